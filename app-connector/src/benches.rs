@@ -0,0 +1,113 @@
+//! Criterion micro-benchmarks for the Connector's packet path.
+//!
+//! Like the Intermediate Server, the Connector is a binary without a library
+//! target, so these run as ignored tests to reach crate-private helpers:
+//!
+//! ```text
+//! cargo test --release bench_ -- --ignored --nocapture --test-threads 1
+//! BENCH_SAVE_BASELINE=main cargo test --release bench_ -- --ignored --test-threads 1
+//! BENCH_BASELINE=main      cargo test --release bench_ -- --ignored --test-threads 1
+//! ```
+
+use std::net::UdpSocket as StdUdpSocket;
+
+use bench_support::criterion;
+use criterion::{BenchmarkId, Throughput};
+
+use super::*;
+
+const PAYLOAD_SIZES: [usize; 3] = [0, 512, DEFAULT_TCP_MSS as usize];
+
+#[test]
+#[ignore = "benchmark; run with --ignored"]
+fn bench_build_tcp_packet() {
+    let mut c = criterion();
+    let mut group = c.benchmark_group("build_tcp_packet");
+    let src = Ipv4Addr::new(10, 100, 0, 1);
+    let dst = Ipv4Addr::new(100, 64, 0, 1);
+
+    for size in PAYLOAD_SIZES {
+        let payload = vec![0xABu8; size];
+        group.throughput(Throughput::Bytes(size.max(1) as u64));
+        group.bench_with_input(BenchmarkId::from_parameter(size), &payload, |b, p| {
+            b.iter(|| build_tcp_packet(src, 80, dst, 54321, 1000, 2000, TCP_PSH | TCP_ACK, 65535, p))
+        });
+    }
+    group.finish();
+    c.final_summary();
+}
+
+#[test]
+#[ignore = "benchmark; run with --ignored"]
+fn bench_tcp_checksum() {
+    let mut c = criterion();
+    let mut group = c.benchmark_group("tcp_checksum");
+    let src = Ipv4Addr::new(10, 100, 0, 1);
+    let dst = Ipv4Addr::new(100, 64, 0, 1);
+
+    for size in PAYLOAD_SIZES {
+        let packet = build_tcp_packet(src, 80, dst, 54321, 1000, 2000, TCP_ACK, 65535, &vec![0x5Au8; size]);
+        let segment = packet[20..].to_vec();
+        group.throughput(Throughput::Bytes(segment.len() as u64));
+        group.bench_with_input(BenchmarkId::from_parameter(size), &segment, |b, seg| {
+            b.iter(|| tcp_checksum(src, dst, seg))
+        });
+    }
+    group.finish();
+    c.final_summary();
+}
+
+#[test]
+#[ignore = "benchmark; run with --ignored"]
+fn bench_forward_to_local() {
+    let mut c = criterion();
+    let mut group = c.benchmark_group("forward_to_local");
+
+    // Backend sink: the kernel drops once its buffer fills, which is fine —
+    // we are measuring the Connector side of sendto().
+    let sink = StdUdpSocket::bind("127.0.0.1:0").unwrap();
+    let mut connector = Connector::new(
+        "127.0.0.1:4433".parse().unwrap(),
+        "bench-service".to_string(),
+        sink.local_addr().unwrap(),
+        None,
+        None,
+        0,
+        None,
+        None,
+        None,
+        false,
+        Arc::new(AtomicBool::new(false)),
+        0,
+        false,
+        DEFAULT_MAX_UDP_PAYLOAD,
+        &congestion::CongestionConfig::default(),
+        &congestion::CongestionConfig::default(),
+        false,
+        0,
+        1,
+        0,
+    )
+    .unwrap();
+
+    let agent_ip = Ipv4Addr::new(100, 64, 0, 1);
+    let service_ip = Ipv4Addr::new(10, 100, 0, 1);
+
+    for size in [64usize, 512, 1200] {
+        let udp = build_udp_packet(agent_ip, 40000, service_ip, 9999, &vec![0u8; size]);
+        group.throughput(Throughput::Bytes(size as u64));
+        group.bench_with_input(BenchmarkId::new("udp", size), &udp, |b, pkt| {
+            b.iter(|| connector.forward_to_local(pkt).is_ok())
+        });
+    }
+
+    // ACK for a flow with no session: header parse + session lookup only
+    let ack = build_tcp_packet(agent_ip, 40000, service_ip, 80, 1, 1, TCP_ACK, 65535, &[]);
+    group.throughput(Throughput::Elements(1));
+    group.bench_with_input(BenchmarkId::new("tcp_ack_no_session", 40), &ack, |b, pkt| {
+        b.iter(|| connector.forward_to_local(pkt).is_ok())
+    });
+
+    group.finish();
+    c.final_summary();
+}
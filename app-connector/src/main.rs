@@ -12,35 +12,62 @@ use std::collections::HashMap;
 use std::io::{self, Read as _, Write as _};
 use std::net::{IpAddr, Ipv4Addr, SocketAddr};
 use std::path::Path;
-use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
 use std::sync::Arc;
 use std::time::{Duration, Instant};
 
 use serde::Deserialize;
 
-use mio::net::{TcpStream as MioTcpStream, UdpSocket};
-use mio::{Events, Interest, Poll, Token};
+use mio::net::UdpSocket;
+use mio::{Events, Interest, Poll, Token, Waker};
 use ring::rand::{SecureRandom, SystemRandom};
+use tunnel_codec::{aggregate, fec, header_compression};
 
+#[cfg(test)]
+mod benches;
 mod metrics;
+mod p2p_listener;
 mod qad;
 mod signaling;
+mod tcp_proxy;
+mod timers;
+mod uplinks;
+mod workers;
 
+use p2p_listener::P2PListener;
 use signaling::{
     decode_message, encode_message, gather_candidates_with_observed, DecodeError,
     P2PSessionManager, SignalingMessage,
 };
+use tcp_proxy::{ProxyConfig, SessionLimit, TcpProxy};
+use timers::{Timer, Timers};
+use uplinks::{Uplink, REG_FLAG_UPLINK};
+use workers::WorkerPool;
 
 // ============================================================================
 // Constants (MUST match Intermediate Server)
 // ============================================================================
 
-/// Maximum UDP payload size for QUIC packets (must match Intermediate Server)
-const MAX_DATAGRAM_SIZE: usize = 1350;
+/// Default ceiling for DPLPMTUD (1500-byte Ethernet MTU less IPv4/UDP
+/// headers; must match Intermediate Server)
+const DEFAULT_MAX_UDP_PAYLOAD: usize = 1472;
+
+/// Accepted range for `--max-udp-payload`
+const MIN_UDP_PAYLOAD: usize = 1200;
+const MAX_UDP_PAYLOAD: usize = 65507;
 
 /// QUIC idle timeout in milliseconds (must match Intermediate Server)
 const IDLE_TIMEOUT_MS: u64 = 30_000;
 
+/// Receive windows advertised at connect; quiche auto-tunes them toward the
+/// path's BDP (doubling a window the peer fills within two RTTs)
+const INITIAL_CONNECTION_WINDOW: u64 = 1024 * 1024;
+const INITIAL_STREAM_WINDOW: u64 = 256 * 1024;
+
+/// Auto-tuning ceilings, sized for high-BDP direct P2P paths
+const MAX_CONNECTION_WINDOW: u64 = 32 * 1024 * 1024;
+const MAX_STREAM_WINDOW: u64 = 16 * 1024 * 1024;
+
 /// Keepalive interval in seconds (should be less than half of idle timeout)
 const KEEPALIVE_INTERVAL_SECS: u64 = 10;
 
@@ -88,13 +115,18 @@ const TCP_PSH: u8 = 0x08;
 /// TCP flag: ACK (acknowledgment)
 const TCP_ACK: u8 = 0x10;
 
-/// Maximum TCP payload per QUIC DATAGRAM: 1350 - 20 (IP) - 20 (TCP)
-const MAX_TCP_PAYLOAD: usize = MAX_DATAGRAM_SIZE - 40;
+/// IPv4 + TCP header bytes wrapped around each segment sent to the Agent
+const TCP_IP_HEADER_LEN: usize = 40;
+
+/// Segment size for Agents whose SYN carries no MSS option (the payload that
+/// fit the old fixed 1350-byte DATAGRAM)
+const DEFAULT_TCP_MSS: u16 = 1310;
 
 /// TCP session idle timeout in seconds
 const TCP_SESSION_TIMEOUT_SECS: u64 = 120;
 
-/// Maximum concurrent TCP proxy sessions (prevents fd exhaustion)
+/// Maximum concurrent TCP proxy sessions, across backend workers (prevents
+/// fd exhaustion)
 const MAX_TCP_SESSIONS: usize = 256;
 
 /// H3: Maximum TCP SYN packets per source IP per second (rate limiting)
@@ -103,6 +135,13 @@ const MAX_SYN_PER_SOURCE_PER_SECOND: u32 = 10;
 /// L6: TCP half-close drain timeout in seconds
 const TCP_DRAIN_TIMEOUT_SECS: u64 = 5;
 
+/// 7A.7: Non-blocking backend connect timeout in seconds
+const TCP_CONNECT_TIMEOUT_SECS: u64 = 5;
+
+/// How often flow mappings, idle TCP sessions and SYN rate windows are aged
+/// while any exist
+const HOUSEKEEPING_INTERVAL: Duration = Duration::from_secs(1);
+
 /// mio token for QUIC socket
 const QUIC_SOCKET_TOKEN: Token = Token(0);
 
@@ -112,6 +151,21 @@ const LOCAL_SOCKET_TOKEN: Token = Token(1);
 /// mio token for the metrics/health HTTP listener
 const METRICS_TOKEN: Token = Token(2);
 
+/// mio token woken by backend workers when they queue packets for Agents
+const WORKERS_TOKEN: Token = Token(3);
+
+/// mio token woken by P2P listener workers when they queue Agent packets
+const P2P_LISTENER_TOKEN: Token = Token(4);
+
+/// Most connections to the Intermediate (`--uplinks`), primary included
+const MAX_UPLINKS: usize = 8;
+
+/// mio tokens of the striped uplink sockets start here
+const FIRST_UPLINK_TOKEN: usize = 5;
+
+/// First mio token for TCP backend sockets proxied on the I/O thread
+const FIRST_TCP_TOKEN: usize = FIRST_UPLINK_TOKEN + MAX_UPLINKS;
+
 // ============================================================================
 // Reconnection Constants
 // ============================================================================
@@ -125,6 +179,17 @@ const RECONNECT_MAX_DELAY_MS: u64 = 30_000;
 /// Backoff multiplier for reconnection delay
 const RECONNECT_BACKOFF_FACTOR: u64 = 2;
 
+/// Backoff before reconnection attempt `attempts + 1`: initial * factor^attempts,
+/// capped, then drawn from its upper half by `jitter` so a fleet of
+/// Connectors cut off together does not reconnect in lockstep.
+fn reconnect_delay(attempts: u32, jitter: u32) -> Duration {
+    let base_ms = RECONNECT_INITIAL_DELAY_MS
+        .saturating_mul(RECONNECT_BACKOFF_FACTOR.saturating_pow(attempts))
+        .min(RECONNECT_MAX_DELAY_MS);
+    let half = base_ms / 2;
+    Duration::from_millis(base_ms - half + jitter as u64 % (half + 1))
+}
+
 // ============================================================================
 // P2P Binding Messages (must match packet_processor::p2p::connectivity)
 // ============================================================================
@@ -191,6 +256,91 @@ fn is_p2p_control_packet(data: &[u8]) -> bool {
     false
 }
 
+/// Answer a P2P control message (keepalive or binding request) from `from`.
+/// Returns the reply to send, if any.
+fn p2p_control_response(data: &[u8], from: SocketAddr) -> Option<Vec<u8>> {
+    // All P2P control messages must start with ZTNA_MAGIC and have at least 2 bytes
+    if data.len() < 2 || data[0] != ZTNA_MAGIC {
+        return None;
+    }
+
+    // Check for keepalive messages: [ZTNA_MAGIC, type, 4-byte nonce] = 6 bytes
+    if data.len() == KEEPALIVE_SIZE {
+        match data[1] {
+            KEEPALIVE_REQUEST => {
+                // Echo back with response type byte, preserving magic prefix and nonce
+                let mut response = vec![0u8; KEEPALIVE_SIZE];
+                response[0] = ZTNA_MAGIC;
+                response[1] = KEEPALIVE_RESPONSE;
+                response[2..].copy_from_slice(&data[2..]);
+                log::trace!("Keepalive response sent to {}", from);
+                return Some(response);
+            }
+            KEEPALIVE_RESPONSE => {
+                log::trace!("Keepalive response from {}", from);
+            }
+            _ => {
+                log::debug!(
+                    "Unknown P2P keepalive-sized message from {} (type=0x{:02x})",
+                    from,
+                    data[1]
+                );
+            }
+        }
+        return None;
+    }
+
+    // Try as binding message (strip ZTNA_MAGIC prefix before deserializing)
+    match bincode::deserialize::<BindingMessage>(&data[1..]) {
+        Ok(BindingMessage::Request(request)) => {
+            log::debug!(
+                "Binding request from {} (txn {:02x}{:02x}{:02x}{:02x})",
+                from,
+                request.transaction_id[0],
+                request.transaction_id[1],
+                request.transaction_id[2],
+                request.transaction_id[3]
+            );
+
+            let response = BindingMessage::Response(BindingResponse {
+                transaction_id: request.transaction_id,
+                success: true,
+                mapped_address: Some(from),
+            });
+
+            let payload = bincode::serialize(&response).ok()?;
+            // Prepend ZTNA_MAGIC to outgoing binding response
+            let mut encoded = Vec::with_capacity(1 + payload.len());
+            encoded.push(ZTNA_MAGIC);
+            encoded.extend_from_slice(&payload);
+            log::debug!(
+                "Binding response sent to {} ({} bytes)",
+                from,
+                encoded.len()
+            );
+            Some(encoded)
+        }
+        Ok(BindingMessage::Response(response)) => {
+            log::debug!(
+                "Binding response from {} (success={})",
+                from,
+                response.success
+            );
+            None
+        }
+        Err(e) => {
+            log::debug!(
+                "Unknown P2P control message from {} (type=0x{:02x}, len={}): {}",
+                from,
+                data[1],
+                data.len(),
+                e
+            );
+            None
+        }
+    }
+}
+
 // ============================================================================
 // Registration State (8A.4)
 // ============================================================================
@@ -233,50 +383,6 @@ impl P2PClient {
     }
 }
 
-/// TCP flow key: (src_ip, src_port, dst_ip, dst_port)
-type FlowKey = (Ipv4Addr, u16, Ipv4Addr, u16);
-
-/// 7A.1: TCP backend connection state for non-blocking connect
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
-enum TcpConnState {
-    /// Non-blocking connect() in progress, waiting for WRITABLE event
-    Connecting,
-    /// Backend TCP connection established
-    Connected,
-}
-
-/// Represents a proxied TCP connection through the ZTNA tunnel
-struct TcpSession {
-    /// Non-blocking TCP connection to the backend service (mio-managed)
-    stream: MioTcpStream,
-    /// mio token for this TCP socket (for event dispatch)
-    mio_token: Token,
-    /// 7A.1: Connection state (Connecting or Connected)
-    conn_state: TcpConnState,
-    /// 7A.7: When the non-blocking connect was initiated (for timeout)
-    connect_started: Instant,
-    /// Our (Connector-side) next sequence number
-    our_seq: u32,
-    /// Agent's next expected sequence number
-    their_seq: u32,
-    /// Agent's source IP (for constructing return packets)
-    agent_ip: Ipv4Addr,
-    /// Agent's source port
-    agent_port: u16,
-    /// Virtual service IP (destination in original packet)
-    service_ip: Ipv4Addr,
-    /// Virtual service port
-    service_port: u16,
-    /// Last activity time for session cleanup
-    last_active: Instant,
-    /// Whether the TCP 3-way handshake is complete (SYN-ACK sent to Agent)
-    established: bool,
-    /// L6: Whether the agent has sent FIN and we are draining backend data
-    draining: bool,
-    /// L6: Deadline for draining to complete (after which session is forcefully removed)
-    drain_deadline: Option<Instant>,
-}
-
 // ============================================================================
 // Configuration
 // ============================================================================
@@ -289,18 +395,35 @@ struct ConnectorConfig {
     ca_cert: Option<String>,
     verify_peer: Option<bool>,
     metrics_port: Option<u16>,
+    enable_profiling: Option<bool>,
+    max_udp_payload: Option<usize>,
+    congestion_control: Option<CongestionClasses>,
+    workers: Option<usize>,
+}
+
+/// Congestion control per connection class
+#[derive(Deserialize, Default)]
+struct CongestionClasses {
+    /// Connection to the Intermediate Server
+    relay: Option<congestion::CongestionConfig>,
+    /// Direct connections accepted from Agents
+    p2p: Option<congestion::CongestionConfig>,
 }
 
 #[derive(Deserialize)]
 struct IntermediateServerConfig {
     host: Option<String>,
     port: Option<u16>,
+    /// Parallel connections carrying tunneled traffic (striped uplinks)
+    uplinks: Option<usize>,
 }
 
 #[derive(Deserialize)]
 struct ServiceConfig {
     id: String,
     backend: Option<String>,
+    /// Offer forward error correction to this service's Agents
+    fec: Option<bool>,
     #[allow(dead_code)]
     protocol: Option<String>,
 }
@@ -310,6 +433,8 @@ struct P2PConfig {
     cert: Option<String>,
     key: Option<String>,
     port: Option<u16>,
+    /// Listener worker threads sharing the port (0 = the QUIC socket)
+    workers: Option<usize>,
 }
 
 fn load_config(path: &str) -> Result<ConnectorConfig, Box<dyn std::error::Error>> {
@@ -338,6 +463,12 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
     // --p2p-key <path>           TLS private key for P2P server mode (overrides config)
     // --p2p-listen-port <port>   Port for P2P connections (overrides config)
     // --external-ip <ip>         Public IP for P2P candidates (for NAT/cloud environments)
+    // --max-udp-payload <bytes>  PMTU discovery ceiling (default 1472; raise for jumbo frames)
+    // --cc <algorithm>           Congestion control toward the Intermediate (reno|cubic|bbr|bbr2)
+    // --p2p-cc <algorithm>       Congestion control for direct Agent connections
+    // --workers <n>              Backend TCP worker threads (default 0: proxy on the I/O thread)
+    // --uplinks <n>              Connections to the Intermediate, striped by flow (default 1)
+    // --p2p-workers <n>          P2P listener threads on SO_REUSEPORT sockets (default 0: shared QUIC socket)
 
     // Load config file if provided (or from default paths)
     let config = if let Some(config_path) = parse_arg(&args, "--config") {
@@ -453,11 +584,89 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         .or(config.metrics_port)
         .unwrap_or(9091);
 
+    // CPU/heap profiling endpoints on the metrics listener (opt-in)
+    let enable_profiling = if args.iter().any(|a| a == "--enable-profiling") {
+        true
+    } else {
+        config.enable_profiling.unwrap_or(false)
+    };
+
+    let max_udp_payload = parse_arg(&args, "--max-udp-payload")
+        .and_then(|s| s.parse().ok())
+        .or(config.max_udp_payload)
+        .unwrap_or(DEFAULT_MAX_UDP_PAYLOAD)
+        .clamp(MIN_UDP_PAYLOAD, MAX_UDP_PAYLOAD);
+
+    // Forward error correction for the service's tunneled traffic (opt-in)
+    let fec = if args.iter().any(|a| a == "--fec") {
+        true
+    } else {
+        first_service.and_then(|s| s.fec).unwrap_or(false)
+    };
+
+    let classes = config.congestion_control.unwrap_or_default();
+    let mut relay_cc = classes.relay.unwrap_or_default();
+    if let Some(algorithm) = parse_arg(&args, "--cc") {
+        relay_cc.algorithm = Some(algorithm);
+    }
+    let mut p2p_cc = classes.p2p.unwrap_or_default();
+    if let Some(algorithm) = parse_arg(&args, "--p2p-cc") {
+        p2p_cc.algorithm = Some(algorithm);
+    }
+
+    // TCP proxying on backend worker threads (0 = on the I/O thread)
+    let workers: usize = parse_arg(&args, "--workers")
+        .and_then(|s| s.parse().ok())
+        .or(config.workers)
+        .unwrap_or(0);
+
+    // Striped uplinks: parallel connections to the Intermediate
+    let uplinks: usize = parse_arg(&args, "--uplinks")
+        .and_then(|s| s.parse().ok())
+        .or_else(|| config_server.and_then(|s| s.uplinks))
+        .unwrap_or(1)
+        .clamp(1, MAX_UPLINKS);
+
+    // Sharded listener for direct Agent connections (0 = on the QUIC socket)
+    let mut p2p_workers: usize = parse_arg(&args, "--p2p-workers")
+        .and_then(|s| s.parse().ok())
+        .or_else(|| p2p_config.and_then(|p| p.workers))
+        .unwrap_or(0);
+    if p2p_workers > 0 && p2p_cert.is_none() {
+        log::warn!("--p2p-workers needs --p2p-cert and --p2p-key; ignored");
+        p2p_workers = 0;
+    }
+    // Only Linux balances a port's packets over SO_REUSEPORT sockets
+    if cfg!(not(target_os = "linux")) && p2p_workers > 1 {
+        log::warn!("--p2p-workers above 1 needs Linux SO_REUSEPORT; using 1");
+        p2p_workers = 1;
+    }
+
     log::info!("  Verify peer: {}", verify_peer);
+    log::info!("  Max UDP payload: {} (PMTU discovery)", max_udp_payload);
+    log::info!("  Congestion control: relay {}, P2P {}", relay_cc, p2p_cc);
+    if fec {
+        log::info!("  FEC: offered to Agents");
+    }
+    if workers > 0 {
+        log::info!("  Backend workers: {}", workers);
+    }
+    if uplinks > 1 {
+        log::info!("  Uplinks: {} (striped by flow)", uplinks);
+    }
+    if p2p_workers > 0 {
+        log::info!("  P2P listener workers: {}", p2p_workers);
+    }
     if metrics_port > 0 {
         log::info!("  Metrics port: {}", metrics_port);
+        if enable_profiling {
+            log::info!("  Profiling: /debug/profile/cpu, /debug/profile/heap");
+        }
     } else {
         log::info!("  Metrics: disabled");
+        if enable_profiling {
+            log::warn!("Profiling requested but the metrics listener is disabled");
+        }
     }
     if !verify_peer {
         log::warn!("TLS peer verification DISABLED — do not use in production");
@@ -485,6 +694,14 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         verify_peer,
         shutdown_flag,
         metrics_port,
+        enable_profiling,
+        max_udp_payload,
+        &relay_cc,
+        &p2p_cc,
+        fec,
+        workers,
+        uplinks,
+        p2p_workers,
     )?;
     connector.run()
 }
@@ -496,6 +713,78 @@ fn parse_arg(args: &[String], flag: &str) -> Option<String> {
         .cloned()
 }
 
+/// Forbid fragmentation of outgoing QUIC packets so DPLPMTUD probes that are
+/// too large for the path are lost (and detected) rather than fragmented.
+/// PROBE mode keeps the kernel's own PMTU cache out of the way.
+#[cfg(target_os = "linux")]
+fn set_dont_fragment(socket: &UdpSocket) -> io::Result<()> {
+    use std::os::unix::io::AsRawFd;
+
+    let value: libc::c_int = libc::IP_PMTUDISC_PROBE;
+    // SAFETY: valid fd and a c_int option value of the advertised length
+    let ret = unsafe {
+        libc::setsockopt(
+            socket.as_raw_fd(),
+            libc::IPPROTO_IP,
+            libc::IP_MTU_DISCOVER,
+            &value as *const libc::c_int as *const libc::c_void,
+            std::mem::size_of::<libc::c_int>() as libc::socklen_t,
+        )
+    };
+    if ret == 0 {
+        Ok(())
+    } else {
+        Err(io::Error::last_os_error())
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+fn set_dont_fragment(_socket: &UdpSocket) -> io::Result<()> {
+    Ok(())
+}
+
+/// quiche configuration for accepting direct connections from Agents
+fn p2p_server_config(
+    cert_path: &str,
+    key_path: &str,
+    ca_cert_path: Option<&str>,
+    verify_peer: bool,
+    max_udp_payload: usize,
+    p2p_cc: &congestion::CongestionConfig,
+) -> Result<quiche::Config, Box<dyn std::error::Error>> {
+    let mut cfg = quiche::Config::new(quiche::PROTOCOL_VERSION)?;
+
+    // Load TLS certificates for server mode
+    cfg.load_cert_chain_from_pem_file(cert_path)?;
+    cfg.load_priv_key_from_pem_file(key_path)?;
+
+    // Same settings as client config
+    cfg.set_application_protos(&[ALPN_PROTOCOL])?;
+    cfg.enable_dgram(true, 1000, 1000);
+    cfg.set_max_idle_timeout(IDLE_TIMEOUT_MS);
+    cfg.set_max_recv_udp_payload_size(max_udp_payload);
+    cfg.set_max_send_udp_payload_size(max_udp_payload);
+    cfg.discover_pmtu(true);
+    p2p_cc.apply(&mut cfg)?;
+    cfg.set_initial_max_data(INITIAL_CONNECTION_WINDOW);
+    cfg.set_initial_max_stream_data_bidi_local(INITIAL_STREAM_WINDOW);
+    cfg.set_initial_max_stream_data_bidi_remote(INITIAL_STREAM_WINDOW);
+    cfg.set_max_connection_window(MAX_CONNECTION_WINDOW);
+    cfg.set_max_stream_window(MAX_STREAM_WINDOW);
+    cfg.set_initial_max_streams_bidi(100);
+    cfg.set_initial_max_streams_uni(100);
+
+    // C1: P2P server TLS — verify connecting Agents' certificates when enabled.
+    cfg.verify_peer(verify_peer);
+    if verify_peer {
+        if let Some(ca_path) = ca_cert_path {
+            cfg.load_verify_locations_from_file(ca_path)?;
+        }
+    }
+
+    Ok(cfg)
+}
+
 // ============================================================================
 // Connector Structure
 // ============================================================================
@@ -509,8 +798,16 @@ struct Connector {
     local_socket: UdpSocket,
     /// QUIC connection to Intermediate Server (client mode)
     intermediate_conn: Option<quiche::Connection>,
+    /// Further connections to the Intermediate carrying tunneled traffic
+    uplinks: Vec<Uplink>,
+    /// Registration the uplinks send (the primary's, plus REG_FLAG_UPLINK)
+    uplink_registration: Vec<u8>,
+    /// Link group ID shared by the primary registration and the uplinks'
+    link_group: Option<u64>,
     /// P2P connections from Agents (server mode)
     p2p_clients: HashMap<quiche::ConnectionId<'static>, P2PClient>,
+    /// Worker threads accepting P2P connections instead (`--p2p-workers`)
+    p2p_listener: Option<P2PListener>,
     /// quiche configuration for client mode (to Intermediate)
     client_config: quiche::Config,
     /// quiche configuration for P2P server mode (optional)
@@ -534,42 +831,60 @@ struct Connector {
     /// Whether registration has been sent to Intermediate
     /// 8A.4: Registration state (replaces old `registered: bool`)
     reg_state: RegistrationState,
+    /// Whether the Intermediate accepts aggregate DATAGRAMs (flag in REG ACK)
+    aggregate_relay: bool,
+    /// Return packets waiting to share a DATAGRAM to the Intermediate
+    batch: aggregate::Aggregator,
+    /// Header compression contexts for return traffic on the relay path
+    compressor: header_compression::Compressor,
+    /// Header compression contexts for Agent traffic on the relay path
+    decompressor: header_compression::Decompressor,
+    /// Whether to offer FEC to Agents (flag in the registration)
+    fec: bool,
+    /// FEC blocks of return traffic on the relay path
+    fec_encoder: fec::Encoder,
+    /// FEC state for Agent traffic on the relay path
+    fec_decoder: fec::Decoder,
     /// Observed public address from QAD
     observed_addr: Option<SocketAddr>,
     /// Mapping from local response source to original agent request
     /// Key: (src_ip, src_port, dst_port) from encapsulated packet
     /// Value: timestamp for cleanup
     flow_map: HashMap<(Ipv4Addr, u16, u16), Instant>,
-    /// Active TCP proxy sessions, keyed by (src_ip, src_port, dst_ip, dst_port)
-    tcp_sessions: HashMap<FlowKey, TcpSession>,
-    /// 7A.2: Next mio token to allocate for TCP backend sockets (starts at 2)
-    next_tcp_token: usize,
-    /// 7A.2: Reverse map from mio Token to FlowKey for event dispatch
-    token_to_flow: HashMap<Token, FlowKey>,
+    /// TCP proxy for Agent flows
+    backend: Backend,
+    /// Largest DATAGRAM the Intermediate connection can send (0 = none),
+    /// published for the TCP proxy's segment sizing
+    max_dgram: Arc<AtomicUsize>,
     /// Buffer for accumulating signaling stream data
     signaling_buffer: Vec<u8>,
     /// P2P session manager
     session_manager: P2PSessionManager,
-    /// Last time we sent a keepalive PING to Intermediate
-    last_keepalive: Instant,
+    /// Deadlines of the periodic jobs in the event loop
+    timers: Timers,
     /// External/public IP for P2P candidates (for NAT/cloud environments like AWS)
     external_ip: Option<std::net::IpAddr>,
-    /// H3: Expected virtual service IP for TCP destination validation.
-    /// When set, TCP SYN packets with a destination IP that does not match are rejected.
-    service_virtual_ip: Option<Ipv4Addr>,
-    /// H3: Per-source-IP TCP SYN rate limiter: maps source IP to (window_start, count)
-    tcp_syn_rates: HashMap<Ipv4Addr, (Instant, u32)>,
-    /// 8B.3: Last time CID rotation was performed
-    last_cid_rotation: Instant,
-    /// Consecutive reconnection attempts (reset to 0 on success)
+    /// Consecutive reconnection attempts (reset to 0 once a handshake completes)
     reconnect_attempts: u32,
+    /// When the next reconnection attempt is due (Intermediate connection down)
+    reconnect_at: Option<Instant>,
     /// Shared shutdown flag — set by SIGTERM handler
     shutdown_flag: Arc<AtomicBool>,
     // Phase 2: Prometheus metrics + health check
-    /// Atomic metrics counters
-    metrics: metrics::Metrics,
+    /// Atomic metrics counters (shared with backend workers)
+    metrics: Arc<metrics::Metrics>,
     /// TCP listener for metrics/health HTTP endpoint (None if disabled)
     metrics_listener: Option<mio::net::TcpListener>,
+    /// `/debug/profile/*` endpoints (None unless profiling is enabled)
+    profiler: Option<profiling::Profiler>,
+}
+
+/// Where the Connector proxies TCP flows to the backend
+enum Backend {
+    /// On the I/O thread, registered on the Connector's poll
+    Inline(Box<TcpProxy>),
+    /// On worker threads, flows sharded by 4-tuple
+    Workers(WorkerPool),
 }
 
 impl Connector {
@@ -587,6 +902,14 @@ impl Connector {
         verify_peer: bool,
         shutdown_flag: Arc<AtomicBool>,
         metrics_port: u16,
+        enable_profiling: bool,
+        max_udp_payload: usize,
+        relay_cc: &congestion::CongestionConfig,
+        p2p_cc: &congestion::CongestionConfig,
+        fec: bool,
+        workers: usize,
+        uplinks: usize,
+        p2p_workers: usize,
     ) -> Result<Self, Box<dyn std::error::Error>> {
         // Create quiche client configuration (for connecting to Intermediate)
         let mut client_config = quiche::Config::new(quiche::PROTOCOL_VERSION)?;
@@ -599,11 +922,15 @@ impl Connector {
 
         // Set timeouts and limits (match Intermediate Server)
         client_config.set_max_idle_timeout(IDLE_TIMEOUT_MS);
-        client_config.set_max_recv_udp_payload_size(MAX_DATAGRAM_SIZE);
-        client_config.set_max_send_udp_payload_size(MAX_DATAGRAM_SIZE);
-        client_config.set_initial_max_data(10_000_000);
-        client_config.set_initial_max_stream_data_bidi_local(1_000_000);
-        client_config.set_initial_max_stream_data_bidi_remote(1_000_000);
+        client_config.set_max_recv_udp_payload_size(max_udp_payload);
+        client_config.set_max_send_udp_payload_size(max_udp_payload);
+        client_config.discover_pmtu(true);
+        relay_cc.apply(&mut client_config)?;
+        client_config.set_initial_max_data(INITIAL_CONNECTION_WINDOW);
+        client_config.set_initial_max_stream_data_bidi_local(INITIAL_STREAM_WINDOW);
+        client_config.set_initial_max_stream_data_bidi_remote(INITIAL_STREAM_WINDOW);
+        client_config.set_max_connection_window(MAX_CONNECTION_WINDOW);
+        client_config.set_max_stream_window(MAX_STREAM_WINDOW);
         client_config.set_initial_max_streams_bidi(100);
         client_config.set_initial_max_streams_uni(100);
 
@@ -621,47 +948,41 @@ impl Connector {
             }
         }
 
-        // Create server config if P2P certificates are provided
-        let server_config = if let (Some(cert_path), Some(key_path)) = (p2p_cert_path, p2p_key_path)
-        {
-            let mut cfg = quiche::Config::new(quiche::PROTOCOL_VERSION)?;
-
-            // Load TLS certificates for server mode
-            cfg.load_cert_chain_from_pem_file(cert_path)?;
-            cfg.load_priv_key_from_pem_file(key_path)?;
-
-            // Same settings as client config
-            cfg.set_application_protos(&[ALPN_PROTOCOL])?;
-            cfg.enable_dgram(true, 1000, 1000);
-            cfg.set_max_idle_timeout(IDLE_TIMEOUT_MS);
-            cfg.set_max_recv_udp_payload_size(MAX_DATAGRAM_SIZE);
-            cfg.set_max_send_udp_payload_size(MAX_DATAGRAM_SIZE);
-            cfg.set_initial_max_data(10_000_000);
-            cfg.set_initial_max_stream_data_bidi_local(1_000_000);
-            cfg.set_initial_max_stream_data_bidi_remote(1_000_000);
-            cfg.set_initial_max_streams_bidi(100);
-            cfg.set_initial_max_streams_uni(100);
-
-            // C1: P2P server TLS — verify connecting Agents' certificates when enabled.
-            cfg.verify_peer(verify_peer);
-            if verify_peer {
-                if let Some(ca_path) = ca_cert_path {
-                    cfg.load_verify_locations_from_file(ca_path)?;
-                }
-            }
-
-            log::info!("P2P server mode enabled with certificates");
-            Some(cfg)
-        } else {
-            None
+        // Direct Agent connections are accepted on the QUIC socket, or by
+        // listener workers on a port of their own
+        let p2p_tls = p2p_cert_path.zip(p2p_key_path);
+        let p2p_workers = if p2p_tls.is_some() { p2p_workers } else { 0 };
+        let server_config = match p2p_tls {
+            Some((cert_path, key_path)) if p2p_workers == 0 => {
+                let cfg = p2p_server_config(
+                    cert_path,
+                    key_path,
+                    ca_cert_path,
+                    verify_peer,
+                    max_udp_payload,
+                    p2p_cc,
+                )?;
+                log::info!("P2P server mode enabled with certificates");
+                Some(cfg)
+            }
+            _ => None,
         };
 
         // Create mio poll
         let poll = Poll::new()?;
 
-        // Create UDP socket for QUIC (bind to P2P port for predictable firewall rules)
-        let local_addr: SocketAddr = format!("0.0.0.0:{}", p2p_port).parse()?;
+        // Create UDP socket for QUIC (bind to P2P port for predictable firewall
+        // rules, unless listener workers own that port)
+        let p2p_addr: SocketAddr = format!("0.0.0.0:{}", p2p_port).parse()?;
+        let local_addr = if p2p_workers > 0 {
+            "0.0.0.0:0".parse()?
+        } else {
+            p2p_addr
+        };
         let mut quic_socket = UdpSocket::bind(local_addr)?;
+        if let Err(e) = set_dont_fragment(&quic_socket) {
+            log::warn!("Failed to set DF on QUIC socket: {}", e);
+        }
 
         // Register QUIC socket with poll
         poll.registry()
@@ -687,51 +1008,142 @@ impl Connector {
             None
         };
 
+        // Striped uplinks each get a socket of their own
+        let mut uplink_list = Vec::new();
+        for id in 1..uplinks.min(MAX_UPLINKS) {
+            let mut socket = UdpSocket::bind("0.0.0.0:0".parse()?)?;
+            if let Err(e) = set_dont_fragment(&socket) {
+                log::warn!("Failed to set DF on uplink socket: {}", e);
+            }
+            poll.registry().register(
+                &mut socket,
+                Token(FIRST_UPLINK_TOKEN + id - 1),
+                Interest::READABLE,
+            )?;
+            uplink_list.push(Uplink::new(id, socket));
+        }
+        // The primary and its uplinks register with one link group ID, so
+        // the Intermediate only pairs them with each other
+        let rng = SystemRandom::new();
+        let link_group = if uplink_list.is_empty() {
+            None
+        } else {
+            let mut group = [0u8; 8];
+            rng.fill(&mut group)
+                .map_err(|_| "Failed to generate link group ID")?;
+            Some(u64::from_be_bytes(group))
+        };
+        let uplink_registration = match link_group {
+            Some(_) => registration_message(
+                &service_id,
+                registration_flags(fec) | REG_FLAG_UPLINK,
+                link_group,
+            )
+            .ok_or("Service ID exceeds 255 bytes")?,
+            None => Vec::new(),
+        };
+
+        let p2p_listener = match p2p_tls {
+            Some((cert_path, key_path)) if p2p_workers > 0 => {
+                let configs = (0..p2p_workers)
+                    .map(|_| {
+                        p2p_server_config(
+                            cert_path,
+                            key_path,
+                            ca_cert_path,
+                            verify_peer,
+                            max_udp_payload,
+                            p2p_cc,
+                        )
+                    })
+                    .collect::<Result<Vec<_>, _>>()?;
+                let io_waker = Arc::new(Waker::new(poll.registry(), P2P_LISTENER_TOKEN)?);
+                let listener = P2PListener::spawn(configs, p2p_addr, io_waker)?;
+                log::info!(
+                    "P2P listener: {} workers on {}",
+                    p2p_workers,
+                    listener.local_addr()
+                );
+                Some(listener)
+            }
+            _ => None,
+        };
+
+        let metrics = Arc::new(metrics::Metrics::new());
+        let max_dgram = Arc::new(AtomicUsize::new(0));
+        let proxy_config = ProxyConfig {
+            forward_addr,
+            service_virtual_ip,
+            metrics: Arc::clone(&metrics),
+            max_dgram: Arc::clone(&max_dgram),
+            sessions: SessionLimit::new(MAX_TCP_SESSIONS),
+        };
+        let backend = if workers > 0 {
+            let io_waker = Arc::new(Waker::new(poll.registry(), WORKERS_TOKEN)?);
+            Backend::Workers(WorkerPool::spawn(workers, &proxy_config, io_waker)?)
+        } else {
+            Backend::Inline(Box::new(TcpProxy::new(
+                poll.registry().try_clone()?,
+                FIRST_TCP_TOKEN,
+                true,
+                &proxy_config,
+            )))
+        };
+
         Ok(Connector {
             poll,
             quic_socket,
             local_socket,
             intermediate_conn: None,
+            uplinks: uplink_list,
+            uplink_registration,
+            link_group,
             p2p_clients: HashMap::new(),
+            p2p_listener,
             client_config,
             server_config,
             server_addr,
             service_id,
             forward_addr,
-            rng: SystemRandom::new(),
+            rng,
             recv_buf: vec![0u8; 65535],
-            send_buf: vec![0u8; MAX_DATAGRAM_SIZE],
+            send_buf: vec![0u8; max_udp_payload],
             stream_buf: vec![0u8; 65535],
             reg_state: RegistrationState::NotRegistered,
+            aggregate_relay: false,
+            batch: aggregate::Aggregator::new(),
+            compressor: header_compression::Compressor::new(),
+            decompressor: header_compression::Decompressor::new(),
+            fec,
+            fec_encoder: fec::Encoder::new(),
+            fec_decoder: fec::Decoder::new(),
             observed_addr: None,
             flow_map: HashMap::new(),
-            tcp_sessions: HashMap::new(),
-            next_tcp_token: 3, // 0 = QUIC, 1 = LOCAL, 2 = METRICS
-            token_to_flow: HashMap::new(),
+            backend,
+            max_dgram,
             signaling_buffer: Vec::new(),
             session_manager: P2PSessionManager::new(),
-            last_keepalive: Instant::now(),
+            timers: Timers::new(),
             external_ip,
-            service_virtual_ip,
-            tcp_syn_rates: HashMap::new(),
-            last_cid_rotation: Instant::now(),
             reconnect_attempts: 0,
+            reconnect_at: None,
             shutdown_flag,
-            metrics: metrics::Metrics::new(),
+            metrics,
+            profiler: if enable_profiling && metrics_listener.is_some() {
+                Some(profiling::Profiler::new()?)
+            } else {
+                None
+            },
             metrics_listener,
         })
     }
 
-    /// 7A.2: Allocate a unique mio Token for a new TCP backend socket
-    fn allocate_tcp_token(&mut self) -> Token {
-        let token = Token(self.next_tcp_token);
-        self.next_tcp_token += 1;
-        token
-    }
-
     fn run(&mut self) -> Result<(), Box<dyn std::error::Error>> {
         // Initiate QUIC connection to Intermediate Server
         self.connect_to_intermediate()?;
+        for uplink in &mut self.uplinks {
+            uplink.connect(&mut self.client_config, self.server_addr, &self.rng)?;
+        }
 
         // Send initial QUIC handshake packet immediately
         self.send_pending()?;
@@ -745,11 +1157,10 @@ impl Connector {
                 break;
             }
 
-            // Calculate timeout based on all connection timeouts
-            let timeout = self
-                .calculate_min_timeout()
-                .map(|t| t.min(Duration::from_millis(100)))
-                .or(Some(Duration::from_millis(100)));
+            // Sleep until the next deadline; nothing runs on a fixed tick. A
+            // SIGTERM landing between the flag check and poll() is seen at
+            // that deadline, at most the keepalive interval away.
+            let timeout = self.calculate_min_timeout();
 
             // Poll for events (EINTR from SIGTERM is expected — continue to check shutdown_flag)
             if let Err(e) = self.poll.poll(&mut events, timeout) {
@@ -760,10 +1171,12 @@ impl Connector {
             }
 
             // Process events
+            let mut quic_input = false;
             for event in events.iter() {
                 match event.token() {
                     QUIC_SOCKET_TOKEN => {
                         self.process_quic_socket()?;
+                        quic_input = true;
                     }
                     LOCAL_SOCKET_TOKEN => {
                         self.process_local_socket()?;
@@ -771,131 +1184,112 @@ impl Connector {
                     METRICS_TOKEN => {
                         self.handle_metrics_accept();
                     }
+                    WORKERS_TOKEN => {
+                        // Returns are tunneled by flush_backend below
+                    }
+                    P2P_LISTENER_TOKEN => {
+                        self.process_p2p_listener()?;
+                    }
+                    Token(t) if (FIRST_UPLINK_TOKEN..FIRST_TCP_TOKEN).contains(&t) => {
+                        self.process_uplink_socket(t - FIRST_UPLINK_TOKEN)?;
+                    }
                     token => {
                         // 7A.4: TCP backend socket event
-                        self.process_tcp_event(token, event)?;
+                        if let Backend::Inline(ref mut proxy) = self.backend {
+                            proxy.process_tcp_event(token, event);
+                        }
                     }
                 }
             }
 
-            // Also check local socket even without events (for edge cases)
-            self.process_local_socket()?;
+            let now = Instant::now();
+
+            // quiche loss detection, PTO and idle timers
+            let quic_timeout = self.process_quic_timeouts(now);
+            self.send_fec_repair(now);
 
-            // 7A.5: Periodic sweep — check TCP connect timeouts, drain deadlines
-            self.sweep_tcp_sessions()?;
+            // 7A.5: TCP connect timeouts, drain deadlines and idle sessions
+            if let Backend::Inline(ref mut proxy) = self.backend {
+                proxy.run_timers(now);
+            }
 
-            // Process timeouts for all connections
-            self.process_timeouts();
+            if self.timers.expired(Timer::Housekeeping, now) {
+                self.housekeeping(now);
+            }
+
+            // Answer a CPU profile request once its sampling window ends
+            if let Some(ref mut profiler) = self.profiler {
+                profiler.poll();
+            }
 
             // Send keepalive to Intermediate if needed
-            self.maybe_send_keepalive();
+            self.maybe_send_keepalive(now);
 
             // 8B.3: Periodic CID rotation for privacy
-            if self.last_cid_rotation.elapsed() >= Duration::from_secs(CID_ROTATION_INTERVAL_SECS) {
+            if self.timers.expired(Timer::CidRotation, now) {
                 self.rotate_connection_ids();
-                self.last_cid_rotation = Instant::now();
+                self.timers.set(
+                    Timer::CidRotation,
+                    now + Duration::from_secs(CID_ROTATION_INTERVAL_SECS),
+                );
             }
 
-            // Send pending packets for all connections
-            self.send_pending()?;
-
-            // Check if we need to register with Intermediate
-            self.maybe_register()?;
-
-            // Process signaling streams from Intermediate
-            self.process_signaling_streams()?;
+            // Connection and stream state only change on QUIC input or a
+            // quiche timeout; registration also retries on its own timer
+            let registration_retry = self.timers.expired(Timer::Registration, now);
+            if quic_input || quic_timeout || registration_retry {
+                self.maybe_register()?;
+            }
+            if quic_input {
+                self.process_signaling_streams()?;
+            }
+            if quic_input || quic_timeout {
+                // FEC block size follows the relay connection's loss rate
+                if let Some(ref conn) = self.intermediate_conn {
+                    let stats = conn.stats();
+                    self.fec_encoder
+                        .observe_loss(stats.sent as u64, stats.lost as u64);
+                }
+                self.cleanup_closed_p2p();
+            }
 
             // Cleanup expired P2P sessions
-            let expired = self.session_manager.cleanup_expired();
-            for session_id in expired {
-                log::debug!("Cleaned up expired P2P session {}", session_id);
+            if self.timers.expired(Timer::SessionExpiry, now) {
+                let expired = self.session_manager.cleanup_expired();
+                for session_id in expired {
+                    log::debug!("Cleaned up expired P2P session {}", session_id);
+                }
+                if let Some(at) = self.session_manager.next_expiry() {
+                    self.timers.set(Timer::SessionExpiry, at);
+                }
             }
 
-            // Check if Intermediate connection is closed — attempt reconnection
-            if let Some(ref conn) = self.intermediate_conn {
-                if conn.is_closed() {
-                    log::warn!("Intermediate connection closed, attempting reconnection...");
-
-                    // Clean up old connection state
-                    self.intermediate_conn = None;
-                    self.reg_state = RegistrationState::NotRegistered;
-                    self.signaling_buffer.clear();
-
-                    // Reconnection loop with exponential backoff
-                    loop {
-                        // Check shutdown before each attempt
-                        if self.shutdown_flag.load(Ordering::Relaxed) {
-                            log::info!("Shutdown signal received during reconnection");
-                            return Ok(());
-                        }
-
-                        // Calculate backoff delay: initial * factor^attempts, capped
-                        let delay_ms = RECONNECT_INITIAL_DELAY_MS
-                            .saturating_mul(
-                                RECONNECT_BACKOFF_FACTOR.saturating_pow(self.reconnect_attempts),
-                            )
-                            .min(RECONNECT_MAX_DELAY_MS);
-
-                        log::info!(
-                            "Reconnect attempt {} — waiting {}ms before retry",
-                            self.reconnect_attempts + 1,
-                            delay_ms
-                        );
-
-                        // Sleep in short intervals so SIGTERM is responsive
-                        let mut remaining_ms = delay_ms;
-                        while remaining_ms > 0 {
-                            let chunk = remaining_ms.min(500);
-                            std::thread::sleep(Duration::from_millis(chunk));
-                            remaining_ms = remaining_ms.saturating_sub(chunk);
-                            if self.shutdown_flag.load(Ordering::Relaxed) {
-                                log::info!("Shutdown signal received during reconnection backoff");
-                                return Ok(());
-                            }
-                        }
-
-                        self.reconnect_attempts += 1;
+            // Replace a closed Intermediate connection once its backoff expires
+            self.maybe_reconnect();
+
+            // Uplink registration (once the primary is registered, as the
+            // Intermediate requires), keepalives and reconnects
+            let primary_registered = matches!(self.reg_state, RegistrationState::Registered);
+            for uplink in &mut self.uplinks {
+                uplink.on_timers(
+                    now,
+                    &mut self.client_config,
+                    self.server_addr,
+                    &self.uplink_registration,
+                    primary_registered,
+                    &self.rng,
+                );
+            }
 
-                        match self.connect_to_intermediate() {
-                            Ok(()) => {
-                                // Send initial handshake packet for the new connection
-                                if let Err(e) = self.send_pending() {
-                                    log::error!("Failed to send handshake after reconnect: {}", e);
-                                    self.intermediate_conn = None;
-                                    continue;
-                                }
-                                self.metrics
-                                    .reconnections_total
-                                    .fetch_add(1, Ordering::Relaxed);
-                                log::info!(
-                                    "Successfully reconnected to Intermediate Server \
-                                     (after {} attempt{})",
-                                    self.reconnect_attempts,
-                                    if self.reconnect_attempts == 1 {
-                                        ""
-                                    } else {
-                                        "s"
-                                    }
-                                );
-                                self.reconnect_attempts = 0;
-                                self.last_keepalive = Instant::now();
-                                self.last_cid_rotation = Instant::now();
-                                break;
-                            }
-                            Err(e) => {
-                                log::error!(
-                                    "Reconnection attempt {} failed: {}",
-                                    self.reconnect_attempts,
-                                    e
-                                );
-                            }
-                        }
-                    }
-                }
+            if !self.timers.is_armed(Timer::Housekeeping) && self.has_aging_state() {
+                self.timers
+                    .set(Timer::Housekeeping, now + HOUSEKEEPING_INTERVAL);
             }
 
-            // Clean up closed P2P connections
-            self.cleanup_closed_p2p();
+            self.flush_backend()?;
+
+            // Send pending packets for all connections
+            self.send_pending()?;
         }
 
         Ok(())
@@ -910,9 +1304,118 @@ impl Connector {
             }
         }
 
+        if let Some(deadline) = self.fec_encoder.deadline() {
+            let t = deadline.saturating_duration_since(Instant::now());
+            min_timeout = Some(min_timeout.map_or(t, |m| m.min(t)));
+        }
+
+        if let Some(at) = self.reconnect_at {
+            let t = at.saturating_duration_since(Instant::now());
+            min_timeout = Some(min_timeout.map_or(t, |m| m.min(t)));
+        }
+
+        for uplink in &self.uplinks {
+            if let Some(at) = uplink.next_deadline() {
+                let t = at.saturating_duration_since(Instant::now());
+                min_timeout = Some(min_timeout.map_or(t, |m| m.min(t)));
+            }
+        }
+
+        if let Some(at) = self.timers.next() {
+            let t = at.saturating_duration_since(Instant::now());
+            min_timeout = Some(min_timeout.map_or(t, |m| m.min(t)));
+        }
+
+        if let Backend::Inline(ref proxy) = self.backend {
+            if let Some(at) = proxy.next_deadline() {
+                let t = at.saturating_duration_since(Instant::now());
+                min_timeout = Some(min_timeout.map_or(t, |m| m.min(t)));
+            }
+        }
+
+        if let Some(t) = self.profiler.as_ref().and_then(|p| p.timeout()) {
+            min_timeout = Some(min_timeout.map_or(t, |m| m.min(t)));
+        }
+
         min_timeout
     }
 
+    /// Drive the Intermediate reconnection state machine
+    ///
+    /// Connected → (closed) → waiting for `reconnect_at` → connecting →
+    /// connected once the handshake completes. The wait is a poll timeout,
+    /// not a sleep, so P2P tunnels and backend flows keep running while the
+    /// relay link is down.
+    fn maybe_reconnect(&mut self) {
+        match self.intermediate_conn {
+            Some(ref conn) if conn.is_closed() => {
+                log::warn!("Intermediate connection closed, scheduling reconnection");
+                self.intermediate_conn = None;
+                self.reg_state = RegistrationState::NotRegistered;
+                self.signaling_buffer.clear();
+                self.schedule_reconnect();
+            }
+            Some(ref conn) if conn.is_established() && self.reconnect_attempts > 0 => {
+                self.metrics
+                    .reconnections_total
+                    .fetch_add(1, Ordering::Relaxed);
+                log::info!(
+                    "Successfully reconnected to Intermediate Server (after {} attempt{})",
+                    self.reconnect_attempts,
+                    if self.reconnect_attempts == 1 {
+                        ""
+                    } else {
+                        "s"
+                    }
+                );
+                self.reconnect_attempts = 0;
+            }
+            Some(_) => {}
+            None => {
+                let due = self.reconnect_at.is_some_and(|at| Instant::now() >= at);
+                if !due {
+                    return;
+                }
+                self.reconnect_at = None;
+                self.reconnect_attempts += 1;
+                let result = self
+                    .connect_to_intermediate()
+                    .and_then(|()| self.send_pending());
+                match result {
+                    Ok(()) => {
+                        log::info!(
+                            "Reconnect attempt {}: handshake started",
+                            self.reconnect_attempts
+                        );
+                    }
+                    Err(e) => {
+                        log::error!(
+                            "Reconnection attempt {} failed: {}",
+                            self.reconnect_attempts,
+                            e
+                        );
+                        self.intermediate_conn = None;
+                        self.schedule_reconnect();
+                    }
+                }
+            }
+        }
+    }
+
+    /// Set `reconnect_at` from the backoff for the attempts made so far
+    fn schedule_reconnect(&mut self) {
+        let mut jitter = [0u8; 4];
+        // A failed RNG only costs the jitter
+        let _ = self.rng.fill(&mut jitter);
+        let delay = reconnect_delay(self.reconnect_attempts, u32::from_ne_bytes(jitter));
+        log::info!(
+            "Reconnect attempt {} in {}ms",
+            self.reconnect_attempts + 1,
+            delay.as_millis()
+        );
+        self.reconnect_at = Some(Instant::now() + delay);
+    }
+
     fn connect_to_intermediate(&mut self) -> Result<(), Box<dyn std::error::Error>> {
         // Generate connection ID
         let mut scid = [0u8; quiche::MAX_CONN_ID_LEN];
@@ -939,6 +1442,22 @@ impl Connector {
 
         self.intermediate_conn = Some(conn);
         self.reg_state = RegistrationState::NotRegistered;
+        self.aggregate_relay = false;
+        self.batch = aggregate::Aggregator::new();
+        self.compressor = header_compression::Compressor::new();
+        self.decompressor = header_compression::Decompressor::new();
+        self.fec_encoder = fec::Encoder::new();
+        self.fec_decoder = fec::Decoder::new();
+
+        let now = Instant::now();
+        self.timers.set(
+            Timer::Keepalive,
+            now + Duration::from_secs(KEEPALIVE_INTERVAL_SECS),
+        );
+        self.timers.set(
+            Timer::CidRotation,
+            now + Duration::from_secs(CID_ROTATION_INTERVAL_SECS),
+        );
 
         Ok(())
     }
@@ -1068,83 +1587,8 @@ impl Connector {
         data: &[u8],
         from: SocketAddr,
     ) -> Result<(), Box<dyn std::error::Error>> {
-        // All P2P control messages must start with ZTNA_MAGIC and have at least 2 bytes
-        if data.len() < 2 || data[0] != ZTNA_MAGIC {
-            return Ok(());
-        }
-
-        // Check for keepalive messages: [ZTNA_MAGIC, type, 4-byte nonce] = 6 bytes
-        if data.len() == KEEPALIVE_SIZE {
-            match data[1] {
-                KEEPALIVE_REQUEST => {
-                    // Echo back with response type byte, preserving magic prefix and nonce
-                    let mut response = [0u8; KEEPALIVE_SIZE];
-                    response[0] = ZTNA_MAGIC;
-                    response[1] = KEEPALIVE_RESPONSE;
-                    response[2..].copy_from_slice(&data[2..]);
-                    self.quic_socket.send_to(&response, from)?;
-                    log::trace!("Keepalive response sent to {}", from);
-                }
-                KEEPALIVE_RESPONSE => {
-                    log::trace!("Keepalive response from {}", from);
-                }
-                _ => {
-                    log::debug!(
-                        "Unknown P2P keepalive-sized message from {} (type=0x{:02x})",
-                        from,
-                        data[1]
-                    );
-                }
-            }
-        } else {
-            // Try as binding message (strip ZTNA_MAGIC prefix before deserializing)
-            match bincode::deserialize::<BindingMessage>(&data[1..]) {
-                Ok(BindingMessage::Request(request)) => {
-                    log::debug!(
-                        "Binding request from {} (txn {:02x}{:02x}{:02x}{:02x})",
-                        from,
-                        request.transaction_id[0],
-                        request.transaction_id[1],
-                        request.transaction_id[2],
-                        request.transaction_id[3]
-                    );
-
-                    let response = BindingMessage::Response(BindingResponse {
-                        transaction_id: request.transaction_id,
-                        success: true,
-                        mapped_address: Some(from),
-                    });
-
-                    if let Ok(payload) = bincode::serialize(&response) {
-                        // Prepend ZTNA_MAGIC to outgoing binding response
-                        let mut encoded = Vec::with_capacity(1 + payload.len());
-                        encoded.push(ZTNA_MAGIC);
-                        encoded.extend_from_slice(&payload);
-                        self.quic_socket.send_to(&encoded, from)?;
-                        log::debug!(
-                            "Binding response sent to {} ({} bytes)",
-                            from,
-                            encoded.len()
-                        );
-                    }
-                }
-                Ok(BindingMessage::Response(response)) => {
-                    log::debug!(
-                        "Binding response from {} (success={})",
-                        from,
-                        response.success
-                    );
-                }
-                Err(e) => {
-                    log::debug!(
-                        "Unknown P2P control message from {} (type=0x{:02x}, len={}): {}",
-                        from,
-                        data[1],
-                        data.len(),
-                        e
-                    );
-                }
-            }
+        if let Some(response) = p2p_control_response(data, from) {
+            self.quic_socket.send_to(&response, from)?;
         }
         Ok(())
     }
@@ -1207,7 +1651,7 @@ impl Connector {
 
         // Collect DATAGRAMs from Intermediate connection
         if let Some(ref mut conn) = self.intermediate_conn {
-            let mut buf = vec![0u8; MAX_DATAGRAM_SIZE];
+            let mut buf = vec![0u8; self.send_buf.len()];
             loop {
                 match conn.dgram_recv(&mut buf) {
                     Ok(len) => {
@@ -1242,7 +1686,7 @@ impl Connector {
                 }
                 REG_TYPE_ACK => {
                     // 8A.5: Registration ACK from server
-                    // Format: [0x12, status, id_len, service_id_bytes...]
+                    // Format: [0x12, status, id_len, service_id_bytes..., flags?]
                     if dgram.len() >= 3 {
                         let id_len = dgram[2] as usize;
                         if dgram.len() >= 3 + id_len {
@@ -1250,6 +1694,9 @@ impl Connector {
                                 if sid == self.service_id {
                                     log::info!("Registration ACK received for service '{}'", sid);
                                     self.reg_state = RegistrationState::Registered;
+                                    let flags = dgram.get(3 + id_len).copied().unwrap_or(0);
+                                    self.aggregate_relay =
+                                        flags & aggregate::REG_FLAG_AGGREGATE != 0;
                                 } else {
                                     log::debug!("Ignoring ACK for unknown service '{}'", sid);
                                 }
@@ -1281,12 +1728,46 @@ impl Connector {
                     }
                 }
                 _ => {
-                    // Encapsulated IP packet - forward to local service
-                    self.forward_to_local(&dgram)?;
+                    // Encapsulated IP packet(s) - forward to local service
+                    self.receive_tunneled(&dgram)?;
+                }
+            }
+        }
+
+        Ok(())
+    }
+
+    /// Forward the packets of a tunneled DATAGRAM from the relay path (the
+    /// primary connection or an uplink) to the local service. FEC repairs
+    /// rebuild lost packets, then headers are restored.
+    fn receive_tunneled(&mut self, dgram: &[u8]) -> Result<(), Box<dyn std::error::Error>> {
+        let recovered = self.fec_decoder.recovered();
+        for packet in aggregate::unpack(dgram) {
+            for packet in self.fec_decoder.decode(packet).into_packets() {
+                match self.decompressor.decompress(&packet) {
+                    Some(packet) => self.forward_to_local(&packet)?,
+                    None => {
+                        log::debug!("Dropping compressed packet for unknown context");
+                    }
                 }
             }
         }
+        self.metrics
+            .fec_recovered_total
+            .fetch_add(self.fec_decoder.recovered() - recovered, Ordering::Relaxed);
+        Ok(())
+    }
 
+    /// Read an uplink's socket and forward what it tunneled
+    fn process_uplink_socket(&mut self, index: usize) -> Result<(), Box<dyn std::error::Error>> {
+        let uplink = match self.uplinks.get_mut(index) {
+            Some(uplink) => uplink,
+            None => return Ok(()),
+        };
+        let dgrams = uplink.recv(&mut self.recv_buf, &self.service_id)?;
+        for dgram in dgrams {
+            self.receive_tunneled(&dgram)?;
+        }
         Ok(())
     }
 
@@ -1300,7 +1781,7 @@ impl Connector {
 
         // Collect DATAGRAMs from P2P client
         if let Some(client) = self.p2p_clients.get_mut(conn_id) {
-            let mut buf = vec![0u8; MAX_DATAGRAM_SIZE];
+            let mut buf = vec![0u8; self.send_buf.len()];
             while let Ok(len) = client.conn.dgram_recv(&mut buf) {
                 dgrams.push(buf[..len].to_vec());
             }
@@ -1340,6 +1821,18 @@ impl Connector {
         Ok(())
     }
 
+    /// Forward the packets P2P listener workers received from Agents
+    fn process_p2p_listener(&mut self) -> Result<(), Box<dyn std::error::Error>> {
+        let packets = match self.p2p_listener {
+            Some(ref mut listener) => listener.take_packets(),
+            None => return Ok(()),
+        };
+        for packet in packets {
+            self.forward_to_local(&packet)?;
+        }
+        Ok(())
+    }
+
     fn send_qad_to_p2p_client(
         &mut self,
         conn_id: &quiche::ConnectionId<'static>,
@@ -1394,7 +1887,15 @@ impl Connector {
 
         // Handle TCP (protocol 6)
         if protocol == 6 {
-            return self.handle_tcp_packet(dgram, ip_header_len, src_ip, dst_ip);
+            match self.backend {
+                Backend::Inline(ref mut proxy) => {
+                    proxy.handle_tcp_packet(dgram, ip_header_len, src_ip, dst_ip)
+                }
+                Backend::Workers(ref mut pool) => {
+                    pool.dispatch(dgram, ip_header_len);
+                }
+            }
+            return Ok(());
         }
 
         // Handle ICMP (protocol 1)
@@ -1472,358 +1973,6 @@ impl Connector {
         Ok(())
     }
 
-    fn handle_tcp_packet(
-        &mut self,
-        dgram: &[u8],
-        ip_header_len: usize,
-        src_ip: Ipv4Addr,
-        dst_ip: Ipv4Addr,
-    ) -> Result<(), Box<dyn std::error::Error>> {
-        if dgram.len() < ip_header_len + 20 {
-            log::debug!("TCP header truncated");
-            return Ok(());
-        }
-
-        let tcp_start = ip_header_len;
-        let src_port = u16::from_be_bytes([dgram[tcp_start], dgram[tcp_start + 1]]);
-        let dst_port = u16::from_be_bytes([dgram[tcp_start + 2], dgram[tcp_start + 3]]);
-        let seq_num = u32::from_be_bytes([
-            dgram[tcp_start + 4],
-            dgram[tcp_start + 5],
-            dgram[tcp_start + 6],
-            dgram[tcp_start + 7],
-        ]);
-        let _ack_num = u32::from_be_bytes([
-            dgram[tcp_start + 8],
-            dgram[tcp_start + 9],
-            dgram[tcp_start + 10],
-            dgram[tcp_start + 11],
-        ]);
-        let data_offset = ((dgram[tcp_start + 12] >> 4) & 0x0F) as usize * 4;
-        let flags = dgram[tcp_start + 13];
-
-        let payload_start = ip_header_len + data_offset;
-        let payload = if dgram.len() > payload_start {
-            &dgram[payload_start..]
-        } else {
-            &[]
-        };
-
-        let flow_key = (src_ip, src_port, dst_ip, dst_port);
-        let mut packets_to_send: Vec<Vec<u8>> = Vec::new();
-
-        if flags & TCP_SYN != 0 && flags & TCP_ACK == 0 {
-            // H3: Validate destination IP matches expected virtual service IP
-            if let Some(expected_ip) = self.service_virtual_ip {
-                if dst_ip != expected_ip {
-                    log::warn!(
-                        "TCP SYN to unexpected destination {}, expected {}. Sending RST.",
-                        dst_ip,
-                        expected_ip
-                    );
-                    packets_to_send.push(build_tcp_packet(
-                        dst_ip,
-                        dst_port,
-                        src_ip,
-                        src_port,
-                        0,
-                        seq_num.wrapping_add(1),
-                        TCP_RST | TCP_ACK,
-                        0,
-                        &[],
-                    ));
-                    for packet in &packets_to_send {
-                        self.send_ip_packet(packet)?;
-                    }
-                    return Ok(());
-                }
-            }
-
-            // H3: Per-source-IP SYN rate limiting
-            let now = Instant::now();
-            let rate_entry = self.tcp_syn_rates.entry(src_ip).or_insert((now, 0));
-            if now.duration_since(rate_entry.0).as_secs() >= 1 {
-                // Reset window
-                *rate_entry = (now, 1);
-            } else {
-                rate_entry.1 += 1;
-                if rate_entry.1 > MAX_SYN_PER_SOURCE_PER_SECOND {
-                    log::warn!(
-                        "TCP SYN rate limit exceeded for {} ({}/s), sending RST",
-                        src_ip,
-                        rate_entry.1
-                    );
-                    packets_to_send.push(build_tcp_packet(
-                        dst_ip,
-                        dst_port,
-                        src_ip,
-                        src_port,
-                        0,
-                        seq_num.wrapping_add(1),
-                        TCP_RST | TCP_ACK,
-                        0,
-                        &[],
-                    ));
-                    for packet in &packets_to_send {
-                        self.send_ip_packet(packet)?;
-                    }
-                    return Ok(());
-                }
-            }
-
-            // B3: Reject new connections when at capacity (prevents fd exhaustion)
-            if self.tcp_sessions.len() >= MAX_TCP_SESSIONS {
-                log::warn!(
-                    "TCP session limit ({}) reached, sending RST to {}:{}",
-                    MAX_TCP_SESSIONS,
-                    src_ip,
-                    src_port
-                );
-                packets_to_send.push(build_tcp_packet(
-                    dst_ip,
-                    dst_port,
-                    src_ip,
-                    src_port,
-                    0,
-                    seq_num.wrapping_add(1),
-                    TCP_RST | TCP_ACK,
-                    0,
-                    &[],
-                ));
-                for packet in &packets_to_send {
-                    self.send_ip_packet(packet)?;
-                }
-                return Ok(());
-            }
-
-            // SYN - new connection request
-            log::debug!(
-                "TCP SYN: {}:{} -> {}:{} (seq={})",
-                src_ip,
-                src_port,
-                dst_ip,
-                dst_port,
-                seq_num
-            );
-
-            // 7A.3: Clean up any existing session for this flow (duplicate SYN)
-            if let Some(mut old_session) = self.tcp_sessions.remove(&flow_key) {
-                let _ = self.poll.registry().deregister(&mut old_session.stream);
-                self.token_to_flow.remove(&old_session.mio_token);
-                log::debug!("Replaced existing TCP session for flow {:?}", flow_key);
-            }
-
-            // 7A.3: Non-blocking connect via mio — returns immediately,
-            // connect completes asynchronously. SYN-ACK deferred until WRITABLE event.
-            match MioTcpStream::connect(self.forward_addr) {
-                Ok(mut stream) => {
-                    // Set TCP_NODELAY for low-latency proxying
-                    let _ = stream.set_nodelay(true);
-
-                    // Allocate mio token and register for WRITABLE (connect completion)
-                    let token = self.allocate_tcp_token();
-                    if let Err(e) =
-                        self.poll
-                            .registry()
-                            .register(&mut stream, token, Interest::WRITABLE)
-                    {
-                        log::warn!("Failed to register TCP socket with mio: {}", e);
-                        packets_to_send.push(build_tcp_packet(
-                            dst_ip,
-                            dst_port,
-                            src_ip,
-                            src_port,
-                            0,
-                            seq_num.wrapping_add(1),
-                            TCP_RST | TCP_ACK,
-                            0,
-                            &[],
-                        ));
-                    } else {
-                        let our_isn: u32 = {
-                            let mut buf = [0u8; 4];
-                            let _ = self.rng.fill(&mut buf);
-                            u32::from_be_bytes(buf)
-                        };
-
-                        let now = Instant::now();
-                        let session = TcpSession {
-                            stream,
-                            mio_token: token,
-                            conn_state: TcpConnState::Connecting,
-                            connect_started: now,
-                            our_seq: our_isn.wrapping_add(1),
-                            their_seq: seq_num.wrapping_add(1),
-                            agent_ip: src_ip,
-                            agent_port: src_port,
-                            service_ip: dst_ip,
-                            service_port: dst_port,
-                            last_active: now,
-                            established: false,
-                            draining: false,
-                            drain_deadline: None,
-                        };
-
-                        self.token_to_flow.insert(token, flow_key);
-                        self.tcp_sessions.insert(flow_key, session);
-                        self.metrics
-                            .tcp_sessions_total
-                            .fetch_add(1, Ordering::Relaxed);
-                        log::debug!(
-                            "TCP non-blocking connect initiated to {} (token={:?})",
-                            self.forward_addr,
-                            token
-                        );
-                    }
-                }
-                Err(e) => {
-                    log::warn!("TCP connect to {} failed: {}", self.forward_addr, e);
-                    self.metrics
-                        .tcp_errors_total
-                        .fetch_add(1, Ordering::Relaxed);
-                    packets_to_send.push(build_tcp_packet(
-                        dst_ip,
-                        dst_port,
-                        src_ip,
-                        src_port,
-                        0,
-                        seq_num.wrapping_add(1),
-                        TCP_RST | TCP_ACK,
-                        0,
-                        &[],
-                    ));
-                }
-            }
-        } else if flags & TCP_RST != 0 {
-            // 7A.6: Clean up mio registration on RST
-            if let Some(mut session) = self.tcp_sessions.remove(&flow_key) {
-                let _ = self.poll.registry().deregister(&mut session.stream);
-                self.token_to_flow.remove(&session.mio_token);
-                log::debug!("TCP session reset: {}:{}", src_ip, src_port);
-            }
-        } else if flags & TCP_FIN != 0 {
-            // L6: TCP half-close draining — don't immediately remove the session.
-            // Shut down the write half to the backend and enter draining state so we
-            // can read any remaining response data before tearing down.
-            if let Some(session) = self.tcp_sessions.get_mut(&flow_key) {
-                // ACK the FIN
-                session.their_seq = seq_num.wrapping_add(1 + payload.len() as u32);
-                packets_to_send.push(build_tcp_packet(
-                    dst_ip,
-                    dst_port,
-                    src_ip,
-                    src_port,
-                    session.our_seq,
-                    session.their_seq,
-                    TCP_ACK,
-                    65535,
-                    &[],
-                ));
-
-                // Shut down the write half of the backend TcpStream
-                let _ = session.stream.shutdown(std::net::Shutdown::Write);
-                session.draining = true;
-                session.drain_deadline =
-                    Some(Instant::now() + Duration::from_secs(TCP_DRAIN_TIMEOUT_SECS));
-                log::debug!(
-                    "TCP half-close: {}:{} entering drain state ({}s timeout)",
-                    src_ip,
-                    src_port,
-                    TCP_DRAIN_TIMEOUT_SECS
-                );
-            }
-        } else if flags & TCP_ACK != 0 {
-            let mut remove_session = false;
-
-            if let Some(session) = self.tcp_sessions.get_mut(&flow_key) {
-                session.last_active = Instant::now();
-
-                // Don't forward data while backend connect is still in progress
-                if session.conn_state == TcpConnState::Connecting {
-                    log::trace!(
-                        "TCP ACK received while connecting, buffering for {}:{}",
-                        src_ip,
-                        src_port
-                    );
-                } else {
-                    if !session.established {
-                        session.established = true;
-                        log::debug!("TCP session established: {}:{}", src_ip, src_port);
-                    }
-
-                    // L6: Don't forward data to backend if session is draining
-                    // (write half already shut down)
-                    if !payload.is_empty() && !session.draining {
-                        match session.stream.write(payload) {
-                            Ok(n) => {
-                                self.metrics
-                                    .forwarded_packets_total
-                                    .fetch_add(1, Ordering::Relaxed);
-                                self.metrics
-                                    .forwarded_bytes_total
-                                    .fetch_add(n as u64, Ordering::Relaxed);
-                                session.their_seq = seq_num.wrapping_add(n as u32);
-                                packets_to_send.push(build_tcp_packet(
-                                    dst_ip,
-                                    dst_port,
-                                    src_ip,
-                                    src_port,
-                                    session.our_seq,
-                                    session.their_seq,
-                                    TCP_ACK,
-                                    65535,
-                                    &[],
-                                ));
-                                log::trace!(
-                                    "TCP forwarded {} bytes to backend for {}:{}",
-                                    n,
-                                    src_ip,
-                                    src_port
-                                );
-                            }
-                            Err(ref e) if e.kind() == io::ErrorKind::WouldBlock => {
-                                // Backend buffer full - don't ACK, agent retransmits
-                                log::trace!("TCP write WouldBlock for {}:{}", src_ip, src_port);
-                            }
-                            Err(e) => {
-                                self.metrics
-                                    .tcp_errors_total
-                                    .fetch_add(1, Ordering::Relaxed);
-                                log::debug!("TCP write to backend failed: {}", e);
-                                packets_to_send.push(build_tcp_packet(
-                                    dst_ip,
-                                    dst_port,
-                                    src_ip,
-                                    src_port,
-                                    session.our_seq,
-                                    seq_num.wrapping_add(payload.len() as u32),
-                                    TCP_RST | TCP_ACK,
-                                    0,
-                                    &[],
-                                ));
-                                remove_session = true;
-                            }
-                        }
-                    }
-                }
-            }
-
-            if remove_session {
-                // 7A.6: Clean up mio registration on session removal
-                if let Some(mut session) = self.tcp_sessions.remove(&flow_key) {
-                    let _ = self.poll.registry().deregister(&mut session.stream);
-                    self.token_to_flow.remove(&session.mio_token);
-                }
-            }
-        }
-
-        for packet in packets_to_send {
-            self.send_ip_packet(&packet)?;
-        }
-
-        Ok(())
-    }
-
     fn handle_icmp_packet(
         &mut self,
         dgram: &[u8],
@@ -1868,9 +2017,35 @@ impl Connector {
         Ok(())
     }
 
+    /// Tunnel the TCP proxy's packets for Agents, and publish the current
+    /// DATAGRAM size for the segments it builds next
+    fn flush_backend(&mut self) -> Result<(), Box<dyn std::error::Error>> {
+        // Segments must fit whichever link their flow is striped onto
+        let max_dgram = self
+            .intermediate_conn
+            .iter()
+            .chain(self.uplinks.iter().filter_map(|u| u.conn.as_ref()))
+            .filter_map(|c| c.dgram_max_writable_len())
+            .min()
+            .unwrap_or(0);
+        self.max_dgram.store(max_dgram, Ordering::Relaxed);
+
+        let packets = match self.backend {
+            Backend::Inline(ref mut proxy) => proxy.take_output(),
+            Backend::Workers(ref mut pool) => {
+                pool.wake();
+                pool.take_returns()
+            }
+        };
+        for packet in packets {
+            self.send_ip_packet(&packet)?;
+        }
+        Ok(())
+    }
+
     fn send_ip_packet(&mut self, packet: &[u8]) -> Result<(), Box<dyn std::error::Error>> {
-        if let Some(ref mut conn) = self.intermediate_conn {
-            match conn.dgram_send(packet) {
+        if self.relay_connected() {
+            match self.send_return(packet) {
                 Ok(_) => {
                     log::trace!("Sent {} byte IP packet via QUIC", packet.len());
                 }
@@ -1882,281 +2057,73 @@ impl Connector {
         Ok(())
     }
 
-    /// 7A.4: Handle a mio event for a TCP backend socket.
-    ///
-    /// Dispatches based on connection state:
-    /// - Connecting + WRITABLE → check connect result via peer_addr()
-    /// - Connected + READABLE → read data from backend, forward to Agent via QUIC
-    /// - Connected + WRITABLE → backend is writable (no-op, writes happen inline in handle_tcp_packet)
-    fn process_tcp_event(
-        &mut self,
-        token: Token,
-        event: &mio::event::Event,
-    ) -> Result<(), Box<dyn std::error::Error>> {
-        // Look up the flow key for this token
-        let flow_key = match self.token_to_flow.get(&token) {
-            Some(fk) => *fk,
-            None => {
-                log::trace!("mio event for unknown TCP token {:?}", token);
-                return Ok(());
-            }
-        };
-
-        let mut packets_to_send: Vec<Vec<u8>> = Vec::new();
-        let mut remove_session = false;
-
-        if let Some(session) = self.tcp_sessions.get_mut(&flow_key) {
-            match session.conn_state {
-                TcpConnState::Connecting => {
-                    if event.is_writable() {
-                        // 7A.4: Check if connect succeeded by calling peer_addr()
-                        match session.stream.peer_addr() {
-                            Ok(_addr) => {
-                                // Connect succeeded — transition to Connected
-                                session.conn_state = TcpConnState::Connected;
-                                session.last_active = Instant::now();
-
-                                // Re-register for READABLE | WRITABLE
-                                if let Err(e) = self.poll.registry().reregister(
-                                    &mut session.stream,
-                                    session.mio_token,
-                                    Interest::READABLE | Interest::WRITABLE,
-                                ) {
-                                    log::warn!("Failed to reregister TCP socket: {}", e);
-                                    remove_session = true;
-                                } else {
-                                    // Send SYN-ACK to Agent now that backend is connected
-                                    let our_isn = session.our_seq.wrapping_sub(1);
-                                    packets_to_send.push(build_tcp_packet(
-                                        session.service_ip,
-                                        session.service_port,
-                                        session.agent_ip,
-                                        session.agent_port,
-                                        our_isn,
-                                        session.their_seq,
-                                        TCP_SYN | TCP_ACK,
-                                        65535,
-                                        &[],
-                                    ));
-                                    log::debug!(
-                                        "TCP backend connected, SYN-ACK sent to {}:{}",
-                                        session.agent_ip,
-                                        session.agent_port
-                                    );
-                                }
-                            }
-                            Err(e) => {
-                                // Connect failed
-                                log::warn!(
-                                    "TCP non-blocking connect failed for {}:{}: {}",
-                                    session.agent_ip,
-                                    session.agent_port,
-                                    e
-                                );
-                                self.metrics
-                                    .tcp_errors_total
-                                    .fetch_add(1, Ordering::Relaxed);
-                                packets_to_send.push(build_tcp_packet(
-                                    session.service_ip,
-                                    session.service_port,
-                                    session.agent_ip,
-                                    session.agent_port,
-                                    0,
-                                    session.their_seq,
-                                    TCP_RST | TCP_ACK,
-                                    0,
-                                    &[],
-                                ));
-                                remove_session = true;
-                            }
-                        }
-                    }
-                }
-                TcpConnState::Connected => {
-                    // Handle READABLE — read data from backend, forward to Agent
-                    if event.is_readable() {
-                        let mut read_buf = [0u8; MAX_TCP_PAYLOAD];
-                        loop {
-                            match session.stream.read(&mut read_buf) {
-                                Ok(0) => {
-                                    // Backend closed connection
-                                    if session.draining {
-                                        log::debug!(
-                                            "TCP drain complete for {}:{}, backend closed",
-                                            session.agent_ip,
-                                            session.agent_port
-                                        );
-                                    } else {
-                                        log::debug!(
-                                            "TCP backend closed for {}:{}",
-                                            session.agent_ip,
-                                            session.agent_port
-                                        );
-                                    }
-                                    packets_to_send.push(build_tcp_packet(
-                                        session.service_ip,
-                                        session.service_port,
-                                        session.agent_ip,
-                                        session.agent_port,
-                                        session.our_seq,
-                                        session.their_seq,
-                                        TCP_FIN | TCP_ACK,
-                                        65535,
-                                        &[],
-                                    ));
-                                    remove_session = true;
-                                    break;
-                                }
-                                Ok(n) => {
-                                    self.metrics
-                                        .forwarded_packets_total
-                                        .fetch_add(1, Ordering::Relaxed);
-                                    self.metrics
-                                        .forwarded_bytes_total
-                                        .fetch_add(n as u64, Ordering::Relaxed);
-                                    packets_to_send.push(build_tcp_packet(
-                                        session.service_ip,
-                                        session.service_port,
-                                        session.agent_ip,
-                                        session.agent_port,
-                                        session.our_seq,
-                                        session.their_seq,
-                                        TCP_PSH | TCP_ACK,
-                                        65535,
-                                        &read_buf[..n],
-                                    ));
-                                    session.our_seq = session.our_seq.wrapping_add(n as u32);
-                                    session.last_active = Instant::now();
-                                    log::trace!(
-                                        "TCP backend -> agent: {} bytes for {}:{}",
-                                        n,
-                                        session.agent_ip,
-                                        session.agent_port
-                                    );
-                                }
-                                Err(ref e) if e.kind() == io::ErrorKind::WouldBlock => break,
-                                Err(e) => {
-                                    log::debug!(
-                                        "TCP backend read error for {}:{}: {}",
-                                        session.agent_ip,
-                                        session.agent_port,
-                                        e
-                                    );
-                                    self.metrics
-                                        .tcp_errors_total
-                                        .fetch_add(1, Ordering::Relaxed);
-                                    packets_to_send.push(build_tcp_packet(
-                                        session.service_ip,
-                                        session.service_port,
-                                        session.agent_ip,
-                                        session.agent_port,
-                                        session.our_seq,
-                                        session.their_seq,
-                                        TCP_RST | TCP_ACK,
-                                        0,
-                                        &[],
-                                    ));
-                                    remove_session = true;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                    // WRITABLE for Connected sessions is a no-op here — writes happen
-                    // inline when the Agent sends data (handle_tcp_packet ACK handler).
-                }
-            }
-        }
+    /// Whether any connection to the Intermediate exists
+    fn relay_connected(&self) -> bool {
+        self.intermediate_conn.is_some() || self.uplinks.iter().any(|u| u.conn.is_some())
+    }
 
-        // 7A.6: Clean up session + mio registration if needed
-        if remove_session {
-            if let Some(mut session) = self.tcp_sessions.remove(&flow_key) {
-                let _ = self.poll.registry().deregister(&mut session.stream);
-                self.token_to_flow.remove(&session.mio_token);
+    /// Link for return traffic with flow hash `hash` (see
+    /// `uplinks::pick_link`); a link is ready once it is registered
+    fn return_link(&self, hash: u64) -> usize {
+        uplinks::pick_link(hash, self.uplinks.len() + 1, |link| match link {
+            0 => {
+                matches!(self.reg_state, RegistrationState::Registered)
+                    && self
+                        .intermediate_conn
+                        .as_ref()
+                        .is_some_and(|c| c.is_established())
             }
-        }
-
-        for packet in packets_to_send {
-            self.send_ip_packet(&packet)?;
-        }
-
-        Ok(())
+            i => self.uplinks[i - 1].is_ready(),
+        })
     }
 
-    /// 7A.5: Periodic sweep for TCP sessions — no I/O, just timer checks.
-    ///
-    /// Checks:
-    /// - 7A.7: Connect timeout (5s) for sessions in Connecting state
-    /// - L6: Drain deadline for half-closed sessions
-    fn sweep_tcp_sessions(&mut self) -> Result<(), Box<dyn std::error::Error>> {
-        let mut to_remove = Vec::new();
-        let mut packets_to_send: Vec<Vec<u8>> = Vec::new();
+    /// Send a return packet to the Agent over the Intermediate, compressed
+    /// and FEC-protected once the Agent side does the same
+    fn send_return(&mut self, packet: &[u8]) -> Result<(), quiche::Error> {
+        let ip_header_len = packet.first().map_or(0, |b| (b & 0x0F) as usize * 4);
+        let hash = flow_hash(packet, ip_header_len).unwrap_or(0);
+        let link = self.return_link(hash);
+        let (conn, batch, aggregate_relay) = relay_link(
+            &mut self.intermediate_conn,
+            &mut self.batch,
+            self.aggregate_relay,
+            &mut self.uplinks,
+            link,
+        )
+        .ok_or(quiche::Error::InvalidState)?;
         let now = Instant::now();
+        let dgram = compress_return(&mut self.compressor, &self.decompressor, conn, packet);
+        let dgram = protect_return(&mut self.fec_encoder, &self.fec_decoder, conn, &dgram, now);
+        aggregate::send(conn, batch, aggregate_relay, &dgram)?;
+        self.send_fec_repair(now);
+        Ok(())
+    }
 
-        for (flow_key, session) in &self.tcp_sessions {
-            // 7A.7: Non-blocking connect timeout (5 seconds)
-            if session.conn_state == TcpConnState::Connecting
-                && now.duration_since(session.connect_started) > Duration::from_secs(5)
-            {
-                log::warn!(
-                    "TCP connect timeout for {}:{} (5s elapsed), sending RST",
-                    session.agent_ip,
-                    session.agent_port
-                );
-                packets_to_send.push(build_tcp_packet(
-                    session.service_ip,
-                    session.service_port,
-                    session.agent_ip,
-                    session.agent_port,
-                    0,
-                    session.their_seq,
-                    TCP_RST | TCP_ACK,
-                    0,
-                    &[],
-                ));
-                to_remove.push(*flow_key);
-                continue;
-            }
-
-            // L6: Check if draining sessions have exceeded their deadline
-            if session.draining {
-                if let Some(deadline) = session.drain_deadline {
-                    if now >= deadline {
-                        log::debug!(
-                            "TCP drain timeout for {}:{}, tearing down",
-                            session.agent_ip,
-                            session.agent_port
-                        );
-                        packets_to_send.push(build_tcp_packet(
-                            session.service_ip,
-                            session.service_port,
-                            session.agent_ip,
-                            session.agent_port,
-                            session.our_seq,
-                            session.their_seq,
-                            TCP_FIN | TCP_ACK,
-                            65535,
-                            &[],
-                        ));
-                        to_remove.push(*flow_key);
-                    }
+    /// Send the repair closing the current FEC block once it is full or due
+    fn send_fec_repair(&mut self, now: Instant) {
+        let link = self.return_link(0);
+        let (conn, batch, aggregate_relay) = match relay_link(
+            &mut self.intermediate_conn,
+            &mut self.batch,
+            self.aggregate_relay,
+            &mut self.uplinks,
+            link,
+        ) {
+            Some(parts) => parts,
+            None => return,
+        };
+        if let Some(repair) = self.fec_encoder.poll_repair(now) {
+            match aggregate::send(conn, batch, aggregate_relay, &repair) {
+                Ok(_) => {
+                    self.metrics
+                        .fec_repairs_sent_total
+                        .fetch_add(1, Ordering::Relaxed);
+                }
+                Err(e) => {
+                    log::debug!("Failed to send FEC repair: {:?}", e);
                 }
             }
         }
-
-        // 7A.6: Clean up removed sessions — deregister from mio, remove token mapping
-        for key in to_remove {
-            if let Some(mut session) = self.tcp_sessions.remove(&key) {
-                let _ = self.poll.registry().deregister(&mut session.stream);
-                self.token_to_flow.remove(&session.mio_token);
-            }
-        }
-
-        for packet in packets_to_send {
-            self.send_ip_packet(&packet)?;
-        }
-
-        Ok(())
     }
 
     fn process_local_socket(&mut self) -> Result<(), Box<dyn std::error::Error>> {
@@ -2217,8 +2184,8 @@ impl Connector {
 
             // Send via Intermediate connection (relay path)
             // In future, could also send via P2P connection if available
-            if let Some(ref mut conn) = self.intermediate_conn {
-                match conn.dgram_send(&packet) {
+            if self.relay_connected() {
+                match self.send_return(&packet) {
                     Ok(_) => {
                         log::trace!(
                             "Sent return packet: {} bytes to agent ({}:{})",
@@ -2288,18 +2255,20 @@ impl Connector {
 
         // Send registration message
         if let Some(ref mut conn) = self.intermediate_conn {
-            let id_bytes = self.service_id.as_bytes();
-            if id_bytes.len() > 255 {
-                log::error!(
-                    "Service ID '{}' exceeds 255 bytes, cannot register",
-                    self.service_id
-                );
-                return Ok(());
-            }
-            let mut msg = Vec::with_capacity(2 + id_bytes.len());
-            msg.push(REG_TYPE_CONNECTOR);
-            msg.push(id_bytes.len() as u8);
-            msg.extend_from_slice(id_bytes);
+            let msg = match registration_message(
+                &self.service_id,
+                registration_flags(self.fec),
+                self.link_group,
+            ) {
+                Some(msg) => msg,
+                None => {
+                    log::error!(
+                        "Service ID '{}' exceeds 255 bytes, cannot register",
+                        self.service_id
+                    );
+                    return Ok(());
+                }
+            };
 
             match conn.dgram_send(&msg) {
                 Ok(_) => {
@@ -2307,10 +2276,15 @@ impl Connector {
                         RegistrationState::Pending { attempts, .. } => attempts + 1,
                         _ => 1,
                     };
+                    let now = Instant::now();
                     self.reg_state = RegistrationState::Pending {
                         attempts: attempt,
-                        last_sent: Instant::now(),
+                        last_sent: now,
                     };
+                    self.timers.set(
+                        Timer::Registration,
+                        now + Duration::from_secs(REG_RETRY_TIMEOUT_SECS),
+                    );
                     log::info!(
                         "Registration sent for '{}' (attempt {}/{}), waiting for ACK",
                         self.service_id,
@@ -2327,47 +2301,45 @@ impl Connector {
         Ok(())
     }
 
-    fn process_timeouts(&mut self) {
+    /// Run quiche's timers on the connections whose timeout has passed.
+    /// Returns whether any did.
+    fn process_quic_timeouts(&mut self, now: Instant) -> bool {
+        let mut fired = false;
+
         // Process Intermediate connection timeout
         if let Some(ref mut conn) = self.intermediate_conn {
-            conn.on_timeout();
+            if conn.timeout_instant().is_some_and(|at| at <= now) {
+                conn.on_timeout();
+                fired = true;
+            }
         }
 
         // Process P2P connection timeouts
         for client in self.p2p_clients.values_mut() {
-            client.conn.on_timeout();
+            if client.conn.timeout_instant().is_some_and(|at| at <= now) {
+                client.conn.on_timeout();
+                fired = true;
+            }
         }
 
+        fired
+    }
+
+    /// Whether there are flow mappings for `housekeeping` to age (the TCP
+    /// proxy ages its own sessions)
+    fn has_aging_state(&self) -> bool {
+        !self.flow_map.is_empty()
+    }
+
+    fn housekeeping(&mut self, now: Instant) {
         // Clean up old flow mappings (older than 60 seconds)
-        let now = Instant::now();
         self.flow_map
             .retain(|_, ts| now.duration_since(*ts).as_secs() < 60);
-
-        // Clean up idle TCP sessions (skip draining sessions — they have their own deadline)
-        // 7A.6: Also deregister from mio and clean up token_to_flow
-        let tcp_timeout = TCP_SESSION_TIMEOUT_SECS;
-        let poll_registry = self.poll.registry();
-        let token_to_flow = &mut self.token_to_flow;
-        self.tcp_sessions.retain(|_, session| {
-            if session.draining {
-                true // Draining sessions are managed by sweep_tcp_sessions
-            } else if now.duration_since(session.last_active).as_secs() >= tcp_timeout {
-                let _ = poll_registry.deregister(&mut session.stream);
-                token_to_flow.remove(&session.mio_token);
-                false
-            } else {
-                true
-            }
-        });
-
-        // H3: Clean up expired SYN rate limit entries (older than 2 seconds)
-        self.tcp_syn_rates
-            .retain(|_, (window_start, _)| now.duration_since(*window_start).as_secs() < 2);
     }
 
     /// Send a QUIC PING to keep the Intermediate connection alive
-    fn maybe_send_keepalive(&mut self) {
-        if self.last_keepalive.elapsed().as_secs() >= KEEPALIVE_INTERVAL_SECS {
+    fn maybe_send_keepalive(&mut self, now: Instant) {
+        if self.timers.expired(Timer::Keepalive, now) {
             if let Some(ref mut conn) = self.intermediate_conn {
                 if conn.is_established() {
                     // send_ack_eliciting() sends a PING frame to keep connection alive
@@ -2381,7 +2353,10 @@ impl Connector {
                     }
                 }
             }
-            self.last_keepalive = Instant::now();
+            self.timers.set(
+                Timer::Keepalive,
+                now + Duration::from_secs(KEEPALIVE_INTERVAL_SECS),
+            );
         }
     }
 
@@ -2438,6 +2413,12 @@ impl Connector {
     fn send_pending(&mut self) -> Result<(), Box<dyn std::error::Error>> {
         // Send pending for Intermediate connection
         if let Some(ref mut conn) = self.intermediate_conn {
+            // Return packets from this iteration share DATAGRAMs where possible
+            if !self.batch.is_empty() {
+                if let Err(e) = aggregate::flush(conn, &mut self.batch) {
+                    log::debug!("Failed to send aggregate DATAGRAM: {:?}", e);
+                }
+            }
             loop {
                 match conn.send(&mut self.send_buf) {
                     Ok((len, send_info)) => {
@@ -2453,6 +2434,10 @@ impl Connector {
             }
         }
 
+        for uplink in &mut self.uplinks {
+            uplink.send_pending(&mut self.send_buf)?;
+        }
+
         // Send pending for P2P connections
         for client in self.p2p_clients.values_mut() {
             loop {
@@ -2477,15 +2462,14 @@ impl Connector {
     ///
     /// Metrics connections are short-lived (Prometheus scrapes), so we handle them
     /// synchronously: accept, read the HTTP request line, write the response, close.
-    fn handle_metrics_accept(&self) {
-        let listener = match self.metrics_listener {
-            Some(ref l) => l,
-            None => return,
-        };
-
+    fn handle_metrics_accept(&mut self) {
         // Accept all pending connections (edge-triggered)
         loop {
-            match listener.accept() {
+            let accepted = match self.metrics_listener {
+                Some(ref l) => l.accept(),
+                None => return,
+            };
+            match accepted {
                 Ok((stream, addr)) => {
                     log::debug!("Metrics connection from {}", addr);
                     self.handle_metrics_connection(stream);
@@ -2500,11 +2484,20 @@ impl Connector {
     }
 
     /// Handle a single metrics/health HTTP request synchronously.
-    fn handle_metrics_connection(&self, stream: mio::net::TcpStream) {
+    ///
+    /// `/debug/profile/*` is served by the profiler when `--enable-profiling`
+    /// is set and is a 404 otherwise.
+    fn handle_metrics_connection(&mut self, stream: mio::net::TcpStream) {
         let mut buf = [0u8; 1024];
         match (&stream).read(&mut buf) {
             Ok(n) if n > 0 => {
                 let request = String::from_utf8_lossy(&buf[..n]);
+                if request.starts_with("GET /debug/profile/") {
+                    if let Some(ref mut profiler) = self.profiler {
+                        profiler.handle_request(&request, stream);
+                        return;
+                    }
+                }
                 let response = if request.starts_with("GET /healthz ")
                     || request.starts_with("GET /healthz\r")
                 {
@@ -2651,14 +2644,26 @@ impl Connector {
 
                 // Create session
                 self.session_manager.create_session(session_id, candidates);
+                if let Some(at) = self.session_manager.next_expiry() {
+                    self.timers.arm(Timer::SessionExpiry, at);
+                }
 
                 // Gather our candidates
-                let bind_addr = self.quic_socket.local_addr()?;
+                let bind_addr = match self.p2p_listener {
+                    Some(ref listener) => listener.local_addr(),
+                    None => self.quic_socket.local_addr()?,
+                };
                 // When external_ip is set (e.g., AWS Elastic IP), override the
                 // observed address so the ServerReflexive candidate uses the
                 // publicly routable IP instead of a VPC-internal address.
                 let effective_observed = if let Some(ext_ip) = self.external_ip {
                     Some(SocketAddr::new(ext_ip, bind_addr.port()))
+                } else if self.p2p_listener.is_some() {
+                    // QAD observed the Intermediate connection's port; Agents
+                    // reach the listener on its own port behind the same
+                    // (port-preserving) NAT
+                    self.observed_addr
+                        .map(|addr| SocketAddr::new(addr.ip(), bind_addr.port()))
                 } else {
                     self.observed_addr
                 };
@@ -2790,6 +2795,151 @@ impl Connector {
 // Packet Building Helpers
 // ============================================================================
 
+/// Compress a return packet once the Agent side of its flow has shown it
+/// decompresses (by compressing the flow itself)
+fn compress_return<'a>(
+    compressor: &mut header_compression::Compressor,
+    decompressor: &header_compression::Decompressor,
+    conn: &quiche::Connection,
+    packet: &'a [u8],
+) -> std::borrow::Cow<'a, [u8]> {
+    if !decompressor.peer_compresses(packet) {
+        return std::borrow::Cow::Borrowed(packet);
+    }
+    let max_len = conn
+        .dgram_max_writable_len()
+        .unwrap_or(DEFAULT_MAX_UDP_PAYLOAD);
+    compressor.compress(packet, max_len)
+}
+
+/// MSS option (kind 2) of a TCP header, if present. Zero is treated as absent.
+fn parse_tcp_mss(tcp_header: &[u8]) -> Option<u16> {
+    let mut options = tcp_header.get(20..)?;
+    while let Some(&kind) = options.first() {
+        match kind {
+            0 => break,
+            1 => options = &options[1..],
+            _ => {
+                let len = *options.get(1)? as usize;
+                if len < 2 || len > options.len() {
+                    return None;
+                }
+                if kind == 2 && len == 4 {
+                    let mss = u16::from_be_bytes([options[2], options[3]]);
+                    return if mss > 0 { Some(mss) } else { None };
+                }
+                options = &options[len..];
+            }
+        }
+    }
+    None
+}
+
+/// Backend bytes per segment relayed to the Agent: the Agent's MSS, capped so
+/// that segment plus IP/TCP headers fits one DATAGRAM on the Intermediate
+/// path as currently discovered
+fn tcp_segment_size(agent_mss: u16, max_dgram: Option<usize>) -> usize {
+    let mss = agent_mss as usize;
+    match max_dgram {
+        Some(len) if len > TCP_IP_HEADER_LEN => mss.min(len - TCP_IP_HEADER_LEN),
+        _ => mss,
+    }
+}
+
+/// Hash of an IPv4 packet's addresses and ports (the first four transport
+/// header bytes), or None if they are truncated. Keeps each flow on one
+/// backend worker and one uplink.
+fn flow_hash(dgram: &[u8], ip_header_len: usize) -> Option<u64> {
+    if dgram.len() < 20 || dgram.len() < ip_header_len + 4 {
+        return None;
+    }
+    let src_ip = Ipv4Addr::new(dgram[12], dgram[13], dgram[14], dgram[15]);
+    let dst_ip = Ipv4Addr::new(dgram[16], dgram[17], dgram[18], dgram[19]);
+    let ports = u32::from_be_bytes([
+        dgram[ip_header_len],
+        dgram[ip_header_len + 1],
+        dgram[ip_header_len + 2],
+        dgram[ip_header_len + 3],
+    ]);
+    let key =
+        (u64::from(u32::from(src_ip)) << 32 | u64::from(u32::from(dst_ip))) ^ u64::from(ports);
+    // Fibonacci hashing spreads nearby addresses and ports
+    Some(key.wrapping_mul(0x9E37_79B9_7F4A_7C15) >> 32)
+}
+
+/// A relay connection with its aggregate batch and whether the
+/// Intermediate accepts aggregates on it
+type RelayLink<'a> = (
+    &'a mut quiche::Connection,
+    &'a mut aggregate::Aggregator,
+    bool,
+);
+
+/// Relay link `link` (0 = primary, `i` = uplink `i`), if it is connected
+fn relay_link<'a>(
+    primary: &'a mut Option<quiche::Connection>,
+    batch: &'a mut aggregate::Aggregator,
+    aggregate_relay: bool,
+    uplinks: &'a mut [Uplink],
+    link: usize,
+) -> Option<RelayLink<'a>> {
+    if link == 0 {
+        return primary.as_mut().map(|conn| (conn, batch, aggregate_relay));
+    }
+    let uplink = uplinks.get_mut(link - 1)?;
+    let aggregate = uplink.aggregate;
+    uplink
+        .conn
+        .as_mut()
+        .map(|conn| (conn, &mut uplink.batch, aggregate))
+}
+
+/// Flags of the Connector's registration: what it accepts and decodes
+fn registration_flags(fec: bool) -> u8 {
+    let mut flags = aggregate::REG_FLAG_AGGREGATE | header_compression::REG_FLAG_HEADER_COMPRESSION;
+    if fec {
+        flags |= fec::REG_FLAG_FEC;
+    }
+    flags
+}
+
+/// Connector registration: [0x11, id_len, service_id..., flags,
+/// link_group (8, with uplinks)], or None if the service ID does not fit
+/// its length byte
+fn registration_message(service_id: &str, flags: u8, link_group: Option<u64>) -> Option<Vec<u8>> {
+    let id_bytes = service_id.as_bytes();
+    if id_bytes.len() > 255 {
+        return None;
+    }
+    let mut msg = Vec::with_capacity(11 + id_bytes.len());
+    msg.push(REG_TYPE_CONNECTOR);
+    msg.push(id_bytes.len() as u8);
+    msg.extend_from_slice(id_bytes);
+    msg.push(flags);
+    if let Some(group) = link_group {
+        msg.extend_from_slice(&group.to_be_bytes());
+    }
+    Some(msg)
+}
+
+/// Add a return packet to the FEC block once the Agent side has shown it
+/// decodes FEC (by protecting its own packets)
+fn protect_return<'a>(
+    encoder: &mut fec::Encoder,
+    decoder: &fec::Decoder,
+    conn: &quiche::Connection,
+    packet: &'a [u8],
+    now: Instant,
+) -> std::borrow::Cow<'a, [u8]> {
+    if !decoder.peer_encodes() {
+        return std::borrow::Cow::Borrowed(packet);
+    }
+    let max_len = conn
+        .dgram_max_writable_len()
+        .unwrap_or(DEFAULT_MAX_UDP_PAYLOAD);
+    encoder.protect(packet, max_len, now)
+}
+
 fn build_udp_packet(
     src_ip: Ipv4Addr,
     src_port: u16,
@@ -2902,6 +3052,39 @@ fn build_tcp_packet(
     packet
 }
 
+/// SYN-ACK with an MSS option (the only option the Connector sends)
+fn build_tcp_syn_ack(
+    src_ip: Ipv4Addr,
+    src_port: u16,
+    dst_ip: Ipv4Addr,
+    dst_port: u16,
+    seq: u32,
+    ack: u32,
+    mss: u16,
+) -> Vec<u8> {
+    let [hi, lo] = mss.to_be_bytes();
+    let mut packet = build_tcp_packet(
+        src_ip,
+        src_port,
+        dst_ip,
+        dst_port,
+        seq,
+        ack,
+        TCP_SYN | TCP_ACK,
+        65535,
+        &[2, 4, hi, lo],
+    );
+
+    // Turn the 4 "payload" bytes into the option: data offset 6 words
+    let t = 20;
+    packet[t + 12] = 0x60;
+    packet[t + 16..t + 18].fill(0);
+    let tcp_cksum = tcp_checksum(src_ip, dst_ip, &packet[t..]);
+    packet[t + 16..t + 18].copy_from_slice(&tcp_cksum.to_be_bytes());
+
+    packet
+}
+
 fn tcp_checksum(src_ip: Ipv4Addr, dst_ip: Ipv4Addr, tcp_segment: &[u8]) -> u16 {
     let mut sum: u32 = 0;
 
@@ -2997,6 +3180,25 @@ fn icmp_checksum(data: &[u8]) -> u16 {
 mod tests {
     use super::*;
 
+    #[test]
+    fn test_reconnect_delay_backoff_and_jitter() {
+        let ms = |attempts, jitter| reconnect_delay(attempts, jitter).as_millis() as u64;
+        // Jitter equal to half the base picks the top of the window
+        assert_eq!(ms(0, 500), RECONNECT_INITIAL_DELAY_MS);
+        assert_eq!(ms(1, 1000), 2 * RECONNECT_INITIAL_DELAY_MS);
+        assert_eq!(
+            ms(20, (RECONNECT_MAX_DELAY_MS / 2) as u32),
+            RECONNECT_MAX_DELAY_MS
+        );
+        for jitter in [0, 1, 7_777, u32::MAX] {
+            for attempts in 0..8 {
+                let base = (RECONNECT_INITIAL_DELAY_MS << attempts).min(RECONNECT_MAX_DELAY_MS);
+                let d = ms(attempts, jitter);
+                assert!(d >= base / 2 && d <= base, "{} {}", attempts, d);
+            }
+        }
+    }
+
     #[test]
     fn test_ip_checksum() {
         // Example IP header (without checksum)
@@ -3042,11 +3244,52 @@ mod tests {
     #[test]
     fn test_constants_match_intermediate() {
         // These must match intermediate-server/src/main.rs
-        assert_eq!(MAX_DATAGRAM_SIZE, 1350);
+        assert_eq!(DEFAULT_MAX_UDP_PAYLOAD, 1472);
         assert_eq!(IDLE_TIMEOUT_MS, 30_000);
         assert_eq!(ALPN_PROTOCOL, b"ztna-v1");
     }
 
+    #[test]
+    fn test_registration_message() {
+        let msg = registration_message("web", registration_flags(true) | REG_FLAG_UPLINK, Some(7))
+            .unwrap();
+        assert_eq!(&msg[..5], &[REG_TYPE_CONNECTOR, 3, b'w', b'e', b'b']);
+        // Aggregate, header compression, FEC, uplink (intermediate-server/src/main.rs)
+        assert_eq!(msg[5], 0x01 | 0x02 | 0x04 | 0x08);
+        // Link group, big-endian
+        assert_eq!(&msg[6..], &7u64.to_be_bytes());
+        assert_eq!(registration_message("web", 0, None).unwrap().len(), 6);
+        assert!(registration_message(&"x".repeat(256), 0, None).is_none());
+    }
+
+    #[test]
+    fn test_relay_link() {
+        let mut config = quiche::Config::new(quiche::PROTOCOL_VERSION).unwrap();
+        let addr: SocketAddr = "127.0.0.1:4433".parse().unwrap();
+        let mut batch = aggregate::Aggregator::new();
+        let mut uplinks: Vec<Uplink> = (1..=2)
+            .map(|id| Uplink::new(id, UdpSocket::bind("127.0.0.1:0".parse().unwrap()).unwrap()))
+            .collect();
+        let scid = quiche::ConnectionId::from_ref(&[1; 16]);
+        uplinks[1].conn = Some(quiche::connect(None, &scid, addr, addr, &mut config).unwrap());
+        uplinks[1].aggregate = true;
+
+        // The primary link relays while connected, with the Intermediate's mode
+        let mut primary = None;
+        assert!(relay_link(&mut primary, &mut batch, true, &mut uplinks, 0).is_none());
+        primary = Some(quiche::connect(None, &scid, addr, addr, &mut config).unwrap());
+        let (_, _, aggregate) =
+            relay_link(&mut primary, &mut batch, true, &mut uplinks, 0).unwrap();
+        assert!(aggregate);
+
+        // Uplinks relay with their own connection and aggregation mode
+        assert!(relay_link(&mut primary, &mut batch, false, &mut uplinks, 1).is_none());
+        let (_, _, aggregate) =
+            relay_link(&mut primary, &mut batch, false, &mut uplinks, 2).unwrap();
+        assert!(aggregate);
+        assert!(relay_link(&mut primary, &mut batch, false, &mut uplinks, 3).is_none());
+    }
+
     #[test]
     fn test_default_p2p_port() {
         // P2P port should be 4434 (one above Intermediate's 4433)
@@ -3104,6 +3347,20 @@ mod tests {
         assert_eq!(packet[33], TCP_SYN | TCP_ACK); // Flags
     }
 
+    #[test]
+    fn test_build_tcp_syn_ack_advertises_mss() {
+        let src = Ipv4Addr::new(10, 100, 0, 1);
+        let dst = Ipv4Addr::new(100, 64, 0, 1);
+        let packet = build_tcp_syn_ack(src, 80, dst, 54321, 1000, 500, 1390);
+
+        assert_eq!(packet.len(), 44);
+        assert_eq!(u16::from_be_bytes([packet[2], packet[3]]), 44);
+        assert_eq!(packet[32], 0x60); // Data offset: 6 words
+        assert_eq!(packet[33], TCP_SYN | TCP_ACK);
+        assert_eq!(parse_tcp_mss(&packet[20..]), Some(1390));
+        assert_eq!(tcp_checksum(src, dst, &packet[20..]), 0);
+    }
+
     #[test]
     fn test_build_tcp_packet_with_data() {
         let payload = b"HTTP/1.1 200 OK\r\n";
@@ -3150,10 +3407,46 @@ mod tests {
     }
 
     #[test]
-    fn test_max_tcp_payload_fits_datagram() {
-        // MAX_TCP_PAYLOAD + IP header + TCP header must fit in MAX_DATAGRAM_SIZE
-        assert_eq!(MAX_TCP_PAYLOAD + 40, MAX_DATAGRAM_SIZE);
-        assert_eq!(MAX_TCP_PAYLOAD, 1310);
+    fn test_flow_hash_is_per_flow() {
+        let a = Ipv4Addr::new(100, 64, 0, 1);
+        let b = Ipv4Addr::new(10, 100, 0, 1);
+        let syn = build_tcp_packet(a, 40000, b, 80, 1, 0, TCP_SYN, 65535, &[]);
+        let data = build_tcp_packet(a, 40000, b, 80, 2, 1, TCP_ACK, 65535, b"GET /");
+        let other = build_tcp_packet(a, 40001, b, 80, 1, 0, TCP_SYN, 65535, &[]);
+
+        assert_eq!(flow_hash(&syn, 20), flow_hash(&data, 20));
+        assert_ne!(flow_hash(&syn, 20), flow_hash(&other, 20));
+        assert_eq!(flow_hash(&syn[..22], 20), None);
+    }
+
+    #[test]
+    fn test_tcp_segment_size() {
+        // Path allows more than the Agent's MSS: honour the MSS
+        assert_eq!(tcp_segment_size(1360, Some(1430)), 1360);
+        // Path smaller than the MSS: segment + 40 header bytes fills the DATAGRAM
+        assert_eq!(tcp_segment_size(1460, Some(1150)), 1110);
+        // Not yet connected
+        assert_eq!(tcp_segment_size(DEFAULT_TCP_MSS, None), 1310);
+    }
+
+    #[test]
+    fn test_parse_tcp_mss() {
+        let mut syn = vec![0u8; 20];
+        assert_eq!(parse_tcp_mss(&syn), None);
+
+        // NOP, NOP, MSS 1360, window scale
+        syn.extend_from_slice(&[1, 1, 2, 4, 0x05, 0x50, 3, 3, 7, 0]);
+        assert_eq!(parse_tcp_mss(&syn), Some(1360));
+
+        // Truncated option
+        syn.truncate(20);
+        syn.extend_from_slice(&[2, 4, 0x05]);
+        assert_eq!(parse_tcp_mss(&syn), None);
+
+        // End-of-options before MSS
+        syn.truncate(20);
+        syn.extend_from_slice(&[0, 2, 4, 0x05, 0x50]);
+        assert_eq!(parse_tcp_mss(&syn), None);
     }
 
     #[test]
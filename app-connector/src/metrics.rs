@@ -18,6 +18,10 @@ pub struct Metrics {
     pub tcp_errors_total: AtomicU64,
     /// Total reconnections to Intermediate Server (counter)
     pub reconnections_total: AtomicU64,
+    /// FEC repair packets sent with return traffic (counter)
+    pub fec_repairs_sent_total: AtomicU64,
+    /// Lost Agent packets rebuilt from FEC repairs (counter)
+    pub fec_recovered_total: AtomicU64,
     /// Server start time (for uptime calculation)
     pub start_time: Instant,
 }
@@ -30,6 +34,8 @@ impl Metrics {
             tcp_sessions_total: AtomicU64::new(0),
             tcp_errors_total: AtomicU64::new(0),
             reconnections_total: AtomicU64::new(0),
+            fec_repairs_sent_total: AtomicU64::new(0),
+            fec_recovered_total: AtomicU64::new(0),
             start_time: Instant::now(),
         }
     }
@@ -53,6 +59,12 @@ impl Metrics {
              # HELP ztna_connector_reconnections_total Total reconnections to Intermediate Server\n\
              # TYPE ztna_connector_reconnections_total counter\n\
              ztna_connector_reconnections_total {}\n\
+             # HELP ztna_connector_fec_repairs_sent_total FEC repair packets sent with return traffic\n\
+             # TYPE ztna_connector_fec_repairs_sent_total counter\n\
+             ztna_connector_fec_repairs_sent_total {}\n\
+             # HELP ztna_connector_fec_recovered_total Lost Agent packets rebuilt from FEC repairs\n\
+             # TYPE ztna_connector_fec_recovered_total counter\n\
+             ztna_connector_fec_recovered_total {}\n\
              # HELP ztna_connector_uptime_seconds Connector uptime in seconds\n\
              # TYPE ztna_connector_uptime_seconds gauge\n\
              ztna_connector_uptime_seconds {}\n",
@@ -61,6 +73,8 @@ impl Metrics {
             self.tcp_sessions_total.load(Ordering::Relaxed),
             self.tcp_errors_total.load(Ordering::Relaxed),
             self.reconnections_total.load(Ordering::Relaxed),
+            self.fec_repairs_sent_total.load(Ordering::Relaxed),
+            self.fec_recovered_total.load(Ordering::Relaxed),
             uptime,
         )
     }
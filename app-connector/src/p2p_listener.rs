@@ -0,0 +1,870 @@
+//! Sharded listener for direct Agent connections
+//!
+//! By default P2P connections from Agents share the QUIC socket and event
+//! loop with the Intermediate connection, so their handshakes and crypto
+//! compete with relay traffic. With `--p2p-workers N` the Connector binds N
+//! UDP sockets to the P2P port with SO_REUSEPORT and moves its Intermediate
+//! connection to an ephemeral port. The kernel spreads Agents over the
+//! sockets by 4-tuple. Each socket belongs to a worker thread that owns the
+//! connections arriving on it, from handshake to close; only the decrypted
+//! IP packets reach the I/O thread, which forwards them like relayed ones.
+//!
+//! Workers admit connections with a stateless Retry. An Initial without a
+//! token gets a Retry carrying a token bound to the Agent's address, and
+//! connection state is only created for an Initial that returns a valid
+//! token, so spoofed sources cannot make a worker run TLS handshakes.
+//!
+//! After NAT rebinding or a migration an Agent's new 4-tuple may hash to
+//! another socket. Workers share a map from every connection ID in use to
+//! the worker owning it, and pass packets for another worker's connection
+//! on to it; the owner replies from its own socket, bound to the same port.
+
+use std::collections::HashMap;
+use std::io;
+use std::net::{IpAddr, SocketAddr};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::mpsc::{self, Receiver, SyncSender, TrySendError};
+use std::sync::{Arc, RwLock};
+use std::thread::{self, JoinHandle};
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+use mio::net::UdpSocket;
+use mio::{Events, Interest, Poll, Token, Waker};
+use ring::hmac;
+use ring::rand::{SecureRandom, SystemRandom};
+
+use crate::{
+    is_p2p_control_packet, p2p_control_response, qad, set_dont_fragment, P2PClient,
+    CID_ROTATION_INTERVAL_SECS, QAD_OBSERVED_ADDRESS,
+};
+
+/// Worker poll token for wake-ups (shutdown, forwarded packets)
+const WAKE_TOKEN: Token = Token(0);
+
+/// Worker poll token for its listener socket
+const SOCKET_TOKEN: Token = Token(1);
+
+/// Agent packets queued from all workers toward the I/O thread
+const PACKET_QUEUE: usize = 4096;
+
+/// Most Agent packets the I/O thread forwards per loop iteration
+const PACKET_BATCH: usize = 256;
+
+/// Packets queued toward one worker by the others before further ones are
+/// dropped
+const FORWARD_QUEUE: usize = 1024;
+
+/// How long a Retry token is accepted after it was issued
+const RETRY_TOKEN_LIFETIME_SECS: u64 = 10;
+
+/// State the workers share to pass each other packets of connections that
+/// moved to another socket
+struct Shared {
+    /// Every connection ID in use to the worker owning it
+    routes: RwLock<HashMap<quiche::ConnectionId<'static>, usize>>,
+    /// Per worker: UDP packets passed on by the others, with their source
+    inboxes: Vec<SyncSender<(Vec<u8>, SocketAddr)>>,
+    wakers: Vec<Waker>,
+}
+
+pub struct P2PListener {
+    local_addr: SocketAddr,
+    shared: Arc<Shared>,
+    /// Decrypted packets from Agents, from every worker
+    packets: Receiver<Vec<u8>>,
+    /// Wakes the I/O thread when packets are queued
+    io_waker: Arc<Waker>,
+    shutdown: Arc<AtomicBool>,
+    handles: Vec<JoinHandle<()>>,
+}
+
+impl P2PListener {
+    /// Start one worker per entry of `configs`, each on its own socket
+    /// bound to `addr`
+    pub fn spawn(
+        configs: Vec<quiche::Config>,
+        addr: SocketAddr,
+        io_waker: Arc<Waker>,
+    ) -> Result<Self, Box<dyn std::error::Error>> {
+        let (packet_tx, packets) = mpsc::sync_channel(PACKET_QUEUE);
+        let rng = SystemRandom::new();
+        // Shared, so a token is valid whichever worker sees the retried Initial
+        let retry = RetryTokens::new(&rng)?;
+        let shutdown = Arc::new(AtomicBool::new(false));
+
+        // Every worker's socket, poll and inbox first: each may pass
+        // packets to any other
+        let mut local_addr = addr;
+        let mut parts = Vec::with_capacity(configs.len());
+        let mut inboxes = Vec::with_capacity(configs.len());
+        let mut wakers = Vec::with_capacity(configs.len());
+        for config in configs {
+            // Bound to the first socket's address, in case `addr` has port 0
+            let mut socket = bind_reuseport(local_addr)?;
+            if let Err(e) = set_dont_fragment(&socket) {
+                log::warn!("Failed to set DF on P2P listener socket: {}", e);
+            }
+            local_addr = socket.local_addr()?;
+
+            let poll = Poll::new()?;
+            poll.registry()
+                .register(&mut socket, SOCKET_TOKEN, Interest::READABLE)?;
+            wakers.push(Waker::new(poll.registry(), WAKE_TOKEN)?);
+            let (inbox_tx, inbox) = mpsc::sync_channel(FORWARD_QUEUE);
+            inboxes.push(inbox_tx);
+            parts.push((poll, socket, config, inbox));
+        }
+
+        let mut listener = P2PListener {
+            local_addr,
+            shared: Arc::new(Shared {
+                routes: RwLock::new(HashMap::new()),
+                inboxes,
+                wakers,
+            }),
+            packets,
+            io_waker,
+            shutdown,
+            handles: Vec::with_capacity(parts.len()),
+        };
+
+        // On error the partly built listener is dropped, which stops the
+        // workers already started
+        for (i, (poll, socket, config, inbox)) in parts.into_iter().enumerate() {
+            let worker = Worker::new(
+                i,
+                poll,
+                socket,
+                config,
+                retry.clone(),
+                Arc::clone(&listener.shared),
+                inbox,
+                packet_tx.clone(),
+                Arc::clone(&listener.io_waker),
+                Arc::clone(&listener.shutdown),
+            )?;
+            let handle = thread::Builder::new()
+                .name(format!("ztna-p2p-{}", i))
+                .spawn(move || worker.run())?;
+            listener.handles.push(handle);
+        }
+
+        Ok(listener)
+    }
+
+    /// Address the workers' sockets are bound to
+    pub fn local_addr(&self) -> SocketAddr {
+        self.local_addr
+    }
+
+    /// Packets from Agents queued by the workers, at most `PACKET_BATCH`
+    pub fn take_packets(&mut self) -> Vec<Vec<u8>> {
+        let packets: Vec<Vec<u8>> = self.packets.try_iter().take(PACKET_BATCH).collect();
+        if packets.len() == PACKET_BATCH {
+            // More may be waiting; come back after the next poll
+            let _ = self.io_waker.wake();
+        }
+        packets
+    }
+}
+
+impl Drop for P2PListener {
+    fn drop(&mut self) {
+        self.shutdown.store(true, Ordering::Relaxed);
+        for waker in &self.shared.wakers {
+            let _ = waker.wake();
+        }
+        for handle in self.handles.drain(..) {
+            let _ = handle.join();
+        }
+    }
+}
+
+/// Bind a UDP socket that shares `addr` with the other listener sockets
+#[cfg(target_os = "linux")]
+fn bind_reuseport(addr: SocketAddr) -> io::Result<UdpSocket> {
+    use std::os::fd::{AsRawFd, FromRawFd, OwnedFd};
+
+    let ip = match addr.ip() {
+        IpAddr::V4(ip) => ip,
+        IpAddr::V6(_) => return Err(io::Error::from(io::ErrorKind::Unsupported)),
+    };
+    // SAFETY: plain socket(2) call; the result is checked before use
+    let fd = unsafe {
+        libc::socket(
+            libc::AF_INET,
+            libc::SOCK_DGRAM | libc::SOCK_NONBLOCK | libc::SOCK_CLOEXEC,
+            0,
+        )
+    };
+    if fd < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    // SAFETY: fd is a freshly created socket owned by nobody else
+    let fd = unsafe { OwnedFd::from_raw_fd(fd) };
+
+    let one: libc::c_int = 1;
+    // SAFETY: valid fd and a c_int option value of the advertised length
+    let ret = unsafe {
+        libc::setsockopt(
+            fd.as_raw_fd(),
+            libc::SOL_SOCKET,
+            libc::SO_REUSEPORT,
+            &one as *const libc::c_int as *const libc::c_void,
+            std::mem::size_of::<libc::c_int>() as libc::socklen_t,
+        )
+    };
+    if ret != 0 {
+        return Err(io::Error::last_os_error());
+    }
+
+    let sin = libc::sockaddr_in {
+        sin_family: libc::AF_INET as libc::sa_family_t,
+        sin_port: addr.port().to_be(),
+        sin_addr: libc::in_addr {
+            s_addr: u32::from(ip).to_be(),
+        },
+        sin_zero: [0; 8],
+    };
+    // SAFETY: sin is a valid sockaddr_in of the advertised length
+    let ret = unsafe {
+        libc::bind(
+            fd.as_raw_fd(),
+            &sin as *const libc::sockaddr_in as *const libc::sockaddr,
+            std::mem::size_of::<libc::sockaddr_in>() as libc::socklen_t,
+        )
+    };
+    if ret != 0 {
+        return Err(io::Error::last_os_error());
+    }
+
+    Ok(UdpSocket::from_std(std::net::UdpSocket::from(fd)))
+}
+
+/// Without Linux's SO_REUSEPORT balancing only one worker can bind the port
+/// (`main` runs a single worker there)
+#[cfg(not(target_os = "linux"))]
+fn bind_reuseport(addr: SocketAddr) -> io::Result<UdpSocket> {
+    UdpSocket::bind(addr)
+}
+
+/// Stateless address validation tokens for QUIC Retry
+#[derive(Clone)]
+struct RetryTokens {
+    key: hmac::Key,
+}
+
+impl RetryTokens {
+    fn new(rng: &SystemRandom) -> Result<Self, Box<dyn std::error::Error>> {
+        let key = hmac::Key::generate(hmac::HMAC_SHA256, rng)
+            .map_err(|_| "Failed to generate Retry token key")?;
+        Ok(RetryTokens { key })
+    }
+
+    /// Token for an Agent at `addr` whose first Initial was sent to
+    /// `odcid`, issued at `now` (seconds since the epoch):
+    /// `[issued (8)][odcid_len (1)][odcid...][HMAC-SHA256 tag (32)]`
+    fn mint(&self, addr: &SocketAddr, odcid: &[u8], now: u64) -> Vec<u8> {
+        let mut token = Vec::with_capacity(9 + odcid.len() + 32);
+        token.extend_from_slice(&now.to_be_bytes());
+        token.push(odcid.len() as u8);
+        token.extend_from_slice(odcid);
+        let tag = self.tag(&token, addr);
+        token.extend_from_slice(tag.as_ref());
+        token
+    }
+
+    /// The original destination connection ID if `token` was minted for
+    /// `addr` and has not expired
+    fn validate(
+        &self,
+        token: &[u8],
+        addr: &SocketAddr,
+        now: u64,
+    ) -> Option<quiche::ConnectionId<'static>> {
+        let odcid_len = *token.get(8)? as usize;
+        let body_len = 9 + odcid_len;
+        if token.len() != body_len + 32 || odcid_len > quiche::MAX_CONN_ID_LEN {
+            return None;
+        }
+        let (body, tag) = token.split_at(body_len);
+        let mut data = body.to_vec();
+        append_addr(&mut data, addr);
+        hmac::verify(&self.key, &data, tag).ok()?;
+
+        let issued = u64::from_be_bytes(body[..8].try_into().ok()?);
+        if now.saturating_sub(issued) > RETRY_TOKEN_LIFETIME_SECS {
+            return None;
+        }
+        Some(quiche::ConnectionId::from_vec(body[9..].to_vec()))
+    }
+
+    fn tag(&self, body: &[u8], addr: &SocketAddr) -> hmac::Tag {
+        let mut data = body.to_vec();
+        append_addr(&mut data, addr);
+        hmac::sign(&self.key, &data)
+    }
+}
+
+fn append_addr(data: &mut Vec<u8>, addr: &SocketAddr) {
+    match addr.ip() {
+        IpAddr::V4(ip) => data.extend_from_slice(&ip.octets()),
+        IpAddr::V6(ip) => data.extend_from_slice(&ip.octets()),
+    }
+    data.extend_from_slice(&addr.port().to_be_bytes());
+}
+
+fn unix_secs() -> u64 {
+    SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map_or(0, |d| d.as_secs())
+}
+
+struct Worker {
+    id: usize,
+    poll: Poll,
+    socket: UdpSocket,
+    local_addr: SocketAddr,
+    config: quiche::Config,
+    retry: RetryTokens,
+    /// Connections owned by this worker, by slot
+    clients: HashMap<u64, P2PClient>,
+    /// Every connection ID in use (original and rotated) to its slot
+    ids: HashMap<quiche::ConnectionId<'static>, u64>,
+    next_slot: u64,
+    shared: Arc<Shared>,
+    /// Packets for this worker's connections that arrived on other sockets
+    inbox: Receiver<(Vec<u8>, SocketAddr)>,
+    packets: SyncSender<Vec<u8>>,
+    io_waker: Arc<Waker>,
+    shutdown: Arc<AtomicBool>,
+    rng: SystemRandom,
+    /// When connection IDs are next rotated (8B.3)
+    rotate_at: Instant,
+    buf: Vec<u8>,
+    out: Vec<u8>,
+}
+
+impl Worker {
+    #[allow(clippy::too_many_arguments)]
+    fn new(
+        id: usize,
+        poll: Poll,
+        socket: UdpSocket,
+        config: quiche::Config,
+        retry: RetryTokens,
+        shared: Arc<Shared>,
+        inbox: Receiver<(Vec<u8>, SocketAddr)>,
+        packets: SyncSender<Vec<u8>>,
+        io_waker: Arc<Waker>,
+        shutdown: Arc<AtomicBool>,
+    ) -> io::Result<Self> {
+        Ok(Worker {
+            id,
+            poll,
+            local_addr: socket.local_addr()?,
+            socket,
+            config,
+            retry,
+            clients: HashMap::new(),
+            ids: HashMap::new(),
+            next_slot: 0,
+            shared,
+            inbox,
+            packets,
+            io_waker,
+            shutdown,
+            rng: SystemRandom::new(),
+            rotate_at: Instant::now() + Duration::from_secs(CID_ROTATION_INTERVAL_SECS),
+            buf: vec![0u8; 65535],
+            out: vec![0u8; 65535],
+        })
+    }
+
+    fn run(mut self) {
+        let mut events = Events::with_capacity(256);
+
+        while !self.shutdown.load(Ordering::Relaxed) {
+            let timeout = self
+                .next_deadline()
+                .saturating_duration_since(Instant::now());
+            if let Err(e) = self.poll.poll(&mut events, Some(timeout)) {
+                if e.kind() == io::ErrorKind::Interrupted {
+                    continue;
+                }
+                log::error!("P2P listener worker poll failed: {}", e);
+                break;
+            }
+
+            if events.iter().any(|e| e.token() == SOCKET_TOKEN) {
+                self.read_socket();
+            }
+            self.read_inbox();
+
+            let now = Instant::now();
+            for client in self.clients.values_mut() {
+                if client.conn.timeout_instant().is_some_and(|at| at <= now) {
+                    client.conn.on_timeout();
+                }
+            }
+            if now >= self.rotate_at {
+                self.rotate_connection_ids();
+                self.rotate_at = now + Duration::from_secs(CID_ROTATION_INTERVAL_SECS);
+            }
+            self.cleanup_closed();
+            self.send_pending();
+        }
+    }
+
+    fn next_deadline(&self) -> Instant {
+        self.clients
+            .values()
+            .filter_map(|c| c.conn.timeout_instant())
+            .fold(self.rotate_at, Instant::min)
+    }
+
+    /// Read the socket dry, handing Agents' packets to the I/O thread
+    fn read_socket(&mut self) {
+        let mut queued = false;
+        loop {
+            let (len, from) = match self.socket.recv_from(&mut self.buf) {
+                Ok(v) => v,
+                Err(e) if e.kind() == io::ErrorKind::WouldBlock => break,
+                Err(e) => {
+                    log::debug!("P2P listener {} recv error: {}", self.id, e);
+                    break;
+                }
+            };
+            let mut pkt = self.buf[..len].to_vec();
+
+            if is_p2p_control_packet(&pkt) {
+                if let Some(response) = p2p_control_response(&pkt, from) {
+                    let _ = self.socket.send_to(&response, from);
+                }
+                continue;
+            }
+
+            let hdr = match quiche::Header::from_slice(&mut pkt, quiche::MAX_CONN_ID_LEN) {
+                Ok(v) => v,
+                Err(e) => {
+                    log::debug!("Failed to parse QUIC header from P2P packet: {:?}", e);
+                    continue;
+                }
+            };
+
+            let conn_id = hdr.dcid.clone().into_owned();
+            let slot = match self.ids.get(&conn_id) {
+                Some(&slot) => slot,
+                None if hdr.ty == quiche::Type::Initial => match self.admit(&hdr, from) {
+                    Some(slot) => slot,
+                    None => continue,
+                },
+                None => {
+                    if !self.forward(&conn_id, pkt, from) {
+                        log::debug!(
+                            "Non-Initial packet for unknown P2P connection from {}",
+                            from
+                        );
+                    }
+                    continue;
+                }
+            };
+            queued |= self.recv(slot, &mut pkt, from);
+        }
+        if queued {
+            let _ = self.io_waker.wake();
+        }
+    }
+
+    /// Pass a packet for a connection this worker does not own to the
+    /// worker that does. Returns false if no other worker owns it.
+    fn forward(
+        &self,
+        dcid: &quiche::ConnectionId<'static>,
+        pkt: Vec<u8>,
+        from: SocketAddr,
+    ) -> bool {
+        let owner = match self.shared.routes.read() {
+            Ok(routes) => routes.get(dcid).copied(),
+            Err(_) => None,
+        };
+        let owner = match owner {
+            Some(owner) if owner != self.id => owner,
+            _ => return false,
+        };
+        match self.shared.inboxes[owner].try_send((pkt, from)) {
+            Ok(()) => {
+                let _ = self.shared.wakers[owner].wake();
+            }
+            // Dropped; the Agent retransmits
+            Err(_) => log::trace!("P2P worker {} inbox full, dropping packet", owner),
+        }
+        true
+    }
+
+    /// Process packets other workers passed on for this worker's connections
+    fn read_inbox(&mut self) {
+        let mut queued = false;
+        while let Ok((mut pkt, from)) = self.inbox.try_recv() {
+            let slot = match quiche::Header::from_slice(&mut pkt, quiche::MAX_CONN_ID_LEN) {
+                Ok(hdr) => self.ids.get(&hdr.dcid.into_owned()).copied(),
+                Err(_) => None,
+            };
+            // Closed since it was passed on
+            if let Some(slot) = slot {
+                queued |= self.recv(slot, &mut pkt, from);
+            }
+        }
+        if queued {
+            let _ = self.io_waker.wake();
+        }
+    }
+
+    /// Answer a new Agent's Initial: version negotiation, a Retry, or (with
+    /// a valid token) a new connection. Returns the new connection's slot.
+    fn admit(&mut self, hdr: &quiche::Header, from: SocketAddr) -> Option<u64> {
+        if !quiche::version_is_supported(hdr.version) {
+            log::debug!("Version negotiation needed for P2P client");
+            match quiche::negotiate_version(&hdr.scid, &hdr.dcid, &mut self.out) {
+                Ok(len) => {
+                    let _ = self.socket.send_to(&self.out[..len], from);
+                }
+                Err(e) => log::debug!("Version negotiation failed: {:?}", e),
+            }
+            return None;
+        }
+
+        let token = hdr.token.as_deref().unwrap_or_default();
+        if token.is_empty() {
+            let mut new_scid = [0u8; quiche::MAX_CONN_ID_LEN];
+            self.rng.fill(&mut new_scid).ok()?;
+            let new_scid = quiche::ConnectionId::from_ref(&new_scid);
+            let token = self.retry.mint(&from, &hdr.dcid, unix_secs());
+            match quiche::retry(
+                &hdr.scid,
+                &hdr.dcid,
+                &new_scid,
+                &token,
+                hdr.version,
+                &mut self.out,
+            ) {
+                Ok(len) => {
+                    log::debug!("Sent Retry to P2P client at {}", from);
+                    let _ = self.socket.send_to(&self.out[..len], from);
+                }
+                Err(e) => log::debug!("Failed to build Retry: {:?}", e),
+            }
+            return None;
+        }
+
+        let odcid = match self.retry.validate(token, &from, unix_secs()) {
+            Some(odcid) => odcid,
+            None => {
+                log::debug!("Invalid Retry token from {}", from);
+                return None;
+            }
+        };
+
+        // The Retry's source connection ID becomes the connection's own
+        let scid = hdr.dcid.clone().into_owned();
+        let conn =
+            match quiche::accept(&scid, Some(&odcid), self.local_addr, from, &mut self.config) {
+                Ok(conn) => conn,
+                Err(e) => {
+                    log::debug!("Failed to accept P2P connection from {}: {:?}", from, e);
+                    return None;
+                }
+            };
+        log::info!(
+            "New P2P connection from Agent at {} (scid={:?}, worker {})",
+            from,
+            scid,
+            self.id
+        );
+
+        let slot = self.next_slot;
+        self.next_slot += 1;
+        self.clients.insert(slot, P2PClient::new(conn, from));
+        self.add_id(scid, slot);
+        Some(slot)
+    }
+
+    /// Feed a packet to the connection in `slot` and queue the Agent's
+    /// DATAGRAMs. Returns whether any were queued.
+    fn recv(&mut self, slot: u64, pkt: &mut [u8], from: SocketAddr) -> bool {
+        let client = match self.clients.get_mut(&slot) {
+            Some(client) => client,
+            None => return false,
+        };
+        let recv_info = quiche::RecvInfo {
+            from,
+            to: self.local_addr,
+        };
+        if let Err(e) = client.conn.recv(pkt, recv_info) {
+            log::debug!("P2P client recv error: {:?}", e);
+            return false;
+        }
+        if !client.conn.is_established() {
+            return false;
+        }
+
+        if !client.qad_sent {
+            let qad_msg = qad::build_observed_address(client.addr);
+            match client.conn.dgram_send(&qad_msg) {
+                Ok(_) => {
+                    log::info!("Sent QAD to P2P client (observed: {})", client.addr);
+                    client.qad_sent = true;
+                }
+                Err(e) => log::debug!("Failed to send QAD to P2P client: {:?}", e),
+            }
+        }
+
+        let mut queued = false;
+        while let Ok(len) = client.conn.dgram_recv(&mut self.buf) {
+            if len == 0 || self.buf[0] == QAD_OBSERVED_ADDRESS {
+                continue;
+            }
+            // A full queue drops the packet; the Agent's TCP retransmits it
+            match self.packets.try_send(self.buf[..len].to_vec()) {
+                Ok(()) => queued = true,
+                Err(TrySendError::Full(_)) => {
+                    log::trace!("P2P packet queue full, dropping packet from {}", from);
+                }
+                Err(TrySendError::Disconnected(_)) => {
+                    self.shutdown.store(true, Ordering::Relaxed);
+                    break;
+                }
+            }
+        }
+        queued
+    }
+
+    /// Route `id` to the connection in `slot`, here and for the other workers
+    fn add_id(&mut self, id: quiche::ConnectionId<'static>, slot: u64) {
+        if let Ok(mut routes) = self.shared.routes.write() {
+            routes.insert(id.clone(), self.id);
+        }
+        self.ids.insert(id, slot);
+    }
+
+    /// 8B.3: Issue a new connection ID on every established connection
+    fn rotate_connection_ids(&mut self) {
+        let mut issued = Vec::new();
+        for (&slot, client) in self.clients.iter_mut() {
+            if !client.conn.is_established() || client.conn.scids_left() == 0 {
+                continue;
+            }
+            let mut scid = [0u8; quiche::MAX_CONN_ID_LEN];
+            let mut reset_token = [0u8; 16];
+            if self.rng.fill(&mut scid).is_err() || self.rng.fill(&mut reset_token).is_err() {
+                continue;
+            }
+            let scid = quiche::ConnectionId::from_vec(scid.to_vec());
+            match client
+                .conn
+                .new_scid(&scid, u128::from_be_bytes(reset_token), true)
+            {
+                Ok(seq) => {
+                    log::debug!("Rotated P2P CID for {} (seq={})", client.addr, seq);
+                    issued.push((scid, slot));
+                }
+                Err(e) => log::debug!("P2P CID rotation failed for {}: {:?}", client.addr, e),
+            }
+        }
+        for (scid, slot) in issued {
+            self.add_id(scid, slot);
+        }
+    }
+
+    fn cleanup_closed(&mut self) {
+        let before = self.clients.len();
+        self.clients.retain(|_, client| {
+            if client.conn.is_closed() {
+                log::info!("P2P connection closed from {}", client.addr);
+            }
+            !client.conn.is_closed()
+        });
+        if self.clients.len() != before {
+            let clients = &self.clients;
+            let mut routes = self.shared.routes.write().ok();
+            self.ids.retain(|id, slot| {
+                let open = clients.contains_key(slot);
+                if let (false, Some(routes)) = (open, routes.as_mut()) {
+                    routes.remove(id);
+                }
+                open
+            });
+        }
+    }
+
+    fn send_pending(&mut self) {
+        for client in self.clients.values_mut() {
+            loop {
+                match client.conn.send(&mut self.out) {
+                    Ok((len, send_info)) => {
+                        if let Err(e) = self.socket.send_to(&self.out[..len], send_info.to) {
+                            log::debug!("P2P listener {} send error: {}", self.id, e);
+                            break;
+                        }
+                    }
+                    Err(quiche::Error::Done) => break,
+                    Err(e) => {
+                        log::debug!("P2P client send error: {:?}", e);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// `count` workers on one port, wired as `spawn` does but not running
+    fn test_workers(count: usize) -> Vec<Worker> {
+        let (packet_tx, _) = mpsc::sync_channel(PACKET_QUEUE);
+        let io_poll = Poll::new().unwrap();
+        let io_waker = Arc::new(Waker::new(io_poll.registry(), WAKE_TOKEN).unwrap());
+        let retry = RetryTokens::new(&SystemRandom::new()).unwrap();
+        let mut addr: SocketAddr = "127.0.0.1:0".parse().unwrap();
+        let mut parts = Vec::new();
+        let mut inboxes = Vec::new();
+        let mut wakers = Vec::new();
+        for _ in 0..count {
+            let socket = bind_reuseport(addr).unwrap();
+            addr = socket.local_addr().unwrap();
+            let poll = Poll::new().unwrap();
+            wakers.push(Waker::new(poll.registry(), WAKE_TOKEN).unwrap());
+            let (inbox_tx, inbox) = mpsc::sync_channel(FORWARD_QUEUE);
+            inboxes.push(inbox_tx);
+            parts.push((poll, socket, inbox));
+        }
+        let shared = Arc::new(Shared {
+            routes: RwLock::new(HashMap::new()),
+            inboxes,
+            wakers,
+        });
+        parts
+            .into_iter()
+            .enumerate()
+            .map(|(i, (poll, socket, inbox))| {
+                let config = quiche::Config::new(quiche::PROTOCOL_VERSION).unwrap();
+                Worker::new(
+                    i,
+                    poll,
+                    socket,
+                    config,
+                    retry.clone(),
+                    Arc::clone(&shared),
+                    inbox,
+                    packet_tx.clone(),
+                    Arc::clone(&io_waker),
+                    Arc::new(AtomicBool::new(false)),
+                )
+                .unwrap()
+            })
+            .collect()
+    }
+
+    fn initial(dcid: &[u8], token: Option<Vec<u8>>) -> quiche::Header<'static> {
+        quiche::Header {
+            ty: quiche::Type::Initial,
+            version: quiche::PROTOCOL_VERSION,
+            dcid: quiche::ConnectionId::from_vec(dcid.to_vec()),
+            scid: quiche::ConnectionId::from_vec(vec![0xC1; 8]),
+            token,
+            versions: None,
+        }
+    }
+
+    #[test]
+    fn test_admit_after_retry() {
+        let mut workers = test_workers(1);
+        let worker = &mut workers[0];
+        let agent: SocketAddr = "198.51.100.7:40000".parse().unwrap();
+
+        // No token: answered with a Retry, no state kept
+        assert!(worker.admit(&initial(&[0xAA; 16], None), agent).is_none());
+        assert!(worker.clients.is_empty());
+
+        // A token for another address is refused
+        let other: SocketAddr = "198.51.100.7:40001".parse().unwrap();
+        let token = worker.retry.mint(&other, &[0xAA; 16], unix_secs());
+        assert!(worker
+            .admit(&initial(&[0xBB; 16], Some(token)), agent)
+            .is_none());
+        assert!(worker.clients.is_empty());
+
+        // The retried Initial is accepted under the Retry's connection ID,
+        // which every worker can now route
+        let token = worker.retry.mint(&agent, &[0xAA; 16], unix_secs());
+        let slot = worker
+            .admit(&initial(&[0xBB; 16], Some(token)), agent)
+            .unwrap();
+        assert_eq!(worker.clients[&slot].addr, agent);
+        let scid = quiche::ConnectionId::from_vec(vec![0xBB; 16]);
+        assert_eq!(worker.ids[&scid], slot);
+        assert_eq!(worker.shared.routes.read().unwrap()[&scid], 0);
+    }
+
+    #[test]
+    fn test_retry_token_roundtrip() {
+        let tokens = RetryTokens::new(&SystemRandom::new()).unwrap();
+        let agent: SocketAddr = "198.51.100.7:40000".parse().unwrap();
+        let odcid = [0xAB; 16];
+        let token = tokens.mint(&agent, &odcid, 1_000);
+
+        let validated = tokens.validate(&token, &agent, 1_005).unwrap();
+        assert_eq!(validated.as_ref(), &odcid);
+
+        // Another address, an expired token or a forged byte are refused
+        let other: SocketAddr = "198.51.100.7:40001".parse().unwrap();
+        assert!(tokens.validate(&token, &other, 1_005).is_none());
+        assert!(tokens
+            .validate(&token, &agent, 1_000 + RETRY_TOKEN_LIFETIME_SECS + 1)
+            .is_none());
+        let mut forged = token.clone();
+        forged[9] ^= 1;
+        assert!(tokens.validate(&forged, &agent, 1_005).is_none());
+        assert!(tokens.validate(&token[..8], &agent, 1_005).is_none());
+
+        // Tokens from another key are refused
+        let other_key = RetryTokens::new(&SystemRandom::new()).unwrap();
+        assert!(other_key.validate(&token, &agent, 1_005).is_none());
+    }
+
+    #[cfg(target_os = "linux")]
+    #[test]
+    fn test_reuseport_sockets_share_port() {
+        let first = bind_reuseport("127.0.0.1:0".parse().unwrap()).unwrap();
+        let addr = first.local_addr().unwrap();
+        let second = bind_reuseport(addr).unwrap();
+        assert_eq!(second.local_addr().unwrap(), addr);
+    }
+
+    #[cfg(target_os = "linux")]
+    #[test]
+    fn test_packets_follow_their_connection() {
+        let mut workers = test_workers(2);
+        let agent: SocketAddr = "198.51.100.7:40000".parse().unwrap();
+        let token = workers[0].retry.mint(&agent, &[0xAA; 16], unix_secs());
+        workers[0]
+            .admit(&initial(&[0xBB; 16], Some(token)), agent)
+            .unwrap();
+        let scid = quiche::ConnectionId::from_vec(vec![0xBB; 16]);
+
+        // After rebinding, the Agent's packets reach worker 1's socket
+        let rebound: SocketAddr = "198.51.100.7:50000".parse().unwrap();
+        assert!(workers[1].forward(&scid, vec![0x40; 32], rebound));
+        let (pkt, from) = workers[0].inbox.try_recv().unwrap();
+        assert_eq!((pkt.len(), from), (32, rebound));
+
+        // Unknown connections, and a worker's own, are not passed on
+        let unknown = quiche::ConnectionId::from_vec(vec![0xCC; 16]);
+        assert!(!workers[1].forward(&unknown, vec![0x40; 32], rebound));
+        assert!(!workers[0].forward(&scid, vec![0x40; 32], rebound));
+        assert!(workers[1].inbox.try_recv().is_err());
+    }
+}
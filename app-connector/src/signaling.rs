@@ -275,9 +275,14 @@ impl P2PSession {
         }
     }
 
+    /// When the session times out
+    pub fn expires_at(&self) -> Instant {
+        self.created_at + SIGNALING_TIMEOUT
+    }
+
     /// Check if session has timed out
     pub fn is_expired(&self) -> bool {
-        self.created_at.elapsed() > SIGNALING_TIMEOUT
+        Instant::now() >= self.expires_at()
     }
 
     /// Mark as connected
@@ -342,6 +347,11 @@ impl P2PSessionManager {
 
         expired
     }
+
+    /// When the oldest remaining session times out
+    pub fn next_expiry(&self) -> Option<Instant> {
+        self.sessions.values().map(|s| s.expires_at()).min()
+    }
 }
 
 impl Default for P2PSessionManager {
@@ -418,4 +428,22 @@ mod tests {
         manager.remove_session(100);
         assert!(manager.get_session(100).is_none());
     }
+
+    #[test]
+    fn test_next_expiry_tracks_oldest_session() {
+        let mut manager = P2PSessionManager::new();
+        assert!(manager.next_expiry().is_none());
+
+        manager.create_session(1, vec![]);
+        let first = manager.get_session(1).unwrap().expires_at();
+        manager.create_session(2, vec![]);
+        assert_eq!(manager.next_expiry(), Some(first));
+
+        manager.get_session_mut(1).unwrap().created_at -= SIGNALING_TIMEOUT;
+        assert_eq!(manager.cleanup_expired(), vec![1]);
+        assert_eq!(
+            manager.next_expiry(),
+            Some(manager.get_session(2).unwrap().expires_at())
+        );
+    }
 }
@@ -0,0 +1,929 @@
+//! Userspace TCP proxy between tunneled Agent flows and the backend
+//!
+//! Each Agent TCP flow gets a non-blocking backend connection. The proxy
+//! synthesizes the Agent-facing side (SYN-ACK, ACKs, data, FIN/RST) as IP
+//! packets and collects them in an output queue, which its owner tunnels
+//! back to the Agent. A `TcpProxy` registers its sockets on one mio
+//! registry. That is the Connector's own poll when it runs single-threaded,
+//! or a backend worker's poll when flows are sharded (`workers.rs`).
+
+use std::collections::HashMap;
+use std::io::{self, Read as _, Write as _};
+use std::net::{Ipv4Addr, SocketAddr};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+use mio::net::TcpStream as MioTcpStream;
+use mio::{Interest, Registry, Token};
+use ring::rand::{SecureRandom, SystemRandom};
+
+use crate::metrics::Metrics;
+use crate::timers::{Timer, Timers};
+use crate::{
+    build_tcp_packet, build_tcp_syn_ack, parse_tcp_mss, tcp_segment_size, DEFAULT_TCP_MSS,
+    HOUSEKEEPING_INTERVAL, MAX_SYN_PER_SOURCE_PER_SECOND, TCP_ACK, TCP_CONNECT_TIMEOUT_SECS,
+    TCP_DRAIN_TIMEOUT_SECS, TCP_FIN, TCP_PSH, TCP_RST, TCP_SESSION_TIMEOUT_SECS, TCP_SYN,
+};
+
+/// TCP flow key: (src_ip, src_port, dst_ip, dst_port)
+pub type FlowKey = (Ipv4Addr, u16, Ipv4Addr, u16);
+
+/// 7A.1: TCP backend connection state for non-blocking connect
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum TcpConnState {
+    /// Non-blocking connect() in progress, waiting for WRITABLE event
+    Connecting,
+    /// Backend TCP connection established
+    Connected,
+}
+
+/// Represents a proxied TCP connection through the ZTNA tunnel
+struct TcpSession {
+    /// Non-blocking TCP connection to the backend service (mio-managed)
+    stream: MioTcpStream,
+    /// mio token for this TCP socket (for event dispatch)
+    mio_token: Token,
+    /// 7A.1: Connection state (Connecting or Connected)
+    conn_state: TcpConnState,
+    /// 7A.7: When the non-blocking connect was initiated (for timeout)
+    connect_started: Instant,
+    /// Our (Connector-side) next sequence number
+    our_seq: u32,
+    /// Agent's next expected sequence number
+    their_seq: u32,
+    /// Agent's source IP (for constructing return packets)
+    agent_ip: Ipv4Addr,
+    /// Agent's source port
+    agent_port: u16,
+    /// Virtual service IP (destination in original packet)
+    service_ip: Ipv4Addr,
+    /// Virtual service port
+    service_port: u16,
+    /// Last activity time for session cleanup
+    last_active: Instant,
+    /// Whether the TCP 3-way handshake is complete (SYN-ACK sent to Agent)
+    established: bool,
+    /// L6: Whether the agent has sent FIN and we are draining backend data
+    draining: bool,
+    /// L6: Deadline for draining to complete (after which session is forcefully removed)
+    drain_deadline: Option<Instant>,
+    /// MSS the Agent advertised in its SYN (caps backend -> Agent segments)
+    agent_mss: u16,
+    /// B3: Held against the session limit until the session is dropped
+    _slot: SessionSlot,
+}
+
+/// B3: Limit on concurrent TCP sessions across every proxy (prevents fd
+/// exhaustion). Clones share the count.
+#[derive(Clone)]
+pub struct SessionLimit {
+    active: Arc<AtomicUsize>,
+    max: usize,
+}
+
+impl SessionLimit {
+    pub fn new(max: usize) -> Self {
+        SessionLimit {
+            active: Arc::new(AtomicUsize::new(0)),
+            max,
+        }
+    }
+
+    /// Take a slot for a new session, or None at the limit
+    fn acquire(&self) -> Option<SessionSlot> {
+        self.active
+            .fetch_update(Ordering::AcqRel, Ordering::Acquire, |n| {
+                (n < self.max).then_some(n + 1)
+            })
+            .ok()
+            .map(|_| SessionSlot(Arc::clone(&self.active)))
+    }
+
+    /// Sessions open in every proxy
+    #[cfg(test)]
+    pub fn active(&self) -> usize {
+        self.active.load(Ordering::Acquire)
+    }
+}
+
+/// A session's share of the limit, given back when the session is dropped
+struct SessionSlot(Arc<AtomicUsize>);
+
+impl Drop for SessionSlot {
+    fn drop(&mut self) {
+        self.0.fetch_sub(1, Ordering::AcqRel);
+    }
+}
+
+/// H3: Per-source-IP TCP SYN rate limiter: maps source IP to (window_start, count)
+#[derive(Default)]
+pub struct SynRateLimiter {
+    rates: HashMap<Ipv4Addr, (Instant, u32)>,
+}
+
+impl SynRateLimiter {
+    /// Count a SYN from `src_ip`. Returns false once the source exceeds
+    /// `MAX_SYN_PER_SOURCE_PER_SECOND`.
+    pub fn admit(&mut self, src_ip: Ipv4Addr, now: Instant) -> bool {
+        let rate_entry = self.rates.entry(src_ip).or_insert((now, 0));
+        if now.duration_since(rate_entry.0).as_secs() >= 1 {
+            // Reset window
+            *rate_entry = (now, 1);
+            return true;
+        }
+        rate_entry.1 += 1;
+        if rate_entry.1 > MAX_SYN_PER_SOURCE_PER_SECOND {
+            log::warn!(
+                "TCP SYN rate limit exceeded for {} ({}/s), sending RST",
+                src_ip,
+                rate_entry.1
+            );
+            return false;
+        }
+        true
+    }
+
+    /// Clean up expired entries (older than 2 seconds)
+    pub fn age(&mut self, now: Instant) {
+        self.rates
+            .retain(|_, (window_start, _)| now.duration_since(*window_start).as_secs() < 2);
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.rates.is_empty()
+    }
+}
+
+/// Whether `dgram` (IPv4/TCP) opens a connection
+pub fn is_syn(dgram: &[u8], ip_header_len: usize) -> bool {
+    dgram
+        .get(ip_header_len + 13)
+        .is_some_and(|&flags| flags & TCP_SYN != 0 && flags & TCP_ACK == 0)
+}
+
+/// RST answering the SYN `dgram` (IPv4/TCP, at least the ports and sequence
+/// number present)
+pub fn reset_syn(dgram: &[u8], ip_header_len: usize) -> Vec<u8> {
+    let tcp = &dgram[ip_header_len..];
+    let seq_num = u32::from_be_bytes([tcp[4], tcp[5], tcp[6], tcp[7]]);
+    build_tcp_packet(
+        Ipv4Addr::new(dgram[16], dgram[17], dgram[18], dgram[19]),
+        u16::from_be_bytes([tcp[2], tcp[3]]),
+        Ipv4Addr::new(dgram[12], dgram[13], dgram[14], dgram[15]),
+        u16::from_be_bytes([tcp[0], tcp[1]]),
+        0,
+        seq_num.wrapping_add(1),
+        TCP_RST | TCP_ACK,
+        0,
+        &[],
+    )
+}
+
+/// Settings shared by every proxy (one per backend worker)
+#[derive(Clone)]
+pub struct ProxyConfig {
+    /// Backend all TCP flows connect to
+    pub forward_addr: SocketAddr,
+    /// H3: Only SYNs to this virtual service IP are accepted (None = any)
+    pub service_virtual_ip: Option<Ipv4Addr>,
+    pub metrics: Arc<Metrics>,
+    /// Largest DATAGRAM the Intermediate connection can send (0 = not
+    /// connected), kept current by the QUIC thread; sizes segments to the Agent
+    pub max_dgram: Arc<AtomicUsize>,
+    pub sessions: SessionLimit,
+}
+
+pub struct TcpProxy {
+    /// Registry of the poll that owns the backend sockets
+    registry: Registry,
+    forward_addr: SocketAddr,
+    service_virtual_ip: Option<Ipv4Addr>,
+    metrics: Arc<Metrics>,
+    max_dgram: Arc<AtomicUsize>,
+    sessions: SessionLimit,
+    /// Active TCP proxy sessions, keyed by (src_ip, src_port, dst_ip, dst_port)
+    tcp_sessions: HashMap<FlowKey, TcpSession>,
+    /// 7A.2: Next mio token to allocate for TCP backend sockets
+    next_tcp_token: usize,
+    /// 7A.2: Reverse map from mio Token to FlowKey for event dispatch
+    token_to_flow: HashMap<Token, FlowKey>,
+    /// H3: SYN rate limiter (None when the I/O thread limits SYNs for
+    /// every backend worker)
+    syn_rates: Option<SynRateLimiter>,
+    rng: SystemRandom,
+    /// Connect/drain sweep and idle-session aging
+    timers: Timers,
+    /// Scratch buffer for backend TCP reads (sized for the largest MSS)
+    tcp_read_buf: Vec<u8>,
+    /// IP packets for Agents, drained by `take_output`
+    output: Vec<Vec<u8>>,
+}
+
+impl TcpProxy {
+    /// Proxy whose backend sockets use `registry` with tokens from
+    /// `first_token` up. With `limit_syns` it rate-limits SYNs per source
+    /// itself.
+    pub fn new(
+        registry: Registry,
+        first_token: usize,
+        limit_syns: bool,
+        config: &ProxyConfig,
+    ) -> Self {
+        TcpProxy {
+            registry,
+            forward_addr: config.forward_addr,
+            service_virtual_ip: config.service_virtual_ip,
+            metrics: Arc::clone(&config.metrics),
+            max_dgram: Arc::clone(&config.max_dgram),
+            sessions: config.sessions.clone(),
+            tcp_sessions: HashMap::new(),
+            next_tcp_token: first_token,
+            token_to_flow: HashMap::new(),
+            syn_rates: limit_syns.then(SynRateLimiter::default),
+            rng: SystemRandom::new(),
+            timers: Timers::new(),
+            tcp_read_buf: vec![0u8; u16::MAX as usize],
+            output: Vec::new(),
+        }
+    }
+
+    /// Handle a tunneled IPv4/TCP packet (IP header not yet parsed)
+    pub fn handle_packet(&mut self, dgram: &[u8]) {
+        if dgram.len() < 20 {
+            return;
+        }
+        let ip_header_len = (dgram[0] & 0x0F) as usize * 4;
+        let src_ip = Ipv4Addr::new(dgram[12], dgram[13], dgram[14], dgram[15]);
+        let dst_ip = Ipv4Addr::new(dgram[16], dgram[17], dgram[18], dgram[19]);
+        self.handle_tcp_packet(dgram, ip_header_len, src_ip, dst_ip);
+    }
+
+    /// IP packets produced for Agents since the last call
+    pub fn take_output(&mut self) -> Vec<Vec<u8>> {
+        std::mem::take(&mut self.output)
+    }
+
+    /// When `run_timers` next has work
+    pub fn next_deadline(&self) -> Option<Instant> {
+        self.timers.next()
+    }
+
+    /// Time out connects and drains, and age idle sessions, when due
+    pub fn run_timers(&mut self, now: Instant) {
+        if self.timers.expired(Timer::TcpSweep, now) {
+            self.sweep_tcp_sessions(now);
+        }
+        if self.timers.expired(Timer::Housekeeping, now) {
+            self.age_sessions(now);
+        }
+        if !self.timers.is_armed(Timer::Housekeeping)
+            && (!self.tcp_sessions.is_empty()
+                || self.syn_rates.as_ref().is_some_and(|r| !r.is_empty()))
+        {
+            self.timers
+                .set(Timer::Housekeeping, now + HOUSEKEEPING_INTERVAL);
+        }
+    }
+
+    fn max_dgram(&self) -> Option<usize> {
+        match self.max_dgram.load(Ordering::Relaxed) {
+            0 => None,
+            len => Some(len),
+        }
+    }
+
+    /// 7A.2: Allocate a unique mio Token for a new TCP backend socket
+    fn allocate_tcp_token(&mut self) -> Token {
+        let token = Token(self.next_tcp_token);
+        self.next_tcp_token += 1;
+        token
+    }
+
+    pub fn handle_tcp_packet(
+        &mut self,
+        dgram: &[u8],
+        ip_header_len: usize,
+        src_ip: Ipv4Addr,
+        dst_ip: Ipv4Addr,
+    ) {
+        if dgram.len() < ip_header_len + 20 {
+            log::debug!("TCP header truncated");
+            return;
+        }
+
+        let tcp_start = ip_header_len;
+        let src_port = u16::from_be_bytes([dgram[tcp_start], dgram[tcp_start + 1]]);
+        let dst_port = u16::from_be_bytes([dgram[tcp_start + 2], dgram[tcp_start + 3]]);
+        let seq_num = u32::from_be_bytes([
+            dgram[tcp_start + 4],
+            dgram[tcp_start + 5],
+            dgram[tcp_start + 6],
+            dgram[tcp_start + 7],
+        ]);
+        let _ack_num = u32::from_be_bytes([
+            dgram[tcp_start + 8],
+            dgram[tcp_start + 9],
+            dgram[tcp_start + 10],
+            dgram[tcp_start + 11],
+        ]);
+        let data_offset = ((dgram[tcp_start + 12] >> 4) & 0x0F) as usize * 4;
+        let flags = dgram[tcp_start + 13];
+
+        let payload_start = ip_header_len + data_offset;
+        let payload = if dgram.len() > payload_start {
+            &dgram[payload_start..]
+        } else {
+            &[]
+        };
+
+        let flow_key = (src_ip, src_port, dst_ip, dst_port);
+        let mut packets_to_send: Vec<Vec<u8>> = Vec::new();
+
+        if flags & TCP_SYN != 0 && flags & TCP_ACK == 0 {
+            // H3: Validate destination IP matches expected virtual service IP
+            if let Some(expected_ip) = self.service_virtual_ip {
+                if dst_ip != expected_ip {
+                    log::warn!(
+                        "TCP SYN to unexpected destination {}, expected {}. Sending RST.",
+                        dst_ip,
+                        expected_ip
+                    );
+                    packets_to_send.push(build_tcp_packet(
+                        dst_ip,
+                        dst_port,
+                        src_ip,
+                        src_port,
+                        0,
+                        seq_num.wrapping_add(1),
+                        TCP_RST | TCP_ACK,
+                        0,
+                        &[],
+                    ));
+                    self.output.extend(packets_to_send);
+                    return;
+                }
+            }
+
+            // H3: Per-source-IP SYN rate limiting
+            if let Some(ref mut syn_rates) = self.syn_rates {
+                if !syn_rates.admit(src_ip, Instant::now()) {
+                    self.output.push(reset_syn(dgram, ip_header_len));
+                    return;
+                }
+            }
+
+            // B3: Reject new connections when at capacity (prevents fd exhaustion)
+            let slot = match self.sessions.acquire() {
+                Some(slot) => slot,
+                None => {
+                    log::warn!(
+                        "TCP session limit ({}) reached, sending RST to {}:{}",
+                        self.sessions.max,
+                        src_ip,
+                        src_port
+                    );
+                    self.output.push(reset_syn(dgram, ip_header_len));
+                    return;
+                }
+            };
+
+            // SYN - new connection request
+            log::debug!(
+                "TCP SYN: {}:{} -> {}:{} (seq={})",
+                src_ip,
+                src_port,
+                dst_ip,
+                dst_port,
+                seq_num
+            );
+
+            // 7A.3: Clean up any existing session for this flow (duplicate SYN)
+            if let Some(mut old_session) = self.tcp_sessions.remove(&flow_key) {
+                let _ = self.registry.deregister(&mut old_session.stream);
+                self.token_to_flow.remove(&old_session.mio_token);
+                log::debug!("Replaced existing TCP session for flow {:?}", flow_key);
+            }
+
+            // 7A.3: Non-blocking connect via mio — returns immediately,
+            // connect completes asynchronously. SYN-ACK deferred until WRITABLE event.
+            match MioTcpStream::connect(self.forward_addr) {
+                Ok(mut stream) => {
+                    // Set TCP_NODELAY for low-latency proxying
+                    let _ = stream.set_nodelay(true);
+
+                    // Allocate mio token and register for WRITABLE (connect completion)
+                    let token = self.allocate_tcp_token();
+                    if let Err(e) = self
+                        .registry
+                        .register(&mut stream, token, Interest::WRITABLE)
+                    {
+                        log::warn!("Failed to register TCP socket with mio: {}", e);
+                        packets_to_send.push(build_tcp_packet(
+                            dst_ip,
+                            dst_port,
+                            src_ip,
+                            src_port,
+                            0,
+                            seq_num.wrapping_add(1),
+                            TCP_RST | TCP_ACK,
+                            0,
+                            &[],
+                        ));
+                    } else {
+                        let our_isn: u32 = {
+                            let mut buf = [0u8; 4];
+                            let _ = self.rng.fill(&mut buf);
+                            u32::from_be_bytes(buf)
+                        };
+
+                        let now = Instant::now();
+                        let session = TcpSession {
+                            stream,
+                            mio_token: token,
+                            conn_state: TcpConnState::Connecting,
+                            connect_started: now,
+                            our_seq: our_isn.wrapping_add(1),
+                            their_seq: seq_num.wrapping_add(1),
+                            agent_ip: src_ip,
+                            agent_port: src_port,
+                            service_ip: dst_ip,
+                            service_port: dst_port,
+                            last_active: now,
+                            established: false,
+                            draining: false,
+                            drain_deadline: None,
+                            agent_mss: parse_tcp_mss(&dgram[tcp_start..payload_start])
+                                .unwrap_or(DEFAULT_TCP_MSS),
+                            _slot: slot,
+                        };
+
+                        self.token_to_flow.insert(token, flow_key);
+                        self.tcp_sessions.insert(flow_key, session);
+                        self.timers.arm(
+                            Timer::TcpSweep,
+                            now + Duration::from_secs(TCP_CONNECT_TIMEOUT_SECS),
+                        );
+                        self.metrics
+                            .tcp_sessions_total
+                            .fetch_add(1, Ordering::Relaxed);
+                        log::debug!(
+                            "TCP non-blocking connect initiated to {} (token={:?})",
+                            self.forward_addr,
+                            token
+                        );
+                    }
+                }
+                Err(e) => {
+                    log::warn!("TCP connect to {} failed: {}", self.forward_addr, e);
+                    self.metrics
+                        .tcp_errors_total
+                        .fetch_add(1, Ordering::Relaxed);
+                    packets_to_send.push(build_tcp_packet(
+                        dst_ip,
+                        dst_port,
+                        src_ip,
+                        src_port,
+                        0,
+                        seq_num.wrapping_add(1),
+                        TCP_RST | TCP_ACK,
+                        0,
+                        &[],
+                    ));
+                }
+            }
+        } else if flags & TCP_RST != 0 {
+            // 7A.6: Clean up mio registration on RST
+            if let Some(mut session) = self.tcp_sessions.remove(&flow_key) {
+                let _ = self.registry.deregister(&mut session.stream);
+                self.token_to_flow.remove(&session.mio_token);
+                log::debug!("TCP session reset: {}:{}", src_ip, src_port);
+            }
+        } else if flags & TCP_FIN != 0 {
+            // L6: TCP half-close draining — don't immediately remove the session.
+            // Shut down the write half to the backend and enter draining state so we
+            // can read any remaining response data before tearing down.
+            if let Some(session) = self.tcp_sessions.get_mut(&flow_key) {
+                // ACK the FIN
+                session.their_seq = seq_num.wrapping_add(1 + payload.len() as u32);
+                packets_to_send.push(build_tcp_packet(
+                    dst_ip,
+                    dst_port,
+                    src_ip,
+                    src_port,
+                    session.our_seq,
+                    session.their_seq,
+                    TCP_ACK,
+                    65535,
+                    &[],
+                ));
+
+                // Shut down the write half of the backend TcpStream
+                let _ = session.stream.shutdown(std::net::Shutdown::Write);
+                session.draining = true;
+                let deadline = Instant::now() + Duration::from_secs(TCP_DRAIN_TIMEOUT_SECS);
+                session.drain_deadline = Some(deadline);
+                self.timers.arm(Timer::TcpSweep, deadline);
+                log::debug!(
+                    "TCP half-close: {}:{} entering drain state ({}s timeout)",
+                    src_ip,
+                    src_port,
+                    TCP_DRAIN_TIMEOUT_SECS
+                );
+            }
+        } else if flags & TCP_ACK != 0 {
+            let mut remove_session = false;
+
+            if let Some(session) = self.tcp_sessions.get_mut(&flow_key) {
+                session.last_active = Instant::now();
+
+                // Don't forward data while backend connect is still in progress
+                if session.conn_state == TcpConnState::Connecting {
+                    log::trace!(
+                        "TCP ACK received while connecting, buffering for {}:{}",
+                        src_ip,
+                        src_port
+                    );
+                } else {
+                    if !session.established {
+                        session.established = true;
+                        log::debug!("TCP session established: {}:{}", src_ip, src_port);
+                    }
+
+                    // L6: Don't forward data to backend if session is draining
+                    // (write half already shut down)
+                    if !payload.is_empty() && !session.draining {
+                        match session.stream.write(payload) {
+                            Ok(n) => {
+                                self.metrics
+                                    .forwarded_packets_total
+                                    .fetch_add(1, Ordering::Relaxed);
+                                self.metrics
+                                    .forwarded_bytes_total
+                                    .fetch_add(n as u64, Ordering::Relaxed);
+                                session.their_seq = seq_num.wrapping_add(n as u32);
+                                packets_to_send.push(build_tcp_packet(
+                                    dst_ip,
+                                    dst_port,
+                                    src_ip,
+                                    src_port,
+                                    session.our_seq,
+                                    session.their_seq,
+                                    TCP_ACK,
+                                    65535,
+                                    &[],
+                                ));
+                                log::trace!(
+                                    "TCP forwarded {} bytes to backend for {}:{}",
+                                    n,
+                                    src_ip,
+                                    src_port
+                                );
+                            }
+                            Err(ref e) if e.kind() == io::ErrorKind::WouldBlock => {
+                                // Backend buffer full - don't ACK, agent retransmits
+                                log::trace!("TCP write WouldBlock for {}:{}", src_ip, src_port);
+                            }
+                            Err(e) => {
+                                self.metrics
+                                    .tcp_errors_total
+                                    .fetch_add(1, Ordering::Relaxed);
+                                log::debug!("TCP write to backend failed: {}", e);
+                                packets_to_send.push(build_tcp_packet(
+                                    dst_ip,
+                                    dst_port,
+                                    src_ip,
+                                    src_port,
+                                    session.our_seq,
+                                    seq_num.wrapping_add(payload.len() as u32),
+                                    TCP_RST | TCP_ACK,
+                                    0,
+                                    &[],
+                                ));
+                                remove_session = true;
+                            }
+                        }
+                    }
+                }
+            }
+
+            if remove_session {
+                // 7A.6: Clean up mio registration on session removal
+                if let Some(mut session) = self.tcp_sessions.remove(&flow_key) {
+                    let _ = self.registry.deregister(&mut session.stream);
+                    self.token_to_flow.remove(&session.mio_token);
+                }
+            }
+        }
+
+        self.output.extend(packets_to_send);
+    }
+
+    /// 7A.4: Handle a mio event for a TCP backend socket.
+    ///
+    /// Dispatches based on connection state:
+    /// - Connecting + WRITABLE → check connect result via peer_addr()
+    /// - Connected + READABLE → read data from backend, forward to Agent via QUIC
+    /// - Connected + WRITABLE → backend is writable (no-op, writes happen inline in handle_tcp_packet)
+    pub fn process_tcp_event(&mut self, token: Token, event: &mio::event::Event) {
+        // Look up the flow key for this token
+        let flow_key = match self.token_to_flow.get(&token) {
+            Some(fk) => *fk,
+            None => {
+                log::trace!("mio event for unknown TCP token {:?}", token);
+                return;
+            }
+        };
+
+        let mut packets_to_send: Vec<Vec<u8>> = Vec::new();
+        let mut remove_session = false;
+        let max_dgram = self.max_dgram();
+
+        if let Some(session) = self.tcp_sessions.get_mut(&flow_key) {
+            match session.conn_state {
+                TcpConnState::Connecting => {
+                    if event.is_writable() {
+                        // 7A.4: Check if connect succeeded by calling peer_addr()
+                        match session.stream.peer_addr() {
+                            Ok(_addr) => {
+                                // Connect succeeded — transition to Connected
+                                session.conn_state = TcpConnState::Connected;
+                                session.last_active = Instant::now();
+
+                                // Re-register for READABLE | WRITABLE
+                                if let Err(e) = self.registry.reregister(
+                                    &mut session.stream,
+                                    session.mio_token,
+                                    Interest::READABLE | Interest::WRITABLE,
+                                ) {
+                                    log::warn!("Failed to reregister TCP socket: {}", e);
+                                    remove_session = true;
+                                } else {
+                                    // Send SYN-ACK to Agent now that backend is connected,
+                                    // advertising an MSS that fits one DATAGRAM
+                                    let our_isn = session.our_seq.wrapping_sub(1);
+                                    let mss = tcp_segment_size(session.agent_mss, max_dgram);
+                                    packets_to_send.push(build_tcp_syn_ack(
+                                        session.service_ip,
+                                        session.service_port,
+                                        session.agent_ip,
+                                        session.agent_port,
+                                        our_isn,
+                                        session.their_seq,
+                                        mss as u16,
+                                    ));
+                                    log::debug!(
+                                        "TCP backend connected, SYN-ACK sent to {}:{}",
+                                        session.agent_ip,
+                                        session.agent_port
+                                    );
+                                }
+                            }
+                            Err(e) => {
+                                // Connect failed
+                                log::warn!(
+                                    "TCP non-blocking connect failed for {}:{}: {}",
+                                    session.agent_ip,
+                                    session.agent_port,
+                                    e
+                                );
+                                self.metrics
+                                    .tcp_errors_total
+                                    .fetch_add(1, Ordering::Relaxed);
+                                packets_to_send.push(build_tcp_packet(
+                                    session.service_ip,
+                                    session.service_port,
+                                    session.agent_ip,
+                                    session.agent_port,
+                                    0,
+                                    session.their_seq,
+                                    TCP_RST | TCP_ACK,
+                                    0,
+                                    &[],
+                                ));
+                                remove_session = true;
+                            }
+                        }
+                    }
+                }
+                TcpConnState::Connected => {
+                    // Handle READABLE — read data from backend, forward to Agent
+                    if event.is_readable() {
+                        let segment = tcp_segment_size(session.agent_mss, max_dgram);
+                        let read_buf = &mut self.tcp_read_buf[..segment];
+                        loop {
+                            match session.stream.read(read_buf) {
+                                Ok(0) => {
+                                    // Backend closed connection
+                                    if session.draining {
+                                        log::debug!(
+                                            "TCP drain complete for {}:{}, backend closed",
+                                            session.agent_ip,
+                                            session.agent_port
+                                        );
+                                    } else {
+                                        log::debug!(
+                                            "TCP backend closed for {}:{}",
+                                            session.agent_ip,
+                                            session.agent_port
+                                        );
+                                    }
+                                    packets_to_send.push(build_tcp_packet(
+                                        session.service_ip,
+                                        session.service_port,
+                                        session.agent_ip,
+                                        session.agent_port,
+                                        session.our_seq,
+                                        session.their_seq,
+                                        TCP_FIN | TCP_ACK,
+                                        65535,
+                                        &[],
+                                    ));
+                                    remove_session = true;
+                                    break;
+                                }
+                                Ok(n) => {
+                                    self.metrics
+                                        .forwarded_packets_total
+                                        .fetch_add(1, Ordering::Relaxed);
+                                    self.metrics
+                                        .forwarded_bytes_total
+                                        .fetch_add(n as u64, Ordering::Relaxed);
+                                    packets_to_send.push(build_tcp_packet(
+                                        session.service_ip,
+                                        session.service_port,
+                                        session.agent_ip,
+                                        session.agent_port,
+                                        session.our_seq,
+                                        session.their_seq,
+                                        TCP_PSH | TCP_ACK,
+                                        65535,
+                                        &read_buf[..n],
+                                    ));
+                                    session.our_seq = session.our_seq.wrapping_add(n as u32);
+                                    session.last_active = Instant::now();
+                                    log::trace!(
+                                        "TCP backend -> agent: {} bytes for {}:{}",
+                                        n,
+                                        session.agent_ip,
+                                        session.agent_port
+                                    );
+                                }
+                                Err(ref e) if e.kind() == io::ErrorKind::WouldBlock => break,
+                                Err(e) => {
+                                    log::debug!(
+                                        "TCP backend read error for {}:{}: {}",
+                                        session.agent_ip,
+                                        session.agent_port,
+                                        e
+                                    );
+                                    self.metrics
+                                        .tcp_errors_total
+                                        .fetch_add(1, Ordering::Relaxed);
+                                    packets_to_send.push(build_tcp_packet(
+                                        session.service_ip,
+                                        session.service_port,
+                                        session.agent_ip,
+                                        session.agent_port,
+                                        session.our_seq,
+                                        session.their_seq,
+                                        TCP_RST | TCP_ACK,
+                                        0,
+                                        &[],
+                                    ));
+                                    remove_session = true;
+                                    break;
+                                }
+                            }
+                        }
+                    }
+                    // WRITABLE for Connected sessions is a no-op here — writes happen
+                    // inline when the Agent sends data (handle_tcp_packet ACK handler).
+                }
+            }
+        }
+
+        // 7A.6: Clean up session + mio registration if needed
+        if remove_session {
+            if let Some(mut session) = self.tcp_sessions.remove(&flow_key) {
+                let _ = self.registry.deregister(&mut session.stream);
+                self.token_to_flow.remove(&session.mio_token);
+            }
+        }
+
+        self.output.extend(packets_to_send);
+    }
+
+    /// 7A.5: Periodic sweep for TCP sessions — no I/O, just timer checks.
+    ///
+    /// Checks:
+    /// - 7A.7: Connect timeout (5s) for sessions in Connecting state
+    /// - L6: Drain deadline for half-closed sessions
+    fn sweep_tcp_sessions(&mut self, now: Instant) {
+        let mut to_remove = Vec::new();
+        let mut packets_to_send: Vec<Vec<u8>> = Vec::new();
+
+        for (flow_key, session) in &self.tcp_sessions {
+            // 7A.7: Non-blocking connect timeout
+            if session.conn_state == TcpConnState::Connecting
+                && now >= session.connect_started + Duration::from_secs(TCP_CONNECT_TIMEOUT_SECS)
+            {
+                log::warn!(
+                    "TCP connect timeout for {}:{} ({}s elapsed), sending RST",
+                    session.agent_ip,
+                    session.agent_port,
+                    TCP_CONNECT_TIMEOUT_SECS
+                );
+                packets_to_send.push(build_tcp_packet(
+                    session.service_ip,
+                    session.service_port,
+                    session.agent_ip,
+                    session.agent_port,
+                    0,
+                    session.their_seq,
+                    TCP_RST | TCP_ACK,
+                    0,
+                    &[],
+                ));
+                to_remove.push(*flow_key);
+                continue;
+            }
+
+            // L6: Check if draining sessions have exceeded their deadline
+            if session.draining {
+                if let Some(deadline) = session.drain_deadline {
+                    if now >= deadline {
+                        log::debug!(
+                            "TCP drain timeout for {}:{}, tearing down",
+                            session.agent_ip,
+                            session.agent_port
+                        );
+                        packets_to_send.push(build_tcp_packet(
+                            session.service_ip,
+                            session.service_port,
+                            session.agent_ip,
+                            session.agent_port,
+                            session.our_seq,
+                            session.their_seq,
+                            TCP_FIN | TCP_ACK,
+                            65535,
+                            &[],
+                        ));
+                        to_remove.push(*flow_key);
+                    }
+                }
+            }
+        }
+
+        // 7A.6: Clean up removed sessions — deregister from mio, remove token mapping
+        for key in to_remove {
+            if let Some(mut session) = self.tcp_sessions.remove(&key) {
+                let _ = self.registry.deregister(&mut session.stream);
+                self.token_to_flow.remove(&session.mio_token);
+            }
+        }
+
+        self.output.extend(packets_to_send);
+
+        // Wake for the next connect timeout or drain deadline
+        let next = self
+            .tcp_sessions
+            .values()
+            .filter_map(|session| {
+                if session.conn_state == TcpConnState::Connecting {
+                    Some(session.connect_started + Duration::from_secs(TCP_CONNECT_TIMEOUT_SECS))
+                } else {
+                    session.drain_deadline
+                }
+            })
+            .min();
+        if let Some(at) = next {
+            self.timers.arm(Timer::TcpSweep, at);
+        }
+    }
+
+    /// Drop idle sessions and expired SYN rate windows
+    fn age_sessions(&mut self, now: Instant) {
+        // Clean up idle TCP sessions (skip draining sessions — they have their own deadline)
+        // 7A.6: Also deregister from mio and clean up token_to_flow
+        let tcp_timeout = TCP_SESSION_TIMEOUT_SECS;
+        let poll_registry = &self.registry;
+        let token_to_flow = &mut self.token_to_flow;
+        self.tcp_sessions.retain(|_, session| {
+            if session.draining {
+                true // Draining sessions are managed by sweep_tcp_sessions
+            } else if now.duration_since(session.last_active).as_secs() >= tcp_timeout {
+                let _ = poll_registry.deregister(&mut session.stream);
+                token_to_flow.remove(&session.mio_token);
+                false
+            } else {
+                true
+            }
+        });
+
+        // H3: Clean up expired SYN rate limit entries
+        if let Some(ref mut syn_rates) = self.syn_rates {
+            syn_rates.age(now);
+        }
+    }
+}
@@ -0,0 +1,110 @@
+//! Deadline scheduler for the Connector event loop
+//!
+//! Each periodic job in `Connector::run` (or a `TcpProxy`) owns a [`Timer`]
+//! slot holding when it next has to run. The loop sleeps in `poll` until the earliest slot,
+//! quiche timeout or socket event, then runs only the jobs that are due.
+//! Jobs re-arm their own slot, or leave it empty while they have nothing
+//! to wait for.
+
+use std::time::Instant;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Timer {
+    /// TCP connect timeouts and drain deadlines (`sweep_tcp_sessions`)
+    TcpSweep,
+    /// Aging of flow mappings, idle TCP sessions and SYN rate windows
+    Housekeeping,
+    /// PING to the Intermediate
+    Keepalive,
+    /// Registration retry while waiting for the ACK
+    Registration,
+    /// Connection ID rotation
+    CidRotation,
+    /// Expiry of P2P signaling sessions
+    SessionExpiry,
+}
+
+const TIMER_COUNT: usize = 6;
+
+#[derive(Debug, Default)]
+pub struct Timers {
+    slots: [Option<Instant>; TIMER_COUNT],
+}
+
+impl Timers {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Run `timer` at `at`, replacing any earlier or later deadline
+    pub fn set(&mut self, timer: Timer, at: Instant) {
+        self.slots[timer as usize] = Some(at);
+    }
+
+    /// Run `timer` at `at` unless it is already due sooner
+    pub fn arm(&mut self, timer: Timer, at: Instant) {
+        let slot = &mut self.slots[timer as usize];
+        *slot = Some(slot.map_or(at, |current| current.min(at)));
+    }
+
+    pub fn is_armed(&self, timer: Timer) -> bool {
+        self.slots[timer as usize].is_some()
+    }
+
+    /// Whether `timer` is due at `now`. A due timer is disarmed; its job
+    /// sets the next deadline.
+    pub fn expired(&mut self, timer: Timer, now: Instant) -> bool {
+        let slot = &mut self.slots[timer as usize];
+        match *slot {
+            Some(at) if at <= now => {
+                *slot = None;
+                true
+            }
+            _ => false,
+        }
+    }
+
+    /// Earliest armed deadline
+    pub fn next(&self) -> Option<Instant> {
+        self.slots.iter().flatten().min().copied()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::time::Duration;
+
+    #[test]
+    fn test_next_and_expiry() {
+        let now = Instant::now();
+        let mut timers = Timers::new();
+        assert_eq!(timers.next(), None);
+
+        timers.set(Timer::Keepalive, now + Duration::from_secs(10));
+        timers.set(Timer::Registration, now + Duration::from_secs(2));
+        assert_eq!(timers.next(), Some(now + Duration::from_secs(2)));
+
+        assert!(!timers.expired(Timer::Registration, now));
+        assert!(timers.expired(Timer::Registration, now + Duration::from_secs(2)));
+        // Fires once, then stays quiet until re-armed
+        assert!(!timers.expired(Timer::Registration, now + Duration::from_secs(3)));
+        assert!(!timers.is_armed(Timer::Registration));
+        assert_eq!(timers.next(), Some(now + Duration::from_secs(10)));
+    }
+
+    #[test]
+    fn test_arm_keeps_earliest() {
+        let now = Instant::now();
+        let mut timers = Timers::new();
+        timers.arm(Timer::TcpSweep, now + Duration::from_secs(5));
+        timers.arm(Timer::TcpSweep, now + Duration::from_secs(9));
+        assert_eq!(timers.next(), Some(now + Duration::from_secs(5)));
+        timers.arm(Timer::TcpSweep, now + Duration::from_secs(1));
+        assert_eq!(timers.next(), Some(now + Duration::from_secs(1)));
+
+        // set() may move a deadline later
+        timers.set(Timer::TcpSweep, now + Duration::from_secs(7));
+        assert_eq!(timers.next(), Some(now + Duration::from_secs(7)));
+    }
+}
@@ -0,0 +1,434 @@
+//! Striped uplinks to the Intermediate
+//!
+//! One QUIC connection caps relay throughput at its congestion window.
+//! With `--uplinks N` the Connector opens N-1 further connections to the
+//! same Intermediate next to its primary one. Each uplink has its own UDP
+//! socket, so its own 4-tuple for the kernel and the network to spread, and
+//! registers for the service with [`REG_FLAG_UPLINK`]. Uplinks carry
+//! tunneled traffic only; QAD, signaling and P2P stay on the primary
+//! connection.
+//!
+//! Return traffic picks a link by flow hash (`Connector::return_link`). A
+//! flow whose link is down or unregistered moves to the next live link, and
+//! an uplink that closes reconnects on its own backoff.
+
+use std::io;
+use std::net::SocketAddr;
+use std::time::{Duration, Instant};
+
+use mio::net::UdpSocket;
+use ring::rand::{SecureRandom, SystemRandom};
+use tunnel_codec::aggregate::{self, Aggregator};
+
+use crate::{
+    reconnect_delay, KEEPALIVE_INTERVAL_SECS, QAD_OBSERVED_ADDRESS, REG_MAX_RETRIES,
+    REG_RETRY_TIMEOUT_SECS, REG_TYPE_ACK, REG_TYPE_NACK,
+};
+
+/// Registration flag: this connection is an additional uplink of a
+/// Connector whose primary connection registers the same service
+pub const REG_FLAG_UPLINK: u8 = 0x08;
+
+/// Registration NACK status: no primary of the uplink's link group is
+/// registered (yet); the uplink retries
+const REG_STATUS_NO_PRIMARY: u8 = 0x03;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum LinkState {
+    /// Handshake in progress
+    Connecting,
+    /// Registration sent; resent at `retry_at` until REG_MAX_RETRIES
+    Registering {
+        attempts: u32,
+        retry_at: Instant,
+    },
+    Registered,
+    /// Registration NACKed; the link stays idle until it reconnects
+    Denied,
+}
+
+impl LinkState {
+    /// State after the Intermediate's reply to a registration: an ACK, or
+    /// a NACK with `status`
+    fn after_reply(ack: bool, status: u8, now: Instant) -> Self {
+        if ack {
+            LinkState::Registered
+        } else if status == REG_STATUS_NO_PRIMARY {
+            // Start over once the primary's registration has landed
+            LinkState::Registering {
+                attempts: 0,
+                retry_at: now + Duration::from_secs(REG_RETRY_TIMEOUT_SECS),
+            }
+        } else {
+            LinkState::Denied
+        }
+    }
+
+    /// Registration attempt due at `now`, if any: the first once the
+    /// primary is registered, then retries until REG_MAX_RETRIES
+    fn attempt_due(self, now: Instant, primary_registered: bool) -> Option<u32> {
+        match self {
+            LinkState::Connecting if primary_registered => Some(1),
+            LinkState::Registering { attempts, retry_at }
+                if now >= retry_at && attempts < REG_MAX_RETRIES =>
+            {
+                Some(attempts + 1)
+            }
+            _ => None,
+        }
+    }
+}
+
+/// Link carrying a flow with `hash` among `links` (0 is the primary
+/// connection, `i` uplink `i`): the one the hash picks, or the next one
+/// `ready` accepts, so a flow only moves while its link is down. 0 if no
+/// link is ready.
+pub fn pick_link(hash: u64, links: usize, ready: impl Fn(usize) -> bool) -> usize {
+    if links <= 1 {
+        return 0;
+    }
+    let start = (hash % links as u64) as usize;
+    (0..links)
+        .map(|i| (start + i) % links)
+        .find(|&link| ready(link))
+        .unwrap_or(0)
+}
+
+pub struct Uplink {
+    /// Position among the uplinks, from 1 (the primary connection is 0)
+    pub id: usize,
+    pub socket: UdpSocket,
+    pub conn: Option<quiche::Connection>,
+    /// Whether the Intermediate accepts aggregate DATAGRAMs on this link
+    pub aggregate: bool,
+    /// Return packets waiting to share a DATAGRAM on this link
+    pub batch: Aggregator,
+    state: LinkState,
+    reconnect_attempts: u32,
+    reconnect_at: Option<Instant>,
+    keepalive_at: Option<Instant>,
+}
+
+impl Uplink {
+    pub fn new(id: usize, socket: UdpSocket) -> Self {
+        Uplink {
+            id,
+            socket,
+            conn: None,
+            aggregate: false,
+            batch: Aggregator::new(),
+            state: LinkState::Connecting,
+            reconnect_attempts: 0,
+            reconnect_at: None,
+            keepalive_at: None,
+        }
+    }
+
+    /// Established and registered: return traffic may use this link
+    pub fn is_ready(&self) -> bool {
+        self.state == LinkState::Registered
+            && self.conn.as_ref().is_some_and(|c| c.is_established())
+    }
+
+    /// Start the handshake to the Intermediate at `server_addr`
+    pub fn connect(
+        &mut self,
+        config: &mut quiche::Config,
+        server_addr: SocketAddr,
+        rng: &SystemRandom,
+    ) -> Result<(), Box<dyn std::error::Error>> {
+        let mut scid = [0u8; quiche::MAX_CONN_ID_LEN];
+        rng.fill(&mut scid)
+            .map_err(|_| "Failed to generate connection ID")?;
+        let scid = quiche::ConnectionId::from_ref(&scid);
+        let local_addr = self.socket.local_addr()?;
+        let conn = quiche::connect(None, &scid, local_addr, server_addr, config)?;
+
+        log::info!(
+            "Connecting uplink {} to Intermediate at {} from {}",
+            self.id,
+            server_addr,
+            local_addr
+        );
+        self.conn = Some(conn);
+        self.state = LinkState::Connecting;
+        self.aggregate = false;
+        self.batch = Aggregator::new();
+        self.keepalive_at = Some(Instant::now() + Duration::from_secs(KEEPALIVE_INTERVAL_SECS));
+        Ok(())
+    }
+
+    /// Read the socket and return the tunneled DATAGRAMs received.
+    /// Registration replies are handled here.
+    pub fn recv(&mut self, buf: &mut [u8], service_id: &str) -> io::Result<Vec<Vec<u8>>> {
+        let local_addr = self.socket.local_addr()?;
+        loop {
+            let (len, from) = match self.socket.recv_from(buf) {
+                Ok(v) => v,
+                Err(e) if e.kind() == io::ErrorKind::WouldBlock => break,
+                Err(e) => return Err(e),
+            };
+            if let Some(ref mut conn) = self.conn {
+                let recv_info = quiche::RecvInfo {
+                    from,
+                    to: local_addr,
+                };
+                if let Err(e) = conn.recv(&mut buf[..len], recv_info) {
+                    log::debug!("Uplink {} recv error: {:?}", self.id, e);
+                }
+            }
+        }
+
+        let mut tunneled = Vec::new();
+        let conn = match self.conn {
+            Some(ref mut conn) if conn.is_established() => conn,
+            _ => return Ok(tunneled),
+        };
+        while let Ok(len) = conn.dgram_recv(buf) {
+            let dgram = &buf[..len];
+            match dgram.first().copied() {
+                None | Some(QAD_OBSERVED_ADDRESS) => {}
+                Some(REG_TYPE_ACK | REG_TYPE_NACK) => {
+                    // [type, status, id_len, service_id..., flags?]
+                    let id_len = dgram.get(2).copied().unwrap_or(0) as usize;
+                    if dgram.get(3..3 + id_len) != Some(service_id.as_bytes()) {
+                        continue;
+                    }
+                    let ack = dgram[0] == REG_TYPE_ACK;
+                    if ack {
+                        log::info!("Uplink {} registered for '{}'", self.id, service_id);
+                        let flags = dgram.get(3 + id_len).copied().unwrap_or(0);
+                        self.aggregate = flags & aggregate::REG_FLAG_AGGREGATE != 0;
+                    } else if dgram[1] == REG_STATUS_NO_PRIMARY {
+                        // The primary's registration has not landed yet
+                        log::debug!("Uplink {} waiting for the primary registration", self.id);
+                    } else {
+                        log::warn!(
+                            "Uplink {} registration NACK for '{}' (status=0x{:02x})",
+                            self.id,
+                            service_id,
+                            dgram[1]
+                        );
+                    }
+                    self.state = LinkState::after_reply(ack, dgram[1], Instant::now());
+                }
+                Some(_) => tunneled.push(dgram.to_vec()),
+            }
+        }
+        Ok(tunneled)
+    }
+
+    /// Run what is due at `now`: quiche timers, registration (retries, and
+    /// only once the primary is registered), keepalive, and reconnection
+    /// after the link closed
+    pub fn on_timers(
+        &mut self,
+        now: Instant,
+        config: &mut quiche::Config,
+        server_addr: SocketAddr,
+        registration: &[u8],
+        primary_registered: bool,
+        rng: &SystemRandom,
+    ) {
+        let conn = match self.conn {
+            Some(ref mut conn) => conn,
+            None => {
+                if self.reconnect_at.is_some_and(|at| now >= at) {
+                    self.reconnect_at = None;
+                    self.reconnect_attempts += 1;
+                    if let Err(e) = self.connect(config, server_addr, rng) {
+                        log::warn!("Uplink {} reconnect failed: {}", self.id, e);
+                        self.schedule_reconnect(now, rng);
+                    }
+                }
+                return;
+            }
+        };
+
+        if conn.timeout_instant().is_some_and(|at| at <= now) {
+            conn.on_timeout();
+        }
+        if conn.is_closed() {
+            log::warn!("Uplink {} closed, flows move to the other links", self.id);
+            self.conn = None;
+            self.keepalive_at = None;
+            self.schedule_reconnect(now, rng);
+            return;
+        }
+        if !conn.is_established() {
+            return;
+        }
+        self.reconnect_attempts = 0;
+
+        if let Some(attempts) = self.state.attempt_due(now, primary_registered) {
+            match conn.dgram_send(registration) {
+                Ok(_) => {
+                    self.state = LinkState::Registering {
+                        attempts,
+                        retry_at: now + Duration::from_secs(REG_RETRY_TIMEOUT_SECS),
+                    };
+                }
+                Err(e) => log::debug!("Uplink {} registration send failed: {:?}", self.id, e),
+            }
+        }
+
+        if self.keepalive_at.is_some_and(|at| now >= at) {
+            if let Err(e) = conn.send_ack_eliciting() {
+                log::debug!("Uplink {} keepalive failed: {:?}", self.id, e);
+            }
+            self.keepalive_at = Some(now + Duration::from_secs(KEEPALIVE_INTERVAL_SECS));
+        }
+    }
+
+    /// Earliest time `on_timers` has work
+    pub fn next_deadline(&self) -> Option<Instant> {
+        let conn = match self.conn {
+            Some(ref conn) => conn,
+            None => return self.reconnect_at,
+        };
+        let retry_at = match self.state {
+            LinkState::Registering { attempts, retry_at } if attempts < REG_MAX_RETRIES => {
+                Some(retry_at)
+            }
+            _ => None,
+        };
+        [conn.timeout_instant(), self.keepalive_at, retry_at]
+            .into_iter()
+            .flatten()
+            .min()
+    }
+
+    /// Hand the pending batch to quiche and write out the connection's packets
+    pub fn send_pending(&mut self, buf: &mut [u8]) -> io::Result<()> {
+        let conn = match self.conn {
+            Some(ref mut conn) => conn,
+            None => return Ok(()),
+        };
+        if !self.batch.is_empty() {
+            if let Err(e) = aggregate::flush(conn, &mut self.batch) {
+                log::debug!("Uplink {} aggregate send failed: {:?}", self.id, e);
+            }
+        }
+        loop {
+            match conn.send(buf) {
+                Ok((len, send_info)) => {
+                    self.socket.send_to(&buf[..len], send_info.to)?;
+                }
+                Err(quiche::Error::Done) => break,
+                Err(e) => {
+                    log::debug!("Uplink {} send error: {:?}", self.id, e);
+                    break;
+                }
+            }
+        }
+        Ok(())
+    }
+
+    fn schedule_reconnect(&mut self, now: Instant, rng: &SystemRandom) {
+        let mut jitter = [0u8; 4];
+        let _ = rng.fill(&mut jitter);
+        let delay = reconnect_delay(self.reconnect_attempts, u32::from_ne_bytes(jitter));
+        self.reconnect_at = Some(now + delay);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn uplink() -> Uplink {
+        Uplink::new(1, UdpSocket::bind("127.0.0.1:0".parse().unwrap()).unwrap())
+    }
+
+    #[test]
+    fn test_registration_replies() {
+        let now = Instant::now();
+        assert_eq!(
+            LinkState::after_reply(true, 0x00, now),
+            LinkState::Registered
+        );
+        // No primary of its link group yet: retry from scratch
+        assert_eq!(
+            LinkState::after_reply(false, REG_STATUS_NO_PRIMARY, now),
+            LinkState::Registering {
+                attempts: 0,
+                retry_at: now + Duration::from_secs(REG_RETRY_TIMEOUT_SECS),
+            }
+        );
+        // Any other NACK (auth denied) is final
+        assert_eq!(LinkState::after_reply(false, 0x02, now), LinkState::Denied);
+    }
+
+    #[test]
+    fn test_registration_attempts() {
+        let now = Instant::now();
+        let retry_at = now + Duration::from_secs(REG_RETRY_TIMEOUT_SECS);
+
+        // The first attempt waits for the primary's registration
+        assert_eq!(LinkState::Connecting.attempt_due(now, false), None);
+        assert_eq!(LinkState::Connecting.attempt_due(now, true), Some(1));
+
+        // Retries come at retry_at, up to REG_MAX_RETRIES
+        let registering = LinkState::Registering {
+            attempts: 1,
+            retry_at,
+        };
+        assert_eq!(registering.attempt_due(now, true), None);
+        assert_eq!(registering.attempt_due(retry_at, true), Some(2));
+        let exhausted = LinkState::Registering {
+            attempts: REG_MAX_RETRIES,
+            retry_at,
+        };
+        assert_eq!(exhausted.attempt_due(retry_at, true), None);
+
+        // After a NO_PRIMARY NACK the count starts over
+        let restarted = LinkState::after_reply(false, REG_STATUS_NO_PRIMARY, now);
+        assert_eq!(restarted.attempt_due(retry_at, true), Some(1));
+
+        assert_eq!(LinkState::Registered.attempt_due(retry_at, true), None);
+        assert_eq!(LinkState::Denied.attempt_due(retry_at, true), None);
+    }
+
+    #[test]
+    fn test_reconnect_after_backoff() {
+        let rng = SystemRandom::new();
+        let mut config = quiche::Config::new(quiche::PROTOCOL_VERSION).unwrap();
+        let server: SocketAddr = "127.0.0.1:4433".parse().unwrap();
+        let mut link = uplink();
+        let now = Instant::now();
+
+        link.schedule_reconnect(now, &rng);
+        let at = link.reconnect_at.unwrap();
+        assert!(at >= now + reconnect_delay(0, 0));
+        assert_eq!(link.next_deadline(), Some(at));
+
+        // Nothing happens before the backoff ends
+        link.on_timers(now, &mut config, server, &[], true, &rng);
+        assert!(link.conn.is_none());
+
+        link.on_timers(at, &mut config, server, &[], true, &rng);
+        assert!(link.conn.is_some());
+        assert_eq!(link.reconnect_at, None);
+        assert_eq!(link.reconnect_attempts, 1);
+        assert_eq!(link.state, LinkState::Connecting);
+        assert!(!link.is_ready());
+    }
+
+    #[test]
+    fn test_pick_link() {
+        // Without uplinks everything uses the primary
+        assert_eq!(pick_link(7, 1, |_| false), 0);
+
+        // The hash picks the link while it is ready
+        assert_eq!(pick_link(4, 3, |_| true), 1);
+        assert_eq!(pick_link(5, 3, |_| true), 2);
+
+        // A flow whose link is down moves to the next ready one, wrapping
+        assert_eq!(pick_link(4, 3, |link| link != 1), 2);
+        assert_eq!(pick_link(5, 3, |link| link != 2), 0);
+        assert_eq!(pick_link(5, 3, |link| link == 1), 1);
+
+        // Nothing ready: the primary, as before registration completes
+        assert_eq!(pick_link(5, 3, |_| false), 0);
+    }
+}
@@ -0,0 +1,346 @@
+//! Backend worker threads for the TCP proxy
+//!
+//! With `--workers N` the I/O thread keeps every QUIC connection and hands
+//! tunneled TCP packets to N workers. Each worker owns a [`TcpProxy`] and a
+//! poll of its own, so backend reads, writes and connect completions run in
+//! parallel with QUIC processing. A flow always hashes to the same worker,
+//! which keeps its session state on one thread.
+//!
+//! Packets cross threads in bounded queues. A full inbound queue drops the
+//! packet (the Agent's TCP retransmits it); a full return queue blocks the
+//! worker, which stops it reading from backends until the I/O thread
+//! catches up.
+//!
+//! Limits apply to the Connector as a whole: the I/O thread rate-limits
+//! SYNs per source before dispatching them, and workers take their
+//! sessions from one shared [`SessionLimit`](crate::tcp_proxy::SessionLimit).
+
+use std::io;
+use std::net::Ipv4Addr;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::mpsc::{self, Receiver, SyncSender, TrySendError};
+use std::sync::Arc;
+use std::thread::{self, JoinHandle};
+use std::time::{Duration, Instant};
+
+use mio::{Events, Poll, Token, Waker};
+
+use crate::flow_hash;
+use crate::tcp_proxy::{is_syn, reset_syn, ProxyConfig, SynRateLimiter, TcpProxy};
+
+/// Worker poll token for wake-ups from the I/O thread
+const WAKE_TOKEN: Token = Token(0);
+
+/// First worker poll token for backend sockets
+const FIRST_TCP_TOKEN: usize = 1;
+
+/// Packets queued toward one worker before further ones are dropped
+const INBOUND_QUEUE: usize = 1024;
+
+/// Packets queued from all workers toward the I/O thread
+const RETURN_QUEUE: usize = 4096;
+
+/// Most return packets the I/O thread tunnels per loop iteration, so a busy
+/// backend cannot starve QUIC processing
+const RETURN_BATCH: usize = 256;
+
+/// How often expired SYN rate windows are dropped
+const SYN_RATE_AGING: Duration = Duration::from_secs(1);
+
+struct Shard {
+    inbound: SyncSender<Vec<u8>>,
+    waker: Waker,
+    /// Packets were queued since the worker was last woken
+    pending: bool,
+}
+
+pub struct WorkerPool {
+    shards: Vec<Shard>,
+    /// Packets for Agents from every worker (None once shutting down)
+    returns: Option<Receiver<Vec<u8>>>,
+    /// Wakes the I/O thread when returns are queued
+    io_waker: Arc<Waker>,
+    /// H3: SYN rate limiter for every worker's flows
+    syn_rates: SynRateLimiter,
+    next_syn_aging: Instant,
+    /// RSTs for SYNs over the rate limit, returned with the next batch
+    refused: Vec<Vec<u8>>,
+    shutdown: Arc<AtomicBool>,
+    handles: Vec<JoinHandle<()>>,
+}
+
+impl WorkerPool {
+    /// Start `workers` backend threads. They wake the I/O thread through
+    /// `io_waker` whenever they queue packets for Agents.
+    pub fn spawn(workers: usize, config: &ProxyConfig, io_waker: Arc<Waker>) -> io::Result<Self> {
+        let (return_tx, returns) = mpsc::sync_channel(RETURN_QUEUE);
+        let mut pool = WorkerPool {
+            shards: Vec::with_capacity(workers),
+            returns: Some(returns),
+            io_waker,
+            syn_rates: SynRateLimiter::default(),
+            next_syn_aging: Instant::now() + SYN_RATE_AGING,
+            refused: Vec::new(),
+            shutdown: Arc::new(AtomicBool::new(false)),
+            handles: Vec::with_capacity(workers),
+        };
+
+        // On error the partly built pool is dropped, which stops the
+        // workers already started
+        for i in 0..workers {
+            let poll = Poll::new()?;
+            let waker = Waker::new(poll.registry(), WAKE_TOKEN)?;
+            let proxy = TcpProxy::new(poll.registry().try_clone()?, FIRST_TCP_TOKEN, false, config);
+            let (inbound_tx, inbound) = mpsc::sync_channel(INBOUND_QUEUE);
+            let worker = Worker {
+                poll,
+                proxy,
+                inbound,
+                returns: return_tx.clone(),
+                io_waker: Arc::clone(&pool.io_waker),
+                shutdown: Arc::clone(&pool.shutdown),
+            };
+            let handle = thread::Builder::new()
+                .name(format!("ztna-backend-{}", i))
+                .spawn(move || worker.run())?;
+            pool.shards.push(Shard {
+                inbound: inbound_tx,
+                waker,
+                pending: false,
+            });
+            pool.handles.push(handle);
+        }
+
+        Ok(pool)
+    }
+
+    /// Queue a tunneled TCP packet for the worker owning its flow. Workers
+    /// are woken in one go by [`WorkerPool::wake`]. Returns false if the
+    /// packet was dropped: the worker's queue is full, or it is a SYN over
+    /// its source's rate limit (answered with a RST).
+    pub fn dispatch(&mut self, dgram: &[u8], ip_header_len: usize) -> bool {
+        if dgram.len() >= ip_header_len + 20 && is_syn(dgram, ip_header_len) {
+            let now = Instant::now();
+            if now >= self.next_syn_aging {
+                self.syn_rates.age(now);
+                self.next_syn_aging = now + SYN_RATE_AGING;
+            }
+            let src_ip = Ipv4Addr::new(dgram[12], dgram[13], dgram[14], dgram[15]);
+            if !self.syn_rates.admit(src_ip, now) {
+                self.refused.push(reset_syn(dgram, ip_header_len));
+                return false;
+            }
+        }
+        let index = match flow_hash(dgram, ip_header_len) {
+            Some(hash) => (hash % self.shards.len() as u64) as usize,
+            // Truncated; any worker drops it
+            None => 0,
+        };
+        let shard = &mut self.shards[index];
+        match shard.inbound.try_send(dgram.to_vec()) {
+            Ok(()) => {
+                shard.pending = true;
+                true
+            }
+            Err(_) => {
+                log::trace!("Backend worker {} queue full, dropping TCP packet", index);
+                false
+            }
+        }
+    }
+
+    /// Wake every worker with newly queued packets
+    pub fn wake(&mut self) {
+        for shard in self.shards.iter_mut().filter(|s| s.pending) {
+            shard.pending = false;
+            if let Err(e) = shard.waker.wake() {
+                log::warn!("Failed to wake backend worker: {}", e);
+            }
+        }
+    }
+
+    /// Packets for Agents queued by the workers, at most `RETURN_BATCH`,
+    /// after the RSTs of refused SYNs
+    pub fn take_returns(&mut self) -> Vec<Vec<u8>> {
+        let mut packets = std::mem::take(&mut self.refused);
+        let returns = match self.returns {
+            Some(ref returns) => returns,
+            None => return packets,
+        };
+        let queued = packets.len();
+        packets.extend(returns.try_iter().take(RETURN_BATCH));
+        if packets.len() - queued == RETURN_BATCH {
+            // More may be waiting; come back after the next poll
+            let _ = self.io_waker.wake();
+        }
+        packets
+    }
+}
+
+impl Drop for WorkerPool {
+    fn drop(&mut self) {
+        self.shutdown.store(true, Ordering::Relaxed);
+        // Unblock workers waiting on a full return queue
+        self.returns = None;
+        for shard in &self.shards {
+            let _ = shard.waker.wake();
+        }
+        for handle in self.handles.drain(..) {
+            let _ = handle.join();
+        }
+    }
+}
+
+struct Worker {
+    poll: Poll,
+    proxy: TcpProxy,
+    inbound: Receiver<Vec<u8>>,
+    returns: SyncSender<Vec<u8>>,
+    io_waker: Arc<Waker>,
+    shutdown: Arc<AtomicBool>,
+}
+
+impl Worker {
+    fn run(mut self) {
+        let mut events = Events::with_capacity(1024);
+
+        while !self.shutdown.load(Ordering::Relaxed) {
+            let timeout = self
+                .proxy
+                .next_deadline()
+                .map(|at| at.saturating_duration_since(Instant::now()));
+            if let Err(e) = self.poll.poll(&mut events, timeout) {
+                if e.kind() == io::ErrorKind::Interrupted {
+                    continue;
+                }
+                log::error!("Backend worker poll failed: {}", e);
+                break;
+            }
+
+            for event in events.iter() {
+                if event.token() != WAKE_TOKEN {
+                    self.proxy.process_tcp_event(event.token(), event);
+                }
+            }
+            while let Ok(dgram) = self.inbound.try_recv() {
+                self.proxy.handle_packet(&dgram);
+            }
+            self.proxy.run_timers(Instant::now());
+
+            if !self.send_returns() {
+                break;
+            }
+        }
+    }
+
+    /// Hand the proxy's output to the I/O thread. Returns false once the
+    /// pool is gone.
+    fn send_returns(&mut self) -> bool {
+        let output = self.proxy.take_output();
+        if output.is_empty() {
+            return true;
+        }
+        for packet in output {
+            match self.returns.try_send(packet) {
+                Ok(()) => {}
+                Err(TrySendError::Full(packet)) => {
+                    // Make sure the I/O thread is draining, then wait for room
+                    let _ = self.io_waker.wake();
+                    if self.returns.send(packet).is_err() {
+                        return false;
+                    }
+                }
+                Err(TrySendError::Disconnected(_)) => return false,
+            }
+        }
+        let _ = self.io_waker.wake();
+        true
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::metrics::Metrics;
+    use crate::tcp_proxy::SessionLimit;
+    use crate::{build_tcp_packet, MAX_SYN_PER_SOURCE_PER_SECOND, TCP_ACK, TCP_RST, TCP_SYN};
+    use std::sync::atomic::AtomicUsize;
+
+    fn proxy_config(backend: &std::net::TcpListener, max_sessions: usize) -> ProxyConfig {
+        ProxyConfig {
+            forward_addr: backend.local_addr().unwrap(),
+            service_virtual_ip: None,
+            metrics: Arc::new(Metrics::new()),
+            max_dgram: Arc::new(AtomicUsize::new(0)),
+            sessions: SessionLimit::new(max_sessions),
+        }
+    }
+
+    /// Poll until the workers have returned `count` packets (or 5 s pass)
+    fn wait_for_returns(poll: &mut Poll, pool: &mut WorkerPool, count: usize) -> Vec<Vec<u8>> {
+        let mut events = Events::with_capacity(8);
+        let deadline = Instant::now() + Duration::from_secs(5);
+        let mut returned = pool.take_returns();
+        while returned.len() < count && Instant::now() < deadline {
+            poll.poll(&mut events, Some(Duration::from_millis(100)))
+                .unwrap();
+            returned.extend(pool.take_returns());
+        }
+        returned
+    }
+
+    #[test]
+    fn test_worker_answers_syn() {
+        let backend = std::net::TcpListener::bind("127.0.0.1:0").unwrap();
+        let mut poll = Poll::new().unwrap();
+        let io_waker = Arc::new(Waker::new(poll.registry(), Token(7)).unwrap());
+        let config = proxy_config(&backend, 16);
+        let mut pool = WorkerPool::spawn(2, &config, io_waker).unwrap();
+
+        let agent = Ipv4Addr::new(100, 64, 0, 1);
+        let service = Ipv4Addr::new(10, 100, 0, 1);
+        let syn = build_tcp_packet(agent, 40000, service, 80, 1000, 0, TCP_SYN, 65535, &[]);
+        assert!(pool.dispatch(&syn, 20));
+        pool.wake();
+
+        // The worker connects to the backend, then returns a SYN-ACK
+        let returned = wait_for_returns(&mut poll, &mut pool, 1);
+        assert_eq!(returned.len(), 1);
+        let syn_ack = &returned[0];
+        assert_eq!(syn_ack[33] & (TCP_SYN | TCP_ACK), TCP_SYN | TCP_ACK);
+        assert_eq!(&syn_ack[16..20], &agent.octets());
+        // Acknowledges the Agent's ISN
+        assert_eq!(&syn_ack[28..32], &1001u32.to_be_bytes());
+    }
+
+    #[test]
+    fn test_limits_span_workers() {
+        let backend = std::net::TcpListener::bind("127.0.0.1:0").unwrap();
+        let mut poll = Poll::new().unwrap();
+        let io_waker = Arc::new(Waker::new(poll.registry(), Token(7)).unwrap());
+        let config = proxy_config(&backend, 3);
+        let mut pool = WorkerPool::spawn(4, &config, io_waker).unwrap();
+        let service = Ipv4Addr::new(10, 100, 0, 1);
+
+        // One source's SYNs spread over every worker, yet only
+        // MAX_SYN_PER_SOURCE_PER_SECOND of them get through
+        let agent = Ipv4Addr::new(100, 64, 0, 1);
+        let syns = MAX_SYN_PER_SOURCE_PER_SECOND as u16 + 5;
+        let mut refused = 0;
+        for port in 0..syns {
+            let syn = build_tcp_packet(agent, 40000 + port, service, 80, 1, 0, TCP_SYN, 65535, &[]);
+            if !pool.dispatch(&syn, 20) {
+                refused += 1;
+            }
+        }
+        assert_eq!(refused, 5);
+        pool.wake();
+
+        // Of the admitted ones, the shared limit lets 3 sessions open
+        let returned = wait_for_returns(&mut poll, &mut pool, syns as usize);
+        assert_eq!(returned.len(), syns as usize);
+        let resets = returned.iter().filter(|p| p[33] & TCP_RST != 0).count();
+        assert_eq!(resets, syns as usize - 3);
+        assert_eq!(config.sessions.active(), 3);
+    }
+}
@@ -20,6 +20,8 @@ const ALPN_PROTOCOL: &[u8] = b"ztna-v1";
 const SERVER_PORT: u16 = 4436; // Use different port for testing (avoid 4433 default, 4435 intermediate-server tests)
 const SERVER_PORT_P2P: u16 = 4437; // Separate port for P2P test to avoid parallel conflict
 const CONNECTOR_P2P_PORT: u16 = 5500; // Port for P2P testing
+const SERVER_PORT_P2P_WORKERS: u16 = 4438; // Intermediate for the P2P listener test
+const CONNECTOR_P2P_WORKERS_PORT: u16 = 5501; // SO_REUSEPORT P2P listener port
 const REG_TYPE_CONNECTOR: u8 = 0x11;
 const QAD_OBSERVED_ADDRESS: u8 = 0x01;
 
@@ -256,6 +258,36 @@ impl ConnectorProcess {
     fn start_with_p2p(
         server_port: u16,
         p2p_bind_port: u16,
+    ) -> Result<Self, Box<dyn std::error::Error>> {
+        Self::spawn(server_port, p2p_bind_port, &[])
+    }
+
+    /// Start the connector with `workers` P2P listener threads sharing
+    /// `p2p_bind_port` through SO_REUSEPORT
+    fn start_with_p2p_workers(
+        server_port: u16,
+        p2p_bind_port: u16,
+        workers: usize,
+    ) -> Result<Self, Box<dyn std::error::Error>> {
+        let port = p2p_bind_port.to_string();
+        let workers = workers.to_string();
+        Self::spawn(
+            server_port,
+            p2p_bind_port,
+            &[
+                "--p2p-listen-port",
+                &port,
+                "--p2p-workers",
+                &workers,
+                "--no-verify-peer",
+            ],
+        )
+    }
+
+    fn spawn(
+        server_port: u16,
+        p2p_bind_port: u16,
+        extra_args: &[&str],
     ) -> Result<Self, Box<dyn std::error::Error>> {
         // Build the connector first
         let status = Command::new("cargo")
@@ -288,6 +320,7 @@ impl ConnectorProcess {
                 "--metrics-port",
                 "0",
             ])
+            .args(extra_args)
             .current_dir(".")
             .env("RUST_LOG", "info")
             .spawn()?;
@@ -352,3 +385,168 @@ fn test_connector_p2p_mode_starts() {
     // 3. Started the main event loop
     println!("Connector P2P mode started successfully");
 }
+
+/// Send everything `conn` has queued from `socket`
+fn flush(conn: &mut quiche::Connection, socket: &UdpSocket, send_buf: &mut [u8]) {
+    loop {
+        match conn.send(send_buf) {
+            Ok((len, send_info)) => {
+                socket
+                    .send_to(&send_buf[..len], send_info.to)
+                    .expect("Failed to send");
+            }
+            Err(quiche::Error::Done) => break,
+            Err(e) => panic!("Send error: {:?}", e),
+        }
+    }
+}
+
+/// Drive `conn` over `socket` until `done` holds or `timeout` passes.
+/// Packets are handed to quiche as received on `local`, as behind a NAT
+/// that rewrites the Agent's source port. Returns the packets received.
+fn drive(
+    conn: &mut quiche::Connection,
+    poll: &mut Poll,
+    socket: &UdpSocket,
+    local: SocketAddr,
+    timeout: Duration,
+    mut done: impl FnMut(&mut quiche::Connection) -> bool,
+) -> usize {
+    let mut events = Events::with_capacity(64);
+    let mut buf = vec![0u8; 65535];
+    let mut send_buf = vec![0u8; MAX_DATAGRAM_SIZE];
+    let mut received = 0;
+    let start = std::time::Instant::now();
+
+    flush(conn, socket, &mut send_buf);
+    while start.elapsed() < timeout && !conn.is_closed() {
+        let poll_timeout = conn.timeout().unwrap_or(Duration::from_millis(100));
+        poll.poll(
+            &mut events,
+            Some(poll_timeout.min(Duration::from_millis(100))),
+        )
+        .expect("Poll failed");
+
+        loop {
+            match socket.recv_from(&mut buf) {
+                Ok((len, from)) => {
+                    let recv_info = quiche::RecvInfo { from, to: local };
+                    if conn.recv(&mut buf[..len], recv_info).is_ok() {
+                        received += 1;
+                    }
+                }
+                Err(e) if e.kind() == io::ErrorKind::WouldBlock => break,
+                Err(e) => panic!("Recv error: {:?}", e),
+            }
+        }
+        conn.on_timeout();
+        flush(conn, socket, &mut send_buf);
+
+        if done(conn) {
+            break;
+        }
+    }
+    received
+}
+
+/// Test an Agent connecting straight to a Connector running `--p2p-workers 2`.
+///
+/// This test validates:
+/// 1. The listener answers the first Initial with a Retry, and accepts the
+///    Initial that returns its token (quiche's client follows the Retry)
+/// 2. The handshake completes on a listener worker and the Agent gets QAD
+/// 3. The connection survives the Agent's source port changing, as after
+///    NAT rebinding. Each rebind picks a new 4-tuple, so over several of
+///    them the kernel hands packets to the worker that does not own the
+///    connection, which must pass them on to the owner.
+#[test]
+fn test_connector_p2p_listener_retry_and_rebinding() {
+    let _server = match ServerProcess::start(SERVER_PORT_P2P_WORKERS) {
+        Ok(s) => s,
+        Err(e) => {
+            eprintln!(
+                "Failed to start server (expected in some CI environments): {}",
+                e
+            );
+            return;
+        }
+    };
+
+    let _connector = ConnectorProcess::start_with_p2p_workers(
+        SERVER_PORT_P2P_WORKERS,
+        CONNECTOR_P2P_WORKERS_PORT,
+        2,
+    )
+    .expect("Connector with P2P workers should start");
+
+    let mut config = create_quic_client_config().expect("Failed to create config");
+    let mut poll = Poll::new().expect("Failed to create poll");
+    let connector_addr: SocketAddr = format!("127.0.0.1:{}", CONNECTOR_P2P_WORKERS_PORT)
+        .parse()
+        .unwrap();
+    let mut socket = UdpSocket::bind("127.0.0.1:0".parse().unwrap()).expect("Failed to bind");
+    poll.registry()
+        .register(&mut socket, SOCKET_TOKEN, Interest::READABLE)
+        .expect("Failed to register socket");
+
+    let rng = SystemRandom::new();
+    let mut scid = [0u8; quiche::MAX_CONN_ID_LEN];
+    rng.fill(&mut scid).expect("Failed to generate scid");
+    let scid = quiche::ConnectionId::from_ref(&scid);
+
+    // The address quiche keeps seeing as its own, whichever socket is used
+    let local = socket.local_addr().expect("Failed to get local addr");
+    let mut conn = quiche::connect(None, &scid, local, connector_addr, &mut config)
+        .expect("Failed to create connection");
+
+    let mut qad_received = false;
+    drive(
+        &mut conn,
+        &mut poll,
+        &socket,
+        local,
+        Duration::from_secs(5),
+        |conn| {
+            let mut dgram = [0u8; MAX_DATAGRAM_SIZE];
+            while let Ok(len) = conn.dgram_recv(&mut dgram) {
+                qad_received |= len >= 7 && dgram[0] == QAD_OBSERVED_ADDRESS;
+            }
+            qad_received
+        },
+    );
+    assert!(conn.is_established(), "P2P handshake should complete");
+    assert!(qad_received, "Should have received QAD from the listener");
+
+    // Rebind: same connection, new source port each time
+    for round in 1..=4 {
+        poll.registry()
+            .deregister(&mut socket)
+            .expect("Failed to deregister socket");
+        socket = UdpSocket::bind("127.0.0.1:0".parse().unwrap()).expect("Failed to bind");
+        poll.registry()
+            .register(&mut socket, SOCKET_TOKEN, Interest::READABLE)
+            .expect("Failed to register socket");
+
+        conn.send_ack_eliciting().expect("Failed to queue PING");
+        let received = drive(
+            &mut conn,
+            &mut poll,
+            &socket,
+            local,
+            Duration::from_secs(3),
+            |_| false,
+        );
+        println!(
+            "Rebind {} from {}: {} packets back",
+            round,
+            socket.local_addr().unwrap(),
+            received
+        );
+        assert!(
+            received > 0,
+            "Connector should answer from the rebound port (round {})",
+            round
+        );
+        assert!(!conn.is_closed(), "Connection should survive rebinding");
+    }
+}
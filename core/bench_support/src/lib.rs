@@ -0,0 +1,26 @@
+//! Criterion setup for micro-benchmarks run as ignored tests
+//!
+//! The Intermediate Server and the App Connector are binaries without a
+//! library target, so their benchmarks live in `src/benches.rs` and run
+//! under the libtest harness. libtest owns the command line, so Criterion's
+//! own `--save-baseline` / `--baseline` flags are unavailable; baselines are
+//! chosen through the environment instead:
+//!
+//! ```text
+//! BENCH_SAVE_BASELINE=main cargo test --release bench_ -- --ignored --test-threads 1
+//! BENCH_BASELINE=main      cargo test --release bench_ -- --ignored --test-threads 1
+//! ```
+
+use criterion::Criterion;
+
+/// Criterion configured from `BENCH_SAVE_BASELINE` / `BENCH_BASELINE`
+pub fn criterion() -> Criterion {
+    let c = Criterion::default();
+    if let Ok(name) = std::env::var("BENCH_BASELINE") {
+        c.retain_baseline(name, false)
+    } else if let Ok(name) = std::env::var("BENCH_SAVE_BASELINE") {
+        c.save_baseline(name)
+    } else {
+        c
+    }
+}
@@ -0,0 +1,86 @@
+//! Congestion control selection for quiche configs
+//!
+//! Read from a `congestion_control` object in the JSON config:
+//!
+//! ```json
+//! { "algorithm": "bbr2", "hystart": true, "pacing": true }
+//! ```
+//!
+//! Unset fields keep quiche's defaults (CUBIC, HyStart++ on, pacing on).
+//! `algorithm` accepts quiche's names: `reno`, `cubic`, `bbr` and `bbr2`.
+//!
+//! Shared by the Intermediate Server and the App Connector.
+
+use serde::Deserialize;
+
+#[derive(Debug, Clone, Default, Deserialize)]
+pub struct CongestionConfig {
+    pub algorithm: Option<String>,
+    pub hystart: Option<bool>,
+    pub pacing: Option<bool>,
+}
+
+impl CongestionConfig {
+    /// Apply to a quiche config; fails on an unknown algorithm name
+    pub fn apply(&self, config: &mut quiche::Config) -> Result<(), String> {
+        if let Some(ref name) = self.algorithm {
+            config
+                .set_cc_algorithm_name(name)
+                .map_err(|_| format!("unknown congestion control algorithm '{}'", name))?;
+        }
+        if let Some(hystart) = self.hystart {
+            config.enable_hystart(hystart);
+        }
+        if let Some(pacing) = self.pacing {
+            config.enable_pacing(pacing);
+        }
+        Ok(())
+    }
+}
+
+impl std::fmt::Display for CongestionConfig {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        let on_off = |v: Option<bool>| if v.unwrap_or(true) { "on" } else { "off" };
+        write!(
+            f,
+            "{} (HyStart++ {}, pacing {})",
+            self.algorithm.as_deref().unwrap_or("cubic"),
+            on_off(self.hystart),
+            on_off(self.pacing)
+        )
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_parse_and_display() {
+        let cc: CongestionConfig =
+            serde_json::from_str(r#"{"algorithm": "bbr2", "pacing": true}"#).unwrap();
+        assert_eq!(cc.algorithm.as_deref(), Some("bbr2"));
+        assert_eq!(cc.hystart, None);
+        assert_eq!(cc.to_string(), "bbr2 (HyStart++ on, pacing on)");
+
+        let default = CongestionConfig::default();
+        assert_eq!(default.to_string(), "cubic (HyStart++ on, pacing on)");
+    }
+
+    #[test]
+    fn test_apply_rejects_unknown_algorithm() {
+        let mut config = quiche::Config::new(quiche::PROTOCOL_VERSION).unwrap();
+        let cc = CongestionConfig {
+            algorithm: Some("vegas".to_string()),
+            ..Default::default()
+        };
+        assert!(cc.apply(&mut config).unwrap_err().contains("vegas"));
+
+        let cc = CongestionConfig {
+            algorithm: Some("bbr".to_string()),
+            hystart: Some(false),
+            pacing: Some(true),
+        };
+        assert!(cc.apply(&mut config).is_ok());
+    }
+}
@@ -0,0 +1,288 @@
+//! Agent hot-path benchmarks through the C ABI
+//!
+//! Drives the same `agent_*` entry points Swift calls, against an in-process
+//! quiche server connection so no sockets are involved. Only the FFI call
+//! under test is timed; packet shuttling between the two endpoints happens
+//! outside the measured window via `iter_custom`.
+//!
+//! Run: `cargo bench --bench agent_ffi`
+//! Compare across commits: `-- --save-baseline main` then `-- --baseline main`
+
+use std::net::SocketAddr;
+use std::time::{Duration, Instant};
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+use packet_processor::{
+    agent_connect, agent_create, agent_destroy, agent_is_connected, agent_poll, agent_recv,
+    agent_recv_datagram, agent_send_datagram, agent_set_local_addr, Agent, AgentResult,
+};
+
+const MAX_DATAGRAM_SIZE: usize = 1472;
+const AGENT_IP: [u8; 4] = [127, 0, 0, 1];
+const AGENT_PORT: u16 = 50_000;
+const SERVER_IP: [u8; 4] = [127, 0, 0, 1];
+const SERVER_PORT: u16 = 4433;
+
+/// Payload sizes exercised by every benchmark (small control, typical, near-MTU)
+const PAYLOAD_SIZES: [usize; 3] = [64, 512, 1200];
+
+/// An established Agent ↔ server pair with in-memory packet exchange.
+struct Tunnel {
+    agent: *mut Agent,
+    server: quiche::Connection,
+    buf: Vec<u8>,
+}
+
+impl Tunnel {
+    fn new() -> Self {
+        let certs = concat!(env!("CARGO_MANIFEST_DIR"), "/../../certs");
+        let mut config = quiche::Config::new(quiche::PROTOCOL_VERSION).unwrap();
+        config
+            .load_cert_chain_from_pem_file(&format!("{}/cert.pem", certs))
+            .unwrap();
+        config
+            .load_priv_key_from_pem_file(&format!("{}/key.pem", certs))
+            .unwrap();
+        config.set_application_protos(&[b"ztna-v1"]).unwrap();
+        config.enable_dgram(true, 1000, 1000);
+        config.set_max_idle_timeout(30_000);
+        config.set_initial_max_data(10_000_000);
+        config.set_initial_max_stream_data_bidi_local(1_000_000);
+        config.set_initial_max_stream_data_bidi_remote(1_000_000);
+        config.set_initial_max_streams_bidi(100);
+        config.set_initial_max_streams_uni(100);
+
+        let agent = unsafe { agent_create(std::ptr::null(), false) };
+        assert!(!agent.is_null());
+        unsafe {
+            agent_set_local_addr(agent, AGENT_IP.as_ptr(), 4, AGENT_PORT);
+            assert_eq!(
+                agent_connect(agent, c"127.0.0.1".as_ptr(), SERVER_PORT),
+                AgentResult::Ok
+            );
+        }
+
+        let agent_addr = SocketAddr::from((AGENT_IP, AGENT_PORT));
+        let server_addr = SocketAddr::from((SERVER_IP, SERVER_PORT));
+        let mut buf = vec![0u8; 65535];
+
+        // First agent packet is the Initial; accept on it
+        let (len, _) = poll_agent(agent, &mut buf).expect("agent Initial");
+        let hdr = quiche::Header::from_slice(&mut buf[..len], quiche::MAX_CONN_ID_LEN).unwrap();
+        let scid = quiche::ConnectionId::from_vec(hdr.dcid.to_vec());
+        let mut server = quiche::accept(&scid, None, server_addr, agent_addr, &mut config).unwrap();
+        server
+            .recv(
+                &mut buf[..len],
+                quiche::RecvInfo {
+                    from: agent_addr,
+                    to: server_addr,
+                },
+            )
+            .unwrap();
+
+        let mut tunnel = Tunnel { agent, server, buf };
+        for _ in 0..32 {
+            tunnel.exchange();
+            if tunnel.server.is_established() && unsafe { agent_is_connected(agent) } {
+                return tunnel;
+            }
+        }
+        panic!("handshake did not complete");
+    }
+
+    /// Move every pending packet in both directions once.
+    fn exchange(&mut self) {
+        let agent_addr = SocketAddr::from((AGENT_IP, AGENT_PORT));
+        let server_addr = SocketAddr::from((SERVER_IP, SERVER_PORT));
+
+        while let Ok((len, _)) = self.server.send(&mut self.buf) {
+            unsafe {
+                agent_recv(
+                    self.agent,
+                    self.buf.as_ptr(),
+                    len,
+                    SERVER_IP.as_ptr(),
+                    SERVER_PORT,
+                );
+            }
+        }
+        while let Some((len, _)) = poll_agent(self.agent, &mut self.buf) {
+            let _ = self.server.recv(
+                &mut self.buf[..len],
+                quiche::RecvInfo {
+                    from: agent_addr,
+                    to: server_addr,
+                },
+            );
+        }
+        while self.server.dgram_recv(&mut self.buf).is_ok() {}
+    }
+
+    /// Discard tunnel packets queued for the app.
+    fn drain_received(&mut self) {
+        loop {
+            let mut len = self.buf.len();
+            let r = unsafe { agent_recv_datagram(self.agent, self.buf.as_mut_ptr(), &mut len) };
+            if r != AgentResult::Ok {
+                break;
+            }
+        }
+    }
+
+    /// Have the server emit one packet carrying `dgrams` DATAGRAM frames.
+    fn server_packet(&mut self, payload: &[u8], dgrams: usize) -> Option<Vec<u8>> {
+        for _ in 0..dgrams {
+            self.server.dgram_send(payload).ok()?;
+        }
+        let mut out = vec![0u8; MAX_DATAGRAM_SIZE];
+        let (len, _) = self.server.send(&mut out).ok()?;
+        out.truncate(len);
+        Some(out)
+    }
+}
+
+impl Drop for Tunnel {
+    fn drop(&mut self) {
+        unsafe { agent_destroy(self.agent) };
+    }
+}
+
+fn poll_agent(agent: *mut Agent, buf: &mut [u8]) -> Option<(usize, u16)> {
+    let mut len = buf.len().min(MAX_DATAGRAM_SIZE);
+    let mut port = 0u16;
+    match unsafe { agent_poll(agent, buf.as_mut_ptr(), &mut len, &mut port) } {
+        AgentResult::Ok => Some((len, port)),
+        _ => None,
+    }
+}
+
+/// Minimal IPv4/UDP packet of `size` bytes (contents are opaque to the agent).
+fn ip_packet(size: usize) -> Vec<u8> {
+    let mut pkt = vec![0u8; size];
+    pkt[0] = 0x45;
+    pkt[2..4].copy_from_slice(&(size as u16).to_be_bytes());
+    pkt[9] = 17;
+    pkt[12..16].copy_from_slice(&[100, 64, 0, 1]);
+    pkt[16..20].copy_from_slice(&[10, 100, 0, 1]);
+    pkt
+}
+
+fn bench_poll(c: &mut Criterion) {
+    let mut group = c.benchmark_group("agent_poll");
+    let mut tunnel = Tunnel::new();
+
+    // Nothing queued: cost of the FFI hop plus quiche's "nothing to send" path
+    group.bench_function("idle", |b| {
+        let mut out = vec![0u8; MAX_DATAGRAM_SIZE];
+        b.iter(|| poll_agent(tunnel.agent, &mut out))
+    });
+
+    for size in PAYLOAD_SIZES {
+        let pkt = ip_packet(size);
+        group.throughput(Throughput::Bytes(size as u64));
+        group.bench_with_input(BenchmarkId::new("one_datagram", size), &pkt, |b, pkt| {
+            b.iter_custom(|iters| {
+                let mut out = vec![0u8; MAX_DATAGRAM_SIZE];
+                let mut total = Duration::ZERO;
+                for _ in 0..iters {
+                    unsafe { agent_send_datagram(tunnel.agent, pkt.as_ptr(), pkt.len()) };
+                    let start = Instant::now();
+                    let polled = poll_agent(tunnel.agent, &mut out);
+                    total += start.elapsed();
+                    criterion::black_box(polled);
+                    tunnel.exchange();
+                }
+                total
+            })
+        });
+    }
+    group.finish();
+}
+
+fn bench_recv(c: &mut Criterion) {
+    let mut group = c.benchmark_group("agent_recv");
+    let mut tunnel = Tunnel::new();
+
+    for size in PAYLOAD_SIZES {
+        let payload = ip_packet(size);
+        group.throughput(Throughput::Bytes(size as u64));
+        group.bench_with_input(BenchmarkId::new("one_datagram", size), &payload, |b, p| {
+            b.iter_custom(|iters| {
+                let mut total = Duration::ZERO;
+                let mut done = 0;
+                while done < iters {
+                    let Some(packet) = tunnel.server_packet(p, 1) else {
+                        // Congestion window full: let ACKs flow, then retry
+                        tunnel.exchange();
+                        continue;
+                    };
+                    let start = Instant::now();
+                    let r = unsafe {
+                        agent_recv(
+                            tunnel.agent,
+                            packet.as_ptr(),
+                            packet.len(),
+                            SERVER_IP.as_ptr(),
+                            SERVER_PORT,
+                        )
+                    };
+                    total += start.elapsed();
+                    criterion::black_box(r);
+                    done += 1;
+                    tunnel.drain_received();
+                    tunnel.exchange();
+                }
+                total
+            })
+        });
+    }
+    group.finish();
+}
+
+fn bench_recv_datagram(c: &mut Criterion) {
+    let mut group = c.benchmark_group("agent_recv_datagram");
+    let mut tunnel = Tunnel::new();
+
+    for size in PAYLOAD_SIZES {
+        let payload = ip_packet(size);
+        group.throughput(Throughput::Bytes(size as u64));
+        group.bench_with_input(BenchmarkId::new("dequeue", size), &payload, |b, p| {
+            b.iter_custom(|iters| {
+                let mut out = vec![0u8; MAX_DATAGRAM_SIZE];
+                let mut total = Duration::ZERO;
+                let mut done = 0;
+                while done < iters {
+                    // Queue one tunnel packet (untimed), then time its dequeue
+                    let Some(packet) = tunnel.server_packet(p, 1) else {
+                        tunnel.exchange();
+                        continue;
+                    };
+                    unsafe {
+                        agent_recv(
+                            tunnel.agent,
+                            packet.as_ptr(),
+                            packet.len(),
+                            SERVER_IP.as_ptr(),
+                            SERVER_PORT,
+                        );
+                    }
+                    let mut len = out.len();
+                    let start = Instant::now();
+                    let r = unsafe { agent_recv_datagram(tunnel.agent, out.as_mut_ptr(), &mut len) };
+                    total += start.elapsed();
+                    criterion::black_box(r);
+                    done += 1;
+                    tunnel.drain_received();
+                    tunnel.exchange();
+                }
+                total
+            })
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, bench_poll, bench_recv, bench_recv_datagram);
+criterion_main!(benches);
@@ -0,0 +1,98 @@
+//! P2P signaling codec and connectivity-check benchmarks
+//!
+//! Run: `cargo bench --bench p2p`
+
+use std::net::{Ipv4Addr, SocketAddr};
+
+use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, Throughput};
+
+use packet_processor::p2p::{
+    decode_message, decode_messages, encode_message, Candidate, CheckList, SignalingMessage,
+};
+
+/// Host candidates on distinct IPs so every pair gets its own foundation
+/// (and therefore starts Waiting rather than Frozen).
+fn candidates(count: usize, subnet: u8) -> Vec<Candidate> {
+    (0..count)
+        .map(|i| {
+            let ip = Ipv4Addr::new(10, subnet, (i >> 8) as u8, i as u8);
+            Candidate::host(SocketAddr::from((ip, 4434)))
+        })
+        .collect()
+}
+
+fn offer(candidate_count: usize) -> SignalingMessage {
+    SignalingMessage::CandidateOffer {
+        session_id: 0x5A5A_5A5A_5A5A_5A5A,
+        service_id: "bench-service".to_string(),
+        candidates: candidates(candidate_count, 1),
+    }
+}
+
+fn bench_signaling(c: &mut Criterion) {
+    let mut group = c.benchmark_group("signaling");
+
+    for count in [1usize, 8, 32] {
+        let msg = offer(count);
+        let encoded = encode_message(&msg).unwrap();
+        group.throughput(Throughput::Bytes(encoded.len() as u64));
+
+        group.bench_with_input(BenchmarkId::new("encode", count), &msg, |b, msg| {
+            b.iter(|| encode_message(msg).unwrap())
+        });
+        group.bench_with_input(BenchmarkId::new("decode", count), &encoded, |b, buf| {
+            b.iter(|| decode_message(buf).unwrap())
+        });
+
+        // A stream read that delivered 16 back-to-back messages plus a partial one
+        let mut stream = Vec::new();
+        for _ in 0..16 {
+            stream.extend_from_slice(&encoded);
+        }
+        stream.extend_from_slice(&encoded[..encoded.len() / 2]);
+        group.throughput(Throughput::Bytes(stream.len() as u64));
+        group.bench_with_input(BenchmarkId::new("decode_messages_x16", count), &stream, |b, buf| {
+            b.iter(|| decode_messages(buf))
+        });
+    }
+    group.finish();
+}
+
+fn bench_check_list(c: &mut Criterion) {
+    let mut group = c.benchmark_group("check_list_next_request");
+
+    // local x remote candidates → pair count
+    for side in [4usize, 16, 64] {
+        let local = candidates(side, 1);
+        let remote = candidates(side, 2);
+        let pairs = side * side;
+
+        group.bench_with_input(BenchmarkId::new("first", pairs), &pairs, |b, _| {
+            b.iter_batched(
+                || {
+                    let mut list = CheckList::new(true);
+                    list.add_pairs(&local, &remote);
+                    list.start();
+                    list
+                },
+                |mut list| list.next_request(),
+                BatchSize::LargeInput,
+            )
+        });
+
+        group.bench_with_input(BenchmarkId::new("add_pairs", pairs), &pairs, |b, _| {
+            b.iter_batched(
+                || CheckList::new(true),
+                |mut list| {
+                    list.add_pairs(&local, &remote);
+                    list
+                },
+                BatchSize::LargeInput,
+            )
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, bench_signaling, bench_check_list);
+criterion_main!(benches);
@@ -0,0 +1,542 @@
+//! Deterministic path-resilience simulator
+//!
+//! Runs the Agent's `PathManager` and a pair of `HolePunchCoordinator`s on a
+//! [`VirtualClock`], so thousands of hours of direct-path outages and NAT
+//! rebinding take seconds of wall time and a given seed always produces the
+//! same numbers.
+//!
+//! Model:
+//! - The direct path alternates between up and down, with exponentially
+//!   distributed up time (`--mtbf`) and outage length (`--mttr`).
+//! - NAT rebinding (`--rebind`) kills the current direct address for good.
+//!   Once the path manager declares it failed, a fresh hole punch is
+//!   simulated and `set_direct` is called with the new address.
+//! - Keepalives and their responses cross the direct path with `--rtt` and
+//!   independent `--loss` in each direction.
+//! - `PathManager` is driven every `--tick` the way `agent_on_timeout` drives
+//!   it: poll_keepalive, deliver responses, check_timeouts, attempt_recovery.
+//! - `--policy agent` keeps the as-built Agent behaviour (once on relay, stay
+//!   there until the next `set_direct`); `--policy switch-back` also calls
+//!   `switch_to_direct` as soon as the recovered path answers a keepalive.
+//!
+//! Run: `cargo run --release --example path_sim -- --hours 5000 --seed 7`
+
+use std::collections::VecDeque;
+use std::net::SocketAddr;
+use std::time::Duration;
+
+use packet_processor::p2p::{
+    decode_keepalive, encode_keepalive_response, encode_message, ActivePath, Candidate,
+    HolePunchCoordinator, HolePunchState, PathManager, PathState, SignalingMessage, VirtualClock,
+    DEFAULT_START_DELAY_MS, HOLE_PUNCH_TIMEOUT, KEEPALIVE_SIZE, KEEPALIVE_TIMEOUT,
+    MISSED_KEEPALIVES_THRESHOLD,
+};
+
+/// IPv4 + UDP header bytes on top of each keepalive payload
+const UDP_IPV4_OVERHEAD: usize = 28;
+
+/// Clock step while a hole punch is in progress
+const PUNCH_TICK: Duration = Duration::from_millis(5);
+
+/// SplitMix64, so runs don't depend on an external RNG crate's stream.
+struct Rng(u64);
+
+impl Rng {
+    fn next_f64(&mut self) -> f64 {
+        self.0 = self.0.wrapping_add(0x9E37_79B9_7F4A_7C15);
+        let mut z = self.0;
+        z = (z ^ (z >> 30)).wrapping_mul(0xBF58_476D_1CE4_E5B9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94D0_49BB_1331_11EB);
+        ((z ^ (z >> 31)) >> 11) as f64 / (1u64 << 53) as f64
+    }
+
+    fn chance(&mut self, p: f64) -> bool {
+        p > 0.0 && self.next_f64() < p
+    }
+
+    /// Exponentially distributed duration with the given mean
+    fn exp(&mut self, mean: Duration) -> Duration {
+        Duration::from_secs_f64(-mean.as_secs_f64() * (1.0 - self.next_f64()).ln())
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Policy {
+    Agent,
+    SwitchBack,
+}
+
+#[derive(Debug, Clone)]
+struct SimConfig {
+    hours: u64,
+    seed: u64,
+    tick: Duration,
+    policy: Policy,
+    mtbf: Duration,
+    mttr: Duration,
+    rebind: Option<Duration>,
+    rtt: Duration,
+    loss: f64,
+    relay_rtt: Duration,
+    /// Port-restricted NATs on both ends: inbound is dropped until we've sent
+    apdf: bool,
+    punch_trials: u64,
+}
+
+fn parse_arg(args: &[String], flag: &str) -> Option<String> {
+    args.iter()
+        .position(|a| a == flag)
+        .and_then(|i| args.get(i + 1).cloned())
+}
+
+impl SimConfig {
+    fn from_args(args: &[String]) -> Result<Self, String> {
+        let num = |flag: &str, default: f64| -> Result<f64, String> {
+            match parse_arg(args, flag) {
+                None => Ok(default),
+                Some(v) => v
+                    .parse::<f64>()
+                    .ok()
+                    .filter(|n| *n >= 0.0)
+                    .ok_or_else(|| format!("{}: invalid number '{}'", flag, v)),
+            }
+        };
+        let secs = |flag: &str, default: f64| num(flag, default).map(Duration::from_secs_f64);
+        let millis = |flag: &str, default: f64| {
+            num(flag, default).map(|ms| Duration::from_secs_f64(ms / 1000.0))
+        };
+
+        let policy = match parse_arg(args, "--policy").as_deref().unwrap_or("agent") {
+            "agent" => Policy::Agent,
+            "switch-back" => Policy::SwitchBack,
+            other => {
+                return Err(format!(
+                    "--policy: expected agent|switch-back, got '{}'",
+                    other
+                ))
+            }
+        };
+
+        let cfg = SimConfig {
+            hours: num("--hours", 1000.0)? as u64,
+            seed: num("--seed", 1.0)? as u64,
+            tick: millis("--tick", 250.0)?,
+            policy,
+            mtbf: secs("--mtbf", 1800.0)?,
+            mttr: secs("--mttr", 20.0)?,
+            rebind: Some(secs("--rebind", 7200.0)?).filter(|d| !d.is_zero()),
+            rtt: millis("--rtt", 30.0)?,
+            loss: num("--loss", 0.01)?,
+            relay_rtt: millis("--relay-rtt", 60.0)?,
+            apdf: parse_arg(args, "--filtering").as_deref() != Some("eif"),
+            punch_trials: num("--punch-trials", 1000.0)? as u64,
+        };
+        if cfg.tick.is_zero() || cfg.mtbf.is_zero() || cfg.mttr.is_zero() {
+            return Err("--tick, --mtbf and --mttr must be positive".to_string());
+        }
+        if cfg.loss >= 1.0 {
+            return Err("--loss must be below 1".to_string());
+        }
+        Ok(cfg)
+    }
+}
+
+fn percentile_ms(sorted: &[Duration], q: f64) -> u128 {
+    if sorted.is_empty() {
+        return 0;
+    }
+    let idx = ((sorted.len() - 1) as f64 * q).round() as usize;
+    sorted[idx].as_millis()
+}
+
+/// Result of one simulated hole punch
+struct PunchOutcome {
+    connected: bool,
+    /// From the Intermediate sending StartPunching to the Agent reaching
+    /// Connected (or giving up)
+    elapsed: Duration,
+}
+
+/// Punch between an Agent (controlling) and a Connector (controlled) over a
+/// direct path with the configured RTT and loss. Each side gets StartPunching
+/// after half a relay RTT, skewed by up to a quarter of that, so with APDF
+/// filtering the first requests can hit a closed pinhole.
+fn simulate_punch(cfg: &SimConfig, rng: &mut Rng, agent_port: u16) -> PunchOutcome {
+    let clock = VirtualClock::new();
+    let addrs: [SocketAddr; 2] = [
+        SocketAddr::from(([192, 0, 2, 10], agent_port)),
+        SocketAddr::from(([198, 51, 100, 20], 4434)),
+    ];
+    let mut sides = [
+        HolePunchCoordinator::with_clock(1, "sim".to_string(), true, clock.shared()),
+        HolePunchCoordinator::with_clock(1, "sim".to_string(), false, clock.shared()),
+    ];
+    for (side, addr) in sides.iter_mut().zip(addrs) {
+        side.start_gathering(&[addr]);
+    }
+
+    let one_way = cfg.rtt / 2;
+    let signal_at = |rng: &mut Rng| {
+        let base = cfg.relay_rtt / 2;
+        base + base.mul_f64(rng.next_f64() * 0.25)
+    };
+    let mut start_at = [Some(signal_at(rng)), Some(signal_at(rng))];
+    let mut pinhole_open = [!cfg.apdf; 2];
+    // (arrival, destination side, payload)
+    let mut wire: Vec<(Duration, usize, Vec<u8>)> = Vec::new();
+
+    while clock.elapsed() < HOLE_PUNCH_TIMEOUT * 2 {
+        let now = clock.elapsed();
+
+        for i in 0..2 {
+            if start_at[i].is_some_and(|at| now >= at) {
+                start_at[i] = None;
+                let msg = SignalingMessage::StartPunching {
+                    session_id: 1,
+                    start_delay_ms: DEFAULT_START_DELAY_MS,
+                    peer_candidates: vec![Candidate::host(addrs[1 - i])],
+                };
+                let _ = sides[i].process_signaling(&encode_message(&msg).unwrap());
+            }
+        }
+
+        for i in 0..2 {
+            sides[i].on_timeout();
+            while let Some((_, request)) = sides[i].poll_binding_request() {
+                pinhole_open[i] = true;
+                if !rng.chance(cfg.loss) {
+                    wire.push((now + one_way, 1 - i, request));
+                }
+            }
+        }
+
+        let (due, pending): (Vec<_>, Vec<_>) = wire.drain(..).partition(|(at, _, _)| *at <= now);
+        wire = pending;
+        for (_, to, data) in due {
+            if !pinhole_open[to] {
+                continue;
+            }
+            if let Ok(Some(response)) = sides[to].process_binding(addrs[1 - to], &data) {
+                if !rng.chance(cfg.loss) {
+                    wire.push((now + one_way, 1 - to, response));
+                }
+            }
+        }
+
+        match sides[0].state() {
+            HolePunchState::Connected => {
+                return PunchOutcome {
+                    connected: true,
+                    elapsed: clock.elapsed(),
+                }
+            }
+            HolePunchState::Failed | HolePunchState::FallbackRelay => break,
+            _ => {}
+        }
+        clock.advance(PUNCH_TICK);
+    }
+
+    PunchOutcome {
+        connected: false,
+        elapsed: clock.elapsed(),
+    }
+}
+
+/// One period during which the direct path could not carry traffic
+struct Outage {
+    start: Duration,
+    end: Option<Duration>,
+    /// Traffic was on the direct path when it began
+    on_direct: bool,
+    failed_over: bool,
+}
+
+#[derive(Default)]
+struct Report {
+    outages: u64,
+    outages_on_direct: u64,
+    /// Outages on the active direct path that never caused a failover
+    missed_short: u64,
+    rebinds: u64,
+    failovers: u64,
+    /// Failovers detected only after the outage had already ended
+    late_failovers: u64,
+    /// Failovers with no outage behind them (keepalive loss)
+    false_failovers: u64,
+    failover_latency: Vec<Duration>,
+    blackhole: Duration,
+    relay_time: Duration,
+    switch_backs: u64,
+    /// From failover until traffic is back on a direct path
+    relay_episodes: Vec<Duration>,
+    punch_attempts: u64,
+    punch_successes: u64,
+    time_to_direct: Vec<Duration>,
+    keepalive_packets: u64,
+}
+
+impl Report {
+    fn record_punch(&mut self, outcome: &PunchOutcome) {
+        self.punch_attempts += 1;
+        if outcome.connected {
+            self.punch_successes += 1;
+            self.time_to_direct.push(outcome.elapsed);
+        }
+    }
+
+    fn print(&mut self, cfg: &SimConfig) {
+        let hours = cfg.hours.max(1) as f64;
+        self.failover_latency.sort_unstable();
+        self.relay_episodes.sort_unstable();
+        self.time_to_direct.sort_unstable();
+
+        println!(
+            "SIM_CONFIG hours={} seed={} tick_ms={} policy={:?} mtbf_s={} mttr_s={} rebind_s={} rtt_ms={} loss={} filtering={}",
+            cfg.hours,
+            cfg.seed,
+            cfg.tick.as_millis(),
+            cfg.policy,
+            cfg.mtbf.as_secs(),
+            cfg.mttr.as_secs(),
+            cfg.rebind.map_or(0, |d| d.as_secs()),
+            cfg.rtt.as_millis(),
+            cfg.loss,
+            if cfg.apdf { "apdf" } else { "eif" },
+        );
+        println!(
+            "SIM_OUTAGES total={} on_direct={} missed_short={} rebinds={}",
+            self.outages, self.outages_on_direct, self.missed_short, self.rebinds
+        );
+        println!(
+            "SIM_FAILOVER count={} late={} false={} p50_ms={} p99_ms={} max_ms={}",
+            self.failovers,
+            self.late_failovers,
+            self.false_failovers,
+            percentile_ms(&self.failover_latency, 0.5),
+            percentile_ms(&self.failover_latency, 0.99),
+            percentile_ms(&self.failover_latency, 1.0),
+        );
+        println!(
+            "SIM_BLACKHOLE total_s={:.1} per_outage_ms={}",
+            self.blackhole.as_secs_f64(),
+            if self.outages_on_direct > 0 {
+                self.blackhole.as_millis() / self.outages_on_direct as u128
+            } else {
+                0
+            }
+        );
+        println!(
+            "SIM_RECOVERY switch_backs={} relay_episode_p50_ms={} relay_episode_p99_ms={} relay_pct={:.2}",
+            self.switch_backs,
+            percentile_ms(&self.relay_episodes, 0.5),
+            percentile_ms(&self.relay_episodes, 0.99),
+            100.0 * self.relay_time.as_secs_f64() / (hours * 3600.0),
+        );
+        println!(
+            "SIM_PUNCH attempts={} success_pct={:.2} time_to_direct_p50_ms={} time_to_direct_p99_ms={}",
+            self.punch_attempts,
+            if self.punch_attempts > 0 {
+                100.0 * self.punch_successes as f64 / self.punch_attempts as f64
+            } else {
+                0.0
+            },
+            percentile_ms(&self.time_to_direct, 0.5),
+            percentile_ms(&self.time_to_direct, 0.99),
+        );
+        let per_hour = self.keepalive_packets as f64 / hours;
+        println!(
+            "SIM_KEEPALIVE packets_per_hour={:.1} bytes_per_hour={:.0}",
+            per_hour,
+            per_hour * (KEEPALIVE_SIZE + UDP_IPV4_OVERHEAD) as f64,
+        );
+    }
+}
+
+fn run(cfg: &SimConfig) -> Report {
+    let mut rng = Rng(cfg.seed);
+    let mut report = Report::default();
+
+    for _ in 0..cfg.punch_trials {
+        let outcome = simulate_punch(cfg, &mut rng, 40000);
+        report.record_punch(&outcome);
+    }
+
+    let clock = VirtualClock::new();
+    let mut pm = PathManager::with_clock(clock.shared());
+    pm.set_relay(SocketAddr::from(([203, 0, 113, 1], 4433)));
+
+    let mut port: u16 = 40000;
+    let direct_addr = |port: u16| SocketAddr::from(([198, 51, 100, 20], port));
+    pm.set_direct(direct_addr(port));
+
+    let end = Duration::from_secs(cfg.hours * 3600);
+    let mut link_up = true;
+    let mut next_flap = rng.exp(cfg.mtbf);
+    let mut next_rebind = cfg.rebind.map(|mean| rng.exp(mean));
+    // Address killed by the last rebind, until a re-punch replaces it
+    let mut dead_addr: Option<SocketAddr> = None;
+    let mut repunch_done: Option<(Duration, bool)> = None;
+
+    // Current or most recent outage
+    let mut outage: Option<Outage> = None;
+    // A keepalive lost just before an outage ends still times out afterwards
+    let late_window = KEEPALIVE_TIMEOUT + cfg.tick * MISSED_KEEPALIVES_THRESHOLD;
+    let mut on_relay_since: Option<Duration> = None;
+    let mut responses: VecDeque<(Duration, SocketAddr, [u8; KEEPALIVE_SIZE])> = VecDeque::new();
+
+    while clock.elapsed() < end {
+        let now = clock.elapsed();
+
+        if now >= next_flap {
+            link_up = !link_up;
+            next_flap = now + rng.exp(if link_up { cfg.mtbf } else { cfg.mttr });
+        }
+        if next_rebind.is_some_and(|at| now >= at) {
+            report.rebinds += 1;
+            dead_addr = pm.direct_path().map(|p| p.remote_addr);
+            next_rebind = cfg.rebind.map(|mean| now + rng.exp(mean));
+        }
+
+        // Once the rebound path is declared failed, punch a new one
+        let direct_state = pm.direct_path().map(|p| p.state);
+        if dead_addr.is_some() && repunch_done.is_none() && direct_state == Some(PathState::Failed)
+        {
+            let outcome = if link_up {
+                simulate_punch(cfg, &mut rng, port.wrapping_add(1))
+            } else {
+                PunchOutcome {
+                    connected: false,
+                    elapsed: HOLE_PUNCH_TIMEOUT,
+                }
+            };
+            report.record_punch(&outcome);
+            repunch_done = Some((now + outcome.elapsed, outcome.connected));
+        }
+        if let Some((at, connected)) = repunch_done {
+            if now >= at {
+                repunch_done = None;
+                if connected {
+                    port = port.wrapping_add(1);
+                    pm.set_direct(direct_addr(port));
+                    dead_addr = None;
+                    if let Some(since) = on_relay_since.take() {
+                        report.relay_episodes.push(now - since);
+                    }
+                }
+            }
+        }
+
+        let direct = pm.direct_path().map(|p| p.remote_addr);
+        let reachable = link_up && direct.is_some() && direct != dead_addr;
+        let on_direct = pm.active_path_type() == ActivePath::Direct;
+
+        let in_outage = outage.as_ref().is_some_and(|o| o.end.is_none());
+        if in_outage && reachable {
+            outage.as_mut().unwrap().end = Some(now);
+        } else if !in_outage && !reachable {
+            if let Some(prev) = outage.take() {
+                report.missed_short += (prev.on_direct && !prev.failed_over) as u64;
+            }
+            report.outages += 1;
+            report.outages_on_direct += on_direct as u64;
+            outage = Some(Outage {
+                start: now,
+                end: None,
+                on_direct,
+                failed_over: false,
+            });
+        }
+
+        while let Some((addr, request)) = pm.poll_keepalive() {
+            report.keepalive_packets += 1;
+            if reachable && !rng.chance(cfg.loss) {
+                let (_, seq) = decode_keepalive(&request).unwrap();
+                report.keepalive_packets += 1;
+                if !rng.chance(cfg.loss) {
+                    responses.push_back((now + cfg.rtt, addr, encode_keepalive_response(seq)));
+                }
+            }
+        }
+        while responses.front().is_some_and(|(at, _, _)| *at <= now) {
+            let (_, addr, response) = responses.pop_front().unwrap();
+            pm.process_keepalive(addr, &response);
+        }
+
+        if pm.check_timeouts() && on_direct {
+            report.failovers += 1;
+            on_relay_since = Some(now);
+            let attributable = |o: &Outage| match o.end {
+                _ if !o.on_direct || o.failed_over => false,
+                Some(end) => now - end <= late_window,
+                None => true,
+            };
+            match outage.as_mut() {
+                Some(o) if attributable(o) => {
+                    o.failed_over = true;
+                    report.failover_latency.push(now - o.start);
+                    report.late_failovers += o.end.is_some() as u64;
+                }
+                _ => report.false_failovers += 1,
+            }
+        }
+        pm.attempt_recovery();
+
+        if cfg.policy == Policy::SwitchBack
+            && pm.is_in_fallback()
+            && pm.direct_path().map(|p| p.state) == Some(PathState::Active)
+        {
+            pm.switch_to_direct();
+            report.switch_backs += 1;
+            if let Some(since) = on_relay_since.take() {
+                report.relay_episodes.push(now - since);
+            }
+        }
+
+        match pm.active_path_type() {
+            ActivePath::Direct if !reachable => report.blackhole += cfg.tick,
+            ActivePath::Relay => report.relay_time += cfg.tick,
+            _ => {}
+        }
+        clock.advance(cfg.tick);
+    }
+
+    if let Some(last) = outage {
+        report.missed_short += (last.on_direct && !last.failed_over) as u64;
+    }
+    report
+}
+
+fn print_usage() {
+    println!("Usage: path_sim [options]");
+    println!();
+    println!("  --hours N          Virtual hours to simulate (default 1000)");
+    println!("  --seed N           RNG seed (default 1)");
+    println!("  --tick MS          agent_on_timeout cadence (default 250)");
+    println!("  --policy P         agent | switch-back (default agent)");
+    println!("  --mtbf S           Mean direct-path up time (default 1800)");
+    println!("  --mttr S           Mean outage length (default 20)");
+    println!("  --rebind S         Mean time between NAT rebinds, 0 = never (default 7200)");
+    println!("  --rtt MS           Direct-path RTT (default 30)");
+    println!("  --loss P           Per-direction loss probability (default 0.01)");
+    println!("  --relay-rtt MS     Signaling RTT via the Intermediate (default 60)");
+    println!("  --filtering F      apdf | eif NAT filtering on both ends (default apdf)");
+    println!("  --punch-trials N   Standalone hole punches to sample (default 1000)");
+}
+
+fn main() {
+    let args: Vec<String> = std::env::args().collect();
+    if args.iter().any(|a| a == "--help" || a == "-h") {
+        print_usage();
+        return;
+    }
+
+    let cfg = match SimConfig::from_args(&args) {
+        Ok(cfg) => cfg,
+        Err(e) => {
+            eprintln!("Error: {}", e);
+            std::process::exit(2);
+        }
+    };
+
+    run(&cfg).print(&cfg);
+}
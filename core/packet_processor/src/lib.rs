@@ -12,11 +12,12 @@
 //! `# Safety` doc sections that would all say the same thing.
 #![allow(clippy::missing_safety_doc)]
 
+use std::borrow::Cow;
 use std::collections::{HashMap, VecDeque};
 use std::net::SocketAddr;
 use std::panic::{self, AssertUnwindSafe};
 use std::slice;
-use std::sync::Once;
+use std::sync::{Arc, Once};
 use std::time::{Duration, Instant};
 
 use quiche::{Config, Connection, ConnectionId};
@@ -29,16 +30,49 @@ use ring::rand::{SecureRandom, SystemRandom};
 /// P2P module for direct peer-to-peer connectivity via NAT traversal
 pub mod p2p;
 
+/// Binary event ring drained by the host via `agent_drain_trace`
+pub mod trace;
+
+/// Transport statistics snapshot read by the host via `agent_get_stats`
+pub mod stats;
+
+/// qlog streaming to a host callback, enabled via `agent_set_qlog`
+pub mod qlog;
+
+/// DATAGRAM aggregation, header compression and FEC, shared with the
+/// Connector (core/tunnel_codec)
+pub use tunnel_codec::{aggregate, fec, header_compression};
+
+/// TCP MSS clamping of SYNs so segments fit the tunnel's DATAGRAM size
+pub mod mss;
+
+/// Priority classes for tunneled packets, set via `agent_set_class_rules`
+pub mod priority;
+
+use trace::{DropReason, TraceKind, TraceRing, TRACE_PATH_INTERMEDIATE, TRACE_PATH_P2P};
+
 // ============================================================================
 // Constants
 // ============================================================================
 
-/// Maximum UDP payload size for QUIC packets
-const MAX_DATAGRAM_SIZE: usize = 1350;
+/// Largest UDP payload the Agent sends or accepts: a 1500-byte Ethernet MTU
+/// less IPv4 and UDP headers. Connections start at quiche's 1200-byte floor
+/// and DPLPMTUD probes up to this, so hosts must size `agent_poll` buffers
+/// for it.
+const MAX_DATAGRAM_SIZE: usize = 1472;
 
 /// QUIC idle timeout in milliseconds
 const IDLE_TIMEOUT_MS: u64 = 30000;
 
+/// Receive windows advertised at connect. quiche auto-tunes them, doubling a
+/// window the peer fills within two RTTs, so they grow toward the path's BDP.
+const INITIAL_CONNECTION_WINDOW: u64 = 1024 * 1024;
+const INITIAL_STREAM_WINDOW: u64 = 256 * 1024;
+
+/// Auto-tuning ceilings: about 1 Gbit/s at 250 ms RTT, for direct P2P paths
+const MAX_CONNECTION_WINDOW: u64 = 32 * 1024 * 1024;
+const MAX_STREAM_WINDOW: u64 = 16 * 1024 * 1024;
+
 /// ALPN protocol identifier for ZTNA
 const ALPN_PROTOCOL: &[u8] = b"ztna-v1";
 
@@ -60,12 +94,19 @@ const REG_MAX_RETRIES: u32 = 3;
 /// 8B.3: Connection ID rotation interval in seconds (default: 5 minutes)
 const CID_ROTATION_INTERVAL_SECS: u64 = 300;
 
+/// Service-routed datagram: [0x2F, id_len, service_id..., ip_packet...]
+const SERVICE_ROUTED: u8 = 0x2F;
+
 /// QAD observed address message type
 const QAD_OBSERVED_ADDRESS: u8 = 0x01;
 
 /// Maximum queued received datagrams before dropping oldest (prevents OOM in NE)
 const MAX_QUEUED_DATAGRAMS: usize = 4096;
 
+/// Tunneled packets kept in quiche's DATAGRAM queue. Anything beyond waits
+/// in the priority class queues, where interactive packets can overtake it.
+const DGRAM_QUEUE_TARGET: usize = 8;
+
 // ============================================================================
 // FFI Enums
 // ============================================================================
@@ -95,6 +136,8 @@ pub enum AgentResult {
     NoData = 6,
     QuicError = 7,
     PanicCaught = 8,
+    /// The packet's priority class queue is full; it was dropped
+    QueueFull = 9,
     // Specific QUIC error codes for debugging (10+)
     QuicDone = 10,
     QuicBufferTooShort = 11,
@@ -196,6 +239,60 @@ pub struct Agent {
     registered_services: std::collections::HashSet<String>,
     /// 8B.3: Last time CID rotation was performed on connections
     last_cid_rotation: Instant,
+    /// Per-packet event trace for the host to drain (shared with
+    /// `agent_trace_handle` handles)
+    trace: Arc<TraceRing>,
+    /// Packets dropped by the Agent, reported by `agent_get_stats`
+    drops: stats::DropCounters,
+    /// qlog destination for new connections (None = qlog off)
+    qlog: Option<qlog::QlogSink>,
+    /// Tunneled packets waiting to share a DATAGRAM on the Intermediate connection
+    batch: aggregate::Aggregator,
+    /// Whether the Intermediate Server accepts aggregate DATAGRAMs (flag in REG ACK)
+    aggregate_relay: bool,
+    /// Services whose Connector decompresses headers (flag in REG ACK)
+    compressed_services: std::collections::HashSet<String>,
+    /// Header compression contexts for packets sent on the relay path
+    compressor: header_compression::Compressor,
+    /// Header compression contexts for packets received on the relay path
+    decompressor: header_compression::Decompressor,
+    /// FEC encoders for services whose Connector decodes FEC (flag in REG ACK)
+    fec_encoders: HashMap<String, fec::Encoder>,
+    /// FEC state for packets received on the relay path
+    fec_decoder: fec::Decoder,
+    /// Congestion control for new Intermediate / P2P connections
+    congestion: [CongestionSettings; 2],
+    /// Maps outgoing packets to priority classes
+    classifier: priority::Classifier,
+    /// Tunneled packets waiting for room in quiche's DATAGRAM queue
+    send_queues: priority::ClassQueues,
+}
+
+/// Congestion control applied to connections on one path
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+struct CongestionSettings {
+    algorithm: quiche::CongestionControlAlgorithm,
+    hystart: bool,
+    pacing: bool,
+}
+
+impl Default for CongestionSettings {
+    /// quiche's own defaults
+    fn default() -> Self {
+        CongestionSettings {
+            algorithm: quiche::CongestionControlAlgorithm::CUBIC,
+            hystart: true,
+            pacing: true,
+        }
+    }
+}
+
+impl CongestionSettings {
+    fn apply(&self, config: &mut Config) {
+        config.set_cc_algorithm(self.algorithm);
+        config.enable_hystart(self.hystart);
+        config.enable_pacing(self.pacing);
+    }
 }
 
 impl Agent {
@@ -230,12 +327,20 @@ impl Agent {
 
         // Set timeouts
         config.set_max_idle_timeout(IDLE_TIMEOUT_MS);
-        config.set_initial_max_data(10_000_000);
-        config.set_initial_max_stream_data_bidi_local(1_000_000);
-        config.set_initial_max_stream_data_bidi_remote(1_000_000);
+        config.set_initial_max_data(INITIAL_CONNECTION_WINDOW);
+        config.set_initial_max_stream_data_bidi_local(INITIAL_STREAM_WINDOW);
+        config.set_initial_max_stream_data_bidi_remote(INITIAL_STREAM_WINDOW);
+        config.set_max_connection_window(MAX_CONNECTION_WINDOW);
+        config.set_max_stream_window(MAX_STREAM_WINDOW);
         config.set_initial_max_streams_bidi(100);
         config.set_initial_max_streams_uni(100);
 
+        // Packetization-layer PMTU discovery (RFC 8899) on every connection,
+        // probing from 1200 bytes up to MAX_DATAGRAM_SIZE
+        config.set_max_recv_udp_payload_size(MAX_DATAGRAM_SIZE);
+        config.set_max_send_udp_payload_size(MAX_DATAGRAM_SIZE);
+        config.discover_pmtu(true);
+
         // Disable active migration (we'll handle reconnection manually)
         config.set_disable_active_migration(true);
 
@@ -257,6 +362,19 @@ impl Agent {
             pending_registrations: std::collections::HashMap::new(),
             registered_services: std::collections::HashSet::new(),
             last_cid_rotation: Instant::now(),
+            trace: Arc::new(TraceRing::default()),
+            drops: stats::DropCounters::default(),
+            qlog: None,
+            batch: aggregate::Aggregator::new(),
+            aggregate_relay: false,
+            compressed_services: std::collections::HashSet::new(),
+            compressor: header_compression::Compressor::new(),
+            decompressor: header_compression::Decompressor::new(),
+            fec_encoders: HashMap::new(),
+            fec_decoder: fec::Decoder::new(),
+            congestion: [CongestionSettings::default(); 2],
+            classifier: priority::Classifier::new(),
+            send_queues: priority::ClassQueues::new(),
         })
     }
 
@@ -267,7 +385,8 @@ impl Agent {
         let scid = ConnectionId::from_ref(&scid_bytes);
 
         // Create QUIC connection to Intermediate Server
-        let conn = quiche::connect(
+        self.congestion[TRACE_PATH_INTERMEDIATE as usize].apply(&mut self.config);
+        let mut conn = quiche::connect(
             Some("ztna-server"), // SNI
             &scid,
             self.local_addr
@@ -275,15 +394,36 @@ impl Agent {
             server_addr,
             &mut self.config,
         )?;
+        if let Some(ref qlog) = self.qlog {
+            qlog.attach(
+                &mut conn,
+                TRACE_PATH_INTERMEDIATE,
+                "ztna agent intermediate",
+            );
+        }
 
         self.intermediate_conn = Some(conn);
         self.intermediate_addr = Some(server_addr);
         self.state = AgentState::Connecting;
+        self.trace.record(
+            TraceKind::State,
+            TRACE_PATH_INTERMEDIATE,
+            AgentState::Connecting as u32,
+            0,
+        );
         self.last_activity = Instant::now();
 
         // Clear registration state — new connection requires fresh registration
         self.registered_services.clear();
         self.pending_registrations.clear();
+        self.batch = aggregate::Aggregator::new();
+        self.aggregate_relay = false;
+        self.compressed_services.clear();
+        self.compressor = header_compression::Compressor::new();
+        self.decompressor = header_compression::Decompressor::new();
+        self.fec_encoders.clear();
+        self.fec_decoder = fec::Decoder::new();
+        self.send_queues = priority::ClassQueues::new();
 
         // Set relay address in path manager
         self.path_manager.set_relay(server_addr);
@@ -303,7 +443,8 @@ impl Agent {
         let scid = ConnectionId::from_ref(&scid_bytes);
 
         // Create QUIC connection to Connector (P2P)
-        let conn = quiche::connect(
+        self.congestion[TRACE_PATH_P2P as usize].apply(&mut self.config);
+        let mut conn = quiche::connect(
             Some("ztna-connector"), // SNI
             &scid,
             self.local_addr
@@ -311,6 +452,9 @@ impl Agent {
             connector_addr,
             &mut self.config,
         )?;
+        if let Some(ref qlog) = self.qlog {
+            qlog.attach(&mut conn, TRACE_PATH_P2P, "ztna agent p2p");
+        }
 
         self.p2p_conns.insert(
             connector_addr,
@@ -331,6 +475,14 @@ impl Agent {
         // must be intercepted before QUIC parsing. The Connector echoes keepalive
         // responses as raw UDP; passing them to quiche::recv() would fail.
         // Wire format: [ZTNA_MAGIC(0x5A), type(0x10/0x11), sequence(4 bytes)]
+        let trace_path = if Some(from) == self.intermediate_addr {
+            TRACE_PATH_INTERMEDIATE
+        } else {
+            TRACE_PATH_P2P
+        };
+        self.trace
+            .record(TraceKind::Recv, trace_path, data.len() as u32, 0);
+
         if data.len() == p2p::KEEPALIVE_SIZE
             && data[0] == p2p::ZTNA_MAGIC
             && (data[1] == p2p::KEEPALIVE_REQUEST || data[1] == p2p::KEEPALIVE_RESPONSE)
@@ -380,6 +532,11 @@ impl Agent {
 
     /// Get next outbound UDP packet to send (Intermediate connection)
     fn poll(&mut self) -> Option<(Vec<u8>, SocketAddr)> {
+        // Top up quiche's DATAGRAM queue as earlier polls emptied it; packets
+        // batched since the last poll go into this flight
+        self.drain_send_queues();
+        self.flush_batch();
+
         let conn = self.intermediate_conn.as_mut()?;
         let server_addr = self.intermediate_addr?;
 
@@ -390,6 +547,8 @@ impl Agent {
             Ok((len, _send_info)) => {
                 out.truncate(len);
                 self.last_activity = Instant::now();
+                self.trace
+                    .record(TraceKind::Send, TRACE_PATH_INTERMEDIATE, len as u32, 0);
                 Some((out, server_addr))
             }
             Err(quiche::Error::Done) => None, // No more packets to send
@@ -406,6 +565,8 @@ impl Agent {
                 Ok((len, _send_info)) => {
                     out.truncate(len);
                     p2p.last_activity = Instant::now();
+                    self.trace
+                        .record(TraceKind::Send, TRACE_PATH_P2P, len as u32, 0);
                     return Some((out, *addr));
                 }
                 Err(quiche::Error::Done) => continue,
@@ -416,6 +577,11 @@ impl Agent {
     }
 
     /// Queue an IP packet for sending via DATAGRAM (Intermediate connection)
+    ///
+    /// The packet waits in its priority class queue until quiche's DATAGRAM
+    /// queue has room. `Error::Done` means its class queue is full, and
+    /// `Error::BufferTooShort` that it can never fit a DATAGRAM; neither is
+    /// queued.
     fn send_datagram(&mut self, data: &[u8]) -> Result<(), quiche::Error> {
         let conn = self
             .intermediate_conn
@@ -426,13 +592,152 @@ impl Agent {
             return Err(quiche::Error::InvalidState);
         }
 
-        // Send as QUIC DATAGRAM
-        conn.dgram_send(data)?;
-        self.last_activity = Instant::now();
+        let max_len = conn.dgram_max_writable_len().unwrap_or(MAX_DATAGRAM_SIZE);
+        let ip_start = routed_ip_start(data);
+        let clamped = mss::clamp(data, ip_start, max_len);
+        if clamped.len() > max_len {
+            self.drops.count(DropReason::SendRejected);
+            self.trace.record(
+                TraceKind::Drop,
+                TRACE_PATH_INTERMEDIATE,
+                DropReason::SendRejected as u32,
+                clamped.len() as u64,
+            );
+            return Err(quiche::Error::BufferTooShort);
+        }
+        let class = self
+            .classifier
+            .classify(clamped.get(ip_start..).unwrap_or_default());
+        if let Err(packet) = self.send_queues.push(class, clamped.into_owned()) {
+            self.drops.count(DropReason::SendRejected);
+            self.trace.record(
+                TraceKind::Drop,
+                TRACE_PATH_INTERMEDIATE,
+                DropReason::SendRejected as u32,
+                packet.len() as u64,
+            );
+            return Err(quiche::Error::Done);
+        }
+        self.drain_send_queues();
+
+        Ok(())
+    }
+
+    /// Move queued packets into quiche, highest class first, until its
+    /// DATAGRAM queue holds `DGRAM_QUEUE_TARGET`
+    fn drain_send_queues(&mut self) {
+        loop {
+            match self.intermediate_conn.as_ref() {
+                Some(conn)
+                    if conn.is_established()
+                        && conn.dgram_send_queue_len() < DGRAM_QUEUE_TARGET => {}
+                _ => return,
+            }
+            let packet = match self.send_queues.pop() {
+                Some(p) => p,
+                None => return,
+            };
+            // Sizes were checked when queued; anything else failing here
+            // is counted and traced by transmit
+            let _ = self.transmit(&packet);
+        }
+    }
+
+    /// Compress, FEC-protect and hand a tunneled packet to quiche
+    fn transmit(&mut self, data: &[u8]) -> Result<(), quiche::Error> {
+        let conn = self
+            .intermediate_conn
+            .as_mut()
+            .ok_or(quiche::Error::InvalidState)?;
+        let max_len = conn.dgram_max_writable_len().unwrap_or(MAX_DATAGRAM_SIZE);
+        let compressed = compress_routed(
+            &mut self.compressor,
+            &self.compressed_services,
+            data,
+            max_len,
+        );
+        let dgram = compressed.as_deref().unwrap_or(data);
+        let now = Instant::now();
+        let protected = protect_routed(&mut self.fec_encoders, dgram, max_len, now);
+
+        // Send as QUIC DATAGRAM, sharing one with other small packets when
+        // the server accepts aggregates (sent by the next poll or FLUSH_DELAY)
+        let dgram = protected.as_deref().unwrap_or(dgram);
+        if let Err(e) = aggregate::send(conn, &mut self.batch, self.aggregate_relay, dgram) {
+            for _ in 0..e.failed {
+                self.drops.count(DropReason::SendRejected);
+            }
+            self.trace.record(
+                TraceKind::Drop,
+                TRACE_PATH_INTERMEDIATE,
+                DropReason::SendRejected as u32,
+                data.len() as u64,
+            );
+            return Err(e.error);
+        }
+        self.trace.record(
+            TraceKind::DgramSend,
+            TRACE_PATH_INTERMEDIATE,
+            data.len() as u32,
+            conn.dgram_send_queue_len() as u64,
+        );
+        self.send_fec_repairs(now);
+        self.last_activity = now;
 
         Ok(())
     }
 
+    /// Send the repair packet of each FEC block that is full or due
+    fn send_fec_repairs(&mut self, now: Instant) {
+        let conn = match self.intermediate_conn.as_mut() {
+            Some(c) => c,
+            None => return,
+        };
+        for (service_id, encoder) in self.fec_encoders.iter_mut() {
+            if let Some(repair) = encoder.poll_repair(now) {
+                let mut dgram = Vec::with_capacity(2 + service_id.len() + repair.len());
+                dgram.push(SERVICE_ROUTED);
+                dgram.push(service_id.len() as u8);
+                dgram.extend_from_slice(service_id.as_bytes());
+                dgram.extend_from_slice(&repair);
+                if let Err(e) = aggregate::send(conn, &mut self.batch, self.aggregate_relay, &dgram)
+                {
+                    log::debug!("[agent] FEC repair for '{}' rejected: {:?}", service_id, e);
+                }
+            }
+        }
+    }
+
+    /// Hand the pending aggregate batch to quiche
+    fn flush_batch(&mut self) {
+        if self.batch.is_empty() {
+            return;
+        }
+        let conn = match self.intermediate_conn.as_mut() {
+            Some(c) => c,
+            None => return,
+        };
+        if let Err(e) = aggregate::flush(conn, &mut self.batch) {
+            log::debug!("[agent] Aggregate DATAGRAM rejected: {:?}", e.error);
+            self.drops.count(DropReason::SendRejected);
+            self.trace.record(
+                TraceKind::Drop,
+                TRACE_PATH_INTERMEDIATE,
+                DropReason::SendRejected as u32,
+                0,
+            );
+        }
+    }
+
+    /// Largest DATAGRAM payload the Intermediate connection can send on its
+    /// current path MTU (0 until the connection is established)
+    fn max_datagram_size(&self) -> usize {
+        self.intermediate_conn
+            .as_ref()
+            .and_then(|conn| conn.dgram_max_writable_len())
+            .unwrap_or(0)
+    }
+
     /// Dequeue next received IP packet (from tunnel)
     ///
     /// Returns the number of bytes written, or None if queue is empty.
@@ -442,6 +747,13 @@ impl Agent {
     fn recv_datagram(&mut self, out: &mut [u8]) -> Option<usize> {
         let data = self.received_datagrams.pop_front()?;
         if data.len() > out.len() {
+            self.drops.count(DropReason::Oversize);
+            self.trace.record(
+                TraceKind::Drop,
+                TRACE_PATH_INTERMEDIATE,
+                DropReason::Oversize as u32,
+                data.len() as u64,
+            );
             // Drop oversized datagram to prevent head-of-line blocking.
             // Returning None with the packet removed lets subsequent packets through.
             log::warn!(
@@ -464,7 +776,8 @@ impl Agent {
     /// 8A.3: Registration is now tracked — the Agent waits for an ACK from the
     /// server and retries up to REG_MAX_RETRIES times with REG_RETRY_TIMEOUT_SECS.
     ///
-    /// Message format: [0x10, service_id_len, service_id_bytes...]
+    /// Message format: [0x10, service_id_len, service_id_bytes..., flags]
+    /// (flags: `aggregate::REG_FLAG_AGGREGATE`)
     fn register(&mut self, service_id: &str) -> Result<(), quiche::Error> {
         // If already registered for this service, skip
         if self.registered_services.contains(service_id) {
@@ -487,10 +800,11 @@ impl Agent {
             return Err(quiche::Error::InvalidState); // Service ID too long
         }
 
-        let mut msg = Vec::with_capacity(2 + id_bytes.len());
+        let mut msg = Vec::with_capacity(3 + id_bytes.len());
         msg.push(REG_TYPE_AGENT);
         msg.push(id_bytes.len() as u8);
         msg.extend_from_slice(id_bytes);
+        msg.push(aggregate::REG_FLAG_AGGREGATE);
 
         conn.dgram_send(&msg)?;
         self.last_activity = Instant::now();
@@ -579,10 +893,11 @@ impl Agent {
                 self.pending_registrations.remove(&service_id);
                 continue;
             }
-            let mut msg = Vec::with_capacity(2 + id_bytes.len());
+            let mut msg = Vec::with_capacity(3 + id_bytes.len());
             msg.push(REG_TYPE_AGENT);
             msg.push(id_bytes.len() as u8);
             msg.extend_from_slice(id_bytes);
+            msg.push(aggregate::REG_FLAG_AGGREGATE);
 
             match conn.dgram_send(&msg) {
                 Ok(_) => {
@@ -649,7 +964,27 @@ impl Agent {
             return Err(quiche::Error::InvalidState);
         }
 
-        p2p.conn.dgram_send(data)?;
+        let max_len = p2p
+            .conn
+            .dgram_max_writable_len()
+            .unwrap_or(MAX_DATAGRAM_SIZE);
+        let clamped = mss::clamp(data, routed_ip_start(data), max_len);
+        if let Err(e) = p2p.conn.dgram_send(&clamped) {
+            self.drops.count(DropReason::SendRejected);
+            self.trace.record(
+                TraceKind::Drop,
+                TRACE_PATH_P2P,
+                DropReason::SendRejected as u32,
+                data.len() as u64,
+            );
+            return Err(e);
+        }
+        self.trace.record(
+            TraceKind::DgramSend,
+            TRACE_PATH_P2P,
+            data.len() as u32,
+            p2p.conn.dgram_send_queue_len() as u64,
+        );
         p2p.last_activity = Instant::now();
 
         Ok(())
@@ -657,6 +992,8 @@ impl Agent {
 
     /// Handle timeout - call periodically
     fn on_timeout(&mut self) {
+        let path_before = self.path_manager.active_path_type();
+
         // Process Intermediate connection timeout
         if let Some(conn) = self.intermediate_conn.as_mut() {
             conn.on_timeout();
@@ -680,11 +1017,51 @@ impl Agent {
         // 8A.3: Check if pending registration needs retry
         self.check_registration_retry();
 
+        // FEC blocks whose MAX_BLOCK_DELAY ran out; block sizes follow the
+        // relay connection's loss rate
+        if !self.fec_encoders.is_empty() {
+            if let Some(conn) = self.intermediate_conn.as_ref() {
+                let stats = conn.stats();
+                for encoder in self.fec_encoders.values_mut() {
+                    encoder.observe_loss(stats.sent as u64, stats.lost as u64);
+                }
+            }
+            self.send_fec_repairs(Instant::now());
+        }
+
+        // Batched packets whose FLUSH_DELAY ran out
+        if self
+            .batch
+            .deadline()
+            .map(|d| Instant::now() >= d)
+            .unwrap_or(false)
+        {
+            self.flush_batch();
+        }
+
         // 8B.3: Periodic CID rotation for privacy
         if self.last_cid_rotation.elapsed() >= Duration::from_secs(CID_ROTATION_INTERVAL_SECS) {
             self.rotate_connection_ids();
             self.last_cid_rotation = Instant::now();
         }
+
+        self.trace_path_switch(path_before);
+        let next_us = self.timeout().map_or(0, |d| d.as_micros() as u64);
+        self.trace
+            .record(TraceKind::Timer, TRACE_PATH_INTERMEDIATE, 0, next_us);
+    }
+
+    /// Record a PathSwitch event if the active path differs from `before`
+    fn trace_path_switch(&self, before: p2p::ActivePath) {
+        let after = self.path_manager.active_path_type();
+        if after != before {
+            self.trace.record(
+                TraceKind::PathSwitch,
+                TRACE_PATH_P2P,
+                active_path_code(after) as u32,
+                0,
+            );
+        }
     }
 
     /// 8B.3: Rotate connection IDs on all established connections for privacy.
@@ -742,6 +1119,16 @@ impl Agent {
     fn timeout(&self) -> Option<Duration> {
         let mut min_timeout = self.intermediate_conn.as_ref().and_then(|c| c.timeout());
 
+        if let Some(deadline) = self.batch.deadline() {
+            let t = deadline.saturating_duration_since(Instant::now());
+            min_timeout = Some(min_timeout.map_or(t, |m| m.min(t)));
+        }
+
+        for deadline in self.fec_encoders.values().filter_map(|e| e.deadline()) {
+            let t = deadline.saturating_duration_since(Instant::now());
+            min_timeout = Some(min_timeout.map_or(t, |m| m.min(t)));
+        }
+
         for p2p in self.p2p_conns.values() {
             if let Some(t) = p2p.conn.timeout() {
                 min_timeout = Some(min_timeout.map_or(t, |m| m.min(t)));
@@ -761,6 +1148,7 @@ impl Agent {
 
     /// Update agent state based on Intermediate QUIC connection state
     fn update_state(&mut self) {
+        let before = self.state;
         if let Some(conn) = &self.intermediate_conn {
             self.state = if conn.is_closed() {
                 AgentState::Closed
@@ -774,6 +1162,14 @@ impl Agent {
         } else {
             self.state = AgentState::Disconnected;
         }
+        if self.state != before {
+            self.trace.record(
+                TraceKind::State,
+                TRACE_PATH_INTERMEDIATE,
+                self.state as u32,
+                0,
+            );
+        }
     }
 
     /// Process incoming DATAGRAM frames from Intermediate connection
@@ -786,7 +1182,7 @@ impl Agent {
         // 8A.5: Collect ALL registration ACK/NACK events to process after the loop
         // (avoids borrow conflict with self.scratch_buffer)
         // Use Vec to handle multiple ACKs/NACKs in a single poll cycle
-        let mut reg_acks: Vec<String> = Vec::new();
+        let mut reg_acks: Vec<(String, u8)> = Vec::new();
         let mut reg_nacks: Vec<(u8, String)> = Vec::new();
 
         while let Ok(len) = conn.dgram_recv(&mut self.scratch_buffer) {
@@ -809,12 +1205,13 @@ impl Agent {
                 }
                 REG_TYPE_ACK => {
                     // 8A.5: Registration ACK from server
-                    // Format: [0x12, status, id_len, service_id_bytes...]
+                    // Format: [0x12, status, id_len, service_id_bytes..., flags?]
                     if len >= 3 {
                         let id_len = data[2] as usize;
                         if len >= 3 + id_len {
                             if let Ok(sid) = String::from_utf8(data[3..3 + id_len].to_vec()) {
-                                reg_acks.push(sid);
+                                let flags = data.get(3 + id_len).copied().unwrap_or(0);
+                                reg_acks.push((sid, flags));
                             }
                         }
                     }
@@ -833,22 +1230,73 @@ impl Agent {
                     }
                 }
                 _ => {
-                    // Tunneled IP packet — queue for Swift to read via agent_recv_datagram()
+                    // Tunneled IP packet(s) — queue for Swift to read via agent_recv_datagram()
                     // Enforce queue bounds to prevent OOM in Network Extension (~50MB limit)
-                    if self.received_datagrams.len() >= MAX_QUEUED_DATAGRAMS {
-                        self.received_datagrams.pop_front(); // drop oldest
+                    // (FEC repairs rebuild lost packets, then headers are restored)
+                    let packets = aggregate::unpack(data)
+                        .flat_map(|packet| self.fec_decoder.decode(packet).into_packets());
+                    for packet in packets {
+                        let packet = match self.decompressor.decompress(&packet) {
+                            Some(packet) => packet,
+                            None => {
+                                log::debug!(
+                                    "[agent] Dropping compressed packet for unknown context"
+                                );
+                                continue;
+                            }
+                        };
+                        if self.received_datagrams.len() >= MAX_QUEUED_DATAGRAMS {
+                            if let Some(dropped) = self.received_datagrams.pop_front() {
+                                self.drops.count(DropReason::RecvQueueFull);
+                                self.trace.record(
+                                    TraceKind::Drop,
+                                    TRACE_PATH_INTERMEDIATE,
+                                    DropReason::RecvQueueFull as u32,
+                                    dropped.len() as u64,
+                                );
+                            }
+                        }
+                        let len = packet.len();
+                        self.received_datagrams.push_back(packet.into_owned());
+                        self.trace.record(
+                            TraceKind::DgramRecv,
+                            TRACE_PATH_INTERMEDIATE,
+                            len as u32,
+                            self.received_datagrams.len() as u64,
+                        );
                     }
-                    self.received_datagrams.push_back(data.to_vec());
                 }
             }
         }
 
         // Process all registration ACKs/NACKs outside the borrow scope
-        for service_id in reg_acks {
+        for (service_id, flags) in reg_acks {
             log::info!(
                 "[agent] Registration ACK received for service '{}'",
                 service_id
             );
+            if flags & aggregate::REG_FLAG_AGGREGATE != 0 && !self.aggregate_relay {
+                log::info!("[agent] Intermediate accepts aggregate DATAGRAMs");
+                self.aggregate_relay = true;
+            }
+            if flags & header_compression::REG_FLAG_HEADER_COMPRESSION != 0 {
+                log::info!(
+                    "[agent] Connector for '{}' accepts compressed headers",
+                    service_id
+                );
+                self.compressed_services.insert(service_id.clone());
+            } else {
+                self.compressed_services.remove(&service_id);
+            }
+            if flags & fec::REG_FLAG_FEC != 0 {
+                if !self.fec_encoders.contains_key(&service_id) {
+                    log::info!("[agent] Connector for '{}' decodes FEC", service_id);
+                    self.fec_encoders
+                        .insert(service_id.clone(), fec::Encoder::new());
+                }
+            } else {
+                self.fec_encoders.remove(&service_id);
+            }
             self.registered_services.insert(service_id.clone());
             self.pending_registrations.remove(&service_id);
         }
@@ -1048,7 +1496,9 @@ impl Agent {
                 let addr = coordinator.working_address();
                 // Set direct path in path manager when hole punching succeeds
                 if let Some(a) = addr {
+                    let before = self.path_manager.active_path_type();
                     self.path_manager.set_direct(a);
+                    self.trace_path_switch(before);
                 }
                 self.hole_punch = None;
                 (addr, true)
@@ -1113,6 +1563,54 @@ impl Agent {
         self.path_manager.stats()
     }
 
+    /// Route qlog for current and future connections to `sink` (None = off)
+    ///
+    /// Connections that were already streaming to a previous sink go quiet;
+    /// existing connections are re-attached to the new sink, so their trace
+    /// restarts with a fresh qlog header. With None they keep their (now
+    /// silent) streamer until they are replaced.
+    fn set_qlog(&mut self, sink: Option<qlog::QlogSink>) {
+        self.qlog = sink;
+        if let Some(ref qlog) = self.qlog {
+            if let Some(ref mut conn) = self.intermediate_conn {
+                qlog.attach(conn, TRACE_PATH_INTERMEDIATE, "ztna agent intermediate");
+            }
+            for p2p in self.p2p_conns.values_mut() {
+                qlog.attach(&mut p2p.conn, TRACE_PATH_P2P, "ztna agent p2p");
+            }
+        }
+    }
+
+    /// Snapshot transport statistics for `agent_get_stats`
+    fn stats(&self) -> stats::AgentStats {
+        let mut out = stats::AgentStats {
+            state: self.state as u32,
+            active_path: active_path_code(self.active_path()),
+            in_fallback: self.is_in_fallback() as u8,
+            registered_services: self.registered_services.len() as u32,
+            pending_registrations: self.pending_registrations.len() as u32,
+            recv_queue_len: self.received_datagrams.len() as u64,
+            recv_queue_bytes: self.received_datagrams.iter().map(|d| d.len() as u64).sum(),
+            drops_recv_queue_full: self.drops.recv_queue_full,
+            drops_oversize: self.drops.oversize,
+            drops_send_rejected: self.drops.send_rejected,
+            p2p_count: self.p2p_conns.len() as u32,
+            ..Default::default()
+        };
+
+        if let (Some(conn), Some(addr)) = (&self.intermediate_conn, self.intermediate_addr) {
+            out.has_intermediate = 1;
+            out.intermediate = stats::ConnStats::from_conn(conn, addr);
+        }
+
+        for (slot, (addr, p2p)) in out.p2p.iter_mut().zip(self.p2p_conns.iter()) {
+            *slot = stats::ConnStats::from_conn(&p2p.conn, *addr);
+            out.p2p_reported += 1;
+        }
+
+        out
+    }
+
     /// Get the current active path address for sending data
     fn _active_send_addr(&self) -> Option<SocketAddr> {
         self.path_manager.active_addr()
@@ -1123,6 +1621,72 @@ impl Agent {
 // Helper Functions
 // ============================================================================
 
+/// Offset of the IP packet in a DATAGRAM (after the 0x2F header, if any)
+fn routed_ip_start(data: &[u8]) -> usize {
+    match data {
+        [SERVICE_ROUTED, id_len, ..] => 2 + *id_len as usize,
+        _ => 0,
+    }
+}
+
+/// Compress the IP packet inside a service-routed datagram when that
+/// service's Connector accepts compressed headers.
+///
+/// Returns None to send `data` unchanged.
+fn compress_routed(
+    compressor: &mut header_compression::Compressor,
+    compressed_services: &std::collections::HashSet<String>,
+    data: &[u8],
+    max_len: usize,
+) -> Option<Vec<u8>> {
+    let (service_id, id_end) = routed_service(data)?;
+    if !compressed_services.contains(service_id) {
+        return None;
+    }
+    match compressor.compress(&data[id_end..], max_len.saturating_sub(id_end)) {
+        Cow::Borrowed(_) => None,
+        Cow::Owned(packet) => {
+            let mut out = Vec::with_capacity(id_end + packet.len());
+            out.extend_from_slice(&data[..id_end]);
+            out.extend_from_slice(&packet);
+            Some(out)
+        }
+    }
+}
+
+/// Add the packet inside a service-routed datagram to its service's FEC
+/// block when that service's Connector decodes FEC.
+///
+/// Returns None to send `data` unchanged.
+fn protect_routed(
+    encoders: &mut HashMap<String, fec::Encoder>,
+    data: &[u8],
+    max_len: usize,
+    now: Instant,
+) -> Option<Vec<u8>> {
+    let (service_id, id_end) = routed_service(data)?;
+    let encoder = encoders.get_mut(service_id)?;
+    match encoder.protect(&data[id_end..], max_len.saturating_sub(id_end), now) {
+        Cow::Borrowed(_) => None,
+        Cow::Owned(packet) => {
+            let mut out = Vec::with_capacity(id_end + packet.len());
+            out.extend_from_slice(&data[..id_end]);
+            out.extend_from_slice(&packet);
+            Some(out)
+        }
+    }
+}
+
+/// Service ID of a service-routed datagram and the offset of its payload
+fn routed_service(data: &[u8]) -> Option<(&str, usize)> {
+    if data.len() < 2 || data[0] != SERVICE_ROUTED {
+        return None;
+    }
+    let id_end = 2 + data[1] as usize;
+    let service_id = std::str::from_utf8(data.get(2..id_end)?).ok()?;
+    Some((service_id, id_end))
+}
+
 /// Generate a cryptographically secure random connection ID
 fn rand_connection_id() -> [u8; 16] {
     let mut id = [0u8; 16];
@@ -1132,6 +1696,15 @@ fn rand_connection_id() -> [u8; 16] {
     id
 }
 
+/// FFI code for an active path (0 = Direct, 1 = Relay, 2 = None)
+fn active_path_code(path: p2p::ActivePath) -> u8 {
+    match path {
+        p2p::ActivePath::Direct => 0,
+        p2p::ActivePath::Relay => 1,
+        p2p::ActivePath::None => 2,
+    }
+}
+
 /// Initialize logging (called once)
 static INIT_LOGGING: Once = Once::new();
 
@@ -1433,7 +2006,16 @@ pub unsafe extern "C" fn agent_recv(
 
         match agent.recv(data, from) {
             Ok(()) => AgentResult::Ok,
-            Err(e) => AgentResult::from_quiche_error(&e),
+            Err(e) => {
+                let code = AgentResult::from_quiche_error(&e);
+                agent.trace.record(
+                    TraceKind::RecvError,
+                    TRACE_PATH_INTERMEDIATE,
+                    code as u32,
+                    data.len() as u64,
+                );
+                code
+            }
         }
     }));
 
@@ -1485,6 +2067,11 @@ pub unsafe extern "C" fn agent_poll(
 
 /// Send an IP packet through the QUIC tunnel (as DATAGRAM)
 ///
+/// The packet is queued by priority class and handed to QUIC as room frees
+/// up, so `Ok` means accepted, not sent. `QueueFull` means its class queue
+/// is full and the packet was dropped; `QuicError` that it is too large for
+/// a DATAGRAM.
+///
 /// # Arguments
 /// * `agent` - Agent pointer
 /// * `data` - IP packet data
@@ -1506,6 +2093,7 @@ pub unsafe extern "C" fn agent_send_datagram(
         match agent.send_datagram(data) {
             Ok(()) => AgentResult::Ok,
             Err(quiche::Error::InvalidState) => AgentResult::NotConnected,
+            Err(quiche::Error::Done) => AgentResult::QueueFull,
             Err(_) => AgentResult::QuicError,
         }
     }));
@@ -1513,6 +2101,24 @@ pub unsafe extern "C" fn agent_send_datagram(
     result.unwrap_or(AgentResult::PanicCaught)
 }
 
+/// Get the largest IP packet (DATAGRAM payload) the tunnel can carry right now
+///
+/// Follows the path MTU discovered on the Intermediate connection, so it can
+/// grow after the handshake and shrink if the path changes. Includes the 0x2F
+/// service-routing header when one is used. Returns 0 if not connected.
+#[no_mangle]
+pub unsafe extern "C" fn agent_max_datagram_size(agent: *const Agent) -> usize {
+    if agent.is_null() {
+        return 0;
+    }
+
+    panic::catch_unwind(AssertUnwindSafe(|| {
+        let agent = &*agent;
+        agent.max_datagram_size()
+    }))
+    .unwrap_or(0)
+}
+
 /// Poll for received IP packets from the QUIC tunnel.
 ///
 /// Call this repeatedly after `agent_recv()` until `AgentResultNoData` is returned.
@@ -2036,12 +2642,7 @@ pub unsafe extern "C" fn agent_get_active_path(agent: *const Agent) -> u8 {
     }
 
     panic::catch_unwind(AssertUnwindSafe(|| {
-        let agent = &*agent;
-        match agent.active_path() {
-            p2p::ActivePath::Direct => 0,
-            p2p::ActivePath::Relay => 1,
-            p2p::ActivePath::None => 2,
-        }
+        active_path_code((*agent).active_path())
     }))
     .unwrap_or(2)
 }
@@ -2099,6 +2700,267 @@ pub unsafe extern "C" fn agent_get_path_stats(
     result.unwrap_or(AgentResult::PanicCaught)
 }
 
+// ============================================================================
+// FFI Functions - Diagnostics
+// ============================================================================
+
+/// Get a transport statistics snapshot
+///
+/// The caller sets `out->struct_size` to the size of its `AgentStats`; the
+/// rest of the struct is overwritten, including `version`.
+///
+/// # Arguments
+/// * `agent` - Agent pointer
+/// * `out` - Stats struct with `struct_size` set
+///
+/// # Returns
+/// `AgentResult::Ok` on success, `AgentResult::BufferTooSmall` if
+/// `struct_size` is smaller than this library's `AgentStats`
+#[no_mangle]
+pub unsafe extern "C" fn agent_get_stats(
+    agent: *const Agent,
+    out: *mut stats::AgentStats,
+) -> AgentResult {
+    if agent.is_null() || out.is_null() {
+        return AgentResult::InvalidPointer;
+    }
+    if ((*out).struct_size as usize) < std::mem::size_of::<stats::AgentStats>() {
+        return AgentResult::BufferTooSmall;
+    }
+
+    let result = panic::catch_unwind(AssertUnwindSafe(|| {
+        *out = (*agent).stats();
+        AgentResult::Ok
+    }));
+
+    result.unwrap_or(AgentResult::PanicCaught)
+}
+
+/// Stream qlog for every QUIC connection to a host callback
+///
+/// Applies to the current Intermediate and P2P connections and to any created
+/// later. `callback` is invoked synchronously from inside other agent calls
+/// with `(ctx, path, data, len)`, where `path` is 0 for the Intermediate
+/// connection and 1 for P2P; it must not call back into the agent. Passing a
+/// NULL `callback` turns qlog off.
+///
+/// Replacing or removing a callback stops calls to it as soon as this
+/// returns, so its `ctx` may be freed then. quiche cannot detach a qlog
+/// streamer, though: after qlog is turned off, connections that were
+/// streaming keep serializing events (and discarding them) until they are
+/// replaced by a reconnect or a new P2P connection.
+///
+/// # Arguments
+/// * `agent` - Agent pointer
+/// * `callback` - qlog byte sink, or NULL to disable
+/// * `ctx` - Opaque pointer passed back to `callback`
+///
+/// # Returns
+/// `AgentResult::Ok` on success
+#[no_mangle]
+pub unsafe extern "C" fn agent_set_qlog(
+    agent: *mut Agent,
+    callback: Option<qlog::QlogCallback>,
+    ctx: *mut std::ffi::c_void,
+) -> AgentResult {
+    if agent.is_null() {
+        return AgentResult::InvalidPointer;
+    }
+
+    let result = panic::catch_unwind(AssertUnwindSafe(|| {
+        let agent = &mut *agent;
+        agent.set_qlog(callback.map(|cb| qlog::QlogSink::new(cb, ctx)));
+        AgentResult::Ok
+    }));
+
+    result.unwrap_or(AgentResult::PanicCaught)
+}
+
+/// Select congestion control for future connections on one path
+///
+/// Applies from the next `agent_connect` (path 0, Intermediate) or the next
+/// P2P connection (path 1); existing connections keep their controller.
+///
+/// # Arguments
+/// * `agent` - Agent pointer
+/// * `path` - 0 = Intermediate connection, 1 = P2P connections
+/// * `algorithm` - "reno", "cubic", "bbr" or "bbr2"
+/// * `hystart` - Use HyStart++ to leave slow start early
+/// * `pacing` - Pace packets across the RTT instead of sending bursts
+///
+/// # Returns
+/// * `AgentResult::Ok` on success
+/// * `AgentResult::QuicCongestionControl` if the algorithm is unknown
+/// * `AgentResult::InvalidPointer` on NULL pointers or an unknown path
+#[no_mangle]
+pub unsafe extern "C" fn agent_set_congestion_control(
+    agent: *mut Agent,
+    path: u8,
+    algorithm: *const libc::c_char,
+    hystart: bool,
+    pacing: bool,
+) -> AgentResult {
+    if agent.is_null() || algorithm.is_null() {
+        return AgentResult::InvalidPointer;
+    }
+    if path != TRACE_PATH_INTERMEDIATE && path != TRACE_PATH_P2P {
+        return AgentResult::InvalidPointer;
+    }
+
+    let result = panic::catch_unwind(AssertUnwindSafe(|| {
+        let agent = &mut *agent;
+        let algorithm = match std::ffi::CStr::from_ptr(algorithm).to_str() {
+            Ok(s) => s,
+            Err(_) => return AgentResult::QuicCongestionControl,
+        };
+        match algorithm.parse::<quiche::CongestionControlAlgorithm>() {
+            Ok(algorithm) => {
+                agent.congestion[path as usize] = CongestionSettings {
+                    algorithm,
+                    hystart,
+                    pacing,
+                };
+                AgentResult::Ok
+            }
+            Err(e) => AgentResult::from_quiche_error(&e),
+        }
+    }));
+
+    result.unwrap_or(AgentResult::PanicCaught)
+}
+
+/// Set the rules that assign tunneled packets to priority classes
+///
+/// Rules are tried in order and the first match decides the class; packets
+/// matching none are class 1 (default). Class 0 (interactive) is sent ahead
+/// of queued default and bulk (2) traffic. Passing NULL or `count` 0
+/// restores the built-in rules (DNS, SSH, ICMP and DSCP EF/CS6
+/// interactive; DSCP CS1/LE bulk). Applies to packets sent after the call.
+///
+/// # Arguments
+/// * `agent` - Agent pointer
+/// * `rules` - Array of `count` rules (`AgentClassRule`)
+/// * `count` - Number of rules
+///
+/// # Returns
+/// * `AgentResult::Ok` on success
+/// * `AgentResult::InvalidPointer` on a NULL agent or a rule with an unknown class
+#[no_mangle]
+pub unsafe extern "C" fn agent_set_class_rules(
+    agent: *mut Agent,
+    rules: *const priority::ClassRule,
+    count: usize,
+) -> AgentResult {
+    if agent.is_null() {
+        return AgentResult::InvalidPointer;
+    }
+
+    let result = panic::catch_unwind(AssertUnwindSafe(|| {
+        let agent = &mut *agent;
+        if rules.is_null() || count == 0 {
+            agent.classifier = priority::Classifier::new();
+            return AgentResult::Ok;
+        }
+        match priority::Classifier::with_rules(std::slice::from_raw_parts(rules, count)) {
+            Some(classifier) => {
+                agent.classifier = classifier;
+                AgentResult::Ok
+            }
+            None => AgentResult::InvalidPointer,
+        }
+    }));
+
+    result.unwrap_or(AgentResult::PanicCaught)
+}
+
+/// Drain buffered trace events
+///
+/// Copies up to `max_records` of the oldest undrained events (`AgentTraceRecord`,
+/// 24 bytes each) into `out` and returns how many were written; call again
+/// while it returns `max_records`. The ring holds the last
+/// `trace::TRACE_CAPACITY` events; if older ones were overwritten, the first
+/// record is an Overflow event carrying the number lost.
+///
+/// Reads through the Agent, so it must run on the thread driving it. Drain
+/// from elsewhere through `agent_trace_handle`.
+///
+/// # Arguments
+/// * `agent` - Agent pointer
+/// * `out` - Array of at least `max_records` records
+/// * `max_records` - Capacity of `out`, in records
+#[no_mangle]
+pub unsafe extern "C" fn agent_drain_trace(
+    agent: *const Agent,
+    out: *mut trace::TraceRecord,
+    max_records: usize,
+) -> usize {
+    if agent.is_null() || out.is_null() {
+        return 0;
+    }
+
+    panic::catch_unwind(AssertUnwindSafe(|| {
+        let out = slice::from_raw_parts_mut(out, max_records);
+        (*agent).trace.drain(out)
+    }))
+    .unwrap_or(0)
+}
+
+/// Get a handle on the Agent's trace ring that any thread can drain
+///
+/// The handle keeps the ring alive, even past `agent_destroy`, until
+/// `agent_trace_release`. Only one thread may drain at a time, whether
+/// through handles or `agent_drain_trace`. Returns null if `agent` is null.
+///
+/// # Arguments
+/// * `agent` - Agent pointer
+#[no_mangle]
+pub unsafe extern "C" fn agent_trace_handle(agent: *const Agent) -> *const TraceRing {
+    if agent.is_null() {
+        return std::ptr::null();
+    }
+
+    panic::catch_unwind(AssertUnwindSafe(|| {
+        Arc::into_raw(Arc::clone(&(*agent).trace))
+    }))
+    .unwrap_or(std::ptr::null())
+}
+
+/// Drain buffered trace events through a handle, from any thread
+///
+/// Same as `agent_drain_trace`.
+///
+/// # Arguments
+/// * `trace` - Handle from `agent_trace_handle`
+/// * `out` - Array of at least `max_records` records
+/// * `max_records` - Capacity of `out`, in records
+#[no_mangle]
+pub unsafe extern "C" fn agent_trace_drain(
+    trace: *const TraceRing,
+    out: *mut trace::TraceRecord,
+    max_records: usize,
+) -> usize {
+    if trace.is_null() || out.is_null() {
+        return 0;
+    }
+
+    panic::catch_unwind(AssertUnwindSafe(|| {
+        let out = slice::from_raw_parts_mut(out, max_records);
+        (*trace).drain(out)
+    }))
+    .unwrap_or(0)
+}
+
+/// Release a handle from `agent_trace_handle`
+///
+/// # Arguments
+/// * `trace` - Handle to release (null is ignored)
+#[no_mangle]
+pub unsafe extern "C" fn agent_trace_release(trace: *const TraceRing) {
+    if !trace.is_null() {
+        drop(Arc::from_raw(trace));
+    }
+}
+
 // ============================================================================
 // Tests
 // ============================================================================
@@ -2386,6 +3248,186 @@ mod tests {
         assert_eq!(&expected[2..], b"echo-service");
     }
 
+    #[test]
+    fn test_aggregate_batch_bounds_timeout() {
+        let mut agent = Agent::new(None, false).unwrap();
+        assert!(agent.timeout().is_none());
+
+        agent.batch.push(&[0x45; 40], 1200);
+        assert!(agent.timeout().unwrap() <= aggregate::FLUSH_DELAY);
+    }
+
+    #[test]
+    fn test_agent_set_congestion_control() {
+        unsafe {
+            let agent = agent_create(std::ptr::null(), false);
+            let bbr2 = std::ffi::CString::new("bbr2").unwrap();
+            let bogus = std::ffi::CString::new("vegas").unwrap();
+
+            assert_eq!(
+                agent_set_congestion_control(std::ptr::null_mut(), 0, bbr2.as_ptr(), true, true),
+                AgentResult::InvalidPointer
+            );
+            assert_eq!(
+                agent_set_congestion_control(agent, 2, bbr2.as_ptr(), true, true),
+                AgentResult::InvalidPointer
+            );
+            assert_eq!(
+                agent_set_congestion_control(agent, 0, bogus.as_ptr(), true, true),
+                AgentResult::QuicCongestionControl
+            );
+            assert_eq!(
+                agent_set_congestion_control(agent, 1, bbr2.as_ptr(), false, true),
+                AgentResult::Ok
+            );
+
+            let settings = (*agent).congestion;
+            assert_eq!(settings[0], CongestionSettings::default());
+            assert_eq!(
+                settings[1].algorithm,
+                quiche::CongestionControlAlgorithm::BBR2
+            );
+            assert!(!settings[1].hystart);
+            agent_destroy(agent);
+        }
+    }
+
+    #[test]
+    fn test_agent_set_class_rules() {
+        unsafe {
+            let agent = agent_create(std::ptr::null(), false);
+            // IPv4/TCP 50000 -> 443
+            let mut https = vec![0u8; 40];
+            https[0] = 0x45;
+            https[9] = 6;
+            https[20..22].copy_from_slice(&50000u16.to_be_bytes());
+            https[22..24].copy_from_slice(&443u16.to_be_bytes());
+            assert_eq!(
+                (*agent).classifier.classify(&https),
+                priority::Class::Default
+            );
+
+            let rule = priority::ClassRule {
+                protocol: 6,
+                dscp: priority::DSCP_ANY,
+                class_id: priority::Class::Interactive as u8,
+                reserved: 0,
+                port_lo: 443,
+                port_hi: 443,
+            };
+            assert_eq!(
+                agent_set_class_rules(std::ptr::null_mut(), &rule, 1),
+                AgentResult::InvalidPointer
+            );
+            assert_eq!(agent_set_class_rules(agent, &rule, 1), AgentResult::Ok);
+            assert_eq!(
+                (*agent).classifier.classify(&https),
+                priority::Class::Interactive
+            );
+
+            // An unknown class is rejected and leaves the rules alone
+            let bad = priority::ClassRule {
+                class_id: 7,
+                ..rule
+            };
+            assert_eq!(
+                agent_set_class_rules(agent, &bad, 1),
+                AgentResult::InvalidPointer
+            );
+            assert_eq!(
+                (*agent).classifier.classify(&https),
+                priority::Class::Interactive
+            );
+
+            assert_eq!(
+                agent_set_class_rules(agent, std::ptr::null(), 0),
+                AgentResult::Ok
+            );
+            assert_eq!(
+                (*agent).classifier.classify(&https),
+                priority::Class::Default
+            );
+            agent_destroy(agent);
+        }
+    }
+
+    #[test]
+    fn test_agent_max_datagram_size_not_connected() {
+        unsafe {
+            assert_eq!(agent_max_datagram_size(std::ptr::null()), 0);
+
+            let agent = agent_create(std::ptr::null(), false);
+            assert_eq!(agent_max_datagram_size(agent), 0);
+            agent_destroy(agent);
+        }
+    }
+
+    #[test]
+    fn test_routed_ip_start() {
+        assert_eq!(routed_ip_start(&[0x45, 0, 0, 20]), 0);
+        assert_eq!(
+            routed_ip_start(&[SERVICE_ROUTED, 3, b'w', b'e', b'b', 0x45]),
+            5
+        );
+        assert_eq!(routed_ip_start(&[]), 0);
+    }
+
+    #[test]
+    fn test_compress_routed_only_for_flagged_services() {
+        let mut compressor = header_compression::Compressor::new();
+        let services = std::collections::HashSet::from(["echo".to_string()]);
+
+        // IPv4/UDP packet (checksums are irrelevant to the compressor)
+        let mut ip = vec![0u8; 28];
+        ip[0] = 0x45;
+        ip[3] = 28;
+        ip[9] = 17;
+        ip[25] = 8;
+
+        let mut routed = vec![SERVICE_ROUTED, 4];
+        routed.extend_from_slice(b"echo");
+        routed.extend_from_slice(&ip);
+        let out = compress_routed(&mut compressor, &services, &routed, 1200).unwrap();
+        assert_eq!(&out[..6], &routed[..6]);
+        assert_eq!(out[6], header_compression::DGRAM_TYPE_HC_FULL);
+
+        let mut other = vec![SERVICE_ROUTED, 4];
+        other.extend_from_slice(b"mail");
+        other.extend_from_slice(&ip);
+        assert!(compress_routed(&mut compressor, &services, &other, 1200).is_none());
+        assert!(compress_routed(&mut compressor, &services, &ip, 1200).is_none());
+    }
+
+    #[test]
+    fn test_protect_routed_keeps_service_header() {
+        let mut encoders = HashMap::from([("echo".to_string(), fec::Encoder::new())]);
+        let now = Instant::now();
+
+        let mut routed = vec![SERVICE_ROUTED, 4];
+        routed.extend_from_slice(b"echo");
+        routed.extend_from_slice(&[0x45; 28]);
+        let out = protect_routed(&mut encoders, &routed, 1200, now).unwrap();
+        assert_eq!(&out[..6], &routed[..6]);
+        assert_eq!(out[6], fec::DGRAM_TYPE_FEC_SOURCE);
+        assert!(out.ends_with(&routed[6..]));
+
+        // Services without FEC, and unrouted packets, are left alone
+        let mut other = vec![SERVICE_ROUTED, 4];
+        other.extend_from_slice(b"mail");
+        other.extend_from_slice(&[0x45; 28]);
+        assert!(protect_routed(&mut encoders, &other, 1200, now).is_none());
+        assert!(protect_routed(&mut encoders, &[0x45; 28], 1200, now).is_none());
+    }
+
+    #[test]
+    fn test_fec_deadline_bounds_timeout() {
+        let mut agent = Agent::new(None, false).unwrap();
+        let mut encoder = fec::Encoder::new();
+        encoder.protect(&[0x45; 40], 1200, Instant::now());
+        agent.fec_encoders.insert("echo".to_string(), encoder);
+        assert!(agent.timeout().unwrap() <= fec::MAX_BLOCK_DELAY);
+    }
+
     #[test]
     fn test_agent_recv_datagram_queue() {
         let mut agent = Agent::new(None, false).unwrap();
@@ -2437,4 +3479,168 @@ mod tests {
         // Queue empty
         assert!(agent.recv_datagram(&mut tiny_buf).is_none());
     }
+
+    #[test]
+    fn test_agent_drain_trace() {
+        unsafe {
+            let mut out = [trace::TraceRecord::default(); 16];
+            assert_eq!(agent_drain_trace(std::ptr::null(), out.as_mut_ptr(), 16), 0);
+
+            let agent = agent_create(std::ptr::null(), false);
+            assert_eq!(agent_drain_trace(agent, std::ptr::null_mut(), 16), 0);
+
+            // connect → State(Connecting); poll → Send(Initial)
+            let host = std::ffi::CString::new("127.0.0.1").unwrap();
+            assert_eq!(agent_connect(agent, host.as_ptr(), 4433), AgentResult::Ok);
+            let mut pkt = [0u8; MAX_DATAGRAM_SIZE];
+            let mut len = pkt.len();
+            let mut port = 0u16;
+            assert_eq!(
+                agent_poll(agent, pkt.as_mut_ptr(), &mut len, &mut port),
+                AgentResult::Ok
+            );
+
+            let n = agent_drain_trace(agent, out.as_mut_ptr(), out.len());
+            let kinds: Vec<u8> = out[..n].iter().map(|r| r.kind).collect();
+            assert!(kinds.contains(&(TraceKind::State as u8)));
+            let send = out[..n]
+                .iter()
+                .find(|r| r.kind == TraceKind::Send as u8)
+                .unwrap();
+            assert_eq!(send.arg0 as usize, len);
+            assert_eq!(send.path, TRACE_PATH_INTERMEDIATE);
+
+            assert_eq!(agent_drain_trace(agent, out.as_mut_ptr(), out.len()), 0);
+            agent_destroy(agent);
+        }
+    }
+
+    #[test]
+    fn test_agent_trace_handle() {
+        unsafe {
+            assert!(agent_trace_handle(std::ptr::null()).is_null());
+            let mut out = [trace::TraceRecord::default(); 16];
+            assert_eq!(agent_trace_drain(std::ptr::null(), out.as_mut_ptr(), 16), 0);
+            agent_trace_release(std::ptr::null());
+
+            let agent = agent_create(std::ptr::null(), false);
+            let handle = agent_trace_handle(agent);
+            assert!(!handle.is_null());
+            let host = std::ffi::CString::new("127.0.0.1").unwrap();
+            assert_eq!(agent_connect(agent, host.as_ptr(), 4433), AgentResult::Ok);
+
+            // Drained on another thread while the Agent keeps recording
+            let handle_addr = handle as usize;
+            let drainer = std::thread::spawn(move || {
+                let mut out = [trace::TraceRecord::default(); 16];
+                agent_trace_drain(handle_addr as *const TraceRing, out.as_mut_ptr(), 16)
+            });
+            (*agent)
+                .trace
+                .record(TraceKind::Timer, TRACE_PATH_INTERMEDIATE, 0, 0);
+            let drained = drainer.join().unwrap();
+            let rest = agent_drain_trace(agent, out.as_mut_ptr(), out.len());
+            assert!(drained + rest >= 2);
+
+            // The handle outlives the Agent
+            agent_destroy(agent);
+            (*handle).record(TraceKind::Timer, TRACE_PATH_INTERMEDIATE, 0, 0);
+            assert_eq!(agent_trace_drain(handle, out.as_mut_ptr(), out.len()), 1);
+            agent_trace_release(handle);
+        }
+    }
+
+    #[test]
+    fn test_trace_records_oversize_drop() {
+        let mut agent = Agent::new(None, false).unwrap();
+        agent.received_datagrams.push_back(vec![0x45; 100]);
+        let mut tiny_buf = [0u8; 10];
+        assert!(agent.recv_datagram(&mut tiny_buf).is_none());
+
+        let mut out = [trace::TraceRecord::default(); 4];
+        assert_eq!(agent.trace.drain(&mut out), 1);
+        assert_eq!(out[0].kind, TraceKind::Drop as u8);
+        assert_eq!(out[0].arg0, DropReason::Oversize as u32);
+        assert_eq!(out[0].arg1, 100);
+    }
+
+    #[test]
+    fn test_agent_get_stats() {
+        unsafe {
+            let mut stats = stats::AgentStats::default();
+            assert_eq!(
+                agent_get_stats(std::ptr::null(), &mut stats),
+                AgentResult::InvalidPointer
+            );
+
+            let agent = agent_create(std::ptr::null(), false);
+            assert_eq!(
+                agent_get_stats(agent, std::ptr::null_mut()),
+                AgentResult::InvalidPointer
+            );
+
+            stats.struct_size = 8;
+            assert_eq!(
+                agent_get_stats(agent, &mut stats),
+                AgentResult::BufferTooSmall
+            );
+
+            stats = stats::AgentStats::default();
+            assert_eq!(agent_get_stats(agent, &mut stats), AgentResult::Ok);
+            assert_eq!(stats.version, stats::AGENT_STATS_VERSION);
+            assert_eq!(stats.state, AgentState::Disconnected as u32);
+            assert_eq!(stats.has_intermediate, 0);
+
+            let host = std::ffi::CString::new("10.0.0.1").unwrap();
+            assert_eq!(agent_connect(agent, host.as_ptr(), 4433), AgentResult::Ok);
+            let agent_ref = &mut *agent;
+            agent_ref.received_datagrams.push_back(vec![0x45; 100]);
+            let mut tiny_buf = [0u8; 10];
+            assert!(agent_ref.recv_datagram(&mut tiny_buf).is_none());
+            agent_ref.received_datagrams.push_back(vec![0x45; 60]);
+
+            assert_eq!(agent_get_stats(agent, &mut stats), AgentResult::Ok);
+            assert_eq!(stats.state, AgentState::Connecting as u32);
+            assert_eq!(stats.has_intermediate, 1);
+            assert_eq!(stats.intermediate.peer_ip, [10, 0, 0, 1]);
+            assert_eq!(stats.intermediate.peer_port, 4433);
+            assert_eq!(stats.intermediate.established, 0);
+            assert_eq!(stats.recv_queue_len, 1);
+            assert_eq!(stats.recv_queue_bytes, 60);
+            assert_eq!(stats.drops_oversize, 1);
+            assert_eq!(stats.p2p_count, 0);
+
+            agent_destroy(agent);
+        }
+    }
+
+    #[test]
+    fn test_agent_set_qlog() {
+        extern "C" fn sink(_ctx: *mut std::ffi::c_void, _path: u8, _data: *const u8, _len: usize) {}
+
+        unsafe {
+            assert_eq!(
+                agent_set_qlog(std::ptr::null_mut(), Some(sink), std::ptr::null_mut()),
+                AgentResult::InvalidPointer
+            );
+
+            let agent = agent_create(std::ptr::null(), false);
+            assert_eq!(
+                agent_set_qlog(agent, Some(sink), std::ptr::null_mut()),
+                AgentResult::Ok
+            );
+            assert!((*agent).qlog.is_some());
+
+            let host = std::ffi::CString::new("127.0.0.1").unwrap();
+            assert_eq!(agent_connect(agent, host.as_ptr(), 4433), AgentResult::Ok);
+
+            assert_eq!(
+                agent_set_qlog(agent, None, std::ptr::null_mut()),
+                AgentResult::Ok
+            );
+            assert!((*agent).qlog.is_none());
+
+            agent_destroy(agent);
+        }
+    }
 }
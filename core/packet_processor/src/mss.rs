@@ -0,0 +1,239 @@
+//! TCP MSS clamping for SYNs entering the tunnel
+//!
+//! The host stack derives its MSS from the utun MTU, not from the QUIC path
+//! underneath. When the path's DATAGRAM limit is smaller, every full-sized
+//! segment is rejected by `dgram_send` and the connection stalls. Rewriting
+//! the MSS option of outbound SYN and SYN-ACK packets makes both ends pick
+//! segments that fit one DATAGRAM, the same way routers clamp MSS on tunnels.
+//!
+//! Only the two MSS bytes change, so the TCP checksum is patched
+//! incrementally (RFC 1624) instead of being recomputed over the segment.
+
+use std::borrow::Cow;
+
+/// TCP header without options
+const TCP_HEADER_LEN: usize = 20;
+
+/// TCP SYN flag
+const TCP_SYN: u8 = 0x02;
+
+/// Never advertise less than the IPv4 default MSS (RFC 9293)
+const MIN_MSS: u16 = 536;
+
+/// Location of a SYN's MSS option within a DATAGRAM
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+struct MssOption {
+    /// Offset of the TCP header
+    tcp_start: usize,
+    /// Offset of the 2-byte MSS value
+    value_at: usize,
+    /// IP header length without options (20 or 40)
+    ip_fixed_len: usize,
+}
+
+/// Clamp the MSS of a TCP SYN or SYN-ACK so that a full segment, with IP and
+/// TCP headers and the `ip_start` bytes preceding the IP packet, fits in a
+/// DATAGRAM of `max_len` bytes.
+///
+/// Returns `dgram` borrowed unless the MSS was lowered.
+pub fn clamp(dgram: &[u8], ip_start: usize, max_len: usize) -> Cow<'_, [u8]> {
+    let opt = match find_mss(dgram, ip_start) {
+        Some(opt) => opt,
+        None => return Cow::Borrowed(dgram),
+    };
+
+    let limit = max_len
+        .saturating_sub(ip_start + opt.ip_fixed_len + TCP_HEADER_LEN)
+        .min(u16::MAX as usize) as u16;
+    let limit = limit.max(MIN_MSS);
+    let mss = u16::from_be_bytes([dgram[opt.value_at], dgram[opt.value_at + 1]]);
+    if mss <= limit {
+        return Cow::Borrowed(dgram);
+    }
+
+    let mut out = dgram.to_vec();
+    out[opt.value_at..opt.value_at + 2].copy_from_slice(&limit.to_be_bytes());
+
+    // An MSS value at an odd offset straddles two checksum words; the
+    // one's-complement sum of byte-swapped words is the byte-swapped sum
+    let (old, new) = if (opt.value_at - opt.tcp_start) % 2 == 0 {
+        (mss, limit)
+    } else {
+        (mss.swap_bytes(), limit.swap_bytes())
+    };
+    let csum_at = opt.tcp_start + 16;
+    let csum = u16::from_be_bytes([out[csum_at], out[csum_at + 1]]);
+    out[csum_at..csum_at + 2].copy_from_slice(&adjust_checksum(csum, old, new).to_be_bytes());
+    Cow::Owned(out)
+}
+
+/// RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m')
+fn adjust_checksum(checksum: u16, old: u16, new: u16) -> u16 {
+    let mut sum = (!checksum) as u32 + (!old) as u32 + new as u32;
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    !(sum as u16)
+}
+
+/// Find the MSS option of an IPv4/IPv6 TCP SYN starting at `ip_start`
+fn find_mss(dgram: &[u8], ip_start: usize) -> Option<MssOption> {
+    let ip = dgram.get(ip_start..)?;
+    let (ip_header_len, ip_fixed_len) = match ip.first()? >> 4 {
+        4 => {
+            let ihl = (ip[0] & 0x0F) as usize * 4;
+            // TCP, first fragment only
+            let frag_offset = u16::from_be_bytes([*ip.get(6)?, *ip.get(7)?]) & 0x1FFF;
+            if ihl < 20 || ip.len() < ihl || ip[9] != 6 || frag_offset != 0 {
+                return None;
+            }
+            (ihl, 20)
+        }
+        // No extension headers: next header must be TCP
+        6 if ip.len() >= 40 && ip[6] == 6 => (40, 40),
+        _ => return None,
+    };
+
+    let tcp_start = ip_start + ip_header_len;
+    let tcp = &dgram[tcp_start..];
+    if tcp.len() < TCP_HEADER_LEN || tcp[13] & TCP_SYN == 0 {
+        return None;
+    }
+    let options_end = ((tcp[12] >> 4) as usize * 4).min(tcp.len());
+
+    let mut i = TCP_HEADER_LEN;
+    while i < options_end {
+        match tcp[i] {
+            0 => break,
+            1 => i += 1,
+            kind => {
+                let len = *tcp.get(i + 1)? as usize;
+                if len < 2 || i + len > options_end {
+                    return None;
+                }
+                if kind == 2 && len == 4 {
+                    return Some(MssOption {
+                        tcp_start,
+                        value_at: tcp_start + i + 2,
+                        ip_fixed_len,
+                    });
+                }
+                i += len;
+            }
+        }
+    }
+    None
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Full TCP checksum over an IPv4 packet (pseudo-header included)
+    fn tcp_checksum_v4(packet: &[u8]) -> u16 {
+        let ihl = (packet[0] & 0x0F) as usize * 4;
+        let tcp = &packet[ihl..];
+        let mut sum: u32 = 0;
+        for pair in packet[12..20].chunks(2) {
+            sum += u16::from_be_bytes([pair[0], pair[1]]) as u32;
+        }
+        sum += 6 + tcp.len() as u32;
+        for (i, chunk) in tcp.chunks(2).enumerate() {
+            if i == 8 {
+                continue; // checksum field
+            }
+            let hi = chunk[0];
+            let lo = chunk.get(1).copied().unwrap_or(0);
+            sum += u16::from_be_bytes([hi, lo]) as u32;
+        }
+        while sum >> 16 != 0 {
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        }
+        !(sum as u16)
+    }
+
+    /// IPv4 TCP packet with the given flags and options
+    fn tcp_packet(flags: u8, options: &[u8]) -> Vec<u8> {
+        let tcp_len = TCP_HEADER_LEN + options.len();
+        let mut p = vec![0u8; 20 + tcp_len];
+        p[0] = 0x45;
+        p[2..4].copy_from_slice(&((20 + tcp_len) as u16).to_be_bytes());
+        p[9] = 6;
+        p[12..16].copy_from_slice(&[100, 64, 0, 1]);
+        p[16..20].copy_from_slice(&[10, 100, 0, 1]);
+        p[20..22].copy_from_slice(&50000u16.to_be_bytes());
+        p[22..24].copy_from_slice(&443u16.to_be_bytes());
+        p[24..28].copy_from_slice(&0x1234_5678u32.to_be_bytes());
+        p[32] = ((tcp_len / 4) as u8) << 4;
+        p[33] = flags;
+        p[34..36].copy_from_slice(&65535u16.to_be_bytes());
+        p[40..].copy_from_slice(options);
+        let csum = tcp_checksum_v4(&p);
+        p[36..38].copy_from_slice(&csum.to_be_bytes());
+        p
+    }
+
+    fn mss_of(packet: &[u8], at: usize) -> u16 {
+        u16::from_be_bytes([packet[at], packet[at + 1]])
+    }
+
+    #[test]
+    fn test_clamps_syn_and_fixes_checksum() {
+        // MSS 1460, SACK permitted, NOP, window scale
+        let syn = tcp_packet(TCP_SYN, &[2, 4, 0x05, 0xB4, 4, 2, 1, 3, 3, 7, 0, 0]);
+        let out = clamp(&syn, 0, 1200);
+        assert!(matches!(out, Cow::Owned(_)));
+        assert_eq!(mss_of(&out, 42), 1200 - 40);
+        assert_eq!(mss_of(&out, 36), tcp_checksum_v4(&out));
+        assert_eq!(&out[44..], &syn[44..]);
+    }
+
+    #[test]
+    fn test_odd_offset_and_routing_prefix() {
+        // NOP before MSS puts the value at an odd offset; 0x2F header before IP
+        let syn_ack = tcp_packet(TCP_SYN | 0x10, &[1, 2, 4, 0x05, 0xB4, 1, 1, 1]);
+        let mut routed = vec![0x2F, 3, b'w', b'e', b'b'];
+        routed.extend_from_slice(&syn_ack);
+
+        let out = clamp(&routed, 5, 1300);
+        let ip = &out[5..];
+        assert_eq!(mss_of(ip, 43), 1300 - 5 - 40);
+        assert_eq!(mss_of(ip, 36), tcp_checksum_v4(ip));
+    }
+
+    #[test]
+    fn test_leaves_small_mss_and_non_syn_alone() {
+        let syn = tcp_packet(TCP_SYN, &[2, 4, 0x04, 0x00]);
+        assert!(matches!(clamp(&syn, 0, 1400), Cow::Borrowed(_)));
+
+        let ack = tcp_packet(0x10, &[2, 4, 0x05, 0xB4]);
+        assert!(matches!(clamp(&ack, 0, 1200), Cow::Borrowed(_)));
+
+        let no_mss = tcp_packet(TCP_SYN, &[1, 1, 1, 1]);
+        assert!(matches!(clamp(&no_mss, 0, 1200), Cow::Borrowed(_)));
+
+        let mut udp = tcp_packet(TCP_SYN, &[2, 4, 0x05, 0xB4]);
+        udp[9] = 17;
+        assert!(matches!(clamp(&udp, 0, 1200), Cow::Borrowed(_)));
+    }
+
+    #[test]
+    fn test_malformed_options_and_floor() {
+        // Option length runs past the header
+        let bad = tcp_packet(TCP_SYN, &[3, 9, 0, 0]);
+        assert!(matches!(clamp(&bad, 0, 1200), Cow::Borrowed(_)));
+
+        // Tiny DATAGRAM limit never advertises below MIN_MSS
+        let syn = tcp_packet(TCP_SYN, &[2, 4, 0x05, 0xB4]);
+        assert_eq!(mss_of(&clamp(&syn, 0, 0), 42), MIN_MSS);
+        assert!(matches!(clamp(&syn[..30], 0, 1200), Cow::Borrowed(_)));
+    }
+
+    #[test]
+    fn test_adjust_checksum_matches_recompute() {
+        let syn = tcp_packet(TCP_SYN, &[2, 4, 0xFF, 0xFF]);
+        for max_len in [600usize, 1000, 1350, 1472] {
+            let out = clamp(&syn, 0, max_len);
+            assert_eq!(mss_of(&out, 36), tcp_checksum_v4(&out));
+        }
+    }
+}
@@ -0,0 +1,122 @@
+//! Time source for P2P timers
+//!
+//! Keepalive, fallback, connectivity-check and hole-punch timers read the
+//! current time through a [`Clock`] rather than calling `Instant::now()`
+//! directly. Production code uses [`SystemClock`]; tests and the path
+//! simulator (`examples/path_sim.rs`) use a [`VirtualClock`] and advance it
+//! explicitly, so hours of keepalive traffic run in milliseconds and the
+//! same inputs always give the same timings.
+
+use std::fmt;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+/// Source of "now" for P2P state machines
+pub trait Clock: fmt::Debug + Send + Sync {
+    fn now(&self) -> Instant;
+}
+
+/// Shared handle to a clock, cloned into every object that keeps timers
+pub type SharedClock = Arc<dyn Clock>;
+
+/// Wall-clock time (`Instant::now()`)
+#[derive(Debug, Clone, Copy, Default)]
+pub struct SystemClock;
+
+impl Clock for SystemClock {
+    fn now(&self) -> Instant {
+        Instant::now()
+    }
+}
+
+/// The default clock for production objects
+pub fn system_clock() -> SharedClock {
+    Arc::new(SystemClock)
+}
+
+/// Manually advanced clock
+///
+/// Clones share the same time, so one handle can drive every object built
+/// from it.
+#[derive(Debug, Clone)]
+pub struct VirtualClock {
+    origin: Instant,
+    elapsed_ns: Arc<AtomicU64>,
+}
+
+impl VirtualClock {
+    /// Start at the current wall-clock instant; only `advance` moves it.
+    pub fn new() -> Self {
+        Self {
+            origin: Instant::now(),
+            elapsed_ns: Arc::new(AtomicU64::new(0)),
+        }
+    }
+
+    /// Move time forward by `d`.
+    pub fn advance(&self, d: Duration) {
+        self.elapsed_ns
+            .fetch_add(d.as_nanos() as u64, Ordering::Relaxed);
+    }
+
+    /// Move time forward to `t` (no-op if `t` is in the past).
+    pub fn advance_to(&self, t: Instant) {
+        let target = t.saturating_duration_since(self.origin).as_nanos() as u64;
+        self.elapsed_ns.fetch_max(target, Ordering::Relaxed);
+    }
+
+    /// Virtual time since the clock was created
+    pub fn elapsed(&self) -> Duration {
+        Duration::from_nanos(self.elapsed_ns.load(Ordering::Relaxed))
+    }
+
+    /// This clock as a [`SharedClock`]
+    pub fn shared(&self) -> SharedClock {
+        Arc::new(self.clone())
+    }
+}
+
+impl Default for VirtualClock {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Clock for VirtualClock {
+    fn now(&self) -> Instant {
+        self.origin + self.elapsed()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_virtual_clock_advances_only_on_demand() {
+        let clock = VirtualClock::new();
+        let t0 = clock.now();
+        std::thread::sleep(Duration::from_millis(5));
+        assert_eq!(clock.now(), t0);
+
+        clock.advance(Duration::from_secs(3600));
+        assert_eq!(clock.now() - t0, Duration::from_secs(3600));
+    }
+
+    #[test]
+    fn test_virtual_clock_clones_share_time() {
+        let clock = VirtualClock::new();
+        let shared = clock.shared();
+        let t0 = shared.now();
+
+        clock.advance(Duration::from_millis(250));
+        assert_eq!(shared.now() - t0, Duration::from_millis(250));
+
+        // advance_to never goes backwards
+        clock.advance_to(t0);
+        assert_eq!(clock.elapsed(), Duration::from_millis(250));
+        clock.advance_to(t0 + Duration::from_secs(1));
+        assert_eq!(clock.elapsed(), Duration::from_secs(1));
+    }
+}
@@ -27,6 +27,7 @@ use std::net::SocketAddr;
 use std::time::{Duration, Instant};
 
 use super::candidate::Candidate;
+use super::clock::{system_clock, SharedClock};
 use super::ZTNA_MAGIC;
 
 // ============================================================================
@@ -205,6 +206,11 @@ impl CandidatePair {
 
     /// Check if this pair needs retransmission
     pub fn needs_retransmit(&self) -> bool {
+        self.needs_retransmit_at(Instant::now())
+    }
+
+    /// [`needs_retransmit`](Self::needs_retransmit) evaluated at `now`
+    pub fn needs_retransmit_at(&self, now: Instant) -> bool {
         if self.state != CheckState::InProgress {
             return false;
         }
@@ -216,7 +222,7 @@ impl CandidatePair {
         match self.last_sent {
             Some(sent) => {
                 let rto = self.current_rto();
-                sent.elapsed() >= rto
+                now.saturating_duration_since(sent) >= rto
             }
             None => true,
         }
@@ -231,23 +237,39 @@ impl CandidatePair {
 
     /// Check if this pair has timed out
     pub fn is_timed_out(&self, start_time: Instant) -> bool {
-        start_time.elapsed() >= CHECK_TIMEOUT && self.state == CheckState::InProgress
+        self.is_timed_out_at(start_time, Instant::now())
+    }
+
+    /// [`is_timed_out`](Self::is_timed_out) evaluated at `now`
+    pub fn is_timed_out_at(&self, start_time: Instant, now: Instant) -> bool {
+        now.saturating_duration_since(start_time) >= CHECK_TIMEOUT
+            && self.state == CheckState::InProgress
     }
 
     /// Mark as in progress with new transaction ID
     pub fn start_check(&mut self) -> BindingRequest {
+        self.start_check_at(Instant::now())
+    }
+
+    /// [`start_check`](Self::start_check) with the send time given
+    pub fn start_check_at(&mut self, now: Instant) -> BindingRequest {
         let request = BindingRequest::new(self.priority, self.nominated);
         self.transaction_id = Some(request.transaction_id);
         self.state = CheckState::InProgress;
         self.transmit_count = 1;
-        self.last_sent = Some(Instant::now());
+        self.last_sent = Some(now);
         request
     }
 
     /// Record a retransmission
     pub fn record_retransmit(&mut self) {
+        self.record_retransmit_at(Instant::now());
+    }
+
+    /// [`record_retransmit`](Self::record_retransmit) with the send time given
+    pub fn record_retransmit_at(&mut self, now: Instant) {
         self.transmit_count += 1;
-        self.last_sent = Some(Instant::now());
+        self.last_sent = Some(now);
     }
 
     /// Handle a binding response
@@ -311,17 +333,25 @@ pub struct CheckList {
     next_check_index: usize,
     /// When last check was triggered
     last_check_time: Option<Instant>,
+    /// Time source for pacing, retransmits and timeouts
+    clock: SharedClock,
 }
 
 impl CheckList {
     /// Create a new check list
     pub fn new(is_controlling: bool) -> Self {
+        Self::with_clock(is_controlling, system_clock())
+    }
+
+    /// Create a check list whose timers read `clock`
+    pub fn with_clock(is_controlling: bool, clock: SharedClock) -> Self {
         Self {
             pairs: Vec::new(),
             start_time: None,
             is_controlling,
             next_check_index: 0,
             last_check_time: None,
+            clock,
         }
     }
 
@@ -360,7 +390,7 @@ impl CheckList {
 
     /// Start the checking process
     pub fn start(&mut self) {
-        self.start_time = Some(Instant::now());
+        self.start_time = Some(self.clock.now());
         self.last_check_time = None;
         self.next_check_index = 0;
     }
@@ -369,21 +399,23 @@ impl CheckList {
     ///
     /// Returns the pair index and binding request
     pub fn next_request(&mut self) -> Option<(usize, BindingRequest, SocketAddr)> {
+        let now = self.clock.now();
+
         // Check pacing
         if let Some(last) = self.last_check_time {
-            if last.elapsed() < PACE_INTERVAL {
+            if now.saturating_duration_since(last) < PACE_INTERVAL {
                 return None;
             }
         }
 
         // First check for retransmissions
         for (idx, pair) in self.pairs.iter_mut().enumerate() {
-            if pair.needs_retransmit() {
-                pair.record_retransmit();
+            if pair.needs_retransmit_at(now) {
+                pair.record_retransmit_at(now);
                 if let Some(txn_id) = pair.transaction_id {
                     let request =
                         BindingRequest::with_transaction_id(txn_id, pair.priority, pair.nominated);
-                    self.last_check_time = Some(Instant::now());
+                    self.last_check_time = Some(now);
                     return Some((idx, request, pair.remote.address));
                 }
             }
@@ -395,9 +427,9 @@ impl CheckList {
             self.next_check_index += 1;
 
             if self.pairs[idx].state == CheckState::Waiting {
-                let request = self.pairs[idx].start_check();
+                let request = self.pairs[idx].start_check_at(now);
                 let remote_addr = self.pairs[idx].remote.address;
-                self.last_check_time = Some(Instant::now());
+                self.last_check_time = Some(now);
                 return Some((idx, request, remote_addr));
             }
         }
@@ -446,10 +478,11 @@ impl CheckList {
             Some(s) => s,
             None => return,
         };
+        let now = self.clock.now();
 
         for pair in &mut self.pairs {
             if pair.state == CheckState::InProgress
-                && (pair.transmit_count >= MAX_RETRANSMITS || pair.is_timed_out(start))
+                && (pair.transmit_count >= MAX_RETRANSMITS || pair.is_timed_out_at(start, now))
             {
                 pair.mark_failed();
             }
@@ -479,7 +512,7 @@ impl CheckList {
     /// Check if checking has timed out overall
     pub fn is_timed_out(&self) -> bool {
         match self.start_time {
-            Some(start) => start.elapsed() >= CHECK_TIMEOUT,
+            Some(start) => self.clock.now().saturating_duration_since(start) >= CHECK_TIMEOUT,
             None => false,
         }
     }
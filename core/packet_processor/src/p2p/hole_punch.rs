@@ -21,6 +21,7 @@ use std::time::{Duration, Instant};
 use super::candidate::{
     gather_host_candidates, gather_reflexive_candidate, gather_relay_candidate, Candidate,
 };
+use super::clock::{system_clock, SharedClock};
 use super::connectivity::{
     decode_binding, encode_binding, BindingMessage, BindingResponse, CheckList,
 };
@@ -112,11 +113,23 @@ pub struct HolePunchCoordinator {
     outgoing_messages: Vec<Vec<u8>>,
     /// Binding requests to send (addr, encoded message)
     outgoing_bindings: Vec<(SocketAddr, Vec<u8>)>,
+    /// Time source for the start delay, check list and overall timeout
+    clock: SharedClock,
 }
 
 impl HolePunchCoordinator {
     /// Create a new hole punch coordinator
     pub fn new(session_id: u64, service_id: String, is_controlling: bool) -> Self {
+        Self::with_clock(session_id, service_id, is_controlling, system_clock())
+    }
+
+    /// Create a coordinator whose timers read `clock`
+    pub fn with_clock(
+        session_id: u64,
+        service_id: String,
+        is_controlling: bool,
+        clock: SharedClock,
+    ) -> Self {
         Self {
             state: HolePunchState::Idle,
             session_id,
@@ -124,7 +137,7 @@ impl HolePunchCoordinator {
             is_controlling,
             local_candidates: Vec::new(),
             remote_candidates: Vec::new(),
-            check_list: CheckList::new(is_controlling),
+            check_list: CheckList::with_clock(is_controlling, clock.clone()),
             start_time: None,
             check_start_time: None,
             intermediate_addr: None,
@@ -132,6 +145,7 @@ impl HolePunchCoordinator {
             working_addr: None,
             outgoing_messages: Vec::new(),
             outgoing_bindings: Vec::new(),
+            clock,
         }
     }
 
@@ -163,7 +177,7 @@ impl HolePunchCoordinator {
     /// Start gathering candidates
     pub fn start_gathering(&mut self, local_addresses: &[SocketAddr]) {
         self.state = HolePunchState::Gathering;
-        self.start_time = Some(Instant::now());
+        self.start_time = Some(self.clock.now());
 
         // Gather host candidates from local addresses
         self.local_candidates = gather_host_candidates(local_addresses, false);
@@ -257,7 +271,7 @@ impl HolePunchCoordinator {
                 if self.state != HolePunchState::Checking && self.state != HolePunchState::Connected
                 {
                     self.check_start_time =
-                        Some(Instant::now() + Duration::from_millis(start_delay_ms));
+                        Some(self.clock.now() + Duration::from_millis(start_delay_ms));
                     self.state = HolePunchState::WaitingToStart;
                 }
             }
@@ -293,7 +307,7 @@ impl HolePunchCoordinator {
     /// Check if ready to start connectivity checks
     pub fn should_start_checking(&self) -> bool {
         match (self.state, self.check_start_time) {
-            (HolePunchState::WaitingToStart, Some(start)) => Instant::now() >= start,
+            (HolePunchState::WaitingToStart, Some(start)) => self.clock.now() >= start,
             (HolePunchState::Signaling, _) => {
                 // Also allow starting if we have remote candidates but no explicit start signal
                 !self.remote_candidates.is_empty() && !self.local_candidates.is_empty()
@@ -310,7 +324,7 @@ impl HolePunchCoordinator {
         }
 
         // Build check list
-        self.check_list = CheckList::new(self.is_controlling);
+        self.check_list = CheckList::with_clock(self.is_controlling, self.clock.clone());
         self.check_list
             .add_pairs(&self.local_candidates, &self.remote_candidates);
         self.check_list.start();
@@ -377,10 +391,9 @@ impl HolePunchCoordinator {
         // Transition WaitingToStart → Checking once the delay has elapsed.
         // This handles the case where StartPunching arrives after (or with)
         // CandidateAnswer and no further signaling messages trigger re-evaluation.
+        let now = self.clock.now();
         if self.state == HolePunchState::WaitingToStart
-            && self
-                .check_start_time
-                .is_some_and(|start| Instant::now() >= start)
+            && self.check_start_time.is_some_and(|start| now >= start)
         {
             self.start_checking();
         }
@@ -405,7 +418,9 @@ impl HolePunchCoordinator {
 
         // Check overall hole punch timeout
         if let Some(start) = self.start_time {
-            if start.elapsed() >= HOLE_PUNCH_TIMEOUT && self.state != HolePunchState::Connected {
+            if now.saturating_duration_since(start) >= HOLE_PUNCH_TIMEOUT
+                && self.state != HolePunchState::Connected
+            {
                 self.state = HolePunchState::Failed;
             }
         }
@@ -533,6 +548,7 @@ pub fn should_switch_to_relay(
 mod tests {
     use super::super::candidate::CandidateType;
     use super::*;
+    use crate::p2p::clock::VirtualClock;
 
     #[test]
     fn test_coordinator_creation() {
@@ -845,4 +861,65 @@ mod tests {
             HolePunchState::Checking | HolePunchState::Failed
         ));
     }
+
+    /// Coordinator on a virtual clock with one remote host candidate, past
+    /// StartPunching with the default delay.
+    fn waiting_coordinator(clock: &VirtualClock) -> HolePunchCoordinator {
+        let mut coord = HolePunchCoordinator::with_clock(
+            12345,
+            "test-service".to_string(),
+            true,
+            clock.shared(),
+        );
+        coord.start_gathering(&["192.168.1.100:5000".parse().unwrap()]);
+        let start = SignalingMessage::StartPunching {
+            session_id: 12345,
+            start_delay_ms: DEFAULT_START_DELAY_MS,
+            peer_candidates: vec![Candidate::host("192.168.1.200:5000".parse().unwrap())],
+        };
+        coord
+            .process_signaling(&encode_message(&start).unwrap())
+            .unwrap();
+        coord
+    }
+
+    #[test]
+    fn test_start_delay_virtual_time() {
+        let clock = VirtualClock::new();
+        let mut coord = waiting_coordinator(&clock);
+        assert_eq!(coord.state(), HolePunchState::WaitingToStart);
+
+        clock.advance(Duration::from_millis(DEFAULT_START_DELAY_MS - 1));
+        coord.on_timeout();
+        assert_eq!(coord.state(), HolePunchState::WaitingToStart);
+
+        clock.advance(Duration::from_millis(1));
+        coord.on_timeout();
+        assert_eq!(coord.state(), HolePunchState::Checking);
+    }
+
+    #[test]
+    fn test_unanswered_checks_fail_virtual_time() {
+        let clock = VirtualClock::new();
+        let mut coord = waiting_coordinator(&clock);
+        clock.advance(Duration::from_millis(DEFAULT_START_DELAY_MS));
+        coord.on_timeout();
+
+        // Drive the check list in 10ms steps with no responses: the pair
+        // retransmits with backoff, then fails, well before HOLE_PUNCH_TIMEOUT
+        let mut requests = 0;
+        let mut elapsed = Duration::ZERO;
+        while coord.state() == HolePunchState::Checking && elapsed < HOLE_PUNCH_TIMEOUT {
+            while coord.poll_binding_request().is_some() {
+                requests += 1;
+            }
+            clock.advance(Duration::from_millis(10));
+            elapsed += Duration::from_millis(10);
+            coord.on_timeout();
+        }
+
+        assert_eq!(coord.state(), HolePunchState::Failed);
+        assert_eq!(requests, crate::p2p::connectivity::MAX_RETRANSMITS);
+        assert!(elapsed < HOLE_PUNCH_TIMEOUT);
+    }
 }
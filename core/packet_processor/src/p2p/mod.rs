@@ -16,6 +16,7 @@
 //! │  connectivity.rs - Binding request/response protocol          │
 //! │  hole_punch.rs   - Hole punching coordination                 │
 //! │  resilience.rs   - Keepalive and path fallback                │
+//! │  clock.rs        - Time source (system or virtual)            │
 //! │                                                                │
 //! └───────────────────────────────────────────────────────────────┘
 //! ```
@@ -29,6 +30,7 @@
 //! - [x] `resilience.rs` - Phase 5 (Path Resilience)
 
 pub mod candidate;
+pub mod clock;
 pub mod connectivity;
 pub mod hole_punch;
 pub mod resilience;
@@ -51,6 +53,8 @@ pub use candidate::{
     CandidateType,
 };
 
+pub use clock::{system_clock, Clock, SharedClock, SystemClock, VirtualClock};
+
 pub use signaling::{
     decode_message, decode_messages, encode_message, generate_session_id, SignalingError,
     SignalingMessage, SIGNALING_TIMEOUT_MS,
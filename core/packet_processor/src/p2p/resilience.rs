@@ -19,6 +19,7 @@
 use std::net::SocketAddr;
 use std::time::{Duration, Instant};
 
+use super::clock::{system_clock, SharedClock};
 use super::ZTNA_MAGIC;
 
 // ============================================================================
@@ -129,11 +130,18 @@ pub struct PathInfo {
     pub established_at: Instant,
     /// When the path last failed (for cooldown)
     pub last_failure: Option<Instant>,
+    /// Time source for all of the above
+    clock: SharedClock,
 }
 
 impl PathInfo {
     /// Create a new path info
     pub fn new(remote_addr: SocketAddr) -> Self {
+        Self::with_clock(remote_addr, system_clock())
+    }
+
+    /// Create a new path info whose timers read `clock`
+    pub fn with_clock(remote_addr: SocketAddr, clock: SharedClock) -> Self {
         Self {
             remote_addr,
             state: PathState::Active,
@@ -143,11 +151,17 @@ impl PathInfo {
             last_acked_sequence: 0,
             missed_keepalives: 0,
             rtt: None,
-            established_at: Instant::now(),
+            established_at: clock.now(),
             last_failure: None,
+            clock,
         }
     }
 
+    /// Time elapsed since `t` on this path's clock
+    fn since(&self, t: Instant) -> Duration {
+        self.clock.now().saturating_duration_since(t)
+    }
+
     /// Check if keepalive should be sent now
     pub fn should_send_keepalive(&self) -> bool {
         match self.state {
@@ -155,7 +169,7 @@ impl PathInfo {
             _ => {
                 match self.last_keepalive_sent {
                     None => true, // Never sent, send now
-                    Some(last) => last.elapsed() >= KEEPALIVE_INTERVAL,
+                    Some(last) => self.since(last) >= KEEPALIVE_INTERVAL,
                 }
             }
         }
@@ -165,7 +179,7 @@ impl PathInfo {
     pub fn record_keepalive_sent(&mut self) -> u32 {
         let seq = self.next_sequence;
         self.next_sequence = self.next_sequence.wrapping_add(1);
-        self.last_keepalive_sent = Some(Instant::now());
+        self.last_keepalive_sent = Some(self.clock.now());
         seq
     }
 
@@ -174,11 +188,11 @@ impl PathInfo {
         // Calculate RTT if this is a response to our latest keepalive
         if let Some(sent_time) = self.last_keepalive_sent {
             if sequence == self.next_sequence.wrapping_sub(1) {
-                self.rtt = Some(sent_time.elapsed());
+                self.rtt = Some(self.since(sent_time));
             }
         }
 
-        self.last_keepalive_received = Some(Instant::now());
+        self.last_keepalive_received = Some(self.clock.now());
         self.last_acked_sequence = sequence;
         self.missed_keepalives = 0;
 
@@ -203,14 +217,14 @@ impl PathInfo {
 
             // If we haven't received response for the last sent keepalive
             if self.last_acked_sequence != expected_response_seq
-                && sent_time.elapsed() >= KEEPALIVE_TIMEOUT
+                && self.since(sent_time) >= KEEPALIVE_TIMEOUT
             {
                 self.missed_keepalives += 1;
 
                 // Update state based on missed count
                 if self.missed_keepalives >= MISSED_KEEPALIVES_THRESHOLD {
                     self.state = PathState::Failed;
-                    self.last_failure = Some(Instant::now());
+                    self.last_failure = Some(self.clock.now());
                     return true;
                 } else if self.missed_keepalives > 0 {
                     self.state = PathState::Degraded;
@@ -225,7 +239,7 @@ impl PathInfo {
     pub fn can_retry(&self) -> bool {
         match self.last_failure {
             None => true,
-            Some(failure_time) => failure_time.elapsed() >= FALLBACK_COOLDOWN,
+            Some(failure_time) => self.since(failure_time) >= FALLBACK_COOLDOWN,
         }
     }
 
@@ -262,6 +276,8 @@ pub struct PathManager {
     active_path: ActivePath,
     /// Whether we're in fallback mode
     in_fallback: bool,
+    /// Time source handed to each direct path
+    clock: SharedClock,
 }
 
 /// Which path is currently active
@@ -278,11 +294,17 @@ pub enum ActivePath {
 impl PathManager {
     /// Create a new path manager
     pub fn new() -> Self {
+        Self::with_clock(system_clock())
+    }
+
+    /// Create a path manager whose keepalive and fallback timers read `clock`
+    pub fn with_clock(clock: SharedClock) -> Self {
         Self {
             direct_path: None,
             relay_addr: None,
             active_path: ActivePath::None,
             in_fallback: false,
+            clock,
         }
     }
 
@@ -296,7 +318,7 @@ impl PathManager {
 
     /// Establish direct P2P path
     pub fn set_direct(&mut self, addr: SocketAddr) {
-        self.direct_path = Some(PathInfo::new(addr));
+        self.direct_path = Some(PathInfo::with_clock(addr, self.clock.clone()));
         self.active_path = ActivePath::Direct;
         self.in_fallback = false;
     }
@@ -458,6 +480,7 @@ pub struct PathStats {
 #[cfg(test)]
 mod tests {
     use super::*;
+    use crate::p2p::clock::VirtualClock;
 
     #[test]
     fn test_encode_decode_keepalive_request() {
@@ -673,4 +696,78 @@ mod tests {
         assert_eq!(stats.direct_state, Some(PathState::Active));
         assert_eq!(stats.missed_keepalives, 0);
     }
+
+    #[test]
+    fn test_fallback_after_missed_keepalives_virtual_time() {
+        let clock = VirtualClock::new();
+        let mut manager = PathManager::with_clock(clock.shared());
+        let relay: SocketAddr = "1.2.3.4:4433".parse().unwrap();
+        let direct: SocketAddr = "192.168.1.100:5000".parse().unwrap();
+        manager.set_relay(relay);
+        manager.set_direct(direct);
+
+        // Keepalive goes out, response never comes back
+        assert!(manager.poll_keepalive().is_some());
+        clock.advance(KEEPALIVE_TIMEOUT - Duration::from_millis(1));
+        assert!(!manager.check_timeouts());
+        assert_eq!(manager.stats().missed_keepalives, 0);
+
+        // Each check past the response timeout counts one more miss
+        clock.advance(Duration::from_millis(1));
+        for missed in 1..MISSED_KEEPALIVES_THRESHOLD {
+            assert!(!manager.check_timeouts());
+            assert_eq!(manager.stats().missed_keepalives, missed);
+            assert_eq!(manager.stats().direct_state, Some(PathState::Degraded));
+        }
+        assert!(manager.check_timeouts());
+        assert_eq!(manager.active_path_type(), ActivePath::Relay);
+        assert!(manager.is_in_fallback());
+    }
+
+    #[test]
+    fn test_recovery_cooldown_virtual_time() {
+        let clock = VirtualClock::new();
+        let mut manager = PathManager::with_clock(clock.shared());
+        let direct: SocketAddr = "192.168.1.100:5000".parse().unwrap();
+        manager.set_relay("1.2.3.4:4433".parse().unwrap());
+        manager.set_direct(direct);
+
+        manager.poll_keepalive();
+        clock.advance(KEEPALIVE_TIMEOUT);
+        while !manager.check_timeouts() {}
+
+        clock.advance(FALLBACK_COOLDOWN - Duration::from_secs(1));
+        assert!(!manager.attempt_recovery());
+        clock.advance(Duration::from_secs(1));
+        assert!(manager.attempt_recovery());
+        assert_eq!(manager.stats().direct_state, Some(PathState::Recovering));
+
+        // Recovery keepalive is sent immediately; its response restores the path
+        let (addr, msg) = manager.poll_keepalive().unwrap();
+        let (_, seq) = decode_keepalive(&msg).unwrap();
+        clock.advance(Duration::from_millis(40));
+        manager.process_keepalive(addr, &encode_keepalive_response(seq));
+        assert_eq!(manager.stats().direct_state, Some(PathState::Active));
+        assert_eq!(manager.stats().direct_rtt, Some(Duration::from_millis(40)));
+
+        manager.switch_to_direct();
+        assert_eq!(manager.active_path_type(), ActivePath::Direct);
+    }
+
+    #[test]
+    fn test_keepalive_interval_virtual_time() {
+        let clock = VirtualClock::new();
+        let mut manager = PathManager::with_clock(clock.shared());
+        manager.set_direct("192.168.1.100:5000".parse().unwrap());
+
+        // 1 virtual hour at 1s steps: one keepalive per interval plus the initial one
+        let mut sent = 0;
+        for _ in 0..3600 {
+            if manager.poll_keepalive().is_some() {
+                sent += 1;
+            }
+            clock.advance(Duration::from_secs(1));
+        }
+        assert_eq!(sent, 3600 / KEEPALIVE_INTERVAL.as_secs() as usize);
+    }
 }
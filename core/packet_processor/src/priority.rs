@@ -0,0 +1,383 @@
+//! Priority classes for tunneled packets on the Intermediate connection
+//!
+//! quiche sends DATAGRAMs first in, first out, so a DNS query queued
+//! behind a bulk upload waits for the whole backlog. The Agent instead
+//! classifies each outgoing packet (protocol, port, DSCP) and holds it in
+//! a per-class queue. Packets move into quiche only while its DATAGRAM
+//! queue is shallow, which keeps any backlog here, where later
+//! higher-class packets can overtake it.
+//!
+//! Queues are served by weighted round robin ([`CLASS_WEIGHTS`] packets
+//! per round). A backlogged class goes first until it has used its
+//! weight, so interactive packets are sent next, yet a saturating flow
+//! that matches an interactive rule (scp on port 22) cannot starve the
+//! other classes.
+
+use std::collections::VecDeque;
+
+/// Number of traffic classes
+pub const CLASS_COUNT: usize = 3;
+
+/// Packets each class may send per round while others are waiting
+pub const CLASS_WEIGHTS: [u32; CLASS_COUNT] = [16, 4, 1];
+
+/// Packets queued per class before new ones are refused
+pub const MAX_CLASS_QUEUE: usize = 256;
+
+const PROTO_ICMP: u8 = 1;
+const PROTO_TCP: u8 = 6;
+const PROTO_UDP: u8 = 17;
+
+/// Rule field value matching any DSCP
+pub const DSCP_ANY: u8 = 0xFF;
+
+/// Traffic class, highest priority first
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(u8)]
+pub enum Class {
+    /// DNS, SSH, ICMP, EF-marked real-time media
+    Interactive = 0,
+    Default = 1,
+    /// Lower-effort marked traffic (DSCP CS1 / LE)
+    Bulk = 2,
+}
+
+impl Class {
+    pub fn from_u8(value: u8) -> Option<Class> {
+        match value {
+            0 => Some(Class::Interactive),
+            1 => Some(Class::Default),
+            2 => Some(Class::Bulk),
+            _ => None,
+        }
+    }
+}
+
+/// Classification rule (`AgentClassRule` in the bridging header)
+///
+/// A packet matches when every set field matches. Ports match if either
+/// the source or destination port is within `port_lo..=port_hi`; a rule
+/// with a port range only matches TCP and UDP.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct ClassRule {
+    /// IP protocol number (0 = any)
+    pub protocol: u8,
+    /// DSCP value ([`DSCP_ANY`] = any)
+    pub dscp: u8,
+    /// [`Class`] of matching packets
+    pub class_id: u8,
+    pub reserved: u8,
+    /// Port range (both 0 = any port)
+    pub port_lo: u16,
+    pub port_hi: u16,
+}
+
+impl ClassRule {
+    const fn new(protocol: u8, dscp: u8, ports: (u16, u16), class: Class) -> Self {
+        ClassRule {
+            protocol,
+            dscp,
+            class_id: class as u8,
+            reserved: 0,
+            port_lo: ports.0,
+            port_hi: ports.1,
+        }
+    }
+
+    fn matches(&self, packet: &PacketInfo) -> bool {
+        if self.protocol != 0 && self.protocol != packet.protocol {
+            return false;
+        }
+        if self.dscp != DSCP_ANY && self.dscp != packet.dscp {
+            return false;
+        }
+        if self.port_lo == 0 && self.port_hi == 0 {
+            return true;
+        }
+        let in_range = |port: u16| (self.port_lo..=self.port_hi).contains(&port);
+        packet
+            .ports
+            .is_some_and(|(src, dst)| in_range(src) || in_range(dst))
+    }
+}
+
+/// Rules used until the host sets its own
+pub const DEFAULT_RULES: [ClassRule; 8] = [
+    // DNS
+    ClassRule::new(PROTO_UDP, DSCP_ANY, (53, 53), Class::Interactive),
+    ClassRule::new(PROTO_TCP, DSCP_ANY, (53, 53), Class::Interactive),
+    // SSH
+    ClassRule::new(PROTO_TCP, DSCP_ANY, (22, 22), Class::Interactive),
+    ClassRule::new(PROTO_ICMP, DSCP_ANY, (0, 0), Class::Interactive),
+    // Expedited Forwarding (voice) and network control
+    ClassRule::new(0, 46, (0, 0), Class::Interactive),
+    ClassRule::new(0, 48, (0, 0), Class::Interactive),
+    // Lower effort (RFC 8622) and CS1
+    ClassRule::new(0, 1, (0, 0), Class::Bulk),
+    ClassRule::new(0, 8, (0, 0), Class::Bulk),
+];
+
+/// Fields of an IP packet the rules look at
+struct PacketInfo {
+    protocol: u8,
+    dscp: u8,
+    /// Source and destination port of an unfragmented TCP or UDP packet
+    ports: Option<(u16, u16)>,
+}
+
+impl PacketInfo {
+    fn parse(packet: &[u8]) -> Option<PacketInfo> {
+        let (protocol, dscp, l4) = match packet.first()? >> 4 {
+            4 => {
+                let header_len = (packet[0] & 0x0F) as usize * 4;
+                if packet.len() < 20 || header_len < 20 {
+                    return None;
+                }
+                // Only first fragments carry ports
+                let offset = u16::from_be_bytes([packet[6], packet[7]]) & 0x1FFF;
+                let l4 = if offset == 0 {
+                    packet.get(header_len..)
+                } else {
+                    None
+                };
+                (packet[9], packet[1] >> 2, l4)
+            }
+            6 => {
+                if packet.len() < 40 {
+                    return None;
+                }
+                let traffic_class = (packet[0] << 4) | (packet[1] >> 4);
+                // Extension headers are not walked
+                (packet[6], traffic_class >> 2, packet.get(40..))
+            }
+            _ => return None,
+        };
+        let ports = match (protocol, l4) {
+            (PROTO_TCP | PROTO_UDP, Some(l4)) if l4.len() >= 4 => Some((
+                u16::from_be_bytes([l4[0], l4[1]]),
+                u16::from_be_bytes([l4[2], l4[3]]),
+            )),
+            _ => None,
+        };
+        Some(PacketInfo {
+            protocol,
+            dscp,
+            ports,
+        })
+    }
+}
+
+/// Maps packets to classes: first matching rule, else [`Class::Default`]
+#[derive(Debug, Clone)]
+pub struct Classifier {
+    rules: Vec<ClassRule>,
+}
+
+impl Classifier {
+    pub fn new() -> Self {
+        Classifier {
+            rules: DEFAULT_RULES.to_vec(),
+        }
+    }
+
+    /// Replace the rules; None if any rule names an unknown class
+    pub fn with_rules(rules: &[ClassRule]) -> Option<Self> {
+        if rules.iter().any(|r| Class::from_u8(r.class_id).is_none()) {
+            return None;
+        }
+        Some(Classifier {
+            rules: rules.to_vec(),
+        })
+    }
+
+    /// Class of an IP packet (not a service-routed DATAGRAM)
+    pub fn classify(&self, packet: &[u8]) -> Class {
+        PacketInfo::parse(packet)
+            .and_then(|info| self.rules.iter().find(|r| r.matches(&info)))
+            .and_then(|r| Class::from_u8(r.class_id))
+            .unwrap_or(Class::Default)
+    }
+}
+
+impl Default for Classifier {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Per-class packet queues served by weighted round robin
+#[derive(Debug)]
+pub struct ClassQueues {
+    queues: [VecDeque<Vec<u8>>; CLASS_COUNT],
+    /// Packets each class may still send this round
+    credits: [u32; CLASS_COUNT],
+}
+
+impl ClassQueues {
+    pub fn new() -> Self {
+        ClassQueues {
+            queues: Default::default(),
+            credits: CLASS_WEIGHTS,
+        }
+    }
+
+    /// Queue `packet`; hands it back if its class is full
+    pub fn push(&mut self, class: Class, packet: Vec<u8>) -> Result<(), Vec<u8>> {
+        let queue = &mut self.queues[class as usize];
+        if queue.len() >= MAX_CLASS_QUEUE {
+            return Err(packet);
+        }
+        queue.push_back(packet);
+        Ok(())
+    }
+
+    /// Next packet to send: from the highest class that is backlogged and
+    /// has credit left, starting a new round when none has
+    pub fn pop(&mut self) -> Option<Vec<u8>> {
+        if self.is_empty() {
+            return None;
+        }
+        loop {
+            for class in 0..CLASS_COUNT {
+                if self.credits[class] > 0 && !self.queues[class].is_empty() {
+                    self.credits[class] -= 1;
+                    return self.queues[class].pop_front();
+                }
+            }
+            self.credits = CLASS_WEIGHTS;
+        }
+    }
+
+    pub fn len(&self) -> usize {
+        self.queues.iter().map(|q| q.len()).sum()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.queues.iter().all(|q| q.is_empty())
+    }
+}
+
+impl Default for ClassQueues {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn ipv4(protocol: u8, tos: u8, src_port: u16, dst_port: u16) -> Vec<u8> {
+        let mut p = vec![0u8; 40];
+        p[0] = 0x45;
+        p[1] = tos;
+        p[9] = protocol;
+        p[20..22].copy_from_slice(&src_port.to_be_bytes());
+        p[22..24].copy_from_slice(&dst_port.to_be_bytes());
+        p
+    }
+
+    #[test]
+    fn test_default_rules() {
+        let c = Classifier::new();
+        assert_eq!(
+            c.classify(&ipv4(PROTO_UDP, 0, 50000, 53)),
+            Class::Interactive
+        );
+        // Replies match on the source port
+        assert_eq!(
+            c.classify(&ipv4(PROTO_TCP, 0, 22, 50000)),
+            Class::Interactive
+        );
+        assert_eq!(c.classify(&ipv4(PROTO_ICMP, 0, 0, 0)), Class::Interactive);
+        assert_eq!(
+            c.classify(&ipv4(PROTO_UDP, 46 << 2, 40000, 40002)),
+            Class::Interactive
+        );
+        assert_eq!(
+            c.classify(&ipv4(PROTO_TCP, 8 << 2, 50000, 443)),
+            Class::Bulk
+        );
+        assert_eq!(c.classify(&ipv4(PROTO_TCP, 0, 50000, 443)), Class::Default);
+        assert_eq!(c.classify(&[0xFF; 8]), Class::Default);
+
+        // IPv6/UDP to port 53
+        let mut v6 = vec![0u8; 48];
+        v6[0] = 0x60;
+        v6[6] = PROTO_UDP;
+        v6[42..44].copy_from_slice(&53u16.to_be_bytes());
+        assert_eq!(c.classify(&v6), Class::Interactive);
+
+        // Non-first fragments carry no ports
+        let mut frag = ipv4(PROTO_UDP, 0, 50000, 53);
+        frag[7] = 10;
+        assert_eq!(c.classify(&frag), Class::Default);
+    }
+
+    #[test]
+    fn test_custom_rules() {
+        let rules = [
+            ClassRule::new(PROTO_TCP, DSCP_ANY, (8000, 8999), Class::Bulk),
+            ClassRule::new(0, DSCP_ANY, (0, 0), Class::Interactive),
+        ];
+        let c = Classifier::with_rules(&rules).unwrap();
+        assert_eq!(c.classify(&ipv4(PROTO_TCP, 0, 50000, 8080)), Class::Bulk);
+        assert_eq!(
+            c.classify(&ipv4(PROTO_UDP, 0, 50000, 8080)),
+            Class::Interactive
+        );
+
+        let bad = [ClassRule {
+            class_id: 3,
+            ..rules[0]
+        }];
+        assert!(Classifier::with_rules(&bad).is_none());
+        assert_eq!(
+            Classifier::with_rules(&[])
+                .unwrap()
+                .classify(&ipv4(PROTO_UDP, 0, 1, 53)),
+            Class::Default
+        );
+    }
+
+    #[test]
+    fn test_interactive_overtakes_backlog() {
+        let mut q = ClassQueues::new();
+        for i in 0..100u8 {
+            q.push(Class::Default, vec![1, i]).unwrap();
+        }
+        assert_eq!(q.pop(), Some(vec![1, 0]));
+        q.push(Class::Interactive, vec![0]).unwrap();
+        assert_eq!(q.pop(), Some(vec![0]));
+        assert_eq!(q.len(), 99);
+    }
+
+    #[test]
+    fn test_weights_prevent_starvation() {
+        let mut q = ClassQueues::new();
+        for _ in 0..100 {
+            q.push(Class::Interactive, vec![0]).unwrap();
+            q.push(Class::Default, vec![1]).unwrap();
+            q.push(Class::Bulk, vec![2]).unwrap();
+        }
+        let round: usize = CLASS_WEIGHTS.iter().sum::<u32>() as usize;
+        let mut sent = [0u32; CLASS_COUNT];
+        for _ in 0..round * 2 {
+            sent[q.pop().unwrap()[0] as usize] += 1;
+        }
+        assert_eq!(sent, [2 * CLASS_WEIGHTS[0], 2 * CLASS_WEIGHTS[1], 2]);
+    }
+
+    #[test]
+    fn test_queue_bound() {
+        let mut q = ClassQueues::new();
+        for _ in 0..MAX_CLASS_QUEUE {
+            q.push(Class::Bulk, vec![2]).unwrap();
+        }
+        assert_eq!(q.push(Class::Bulk, vec![2]), Err(vec![2]));
+        assert!(q.push(Class::Default, vec![1]).is_ok());
+        while q.pop().is_some() {}
+        assert!(q.is_empty());
+    }
+}
@@ -0,0 +1,116 @@
+//! qlog streaming to a host-provided callback
+//!
+//! The Network Extension cannot write files where anyone would find them, so
+//! qlog output is handed to the host instead: `agent_set_qlog` registers a C
+//! callback, and every QUIC connection the Agent owns streams its JSON-SEQ
+//! records through it, tagged with the connection they belong to.
+//!
+//! The callback runs synchronously on whichever thread is driving the Agent
+//! (inside `agent_recv`, `agent_poll`, `agent_on_timeout`, ...). It must copy
+//! the bytes out and return quickly, and must not call back into the Agent.
+
+use std::ffi::c_void;
+use std::io::{self, Write};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+
+/// Host callback receiving qlog bytes.
+///
+/// `path` is `TRACE_PATH_INTERMEDIATE` or `TRACE_PATH_P2P`; `data` is only
+/// valid for the duration of the call.
+pub type QlogCallback = extern "C" fn(ctx: *mut c_void, path: u8, data: *const u8, len: usize);
+
+/// The registered callback and its context pointer
+pub struct QlogSink {
+    callback: QlogCallback,
+    /// Host context, stored as an address so writers are `Send + Sync`
+    ctx: usize,
+    /// Cleared when the sink is replaced or removed; writers still owned by
+    /// quiche then discard their output instead of calling a stale callback
+    live: Arc<AtomicBool>,
+}
+
+impl QlogSink {
+    pub fn new(callback: QlogCallback, ctx: *mut c_void) -> Self {
+        QlogSink {
+            callback,
+            ctx: ctx as usize,
+            live: Arc::new(AtomicBool::new(true)),
+        }
+    }
+
+    /// Stream qlog for `conn` through this sink
+    pub fn attach(&self, conn: &mut quiche::Connection, path: u8, title: &str) {
+        let writer = CallbackWriter {
+            callback: self.callback,
+            ctx: self.ctx,
+            path,
+            live: Arc::clone(&self.live),
+        };
+        conn.set_qlog(
+            Box::new(writer),
+            title.to_string(),
+            format!("{} {}", title, conn.trace_id()),
+        );
+    }
+}
+
+impl Drop for QlogSink {
+    fn drop(&mut self) {
+        self.live.store(false, Ordering::Release);
+    }
+}
+
+struct CallbackWriter {
+    callback: QlogCallback,
+    ctx: usize,
+    path: u8,
+    live: Arc<AtomicBool>,
+}
+
+impl Write for CallbackWriter {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        if !buf.is_empty() && self.live.load(Ordering::Acquire) {
+            (self.callback)(self.ctx as *mut c_void, self.path, buf.as_ptr(), buf.len());
+        }
+        Ok(buf.len())
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::Mutex;
+
+    extern "C" fn collect(ctx: *mut c_void, path: u8, data: *const u8, len: usize) {
+        let out = unsafe { &*(ctx as *const Mutex<Vec<(u8, Vec<u8>)>>) };
+        let bytes = unsafe { std::slice::from_raw_parts(data, len) }.to_vec();
+        out.lock().unwrap().push((path, bytes));
+    }
+
+    #[test]
+    fn test_writer_forwards_until_sink_dropped() {
+        let out: Mutex<Vec<(u8, Vec<u8>)>> = Mutex::new(Vec::new());
+        let sink = QlogSink::new(collect, &out as *const _ as *mut c_void);
+        let mut writer = CallbackWriter {
+            callback: sink.callback,
+            ctx: sink.ctx,
+            path: 1,
+            live: Arc::clone(&sink.live),
+        };
+
+        writer
+            .write_all(b"\x1e{\"qlog_version\":\"0.3\"}\n")
+            .unwrap();
+        assert_eq!(out.lock().unwrap().len(), 1);
+        assert_eq!(out.lock().unwrap()[0].0, 1);
+
+        drop(sink);
+        writer.write_all(b"\x1e{}\n").unwrap();
+        assert_eq!(out.lock().unwrap().len(), 1);
+    }
+}
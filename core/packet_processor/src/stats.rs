@@ -0,0 +1,214 @@
+//! Transport statistics snapshot for the host (`agent_get_stats`)
+//!
+//! The host reads one [`AgentStats`] per call: Agent-level counters plus a
+//! [`ConnStats`] for the Intermediate connection and each P2P connection,
+//! taken from quiche's `stats()` and the active path's `path_stats()`.
+//!
+//! The struct is versioned. The host sets `struct_size` to
+//! `sizeof(AgentStats)` before the call; the Agent refuses a smaller buffer
+//! and always writes [`AGENT_STATS_VERSION`] back. New fields are only ever
+//! appended, bumping the version.
+
+use std::net::SocketAddr;
+
+use quiche::Connection;
+
+use crate::trace::DropReason;
+
+/// Layout version of [`AgentStats`]
+pub const AGENT_STATS_VERSION: u32 = 1;
+
+/// P2P connections reported per snapshot (`AgentStats::p2p`)
+pub const AGENT_STATS_MAX_P2P: usize = 4;
+
+/// Statistics for one QUIC connection (`AgentConnStats` in the bridging header)
+///
+/// Path fields (cwnd, RTT, delivery rate, PMTU) come from the connection's
+/// active path; counters are connection totals.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct ConnStats {
+    /// Peer IPv4 address (zero for IPv6 peers or unused entries)
+    pub peer_ip: [u8; 4],
+    pub peer_port: u16,
+    /// 1 once the handshake has completed
+    pub established: u8,
+    pub reserved: u8,
+    /// Congestion window in bytes
+    pub cwnd: u64,
+    /// Smoothed RTT in microseconds
+    pub srtt_us: u64,
+    /// RTT variation in microseconds
+    pub rttvar_us: u64,
+    /// Minimum observed RTT in microseconds (0 if not yet measured)
+    pub min_rtt_us: u64,
+    /// Estimated delivery rate in bytes per second
+    pub delivery_rate: u64,
+    /// Path MTU in bytes
+    pub pmtu: u64,
+    pub sent_packets: u64,
+    pub recv_packets: u64,
+    pub lost_packets: u64,
+    pub retrans_packets: u64,
+    pub sent_bytes: u64,
+    pub recv_bytes: u64,
+    pub lost_bytes: u64,
+    /// DATAGRAM frames waiting to be sent
+    pub dgram_send_queue_len: u64,
+    pub dgram_send_queue_bytes: u64,
+}
+
+impl ConnStats {
+    pub fn from_conn(conn: &Connection, peer: SocketAddr) -> Self {
+        let stats = conn.stats();
+        let mut out = ConnStats {
+            established: conn.is_established() as u8,
+            sent_packets: stats.sent as u64,
+            recv_packets: stats.recv as u64,
+            lost_packets: stats.lost as u64,
+            retrans_packets: stats.retrans as u64,
+            sent_bytes: stats.sent_bytes,
+            recv_bytes: stats.recv_bytes,
+            lost_bytes: stats.lost_bytes,
+            dgram_send_queue_len: conn.dgram_send_queue_len() as u64,
+            dgram_send_queue_bytes: conn.dgram_send_queue_byte_size() as u64,
+            ..Default::default()
+        };
+
+        if let SocketAddr::V4(v4) = peer {
+            out.peer_ip = v4.ip().octets();
+        }
+        out.peer_port = peer.port();
+
+        if let Some(path) = conn.path_stats().find(|p| p.active) {
+            out.cwnd = path.cwnd as u64;
+            out.srtt_us = path.rtt.as_micros() as u64;
+            out.rttvar_us = path.rttvar.as_micros() as u64;
+            out.min_rtt_us = path.min_rtt.map(|d| d.as_micros() as u64).unwrap_or(0);
+            out.delivery_rate = path.delivery_rate;
+            out.pmtu = path.pmtu as u64;
+        }
+
+        out
+    }
+}
+
+/// Snapshot of Agent-wide and per-connection statistics (`AgentStats` in the
+/// bridging header)
+#[repr(C)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct AgentStats {
+    /// Out: [`AGENT_STATS_VERSION`]
+    pub version: u32,
+    /// In: size of the caller's struct in bytes
+    pub struct_size: u32,
+    /// `AgentState`
+    pub state: u32,
+    /// 0 = Direct, 1 = Relay, 2 = None
+    pub active_path: u8,
+    /// 1 if the direct path failed and traffic fell back to relay
+    pub in_fallback: u8,
+    /// 1 if the Intermediate connection exists
+    pub has_intermediate: u8,
+    pub reserved: u8,
+    /// Services with an acknowledged registration
+    pub registered_services: u32,
+    /// Registrations sent and awaiting ACK
+    pub pending_registrations: u32,
+    /// Tunneled IP packets queued for `agent_recv_datagram`
+    pub recv_queue_len: u64,
+    pub recv_queue_bytes: u64,
+    /// Oldest queued packets dropped because the receive queue was full
+    pub drops_recv_queue_full: u64,
+    /// Packets dropped because they exceeded the `agent_recv_datagram` buffer
+    pub drops_oversize: u64,
+    /// Packets refused by the QUIC datagram send queue
+    pub drops_send_rejected: u64,
+    /// Number of P2P connections (may exceed [`AGENT_STATS_MAX_P2P`])
+    pub p2p_count: u32,
+    /// Entries of `p2p` that are filled in
+    pub p2p_reported: u32,
+    pub intermediate: ConnStats,
+    pub p2p: [ConnStats; AGENT_STATS_MAX_P2P],
+}
+
+impl Default for AgentStats {
+    fn default() -> Self {
+        AgentStats {
+            version: AGENT_STATS_VERSION,
+            struct_size: std::mem::size_of::<AgentStats>() as u32,
+            state: 0,
+            active_path: 2,
+            in_fallback: 0,
+            has_intermediate: 0,
+            reserved: 0,
+            registered_services: 0,
+            pending_registrations: 0,
+            recv_queue_len: 0,
+            recv_queue_bytes: 0,
+            drops_recv_queue_full: 0,
+            drops_oversize: 0,
+            drops_send_rejected: 0,
+            p2p_count: 0,
+            p2p_reported: 0,
+            intermediate: ConnStats::default(),
+            p2p: [ConnStats::default(); AGENT_STATS_MAX_P2P],
+        }
+    }
+}
+
+/// Packets the Agent itself discarded, by [`DropReason`]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct DropCounters {
+    pub recv_queue_full: u64,
+    pub oversize: u64,
+    pub send_rejected: u64,
+}
+
+impl DropCounters {
+    pub fn count(&mut self, reason: DropReason) {
+        match reason {
+            DropReason::RecvQueueFull => self.recv_queue_full += 1,
+            DropReason::Oversize => self.oversize += 1,
+            DropReason::SendRejected => self.send_rejected += 1,
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_layout() {
+        // Field offsets the bridging header relies on
+        assert_eq!(std::mem::size_of::<ConnStats>(), 8 + 15 * 8);
+        assert_eq!(std::mem::align_of::<AgentStats>(), 8);
+        assert_eq!(
+            std::mem::size_of::<AgentStats>(),
+            24 + 5 * 8 + 8 + (1 + AGENT_STATS_MAX_P2P) * std::mem::size_of::<ConnStats>()
+        );
+    }
+
+    #[test]
+    fn test_default_is_versioned() {
+        let stats = AgentStats::default();
+        assert_eq!(stats.version, AGENT_STATS_VERSION);
+        assert_eq!(
+            stats.struct_size as usize,
+            std::mem::size_of::<AgentStats>()
+        );
+        assert_eq!(stats.active_path, 2);
+    }
+
+    #[test]
+    fn test_drop_counters() {
+        let mut drops = DropCounters::default();
+        drops.count(DropReason::Oversize);
+        drops.count(DropReason::Oversize);
+        drops.count(DropReason::RecvQueueFull);
+        assert_eq!(drops.oversize, 2);
+        assert_eq!(drops.recv_queue_full, 1);
+        assert_eq!(drops.send_rejected, 0);
+    }
+}
@@ -0,0 +1,298 @@
+//! In-memory event trace for performance forensics
+//!
+//! `log` output is discarded inside the Network Extension (see
+//! `init_logging`), and os_log is too expensive to call per packet. Instead
+//! the Agent records fixed-size binary events into a [`TraceRing`]; the host
+//! pulls them with `agent_drain_trace` when it wants to ship a trace, or
+//! from another thread through an `agent_trace_handle`.
+//!
+//! Recording is a handful of relaxed atomic stores into a preallocated slot:
+//! no allocation, no locks, no formatting. The ring overwrites its oldest
+//! records when full, and the next drain reports how many were lost.
+//!
+//! Each slot is guarded by a sequence stamp (a per-slot seqlock), so a reader
+//! that races a writer wrapping around the ring detects the torn record and
+//! skips it instead of returning garbage.
+
+use std::sync::atomic::{fence, AtomicU64, Ordering};
+use std::time::Instant;
+
+/// Records kept by the Agent's ring (power of two)
+pub const TRACE_CAPACITY: usize = 4096;
+
+/// Event kinds (`TraceRecord::kind`)
+#[repr(u8)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum TraceKind {
+    /// Records were overwritten before being drained; `arg1` = count
+    Overflow = 0,
+    /// UDP packet fed to `agent_recv`; `arg0` = bytes
+    Recv = 1,
+    /// UDP packet returned by `agent_poll`/`agent_poll_p2p`; `arg0` = bytes
+    Send = 2,
+    /// IP packet queued with `dgram_send`; `arg0` = bytes, `arg1` = send queue depth
+    DgramSend = 3,
+    /// Tunneled IP packet queued for the host; `arg0` = bytes, `arg1` = queue depth
+    DgramRecv = 4,
+    /// Packet dropped; `arg0` = [`DropReason`], `arg1` = bytes
+    Drop = 5,
+    /// Active path changed; `arg0` = new `ActivePath` (0 direct, 1 relay, 2 none)
+    PathSwitch = 6,
+    /// `agent_on_timeout` ran; `arg1` = µs until the next timeout (0 = none)
+    Timer = 7,
+    /// Agent state changed; `arg0` = new `AgentState`
+    State = 8,
+    /// `agent_recv` failed; `arg0` = `AgentResult`, `arg1` = bytes
+    RecvError = 9,
+}
+
+/// `arg0` of a [`TraceKind::Drop`] record
+#[repr(u32)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DropReason {
+    /// Host receive queue full; oldest packet dropped
+    RecvQueueFull = 1,
+    /// Packet larger than the host's buffer in `agent_recv_datagram`
+    Oversize = 2,
+    /// `dgram_send` refused the packet (queue full or too large)
+    SendRejected = 3,
+}
+
+/// Which connection an event belongs to (`TraceRecord::path`)
+pub const TRACE_PATH_INTERMEDIATE: u8 = 0;
+pub const TRACE_PATH_P2P: u8 = 1;
+
+/// One trace event as copied out to the host (24 bytes, `AgentTraceRecord`
+/// in the bridging header)
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct TraceRecord {
+    /// Microseconds since the ring was created
+    pub timestamp_us: u64,
+    pub kind: u8,
+    pub path: u8,
+    pub reserved: u16,
+    pub arg0: u32,
+    pub arg1: u64,
+}
+
+impl TraceRecord {
+    fn pack_meta(&self) -> u64 {
+        (self.kind as u64) | (self.path as u64) << 8 | (self.arg0 as u64) << 32
+    }
+
+    fn unpack(timestamp_us: u64, meta: u64, arg1: u64) -> Self {
+        TraceRecord {
+            timestamp_us,
+            kind: meta as u8,
+            path: (meta >> 8) as u8,
+            reserved: 0,
+            arg0: (meta >> 32) as u32,
+            arg1,
+        }
+    }
+}
+
+#[derive(Default)]
+struct Slot {
+    /// `seq + 1` of the record held, 0 if never written, `u64::MAX` mid-write
+    stamp: AtomicU64,
+    timestamp_us: AtomicU64,
+    meta: AtomicU64,
+    arg1: AtomicU64,
+}
+
+/// Fixed-size single-producer ring of [`TraceRecord`]s
+pub struct TraceRing {
+    slots: Box<[Slot]>,
+    mask: u64,
+    /// Sequence number of the next record to write
+    head: AtomicU64,
+    /// Sequence number of the next record to drain
+    tail: AtomicU64,
+    origin: Instant,
+}
+
+impl TraceRing {
+    /// `capacity` is rounded up to a power of two.
+    pub fn new(capacity: usize) -> Self {
+        let capacity = capacity.max(1).next_power_of_two();
+        TraceRing {
+            slots: (0..capacity).map(|_| Slot::default()).collect(),
+            mask: capacity as u64 - 1,
+            head: AtomicU64::new(0),
+            tail: AtomicU64::new(0),
+            origin: Instant::now(),
+        }
+    }
+
+    pub fn capacity(&self) -> usize {
+        self.slots.len()
+    }
+
+    /// Append an event. Must only be called from one thread at a time (the
+    /// Agent calls it with `&mut self` held).
+    #[inline]
+    pub fn record(&self, kind: TraceKind, path: u8, arg0: u32, arg1: u64) {
+        let seq = self.head.load(Ordering::Relaxed);
+        let slot = &self.slots[(seq & self.mask) as usize];
+        let meta = TraceRecord {
+            kind: kind as u8,
+            path,
+            arg0,
+            ..Default::default()
+        }
+        .pack_meta();
+
+        slot.stamp.store(u64::MAX, Ordering::Relaxed);
+        fence(Ordering::Release);
+        slot.timestamp_us
+            .store(self.origin.elapsed().as_micros() as u64, Ordering::Relaxed);
+        slot.meta.store(meta, Ordering::Relaxed);
+        slot.arg1.store(arg1, Ordering::Relaxed);
+        slot.stamp.store(seq + 1, Ordering::Release);
+        self.head.store(seq + 1, Ordering::Release);
+    }
+
+    /// Copy up to `out.len()` of the oldest undrained records into `out`,
+    /// returning how many were written.
+    ///
+    /// If records were overwritten since the last drain, the first record
+    /// written is a [`TraceKind::Overflow`] carrying the number lost.
+    pub fn drain(&self, out: &mut [TraceRecord]) -> usize {
+        if out.is_empty() {
+            return 0;
+        }
+        let head = self.head.load(Ordering::Acquire);
+        let mut tail = self.tail.load(Ordering::Relaxed);
+        let mut written = 0;
+
+        let oldest = head.saturating_sub(self.slots.len() as u64);
+        if tail < oldest {
+            out[0] = TraceRecord {
+                timestamp_us: self.origin.elapsed().as_micros() as u64,
+                kind: TraceKind::Overflow as u8,
+                arg1: oldest - tail,
+                ..Default::default()
+            };
+            written = 1;
+            tail = oldest;
+        }
+
+        while tail < head && written < out.len() {
+            let slot = &self.slots[(tail & self.mask) as usize];
+            let stamp = slot.stamp.load(Ordering::Acquire);
+            let timestamp_us = slot.timestamp_us.load(Ordering::Relaxed);
+            let meta = slot.meta.load(Ordering::Relaxed);
+            let arg1 = slot.arg1.load(Ordering::Relaxed);
+            fence(Ordering::Acquire);
+            // Overwritten (or being overwritten) by a newer record: skip it
+            if stamp == tail + 1 && slot.stamp.load(Ordering::Relaxed) == stamp {
+                out[written] = TraceRecord::unpack(timestamp_us, meta, arg1);
+                written += 1;
+            }
+            tail += 1;
+        }
+
+        self.tail.store(tail, Ordering::Release);
+        written
+    }
+}
+
+impl Default for TraceRing {
+    fn default() -> Self {
+        Self::new(TRACE_CAPACITY)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_record_layout() {
+        assert_eq!(std::mem::size_of::<TraceRecord>(), 24);
+        assert_eq!(std::mem::align_of::<TraceRecord>(), 8);
+    }
+
+    #[test]
+    fn test_drain_in_order() {
+        let ring = TraceRing::new(8);
+        ring.record(TraceKind::Recv, TRACE_PATH_INTERMEDIATE, 1200, 0);
+        ring.record(TraceKind::DgramRecv, TRACE_PATH_P2P, 1100, 3);
+
+        let mut out = [TraceRecord::default(); 8];
+        assert_eq!(ring.drain(&mut out), 2);
+        assert_eq!(out[0].kind, TraceKind::Recv as u8);
+        assert_eq!(out[0].arg0, 1200);
+        assert_eq!(out[1].kind, TraceKind::DgramRecv as u8);
+        assert_eq!(out[1].path, TRACE_PATH_P2P);
+        assert_eq!(out[1].arg1, 3);
+        assert!(out[1].timestamp_us >= out[0].timestamp_us);
+
+        // Drained records are not returned again
+        assert_eq!(ring.drain(&mut out), 0);
+    }
+
+    #[test]
+    fn test_partial_drain() {
+        let ring = TraceRing::new(8);
+        for i in 0..5 {
+            ring.record(TraceKind::Send, TRACE_PATH_INTERMEDIATE, i, 0);
+        }
+        let mut out = [TraceRecord::default(); 2];
+        assert_eq!(ring.drain(&mut out), 2);
+        assert_eq!((out[0].arg0, out[1].arg0), (0, 1));
+        assert_eq!(ring.drain(&mut out), 2);
+        assert_eq!((out[0].arg0, out[1].arg0), (2, 3));
+        assert_eq!(ring.drain(&mut out), 1);
+        assert_eq!(out[0].arg0, 4);
+    }
+
+    #[test]
+    fn test_overflow_reports_lost_records() {
+        let ring = TraceRing::new(4);
+        for i in 0..10 {
+            ring.record(TraceKind::Send, TRACE_PATH_INTERMEDIATE, i, 0);
+        }
+        let mut out = [TraceRecord::default(); 8];
+        assert_eq!(ring.drain(&mut out), 5);
+        assert_eq!(out[0].kind, TraceKind::Overflow as u8);
+        assert_eq!(out[0].arg1, 6);
+        let kept: Vec<u32> = out[1..5].iter().map(|r| r.arg0).collect();
+        assert_eq!(kept, vec![6, 7, 8, 9]);
+    }
+
+    #[test]
+    fn test_concurrent_drain_never_tears() {
+        use std::sync::Arc;
+
+        let ring = Arc::new(TraceRing::new(64));
+        let writer = {
+            let ring = ring.clone();
+            std::thread::spawn(move || {
+                for i in 0..200_000u32 {
+                    // arg1 mirrors arg0 so a torn record is detectable
+                    ring.record(TraceKind::Send, TRACE_PATH_P2P, i, i as u64);
+                }
+            })
+        };
+
+        let mut out = [TraceRecord::default(); 32];
+        let mut last = None;
+        while !writer.is_finished() {
+            let n = ring.drain(&mut out);
+            for r in &out[..n] {
+                if r.kind == TraceKind::Overflow as u8 {
+                    continue;
+                }
+                assert_eq!(r.arg0 as u64, r.arg1);
+                if let Some(l) = last {
+                    assert!(r.arg0 > l);
+                }
+                last = Some(r.arg0);
+            }
+        }
+        writer.join().unwrap();
+    }
+}
@@ -0,0 +1,908 @@
+//! On-demand CPU and heap profiling on the metrics listener
+//!
+//! Enabled with `--enable-profiling`, which adds two endpoints next to
+//! `/metrics`:
+//!
+//! - `GET /debug/profile/cpu?seconds=N` samples on-CPU stacks with `SIGPROF`
+//!   at [`SAMPLE_HZ`] for N seconds (default 10, at most 60) and answers with
+//!   folded stacks (`root;caller;leaf count`), the input format of
+//!   `flamegraph.pl`, inferno and speedscope. One profile runs at a time.
+//! - `GET /debug/profile/heap` reports the counting global allocator's totals
+//!   and a power-of-two size-class histogram of allocations.
+//!
+//! The event loop never waits on a profile: a CPU profile's stream is parked
+//! in [`Profiler`] until the deadline passes, then handed with the raw
+//! samples to a responder thread, which symbolizes, folds and writes every
+//! response. A slow reader only holds up the responder.
+//!
+//! # CPU sampling
+//!
+//! The `SIGPROF` handler walks the interrupted thread's frame-pointer chain
+//! into a buffer allocated before the timer is armed. It takes no locks and
+//! never calls the unwinder or the dynamic loader, so a signal landing in
+//! malloc, dlopen or another unwind cannot deadlock it. Each frame is
+//! checked readable (by writing it to a pipe, which fails with `EFAULT`
+//! instead of faulting) before it is dereferenced. The limits are those of
+//! any frame-pointer sampler:
+//!
+//! - Stacks are only complete when every frame keeps a frame pointer. Build
+//!   with `RUSTFLAGS="-C force-frame-pointers=yes"`; code without them
+//!   (libc, the standard library unless rebuilt) ends or skips part of a
+//!   walk.
+//! - A sample taken in a function prologue or epilogue attributes the leaf
+//!   to its caller's caller.
+//! - Only Linux on x86_64 and aarch64 is supported, where the signal context
+//!   layout is known; elsewhere the endpoint answers with an error.
+//!
+//! # Heap accounting
+//!
+//! The counting allocator is only installed in builds with the
+//! `heap-profiling` feature; otherwise the heap endpoint reports that it is
+//! unavailable and allocations go straight to the system allocator. Counters
+//! are sharded per thread on their own cache lines and summed when a report
+//! is taken. Live bytes are folded into the process total in batches, so the
+//! reported peak is accurate to within `SHARDS * LIVE_BATCH` bytes.
+//!
+//! Shared by the Intermediate Server and the App Connector.
+
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::cell::Cell;
+use std::collections::HashMap;
+use std::io::{self, Write};
+use std::sync::atomic::{AtomicI64, AtomicU64, AtomicUsize, Ordering};
+use std::sync::mpsc::{self, Receiver, SyncSender, TrySendError};
+use std::thread;
+use std::time::{Duration, Instant};
+
+/// CPU sampling frequency. Deliberately not a divisor of common timer rates,
+/// so samples do not lock step with periodic work.
+pub const SAMPLE_HZ: u32 = 99;
+
+/// CPU profile duration when the request gives none
+pub const DEFAULT_PROFILE_SECS: u64 = 10;
+
+/// Longest CPU profile a request may ask for
+pub const MAX_PROFILE_SECS: u64 = 60;
+
+/// Whether this build counts allocations for `/debug/profile/heap`
+pub const HEAP_PROFILING: bool = cfg!(feature = "heap-profiling");
+
+/// Stack frames captured per sample
+const MAX_DEPTH: usize = 64;
+
+/// Size classes in the heap histogram: `< 2^1`, `< 2^2`, ... `< 2^20`, then
+/// everything larger
+const SIZE_CLASSES: usize = 21;
+
+/// Counter shards; threads beyond this many share shards round-robin
+const SHARDS: usize = 16;
+
+/// Net live bytes a shard accumulates before folding them into the process
+/// total and checking the peak
+const LIVE_BATCH: i64 = 256 * 1024;
+
+/// Responses waiting for the responder thread; more are refused
+const RESPONSE_QUEUE: usize = 8;
+
+/// How long the responder waits on a client that is not reading
+const WRITE_TIMEOUT: Duration = Duration::from_secs(5);
+
+// ============================================================================
+// Counting allocator
+// ============================================================================
+
+/// `System` allocator that keeps sharded allocation counters
+pub struct CountingAllocator;
+
+#[cfg(feature = "heap-profiling")]
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+/// One thread's counters, on a cache line of its own
+#[repr(align(128))]
+struct Shard {
+    allocs: AtomicU64,
+    frees: AtomicU64,
+    bytes_allocated: AtomicU64,
+    bytes_freed: AtomicU64,
+    /// Live bytes not yet folded into `LIVE_BYTES`; negative when this
+    /// thread frees memory allocated elsewhere
+    live_delta: AtomicI64,
+    size_histogram: [AtomicU64; SIZE_CLASSES],
+}
+
+#[allow(clippy::declare_interior_mutable_const)]
+const ZERO: AtomicU64 = AtomicU64::new(0);
+#[allow(clippy::declare_interior_mutable_const)]
+const EMPTY_SHARD: Shard = Shard {
+    allocs: ZERO,
+    frees: ZERO,
+    bytes_allocated: ZERO,
+    bytes_freed: ZERO,
+    live_delta: AtomicI64::new(0),
+    size_histogram: [ZERO; SIZE_CLASSES],
+};
+
+static COUNTERS: [Shard; SHARDS] = [EMPTY_SHARD; SHARDS];
+static NEXT_SHARD: AtomicUsize = AtomicUsize::new(0);
+static LIVE_BYTES: AtomicI64 = AtomicI64::new(0);
+static PEAK_BYTES: AtomicI64 = AtomicI64::new(0);
+
+thread_local! {
+    // Const-initialized and without a destructor, so the allocator can use
+    // it without allocating or registering anything
+    static SHARD_INDEX: Cell<usize> = const { Cell::new(usize::MAX) };
+}
+
+/// The calling thread's shard. Shard 0 once thread-locals are torn down.
+fn shard() -> &'static Shard {
+    let index = SHARD_INDEX
+        .try_with(|index| {
+            if index.get() == usize::MAX {
+                index.set(NEXT_SHARD.fetch_add(1, Ordering::Relaxed) % SHARDS);
+            }
+            index.get()
+        })
+        .unwrap_or(0);
+    &COUNTERS[index]
+}
+
+fn size_class(size: usize) -> usize {
+    let bits = (usize::BITS - size.leading_zeros()) as usize;
+    bits.saturating_sub(1).min(SIZE_CLASSES - 1)
+}
+
+/// Move a shard's pending live bytes into the process total
+fn fold_live(shard: &Shard) {
+    let delta = shard.live_delta.swap(0, Ordering::Relaxed);
+    let live = LIVE_BYTES.fetch_add(delta, Ordering::Relaxed) + delta;
+    PEAK_BYTES.fetch_max(live, Ordering::Relaxed);
+}
+
+fn count_alloc(size: usize) {
+    let shard = shard();
+    shard.allocs.fetch_add(1, Ordering::Relaxed);
+    shard
+        .bytes_allocated
+        .fetch_add(size as u64, Ordering::Relaxed);
+    shard.size_histogram[size_class(size)].fetch_add(1, Ordering::Relaxed);
+    let delta = shard.live_delta.fetch_add(size as i64, Ordering::Relaxed) + size as i64;
+    if delta >= LIVE_BATCH {
+        fold_live(shard);
+    }
+}
+
+fn count_free(size: usize) {
+    let shard = shard();
+    shard.frees.fetch_add(1, Ordering::Relaxed);
+    shard.bytes_freed.fetch_add(size as u64, Ordering::Relaxed);
+    let delta = shard.live_delta.fetch_sub(size as i64, Ordering::Relaxed) - size as i64;
+    if delta <= -LIVE_BATCH {
+        fold_live(shard);
+    }
+}
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        let ptr = System.alloc(layout);
+        if !ptr.is_null() {
+            count_alloc(layout.size());
+        }
+        ptr
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        let ptr = System.alloc_zeroed(layout);
+        if !ptr.is_null() {
+            count_alloc(layout.size());
+        }
+        ptr
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout);
+        count_free(layout.size());
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        let new_ptr = System.realloc(ptr, layout, new_size);
+        if !new_ptr.is_null() {
+            count_free(layout.size());
+            count_alloc(new_size);
+        }
+        new_ptr
+    }
+}
+
+/// Snapshot of the allocator counters, summed over all shards
+#[derive(Debug, Clone, Copy)]
+pub struct HeapStats {
+    pub allocs: u64,
+    pub frees: u64,
+    pub bytes_allocated: u64,
+    pub bytes_freed: u64,
+    pub live_bytes: usize,
+    pub peak_bytes: usize,
+    pub size_histogram: [u64; SIZE_CLASSES],
+}
+
+impl HeapStats {
+    pub fn snapshot() -> Self {
+        let mut stats = HeapStats {
+            allocs: 0,
+            frees: 0,
+            bytes_allocated: 0,
+            bytes_freed: 0,
+            live_bytes: 0,
+            peak_bytes: 0,
+            size_histogram: [0; SIZE_CLASSES],
+        };
+        let mut live = LIVE_BYTES.load(Ordering::Relaxed);
+        for shard in &COUNTERS {
+            stats.allocs += shard.allocs.load(Ordering::Relaxed);
+            stats.frees += shard.frees.load(Ordering::Relaxed);
+            stats.bytes_allocated += shard.bytes_allocated.load(Ordering::Relaxed);
+            stats.bytes_freed += shard.bytes_freed.load(Ordering::Relaxed);
+            live += shard.live_delta.load(Ordering::Relaxed);
+            for (total, count) in stats.size_histogram.iter_mut().zip(&shard.size_histogram) {
+                *total += count.load(Ordering::Relaxed);
+            }
+        }
+        let live = live.max(0);
+        stats.live_bytes = live as usize;
+        stats.peak_bytes = PEAK_BYTES.load(Ordering::Relaxed).max(live) as usize;
+        stats
+    }
+
+    /// Plain-text report served by `/debug/profile/heap`
+    pub fn render(&self) -> String {
+        let mut out = format!(
+            "allocs {}\nfrees {}\nlive_allocs {}\nbytes_allocated {}\nbytes_freed {}\n\
+             live_bytes {}\npeak_live_bytes {}\n\n# allocations by size (bytes)\n",
+            self.allocs,
+            self.frees,
+            self.allocs.saturating_sub(self.frees),
+            self.bytes_allocated,
+            self.bytes_freed,
+            self.live_bytes,
+            self.peak_bytes
+        );
+        for (class, count) in self.size_histogram.iter().enumerate() {
+            if class == SIZE_CLASSES - 1 {
+                out.push_str(&format!(">={} {}\n", 1u64 << class, count));
+            } else {
+                out.push_str(&format!("<{} {}\n", 1u64 << (class + 1), count));
+            }
+        }
+        out
+    }
+}
+
+// ============================================================================
+// CPU sampler
+// ============================================================================
+
+/// One sampled stack, leaf first, as addresses to symbolize: the
+/// interrupted instruction, then each caller's call instruction
+struct Sample {
+    depth: usize,
+    ips: [usize; MAX_DEPTH],
+}
+
+/// `SIGPROF`-driven frame-pointer sampler
+///
+/// The signal handler may only touch memory that already exists, so
+/// [`sampler::start`] allocates room for every sample the profile can take
+/// and publishes it to the handler; each signal claims the next slot with
+/// an atomic counter. [`sampler::stop`] disarms the timer, unpublishes the
+/// buffer and waits for any handler still running before reading it.
+#[cfg(all(
+    target_os = "linux",
+    any(target_arch = "x86_64", target_arch = "aarch64")
+))]
+mod sampler {
+    use super::{Sample, MAX_DEPTH};
+    use std::io;
+    use std::mem::size_of;
+    use std::ptr;
+    use std::sync::atomic::{AtomicI32, AtomicPtr, AtomicUsize, Ordering};
+    use std::sync::Once;
+
+    static SAMPLES: AtomicPtr<Sample> = AtomicPtr::new(ptr::null_mut());
+    static CAPACITY: AtomicUsize = AtomicUsize::new(0);
+    static NEXT: AtomicUsize = AtomicUsize::new(0);
+    static IN_HANDLER: AtomicUsize = AtomicUsize::new(0);
+
+    /// Pipe the handler probes frame addresses through. Opened once and
+    /// never closed, since a late signal may still use it.
+    static PROBE_READ: AtomicI32 = AtomicI32::new(-1);
+    static PROBE_WRITE: AtomicI32 = AtomicI32::new(-1);
+    static PROBE_INIT: Once = Once::new();
+
+    /// A frame record: the caller's frame pointer, then the return address
+    const FRAME_RECORD: usize = 2 * size_of::<usize>();
+
+    /// Registers a walk starts from
+    struct Registers {
+        pc: usize,
+        fp: usize,
+        sp: usize,
+    }
+
+    // Not exported by the libc crate on every target
+    extern "C" {
+        fn setitimer(
+            which: libc::c_int,
+            new_value: *const libc::itimerval,
+            old_value: *mut libc::itimerval,
+        ) -> libc::c_int;
+    }
+
+    unsafe fn registers(context: *mut libc::c_void) -> Registers {
+        let context = &*(context as *const libc::ucontext_t);
+        #[cfg(target_arch = "x86_64")]
+        let registers = {
+            let gregs = &context.uc_mcontext.gregs;
+            Registers {
+                pc: gregs[libc::REG_RIP as usize] as usize,
+                fp: gregs[libc::REG_RBP as usize] as usize,
+                sp: gregs[libc::REG_RSP as usize] as usize,
+            }
+        };
+        #[cfg(target_arch = "aarch64")]
+        let registers = Registers {
+            pc: context.uc_mcontext.pc as usize,
+            fp: context.uc_mcontext.regs[29] as usize,
+            sp: context.uc_mcontext.sp as usize,
+        };
+        registers
+    }
+
+    /// Whether a frame record at `addr` can be read. `write` copies from the
+    /// address in the kernel and reports `EFAULT` rather than raising
+    /// `SIGSEGV`; the probe bytes are read back so the pipe never fills.
+    unsafe fn readable(addr: usize) -> bool {
+        let written = libc::write(
+            PROBE_WRITE.load(Ordering::Relaxed),
+            addr as *const libc::c_void,
+            FRAME_RECORD,
+        );
+        if written <= 0 {
+            return false;
+        }
+        let mut scratch = [0u8; FRAME_RECORD];
+        libc::read(
+            PROBE_READ.load(Ordering::Relaxed),
+            scratch.as_mut_ptr() as *mut libc::c_void,
+            written as usize,
+        );
+        written as usize == FRAME_RECORD
+    }
+
+    /// Walk the frame-pointer chain from the interrupted registers. Frames
+    /// must sit above the stack pointer and strictly above one another, so
+    /// a corrupt chain ends the walk instead of looping.
+    unsafe fn walk(registers: &Registers, sample: &mut Sample) {
+        sample.ips[0] = registers.pc;
+        let mut depth = 1;
+        let mut floor = registers.sp;
+        let mut fp = registers.fp;
+        while depth < MAX_DEPTH {
+            if fp < floor || fp & (size_of::<usize>() - 1) != 0 || !readable(fp) {
+                break;
+            }
+            let record = fp as *const usize;
+            let caller_fp = *record;
+            let return_address = *record.add(1);
+            if return_address == 0 {
+                break;
+            }
+            // Return address: look up the call before it
+            sample.ips[depth] = return_address.wrapping_sub(1);
+            depth += 1;
+            floor = fp + FRAME_RECORD;
+            fp = caller_fp;
+        }
+        sample.depth = depth;
+    }
+
+    extern "C" fn on_sigprof(
+        _signal: libc::c_int,
+        _info: *mut libc::siginfo_t,
+        context: *mut libc::c_void,
+    ) {
+        IN_HANDLER.fetch_add(1, Ordering::SeqCst);
+        let samples = SAMPLES.load(Ordering::SeqCst);
+        if !samples.is_null() {
+            let slot = NEXT.fetch_add(1, Ordering::Relaxed);
+            if slot < CAPACITY.load(Ordering::Relaxed) {
+                // The probe pipe sets errno, which the interrupted code may
+                // be about to read
+                unsafe {
+                    let errno = *libc::__errno_location();
+                    // Safety: slot < CAPACITY, and the buffer stays alive
+                    // until stop() has seen IN_HANDLER drop to zero
+                    walk(&registers(context), &mut *samples.add(slot));
+                    *libc::__errno_location() = errno;
+                }
+            }
+        }
+        IN_HANDLER.fetch_sub(1, Ordering::SeqCst);
+    }
+
+    fn open_probe_pipe() -> io::Result<()> {
+        let mut result = Ok(());
+        PROBE_INIT.call_once(|| {
+            let mut fds = [0; 2];
+            if unsafe { libc::pipe2(fds.as_mut_ptr(), libc::O_NONBLOCK | libc::O_CLOEXEC) } != 0 {
+                result = Err(io::Error::last_os_error());
+                return;
+            }
+            PROBE_READ.store(fds[0], Ordering::SeqCst);
+            PROBE_WRITE.store(fds[1], Ordering::SeqCst);
+        });
+        result?;
+        if PROBE_WRITE.load(Ordering::SeqCst) < 0 {
+            return Err(io::Error::other("CPU profiler probe pipe unavailable"));
+        }
+        Ok(())
+    }
+
+    fn set_timer(hz: u32) -> io::Result<()> {
+        let period = libc::timeval {
+            tv_sec: 0,
+            tv_usec: if hz == 0 {
+                0
+            } else {
+                (1_000_000 / hz) as libc::suseconds_t
+            },
+        };
+        let timer = libc::itimerval {
+            it_interval: period,
+            it_value: period,
+        };
+        if unsafe { setitimer(libc::ITIMER_PROF, &timer, ptr::null_mut()) } != 0 {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(())
+    }
+
+    /// Start sampling at `hz` with room for `capacity` samples
+    pub fn start(hz: u32, capacity: usize) -> io::Result<()> {
+        open_probe_pipe()?;
+
+        let mut buffer: Vec<Sample> = Vec::with_capacity(capacity);
+        buffer.resize_with(capacity, || Sample {
+            depth: 0,
+            ips: [0; MAX_DEPTH],
+        });
+        let buffer = Box::into_raw(buffer.into_boxed_slice()) as *mut Sample;
+
+        NEXT.store(0, Ordering::SeqCst);
+        CAPACITY.store(capacity, Ordering::SeqCst);
+        SAMPLES.store(buffer, Ordering::SeqCst);
+
+        // The handler stays installed after the profile ends: a late SIGPROF
+        // must not hit the default action, which terminates the process
+        unsafe {
+            let mut action: libc::sigaction = std::mem::zeroed();
+            action.sa_sigaction = on_sigprof as usize;
+            action.sa_flags = libc::SA_SIGINFO | libc::SA_RESTART;
+            libc::sigemptyset(&mut action.sa_mask);
+            if libc::sigaction(libc::SIGPROF, &action, ptr::null_mut()) != 0 {
+                let err = io::Error::last_os_error();
+                drop(take_buffer());
+                return Err(err);
+            }
+        }
+
+        if let Err(e) = set_timer(hz) {
+            drop(take_buffer());
+            return Err(e);
+        }
+        Ok(())
+    }
+
+    /// Stop sampling and return the captured stacks, leaf first
+    pub fn stop() -> Vec<Vec<usize>> {
+        let _ = set_timer(0);
+        let buffer = take_buffer();
+        let taken = NEXT.load(Ordering::SeqCst).min(buffer.len());
+        buffer[..taken]
+            .iter()
+            .filter(|s| s.depth > 0)
+            .map(|s| s.ips[..s.depth].to_vec())
+            .collect()
+    }
+
+    /// Unpublish the buffer and reclaim it once no handler can be using it
+    fn take_buffer() -> Box<[Sample]> {
+        let samples = SAMPLES.swap(ptr::null_mut(), Ordering::SeqCst);
+        while IN_HANDLER.load(Ordering::SeqCst) != 0 {
+            std::hint::spin_loop();
+        }
+        let capacity = CAPACITY.swap(0, Ordering::SeqCst);
+        // Safety: allocated by start() with exactly `capacity` elements
+        unsafe { Box::from_raw(ptr::slice_from_raw_parts_mut(samples, capacity)) }
+    }
+}
+
+#[cfg(not(all(
+    target_os = "linux",
+    any(target_arch = "x86_64", target_arch = "aarch64")
+)))]
+mod sampler {
+    use std::io;
+
+    pub fn start(_hz: u32, _capacity: usize) -> io::Result<()> {
+        Err(io::Error::new(
+            io::ErrorKind::Unsupported,
+            "CPU profiling requires Linux on x86_64 or aarch64",
+        ))
+    }
+
+    pub fn stop() -> Vec<Vec<usize>> {
+        Vec::new()
+    }
+}
+
+/// Symbol names for a code address, innermost inlined frame first
+fn symbolize(ip: usize) -> Vec<String> {
+    let mut names = Vec::new();
+    backtrace::resolve(ip as *mut std::ffi::c_void, |symbol| {
+        if let Some(name) = symbol.name() {
+            names.push(format!("{:#}", name));
+        }
+    });
+    if names.is_empty() {
+        names.push(format!("{:#x}", ip));
+    }
+    names
+}
+
+/// Aggregate stacks into folded format, heaviest stack first
+fn fold(samples: &[Vec<usize>], mut symbolize: impl FnMut(usize) -> Vec<String>) -> String {
+    let mut stacks: HashMap<&[usize], u64> = HashMap::new();
+    for sample in samples {
+        *stacks.entry(sample.as_slice()).or_insert(0) += 1;
+    }
+
+    let mut symbols: HashMap<usize, Vec<String>> = HashMap::new();
+    let mut folded: HashMap<String, u64> = HashMap::new();
+    for (stack, count) in stacks {
+        let mut frames: Vec<String> = Vec::new();
+        for ip in stack {
+            frames.extend(
+                symbols
+                    .entry(*ip)
+                    .or_insert_with(|| symbolize(*ip))
+                    .iter()
+                    .cloned(),
+            );
+        }
+        if frames.is_empty() {
+            continue;
+        }
+        // ';' separates frames, but appears in Rust array types
+        let line = frames
+            .iter()
+            .rev()
+            .map(|f| f.replace(';', ":"))
+            .collect::<Vec<_>>()
+            .join(";");
+        *folded.entry(line).or_insert(0) += count;
+    }
+
+    let mut lines: Vec<(String, u64)> = folded.into_iter().collect();
+    lines.sort_by(|a, b| b.1.cmp(&a.1).then_with(|| a.0.cmp(&b.0)));
+    let mut out = String::new();
+    for (stack, count) in lines {
+        out.push_str(&format!("{} {}\n", stack, count));
+    }
+    out
+}
+
+// ============================================================================
+// HTTP endpoints
+// ============================================================================
+
+/// A CPU profile in progress and the client waiting for it
+struct PendingProfile {
+    stream: mio::net::TcpStream,
+    deadline: Instant,
+}
+
+/// A response for the responder thread to produce and write
+enum Response {
+    Text {
+        stream: mio::net::TcpStream,
+        status: &'static str,
+        body: String,
+    },
+    /// Raw samples, symbolized and folded on the responder thread
+    CpuProfile {
+        stream: mio::net::TcpStream,
+        samples: Vec<Vec<usize>>,
+    },
+}
+
+/// Serves `/debug/profile/*` on the metrics listener
+pub struct Profiler {
+    pending: Option<PendingProfile>,
+    responses: SyncSender<Response>,
+}
+
+impl Profiler {
+    /// Start the responder thread. It exits when the profiler is dropped.
+    pub fn new() -> io::Result<Self> {
+        let (responses, queue) = mpsc::sync_channel(RESPONSE_QUEUE);
+        thread::Builder::new()
+            .name("ztna-profiler".into())
+            .spawn(move || run_responder(queue))?;
+        Ok(Profiler {
+            pending: None,
+            responses,
+        })
+    }
+
+    /// Handle a `GET /debug/profile/...` request. Heap reports and errors are
+    /// queued for the responder at once; a CPU profile keeps `stream` until
+    /// [`poll`] finds the profile due.
+    ///
+    /// [`poll`]: Profiler::poll
+    pub fn handle_request(&mut self, request: &str, stream: mio::net::TcpStream) {
+        let target = request.split_whitespace().nth(1).unwrap_or("");
+        let (path, query) = target.split_once('?').unwrap_or((target, ""));
+
+        match path {
+            "/debug/profile/heap" if HEAP_PROFILING => {
+                self.respond(stream, "200 OK", HeapStats::snapshot().render());
+            }
+            "/debug/profile/heap" => {
+                self.respond(
+                    stream,
+                    "501 Not Implemented",
+                    "built without the heap-profiling feature\n".into(),
+                );
+            }
+            "/debug/profile/cpu" => {
+                let seconds = match parse_seconds(query) {
+                    Some(s) => s,
+                    None => {
+                        self.respond(stream, "400 Bad Request", "seconds must be 1-60\n".into());
+                        return;
+                    }
+                };
+                if self.pending.is_some() {
+                    self.respond(
+                        stream,
+                        "409 Conflict",
+                        "a CPU profile is already running\n".into(),
+                    );
+                    return;
+                }
+                let capacity = (SAMPLE_HZ as u64 * (seconds + 1)) as usize;
+                match sampler::start(SAMPLE_HZ, capacity) {
+                    Ok(()) => {
+                        log::info!("CPU profile started for {}s", seconds);
+                        self.pending = Some(PendingProfile {
+                            stream,
+                            deadline: Instant::now() + Duration::from_secs(seconds),
+                        });
+                    }
+                    Err(e) => {
+                        log::warn!("Failed to start CPU profile: {}", e);
+                        self.respond(stream, "500 Internal Server Error", format!("{}\n", e));
+                    }
+                }
+            }
+            _ => self.respond(stream, "404 Not Found", String::new()),
+        }
+    }
+
+    /// Time until the running CPU profile is due, for the poll timeout
+    pub fn timeout(&self) -> Option<Duration> {
+        self.pending
+            .as_ref()
+            .map(|p| p.deadline.saturating_duration_since(Instant::now()))
+    }
+
+    /// Finish the running CPU profile if its deadline has passed, leaving
+    /// symbolization and the response to the responder thread
+    pub fn poll(&mut self) {
+        let due = self
+            .pending
+            .as_ref()
+            .map(|p| Instant::now() >= p.deadline)
+            .unwrap_or(false);
+        if !due {
+            return;
+        }
+
+        let pending = self.pending.take().unwrap();
+        let samples = sampler::stop();
+        log::info!("CPU profile finished with {} samples", samples.len());
+        self.queue(Response::CpuProfile {
+            stream: pending.stream,
+            samples,
+        });
+    }
+
+    fn respond(&self, stream: mio::net::TcpStream, status: &'static str, body: String) {
+        self.queue(Response::Text {
+            stream,
+            status,
+            body,
+        });
+    }
+
+    /// Hand a response to the responder. When it is backed up the client's
+    /// connection is closed unanswered rather than blocking the caller.
+    fn queue(&self, response: Response) {
+        match self.responses.try_send(response) {
+            Ok(()) => {}
+            Err(TrySendError::Full(_)) => {
+                log::warn!("Profile responder busy, dropping request");
+            }
+            Err(TrySendError::Disconnected(_)) => {
+                log::warn!("Profile responder has exited, dropping request");
+            }
+        }
+    }
+}
+
+/// Responder thread: produce and write each queued response in turn
+fn run_responder(queue: Receiver<Response>) {
+    for response in queue {
+        match response {
+            Response::Text {
+                stream,
+                status,
+                body,
+            } => write_response(stream, status, &body),
+            Response::CpuProfile { stream, samples } => {
+                write_response(stream, "200 OK", &fold(&samples, symbolize));
+            }
+        }
+    }
+}
+
+/// `seconds=N` from a query string; the default when absent
+fn parse_seconds(query: &str) -> Option<u64> {
+    match query.split('&').find_map(|kv| kv.strip_prefix("seconds=")) {
+        Some(value) => value
+            .parse()
+            .ok()
+            .filter(|s| (1..=MAX_PROFILE_SECS).contains(s)),
+        None => Some(DEFAULT_PROFILE_SECS),
+    }
+}
+
+/// Write a plain-text response and close the connection.
+///
+/// Profiles can exceed the socket send buffer, so the stream is switched to
+/// blocking mode with a write timeout rather than written non-blocking. Only
+/// the responder thread calls this.
+fn write_response(stream: mio::net::TcpStream, status: &str, body: &str) {
+    let response = format!(
+        "HTTP/1.1 {}\r\nContent-Type: text/plain\r\nContent-Length: {}\r\n\r\n{}",
+        status,
+        body.len(),
+        body
+    );
+    #[cfg(unix)]
+    let result = {
+        use std::os::unix::io::{FromRawFd, IntoRawFd};
+        // Safety: the fd is taken from the mio stream, which gives up ownership
+        let mut stream = unsafe { std::net::TcpStream::from_raw_fd(stream.into_raw_fd()) };
+        stream
+            .set_nonblocking(false)
+            .and_then(|_| stream.set_write_timeout(Some(WRITE_TIMEOUT)))
+            .and_then(|_| stream.write_all(response.as_bytes()))
+    };
+    #[cfg(not(unix))]
+    let result = (&stream).write_all(response.as_bytes());
+    if let Err(e) = result {
+        log::debug!("Profile response write error: {:?}", e);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_size_classes() {
+        assert_eq!(size_class(0), 0);
+        assert_eq!(size_class(1), 0);
+        assert_eq!(size_class(2), 1);
+        assert_eq!(size_class(1500), 10);
+        assert_eq!(size_class(usize::MAX), SIZE_CLASSES - 1);
+    }
+
+    #[test]
+    fn test_sharded_counts_fold_into_totals() {
+        let before = HeapStats::snapshot();
+        // Larger than a batch, so the live bytes reach the process total
+        count_alloc(LIVE_BATCH as usize);
+        count_alloc(4096);
+        let during = HeapStats::snapshot();
+        count_free(4096);
+        count_free(LIVE_BATCH as usize);
+        let after = HeapStats::snapshot();
+
+        // Other tests may count concurrently, so only lower bounds hold
+        assert!(during.allocs >= before.allocs + 2);
+        assert!(during.bytes_allocated >= before.bytes_allocated + LIVE_BATCH as u64 + 4096);
+        assert!(during.size_histogram[12] > before.size_histogram[12]);
+        assert!(during.peak_bytes >= LIVE_BATCH as usize);
+        assert!(during.peak_bytes >= during.live_bytes);
+        assert!(after.frees >= before.frees + 2);
+        assert!(after.bytes_freed >= before.bytes_freed + LIVE_BATCH as u64 + 4096);
+        assert!(during.render().contains("<8192 "));
+    }
+
+    #[test]
+    fn test_shards_are_per_thread() {
+        let here = shard() as *const Shard as usize;
+        assert_eq!(here, shard() as *const Shard as usize);
+        let there = thread::spawn(|| shard() as *const Shard as usize)
+            .join()
+            .unwrap();
+        // Consecutive threads take consecutive shards
+        assert_ne!(here, there);
+    }
+
+    #[test]
+    fn test_fold_aggregates() {
+        let names = |ip: usize| -> Vec<String> {
+            match ip {
+                3 => vec!["inlined_leaf".into(), "relay_datagram".into()],
+                4 => vec!["main".into()],
+                5 => vec!["poll".into()],
+                _ => vec![format!("{:#x}", ip)],
+            }
+        };
+        let samples = vec![vec![3, 4], vec![3, 4], vec![5, 4], vec![9, 4]];
+
+        let folded = fold(&samples, names);
+        let lines: Vec<&str> = folded.lines().collect();
+        assert_eq!(
+            lines,
+            vec![
+                "main;relay_datagram;inlined_leaf 2",
+                "main;0x9 1",
+                "main;poll 1"
+            ]
+        );
+    }
+
+    #[test]
+    fn test_parse_seconds() {
+        assert_eq!(parse_seconds(""), Some(DEFAULT_PROFILE_SECS));
+        assert_eq!(parse_seconds("seconds=30"), Some(30));
+        assert_eq!(parse_seconds("x=1&seconds=5"), Some(5));
+        assert_eq!(parse_seconds("seconds=0"), None);
+        assert_eq!(parse_seconds("seconds=61"), None);
+        assert_eq!(parse_seconds("seconds=abc"), None);
+    }
+
+    #[cfg(all(
+        target_os = "linux",
+        any(target_arch = "x86_64", target_arch = "aarch64")
+    ))]
+    #[test]
+    fn test_sampler_captures_busy_loop() {
+        sampler::start(SAMPLE_HZ, SAMPLE_HZ as usize * 2).unwrap();
+        let start = Instant::now();
+        let mut x = 0u64;
+        while start.elapsed() < Duration::from_millis(300) {
+            x = std::hint::black_box(x.wrapping_mul(31).wrapping_add(7));
+        }
+        let samples = sampler::stop();
+        assert!(!samples.is_empty());
+        assert!(samples
+            .iter()
+            .all(|s| !s.is_empty() && s.len() <= MAX_DEPTH));
+    }
+}
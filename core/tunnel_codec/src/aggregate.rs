@@ -0,0 +1,321 @@
+//! Packing several tunneled IP packets into one QUIC DATAGRAM
+//!
+//! Small packets (TCP ACKs, VoIP frames) each cost a DATAGRAM frame and
+//! usually a whole QUIC packet. A peer that advertises
+//! [`REG_FLAG_AGGREGATE`] at registration accepts aggregate datagrams
+//! instead:
+//!
+//! ```text
+//! [0x30, len_hi, len_lo, packet..., len_hi, len_lo, packet..., ...]
+//! ```
+//!
+//! Each inner packet is whatever would otherwise have been a DATAGRAM of its
+//! own (a raw IP packet or a 0x2F service-routed packet). An aggregate never
+//! exceeds the connection's `dgram_max_writable_len()`, so it still fits one
+//! QUIC packet on the current path MTU. A batch holding a single packet is
+//! sent bare, so aggregation never adds overhead.
+//!
+//! Negotiation: the registering side appends a flags byte after the service
+//! ID; the server echoes the flags it accepts after the service ID in the
+//! ACK. Peers without support ignore the trailing byte, so either side can
+//! be upgraded first.
+//!
+//! The Intermediate and the Connector flush once per event-loop iteration,
+//! before sending, so batching adds no delay there. The Agent has no loop of
+//! its own and flushes from its next poll or once [`FLUSH_DELAY`] passes.
+
+use std::time::{Duration, Instant};
+
+/// DATAGRAM type of an aggregate (not a valid IPv4/IPv6 first byte, and
+/// distinct from the control types 0x01, 0x10-0x13 and 0x2F)
+pub const DGRAM_TYPE_AGGREGATE: u8 = 0x30;
+
+/// Registration / ACK flag: this side understands aggregate datagrams
+pub const REG_FLAG_AGGREGATE: u8 = 0x01;
+
+/// Longest a packet waits for company before its batch is sent anyway
+pub const FLUSH_DELAY: Duration = Duration::from_millis(1);
+
+/// Type byte plus one length prefix
+const HEADER_LEN: usize = 1;
+const PREFIX_LEN: usize = 2;
+
+/// Pending batch of packets bound for one connection
+#[derive(Debug, Default)]
+pub struct Aggregator {
+    /// Aggregate under construction (type byte, then prefixed packets)
+    buf: Vec<u8>,
+    /// Packets in `buf`
+    count: usize,
+    /// When the first packet of the batch was queued
+    oldest: Option<Instant>,
+}
+
+impl Aggregator {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.count == 0
+    }
+
+    /// When the pending batch must be sent
+    pub fn deadline(&self) -> Option<Instant> {
+        self.oldest.map(|t| t + FLUSH_DELAY)
+    }
+
+    /// Add `packet` to the batch for a connection whose DATAGRAMs may be up
+    /// to `max_len` bytes.
+    ///
+    /// Returns the DATAGRAMs to send now, in order: the previous batch if
+    /// `packet` does not fit alongside it, and `packet` itself if it is too
+    /// large to ever share a DATAGRAM.
+    pub fn push(&mut self, packet: &[u8], max_len: usize) -> Vec<Vec<u8>> {
+        let mut out = Vec::new();
+        if HEADER_LEN + PREFIX_LEN + packet.len() > max_len || packet.len() > u16::MAX as usize {
+            out.extend(self.take());
+            out.push(packet.to_vec());
+            return out;
+        }
+
+        if self.buf.len() + PREFIX_LEN + packet.len() > max_len {
+            out.extend(self.take());
+        }
+        if self.buf.is_empty() {
+            self.buf.reserve(max_len);
+            self.buf.push(DGRAM_TYPE_AGGREGATE);
+            self.oldest = Some(Instant::now());
+        }
+        self.buf
+            .extend_from_slice(&(packet.len() as u16).to_be_bytes());
+        self.buf.extend_from_slice(packet);
+        self.count += 1;
+        out
+    }
+
+    /// Take the pending batch as one DATAGRAM (bare if it holds one packet)
+    pub fn take(&mut self) -> Option<Vec<u8>> {
+        let count = std::mem::take(&mut self.count);
+        self.oldest = None;
+        match count {
+            0 => None,
+            1 => {
+                let packet = self.buf[HEADER_LEN + PREFIX_LEN..].to_vec();
+                self.buf.clear();
+                Some(packet)
+            }
+            _ => Some(std::mem::take(&mut self.buf)),
+        }
+    }
+}
+
+/// DATAGRAMs `conn` refused while sending a batch. Every DATAGRAM is still
+/// attempted; this records the first refusal and how many there were.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct SendError {
+    /// The first refusal (`Done` when the DATAGRAM send queue is full)
+    pub error: quiche::Error,
+    /// DATAGRAMs refused, each carrying one or more packets
+    pub failed: usize,
+    /// Packets that still went out inside aggregates
+    pub packed: usize,
+}
+
+impl From<SendError> for quiche::Error {
+    fn from(e: SendError) -> Self {
+        e.error
+    }
+}
+
+/// Results of the DATAGRAMs handed to `conn` by one call
+#[derive(Default)]
+struct Progress {
+    packed: usize,
+    failed: usize,
+    first_error: Option<quiche::Error>,
+}
+
+impl Progress {
+    /// Send one DATAGRAM carrying `packets` packets
+    fn send(&mut self, conn: &mut quiche::Connection, dgram: &[u8], packets: usize) {
+        match conn.dgram_send(dgram) {
+            Ok(()) if packets > 1 => self.packed += packets,
+            Ok(()) => {}
+            Err(e) => {
+                self.failed += 1;
+                self.first_error.get_or_insert(e);
+            }
+        }
+    }
+
+    fn finish(self) -> Result<usize, SendError> {
+        match self.first_error {
+            None => Ok(self.packed),
+            Some(error) => Err(SendError {
+                error,
+                failed: self.failed,
+                packed: self.packed,
+            }),
+        }
+    }
+}
+
+/// Queue a tunneled packet on `conn`, batching it when `aggregate` is set
+/// (the peer accepted aggregates at registration).
+///
+/// Returns how many packets went out inside aggregates as a result. A
+/// refused DATAGRAM does not stop the others, which may hold packets
+/// batched by earlier calls.
+pub fn send(
+    conn: &mut quiche::Connection,
+    batch: &mut Aggregator,
+    aggregate: bool,
+    packet: &[u8],
+) -> Result<usize, SendError> {
+    let mut progress = Progress::default();
+    match conn.dgram_max_writable_len() {
+        Some(max_len) if aggregate => {
+            let before = batch.count;
+            // When the batch is flushed it comes first, then possibly `packet`
+            for (i, dgram) in batch.push(packet, max_len).iter().enumerate() {
+                let packets = if i == 0 && before > 0 { before } else { 1 };
+                progress.send(conn, dgram, packets);
+            }
+        }
+        _ => {
+            let count = batch.count;
+            if let Some(dgram) = batch.take() {
+                progress.send(conn, &dgram, count);
+            }
+            progress.send(conn, packet, 1);
+        }
+    }
+    progress.finish()
+}
+
+/// Send the pending batch now. Returns how many packets it carried if it
+/// went out as an aggregate.
+pub fn flush(conn: &mut quiche::Connection, batch: &mut Aggregator) -> Result<usize, SendError> {
+    let mut progress = Progress::default();
+    let count = batch.count;
+    if let Some(dgram) = batch.take() {
+        progress.send(conn, &dgram, count);
+    }
+    progress.finish()
+}
+
+/// Iterate the packets carried by a received DATAGRAM: the inner packets of
+/// an aggregate, or the DATAGRAM itself otherwise. A truncated aggregate
+/// yields the packets before the damage.
+pub fn unpack(dgram: &[u8]) -> Packets<'_> {
+    if dgram.first() == Some(&DGRAM_TYPE_AGGREGATE) {
+        Packets {
+            rest: &dgram[HEADER_LEN..],
+            aggregate: true,
+        }
+    } else {
+        Packets {
+            rest: dgram,
+            aggregate: false,
+        }
+    }
+}
+
+/// Iterator returned by [`unpack`]
+pub struct Packets<'a> {
+    rest: &'a [u8],
+    aggregate: bool,
+}
+
+impl<'a> Iterator for Packets<'a> {
+    type Item = &'a [u8];
+
+    fn next(&mut self) -> Option<&'a [u8]> {
+        if !self.aggregate {
+            if self.rest.is_empty() {
+                return None;
+            }
+            return Some(std::mem::take(&mut self.rest));
+        }
+
+        if self.rest.len() < PREFIX_LEN {
+            return None;
+        }
+        let len = u16::from_be_bytes([self.rest[0], self.rest[1]]) as usize;
+        if self.rest.len() < PREFIX_LEN + len {
+            self.rest = &[];
+            return None;
+        }
+        let packet = &self.rest[PREFIX_LEN..PREFIX_LEN + len];
+        self.rest = &self.rest[PREFIX_LEN + len..];
+        Some(packet)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_round_trip() {
+        let mut batch = Aggregator::new();
+        assert!(batch.push(&[0x45; 40], 1200).is_empty());
+        assert!(batch.push(&[0x2F, 1, b'x', 0x45], 1200).is_empty());
+        assert!(batch.deadline().is_some());
+
+        let dgram = batch.take().unwrap();
+        assert_eq!(dgram[0], DGRAM_TYPE_AGGREGATE);
+        assert_eq!(dgram.len(), 1 + 2 + 40 + 2 + 4);
+        let packets: Vec<&[u8]> = unpack(&dgram).collect();
+        assert_eq!(packets, vec![&[0x45; 40][..], &[0x2F, 1, b'x', 0x45][..]]);
+        assert!(batch.is_empty());
+        assert!(batch.deadline().is_none());
+    }
+
+    #[test]
+    fn test_single_packet_sent_bare() {
+        let mut batch = Aggregator::new();
+        batch.push(&[0x45, 1, 2, 3], 1200);
+        assert_eq!(batch.take().unwrap(), vec![0x45, 1, 2, 3]);
+        assert!(batch.take().is_none());
+
+        let packets: Vec<&[u8]> = unpack(&[0x45, 1, 2, 3]).collect();
+        assert_eq!(packets, vec![&[0x45, 1, 2, 3][..]]);
+    }
+
+    #[test]
+    fn test_batches_never_exceed_max_len() {
+        let max_len = 100;
+        let mut batch = Aggregator::new();
+        let mut sent = Vec::new();
+        for i in 0..10u8 {
+            sent.extend(batch.push(&[i; 40], max_len));
+        }
+        sent.extend(batch.take());
+
+        assert!(sent.iter().all(|d| d.len() <= max_len));
+        let inner: Vec<u8> = sent.iter().flat_map(|d| unpack(d)).map(|p| p[0]).collect();
+        assert_eq!(inner, (0..10).collect::<Vec<u8>>());
+    }
+
+    #[test]
+    fn test_oversize_packet_flushes_batch_first() {
+        let mut batch = Aggregator::new();
+        batch.push(&[1; 10], 100);
+        batch.push(&[2; 10], 100);
+        let sent = batch.push(&[3; 98], 100);
+
+        assert_eq!(sent.len(), 2);
+        assert_eq!(sent[0][0], DGRAM_TYPE_AGGREGATE);
+        assert_eq!(sent[1], vec![3; 98]);
+        assert!(batch.is_empty());
+    }
+
+    #[test]
+    fn test_truncated_aggregate() {
+        let dgram = [DGRAM_TYPE_AGGREGATE, 0, 2, 0x45, 0x00, 0, 9, 0x45];
+        let packets: Vec<&[u8]> = unpack(&dgram).collect();
+        assert_eq!(packets, vec![&[0x45, 0x00][..]]);
+    }
+}
@@ -0,0 +1,600 @@
+//! Forward error correction for tunneled DATAGRAMs
+//!
+//! QUIC never retransmits DATAGRAMs, so a tunneled packet lost on a lossy
+//! hop is gone: real-time UDP (VoIP, video) glitches and inner TCP waits
+//! out a full RTO. With FEC the sender groups tunneled packets into blocks
+//! and closes each block with one repair packet, the XOR of its packets:
+//!
+//! ```text
+//! Source: [0x33, session(4), block(2), index(1), packet...]
+//! Repair: [0x34, session(4), block(2), count(1), len_xor(2), xor...]
+//! ```
+//!
+//! The receiver delivers source packets as they arrive. When exactly one
+//! packet of a block is missing, the repair and the others rebuild it.
+//!
+//! - Redundancy: the block size follows the sender's QUIC loss rate, from
+//!   [`MAX_BLOCK_SIZE`] packets per repair on a clean path down to
+//!   [`MIN_BLOCK_SIZE`] (50% overhead) at 6% loss and above.
+//! - Latency: a block closes when full or [`MAX_BLOCK_DELAY`] after its
+//!   first packet, so a rebuilt packet is at most that late. Sparse flows
+//!   (one voice frame per block) pay for this with a repair per packet.
+//! - Sessions: a Connector hears every Agent over one relay connection, so
+//!   each encoder picks a random 32-bit session ID and decoders track
+//!   blocks per session.
+//!
+//! Negotiation: Connectors configured for FEC set [`REG_FLAG_FEC`] when
+//! they register, and the Intermediate passes it on in the ACK to Agents of
+//! that service. A Connector protects return traffic only after its peer
+//! has sent it FEC packets. The Intermediate relays both types unchanged.
+
+use std::borrow::Cow;
+use std::collections::hash_map::RandomState;
+use std::collections::HashMap;
+use std::hash::BuildHasher;
+use std::time::{Duration, Instant};
+
+/// DATAGRAM type of a source packet (a tunneled packet with FEC header)
+pub const DGRAM_TYPE_FEC_SOURCE: u8 = 0x33;
+
+/// DATAGRAM type of a repair packet closing a block
+pub const DGRAM_TYPE_FEC_REPAIR: u8 = 0x34;
+
+/// Registration / ACK flag: the Connector decodes FEC
+pub const REG_FLAG_FEC: u8 = 0x04;
+
+/// Longest a block stays open before its repair is sent
+pub const MAX_BLOCK_DELAY: Duration = Duration::from_millis(20);
+
+/// Source packets per repair on a clean path
+pub const MAX_BLOCK_SIZE: u8 = 16;
+
+/// Source packets per repair at high loss
+pub const MIN_BLOCK_SIZE: u8 = 2;
+
+/// Sessions kept by each decoder (least recently used evicted first)
+pub const MAX_SESSIONS: usize = 256;
+
+/// Recent blocks per session that can still be completed
+const BLOCK_WINDOW: usize = 8;
+
+/// Type, session, block and index of a source packet
+const SOURCE_HEADER_LEN: usize = 8;
+
+/// Type, session, block, count and length XOR of a repair packet
+const REPAIR_HEADER_LEN: usize = 10;
+
+/// Packets sent between two loss rate samples
+const LOSS_SAMPLE_PACKETS: u64 = 200;
+
+/// Block size for a loss rate (fraction of packets lost)
+fn block_size_for(loss: f64) -> u8 {
+    if loss >= 0.06 {
+        MIN_BLOCK_SIZE
+    } else if loss >= 0.03 {
+        4
+    } else if loss >= 0.01 {
+        8
+    } else {
+        MAX_BLOCK_SIZE
+    }
+}
+
+/// Smoothed loss rate from a connection's cumulative packet counters
+#[derive(Debug, Default)]
+struct LossMeter {
+    sent: u64,
+    lost: u64,
+    rate: f64,
+}
+
+impl LossMeter {
+    /// The updated rate once `LOSS_SAMPLE_PACKETS` more packets were sent
+    fn update(&mut self, sent: u64, lost: u64) -> Option<f64> {
+        if sent < self.sent || lost < self.lost {
+            // Counters of a new connection
+            self.sent = sent;
+            self.lost = lost;
+            return None;
+        }
+        let sent_delta = sent - self.sent;
+        if sent_delta < LOSS_SAMPLE_PACKETS {
+            return None;
+        }
+        let sample = (lost - self.lost) as f64 / sent_delta as f64;
+        self.sent = sent;
+        self.lost = lost;
+        self.rate = 0.75 * self.rate + 0.25 * sample.min(1.0);
+        Some(self.rate)
+    }
+}
+
+/// Sending side: one per destination (Connector or Agent session)
+pub struct Encoder {
+    session: u32,
+    block: u16,
+    block_size: u8,
+    /// Source packets in the open block
+    count: u8,
+    /// XOR of the open block's packets, zero-padded to the longest
+    parity: Vec<u8>,
+    len_xor: u16,
+    /// When the open block's first packet was protected
+    opened: Option<Instant>,
+    loss: LossMeter,
+}
+
+impl Encoder {
+    pub fn new() -> Self {
+        Encoder {
+            session: RandomState::new().hash_one(Instant::now()) as u32,
+            block: 0,
+            block_size: MAX_BLOCK_SIZE,
+            count: 0,
+            parity: Vec::new(),
+            len_xor: 0,
+            opened: None,
+            loss: LossMeter::default(),
+        }
+    }
+
+    /// Add `packet` to the open block and return it as a source packet.
+    ///
+    /// Returns the packet unchanged when it (or the repair it would need)
+    /// doesn't fit `max_len`; it is then sent unprotected.
+    pub fn protect<'a>(&mut self, packet: &'a [u8], max_len: usize, now: Instant) -> Cow<'a, [u8]> {
+        if packet.is_empty() || packet.len() + REPAIR_HEADER_LEN > max_len {
+            return Cow::Borrowed(packet);
+        }
+
+        let mut out = Vec::with_capacity(SOURCE_HEADER_LEN + packet.len());
+        out.push(DGRAM_TYPE_FEC_SOURCE);
+        out.extend_from_slice(&self.session.to_be_bytes());
+        out.extend_from_slice(&self.block.to_be_bytes());
+        out.push(self.count);
+        out.extend_from_slice(packet);
+
+        if self.parity.len() < packet.len() {
+            self.parity.resize(packet.len(), 0);
+        }
+        for (p, b) in self.parity.iter_mut().zip(packet) {
+            *p ^= b;
+        }
+        self.len_xor ^= packet.len() as u16;
+        self.count += 1;
+        self.opened.get_or_insert(now);
+        Cow::Owned(out)
+    }
+
+    /// The repair packet closing the open block, once the block is full or
+    /// has been open for [`MAX_BLOCK_DELAY`]
+    pub fn poll_repair(&mut self, now: Instant) -> Option<Vec<u8>> {
+        let deadline = self.deadline()?;
+        if self.count < self.block_size && now < deadline {
+            return None;
+        }
+
+        let mut out = Vec::with_capacity(REPAIR_HEADER_LEN + self.parity.len());
+        out.push(DGRAM_TYPE_FEC_REPAIR);
+        out.extend_from_slice(&self.session.to_be_bytes());
+        out.extend_from_slice(&self.block.to_be_bytes());
+        out.push(self.count);
+        out.extend_from_slice(&self.len_xor.to_be_bytes());
+        out.extend_from_slice(&self.parity);
+
+        self.block = self.block.wrapping_add(1);
+        self.count = 0;
+        self.parity.clear();
+        self.len_xor = 0;
+        self.opened = None;
+        Some(out)
+    }
+
+    /// When the open block's repair is due (None while no block is open)
+    pub fn deadline(&self) -> Option<Instant> {
+        self.opened.map(|opened| opened + MAX_BLOCK_DELAY)
+    }
+
+    /// Feed the connection's cumulative packet counters (quiche
+    /// `stats().sent` and `stats().lost`) to adapt the block size
+    pub fn observe_loss(&mut self, sent: u64, lost: u64) {
+        if let Some(rate) = self.loss.update(sent, lost) {
+            self.block_size = block_size_for(rate);
+        }
+    }
+}
+
+impl Default for Encoder {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// What the decoder learned from one DATAGRAM
+#[derive(Debug, Default)]
+pub struct Decoded<'a> {
+    /// The received packet, unless it was a repair or a duplicate
+    pub source: Option<&'a [u8]>,
+    /// A lost packet of the same block, rebuilt by this DATAGRAM
+    pub recovered: Option<Vec<u8>>,
+}
+
+impl<'a> Decoded<'a> {
+    /// Packets to deliver, the received one first
+    pub fn into_packets(self) -> impl Iterator<Item = Cow<'a, [u8]>> {
+        self.source
+            .map(Cow::Borrowed)
+            .into_iter()
+            .chain(self.recovered.map(Cow::Owned))
+    }
+}
+
+#[derive(Default)]
+struct Block {
+    block: u16,
+    /// Bit per source index received or rebuilt
+    received: u32,
+    /// XOR of everything received for the block, sources and repair
+    acc: Vec<u8>,
+    len_acc: u16,
+    /// Source packet count, once the repair has arrived
+    count: Option<u8>,
+    /// Every source packet is accounted for
+    done: bool,
+}
+
+impl Block {
+    fn absorb(&mut self, data: &[u8], len: u16) {
+        if self.acc.len() < data.len() {
+            self.acc.resize(data.len(), 0);
+        }
+        for (a, b) in self.acc.iter_mut().zip(data) {
+            *a ^= b;
+        }
+        self.len_acc ^= len;
+    }
+
+    /// Rebuild the single missing source packet, if that is the case now
+    fn try_recover(&mut self) -> Option<Vec<u8>> {
+        let count = self.count?;
+        if self.done {
+            return None;
+        }
+        let mask = (1u32 << count) - 1;
+        let missing = count - (self.received & mask).count_ones() as u8;
+        if missing > 1 {
+            return None;
+        }
+        self.done = true;
+        let acc = std::mem::take(&mut self.acc);
+        if missing == 0 {
+            return None;
+        }
+        let index = (!self.received & mask).trailing_zeros();
+        self.received |= 1 << index;
+        let len = self.len_acc as usize;
+        if len == 0 || len > acc.len() {
+            // Inconsistent block (sender restarted mid-block)
+            return None;
+        }
+        Some(acc[..len].to_vec())
+    }
+}
+
+struct Session {
+    blocks: Vec<Block>,
+    last_used: u64,
+}
+
+/// Receiving side: one per connection FEC packets arrive on
+#[derive(Default)]
+pub struct Decoder {
+    sessions: HashMap<u32, Session>,
+    tick: u64,
+    /// Whether the peer has sent an FEC packet
+    peer_encodes: bool,
+    recovered: u64,
+}
+
+impl Decoder {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Whether the peer protects its packets, and so decodes in turn
+    pub fn peer_encodes(&self) -> bool {
+        self.peer_encodes
+    }
+
+    /// Packets rebuilt from repairs so far
+    pub fn recovered(&self) -> u64 {
+        self.recovered
+    }
+
+    /// Strip the FEC header from a received DATAGRAM and rebuild a lost
+    /// packet when this DATAGRAM completes its block. Packets without FEC
+    /// pass through unchanged.
+    pub fn decode<'a>(&mut self, dgram: &'a [u8]) -> Decoded<'a> {
+        match dgram.first() {
+            Some(&DGRAM_TYPE_FEC_SOURCE) => {
+                if dgram.len() <= SOURCE_HEADER_LEN {
+                    return Decoded::default();
+                }
+                self.peer_encodes = true;
+                let session = u32::from_be_bytes([dgram[1], dgram[2], dgram[3], dgram[4]]);
+                let block = u16::from_be_bytes([dgram[5], dgram[6]]);
+                let index = dgram[7];
+                let packet = &dgram[SOURCE_HEADER_LEN..];
+                if index >= MAX_BLOCK_SIZE {
+                    return Decoded {
+                        source: Some(packet),
+                        recovered: None,
+                    };
+                }
+
+                let recovered = match self.block(session, block) {
+                    Some(b) => {
+                        if b.received & (1 << index) != 0 {
+                            // Already rebuilt (or a duplicate)
+                            return Decoded::default();
+                        }
+                        b.received |= 1 << index;
+                        if !b.done {
+                            b.absorb(packet, packet.len() as u16);
+                        }
+                        b.try_recover()
+                    }
+                    // Too old for the window: deliver without FEC
+                    None => None,
+                };
+                self.count(&recovered);
+                Decoded {
+                    source: Some(packet),
+                    recovered,
+                }
+            }
+            Some(&DGRAM_TYPE_FEC_REPAIR) => {
+                if dgram.len() < REPAIR_HEADER_LEN {
+                    return Decoded::default();
+                }
+                self.peer_encodes = true;
+                let session = u32::from_be_bytes([dgram[1], dgram[2], dgram[3], dgram[4]]);
+                let block = u16::from_be_bytes([dgram[5], dgram[6]]);
+                let count = dgram[7];
+                let len_xor = u16::from_be_bytes([dgram[8], dgram[9]]);
+                if count == 0 || count > MAX_BLOCK_SIZE {
+                    return Decoded::default();
+                }
+
+                let recovered = match self.block(session, block) {
+                    Some(b) if b.count.is_none() => {
+                        b.count = Some(count);
+                        if !b.done {
+                            b.absorb(&dgram[REPAIR_HEADER_LEN..], len_xor);
+                        }
+                        b.try_recover()
+                    }
+                    _ => None,
+                };
+                self.count(&recovered);
+                Decoded {
+                    source: None,
+                    recovered,
+                }
+            }
+            _ => Decoded {
+                source: Some(dgram),
+                recovered: None,
+            },
+        }
+    }
+
+    fn count(&mut self, recovered: &Option<Vec<u8>>) {
+        if recovered.is_some() {
+            self.recovered += 1;
+        }
+    }
+
+    /// State of `block` in `session`, or None if the block has already left
+    /// the window
+    fn block(&mut self, session: u32, block: u16) -> Option<&mut Block> {
+        self.tick += 1;
+        if !self.sessions.contains_key(&session) && self.sessions.len() >= MAX_SESSIONS {
+            let oldest = self
+                .sessions
+                .iter()
+                .min_by_key(|(_, s)| s.last_used)
+                .map(|(id, _)| *id);
+            if let Some(id) = oldest {
+                self.sessions.remove(&id);
+            }
+        }
+        let s = self.sessions.entry(session).or_insert_with(|| Session {
+            blocks: (0..BLOCK_WINDOW).map(|_| Block::default()).collect(),
+            last_used: 0,
+        });
+        s.last_used = self.tick;
+
+        let slot = &mut s.blocks[block as usize % BLOCK_WINDOW];
+        let unused = slot.received == 0 && slot.count.is_none();
+        if slot.block != block || unused {
+            if !unused && (block.wrapping_sub(slot.block) as i16) < 0 {
+                return None;
+            }
+            *slot = Block {
+                block,
+                ..Block::default()
+            };
+        }
+        Some(slot)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn packet(tag: u8, len: usize) -> Vec<u8> {
+        (0..len).map(|i| tag.wrapping_add(i as u8)).collect()
+    }
+
+    /// Source DATAGRAMs and the repair for one full block
+    fn encode_block(encoder: &mut Encoder, packets: &[Vec<u8>], now: Instant) -> Vec<Vec<u8>> {
+        let mut out: Vec<Vec<u8>> = packets
+            .iter()
+            .map(|p| encoder.protect(p, 1200, now).into_owned())
+            .collect();
+        out.push(encoder.poll_repair(now).expect("block is full"));
+        out
+    }
+
+    fn delivered(decoder: &mut Decoder, dgram: &[u8]) -> Vec<Vec<u8>> {
+        decoder
+            .decode(dgram)
+            .into_packets()
+            .map(|p| p.into_owned())
+            .collect()
+    }
+
+    #[test]
+    fn test_rebuilds_one_lost_packet_per_block() {
+        let now = Instant::now();
+        let mut encoder = Encoder::new();
+        encoder.block_size = 4;
+        let packets: Vec<_> = (0..4)
+            .map(|i| packet(i * 40, 60 + i as usize * 7))
+            .collect();
+        let dgrams = encode_block(&mut encoder, &packets, now);
+        assert_eq!(dgrams.len(), 5);
+        assert_eq!(dgrams[0][0], DGRAM_TYPE_FEC_SOURCE);
+        assert_eq!(dgrams[4][0], DGRAM_TYPE_FEC_REPAIR);
+
+        // Lose the longest packet; the repair (last) rebuilds it
+        let mut decoder = Decoder::new();
+        let mut out = Vec::new();
+        for (i, dgram) in dgrams.iter().enumerate() {
+            if i != 3 {
+                out.extend(delivered(&mut decoder, dgram));
+            }
+        }
+        assert_eq!(
+            out,
+            vec![
+                packets[0].clone(),
+                packets[1].clone(),
+                packets[2].clone(),
+                packets[3].clone()
+            ]
+        );
+        assert_eq!(decoder.recovered(), 1);
+        assert!(decoder.peer_encodes());
+
+        // The lost packet turning up late is not delivered twice
+        assert!(delivered(&mut decoder, &dgrams[3]).is_empty());
+    }
+
+    #[test]
+    fn test_repair_before_last_source() {
+        let now = Instant::now();
+        let mut encoder = Encoder::new();
+        encoder.block_size = 3;
+        let packets: Vec<_> = (0..3).map(|i| packet(i, 100)).collect();
+        let dgrams = encode_block(&mut encoder, &packets, now);
+
+        // Packet 0 lost, repair overtakes packet 2
+        let mut decoder = Decoder::new();
+        assert_eq!(
+            delivered(&mut decoder, &dgrams[1]),
+            vec![packets[1].clone()]
+        );
+        assert!(delivered(&mut decoder, &dgrams[3]).is_empty());
+        assert_eq!(
+            delivered(&mut decoder, &dgrams[2]),
+            vec![packets[2].clone(), packets[0].clone()]
+        );
+    }
+
+    #[test]
+    fn test_partial_block_closes_after_delay() {
+        let now = Instant::now();
+        let mut encoder = Encoder::new();
+        let voice = packet(7, 160);
+        let source = encoder.protect(&voice, 1200, now).into_owned();
+        assert!(encoder.poll_repair(now).is_none());
+        assert_eq!(encoder.deadline(), Some(now + MAX_BLOCK_DELAY));
+        let repair = encoder.poll_repair(now + MAX_BLOCK_DELAY).unwrap();
+        assert!(encoder.deadline().is_none());
+
+        // A one-packet block's repair is the packet itself
+        let mut decoder = Decoder::new();
+        assert_eq!(delivered(&mut decoder, &repair), vec![voice.clone()]);
+        assert!(delivered(&mut decoder, &source).is_empty());
+    }
+
+    #[test]
+    fn test_sessions_are_isolated() {
+        let now = Instant::now();
+        let mut a = Encoder::new();
+        let mut b = Encoder::new();
+        b.session = a.session.wrapping_add(1);
+        a.block_size = 2;
+        b.block_size = 2;
+        let pa: Vec<_> = (0..2).map(|i| packet(i, 50)).collect();
+        let pb: Vec<_> = (0..2).map(|i| packet(100 + i, 80)).collect();
+        let da = encode_block(&mut a, &pa, now);
+        let db = encode_block(&mut b, &pb, now);
+
+        // Same block numbers, interleaved, one loss in each
+        let mut decoder = Decoder::new();
+        let mut out = Vec::new();
+        for dgram in [&da[0], &db[1], &da[2], &db[2]] {
+            out.extend(delivered(&mut decoder, dgram));
+        }
+        assert_eq!(
+            out,
+            vec![pa[0].clone(), pb[1].clone(), pa[1].clone(), pb[0].clone()]
+        );
+    }
+
+    #[test]
+    fn test_block_size_follows_loss() {
+        let mut encoder = Encoder::new();
+        assert_eq!(encoder.block_size, MAX_BLOCK_SIZE);
+
+        // 10% loss, sustained
+        let (mut sent, mut lost) = (0, 0);
+        for _ in 0..10 {
+            sent += 1000;
+            lost += 100;
+            encoder.observe_loss(sent, lost);
+        }
+        assert_eq!(encoder.block_size, MIN_BLOCK_SIZE);
+
+        // Loss stops
+        for _ in 0..20 {
+            sent += 1000;
+            encoder.observe_loss(sent, lost);
+        }
+        assert_eq!(encoder.block_size, MAX_BLOCK_SIZE);
+
+        // A new connection's counters start over without a bogus sample
+        encoder.observe_loss(10, 10);
+        assert_eq!(encoder.block_size, MAX_BLOCK_SIZE);
+    }
+
+    #[test]
+    fn test_passthrough() {
+        let mut encoder = Encoder::new();
+        let big = packet(0, 1195);
+        assert!(matches!(
+            encoder.protect(&big, 1200, Instant::now()),
+            Cow::Borrowed(_)
+        ));
+        assert!(encoder.deadline().is_none());
+
+        let mut decoder = Decoder::new();
+        let ip = packet(0x45, 40);
+        assert_eq!(delivered(&mut decoder, &ip), vec![ip.clone()]);
+        assert!(!decoder.peer_encodes());
+    }
+}
@@ -0,0 +1,724 @@
+//! Per-flow IPv4 TCP/UDP header compression for tunneled packets
+//!
+//! Most of a tunneled packet's 40-byte IPv4+TCP (or 28-byte IPv4+UDP)
+//! header stays the same for the life of a flow. The sender keeps a context
+//! per flow and, once the peer has seen the full header, sends only the
+//! fields that change:
+//!
+//! ```text
+//! Full (sets up the context): [0x31, cid(2), ip_packet...]
+//! Compressed:                 [0x32, cid(2), check(2), ip_id(2)?, tcp_fields?, payload...]
+//! ```
+//!
+//! Contexts are set up in-band. The first [`FULL_PACKETS`] packets of a
+//! flow, and one packet in every [`REFRESH_INTERVAL`] after that, go out in
+//! full with the context ID. Compressed packets carry dynamic fields as
+//! absolute values (no deltas), so loss and reordering never corrupt a
+//! context. A lost full packet only costs the compressed packets sent
+//! before the next refresh.
+//!
+//! - In the context: addresses, protocol, ports, TOS, TTL and DF. A change
+//!   to any of them starts a new context.
+//! - Omitted: IP total length and UDP length (implied by the DATAGRAM
+//!   length), the IP ID of DF packets (RFC 6864), and all checksums. QUIC
+//!   already authenticates the DATAGRAM, so the decompressor just writes
+//!   valid checksums.
+//! - Carried: the IP ID of non-DF packets, TCP seq/ack/offset/flags/window,
+//!   the urgent pointer when URG is set, and TCP options verbatim.
+//!
+//! A Connector's relay connection carries every Agent's traffic, and all
+//! Agents use the same tunnel address, so one decompressor hears from many
+//! compressors. Contexts are therefore keyed by the context ID plus a
+//! 16-bit check over the static fields, and each compressor derives context
+//! IDs from a randomly keyed hash of the flow.
+//!
+//! Negotiation: Connectors set [`REG_FLAG_HEADER_COMPRESSION`] when they
+//! register, and the Intermediate passes it on in the ACK to Agents of that
+//! service. A Connector compresses the return traffic of a flow only while
+//! it holds a context the Agent set up for that flow: Agents that don't
+//! compress (or don't decompress) share its relay connection. Packets the
+//! scheme does not cover (IPv6, IP options, fragments, ICMP) are sent as
+//! they are.
+
+use std::borrow::Cow;
+use std::collections::hash_map::RandomState;
+use std::collections::{HashMap, HashSet};
+use std::hash::BuildHasher;
+
+/// DATAGRAM type of a full packet that (re)sets up a context. 0x3X is not
+/// a valid IP version, and is distinct from the aggregate type 0x30.
+pub const DGRAM_TYPE_HC_FULL: u8 = 0x31;
+
+/// DATAGRAM type of a packet with a compressed header
+pub const DGRAM_TYPE_HC_COMPRESSED: u8 = 0x32;
+
+/// Registration / ACK flag: the Connector decompresses headers
+pub const REG_FLAG_HEADER_COMPRESSION: u8 = 0x02;
+
+/// Packets sent in full when a flow starts
+pub const FULL_PACKETS: u32 = 3;
+
+/// Most compressed packets sent between two full ones
+pub const REFRESH_INTERVAL: u32 = 64;
+
+/// Contexts kept by each compressor and decompressor (least recently used
+/// evicted first)
+pub const MAX_CONTEXTS: usize = 1024;
+
+const PROTO_TCP: u8 = 6;
+const PROTO_UDP: u8 = 17;
+const IP_HEADER_LEN: usize = 20;
+const TCP_HEADER_LEN: usize = 20;
+const UDP_HEADER_LEN: usize = 8;
+const IP_FLAG_DF: u16 = 0x4000;
+const TCP_FLAG_URG: u8 = 0x20;
+
+/// Type byte, context ID and check of a compressed packet
+const COMPRESSED_HEADER_LEN: usize = 5;
+
+/// Type byte and context ID of a full packet
+const FULL_HEADER_LEN: usize = 3;
+
+/// Addresses, ports and protocol of one direction of a flow
+type FlowEnds = ([u8; 4], u16, [u8; 4], u16, u8);
+
+/// Header fields that are constant for the life of a flow
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+struct FlowStatic {
+    src: [u8; 4],
+    dst: [u8; 4],
+    protocol: u8,
+    src_port: u16,
+    dst_port: u16,
+    tos: u8,
+    ttl: u8,
+    df: bool,
+}
+
+impl FlowStatic {
+    fn ends(&self) -> FlowEnds {
+        (
+            self.src,
+            self.src_port,
+            self.dst,
+            self.dst_port,
+            self.protocol,
+        )
+    }
+
+    /// Ends of the other direction of the flow
+    fn reply_ends(&self) -> FlowEnds {
+        (
+            self.dst,
+            self.dst_port,
+            self.src,
+            self.src_port,
+            self.protocol,
+        )
+    }
+
+    /// Static fields of `packet`, or None if the scheme can't compress it
+    fn parse(packet: &[u8]) -> Option<FlowStatic> {
+        // IPv4 without options, length exactly the packet, not a fragment
+        if packet.len() < IP_HEADER_LEN || packet[0] != 0x45 {
+            return None;
+        }
+        if u16::from_be_bytes([packet[2], packet[3]]) as usize != packet.len() {
+            return None;
+        }
+        let frag = u16::from_be_bytes([packet[6], packet[7]]);
+        if frag & !IP_FLAG_DF != 0 {
+            return None;
+        }
+
+        let l4 = &packet[IP_HEADER_LEN..];
+        match packet[9] {
+            PROTO_TCP => {
+                if l4.len() < TCP_HEADER_LEN {
+                    return None;
+                }
+                let header_len = (l4[12] >> 4) as usize * 4;
+                if header_len < TCP_HEADER_LEN || header_len > l4.len() {
+                    return None;
+                }
+            }
+            PROTO_UDP => {
+                if l4.len() < UDP_HEADER_LEN
+                    || u16::from_be_bytes([l4[4], l4[5]]) as usize != l4.len()
+                {
+                    return None;
+                }
+            }
+            _ => return None,
+        }
+
+        Some(FlowStatic {
+            src: [packet[12], packet[13], packet[14], packet[15]],
+            dst: [packet[16], packet[17], packet[18], packet[19]],
+            protocol: packet[9],
+            src_port: u16::from_be_bytes([l4[0], l4[1]]),
+            dst_port: u16::from_be_bytes([l4[2], l4[3]]),
+            tos: packet[1],
+            ttl: packet[8],
+            df: frag & IP_FLAG_DF != 0,
+        })
+    }
+
+    /// Check carried in compressed packets (CRC-16/CCITT-FALSE)
+    fn check(&self) -> u16 {
+        let mut bytes = Vec::with_capacity(16);
+        bytes.extend_from_slice(&self.src);
+        bytes.extend_from_slice(&self.dst);
+        bytes.push(self.protocol);
+        bytes.extend_from_slice(&self.src_port.to_be_bytes());
+        bytes.extend_from_slice(&self.dst_port.to_be_bytes());
+        bytes.push(self.tos);
+        bytes.push(self.ttl);
+        bytes.push(self.df as u8);
+
+        let mut crc: u16 = 0xFFFF;
+        for byte in bytes {
+            crc ^= (byte as u16) << 8;
+            for _ in 0..8 {
+                crc = if crc & 0x8000 != 0 {
+                    (crc << 1) ^ 0x1021
+                } else {
+                    crc << 1
+                };
+            }
+        }
+        crc
+    }
+}
+
+/// Compressor state of one flow
+struct Flow {
+    cid: u16,
+    check: u16,
+    /// Packets sent on this context
+    sent: u32,
+    /// Compressed packets sent since the last full one
+    since_full: u32,
+    last_used: u64,
+}
+
+/// Sending side: one per connection the peer decompresses on
+pub struct Compressor {
+    flows: HashMap<FlowStatic, Flow>,
+    cids: HashSet<u16>,
+    hasher: RandomState,
+    tick: u64,
+}
+
+impl Compressor {
+    pub fn new() -> Self {
+        Compressor {
+            flows: HashMap::new(),
+            cids: HashSet::new(),
+            hasher: RandomState::new(),
+            tick: 0,
+        }
+    }
+
+    /// Compress `packet` into a DATAGRAM of at most `max_len` bytes.
+    ///
+    /// Returns the packet unchanged (borrowed) when the scheme doesn't cover
+    /// it, or when a full packet would not fit in `max_len`.
+    pub fn compress<'a>(&mut self, packet: &'a [u8], max_len: usize) -> Cow<'a, [u8]> {
+        let key = match FlowStatic::parse(packet) {
+            Some(key) => key,
+            None => return Cow::Borrowed(packet),
+        };
+
+        if !self.flows.contains_key(&key) {
+            if self.flows.len() >= MAX_CONTEXTS {
+                self.evict();
+            }
+            let mut cid = self.hasher.hash_one(key) as u16;
+            while self.cids.contains(&cid) {
+                cid = cid.wrapping_add(1);
+            }
+            self.cids.insert(cid);
+            self.flows.insert(
+                key,
+                Flow {
+                    cid,
+                    check: key.check(),
+                    sent: 0,
+                    since_full: 0,
+                    last_used: 0,
+                },
+            );
+        }
+
+        self.tick += 1;
+        let flow = self.flows.get_mut(&key).unwrap();
+        flow.last_used = self.tick;
+
+        let full = flow.sent < FULL_PACKETS || flow.since_full >= REFRESH_INTERVAL;
+        if full && FULL_HEADER_LEN + packet.len() > max_len {
+            return Cow::Borrowed(packet);
+        }
+        flow.sent = flow.sent.saturating_add(1);
+        flow.since_full = if full { 0 } else { flow.since_full + 1 };
+
+        if full {
+            let mut out = Vec::with_capacity(FULL_HEADER_LEN + packet.len());
+            out.push(DGRAM_TYPE_HC_FULL);
+            out.extend_from_slice(&flow.cid.to_be_bytes());
+            out.extend_from_slice(packet);
+            return Cow::Owned(out);
+        }
+
+        let mut out = Vec::with_capacity(packet.len());
+        out.push(DGRAM_TYPE_HC_COMPRESSED);
+        out.extend_from_slice(&flow.cid.to_be_bytes());
+        out.extend_from_slice(&flow.check.to_be_bytes());
+        if !key.df {
+            out.extend_from_slice(&packet[4..6]);
+        }
+        let l4 = &packet[IP_HEADER_LEN..];
+        if key.protocol == PROTO_TCP {
+            // seq, ack, offset/flags, window
+            out.extend_from_slice(&l4[4..16]);
+            if l4[13] & TCP_FLAG_URG != 0 {
+                out.extend_from_slice(&l4[18..20]);
+            }
+            // options and payload
+            out.extend_from_slice(&l4[TCP_HEADER_LEN..]);
+        } else {
+            out.extend_from_slice(&l4[UDP_HEADER_LEN..]);
+        }
+        Cow::Owned(out)
+    }
+
+    fn evict(&mut self) {
+        let oldest = self
+            .flows
+            .iter()
+            .min_by_key(|(_, flow)| flow.last_used)
+            .map(|(key, _)| *key);
+        if let Some(flow) = oldest.and_then(|key| self.flows.remove(&key)) {
+            self.cids.remove(&flow.cid);
+        }
+    }
+}
+
+impl Default for Compressor {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+struct Context {
+    flow: FlowStatic,
+    last_used: u64,
+}
+
+/// Receiving side: one per connection compressed packets arrive on
+#[derive(Default)]
+pub struct Decompressor {
+    /// Keyed by (context ID, check)
+    contexts: HashMap<(u16, u16), Context>,
+    tick: u64,
+    /// Flows the peer compresses, with the number of contexts held for each
+    peer_flows: HashMap<FlowEnds, usize>,
+}
+
+impl Decompressor {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Whether the peer compresses the flow `packet` replies to, and so
+    /// decompresses it in turn. Peers sharing the connection may not.
+    pub fn peer_compresses(&self, packet: &[u8]) -> bool {
+        FlowStatic::parse(packet)
+            .is_some_and(|flow| self.peer_flows.contains_key(&flow.reply_ends()))
+    }
+
+    /// Restore the IP packet carried by a received DATAGRAM. Packets that
+    /// weren't compressed pass through unchanged.
+    ///
+    /// Returns None for a compressed packet whose context is unknown (its
+    /// full packets were lost) or that is malformed; drop it.
+    pub fn decompress<'a>(&mut self, dgram: &'a [u8]) -> Option<Cow<'a, [u8]>> {
+        match dgram.first() {
+            Some(&DGRAM_TYPE_HC_FULL) => {
+                if dgram.len() < FULL_HEADER_LEN {
+                    return None;
+                }
+                let cid = u16::from_be_bytes([dgram[1], dgram[2]]);
+                let packet = &dgram[FULL_HEADER_LEN..];
+                let flow = FlowStatic::parse(packet)?;
+                self.install(cid, flow);
+                Some(Cow::Borrowed(packet))
+            }
+            Some(&DGRAM_TYPE_HC_COMPRESSED) => {
+                let packet = self.expand(dgram)?;
+                Some(Cow::Owned(packet))
+            }
+            _ => Some(Cow::Borrowed(dgram)),
+        }
+    }
+
+    fn install(&mut self, cid: u16, flow: FlowStatic) {
+        let key = (cid, flow.check());
+        if !self.contexts.contains_key(&key) && self.contexts.len() >= MAX_CONTEXTS {
+            let oldest = self
+                .contexts
+                .iter()
+                .min_by_key(|(_, context)| context.last_used)
+                .map(|(key, _)| *key);
+            if let Some(context) = oldest.and_then(|key| self.contexts.remove(&key)) {
+                self.release(&context.flow);
+            }
+        }
+        self.tick += 1;
+        let replaced = self.contexts.insert(
+            key,
+            Context {
+                flow,
+                last_used: self.tick,
+            },
+        );
+        if let Some(context) = replaced {
+            self.release(&context.flow);
+        }
+        *self.peer_flows.entry(flow.ends()).or_default() += 1;
+    }
+
+    /// Forget a context of `flow`
+    fn release(&mut self, flow: &FlowStatic) {
+        let ends = flow.ends();
+        if let Some(count) = self.peer_flows.get_mut(&ends) {
+            *count -= 1;
+            if *count == 0 {
+                self.peer_flows.remove(&ends);
+            }
+        }
+    }
+
+    /// Rebuild the IP packet of a compressed DATAGRAM
+    fn expand(&mut self, dgram: &[u8]) -> Option<Vec<u8>> {
+        if dgram.len() < COMPRESSED_HEADER_LEN {
+            return None;
+        }
+        let key = (
+            u16::from_be_bytes([dgram[1], dgram[2]]),
+            u16::from_be_bytes([dgram[3], dgram[4]]),
+        );
+        self.tick += 1;
+        let context = self.contexts.get_mut(&key)?;
+        context.last_used = self.tick;
+        let flow = context.flow;
+
+        let mut rest = &dgram[COMPRESSED_HEADER_LEN..];
+        let ip_id: &[u8] = if flow.df {
+            &[0, 0]
+        } else {
+            take(&mut rest, 2)?
+        };
+
+        let mut packet = Vec::with_capacity(dgram.len() + IP_HEADER_LEN + TCP_HEADER_LEN);
+        packet.extend_from_slice(&[0x45, flow.tos, 0, 0]);
+        packet.extend_from_slice(ip_id);
+        packet.extend_from_slice(&[if flow.df { 0x40 } else { 0 }, 0]);
+        packet.extend_from_slice(&[flow.ttl, flow.protocol, 0, 0]);
+        packet.extend_from_slice(&flow.src);
+        packet.extend_from_slice(&flow.dst);
+        packet.extend_from_slice(&flow.src_port.to_be_bytes());
+        packet.extend_from_slice(&flow.dst_port.to_be_bytes());
+
+        let checksum_at = if flow.protocol == PROTO_TCP {
+            let fields = take(&mut rest, 12)?;
+            let urgent: &[u8] = if fields[9] & TCP_FLAG_URG != 0 {
+                take(&mut rest, 2)?
+            } else {
+                &[0, 0]
+            };
+            let header_len = (fields[8] >> 4) as usize * 4;
+            if header_len < TCP_HEADER_LEN || rest.len() < header_len - TCP_HEADER_LEN {
+                return None;
+            }
+            packet.extend_from_slice(fields);
+            packet.extend_from_slice(&[0, 0]);
+            packet.extend_from_slice(urgent);
+            IP_HEADER_LEN + 16
+        } else {
+            let udp_len = u16::try_from(UDP_HEADER_LEN + rest.len()).ok()?;
+            packet.extend_from_slice(&udp_len.to_be_bytes());
+            packet.extend_from_slice(&[0, 0]);
+            IP_HEADER_LEN + 6
+        };
+        packet.extend_from_slice(rest);
+
+        let total_len = u16::try_from(packet.len()).ok()?;
+        packet[2..4].copy_from_slice(&total_len.to_be_bytes());
+        let ip_sum = fold(sum16(0, &packet[..IP_HEADER_LEN]));
+        packet[10..12].copy_from_slice(&ip_sum.to_be_bytes());
+
+        let segment = &packet[IP_HEADER_LEN..];
+        let mut pseudo = sum16(0, &flow.src);
+        pseudo = sum16(pseudo, &flow.dst);
+        pseudo += flow.protocol as u32 + segment.len() as u32;
+        let mut l4_sum = fold(sum16(pseudo, segment));
+        if flow.protocol == PROTO_UDP && l4_sum == 0 {
+            // Zero means "no checksum" for UDP over IPv4
+            l4_sum = 0xFFFF;
+        }
+        packet[checksum_at..checksum_at + 2].copy_from_slice(&l4_sum.to_be_bytes());
+
+        Some(packet)
+    }
+}
+
+fn take<'a>(rest: &mut &'a [u8], n: usize) -> Option<&'a [u8]> {
+    if rest.len() < n {
+        return None;
+    }
+    let (head, tail) = rest.split_at(n);
+    *rest = tail;
+    Some(head)
+}
+
+/// Add `data` to a ones' complement sum of 16-bit words
+fn sum16(mut sum: u32, data: &[u8]) -> u32 {
+    for word in data.chunks(2) {
+        sum += u16::from_be_bytes([word[0], word.get(1).copied().unwrap_or(0)]) as u32;
+    }
+    sum
+}
+
+fn fold(mut sum: u32) -> u16 {
+    while sum >> 16 != 0 {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    !sum as u16
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// IPv4/TCP packet with valid checksums
+    fn tcp_packet(src_port: u16, seq: u32, flags: u8, options: &[u8], payload: &[u8]) -> Vec<u8> {
+        let tcp_len = TCP_HEADER_LEN + options.len() + payload.len();
+        let total_len = IP_HEADER_LEN + tcp_len;
+        let mut p = vec![0u8; total_len];
+        p[0] = 0x45;
+        p[2..4].copy_from_slice(&(total_len as u16).to_be_bytes());
+        p[6] = 0x40;
+        p[8] = 64;
+        p[9] = PROTO_TCP;
+        p[12..16].copy_from_slice(&[100, 64, 0, 1]);
+        p[16..20].copy_from_slice(&[10, 100, 0, 1]);
+        let t = IP_HEADER_LEN;
+        p[t..t + 2].copy_from_slice(&src_port.to_be_bytes());
+        p[t + 2..t + 4].copy_from_slice(&443u16.to_be_bytes());
+        p[t + 4..t + 8].copy_from_slice(&seq.to_be_bytes());
+        p[t + 8..t + 12].copy_from_slice(&7u32.to_be_bytes());
+        p[t + 12] = (((TCP_HEADER_LEN + options.len()) / 4) as u8) << 4;
+        p[t + 13] = flags;
+        p[t + 14..t + 16].copy_from_slice(&65535u16.to_be_bytes());
+        p[t + 20..t + 20 + options.len()].copy_from_slice(options);
+        p[t + 20 + options.len()..].copy_from_slice(payload);
+        fix_checksums(&mut p, t + 16);
+        p
+    }
+
+    /// Non-DF IPv4/UDP packet with a zero (absent) UDP checksum
+    fn udp_packet(ip_id: u16, payload: &[u8]) -> Vec<u8> {
+        let total_len = IP_HEADER_LEN + UDP_HEADER_LEN + payload.len();
+        let mut p = vec![0u8; total_len];
+        p[0] = 0x45;
+        p[2..4].copy_from_slice(&(total_len as u16).to_be_bytes());
+        p[4..6].copy_from_slice(&ip_id.to_be_bytes());
+        p[8] = 64;
+        p[9] = PROTO_UDP;
+        p[12..16].copy_from_slice(&[100, 64, 0, 1]);
+        p[16..20].copy_from_slice(&[10, 100, 0, 2]);
+        p[20..22].copy_from_slice(&5000u16.to_be_bytes());
+        p[22..24].copy_from_slice(&53u16.to_be_bytes());
+        p[24..26].copy_from_slice(&((UDP_HEADER_LEN + payload.len()) as u16).to_be_bytes());
+        p[28..].copy_from_slice(payload);
+        let ip_sum = fold(sum16(0, &p[..IP_HEADER_LEN]));
+        p[10..12].copy_from_slice(&ip_sum.to_be_bytes());
+        p
+    }
+
+    /// `packet` with addresses and ports swapped, as sent back on its flow
+    fn reply(packet: &[u8]) -> Vec<u8> {
+        let mut p = packet.to_vec();
+        p[12..16].copy_from_slice(&packet[16..20]);
+        p[16..20].copy_from_slice(&packet[12..16]);
+        p[20..22].copy_from_slice(&packet[22..24]);
+        p[22..24].copy_from_slice(&packet[20..22]);
+        p
+    }
+
+    fn fix_checksums(p: &mut [u8], l4_checksum_at: usize) {
+        p[10..12].copy_from_slice(&[0, 0]);
+        let ip_sum = fold(sum16(0, &p[..IP_HEADER_LEN]));
+        p[10..12].copy_from_slice(&ip_sum.to_be_bytes());
+        p[l4_checksum_at..l4_checksum_at + 2].copy_from_slice(&[0, 0]);
+        let mut pseudo = sum16(0, &p[12..20]);
+        pseudo += p[9] as u32 + (p.len() - IP_HEADER_LEN) as u32;
+        let l4_sum = fold(sum16(pseudo, &p[IP_HEADER_LEN..]));
+        p[l4_checksum_at..l4_checksum_at + 2].copy_from_slice(&l4_sum.to_be_bytes());
+    }
+
+    #[test]
+    fn test_tcp_round_trip() {
+        let mut tx = Compressor::new();
+        let mut rx = Decompressor::new();
+        // Timestamps option (NOP, NOP, TS)
+        let options = [1, 1, 8, 10, 0, 0, 0, 1, 0, 0, 0, 2];
+
+        for i in 0..(FULL_PACKETS + 5) {
+            let packet = tcp_packet(40000, 1000 + i, 0x18, &options, b"hello");
+            let dgram = tx.compress(&packet, 1200).into_owned();
+            if i < FULL_PACKETS {
+                assert_eq!(dgram[0], DGRAM_TYPE_HC_FULL);
+            } else {
+                assert_eq!(dgram[0], DGRAM_TYPE_HC_COMPRESSED);
+                // 40-byte header down to 17 bytes, options and payload as-is
+                assert_eq!(dgram.len(), packet.len() - 40 + 17);
+            }
+            assert_eq!(rx.decompress(&dgram).unwrap().as_ref(), &packet[..]);
+        }
+        let packet = tcp_packet(40000, 0, 0x10, &[], &[]);
+        assert!(rx.peer_compresses(&reply(&packet)));
+    }
+
+    #[test]
+    fn test_udp_round_trip_carries_ip_id() {
+        let mut tx = Compressor::new();
+        let mut rx = Decompressor::new();
+        for i in 0..(FULL_PACKETS + 2) {
+            let packet = udp_packet(0x1234 + i as u16, b"query");
+            let dgram = tx.compress(&packet, 1200).into_owned();
+            let restored = rx.decompress(&dgram).unwrap().into_owned();
+            if i < FULL_PACKETS {
+                assert_eq!(restored, packet);
+                continue;
+            }
+            // type + cid + check + IP ID, then the payload
+            assert_eq!(dgram.len(), 7 + 5);
+            // Identical apart from the UDP checksum, which is now filled in
+            assert_eq!(restored[..26], packet[..26]);
+            assert_eq!(restored[28..], packet[28..]);
+            let mut pseudo = sum16(0, &restored[12..20]);
+            pseudo += PROTO_UDP as u32 + (restored.len() - IP_HEADER_LEN) as u32;
+            assert_eq!(fold(sum16(pseudo, &restored[IP_HEADER_LEN..])), 0);
+        }
+    }
+
+    #[test]
+    fn test_lost_full_packets_recovered_by_refresh() {
+        let mut tx = Compressor::new();
+        let mut rx = Decompressor::new();
+        let mut delivered = 0;
+        for i in 0..(FULL_PACKETS + REFRESH_INTERVAL + 2) {
+            let packet = tcp_packet(40001, i, 0x10, &[], &[]);
+            let dgram = tx.compress(&packet, 1200).into_owned();
+            if i < FULL_PACKETS {
+                continue; // lost
+            }
+            match rx.decompress(&dgram) {
+                Some(restored) => {
+                    assert_eq!(restored.as_ref(), &packet[..]);
+                    delivered += 1;
+                }
+                None => assert_eq!(delivered, 0, "only packets before the refresh are lost"),
+            }
+        }
+        assert_eq!(delivered, 2);
+    }
+
+    #[test]
+    fn test_colliding_context_ids_from_two_senders() {
+        let mut rx = Decompressor::new();
+        let mut a = Compressor::new();
+        let mut b = Compressor::new();
+        let force_cid = |mut dgram: Vec<u8>| {
+            dgram[1..3].copy_from_slice(&[0xAB, 0xCD]);
+            dgram
+        };
+
+        for i in 0..(FULL_PACKETS + 3) {
+            let pa = tcp_packet(40000, i, 0x10, &[], b"a");
+            let pb = tcp_packet(40002, i, 0x10, &[], b"b");
+            let da = force_cid(a.compress(&pa, 1200).into_owned());
+            let db = force_cid(b.compress(&pb, 1200).into_owned());
+            assert_eq!(rx.decompress(&da).unwrap().as_ref(), &pa[..]);
+            assert_eq!(rx.decompress(&db).unwrap().as_ref(), &pb[..]);
+        }
+    }
+
+    #[test]
+    fn test_uncovered_packets_pass_through() {
+        let mut tx = Compressor::new();
+        let mut rx = Decompressor::new();
+
+        let mut icmp = udp_packet(1, b"ping");
+        icmp[9] = 1;
+        let mut fragment = udp_packet(2, b"frag");
+        fragment[6] = 0x20; // MF
+        let ipv6 = [0x60u8; 48];
+        for packet in [&icmp[..], &fragment[..], &ipv6[..]] {
+            assert!(matches!(tx.compress(packet, 1200), Cow::Borrowed(_)));
+            assert_eq!(rx.decompress(packet).unwrap().as_ref(), packet);
+        }
+        assert!(!rx.peer_compresses(&reply(&icmp)));
+        assert!(!rx.peer_compresses(&reply(&fragment)));
+
+        // A full packet that would not fit is sent as-is
+        let big = tcp_packet(40000, 0, 0x10, &[], &[0; 1000]);
+        assert!(matches!(tx.compress(&big, big.len() + 2), Cow::Borrowed(_)));
+
+        // Compressed packet for a context the receiver never saw
+        assert!(rx
+            .decompress(&[DGRAM_TYPE_HC_COMPRESSED, 0, 1, 0, 2, 0])
+            .is_none());
+    }
+
+    #[test]
+    fn test_peer_compresses_per_flow() {
+        let mut tx = Compressor::new();
+        let mut rx = Decompressor::new();
+
+        // Another Agent's flow on the same relay connection, sent as-is
+        let plain = tcp_packet(40001, 0, 0x02, &[], &[]);
+        assert_eq!(rx.decompress(&plain).unwrap().as_ref(), &plain[..]);
+
+        let packet = tcp_packet(40000, 0, 0x02, &[], &[]);
+        rx.decompress(&tx.compress(&packet, 1200)).unwrap();
+        assert!(rx.peer_compresses(&reply(&packet)));
+        assert!(!rx.peer_compresses(&reply(&plain)));
+        // Only replies count, not the peer's own direction
+        assert!(!rx.peer_compresses(&packet));
+
+        // Evicting the flow's context forgets it
+        for port in 0..MAX_CONTEXTS as u16 {
+            let other = tcp_packet(port, 0, 0x02, &[], &[]);
+            rx.decompress(&tx.compress(&other, 1200)).unwrap();
+        }
+        assert!(!rx.peer_compresses(&reply(&packet)));
+        assert_eq!(rx.peer_flows.len(), MAX_CONTEXTS);
+    }
+
+    #[test]
+    fn test_contexts_bounded() {
+        let mut tx = Compressor::new();
+        let mut rx = Decompressor::new();
+        for port in 0..(MAX_CONTEXTS as u16 + 10) {
+            let packet = tcp_packet(port, 0, 0x02, &[], &[]);
+            let dgram = tx.compress(&packet, 1200).into_owned();
+            rx.decompress(&dgram).unwrap();
+        }
+        assert_eq!(tx.flows.len(), MAX_CONTEXTS);
+        assert_eq!(tx.cids.len(), MAX_CONTEXTS);
+        assert_eq!(rx.contexts.len(), MAX_CONTEXTS);
+    }
+}
@@ -0,0 +1,18 @@
+//! ZTNA tunnel codecs
+//!
+//! Transforms applied to tunneled packets end to end between the Agent
+//! (`core/packet_processor`) and the App Connector (`app-connector`). Both
+//! sides link this crate, so encoder and decoder cannot drift apart; the
+//! Intermediate relays the resulting DATAGRAMs unchanged.
+//!
+//! DATAGRAM aggregation is the exception: it applies per hop, so the
+//! Intermediate links this crate for it as well.
+
+/// Packing several tunneled packets into one QUIC DATAGRAM, on every hop
+pub mod aggregate;
+
+/// Per-flow IP/TCP/UDP header compression between Agent and Connector
+pub mod header_compression;
+
+/// XOR forward error correction for tunneled packets between Agent and Connector
+pub mod fec;
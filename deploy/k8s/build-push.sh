@@ -187,6 +187,9 @@ RUN apt-get update && apt-get install -y \
 
 WORKDIR /build
 COPY app-connector ./app-connector
+COPY core/tunnel_codec ./core/tunnel_codec
+COPY core/congestion ./core/congestion
+COPY core/profiling ./core/profiling
 WORKDIR /build/app-connector
 RUN cargo build --release
 
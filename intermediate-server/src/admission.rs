@@ -0,0 +1,476 @@
+//! Handshake admission control
+//!
+//! Every Initial for an unknown connection passes through [`Admission::check`]
+//! before the server spends anything on it:
+//!
+//! 1. A token bucket per source prefix (IPv4 /24, IPv6 /48) caps how fast
+//!    one network can start handshakes.
+//! 2. A global limit on handshakes in progress drops Initials outright once
+//!    reached, as does a per-event-loop-iteration cap on new accepts, so a
+//!    flood cannot hold the loop away from relaying established traffic.
+//! 3. The retry policy decides whether the client must first prove its
+//!    address with a Retry round-trip. `adaptive` skips the extra RTT while
+//!    few handshakes are pending, and switches to retrying every Initial for
+//!    [`RETRY_HOLD`] once they pass the threshold.
+//!
+//! Retry tokens are a compact binary encoding sealed with AES-256-GCM:
+//!
+//! ```text
+//! [nonce(12)] [seal(issued_secs(u32 BE) || odcid) + tag(16)]
+//! ```
+//!
+//! The client address (IP octets and port) is bound as associated data
+//! rather than stored, so a token is at most 52 bytes and a token replayed
+//! from another address fails authentication.
+
+use std::collections::HashMap;
+use std::net::{IpAddr, SocketAddr};
+use std::str::FromStr;
+use std::time::{Duration, Instant};
+
+use ring::aead;
+use ring::rand::{SecureRandom, SystemRandom};
+use serde::Deserialize;
+
+/// How long a retry token stays valid
+const TOKEN_MAX_AGE_SECS: u64 = 60;
+
+const NONCE_LEN: usize = 12;
+
+/// How long `adaptive` keeps retrying every Initial after load was seen
+pub const RETRY_HOLD: Duration = Duration::from_secs(10);
+
+/// Source prefixes tracked; new prefixes beyond this share one bucket
+/// until a sweep frees room
+const MAX_BUCKETS: usize = 65_536;
+
+/// How often housekeeping sweeps out idle buckets (see [`Admission::sweep`])
+pub const BUCKET_SWEEP_INTERVAL: Duration = Duration::from_secs(5);
+
+/// When to answer an Initial with a Retry
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default, Deserialize)]
+#[serde(rename_all = "lowercase")]
+pub enum RetryMode {
+    /// Every connection validates its address first
+    Always,
+    /// Only while handshakes in progress exceed `retry_threshold`
+    #[default]
+    Adaptive,
+    /// Never (development)
+    Off,
+}
+
+impl FromStr for RetryMode {
+    type Err = String;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        match s {
+            "always" => Ok(RetryMode::Always),
+            "adaptive" => Ok(RetryMode::Adaptive),
+            "off" => Ok(RetryMode::Off),
+            _ => Err(format!("unknown retry mode '{}'", s)),
+        }
+    }
+}
+
+/// Limits from the `admission` object of the JSON config
+#[derive(Debug, Clone, Deserialize)]
+#[serde(default)]
+pub struct AdmissionConfig {
+    pub retry: RetryMode,
+    /// Sustained Initials per second from one source prefix
+    pub initials_per_sec: f64,
+    /// Initials one source prefix may send in a burst
+    pub initial_burst: f64,
+    /// Handshakes in progress before new Initials are dropped
+    pub max_handshakes: usize,
+    /// Handshakes in progress before `adaptive` starts retrying
+    pub retry_threshold: usize,
+    /// New connections accepted per event-loop iteration
+    pub accepts_per_iteration: usize,
+}
+
+impl Default for AdmissionConfig {
+    fn default() -> Self {
+        AdmissionConfig {
+            retry: RetryMode::Adaptive,
+            initials_per_sec: 50.0,
+            initial_burst: 100.0,
+            max_handshakes: 1024,
+            retry_threshold: 64,
+            accepts_per_iteration: 64,
+        }
+    }
+}
+
+/// What to do with an Initial for an unknown connection
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Verdict {
+    /// Accept (validating the token first, if the Initial carries one)
+    Accept,
+    /// Answer with a Retry
+    Retry,
+    /// Drop: source prefix over its rate
+    RateLimited,
+    /// Drop: too many handshakes in progress
+    Overloaded,
+}
+
+#[derive(Debug, Clone, Copy)]
+struct Bucket {
+    tokens: f64,
+    last: Instant,
+}
+
+pub struct Admission {
+    config: AdmissionConfig,
+    buckets: HashMap<IpAddr, Bucket>,
+    /// Shared by new prefixes while `buckets` is full of active ones
+    overflow: Bucket,
+    /// Handshakes accepted but not yet established or closed
+    pending: usize,
+    /// Accepts since `begin_iteration`
+    accepted_this_iteration: usize,
+    /// `adaptive` retries every Initial until then
+    retry_until: Option<Instant>,
+}
+
+impl Admission {
+    pub fn new(config: AdmissionConfig) -> Self {
+        let now = Instant::now();
+        Admission {
+            overflow: Bucket {
+                tokens: config.initial_burst,
+                last: now,
+            },
+            config,
+            buckets: HashMap::new(),
+            pending: 0,
+            accepted_this_iteration: 0,
+            retry_until: None,
+        }
+    }
+
+    pub fn pending(&self) -> usize {
+        self.pending
+    }
+
+    /// Whether Initials without a token currently get a Retry
+    pub fn retrying(&self, now: Instant) -> bool {
+        match self.config.retry {
+            RetryMode::Always => true,
+            RetryMode::Off => false,
+            RetryMode::Adaptive => self.retry_until.is_some_and(|until| now < until),
+        }
+    }
+
+    /// Start of an event-loop iteration: reset the per-iteration accept cap
+    pub fn begin_iteration(&mut self) {
+        self.accepted_this_iteration = 0;
+    }
+
+    /// Decide on an Initial from `from` for an unknown connection
+    pub fn check(&mut self, from: IpAddr, has_token: bool, now: Instant) -> Verdict {
+        if !self.take_token(prefix_of(from), now) {
+            return Verdict::RateLimited;
+        }
+        if self.pending >= self.config.max_handshakes
+            || self.accepted_this_iteration >= self.config.accepts_per_iteration
+        {
+            return Verdict::Overloaded;
+        }
+        if self.config.retry == RetryMode::Adaptive && self.pending >= self.config.retry_threshold {
+            self.retry_until = Some(now + RETRY_HOLD);
+        }
+        if !has_token && self.retrying(now) {
+            return Verdict::Retry;
+        }
+        Verdict::Accept
+    }
+
+    /// A connection was accepted and its handshake is in progress
+    pub fn handshake_started(&mut self) {
+        self.pending += 1;
+        self.accepted_this_iteration += 1;
+    }
+
+    /// A handshake completed, failed or timed out
+    pub fn handshake_finished(&mut self) {
+        self.pending = self.pending.saturating_sub(1);
+    }
+
+    /// Drop the buckets of prefixes idle long enough to have refilled, which
+    /// loses nothing: a new bucket starts full. Runs from housekeeping every
+    /// [`BUCKET_SWEEP_INTERVAL`], never per Initial, so a flood of new
+    /// prefixes costs O(1) per packet.
+    pub fn sweep(&mut self, now: Instant) {
+        let refill =
+            Duration::try_from_secs_f64(self.config.initial_burst / self.config.initials_per_sec)
+                .unwrap_or(Duration::MAX);
+        self.buckets
+            .retain(|_, b| now.saturating_duration_since(b.last) < refill);
+    }
+
+    fn take_token(&mut self, prefix: IpAddr, now: Instant) -> bool {
+        let (rate, burst) = (self.config.initials_per_sec, self.config.initial_burst);
+        // Over the cap, new prefixes share `overflow` until the next sweep
+        let bucket = if self.buckets.len() < MAX_BUCKETS || self.buckets.contains_key(&prefix) {
+            self.buckets.entry(prefix).or_insert(Bucket {
+                tokens: burst,
+                last: now,
+            })
+        } else {
+            &mut self.overflow
+        };
+
+        let elapsed = now.saturating_duration_since(bucket.last).as_secs_f64();
+        bucket.tokens = (bucket.tokens + elapsed * rate).min(burst);
+        bucket.last = now;
+        if bucket.tokens >= 1.0 {
+            bucket.tokens -= 1.0;
+            true
+        } else {
+            false
+        }
+    }
+}
+
+/// Source prefix a client is rate-limited under: IPv4 /24, IPv6 /48
+fn prefix_of(ip: IpAddr) -> IpAddr {
+    match ip {
+        IpAddr::V4(v4) => {
+            let [a, b, c, _] = v4.octets();
+            IpAddr::from([a, b, c, 0])
+        }
+        IpAddr::V6(v6) => match v6.to_ipv4_mapped() {
+            Some(v4) => prefix_of(IpAddr::V4(v4)),
+            None => {
+                let mut octets = v6.octets();
+                octets[6..].fill(0);
+                IpAddr::from(octets)
+            }
+        },
+    }
+}
+
+/// Associated data binding a token to the client's address
+fn token_aad(addr: SocketAddr) -> Vec<u8> {
+    let mut aad = match addr.ip() {
+        IpAddr::V4(v4) => v4.octets().to_vec(),
+        IpAddr::V6(v6) => v6.octets().to_vec(),
+    };
+    aad.extend_from_slice(&addr.port().to_be_bytes());
+    aad
+}
+
+/// Seal a retry token for `odcid`, bound to `addr`, issued at `now_secs`
+pub fn seal_token(
+    key: &aead::LessSafeKey,
+    rng: &SystemRandom,
+    odcid: &[u8],
+    addr: SocketAddr,
+    now_secs: u64,
+) -> Option<Vec<u8>> {
+    let mut nonce_bytes = [0u8; NONCE_LEN];
+    rng.fill(&mut nonce_bytes).ok()?;
+
+    let mut token = Vec::with_capacity(NONCE_LEN + 4 + odcid.len() + key.algorithm().tag_len());
+    token.extend_from_slice(&nonce_bytes);
+    token.extend_from_slice(&(now_secs as u32).to_be_bytes());
+    token.extend_from_slice(odcid);
+
+    let tag = key
+        .seal_in_place_separate_tag(
+            aead::Nonce::assume_unique_for_key(nonce_bytes),
+            aead::Aad::from(token_aad(addr)),
+            &mut token[NONCE_LEN..],
+        )
+        .ok()?;
+    token.extend_from_slice(tag.as_ref());
+    Some(token)
+}
+
+/// Open a retry token presented from `addr`; returns the original DCID if
+/// it authenticates and has not expired
+pub fn open_token(
+    key: &aead::LessSafeKey,
+    token: &[u8],
+    addr: SocketAddr,
+    now_secs: u64,
+) -> Option<Vec<u8>> {
+    let nonce_bytes: [u8; NONCE_LEN] = token.get(..NONCE_LEN)?.try_into().ok()?;
+    let mut sealed = token[NONCE_LEN..].to_vec();
+    let plaintext = key
+        .open_in_place(
+            aead::Nonce::assume_unique_for_key(nonce_bytes),
+            aead::Aad::from(token_aad(addr)),
+            &mut sealed,
+        )
+        .ok()?;
+    if plaintext.len() < 4 {
+        return None;
+    }
+
+    // Issue time is the low 32 bits of the Unix time; compare modulo 2^32
+    let issued = u32::from_be_bytes(plaintext[..4].try_into().ok()?);
+    let age = (now_secs as u32).wrapping_sub(issued) as u64;
+    if age > TOKEN_MAX_AGE_SECS {
+        log::debug!("Retry token expired ({} seconds old)", age);
+        return None;
+    }
+    Some(plaintext[4..].to_vec())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn key() -> aead::LessSafeKey {
+        let unbound = aead::UnboundKey::new(&aead::AES_256_GCM, &[7u8; 32]).unwrap();
+        aead::LessSafeKey::new(unbound)
+    }
+
+    #[test]
+    fn test_token_roundtrip_and_binding() {
+        let key = key();
+        let rng = SystemRandom::new();
+        let addr: SocketAddr = "203.0.113.9:50000".parse().unwrap();
+        let odcid = [0xAB; 20];
+
+        let token = seal_token(&key, &rng, &odcid, addr, 1_000).unwrap();
+        assert_eq!(token.len(), 52);
+        assert_eq!(open_token(&key, &token, addr, 1_030).unwrap(), odcid);
+
+        // Other port, other host, expired, tampered
+        let moved: SocketAddr = "203.0.113.9:50001".parse().unwrap();
+        assert!(open_token(&key, &token, moved, 1_030).is_none());
+        let v6: SocketAddr = "[2001:db8::9]:50000".parse().unwrap();
+        assert!(open_token(&key, &token, v6, 1_030).is_none());
+        assert!(open_token(&key, &token, addr, 1_000 + TOKEN_MAX_AGE_SECS + 1).is_none());
+        let mut tampered = token.clone();
+        tampered[13] ^= 1;
+        assert!(open_token(&key, &tampered, addr, 1_030).is_none());
+        assert!(open_token(&key, &token[..10], addr, 1_030).is_none());
+    }
+
+    #[test]
+    fn test_prefix_of() {
+        let p = |s: &str| prefix_of(s.parse().unwrap()).to_string();
+        assert_eq!(p("198.51.100.77"), "198.51.100.0");
+        assert_eq!(p("::ffff:198.51.100.77"), "198.51.100.0");
+        assert_eq!(p("2001:db8:1:2:3::4"), "2001:db8:1::");
+    }
+
+    #[test]
+    fn test_per_prefix_rate_limit() {
+        let mut adm = Admission::new(AdmissionConfig {
+            retry: RetryMode::Off,
+            initials_per_sec: 10.0,
+            initial_burst: 3.0,
+            ..Default::default()
+        });
+        let now = Instant::now();
+        let a: IpAddr = "198.51.100.1".parse().unwrap();
+        let same_net: IpAddr = "198.51.100.200".parse().unwrap();
+        let other: IpAddr = "192.0.2.1".parse().unwrap();
+
+        for _ in 0..3 {
+            assert_eq!(adm.check(a, false, now), Verdict::Accept);
+        }
+        assert_eq!(adm.check(same_net, false, now), Verdict::RateLimited);
+        assert_eq!(adm.check(other, false, now), Verdict::Accept);
+
+        // 100 ms refills one token at 10/s
+        let later = now + Duration::from_millis(100);
+        assert_eq!(adm.check(a, false, later), Verdict::Accept);
+        assert_eq!(adm.check(a, false, later), Verdict::RateLimited);
+    }
+
+    #[test]
+    fn test_full_table_uses_overflow_until_sweep() {
+        let mut adm = Admission::new(AdmissionConfig {
+            retry: RetryMode::Off,
+            initials_per_sec: 10.0,
+            initial_burst: 2.0,
+            max_handshakes: usize::MAX,
+            accepts_per_iteration: usize::MAX,
+            ..Default::default()
+        });
+        let now = Instant::now();
+        let prefix = |n: usize| IpAddr::from([10, (n >> 16) as u8, (n >> 8) as u8, n as u8]);
+        for n in 0..MAX_BUCKETS {
+            adm.buckets.insert(
+                prefix_of(prefix(n << 8)),
+                Bucket {
+                    tokens: 2.0,
+                    last: now,
+                },
+            );
+        }
+
+        // New prefixes share the overflow bucket's burst
+        let late = |n: u8| IpAddr::from([172, 16, n, 1]);
+        assert_eq!(adm.check(late(1), false, now), Verdict::Accept);
+        assert_eq!(adm.check(late(2), false, now), Verdict::Accept);
+        assert_eq!(adm.check(late(3), false, now), Verdict::RateLimited);
+        assert_eq!(adm.buckets.len(), MAX_BUCKETS);
+
+        // Refilled buckets are swept; active ones stay
+        let later = now + Duration::from_millis(250);
+        assert_eq!(adm.check(prefix(0), false, later), Verdict::Accept);
+        adm.sweep(later);
+        assert_eq!(adm.buckets.len(), 1);
+        assert_eq!(adm.check(late(3), false, later), Verdict::Accept);
+        assert_eq!(adm.buckets.len(), 2);
+    }
+
+    #[test]
+    fn test_adaptive_retry_and_overload() {
+        let mut adm = Admission::new(AdmissionConfig {
+            retry_threshold: 2,
+            max_handshakes: 4,
+            accepts_per_iteration: 100,
+            ..Default::default()
+        });
+        let now = Instant::now();
+        let ip = |n: u8| IpAddr::from([10, n, 0, 1]);
+
+        // Quiet: accept without a Retry
+        assert_eq!(adm.check(ip(1), false, now), Verdict::Accept);
+        adm.handshake_started();
+        adm.handshake_started();
+
+        // Threshold reached: tokenless Initials get a Retry, tokens pass
+        assert_eq!(adm.check(ip(2), false, now), Verdict::Retry);
+        assert_eq!(adm.check(ip(3), true, now), Verdict::Accept);
+        adm.handshake_started();
+        adm.handshake_started();
+        assert_eq!(adm.check(ip(4), true, now), Verdict::Overloaded);
+
+        // Retrying holds after the load clears, then relaxes
+        for _ in 0..4 {
+            adm.handshake_finished();
+        }
+        assert_eq!(adm.pending(), 0);
+        assert_eq!(adm.check(ip(5), false, now), Verdict::Retry);
+        let after = now + RETRY_HOLD + Duration::from_millis(1);
+        assert_eq!(adm.check(ip(6), false, after), Verdict::Accept);
+    }
+
+    #[test]
+    fn test_accepts_per_iteration() {
+        let mut adm = Admission::new(AdmissionConfig {
+            retry: RetryMode::Always,
+            accepts_per_iteration: 1,
+            ..Default::default()
+        });
+        let now = Instant::now();
+        let ip: IpAddr = "192.0.2.1".parse().unwrap();
+        assert_eq!(adm.check(ip, false, now), Verdict::Retry);
+        assert_eq!(adm.check(ip, true, now), Verdict::Accept);
+        adm.handshake_started();
+        assert_eq!(adm.check(ip, true, now), Verdict::Overloaded);
+        adm.begin_iteration();
+        assert_eq!(adm.check(ip, true, now), Verdict::Accept);
+    }
+}
@@ -10,8 +10,13 @@
 //!   DNS:agent.*.ztna           → wildcard Agent (all services)
 //!   DNS:connector.*.ztna       → wildcard Connector (all services)
 //!   (no ZTNA SAN entries)      → allow all (backward compatibility)
+//!
+//! SAN entries are turned into [`ServiceGrants`], per-role bitmaps over
+//! interned service handles, so a registration check is one hash lookup and
+//! a bit test. Parsed identities are cached by certificate fingerprint in
+//! `identity_cache.rs`.
 
-use std::collections::HashSet;
+use std::collections::{HashMap, HashSet};
 use std::fmt;
 
 use x509_parser::prelude::*;
@@ -30,6 +35,8 @@ pub struct ClientIdentity {
     /// Services this client is authorized for (from SAN DNS entries).
     /// None means no ZTNA SAN entries were found → allow all (backward compat).
     pub authorized_services: Option<HashSet<String>>,
+    /// End of the certificate's validity period (Unix seconds)
+    pub not_after: i64,
 }
 
 /// Errors during certificate parsing and identity extraction
@@ -83,6 +90,7 @@ pub fn extract_identity(der_cert: &[u8]) -> Result<ClientIdentity, AuthError> {
     Ok(ClientIdentity {
         common_name,
         authorized_services,
+        not_after: cert.validity().not_after.timestamp(),
     })
 }
 
@@ -157,37 +165,135 @@ fn parse_ztna_san(dns: &str) -> Option<String> {
 // Authorization Check
 // ============================================================================
 
-/// Check whether a client identity is authorized for a specific service.
-///
-/// Authorization rules:
-/// 1. If `identity.authorized_services` is None → allow all (backward compat)
-/// 2. Check for exact match: `<role>:<service_id>`
-/// 3. Check for wildcard: `<role>:*`
-/// 4. Otherwise → deny
-pub fn is_authorized_for_service(
-    identity: &ClientIdentity,
-    service_id: &str,
-    client_type: &ClientType,
-) -> bool {
-    let services = match &identity.authorized_services {
-        None => return true, // No ZTNA SANs = allow all (backward compat)
-        Some(s) => s,
-    };
+/// Interned service IDs. A handle is a service's bit position in
+/// [`ServiceGrants`]; only services named by some certificate get one.
+#[derive(Debug, Default)]
+pub struct ServiceHandles {
+    ids: HashMap<String, u32>,
+}
 
-    let role = match client_type {
-        ClientType::Agent => "agent",
-        ClientType::Connector => "connector",
-    };
+impl ServiceHandles {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    fn intern(&mut self, service: &str) -> u32 {
+        let next = self.ids.len() as u32;
+        *self.ids.entry(service.to_string()).or_insert(next)
+    }
 
-    // Check exact match
-    let exact_key = format!("{}:{}", role, service_id);
-    if services.contains(&exact_key) {
-        return true;
+    /// Handle of `service`, or None if no certificate has named it
+    pub fn get(&self, service: &str) -> Option<u32> {
+        self.ids.get(service).copied()
     }
 
-    // Check wildcard
-    let wildcard_key = format!("{}:*", role);
-    services.contains(&wildcard_key)
+    /// Service IDs by handle
+    pub fn names(&self) -> Vec<&str> {
+        let mut names = vec![""; self.ids.len()];
+        for (service, &handle) in &self.ids {
+            names[handle as usize] = service;
+        }
+        names
+    }
+}
+
+/// Grants for a certificate's `<role>:<service>` entries, or None to skip
+/// the registration check: no ZTNA SAN entries, or an empty set (backward
+/// compat)
+pub fn grants_for(
+    entries: Option<&HashSet<String>>,
+    handles: &mut ServiceHandles,
+) -> Option<ServiceGrants> {
+    entries
+        .filter(|entries| !entries.is_empty())
+        .map(|entries| ServiceGrants::new(entries, handles))
+}
+
+fn set_bit(bits: &mut Vec<u64>, handle: u32) {
+    let handle = handle as usize;
+    if bits.len() <= handle / 64 {
+        bits.resize(handle / 64 + 1, 0);
+    }
+    bits[handle / 64] |= 1 << (handle % 64);
+}
+
+/// Services a certificate authorizes, as one bitmap per role
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct ServiceGrants {
+    agent: Vec<u64>,
+    connector: Vec<u64>,
+    agent_all: bool,
+    connector_all: bool,
+}
+
+impl ServiceGrants {
+    /// Build from `<role>:<service>` entries as produced by [`extract_identity`]
+    pub fn new(entries: &HashSet<String>, handles: &mut ServiceHandles) -> Self {
+        let mut grants = ServiceGrants::default();
+        for entry in entries {
+            let (role, service) = match entry.split_once(':') {
+                Some(parts) => parts,
+                None => continue,
+            };
+            let (bits, all) = match role {
+                "agent" => (&mut grants.agent, &mut grants.agent_all),
+                "connector" => (&mut grants.connector, &mut grants.connector_all),
+                _ => continue,
+            };
+            if service == "*" {
+                *all = true;
+                continue;
+            }
+            set_bit(bits, handles.intern(service));
+        }
+        grants
+    }
+
+    /// The same grants over a fresh `handles` table, where `names` maps the
+    /// handles they were built with back to service IDs (SIGHUP reload)
+    pub fn rebuild(&self, names: &[&str], handles: &mut ServiceHandles) -> Self {
+        let mut grants = ServiceGrants {
+            agent_all: self.agent_all,
+            connector_all: self.connector_all,
+            ..ServiceGrants::default()
+        };
+        for (old, new) in [
+            (&self.agent, &mut grants.agent),
+            (&self.connector, &mut grants.connector),
+        ] {
+            for (word_index, &word) in old.iter().enumerate() {
+                for bit in (0..64).filter(|bit| word & (1 << bit) != 0) {
+                    let name = names[word_index * 64 + bit];
+                    set_bit(new, handles.intern(name));
+                }
+            }
+        }
+        grants
+    }
+
+    /// Whether `client_type` may register for the service with `handle`.
+    ///
+    /// Authorization rules:
+    /// 1. A `<role>:*` wildcard allows every service
+    /// 2. Otherwise the service's bit must be set for the role
+    /// 3. A service without a handle (named by no certificate) is denied
+    ///
+    /// Certificates without ZTNA SAN entries have no grants at all and are
+    /// allowed everything (backward compat); that is decided by the caller.
+    pub fn allows(&self, handle: Option<u32>, client_type: &ClientType) -> bool {
+        let (bits, all) = match client_type {
+            ClientType::Agent => (&self.agent, self.agent_all),
+            ClientType::Connector => (&self.connector, self.connector_all),
+        };
+        if all {
+            return true;
+        }
+        handle.is_some_and(|h| {
+            let h = h as usize;
+            bits.get(h / 64)
+                .is_some_and(|word| word & (1 << (h % 64)) != 0)
+        })
+    }
 }
 
 // ============================================================================
@@ -375,27 +481,28 @@ mod tests {
         assert_eq!(parse_ztna_san("myservice.ztna"), None);
     }
 
-    // ---- is_authorized_for_service tests ----
+    // ---- ServiceGrants tests ----
+
+    /// Authorization as the server checks it: None (no ZTNA SANs) allows all
+    fn authorized(entries: Option<&[&str]>, service: &str, client_type: &ClientType) -> bool {
+        let mut handles = ServiceHandles::new();
+        match entries {
+            None => true,
+            Some(entries) => {
+                let set = entries.iter().map(|e| e.to_string()).collect();
+                let grants = ServiceGrants::new(&set, &mut handles);
+                grants.allows(handles.get(service), client_type)
+            }
+        }
+    }
 
     #[test]
     fn test_authorized_exact_match() {
-        let identity = ClientIdentity {
-            common_name: "test".to_string(),
-            authorized_services: Some(["agent:myservice".to_string()].into_iter().collect()),
-        };
-
-        assert!(is_authorized_for_service(
-            &identity,
-            "myservice",
-            &ClientType::Agent
-        ));
-        assert!(!is_authorized_for_service(
-            &identity,
-            "other",
-            &ClientType::Agent
-        ));
-        assert!(!is_authorized_for_service(
-            &identity,
+        let entries: &[&str] = &["agent:myservice"];
+        assert!(authorized(Some(entries), "myservice", &ClientType::Agent));
+        assert!(!authorized(Some(entries), "other", &ClientType::Agent));
+        assert!(!authorized(
+            Some(entries),
             "myservice",
             &ClientType::Connector
         ));
@@ -403,23 +510,11 @@ mod tests {
 
     #[test]
     fn test_authorized_wildcard() {
-        let identity = ClientIdentity {
-            common_name: "test".to_string(),
-            authorized_services: Some(["agent:*".to_string()].into_iter().collect()),
-        };
-
-        assert!(is_authorized_for_service(
-            &identity,
-            "any-service",
-            &ClientType::Agent
-        ));
-        assert!(is_authorized_for_service(
-            &identity,
-            "another",
-            &ClientType::Agent
-        ));
-        assert!(!is_authorized_for_service(
-            &identity,
+        let entries: &[&str] = &["agent:*"];
+        assert!(authorized(Some(entries), "any-service", &ClientType::Agent));
+        assert!(authorized(Some(entries), "another", &ClientType::Agent));
+        assert!(!authorized(
+            Some(entries),
             "any-service",
             &ClientType::Connector
         ));
@@ -427,93 +522,83 @@ mod tests {
 
     #[test]
     fn test_authorized_backward_compat_no_san() {
-        let identity = ClientIdentity {
-            common_name: "legacy".to_string(),
-            authorized_services: None,
-        };
-
         // No ZTNA SAN = allow all
-        assert!(is_authorized_for_service(
-            &identity,
-            "any",
-            &ClientType::Agent
-        ));
-        assert!(is_authorized_for_service(
-            &identity,
-            "any",
-            &ClientType::Connector
-        ));
+        assert!(authorized(None, "any", &ClientType::Agent));
+        assert!(authorized(None, "any", &ClientType::Connector));
     }
 
     #[test]
     fn test_authorized_connector_exact() {
-        let identity = ClientIdentity {
-            common_name: "test-connector".to_string(),
-            authorized_services: Some(["connector:web-app".to_string()].into_iter().collect()),
-        };
-
-        assert!(is_authorized_for_service(
-            &identity,
-            "web-app",
-            &ClientType::Connector
-        ));
-        assert!(!is_authorized_for_service(
-            &identity,
-            "web-app",
-            &ClientType::Agent
-        ));
-        assert!(!is_authorized_for_service(
-            &identity,
-            "other",
-            &ClientType::Connector
-        ));
+        let entries: &[&str] = &["connector:web-app"];
+        assert!(authorized(Some(entries), "web-app", &ClientType::Connector));
+        assert!(!authorized(Some(entries), "web-app", &ClientType::Agent));
+        assert!(!authorized(Some(entries), "other", &ClientType::Connector));
     }
 
     #[test]
     fn test_authorized_multiple_services() {
-        let identity = ClientIdentity {
-            common_name: "multi".to_string(),
-            authorized_services: Some(
-                ["agent:svc-a".to_string(), "agent:svc-b".to_string()]
-                    .into_iter()
-                    .collect(),
-            ),
-        };
-
-        assert!(is_authorized_for_service(
-            &identity,
-            "svc-a",
-            &ClientType::Agent
-        ));
-        assert!(is_authorized_for_service(
-            &identity,
-            "svc-b",
-            &ClientType::Agent
-        ));
-        assert!(!is_authorized_for_service(
-            &identity,
-            "svc-c",
-            &ClientType::Agent
-        ));
+        let entries: &[&str] = &["agent:svc-a", "agent:svc-b"];
+        assert!(authorized(Some(entries), "svc-a", &ClientType::Agent));
+        assert!(authorized(Some(entries), "svc-b", &ClientType::Agent));
+        assert!(!authorized(Some(entries), "svc-c", &ClientType::Agent));
     }
 
     #[test]
     fn test_authorized_empty_services_set_denies_all() {
         // Empty set (different from None) → deny all
-        let identity = ClientIdentity {
-            common_name: "empty".to_string(),
-            authorized_services: Some(HashSet::new()),
-        };
+        assert!(!authorized(Some(&[]), "any", &ClientType::Agent));
+        assert!(!authorized(Some(&[]), "any", &ClientType::Connector));
+    }
 
-        assert!(!is_authorized_for_service(
-            &identity,
-            "any",
-            &ClientType::Agent
-        ));
-        assert!(!is_authorized_for_service(
-            &identity,
-            "any",
-            &ClientType::Connector
-        ));
+    #[test]
+    fn test_empty_services_set_skips_the_check() {
+        // The server only checks certificates that name some service
+        let mut handles = ServiceHandles::new();
+        assert_eq!(grants_for(None, &mut handles), None);
+        assert_eq!(grants_for(Some(&HashSet::new()), &mut handles), None);
+        let entries = ["agent:web".to_string()].into_iter().collect();
+        assert!(grants_for(Some(&entries), &mut handles).is_some());
+    }
+
+    #[test]
+    fn test_rebuild_grants_over_fresh_handles() {
+        let mut handles = ServiceHandles::new();
+        let set = |entries: &[&str]| entries.iter().map(|e| e.to_string()).collect();
+        let stale = ServiceGrants::new(&set(&["agent:retired"]), &mut handles);
+        let names: Vec<String> = (0..70).map(|i| format!("agent:svc-{}", i)).collect();
+        let many: HashSet<String> = names.iter().cloned().collect();
+        let mut live = ServiceGrants::new(&many, &mut handles);
+        live.connector_all = true;
+        assert_eq!(handles.names().len(), 71);
+        drop(stale);
+
+        // Only services of grants still in use are interned again
+        let mut fresh = ServiceHandles::new();
+        let rebuilt = live.rebuild(&handles.names(), &mut fresh);
+        assert_eq!(fresh.get("retired"), None);
+        assert_eq!(fresh.names().len(), 70);
+        for i in 0..70 {
+            let service = format!("svc-{}", i);
+            assert!(rebuilt.allows(fresh.get(&service), &ClientType::Agent));
+        }
+        assert!(rebuilt.allows(None, &ClientType::Connector));
+        assert!(!rebuilt.allows(None, &ClientType::Agent));
+    }
+
+    #[test]
+    fn test_grants_share_handles_across_certificates() {
+        let mut handles = ServiceHandles::new();
+        let set = |entries: &[&str]| entries.iter().map(|e| e.to_string()).collect();
+        let a = ServiceGrants::new(&set(&["agent:svc-a"]), &mut handles);
+        // Enough services to spill into a second bitmap word
+        let names: Vec<String> = (0..100).map(|i| format!("agent:svc-{}", i)).collect();
+        let many: HashSet<String> = names.iter().cloned().collect();
+        let b = ServiceGrants::new(&many, &mut handles);
+
+        assert!(a.allows(handles.get("svc-a"), &ClientType::Agent));
+        assert!(!a.allows(handles.get("svc-99"), &ClientType::Agent));
+        assert!(b.allows(handles.get("svc-99"), &ClientType::Agent));
+        assert!(!b.allows(handles.get("svc-a"), &ClientType::Agent));
+        assert!(!b.allows(handles.get("svc-7"), &ClientType::Connector));
     }
 }
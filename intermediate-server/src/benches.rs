@@ -0,0 +1,300 @@
+//! Criterion micro-benchmarks for the relay hot path.
+//!
+//! The server is a binary with no library target, so `benches/` cannot reach
+//! `Server` or `Registry`. These run as ignored tests instead, which gives
+//! them access to crate-private items while still using Criterion's
+//! statistics and `target/criterion` baselines:
+//!
+//! ```text
+//! cargo test --release bench_ -- --ignored --nocapture --test-threads 1
+//! BENCH_SAVE_BASELINE=main cargo test --release bench_ -- --ignored --test-threads 1
+//! BENCH_BASELINE=main      cargo test --release bench_ -- --ignored --test-threads 1
+//! ```
+//!
+//! Only the call under test is timed. QUIC packet exchange between the
+//! in-memory peers happens outside the measured window via `iter_custom`.
+
+use std::net::SocketAddr;
+use std::sync::atomic::AtomicBool;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+use bench_support::criterion;
+use criterion::{BenchmarkId, Throughput};
+
+use super::*;
+
+const SERVER_ADDR: &str = "127.0.0.1:4433";
+const SERVICE_ID: &str = "bench-service";
+const PAYLOAD_SIZES: [usize; 3] = [64, 512, 1200];
+
+/// Client half of an in-memory QUIC connection to the server.
+struct Peer {
+    conn: quiche::Connection,
+    addr: SocketAddr,
+    server_cid: quiche::ConnectionId<'static>,
+}
+
+/// A `Server` with one registered Agent and one registered Connector.
+struct Relay {
+    server: Server,
+    agent: Peer,
+    connector: Peer,
+    buf: Vec<u8>,
+}
+
+impl Relay {
+    fn new() -> Self {
+        let mut server = Server::new(
+            0,
+            "127.0.0.1",
+            None,
+            "certs/cert.pem",
+            "certs/key.pem",
+            None,
+            false,
+            false,
+            Arc::new(AtomicBool::new(false)),
+            Arc::new(AtomicBool::new(false)),
+            admission::AdmissionConfig {
+                retry: admission::RetryMode::Off,
+                ..Default::default()
+            },
+            0,
+            false,
+            None,
+            DEFAULT_MAX_UDP_PAYLOAD,
+            congestion::CongestionConfig::default(),
+            memory::MemoryBudget::new(1 << 30, DEFAULT_MAX_UDP_PAYLOAD),
+        )
+        .expect("server");
+
+        let mut buf = vec![0u8; 65535];
+        let agent = connect_peer(&mut server, "127.0.0.1:50001", &mut buf);
+        let connector = connect_peer(&mut server, "127.0.0.1:50002", &mut buf);
+
+        let mut relay = Relay {
+            server,
+            agent,
+            connector,
+            buf,
+        };
+        relay.register(false, SERVICE_ID);
+        relay.register(true, SERVICE_ID);
+        relay
+    }
+
+    fn register(&mut self, connector: bool, service_id: &str) {
+        let (kind, cid) = if connector {
+            (0x11, self.connector.server_cid.clone())
+        } else {
+            (0x10, self.agent.server_cid.clone())
+        };
+        let mut msg = vec![kind, service_id.len() as u8];
+        msg.extend_from_slice(service_id.as_bytes());
+        self.server.handle_registration(&cid, &msg).unwrap();
+        self.flush();
+    }
+
+    /// Exchange all pending packets between the server and both peers and
+    /// discard whatever DATAGRAMs they received.
+    fn flush(&mut self) {
+        for peer in [&mut self.agent, &mut self.connector] {
+            let server_conn = &mut self.server.clients.get_mut(&peer.server_cid).unwrap().conn;
+            exchange(server_conn, peer, &mut self.buf);
+            while peer.conn.dgram_recv(&mut self.buf).is_ok() {}
+        }
+    }
+
+    /// Send `dgram` from the Agent and deliver it to the server connection
+    /// without processing it.
+    fn deliver_from_agent(&mut self, dgram: &[u8]) {
+        self.agent.conn.dgram_send(dgram).unwrap();
+        let server_conn = &mut self
+            .server
+            .clients
+            .get_mut(&self.agent.server_cid)
+            .unwrap()
+            .conn;
+        let to: SocketAddr = SERVER_ADDR.parse().unwrap();
+        while let Ok((len, _)) = self.agent.conn.send(&mut self.buf) {
+            let _ = server_conn.recv(
+                &mut self.buf[..len],
+                quiche::RecvInfo {
+                    from: self.agent.addr,
+                    to,
+                },
+            );
+        }
+    }
+}
+
+fn client_config() -> quiche::Config {
+    let mut config = quiche::Config::new(quiche::PROTOCOL_VERSION).unwrap();
+    config.verify_peer(false);
+    config.set_application_protos(&[ALPN_PROTOCOL]).unwrap();
+    config.enable_dgram(true, 1000, 1000);
+    config.set_max_idle_timeout(IDLE_TIMEOUT_MS);
+    config.set_initial_max_data(10_000_000);
+    config.set_initial_max_stream_data_bidi_local(1_000_000);
+    config.set_initial_max_stream_data_bidi_remote(1_000_000);
+    config.set_initial_max_streams_bidi(100);
+    config.set_initial_max_streams_uni(100);
+    config
+}
+
+/// Handshake a client against `server.config` in memory and insert the
+/// accepted side into `server.clients`.
+fn connect_peer(server: &mut Server, addr: &str, buf: &mut [u8]) -> Peer {
+    let addr: SocketAddr = addr.parse().unwrap();
+    let server_addr: SocketAddr = SERVER_ADDR.parse().unwrap();
+
+    let mut cid = [0u8; quiche::MAX_CONN_ID_LEN];
+    server.rng.fill(&mut cid).unwrap();
+    let client_cid = quiche::ConnectionId::from_vec(cid.to_vec());
+    server.rng.fill(&mut cid).unwrap();
+    let server_cid = quiche::ConnectionId::from_vec(cid.to_vec());
+
+    let mut config = client_config();
+    let conn = quiche::connect(Some("localhost"), &client_cid, addr, server_addr, &mut config)
+        .unwrap();
+    let accepted = quiche::accept(&server_cid, None, server_addr, addr, &mut server.config)
+        .unwrap();
+    server
+        .clients
+        .insert(server_cid.clone(), Client::new(accepted, addr));
+
+    let mut peer = Peer {
+        conn,
+        addr,
+        server_cid,
+    };
+    for _ in 0..32 {
+        let server_conn = &mut server.clients.get_mut(&peer.server_cid).unwrap().conn;
+        exchange(server_conn, &mut peer, buf);
+        if peer.conn.is_established() && server_conn.is_established() {
+            return peer;
+        }
+    }
+    panic!("handshake did not complete");
+}
+
+fn exchange(server_conn: &mut quiche::Connection, peer: &mut Peer, buf: &mut [u8]) {
+    let server_addr: SocketAddr = SERVER_ADDR.parse().unwrap();
+    while let Ok((len, _)) = peer.conn.send(buf) {
+        let _ = server_conn.recv(
+            &mut buf[..len],
+            quiche::RecvInfo {
+                from: peer.addr,
+                to: server_addr,
+            },
+        );
+    }
+    while let Ok((len, _)) = server_conn.send(buf) {
+        let _ = peer.conn.recv(
+            &mut buf[..len],
+            quiche::RecvInfo {
+                from: server_addr,
+                to: peer.addr,
+            },
+        );
+    }
+}
+
+/// `[0x2F, id_len, service_id, ip_packet]` with a `size`-byte IP packet.
+fn service_datagram(size: usize) -> Vec<u8> {
+    let mut dgram = vec![0x2F, SERVICE_ID.len() as u8];
+    dgram.extend_from_slice(SERVICE_ID.as_bytes());
+    let mut ip = vec![0u8; size];
+    ip[0] = 0x45;
+    dgram.extend_from_slice(&ip);
+    dgram
+}
+
+#[test]
+#[ignore = "benchmark; run with --ignored"]
+fn bench_relay_service_datagram() {
+    let mut c = criterion();
+    let mut group = c.benchmark_group("relay_service_datagram");
+    let mut relay = Relay::new();
+    let agent_cid = relay.agent.server_cid.clone();
+
+    for size in PAYLOAD_SIZES {
+        let dgram = service_datagram(size);
+        group.throughput(Throughput::Bytes(size as u64));
+        group.bench_with_input(BenchmarkId::from_parameter(size), &dgram, |b, dgram| {
+            b.iter_custom(|iters| {
+                let mut total = Duration::ZERO;
+                for _ in 0..iters {
+                    let start = Instant::now();
+                    relay
+                        .server
+                        .relay_service_datagram(&agent_cid, dgram)
+                        .unwrap();
+                    total += start.elapsed();
+                    relay.flush();
+                }
+                total
+            })
+        });
+    }
+    group.finish();
+    c.final_summary();
+}
+
+#[test]
+#[ignore = "benchmark; run with --ignored"]
+fn bench_process_datagrams() {
+    let mut c = criterion();
+    let mut group = c.benchmark_group("process_datagrams");
+    let mut relay = Relay::new();
+    let agent_cid = relay.agent.server_cid.clone();
+
+    for size in PAYLOAD_SIZES {
+        let dgram = service_datagram(size);
+        group.throughput(Throughput::Bytes(size as u64));
+        group.bench_with_input(BenchmarkId::new("service_routed", size), &dgram, |b, dgram| {
+            b.iter_custom(|iters| {
+                let mut total = Duration::ZERO;
+                for _ in 0..iters {
+                    relay.deliver_from_agent(dgram);
+                    let start = Instant::now();
+                    relay.server.process_datagrams(&agent_cid).unwrap();
+                    total += start.elapsed();
+                    relay.flush();
+                }
+                total
+            })
+        });
+    }
+    group.finish();
+    c.final_summary();
+}
+
+#[test]
+#[ignore = "benchmark; run with --ignored"]
+fn bench_registry_find_connector() {
+    let mut c = criterion();
+    let mut group = c.benchmark_group("registry_find_connector_for_service");
+
+    for services in [10usize, 1_000, 100_000] {
+        let mut registry = Registry::new();
+        for i in 0..services {
+            registry.register(
+                quiche::ConnectionId::from_vec((i as u64).to_be_bytes().to_vec()),
+                ClientType::Connector,
+                format!("service-{}", i),
+            );
+        }
+        let hit = format!("service-{}", services / 2);
+
+        group.bench_with_input(BenchmarkId::new("hit", services), &hit, |b, id| {
+            b.iter(|| registry.find_connector_for_service(id))
+        });
+        group.bench_with_input(BenchmarkId::new("miss", services), &services, |b, _| {
+            b.iter(|| registry.find_connector_for_service("no-such-service"))
+        });
+    }
+    group.finish();
+    c.final_summary();
+}
@@ -1,7 +1,14 @@
 //! Client management for the ZTNA Intermediate Server
 
-use std::collections::{HashMap, HashSet};
+use std::collections::HashMap;
 use std::net::SocketAddr;
+use std::sync::Arc;
+use std::time::Instant;
+
+use tunnel_codec::aggregate::{self, Aggregator};
+
+use crate::auth::ServiceGrants;
+use crate::qlog::QlogCapture;
 
 // ============================================================================
 // Client Type
@@ -37,7 +44,28 @@ pub struct Client {
     /// Authenticated identity from mTLS client certificate (CN)
     pub authenticated_identity: Option<String>,
     /// Services this client is authorized for (from SAN entries). None = allow all (backward compat)
-    pub authenticated_services: Option<HashSet<String>>,
+    pub authenticated_services: Option<Arc<ServiceGrants>>,
+    /// Whether qlog is being captured for this connection
+    pub qlog_enabled: bool,
+    /// Whether the client accepts aggregate DATAGRAMs (flag in its registration)
+    pub aggregate: bool,
+    /// Relayed packets waiting to share a DATAGRAM to this client
+    pub batch: Aggregator,
+    /// Packet quiche's pacer scheduled for later; nothing more is sent on
+    /// this connection until it goes out
+    pub paced: Option<PacedPacket>,
+    /// Relayed DATAGRAMs allowed in quiche's send queue before further ones
+    /// are dropped (sized from the memory budget and congestion window)
+    pub dgram_queue_limit: usize,
+    /// Accepted but not yet established; counts against the handshake limit
+    pub handshake_pending: bool,
+}
+
+/// A packet held until its pacing release time (`SendInfo::at`)
+pub struct PacedPacket {
+    pub at: Instant,
+    pub to: SocketAddr,
+    pub data: Vec<u8>,
 }
 
 impl Client {
@@ -52,6 +80,41 @@ impl Client {
             signaling_buffers: HashMap::new(),
             authenticated_identity: None,
             authenticated_services: None,
+            qlog_enabled: false,
+            aggregate: false,
+            batch: Aggregator::new(),
+            paced: None,
+            dgram_queue_limit: usize::MAX,
+            handshake_pending: false,
+        }
+    }
+
+    /// Queue a relayed packet, batching it when the client accepts
+    /// aggregates. Returns how many packets went out inside aggregates.
+    /// `Error::Done` means the relay queue is full and DATAGRAMs were
+    /// dropped, `packet` among them when the queue was full beforehand.
+    pub fn send_tunneled(&mut self, packet: &[u8]) -> Result<usize, aggregate::SendError> {
+        if self.conn.dgram_send_queue_len() >= self.dgram_queue_limit {
+            return Err(aggregate::SendError {
+                error: quiche::Error::Done,
+                failed: 1,
+                packed: 0,
+            });
+        }
+        aggregate::send(&mut self.conn, &mut self.batch, self.aggregate, packet)
+    }
+
+    /// Hand the pending batch to quiche. Returns how many packets it carried
+    /// if it went out as an aggregate.
+    pub fn flush_tunneled(&mut self) -> Result<usize, aggregate::SendError> {
+        aggregate::flush(&mut self.conn, &mut self.batch)
+    }
+
+    /// Start qlog capture for this connection (no-op if already capturing)
+    pub fn start_qlog(&mut self, capture: &QlogCapture, reason: &str) {
+        if !self.qlog_enabled {
+            capture.attach(&mut self.conn, reason);
+            self.qlog_enabled = true;
         }
     }
 
@@ -0,0 +1,199 @@
+//! Bounded LRU cache of parsed client certificates
+//!
+//! Agent fleets reconnect with the same certificates over and over. Parsing
+//! each certificate once (X.509 decode plus the SAN scan), rather than once
+//! per connection, keeps reconnect storms cheap. Entries are keyed by the
+//! certificate's SHA-256 and expire at its notAfter. SIGHUP flushes the
+//! cache along with the TLS config.
+
+use std::collections::{BTreeMap, HashMap};
+use std::sync::Arc;
+
+use ring::digest;
+
+use crate::auth::{self, AuthError, ServiceGrants, ServiceHandles};
+
+/// A parsed certificate, shared by every connection presenting it
+#[derive(Debug)]
+pub struct CachedIdentity {
+    pub common_name: String,
+    /// None: no (or an empty set of) ZTNA SAN entries, allow all
+    /// (backward compat)
+    pub grants: Option<Arc<ServiceGrants>>,
+    /// `<role>:<service>` entries, for logging
+    pub services: Option<Vec<String>>,
+}
+
+struct Slot {
+    identity: Arc<CachedIdentity>,
+    not_after: i64,
+    /// Position in `lru`
+    tick: u64,
+}
+
+pub struct IdentityCache {
+    capacity: usize,
+    slots: HashMap<[u8; 32], Slot>,
+    /// Least recently used first
+    lru: BTreeMap<u64, [u8; 32]>,
+    next_tick: u64,
+}
+
+impl IdentityCache {
+    pub fn new(capacity: usize) -> Self {
+        IdentityCache {
+            capacity: capacity.max(1),
+            slots: HashMap::new(),
+            lru: BTreeMap::new(),
+            next_tick: 0,
+        }
+    }
+
+    /// Identity for `der_cert` and whether the cache answered, parsing it on
+    /// a miss. Expired certificates are parsed but not cached.
+    pub fn get_or_parse(
+        &mut self,
+        der_cert: &[u8],
+        now_unix: i64,
+        handles: &mut ServiceHandles,
+    ) -> Result<(Arc<CachedIdentity>, bool), AuthError> {
+        let key: [u8; 32] = digest::digest(&digest::SHA256, der_cert)
+            .as_ref()
+            .try_into()
+            .expect("SHA-256 is 32 bytes");
+
+        if let Some(slot) = self.slots.get_mut(&key) {
+            if now_unix < slot.not_after {
+                self.lru.remove(&slot.tick);
+                slot.tick = self.next_tick;
+                self.lru.insert(slot.tick, key);
+                self.next_tick += 1;
+                return Ok((Arc::clone(&slot.identity), true));
+            }
+            let tick = slot.tick;
+            self.slots.remove(&key);
+            self.lru.remove(&tick);
+        }
+
+        let parsed = auth::extract_identity(der_cert)?;
+        let identity = Arc::new(CachedIdentity {
+            common_name: parsed.common_name,
+            grants: auth::grants_for(parsed.authorized_services.as_ref(), handles).map(Arc::new),
+            services: parsed.authorized_services.map(|services| {
+                let mut services: Vec<_> = services.into_iter().collect();
+                services.sort();
+                services
+            }),
+        });
+        if now_unix < parsed.not_after {
+            self.insert(key, Arc::clone(&identity), parsed.not_after);
+        }
+        Ok((identity, false))
+    }
+
+    fn insert(&mut self, key: [u8; 32], identity: Arc<CachedIdentity>, not_after: i64) {
+        while self.slots.len() >= self.capacity {
+            let (_, oldest) = match self.lru.pop_first() {
+                Some(entry) => entry,
+                None => break,
+            };
+            self.slots.remove(&oldest);
+        }
+        let tick = self.next_tick;
+        self.next_tick += 1;
+        self.lru.insert(tick, key);
+        self.slots.insert(
+            key,
+            Slot {
+                identity,
+                not_after,
+                tick,
+            },
+        );
+    }
+
+    /// Drop every entry (SIGHUP reload)
+    pub fn clear(&mut self) {
+        self.slots.clear();
+        self.lru.clear();
+    }
+
+    pub fn len(&self) -> usize {
+        self.slots.len()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::client::ClientType;
+
+    fn cert(cn: &str, san_dns: &[&str], not_after: (i32, u8, u8)) -> Vec<u8> {
+        use rcgen::{date_time_ymd, CertificateParams, DnType, KeyPair, SanType};
+
+        let mut params = CertificateParams::default();
+        params.distinguished_name.push(DnType::CommonName, cn);
+        for dns in san_dns {
+            params
+                .subject_alt_names
+                .push(SanType::DnsName(dns.to_string().try_into().unwrap()));
+        }
+        params.not_after = date_time_ymd(not_after.0, not_after.1, not_after.2);
+        let key_pair = KeyPair::generate().unwrap();
+        params.self_signed(&key_pair).unwrap().der().to_vec()
+    }
+
+    /// 2026-01-01T00:00:00Z
+    const NOW: i64 = 1_767_225_600;
+
+    #[test]
+    fn test_hit_after_first_parse() {
+        let mut cache = IdentityCache::new(8);
+        let mut handles = ServiceHandles::new();
+        let der = cert("agent-1", &["agent.web.ztna"], (2030, 1, 1));
+
+        let (first, hit) = cache.get_or_parse(&der, NOW, &mut handles).unwrap();
+        assert!(!hit);
+        let (second, hit) = cache.get_or_parse(&der, NOW, &mut handles).unwrap();
+        assert!(hit);
+        assert!(Arc::ptr_eq(&first, &second));
+        assert_eq!(second.common_name, "agent-1");
+
+        let grants = second.grants.as_ref().unwrap();
+        assert!(grants.allows(handles.get("web"), &ClientType::Agent));
+        assert!(!grants.allows(handles.get("web"), &ClientType::Connector));
+    }
+
+    #[test]
+    fn test_expiry_and_lru_eviction() {
+        let mut cache = IdentityCache::new(2);
+        let mut handles = ServiceHandles::new();
+        let mut hit = |cache: &mut IdentityCache, der: &[u8], now| {
+            cache.get_or_parse(der, now, &mut handles).unwrap().1
+        };
+
+        // Expired certificates are never cached
+        let expired = cert("old", &[], (2025, 6, 1));
+        hit(&mut cache, &expired, NOW);
+        assert_eq!(cache.len(), 0);
+
+        let a = cert("a", &[], (2030, 1, 1));
+        let b = cert("b", &[], (2030, 1, 1));
+        let c = cert("c", &[], (2030, 1, 1));
+        hit(&mut cache, &a, NOW);
+        hit(&mut cache, &b, NOW);
+        // Touch a so b is least recently used
+        hit(&mut cache, &a, NOW);
+        hit(&mut cache, &c, NOW);
+        assert_eq!(cache.len(), 2);
+        assert!(hit(&mut cache, &a, NOW));
+        assert!(!hit(&mut cache, &b, NOW));
+
+        // An entry stops answering once its notAfter passes
+        let later = NOW + 10 * 365 * 86_400;
+        assert!(!hit(&mut cache, &a, later));
+
+        cache.clear();
+        assert_eq!(cache.len(), 0);
+    }
+}
@@ -5,7 +5,7 @@
 //! - Implements QAD (QUIC Address Discovery)
 //! - Relays DATAGRAM frames between matched pairs
 
-use std::collections::HashMap;
+use std::collections::{HashMap, HashSet};
 use std::io::{self, Read as _, Write as _};
 use std::net::SocketAddr;
 use std::path::Path;
@@ -19,15 +19,25 @@ use mio::net::UdpSocket;
 use mio::{Events, Interest, Poll, Token};
 use ring::aead;
 use ring::rand::{SecureRandom, SystemRandom};
+use tunnel_codec::aggregate;
+use tunnel_codec::fec::REG_FLAG_FEC;
+use tunnel_codec::header_compression::REG_FLAG_HEADER_COMPRESSION;
 
+mod admission;
 mod auth;
+#[cfg(test)]
+mod benches;
 mod client;
+mod identity_cache;
+mod memory;
 mod metrics;
 mod qad;
+mod qlog;
 mod registry;
 mod signaling;
+mod traffic;
 
-use client::{Client, ClientType};
+use client::{Client, ClientType, PacedPacket};
 use registry::Registry;
 use signaling::{
     decode_message, encode_message, DecodeError, SessionManager, SessionState, SignalingError,
@@ -52,12 +62,21 @@ type ReadySession = (
 // Constants
 // ============================================================================
 
-/// Maximum UDP payload size for QUIC packets (must match Agent)
-const MAX_DATAGRAM_SIZE: usize = 1350;
+/// Default ceiling for DPLPMTUD: a 1500-byte Ethernet MTU less IPv4/UDP
+/// headers (matches the Agent). Connections start at quiche's 1200-byte floor.
+const DEFAULT_MAX_UDP_PAYLOAD: usize = 1472;
+
+/// Accepted range for `--max-udp-payload` (QUIC minimum to IPv4 UDP maximum)
+const MIN_UDP_PAYLOAD: usize = 1200;
+const MAX_UDP_PAYLOAD: usize = 65507;
 
 /// QUIC idle timeout in milliseconds (must match Agent)
 const IDLE_TIMEOUT_MS: u64 = 30_000;
 
+/// Paced packets due within this window are sent now (mio's poll timeout
+/// has millisecond resolution, so waiting for less is not possible)
+const PACING_GRANULARITY: std::time::Duration = std::time::Duration::from_millis(1);
+
 /// ALPN protocol identifier (CRITICAL: must match Agent at lib.rs:28)
 const ALPN_PROTOCOL: &[u8] = b"ztna-v1";
 
@@ -70,15 +89,35 @@ const SOCKET_TOKEN: Token = Token(0);
 /// mio token for the metrics/health HTTP listener
 const METRICS_TOKEN: Token = Token(1);
 
-/// 7B: Maximum age for retry tokens (seconds)
-const RETRY_TOKEN_MAX_AGE_SECS: u64 = 60;
-
 /// 8A.1: Registration ACK — server sends after successful registration
 const REG_TYPE_ACK: u8 = 0x12;
 
 /// 8A.1: Registration NACK — server sends on auth denial or invalid registration
 const REG_TYPE_NACK: u8 = 0x13;
 
+/// Connector features that work end to end and are passed on to Agents.
+/// The server relays compressed and FEC-protected packets unchanged; it only
+/// tells Agents whether their service's Connector understands them.
+const REG_FLAGS_END_TO_END: u8 = REG_FLAG_HEADER_COMPRESSION | REG_FLAG_FEC;
+
+/// Registration flag: this connection is a striped uplink of a Connector
+/// already registered for the service. It carries tunneled traffic next to
+/// the Connector's primary connection instead of replacing it.
+const REG_FLAG_UPLINK: u8 = 0x08;
+
+/// Registration NACK status: an uplink whose link group does not match the
+/// service's primary Connector (or that has no primary yet)
+const REG_STATUS_NO_PRIMARY: u8 = 0x03;
+
+/// Default memory budget for connection buffers (windows and DATAGRAM queues)
+const DEFAULT_MEMORY_BUDGET_MB: u64 = 2048;
+
+/// How often relay queue caps follow the measured congestion windows
+const RELAY_QUEUE_REFRESH: std::time::Duration = std::time::Duration::from_millis(250);
+
+/// Parsed client certificates kept by fingerprint (see identity_cache.rs)
+const IDENTITY_CACHE_CAPACITY: usize = 4096;
+
 /// 8B.1: Connection ID rotation interval in seconds (default: 5 minutes)
 const CID_ROTATION_INTERVAL_SECS: u64 = 300;
 
@@ -97,7 +136,18 @@ struct ServerConfig {
     verify_peer: Option<bool>,
     require_client_cert: Option<bool>,
     disable_retry: Option<bool>,
+    admission: Option<admission::AdmissionConfig>,
     metrics_port: Option<u16>,
+    enable_profiling: Option<bool>,
+    qlog_dir: Option<String>,
+    qlog_sample: Option<u64>,
+    qlog_identities: Option<Vec<String>>,
+    qlog_services: Option<Vec<String>>,
+    qlog_max_file_mb: Option<u64>,
+    qlog_max_total_mb: Option<u64>,
+    max_udp_payload: Option<usize>,
+    congestion_control: Option<congestion::CongestionConfig>,
+    memory_budget_mb: Option<u64>,
 }
 
 fn load_config(path: &str) -> Result<ServerConfig, Box<dyn std::error::Error>> {
@@ -114,6 +164,49 @@ fn parse_arg(args: &[String], flag: &str) -> Option<String> {
         .cloned()
 }
 
+/// Set the Don't Fragment bit on everything sent from `socket`, so oversized
+/// PMTU probes are dropped on the path instead of being fragmented and
+/// "succeeding". PROBE mode ignores the kernel's cached path MTU, leaving the
+/// search to DPLPMTUD. Only Linux exposes this; elsewhere the OS default holds.
+#[cfg(target_os = "linux")]
+fn set_dont_fragment(socket: &UdpSocket, ipv6: bool) -> io::Result<()> {
+    use std::os::unix::io::AsRawFd;
+
+    let (level, name, value) = if ipv6 {
+        (
+            libc::IPPROTO_IPV6,
+            libc::IPV6_MTU_DISCOVER,
+            libc::IPV6_PMTUDISC_PROBE,
+        )
+    } else {
+        (
+            libc::IPPROTO_IP,
+            libc::IP_MTU_DISCOVER,
+            libc::IP_PMTUDISC_PROBE,
+        )
+    };
+    // SAFETY: valid fd and a c_int option value of the advertised length
+    let ret = unsafe {
+        libc::setsockopt(
+            socket.as_raw_fd(),
+            level,
+            name,
+            &value as *const libc::c_int as *const libc::c_void,
+            std::mem::size_of::<libc::c_int>() as libc::socklen_t,
+        )
+    };
+    if ret == 0 {
+        Ok(())
+    } else {
+        Err(io::Error::last_os_error())
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+fn set_dont_fragment(_socket: &UdpSocket, _ipv6: bool) -> io::Result<()> {
+    Ok(())
+}
+
 // ============================================================================
 // Main Entry Point
 // ============================================================================
@@ -193,12 +286,18 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         config.require_client_cert.unwrap_or(false)
     };
 
-    // 7B.4: Stateless retry tokens (enabled by default, --disable-retry for dev/testing)
-    let enable_retry = if args.iter().any(|a| a == "--disable-retry") {
-        false
-    } else {
-        !config.disable_retry.unwrap_or(false)
-    };
+    // 7B.4: Handshake admission. Retry is adaptive by default; --retry picks
+    // always/adaptive/off and --disable-retry (dev/testing) means off
+    let mut admission_config = config.admission.unwrap_or_default();
+    if config.disable_retry.unwrap_or(false) {
+        admission_config.retry = admission::RetryMode::Off;
+    }
+    if let Some(mode) = parse_arg(&args, "--retry") {
+        admission_config.retry = mode.parse()?;
+    }
+    if args.iter().any(|a| a == "--disable-retry") {
+        admission_config.retry = admission::RetryMode::Off;
+    }
 
     // Metrics/health HTTP endpoint (default 9090, 0 to disable)
     let metrics_port: u16 = parse_arg(&args, "--metrics-port")
@@ -206,6 +305,68 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         .or(config.metrics_port)
         .unwrap_or(9090);
 
+    // CPU/heap profiling endpoints on the metrics listener (opt-in)
+    let enable_profiling = if args.iter().any(|a| a == "--enable-profiling") {
+        true
+    } else {
+        config.enable_profiling.unwrap_or(false)
+    };
+
+    // Ceiling for path MTU discovery; raise on jumbo-frame links
+    let max_udp_payload = parse_arg(&args, "--max-udp-payload")
+        .and_then(|s| s.parse().ok())
+        .or(config.max_udp_payload)
+        .unwrap_or(DEFAULT_MAX_UDP_PAYLOAD)
+        .clamp(MIN_UDP_PAYLOAD, MAX_UDP_PAYLOAD);
+
+    // Congestion control for all connections; --cc overrides the algorithm
+    let mut congestion = config.congestion_control.unwrap_or_default();
+    if let Some(algorithm) = parse_arg(&args, "--cc") {
+        congestion.algorithm = Some(algorithm);
+    }
+
+    // Budget for all connections' receive windows and DATAGRAM queues
+    let memory_budget_mb: u64 = parse_arg(&args, "--memory-budget-mb")
+        .and_then(|s| s.parse().ok())
+        .or(config.memory_budget_mb)
+        .unwrap_or(DEFAULT_MEMORY_BUDGET_MB);
+    let memory_budget = memory::MemoryBudget::new(memory_budget_mb * 1024 * 1024, max_udp_payload);
+
+    // qlog capture (disabled unless a directory is given). Identity and service
+    // lists come from the config file or comma-separated flags.
+    let qlog_config = parse_arg(&args, "--qlog-dir")
+        .or(config.qlog_dir)
+        .map(|dir| {
+            let list = |flag: &str, from_config: Option<Vec<String>>| -> HashSet<String> {
+                parse_arg(&args, flag)
+                    .map(|s| s.split(',').map(|v| v.trim().to_string()).collect())
+                    .or(from_config)
+                    .unwrap_or_default()
+                    .into_iter()
+                    .filter(|v| !v.is_empty())
+                    .collect()
+            };
+            let mb = 1024 * 1024;
+            qlog::QlogConfig {
+                dir: dir.into(),
+                sample_one_in: parse_arg(&args, "--qlog-sample")
+                    .and_then(|s| s.parse().ok())
+                    .or(config.qlog_sample)
+                    .unwrap_or(0),
+                identities: list("--qlog-identity", config.qlog_identities),
+                services: list("--qlog-service", config.qlog_services),
+                max_file_bytes: config
+                    .qlog_max_file_mb
+                    .map(|v| v * mb)
+                    .unwrap_or(qlog::DEFAULT_MAX_FILE_BYTES),
+                max_total_bytes: parse_arg(&args, "--qlog-budget-mb")
+                    .and_then(|s| s.parse().ok())
+                    .or(config.qlog_max_total_mb)
+                    .map(|v: u64| v * mb)
+                    .unwrap_or(qlog::DEFAULT_MAX_TOTAL_BYTES),
+            }
+        });
+
     // L2: Validate cert/key paths exist at startup
     if !Path::new(&cert_path).exists() {
         log::error!("Certificate file not found: {}", cert_path);
@@ -227,11 +388,44 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
     log::info!("  ALPN: {:?}", std::str::from_utf8(ALPN_PROTOCOL));
     log::info!("  Verify peer: {}", verify_peer);
     log::info!("  Require client cert: {}", require_client_cert);
-    log::info!("  Stateless retry: {}", enable_retry);
+    log::info!(
+        "  Stateless retry: {:?} (threshold {} handshakes)",
+        admission_config.retry,
+        admission_config.retry_threshold
+    );
+    log::info!(
+        "  Admission: {}/s per prefix (burst {}), {} handshakes max",
+        admission_config.initials_per_sec,
+        admission_config.initial_burst,
+        admission_config.max_handshakes
+    );
+    log::info!("  Max UDP payload: {} (PMTU discovery)", max_udp_payload);
+    log::info!("  Congestion control: {}", congestion);
+    log::info!(
+        "  Memory budget: {} MB ({} per connection when idle)",
+        memory_budget_mb,
+        memory::Allotment::at_tier(0)
+    );
     if metrics_port > 0 {
         log::info!("  Metrics port: {}", metrics_port);
+        if enable_profiling {
+            log::info!("  Profiling: /debug/profile/cpu, /debug/profile/heap");
+        }
     } else {
         log::info!("  Metrics: disabled");
+        if enable_profiling {
+            log::warn!("Profiling requested but the metrics listener is disabled");
+        }
+    }
+    if let Some(ref q) = qlog_config {
+        log::info!(
+            "  qlog: {} (1 in {} sampled, {} identities, {} services, budget {} MB)",
+            q.dir.display(),
+            q.sample_one_in,
+            q.identities.len(),
+            q.services.len(),
+            q.max_total_bytes / (1024 * 1024)
+        );
     }
     if !verify_peer {
         log::warn!("TLS peer verification DISABLED — do not use in production");
@@ -264,8 +458,13 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         require_client_cert,
         reload_flag,
         shutdown_flag,
-        enable_retry,
+        admission_config,
         metrics_port,
+        enable_profiling,
+        qlog_config,
+        max_udp_payload,
+        congestion,
+        memory_budget,
     )?;
     server.run()
 }
@@ -300,6 +499,10 @@ struct Server {
     external_addr: Option<SocketAddr>,
     /// Whether to require valid client certificates (mTLS)
     require_client_cert: bool,
+    /// Parsed client certificates by SHA-256 (flushed on SIGHUP)
+    identity_cache: identity_cache::IdentityCache,
+    /// Service IDs interned for the authorization bitmaps (rebuilt on SIGHUP)
+    service_handles: auth::ServiceHandles,
     // 6B.1: Certificate hot-reload support
     /// Atomic flag set by SIGHUP handler to trigger config reload
     reload_flag: Arc<AtomicBool>,
@@ -314,9 +517,9 @@ struct Server {
     ca_cert_path: Option<String>,
     /// Whether to verify peer certificates
     verify_peer: bool,
-    // 7B: Stateless retry token support
-    /// Whether to require retry tokens on new connections
-    enable_retry: bool,
+    // 7B: Handshake admission and stateless retry
+    /// Rate limits, handshake concurrency and retry policy for new connections
+    admission: admission::Admission,
     /// AEAD key for retry token encryption/decryption
     retry_key: aead::LessSafeKey,
     // 8B.1: Connection ID rotation
@@ -331,6 +534,25 @@ struct Server {
     metrics: metrics::Metrics,
     /// TCP listener for metrics/health HTTP endpoint (None if disabled)
     metrics_listener: Option<mio::net::TcpListener>,
+    /// `/debug/profile/*` endpoints (None unless profiling is enabled)
+    profiler: Option<profiling::Profiler>,
+    /// Sampled qlog capture (None if disabled)
+    qlog: Option<qlog::QlogCapture>,
+    /// Largest UDP payload sent or accepted (DPLPMTUD ceiling)
+    max_udp_payload: usize,
+    /// Congestion control / pacing settings (re-applied on config reload)
+    congestion: congestion::CongestionConfig,
+    /// Budget that per-connection windows and queues are sized from
+    budget: memory::MemoryBudget,
+    /// Budget tier `config` was built for (see memory.rs)
+    memory_tier: u32,
+    /// Configs of other tiers built since the last TLS reload, so moving
+    /// between tiers does not re-read the PEM files
+    tier_configs: HashMap<u32, quiche::Config>,
+    /// Last time relay queue caps were re-sized
+    last_relay_queue_refresh: Instant,
+    /// Last time idle admission buckets were swept out
+    last_admission_sweep: Instant,
 }
 
 impl Server {
@@ -346,8 +568,13 @@ impl Server {
         require_client_cert: bool,
         reload_flag: Arc<AtomicBool>,
         shutdown_flag: Arc<AtomicBool>,
-        enable_retry: bool,
+        admission_config: admission::AdmissionConfig,
         metrics_port: u16,
+        enable_profiling: bool,
+        qlog_config: Option<qlog::QlogConfig>,
+        max_udp_payload: usize,
+        congestion: congestion::CongestionConfig,
+        budget: memory::MemoryBudget,
     ) -> Result<Self, Box<dyn std::error::Error>> {
         // Parse external address if provided (for NAT environments like AWS Elastic IP)
         let external_addr: Option<SocketAddr> = if let Some(ext_ip) = external_ip {
@@ -366,16 +593,16 @@ impl Server {
         // CRITICAL: ALPN must match Agent
         config.set_application_protos(&[ALPN_PROTOCOL])?;
 
-        // Enable DATAGRAM support (for QAD and IP tunneling)
-        config.enable_dgram(true, 1000, 1000);
-
         // Set timeouts and limits (match Agent)
         config.set_max_idle_timeout(IDLE_TIMEOUT_MS);
-        config.set_max_recv_udp_payload_size(MAX_DATAGRAM_SIZE);
-        config.set_max_send_udp_payload_size(MAX_DATAGRAM_SIZE);
-        config.set_initial_max_data(10_000_000);
-        config.set_initial_max_stream_data_bidi_local(1_000_000);
-        config.set_initial_max_stream_data_bidi_remote(1_000_000);
+        config.set_max_recv_udp_payload_size(max_udp_payload);
+        config.set_max_send_udp_payload_size(max_udp_payload);
+        config.discover_pmtu(true);
+        congestion.apply(&mut config)?;
+
+        // DATAGRAM support (QAD and IP tunneling) and auto-tuned receive
+        // windows, at the budget's full allotment until connections arrive
+        memory::Allotment::at_tier(0).apply(&mut config);
         config.set_initial_max_streams_bidi(100);
         config.set_initial_max_streams_uni(100);
 
@@ -392,6 +619,9 @@ impl Server {
         let poll = Poll::new()?;
         let addr: SocketAddr = format!("{}:{}", bind_addr, port).parse()?;
         let mut socket = UdpSocket::bind(addr)?;
+        if let Err(e) = set_dont_fragment(&socket, addr.is_ipv6()) {
+            log::warn!("Failed to set DF on UDP socket: {}", e);
+        }
 
         // Register socket with poll
         poll.registry()
@@ -418,6 +648,8 @@ impl Server {
             aead::UnboundKey::new(&aead::AES_256_GCM, &key_bytes).map_err(|_| "Invalid key")?;
         let retry_key = aead::LessSafeKey::new(unbound_key);
 
+        let qlog = qlog_config.map(qlog::QlogCapture::new).transpose()?;
+
         log::info!("Server listening on {}", addr);
         if let Some(ext) = external_addr {
             log::info!("External address for QUIC path validation: {}", ext);
@@ -432,22 +664,37 @@ impl Server {
             session_manager: SessionManager::new(),
             rng,
             recv_buf: vec![0u8; 65535],
-            send_buf: vec![0u8; MAX_DATAGRAM_SIZE],
+            send_buf: vec![0u8; max_udp_payload],
             stream_buf: vec![0u8; 65535],
             external_addr,
             require_client_cert,
+            identity_cache: identity_cache::IdentityCache::new(IDENTITY_CACHE_CAPACITY),
+            service_handles: auth::ServiceHandles::new(),
             reload_flag,
             shutdown_flag,
             cert_path: cert_path.to_string(),
             key_path: key_path.to_string(),
             ca_cert_path: ca_cert_path.map(|s| s.to_string()),
             verify_peer,
-            enable_retry,
+            admission: admission::Admission::new(admission_config),
             retry_key,
             cid_aliases: HashMap::new(),
             last_cid_rotation: Instant::now(),
             metrics: metrics::Metrics::new(),
+            profiler: if enable_profiling && metrics_listener.is_some() {
+                Some(profiling::Profiler::new()?)
+            } else {
+                None
+            },
             metrics_listener,
+            qlog,
+            max_udp_payload,
+            congestion,
+            budget,
+            memory_tier: 0,
+            tier_configs: HashMap::new(),
+            last_relay_queue_refresh: Instant::now(),
+            last_admission_sweep: Instant::now(),
         })
     }
 
@@ -467,8 +714,21 @@ impl Server {
                 self.reload_tls_config();
             }
 
-            // Calculate timeout based on earliest connection timeout
-            let timeout = self.clients.values().filter_map(|c| c.conn.timeout()).min();
+            // Calculate timeout based on earliest connection timeout (and a
+            // CPU profile or paced packet coming due)
+            let now = Instant::now();
+            let timeout = self
+                .clients
+                .values()
+                .filter_map(|c| c.conn.timeout())
+                .chain(
+                    self.clients
+                        .values()
+                        .filter_map(|c| c.paced.as_ref())
+                        .map(|p| p.at.saturating_duration_since(now)),
+                )
+                .chain(self.profiler.as_ref().and_then(|p| p.timeout()))
+                .min();
 
             // Poll for events (EINTR from SIGTERM is expected — continue to check shutdown_flag)
             if let Err(e) = self.poll.poll(&mut events, timeout) {
@@ -497,6 +757,11 @@ impl Server {
             // Process timeouts for all connections
             self.process_timeouts();
 
+            // Answer a CPU profile request once its sampling window ends
+            if let Some(ref mut profiler) = self.profiler {
+                profiler.poll();
+            }
+
             // 8B.2: Periodic CID rotation for privacy
             if self.last_cid_rotation.elapsed()
                 >= std::time::Duration::from_secs(CID_ROTATION_INTERVAL_SECS)
@@ -505,6 +770,20 @@ impl Server {
                 self.last_cid_rotation = Instant::now();
             }
 
+            // Windows of new connections follow the budget tier, and relay
+            // queues each client's congestion window
+            if self.last_relay_queue_refresh.elapsed() >= RELAY_QUEUE_REFRESH {
+                self.update_memory_tier(self.clients.len());
+                self.refresh_relay_queue_limits();
+                self.last_relay_queue_refresh = Instant::now();
+            }
+
+            // Forget rate-limit buckets of prefixes that have gone quiet
+            if self.last_admission_sweep.elapsed() >= admission::BUCKET_SWEEP_INTERVAL {
+                self.last_admission_sweep = Instant::now();
+                self.admission.sweep(self.last_admission_sweep);
+            }
+
             // Cleanup expired signaling sessions
             let expired = self.session_manager.cleanup_expired();
             for session_id in expired {
@@ -516,6 +795,9 @@ impl Server {
 
             // Clean up closed connections
             self.cleanup_closed();
+            self.metrics
+                .handshakes_pending
+                .store(self.admission.pending() as u64, Ordering::Relaxed);
         }
     }
 
@@ -598,15 +880,14 @@ impl Server {
     ///
     /// Metrics connections are short-lived (Prometheus scrapes), so we handle them
     /// synchronously: accept, read the HTTP request line, write the response, close.
-    fn handle_metrics_accept(&self) {
-        let listener = match self.metrics_listener {
-            Some(ref l) => l,
-            None => return,
-        };
-
+    fn handle_metrics_accept(&mut self) {
         // Accept all pending connections (edge-triggered)
         loop {
-            match listener.accept() {
+            let accepted = match self.metrics_listener {
+                Some(ref l) => l.accept(),
+                None => return,
+            };
+            match accepted {
                 Ok((stream, addr)) => {
                     log::debug!("Metrics connection from {}", addr);
                     self.handle_metrics_connection(stream);
@@ -621,11 +902,20 @@ impl Server {
     }
 
     /// Handle a single metrics/health HTTP request synchronously.
-    fn handle_metrics_connection(&self, stream: mio::net::TcpStream) {
+    ///
+    /// `/debug/profile/*` requests go to the profiler when profiling is
+    /// enabled (404 otherwise); a CPU profile answers after its sampling window.
+    fn handle_metrics_connection(&mut self, stream: mio::net::TcpStream) {
         let mut buf = [0u8; 1024];
         match (&stream).read(&mut buf) {
             Ok(n) if n > 0 => {
                 let request = String::from_utf8_lossy(&buf[..n]);
+                if request.starts_with("GET /debug/profile/") {
+                    if let Some(ref mut profiler) = self.profiler {
+                        profiler.handle_request(&request, stream);
+                        return;
+                    }
+                }
                 let response = if request.starts_with("GET /healthz ")
                     || request.starts_with("GET /healthz\r")
                 {
@@ -633,6 +923,7 @@ impl Server {
                 } else if request.starts_with("GET /metrics ")
                     || request.starts_with("GET /metrics\r")
                 {
+                    self.refresh_active_agents();
                     let body = self.metrics.render();
                     format!(
                         "HTTP/1.1 200 OK\r\n\
@@ -651,14 +942,69 @@ impl Server {
         }
     }
 
+    /// Snapshot connected Agents per service and per identity for `/metrics`
+    fn refresh_active_agents(&self) {
+        let by_service = self.registry.agents_per_service();
+        let mut by_identity: HashMap<String, u64> = HashMap::new();
+        for client in self.clients.values() {
+            if client.client_type == Some(ClientType::Agent) {
+                if let Some(ref identity) = client.authenticated_identity {
+                    *by_identity.entry(identity.clone()).or_insert(0) += 1;
+                }
+            }
+        }
+        if let Ok(mut traffic) = self.metrics.traffic.lock() {
+            traffic.set_active_agents(by_service, by_identity);
+        }
+    }
+
+    /// Attribute a relayed or dropped DATAGRAM to its service and to the
+    /// sender's mTLS identity
+    fn account_traffic(
+        &self,
+        from_conn_id: &quiche::ConnectionId<'static>,
+        service_id: Option<&str>,
+        bytes: usize,
+        relayed: bool,
+    ) {
+        let identity = self
+            .clients
+            .get(from_conn_id)
+            .and_then(|c| c.authenticated_identity.as_deref());
+        if service_id.is_none() && identity.is_none() {
+            return;
+        }
+        if let Ok(mut traffic) = self.metrics.traffic.lock() {
+            traffic.record(service_id, identity, bytes as u64, relayed);
+        }
+    }
+
     /// 6B.1: Reload TLS configuration from disk (triggered by SIGHUP).
     /// New connections will use the updated certificates; existing connections are unaffected.
     fn reload_tls_config(&mut self) {
         log::info!("SIGHUP received — reloading TLS certificates...");
 
-        match self.build_quiche_config() {
+        // Re-parse client certificates from scratch after a CA or policy change
+        log::info!(
+            "Flushing {} cached client identities",
+            self.identity_cache.len()
+        );
+        self.identity_cache.clear();
+
+        // Re-intern only the services connected clients are granted, so
+        // services dropped from every certificate leave the handle table
+        let old_handles = std::mem::take(&mut self.service_handles);
+        let names = old_handles.names();
+        for client in self.clients.values_mut() {
+            if let Some(ref mut grants) = client.authenticated_services {
+                *grants = Arc::new(grants.rebuild(&names, &mut self.service_handles));
+            }
+        }
+
+        match self.build_quiche_config(self.memory_tier) {
             Ok(new_config) => {
                 self.config = new_config;
+                self.tier_configs.clear();
                 log::info!(
                     "TLS certificates reloaded (cert={}, key={})",
                     self.cert_path,
@@ -674,20 +1020,20 @@ impl Server {
         }
     }
 
-    /// Build a fresh quiche::Config from the stored cert/key/CA paths
-    fn build_quiche_config(&self) -> Result<quiche::Config, Box<dyn std::error::Error>> {
+    /// Build a fresh quiche::Config for a memory tier from the stored
+    /// cert/key/CA paths
+    fn build_quiche_config(&self, tier: u32) -> Result<quiche::Config, Box<dyn std::error::Error>> {
         let mut config = quiche::Config::new(quiche::PROTOCOL_VERSION)?;
 
         config.load_cert_chain_from_pem_file(&self.cert_path)?;
         config.load_priv_key_from_pem_file(&self.key_path)?;
         config.set_application_protos(&[ALPN_PROTOCOL])?;
-        config.enable_dgram(true, 1000, 1000);
         config.set_max_idle_timeout(IDLE_TIMEOUT_MS);
-        config.set_max_recv_udp_payload_size(MAX_DATAGRAM_SIZE);
-        config.set_max_send_udp_payload_size(MAX_DATAGRAM_SIZE);
-        config.set_initial_max_data(10_000_000);
-        config.set_initial_max_stream_data_bidi_local(1_000_000);
-        config.set_initial_max_stream_data_bidi_remote(1_000_000);
+        config.set_max_recv_udp_payload_size(self.max_udp_payload);
+        config.set_max_send_udp_payload_size(self.max_udp_payload);
+        config.discover_pmtu(true);
+        self.congestion.apply(&mut config)?;
+        memory::Allotment::at_tier(tier).apply(&mut config);
         config.set_initial_max_streams_bidi(100);
         config.set_initial_max_streams_uni(100);
 
@@ -701,7 +1047,59 @@ impl Server {
         Ok(config)
     }
 
+    /// Move to the budget tier for `connections`, switching the config new
+    /// connections are accepted with. Runs from housekeeping; each tier's
+    /// config is built once per TLS reload. Relaxing waits for 1/8 headroom
+    /// so churn around a tier boundary does not flip tiers every run.
+    fn update_memory_tier(&mut self, connections: usize) {
+        let mut tier = self.budget.tier_for(connections);
+        if tier < self.memory_tier {
+            tier = self.budget.tier_for(connections + connections / 8);
+        }
+        if tier == self.memory_tier {
+            return;
+        }
+
+        let config = match self.tier_configs.remove(&tier) {
+            Some(config) => config,
+            None => match self.build_quiche_config(tier) {
+                Ok(config) => config,
+                Err(e) => {
+                    log::error!("Failed to build config for memory tier {}: {}", tier, e);
+                    return;
+                }
+            },
+        };
+        let previous = std::mem::replace(&mut self.memory_tier, tier);
+        let previous_config = std::mem::replace(&mut self.config, config);
+        self.tier_configs.insert(previous, previous_config);
+        self.metrics
+            .memory_tier
+            .store(tier as u64, Ordering::Relaxed);
+        log::info!(
+            "Memory tier {} -> {} at {} connections: {}",
+            previous,
+            tier,
+            connections,
+            memory::Allotment::at_tier(tier)
+        );
+    }
+
+    /// Cap each client's queued relay DATAGRAMs at about two congestion
+    /// windows, within the current tier's queue length
+    fn refresh_relay_queue_limits(&mut self) {
+        let tier_limit = memory::Allotment::at_tier(self.memory_tier).dgram_queue_len;
+        for client in self.clients.values_mut() {
+            if let Some(path) = client.conn.path_stats().find(|p| p.active) {
+                client.dgram_queue_limit =
+                    memory::relay_queue_limit(path.cwnd, path.pmtu, tier_limit);
+            }
+        }
+    }
+
     fn process_socket(&mut self) -> Result<(), Box<dyn std::error::Error>> {
+        self.admission.begin_iteration();
+
         // Use a separate buffer to avoid borrow conflicts with self.recv_buf
         let mut pkt_buf = vec![0u8; 65535];
 
@@ -768,6 +1166,11 @@ impl Server {
 
                 match client.conn.recv(pkt_slice, recv_info) {
                     Ok(_) => {
+                        if client.handshake_pending && client.conn.is_established() {
+                            client.handshake_pending = false;
+                            self.admission.handshake_finished();
+                        }
+
                         // Update observed address (for QAD)
                         if client.observed_addr != from {
                             log::debug!(
@@ -782,19 +1185,39 @@ impl Server {
                         // 6A.4: Extract peer cert once connection is established
                         if client.conn.is_established() && client.authenticated_identity.is_none() {
                             if let Some(der_cert) = client.conn.peer_cert() {
-                                match auth::extract_identity(der_cert) {
-                                    Ok(identity) => {
+                                let now = std::time::SystemTime::now()
+                                    .duration_since(std::time::UNIX_EPOCH)
+                                    .map(|d| d.as_secs() as i64)
+                                    .unwrap_or(0);
+                                match self.identity_cache.get_or_parse(
+                                    der_cert,
+                                    now,
+                                    &mut self.service_handles,
+                                ) {
+                                    Ok((identity, cached)) => {
+                                        let counter = if cached {
+                                            &self.metrics.identity_cache_hits_total
+                                        } else {
+                                            &self.metrics.identity_cache_misses_total
+                                        };
+                                        counter.fetch_add(1, Ordering::Relaxed);
                                         log::info!(
-                                            "Client {:?} authenticated as '{}'",
+                                            "Client {:?} authenticated as '{}'{}",
                                             conn_id,
-                                            identity.common_name
+                                            identity.common_name,
+                                            if cached { " (cached)" } else { "" }
                                         );
-                                        if let Some(ref services) = identity.authorized_services {
+                                        if let Some(ref services) = identity.services {
                                             log::info!("  Authorized services: {:?}", services);
                                         }
-                                        client.authenticated_identity = Some(identity.common_name);
-                                        client.authenticated_services =
-                                            identity.authorized_services;
+                                        if let Some(ref qlog) = self.qlog {
+                                            if qlog.matches_identity(&identity.common_name) {
+                                                client.start_qlog(qlog, "identity");
+                                            }
+                                        }
+                                        client.authenticated_identity =
+                                            Some(identity.common_name.clone());
+                                        client.authenticated_services = identity.grants.clone();
                                     }
                                     Err(e) => {
                                         log::warn!(
@@ -864,11 +1287,15 @@ impl Server {
             return Ok(());
         }
 
-        // 7B.3: Stateless retry token validation
-        let odcid = if self.enable_retry {
-            let token_data = hdr.token.as_deref().unwrap_or(&[]);
-            if token_data.is_empty() {
-                // No token — send Retry packet
+        // Admission control before any per-connection work: source prefix
+        // rate, handshakes in progress and the retry policy
+        let token_data = hdr.token.as_deref().unwrap_or(&[]);
+        match self
+            .admission
+            .check(from.ip(), !token_data.is_empty(), Instant::now())
+        {
+            admission::Verdict::Accept => {}
+            admission::Verdict::Retry => {
                 let token = self.mint_retry_token(&hdr.dcid, from)?;
 
                 let mut new_scid = [0u8; quiche::MAX_CONN_ID_LEN];
@@ -890,8 +1317,30 @@ impl Server {
                 log::debug!("Sent Retry to {} (dcid={:?})", from, hdr.dcid);
                 return Ok(());
             }
+            admission::Verdict::RateLimited => {
+                self.metrics
+                    .initials_rate_limited_total
+                    .fetch_add(1, Ordering::Relaxed);
+                log::debug!("Initial from {} dropped: source prefix over rate", from);
+                return Ok(());
+            }
+            admission::Verdict::Overloaded => {
+                self.metrics
+                    .initials_overload_dropped_total
+                    .fetch_add(1, Ordering::Relaxed);
+                log::debug!(
+                    "Initial from {} dropped: {} handshakes in progress",
+                    from,
+                    self.admission.pending()
+                );
+                return Ok(());
+            }
+        }
 
-            // Has token — validate it
+        // 7B.3: A token can only come from our Retry, so it must validate
+        let odcid = if token_data.is_empty() {
+            None
+        } else {
             match self.validate_retry_token(token_data, from) {
                 Some(original_dcid) => {
                     self.metrics
@@ -907,8 +1356,6 @@ impl Server {
                     return Ok(());
                 }
             }
-        } else {
-            None
         };
 
         // Generate connection ID for accept.
@@ -942,7 +1389,14 @@ impl Server {
         log::info!("New connection from {} (scid={:?})", from, scid_owned);
 
         // Create client
-        let client = Client::new(conn, from);
+        let mut client = Client::new(conn, from);
+        client.handshake_pending = true;
+        self.admission.handshake_started();
+        if let Some(ref mut qlog) = self.qlog {
+            if qlog.sample_connection() {
+                client.start_qlog(qlog, "sampling");
+            }
+        }
 
         // Store the connection (use our generated scid)
         self.clients.insert(scid_owned.clone(), client);
@@ -968,47 +1422,17 @@ impl Server {
         Ok(())
     }
 
-    /// 7B.2: Generate an encrypted retry token containing [addr, dcid, timestamp]
+    /// 7B.2: Seal a retry token for `dcid`, bound to the client address
     fn mint_retry_token(
         &self,
         dcid: &quiche::ConnectionId<'_>,
         addr: SocketAddr,
     ) -> Result<Vec<u8>, Box<dyn std::error::Error>> {
-        // Plaintext: [addr_bytes..., dcid_len(u8), dcid_bytes..., timestamp(u64 BE)]
-        let addr_str = addr.to_string();
-        let addr_bytes = addr_str.as_bytes();
-        let timestamp = std::time::SystemTime::now()
+        let now = std::time::SystemTime::now()
             .duration_since(std::time::UNIX_EPOCH)?
             .as_secs();
-
-        let mut plaintext = Vec::new();
-        plaintext.push(addr_bytes.len() as u8);
-        plaintext.extend_from_slice(addr_bytes);
-        plaintext.push(dcid.len() as u8);
-        plaintext.extend_from_slice(dcid.as_ref());
-        plaintext.extend_from_slice(&timestamp.to_be_bytes());
-
-        // Generate random nonce
-        let mut nonce_bytes = [0u8; 12]; // AES-256-GCM nonce size
-        self.rng
-            .fill(&mut nonce_bytes)
-            .map_err(|_| "Failed to generate nonce")?;
-        let nonce = aead::Nonce::assume_unique_for_key(nonce_bytes);
-
-        // Encrypt in place
-        let tag_len = self.retry_key.algorithm().tag_len();
-        let mut in_out = plaintext;
-        self.retry_key
-            .seal_in_place_append_tag(nonce, aead::Aad::empty(), &mut in_out)
-            .map_err(|_| "Token encryption failed")?;
-
-        // Token format: [nonce(12), ciphertext+tag(...)]
-        let mut token = Vec::with_capacity(12 + in_out.len());
-        token.extend_from_slice(&nonce_bytes);
-        token.extend_from_slice(&in_out);
-
-        let _ = tag_len; // suppress unused warning
-        Ok(token)
+        admission::seal_token(&self.retry_key, &self.rng, dcid.as_ref(), addr, now)
+            .ok_or_else(|| "Token encryption failed".into())
     }
 
     /// 7B.2: Validate a retry token — returns the original dcid if valid
@@ -1017,58 +1441,11 @@ impl Server {
         token: &[u8],
         addr: SocketAddr,
     ) -> Option<quiche::ConnectionId<'static>> {
-        if token.len() < 12 {
-            return None; // Too short for nonce
-        }
-
-        let nonce_bytes: [u8; 12] = token[..12].try_into().ok()?;
-        let nonce = aead::Nonce::assume_unique_for_key(nonce_bytes);
-
-        let mut ciphertext = token[12..].to_vec();
-        let plaintext = self
-            .retry_key
-            .open_in_place(nonce, aead::Aad::empty(), &mut ciphertext)
-            .ok()?;
-
-        // Parse: [addr_len(u8), addr_bytes..., dcid_len(u8), dcid_bytes..., timestamp(u64 BE)]
-        if plaintext.is_empty() {
-            return None;
-        }
-        let addr_len = plaintext[0] as usize;
-        if plaintext.len() < 1 + addr_len + 1 {
-            return None;
-        }
-        let token_addr_str = std::str::from_utf8(&plaintext[1..1 + addr_len]).ok()?;
-        let dcid_len = plaintext[1 + addr_len] as usize;
-        if plaintext.len() < 1 + addr_len + 1 + dcid_len + 8 {
-            return None;
-        }
-        let dcid_bytes = &plaintext[1 + addr_len + 1..1 + addr_len + 1 + dcid_len];
-        let ts_offset = 1 + addr_len + 1 + dcid_len;
-        let timestamp = u64::from_be_bytes(plaintext[ts_offset..ts_offset + 8].try_into().ok()?);
-
-        // Validate address matches
-        let expected_addr = addr.to_string();
-        if token_addr_str != expected_addr {
-            log::debug!(
-                "Retry token addr mismatch: {} vs {}",
-                token_addr_str,
-                expected_addr
-            );
-            return None;
-        }
-
-        // Validate timestamp freshness
         let now = std::time::SystemTime::now()
             .duration_since(std::time::UNIX_EPOCH)
             .ok()?
             .as_secs();
-        if now.saturating_sub(timestamp) > RETRY_TOKEN_MAX_AGE_SECS {
-            log::debug!("Retry token expired ({} seconds old)", now - timestamp);
-            return None;
-        }
-
-        Some(quiche::ConnectionId::from_vec(dcid_bytes.to_vec()))
+        admission::open_token(&self.retry_key, token, addr, now).map(quiche::ConnectionId::from_vec)
     }
 
     fn send_qad(
@@ -1109,7 +1486,7 @@ impl Server {
 
         // Collect DATAGRAMs from this connection
         if let Some(client) = self.clients.get_mut(conn_id) {
-            let mut buf = vec![0u8; MAX_DATAGRAM_SIZE];
+            let mut buf = vec![0u8; self.max_udp_payload];
             while let Ok(len) = client.conn.dgram_recv(&mut buf) {
                 dgrams.push(buf[..len].to_vec());
             }
@@ -1134,6 +1511,22 @@ impl Server {
                     // Service-routed IP packet: [0x2F, id_len, service_id..., ip_packet...]
                     self.relay_service_datagram(conn_id, &dgram)?;
                 }
+                aggregate::DGRAM_TYPE_AGGREGATE => {
+                    // Several tunneled packets in one DATAGRAM; only packets
+                    // that could have been sent on their own are relayed
+                    for packet in aggregate::unpack(&dgram) {
+                        match packet.first().copied() {
+                            Some(0x2F) => self.relay_service_datagram(conn_id, packet)?,
+                            Some(0x01 | 0x10..=0x13 | aggregate::DGRAM_TYPE_AGGREGATE) | None => {
+                                log::debug!(
+                                    "Ignoring control message inside aggregate from {:?}",
+                                    conn_id
+                                );
+                            }
+                            Some(_) => self.relay_datagram(conn_id, packet)?,
+                        }
+                    }
+                }
                 _ => {
                     // Raw IP packet - relay to paired connection (implicit routing)
                     log::debug!("Received {} bytes to relay from {:?}", dgram.len(), conn_id);
@@ -1194,47 +1587,98 @@ impl Server {
         // 6A.5: Check mTLS authorization before allowing registration
         if self.require_client_cert {
             if let Some(client) = self.clients.get(conn_id) {
-                if let Some(ref services) = client.authenticated_services {
-                    if !services.is_empty() {
-                        let identity = auth::ClientIdentity {
-                            common_name: client.authenticated_identity.clone().unwrap_or_default(),
-                            authorized_services: Some(services.clone()),
-                        };
-                        if !auth::is_authorized_for_service(&identity, &service_id, &client_type) {
-                            log::warn!(
-                                "Rejecting registration: {:?} '{}' not authorized for service '{}' (conn={:?})",
-                                client_type,
-                                identity.common_name,
-                                service_id,
-                                conn_id
-                            );
-                            // 8A.2: Send NACK for auth denial
-                            self.send_registration_nack(conn_id, service_id.as_bytes(), 0x02);
-                            self.metrics
-                                .registration_rejections_total
-                                .fetch_add(1, Ordering::Relaxed);
-                            return Ok(());
-                        }
+                // None = no ZTNA SANs = allow all (backward compat)
+                if let Some(ref grants) = client.authenticated_services {
+                    let handle = self.service_handles.get(&service_id);
+                    if !grants.allows(handle, &client_type) {
+                        log::warn!(
+                            "Rejecting registration: {:?} '{}' not authorized for service '{}' (conn={:?})",
+                            client_type,
+                            client.authenticated_identity.as_deref().unwrap_or_default(),
+                            service_id,
+                            conn_id
+                        );
+                        // 8A.2: Send NACK for auth denial
+                        self.send_registration_nack(conn_id, service_id.as_bytes(), 0x02);
+                        self.metrics
+                            .registration_rejections_total
+                            .fetch_add(1, Ordering::Relaxed);
+                        return Ok(());
                     }
-                    // Empty set with require_client_cert = deny
-                } else {
-                    // None = no ZTNA SANs = allow all (backward compat)
                 }
             }
         }
 
+        // Optional flags byte after the service ID, then a Connector's
+        // 8-byte link group ID
+        let flags = dgram.get(2 + id_len).copied().unwrap_or(0);
+        let link_group = dgram
+            .get(3 + id_len..11 + id_len)
+            .and_then(|b| b.try_into().ok())
+            .map(u64::from_be_bytes);
+
+        // An uplink joins only the primary of its own Connector
+        let is_uplink =
+            matches!(client_type, ClientType::Connector) && flags & REG_FLAG_UPLINK != 0;
+        if is_uplink
+            && !link_group.is_some_and(|group| {
+                self.registry
+                    .register_uplink(conn_id.clone(), service_id.clone(), group)
+            })
+        {
+            log::warn!(
+                "Rejecting uplink for service '{}': no primary Connector of its link group (conn={:?})",
+                service_id,
+                conn_id
+            );
+            self.send_registration_nack(conn_id, service_id.as_bytes(), REG_STATUS_NO_PRIMARY);
+            self.metrics
+                .registration_rejections_total
+                .fetch_add(1, Ordering::Relaxed);
+            return Ok(());
+        }
+
         // Update client type
         if let Some(client) = self.clients.get_mut(conn_id) {
             client.client_type = Some(client_type.clone());
             client.registered_id = Some(service_id.clone());
+            client.aggregate = flags & aggregate::REG_FLAG_AGGREGATE != 0;
+            if let Some(ref qlog) = self.qlog {
+                if qlog.matches_service(&service_id) {
+                    client.start_qlog(qlog, "service");
+                }
+            }
         }
 
-        // Register in routing table
-        self.registry
-            .register(conn_id.clone(), client_type, service_id.clone());
+        // Register in routing table (uplinks are already in)
+        let is_agent = matches!(client_type, ClientType::Agent);
+        if !is_agent {
+            if !is_uplink {
+                self.registry.register_connector(
+                    conn_id.clone(),
+                    service_id.clone(),
+                    link_group,
+                    flags & REG_FLAGS_END_TO_END,
+                );
+            }
+        } else {
+            self.registry
+                .register(conn_id.clone(), client_type, service_id.clone());
+        }
 
-        // 8A.2: Send ACK after successful registration
-        self.send_registration_ack(conn_id, &service_id);
+        // 8A.2: Send ACK after successful registration. Agents learn whether
+        // their Connector decompresses headers and decodes FEC; a new
+        // primary Connector may change that for Agents already registered.
+        if is_agent {
+            let ack_flags =
+                aggregate::REG_FLAG_AGGREGATE | self.registry.connector_flags(&service_id);
+            self.send_registration_ack(conn_id, &service_id, ack_flags);
+        } else {
+            self.send_registration_ack(conn_id, &service_id, aggregate::REG_FLAG_AGGREGATE);
+            if !is_uplink {
+                self.refresh_agent_flags(&service_id);
+            }
+        }
         self.metrics
             .registrations_total
             .fetch_add(1, Ordering::Relaxed);
@@ -1242,15 +1686,36 @@ impl Server {
         Ok(())
     }
 
+    /// Re-send the ACK to every Agent of a service whose primary Connector
+    /// registered, was replaced, or went away, so they stop compressing
+    /// headers or FEC-encoding for a Connector that cannot undo it
+    fn refresh_agent_flags(&mut self, service_id: &str) {
+        let ack_flags = aggregate::REG_FLAG_AGGREGATE | self.registry.connector_flags(service_id);
+        for agent in self.registry.agents_for_service(service_id) {
+            self.send_registration_ack(&agent, service_id, ack_flags);
+        }
+    }
+
     /// 8A.2: Send registration ACK to client
-    /// Wire format: [0x12, status(0x00=ok), id_len, service_id_bytes...]
-    fn send_registration_ack(&mut self, conn_id: &quiche::ConnectionId<'static>, service_id: &str) {
+    /// Wire format: [0x12, status(0x00=ok), id_len, service_id_bytes..., flags]
+    ///
+    /// `flags` lists what the server accepts (`aggregate::REG_FLAG_AGGREGATE`)
+    /// and, for Agents, whether the service's Connector decompresses headers
+    /// (`REG_FLAG_HEADER_COMPRESSION`) or decodes FEC (`REG_FLAG_FEC`).
+    /// Clients that predate it ignore the trailing byte.
+    fn send_registration_ack(
+        &mut self,
+        conn_id: &quiche::ConnectionId<'static>,
+        service_id: &str,
+        flags: u8,
+    ) {
         let id_bytes = service_id.as_bytes();
-        let mut msg = Vec::with_capacity(3 + id_bytes.len());
+        let mut msg = Vec::with_capacity(4 + id_bytes.len());
         msg.push(REG_TYPE_ACK);
         msg.push(0x00); // status: success
         msg.push(id_bytes.len() as u8);
         msg.extend_from_slice(id_bytes);
+        msg.push(flags);
 
         if let Some(client) = self.clients.get_mut(conn_id) {
             match client.conn.dgram_send(&msg) {
@@ -1270,7 +1735,8 @@ impl Server {
 
     /// 8A.2: Send registration NACK to client
     /// Wire format: [0x13, status, id_len, service_id_bytes...]
-    /// Status codes: 0x01 = invalid request, 0x02 = auth denied
+    /// Status codes: 0x01 = invalid request, 0x02 = auth denied,
+    /// 0x03 = uplink without a primary of its link group
     fn send_registration_nack(
         &mut self,
         conn_id: &quiche::ConnectionId<'static>,
@@ -1312,18 +1778,29 @@ impl Server {
             }
             None => {
                 log::warn!("No destination for relay from {:?}", from_conn_id);
+                self.account_traffic(
+                    from_conn_id,
+                    self.registry.service_of(from_conn_id),
+                    dgram.len(),
+                    false,
+                );
                 return Ok(());
             }
         };
 
         // Forward the datagram
+        let mut relayed = false;
         if let Some(dest_client) = self.clients.get_mut(&dest_conn_id) {
             log::debug!(
                 "Destination connection established: {}",
                 dest_client.conn.is_established()
             );
-            match dest_client.conn.dgram_send(dgram) {
-                Ok(_) => {
+            match dest_client.send_tunneled(dgram) {
+                Ok(packed) => {
+                    relayed = true;
+                    self.metrics
+                        .aggregated_packets_total
+                        .fetch_add(packed as u64, Ordering::Relaxed);
                     self.metrics
                         .datagrams_relayed_total
                         .fetch_add(1, Ordering::Relaxed);
@@ -1338,7 +1815,17 @@ impl Server {
                     );
                 }
                 Err(e) => {
-                    log::error!("Failed to relay datagram: {:?}", e);
+                    self.metrics
+                        .aggregated_packets_total
+                        .fetch_add(e.packed as u64, Ordering::Relaxed);
+                    if e.error == quiche::Error::Done {
+                        self.metrics
+                            .datagrams_shed_total
+                            .fetch_add(e.failed as u64, Ordering::Relaxed);
+                        log::debug!("Relay queue to {:?} full, datagram dropped", dest_conn_id);
+                    } else {
+                        log::error!("Failed to relay datagram: {:?}", e.error);
+                    }
                 }
             }
         } else {
@@ -1347,6 +1834,12 @@ impl Server {
                 dest_conn_id
             );
         }
+        self.account_traffic(
+            from_conn_id,
+            self.registry.service_of(from_conn_id),
+            dgram.len(),
+            relayed,
+        );
 
         Ok(())
     }
@@ -1391,6 +1884,7 @@ impl Server {
                 from_conn_id,
                 service_id
             );
+            self.account_traffic(from_conn_id, Some(&service_id), ip_packet.len(), false);
             return Ok(());
         }
 
@@ -1401,22 +1895,28 @@ impl Server {
             from_conn_id
         );
 
-        // Find Connector for this service
-        let dest_conn_id = match self.registry.find_connector_for_service(&service_id) {
+        // Find the Connector link carrying this Agent's traffic
+        let dest_conn_id = match self.registry.find_connector_link(&service_id, from_conn_id) {
             Some(id) => {
                 log::debug!("Routing to Connector {:?} for service '{}'", id, service_id);
                 id
             }
             None => {
                 log::warn!("No Connector registered for service '{}'", service_id);
+                self.account_traffic(from_conn_id, Some(&service_id), ip_packet.len(), false);
                 return Ok(());
             }
         };
 
         // Forward the unwrapped IP packet (Connector doesn't need the service wrapper)
+        let mut relayed = false;
         if let Some(dest_client) = self.clients.get_mut(&dest_conn_id) {
-            match dest_client.conn.dgram_send(ip_packet) {
-                Ok(_) => {
+            match dest_client.send_tunneled(ip_packet) {
+                Ok(packed) => {
+                    relayed = true;
+                    self.metrics
+                        .aggregated_packets_total
+                        .fetch_add(packed as u64, Ordering::Relaxed);
                     self.metrics
                         .datagrams_relayed_total
                         .fetch_add(1, Ordering::Relaxed);
@@ -1432,7 +1932,17 @@ impl Server {
                     );
                 }
                 Err(e) => {
-                    log::error!("Failed to relay service datagram: {:?}", e);
+                    self.metrics
+                        .aggregated_packets_total
+                        .fetch_add(e.packed as u64, Ordering::Relaxed);
+                    if e.error == quiche::Error::Done {
+                        self.metrics
+                            .datagrams_shed_total
+                            .fetch_add(e.failed as u64, Ordering::Relaxed);
+                        log::debug!("Relay queue to {:?} full, datagram dropped", dest_conn_id);
+                    } else {
+                        log::error!("Failed to relay service datagram: {:?}", e.error);
+                    }
                 }
             }
         } else {
@@ -1442,6 +1952,7 @@ impl Server {
                 service_id
             );
         }
+        self.account_traffic(from_conn_id, Some(&service_id), ip_packet.len(), relayed);
 
         Ok(())
     }
@@ -1891,11 +2402,48 @@ impl Server {
         }
     }
 
+    /// Send what quiche has queued, honouring its pacing: a packet whose
+    /// `SendInfo::at` is in the future is held (and the connection paused)
+    /// until the event loop wakes for it.
     fn send_pending(&mut self) -> Result<(), Box<dyn std::error::Error>> {
+        let release_by = Instant::now() + PACING_GRANULARITY;
         for client in self.clients.values_mut() {
+            // Packets relayed this iteration share DATAGRAMs where possible
+            if !client.batch.is_empty() {
+                match client.flush_tunneled() {
+                    Ok(packed) => {
+                        self.metrics
+                            .aggregated_packets_total
+                            .fetch_add(packed as u64, Ordering::Relaxed);
+                    }
+                    Err(e) => {
+                        if e.error == quiche::Error::Done {
+                            self.metrics
+                                .datagrams_shed_total
+                                .fetch_add(e.failed as u64, Ordering::Relaxed);
+                        }
+                        log::debug!("Failed to send aggregate DATAGRAM: {:?}", e.error);
+                    }
+                }
+            }
+            if let Some(ref held) = client.paced {
+                if held.at > release_by {
+                    continue;
+                }
+                self.socket.send_to(&held.data, held.to)?;
+                client.paced = None;
+            }
             loop {
                 match client.conn.send(&mut self.send_buf) {
                     Ok((len, send_info)) => {
+                        if send_info.at > release_by {
+                            client.paced = Some(PacedPacket {
+                                at: send_info.at,
+                                to: send_info.to,
+                                data: self.send_buf[..len].to_vec(),
+                            });
+                            break;
+                        }
                         log::trace!("Sending {} bytes to {:?}", len, send_info.to);
                         self.socket.send_to(&self.send_buf[..len], send_info.to)?;
                     }
@@ -1921,8 +2469,15 @@ impl Server {
         let removed_count = closed.len() as u64;
         for conn_id in closed {
             log::info!("Connection closed: {:?}", conn_id);
-            self.registry.unregister(&conn_id);
-            self.clients.remove(&conn_id);
+            let lost_primary = self.registry.unregister(&conn_id);
+            if let Some(client) = self.clients.remove(&conn_id) {
+                if client.handshake_pending {
+                    self.admission.handshake_finished();
+                }
+            }
+            if let Some(service_id) = lost_primary {
+                self.refresh_agent_flags(&service_id);
+            }
             // 8B.2: Remove any CID aliases pointing to this connection
             self.cid_aliases
                 .retain(|_, canonical| *canonical != conn_id);
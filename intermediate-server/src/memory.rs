@@ -0,0 +1,181 @@
+//! Per-connection memory budget
+//!
+//! Each connection can make quiche buffer up to its connection receive
+//! window of stream data, plus a DATAGRAM receive and send queue. Fixed 10 MB
+//! windows and 1000-slot queues commit over 100 GB at 10k connections, so the
+//! server sizes both from a global budget instead:
+//!
+//! - Receive windows start small and quiche auto-tunes them: a window the
+//!   peer fills within two RTTs is doubled, up to a ceiling, so it settles
+//!   near the path's bandwidth-delay product.
+//! - Ceilings and queue lengths come from a tier. Tier 0 is the full
+//!   allotment and each tier above halves it (down to a floor). The server
+//!   uses the lowest tier whose worst case, times the connection count, fits
+//!   the budget.
+//! - DATAGRAMs relayed to a client are capped at about two congestion
+//!   windows (the measured BDP) within the tier's queue length. More than
+//!   that only adds queueing delay.
+//!
+//! Credit already granted to a peer cannot be taken back, so a tier change
+//! affects windows of new connections only; relay queue caps apply to all.
+
+/// Tier 0 allotment
+const INITIAL_CONNECTION_WINDOW: u64 = 1024 * 1024;
+const INITIAL_STREAM_WINDOW: u64 = 256 * 1024;
+const MAX_CONNECTION_WINDOW: u64 = 8 * 1024 * 1024;
+const MAX_STREAM_WINDOW: u64 = 4 * 1024 * 1024;
+const DGRAM_QUEUE_LEN: usize = 1000;
+
+/// Floors: enough for signaling streams and a few RTTs of DATAGRAMs
+const MIN_CONNECTION_WINDOW: u64 = 64 * 1024;
+const MIN_STREAM_WINDOW: u64 = 32 * 1024;
+const MIN_DGRAM_QUEUE_LEN: usize = 32;
+
+/// Tier at which every limit has reached its floor
+pub const MAX_TIER: u32 = 7;
+
+/// Flow-control and DATAGRAM queue limits for one connection
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Allotment {
+    pub initial_window: u64,
+    pub initial_stream_window: u64,
+    pub max_window: u64,
+    pub max_stream_window: u64,
+    pub dgram_queue_len: usize,
+}
+
+impl Allotment {
+    /// Tier 0 limits halved `tier` times, never below the floors
+    pub fn at_tier(tier: u32) -> Self {
+        let tier = tier.min(MAX_TIER);
+        let max_window = (MAX_CONNECTION_WINDOW >> tier).max(MIN_CONNECTION_WINDOW);
+        let max_stream_window = (MAX_STREAM_WINDOW >> tier).max(MIN_STREAM_WINDOW);
+        Allotment {
+            initial_window: INITIAL_CONNECTION_WINDOW.min(max_window),
+            initial_stream_window: INITIAL_STREAM_WINDOW.min(max_stream_window),
+            max_window,
+            max_stream_window,
+            dgram_queue_len: (DGRAM_QUEUE_LEN >> tier).max(MIN_DGRAM_QUEUE_LEN),
+        }
+    }
+
+    /// Most a connection can hold: a full receive window and both DATAGRAM
+    /// queues full of `max_dgram`-byte datagrams
+    pub fn worst_case_bytes(&self, max_dgram: usize) -> u64 {
+        self.max_window + 2 * (self.dgram_queue_len * max_dgram) as u64
+    }
+
+    pub fn apply(&self, config: &mut quiche::Config) {
+        config.enable_dgram(true, self.dgram_queue_len, self.dgram_queue_len);
+        config.set_initial_max_data(self.initial_window);
+        config.set_initial_max_stream_data_bidi_local(self.initial_stream_window);
+        config.set_initial_max_stream_data_bidi_remote(self.initial_stream_window);
+        config.set_max_connection_window(self.max_window);
+        config.set_max_stream_window(self.max_stream_window);
+    }
+}
+
+impl std::fmt::Display for Allotment {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(
+            f,
+            "window {}-{} KiB, stream {}-{} KiB, {} DATAGRAMs queued",
+            self.initial_window / 1024,
+            self.max_window / 1024,
+            self.initial_stream_window / 1024,
+            self.max_stream_window / 1024,
+            self.dgram_queue_len
+        )
+    }
+}
+
+/// Global budget shared by all connections
+#[derive(Debug, Clone, Copy)]
+pub struct MemoryBudget {
+    total_bytes: u64,
+    max_dgram: usize,
+}
+
+impl MemoryBudget {
+    pub fn new(total_bytes: u64, max_dgram: usize) -> Self {
+        MemoryBudget {
+            total_bytes,
+            max_dgram,
+        }
+    }
+
+    /// Lowest tier whose worst case fits `connections` in the budget
+    /// (`MAX_TIER` when even the floors do not)
+    pub fn tier_for(&self, connections: usize) -> u32 {
+        let connections = connections.max(1) as u64;
+        (0..MAX_TIER)
+            .find(|&tier| {
+                Allotment::at_tier(tier)
+                    .worst_case_bytes(self.max_dgram)
+                    .saturating_mul(connections)
+                    <= self.total_bytes
+            })
+            .unwrap_or(MAX_TIER)
+    }
+}
+
+/// DATAGRAMs worth queueing towards a client whose congestion window is
+/// `cwnd` bytes: two windows' worth, within the floor and `tier_limit`
+pub fn relay_queue_limit(cwnd: usize, max_dgram: usize, tier_limit: usize) -> usize {
+    (2 * cwnd / max_dgram.max(1)).clamp(MIN_DGRAM_QUEUE_LEN, tier_limit.max(MIN_DGRAM_QUEUE_LEN))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_tiers_halve_to_floor() {
+        let t0 = Allotment::at_tier(0);
+        assert_eq!(t0.max_window, MAX_CONNECTION_WINDOW);
+        assert_eq!(t0.dgram_queue_len, DGRAM_QUEUE_LEN);
+
+        let t1 = Allotment::at_tier(1);
+        assert_eq!(t1.max_window, MAX_CONNECTION_WINDOW / 2);
+        assert_eq!(t1.dgram_queue_len, DGRAM_QUEUE_LEN / 2);
+
+        let floor = Allotment::at_tier(MAX_TIER);
+        assert_eq!(floor.max_window, MIN_CONNECTION_WINDOW);
+        assert_eq!(floor.max_stream_window, MIN_STREAM_WINDOW);
+        assert_eq!(floor.dgram_queue_len, MIN_DGRAM_QUEUE_LEN);
+        assert_eq!(floor.initial_window, MIN_CONNECTION_WINDOW);
+        assert_eq!(Allotment::at_tier(MAX_TIER + 3), floor);
+    }
+
+    #[test]
+    fn test_tier_for_connection_count() {
+        let total = 2048 * 1024 * 1024;
+        let budget = MemoryBudget::new(total, 1472);
+        assert_eq!(budget.tier_for(0), 0);
+        assert_eq!(budget.tier_for(10), 0);
+
+        // Tiers rise with load and each chosen tier fits the budget
+        let mut last = 0;
+        for n in [100, 1_000, 5_000, 10_000] {
+            let tier = budget.tier_for(n);
+            assert!(tier >= last);
+            let worst = Allotment::at_tier(tier).worst_case_bytes(1472) * n as u64;
+            assert!(worst <= total, "{} connections", n);
+            last = tier;
+        }
+        assert!(last > 0);
+
+        // Beyond what the floors fit, stay at the floor
+        assert_eq!(budget.tier_for(1_000_000), MAX_TIER);
+    }
+
+    #[test]
+    fn test_relay_queue_limit_tracks_cwnd() {
+        // Initial window of 10 packets: floor
+        assert_eq!(relay_queue_limit(14_720, 1472, 1000), MIN_DGRAM_QUEUE_LEN);
+        // 1 MB window: two windows of datagrams
+        assert_eq!(relay_queue_limit(1_472_000, 1472, 4000), 2000);
+        // Capped by the tier
+        assert_eq!(relay_queue_limit(1_472_000, 1472, 250), 250);
+    }
+}
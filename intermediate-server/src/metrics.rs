@@ -4,8 +4,11 @@
 //! Prometheus text exposition format for scraping on the metrics HTTP endpoint.
 
 use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Mutex;
 use std::time::Instant;
 
+use crate::traffic::TrafficAccounting;
+
 /// Lightweight Prometheus-compatible metrics for the Intermediate Server.
 pub struct Metrics {
     /// Total active QUIC connections (gauge)
@@ -18,14 +21,32 @@ pub struct Metrics {
     pub registration_rejections_total: AtomicU64,
     /// Total DATAGRAMs relayed (counter)
     pub datagrams_relayed_total: AtomicU64,
+    /// Relayed packets sent packed inside aggregate DATAGRAMs (counter)
+    pub aggregated_packets_total: AtomicU64,
+    /// Relayed DATAGRAMs dropped on a full relay queue (counter)
+    pub datagrams_shed_total: AtomicU64,
+    /// Memory budget tier new connections are sized for (gauge)
+    pub memory_tier: AtomicU64,
     /// Total P2P signaling sessions created (counter)
     pub signaling_sessions_total: AtomicU64,
     /// Total retry tokens validated successfully (counter)
     pub retry_tokens_validated: AtomicU64,
     /// Total retry token validation failures (counter)
     pub retry_token_failures: AtomicU64,
+    /// Initials dropped by the per-prefix rate limit (counter)
+    pub initials_rate_limited_total: AtomicU64,
+    /// Initials dropped at the handshake concurrency limit (counter)
+    pub initials_overload_dropped_total: AtomicU64,
+    /// Handshakes accepted but not yet established (gauge)
+    pub handshakes_pending: AtomicU64,
+    /// Client certificates answered from the identity cache (counter)
+    pub identity_cache_hits_total: AtomicU64,
+    /// Client certificates parsed because the cache missed (counter)
+    pub identity_cache_misses_total: AtomicU64,
     /// Server start time (for uptime calculation)
     pub start_time: Instant,
+    /// Per-service and per-identity top-K traffic (labelled series)
+    pub traffic: Mutex<TrafficAccounting>,
 }
 
 impl Metrics {
@@ -36,16 +57,26 @@ impl Metrics {
             registrations_total: AtomicU64::new(0),
             registration_rejections_total: AtomicU64::new(0),
             datagrams_relayed_total: AtomicU64::new(0),
+            aggregated_packets_total: AtomicU64::new(0),
+            datagrams_shed_total: AtomicU64::new(0),
+            memory_tier: AtomicU64::new(0),
             signaling_sessions_total: AtomicU64::new(0),
             retry_tokens_validated: AtomicU64::new(0),
             retry_token_failures: AtomicU64::new(0),
+            initials_rate_limited_total: AtomicU64::new(0),
+            initials_overload_dropped_total: AtomicU64::new(0),
+            handshakes_pending: AtomicU64::new(0),
+            identity_cache_hits_total: AtomicU64::new(0),
+            identity_cache_misses_total: AtomicU64::new(0),
             start_time: Instant::now(),
+            traffic: Mutex::new(TrafficAccounting::new()),
         }
     }
 
     /// Render metrics in Prometheus text exposition format.
     pub fn render(&self) -> String {
         let uptime = self.start_time.elapsed().as_secs();
+        let traffic = self.traffic.lock().map(|t| t.render()).unwrap_or_default();
         format!(
             "# HELP ztna_active_connections Current number of active QUIC connections\n\
              # TYPE ztna_active_connections gauge\n\
@@ -62,6 +93,15 @@ impl Metrics {
              # HELP ztna_datagrams_relayed_total Total DATAGRAMs relayed\n\
              # TYPE ztna_datagrams_relayed_total counter\n\
              ztna_datagrams_relayed_total {}\n\
+             # HELP ztna_aggregated_packets_total Relayed packets sent packed inside aggregate DATAGRAMs\n\
+             # TYPE ztna_aggregated_packets_total counter\n\
+             ztna_aggregated_packets_total {}\n\
+             # HELP ztna_datagrams_shed_total Relayed DATAGRAMs dropped on a full relay queue\n\
+             # TYPE ztna_datagrams_shed_total counter\n\
+             ztna_datagrams_shed_total {}\n\
+             # HELP ztna_memory_tier Memory budget tier for new connections (0 = full allotment)\n\
+             # TYPE ztna_memory_tier gauge\n\
+             ztna_memory_tier {}\n\
              # HELP ztna_signaling_sessions_total Total P2P signaling sessions created\n\
              # TYPE ztna_signaling_sessions_total counter\n\
              ztna_signaling_sessions_total {}\n\
@@ -71,18 +111,43 @@ impl Metrics {
              # HELP ztna_retry_token_failures Total retry token validation failures\n\
              # TYPE ztna_retry_token_failures counter\n\
              ztna_retry_token_failures {}\n\
+             # HELP ztna_initials_rate_limited_total Initials dropped by the per-prefix rate limit\n\
+             # TYPE ztna_initials_rate_limited_total counter\n\
+             ztna_initials_rate_limited_total {}\n\
+             # HELP ztna_initials_overload_dropped_total Initials dropped at the handshake concurrency limit\n\
+             # TYPE ztna_initials_overload_dropped_total counter\n\
+             ztna_initials_overload_dropped_total {}\n\
+             # HELP ztna_handshakes_pending Handshakes accepted but not yet established\n\
+             # TYPE ztna_handshakes_pending gauge\n\
+             ztna_handshakes_pending {}\n\
+             # HELP ztna_identity_cache_hits_total Client certificates answered from the identity cache\n\
+             # TYPE ztna_identity_cache_hits_total counter\n\
+             ztna_identity_cache_hits_total {}\n\
+             # HELP ztna_identity_cache_misses_total Client certificates parsed on an identity cache miss\n\
+             # TYPE ztna_identity_cache_misses_total counter\n\
+             ztna_identity_cache_misses_total {}\n\
              # HELP ztna_uptime_seconds Server uptime in seconds\n\
              # TYPE ztna_uptime_seconds gauge\n\
-             ztna_uptime_seconds {}\n",
+             ztna_uptime_seconds {}\n\
+             {}",
             self.active_connections.load(Ordering::Relaxed),
             self.relay_bytes_total.load(Ordering::Relaxed),
             self.registrations_total.load(Ordering::Relaxed),
             self.registration_rejections_total.load(Ordering::Relaxed),
             self.datagrams_relayed_total.load(Ordering::Relaxed),
+            self.aggregated_packets_total.load(Ordering::Relaxed),
+            self.datagrams_shed_total.load(Ordering::Relaxed),
+            self.memory_tier.load(Ordering::Relaxed),
             self.signaling_sessions_total.load(Ordering::Relaxed),
             self.retry_tokens_validated.load(Ordering::Relaxed),
             self.retry_token_failures.load(Ordering::Relaxed),
+            self.initials_rate_limited_total.load(Ordering::Relaxed),
+            self.initials_overload_dropped_total.load(Ordering::Relaxed),
+            self.handshakes_pending.load(Ordering::Relaxed),
+            self.identity_cache_hits_total.load(Ordering::Relaxed),
+            self.identity_cache_misses_total.load(Ordering::Relaxed),
             uptime,
+            traffic,
         )
     }
 }
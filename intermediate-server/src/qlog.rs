@@ -0,0 +1,415 @@
+//! Sampled qlog capture for the Intermediate Server
+//!
+//! qlog is opt-in (`--qlog-dir`) and per connection. A connection is captured
+//! when it is picked by 1-in-N sampling at accept time, when its mTLS identity
+//! is listed, or when it registers for a listed service. The last two start
+//! mid-connection, so their traces begin after the handshake.
+//!
+//! Each captured connection streams JSON-SEQ records into its own files in
+//! the qlog directory. Files rotate at `max_file_bytes`, and every part starts
+//! with a copy of the qlog header so it loads on its own. All files share one
+//! `max_total_bytes` budget: when it is exhausted the oldest finished files
+//! are deleted, and if only live files remain new records are dropped.
+
+use std::collections::{HashSet, VecDeque};
+use std::fs::{self, File};
+use std::io::{self, BufWriter, Write};
+use std::path::PathBuf;
+use std::sync::{Arc, Mutex};
+use std::time::{SystemTime, UNIX_EPOCH};
+
+/// Default size at which a connection's qlog file is rotated
+pub const DEFAULT_MAX_FILE_BYTES: u64 = 16 * 1024 * 1024;
+
+/// Default byte budget for all qlog files on disk
+pub const DEFAULT_MAX_TOTAL_BYTES: u64 = 256 * 1024 * 1024;
+
+/// qlog capture settings
+#[derive(Debug, Clone)]
+pub struct QlogConfig {
+    /// Directory the `.sqlog` files are written to
+    pub dir: PathBuf,
+    /// Capture one in every N new connections (0 = no random sampling)
+    pub sample_one_in: u64,
+    /// mTLS common names whose connections are always captured
+    pub identities: HashSet<String>,
+    /// Service IDs whose registering connections are always captured
+    pub services: HashSet<String>,
+    pub max_file_bytes: u64,
+    pub max_total_bytes: u64,
+}
+
+/// Disk usage shared by every open qlog writer
+struct Budget {
+    max_total_bytes: u64,
+    total_bytes: u64,
+    /// Rotated or finished files, oldest first
+    closed: VecDeque<(PathBuf, u64)>,
+    dropped_bytes: u64,
+}
+
+impl Budget {
+    /// Account for `len` more bytes, deleting the oldest finished files if
+    /// needed. Returns false if the bytes do not fit and must be dropped.
+    fn reserve(&mut self, len: u64) -> bool {
+        while self.total_bytes + len > self.max_total_bytes {
+            match self.closed.pop_front() {
+                Some((path, size)) => {
+                    if let Err(e) = fs::remove_file(&path) {
+                        log::debug!("qlog: failed to remove {}: {}", path.display(), e);
+                    }
+                    self.total_bytes -= size;
+                }
+                None => break,
+            }
+        }
+
+        if self.total_bytes + len > self.max_total_bytes {
+            if self.dropped_bytes == 0 {
+                log::warn!(
+                    "qlog: byte budget of {} exhausted by live connections, dropping records",
+                    self.max_total_bytes
+                );
+            }
+            self.dropped_bytes += len;
+            return false;
+        }
+        self.total_bytes += len;
+        true
+    }
+
+    fn close(&mut self, path: PathBuf, size: u64) {
+        self.closed.push_back((path, size));
+    }
+}
+
+/// Decides which connections are captured and hands out their writers
+pub struct QlogCapture {
+    config: QlogConfig,
+    budget: Arc<Mutex<Budget>>,
+    /// Connections offered to `sample_connection` since the last one sampled
+    seen: u64,
+}
+
+impl QlogCapture {
+    pub fn new(config: QlogConfig) -> io::Result<Self> {
+        fs::create_dir_all(&config.dir)?;
+        let budget = Budget {
+            max_total_bytes: config.max_total_bytes,
+            total_bytes: 0,
+            closed: VecDeque::new(),
+            dropped_bytes: 0,
+        };
+        Ok(QlogCapture {
+            config,
+            budget: Arc::new(Mutex::new(budget)),
+            seen: 0,
+        })
+    }
+
+    /// Called once per accepted connection; true for one in every N
+    pub fn sample_connection(&mut self) -> bool {
+        if self.config.sample_one_in == 0 {
+            return false;
+        }
+        self.seen += 1;
+        if self.seen < self.config.sample_one_in {
+            return false;
+        }
+        self.seen = 0;
+        true
+    }
+
+    pub fn matches_identity(&self, common_name: &str) -> bool {
+        self.config.identities.contains(common_name)
+    }
+
+    pub fn matches_service(&self, service_id: &str) -> bool {
+        self.config.services.contains(service_id)
+    }
+
+    /// Start streaming qlog for `conn`; `reason` ends up in the trace description
+    pub fn attach(&self, conn: &mut quiche::Connection, reason: &str) {
+        let trace_id = conn.trace_id().to_string();
+        let writer = self.writer(&trace_id);
+        log::info!(
+            "qlog: capturing {} ({}) to {}",
+            trace_id,
+            reason,
+            writer.stem.display()
+        );
+        conn.set_qlog(
+            Box::new(writer),
+            "ztna intermediate-server".to_string(),
+            format!("{} sampled by {}", trace_id, reason),
+        );
+    }
+
+    fn writer(&self, trace_id: &str) -> QlogWriter {
+        let secs = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .map(|d| d.as_secs())
+            .unwrap_or(0);
+        QlogWriter {
+            stem: self.config.dir.join(format!("{}-{}", secs, trace_id)),
+            part: 0,
+            file: None,
+            file_bytes: 0,
+            max_file_bytes: self.config.max_file_bytes,
+            pending: Vec::new(),
+            header: None,
+            budget: Arc::clone(&self.budget),
+        }
+    }
+}
+
+/// Per-connection qlog sink handed to quiche
+///
+/// quiche may emit a record in several `write` calls; records are buffered
+/// up to their terminating newline so rotation never splits one. Parts are
+/// written through a `BufWriter`, so a record costs a `write(2)` only when
+/// the buffer fills, the part rotates or the writer is flushed or dropped.
+pub struct QlogWriter {
+    /// Path prefix; parts are `<stem>.<part>.sqlog`
+    stem: PathBuf,
+    part: u32,
+    file: Option<BufWriter<File>>,
+    file_bytes: u64,
+    max_file_bytes: u64,
+    /// Incomplete record
+    pending: Vec<u8>,
+    /// First record written (the qlog header), repeated at the top of each part
+    header: Option<Vec<u8>>,
+    budget: Arc<Mutex<Budget>>,
+}
+
+impl QlogWriter {
+    fn part_path(&self) -> PathBuf {
+        let mut path = self.stem.clone().into_os_string();
+        path.push(format!(".{}.sqlog", self.part));
+        PathBuf::from(path)
+    }
+
+    /// Finish the current part and hand it to the budget for eviction
+    fn close_part(&mut self) {
+        if let Some(mut file) = self.file.take() {
+            let _ = file.flush();
+            let path = self.part_path();
+            if let Ok(mut budget) = self.budget.lock() {
+                budget.close(path, self.file_bytes);
+            }
+            self.part += 1;
+            self.file_bytes = 0;
+        }
+    }
+
+    fn write_record(&mut self, record: &[u8]) -> io::Result<()> {
+        if self.header.is_none() {
+            self.header = Some(record.to_vec());
+        }
+
+        if self.file.is_some() && self.file_bytes + record.len() as u64 > self.max_file_bytes {
+            self.close_part();
+        }
+
+        let mut budget = self
+            .budget
+            .lock()
+            .map_err(|_| io::Error::other("qlog budget poisoned"))?;
+
+        if self.file.is_none() {
+            let mut file = BufWriter::new(File::create(self.part_path())?);
+            if self.part > 0 {
+                if let Some(ref header) = self.header {
+                    if budget.reserve(header.len() as u64) {
+                        file.write_all(header)?;
+                        self.file_bytes += header.len() as u64;
+                    }
+                }
+            }
+            self.file = Some(file);
+        }
+
+        if budget.reserve(record.len() as u64) {
+            if let Some(ref mut file) = self.file {
+                file.write_all(record)?;
+                self.file_bytes += record.len() as u64;
+            }
+        }
+        Ok(())
+    }
+}
+
+impl Write for QlogWriter {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        self.pending.extend_from_slice(buf);
+
+        // Write complete records straight out of `pending`, then shift the
+        // incomplete tail down in place
+        let pending = std::mem::take(&mut self.pending);
+        let mut start = 0;
+        while let Some(len) = pending[start..].iter().position(|&b| b == b'\n') {
+            let end = start + len + 1;
+            // A qlog I/O error must never reach the connection
+            if let Err(e) = self.write_record(&pending[start..end]) {
+                log::debug!("qlog: write to {} failed: {}", self.stem.display(), e);
+            }
+            start = end;
+        }
+        self.pending = pending;
+        self.pending.drain(..start);
+
+        // A record longer than a whole file can never be written
+        if self.pending.len() as u64 > self.max_file_bytes {
+            self.pending.clear();
+        }
+        Ok(buf.len())
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        match self.file {
+            Some(ref mut file) => file.flush(),
+            None => Ok(()),
+        }
+    }
+}
+
+impl Drop for QlogWriter {
+    fn drop(&mut self) {
+        self.close_part();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn test_config(name: &str, max_file_bytes: u64, max_total_bytes: u64) -> QlogConfig {
+        let dir = std::env::temp_dir().join(format!("ztna-qlog-{}-{}", name, std::process::id()));
+        let _ = fs::remove_dir_all(&dir);
+        QlogConfig {
+            dir,
+            sample_one_in: 0,
+            identities: HashSet::new(),
+            services: HashSet::new(),
+            max_file_bytes,
+            max_total_bytes,
+        }
+    }
+
+    fn record(i: usize) -> Vec<u8> {
+        format!(
+            "\x1e{{\"time\":{},\"name\":\"transport:packet_sent\"}}\n",
+            i
+        )
+        .into_bytes()
+    }
+
+    fn sqlog_files(dir: &PathBuf) -> Vec<PathBuf> {
+        let mut files: Vec<PathBuf> = fs::read_dir(dir)
+            .unwrap()
+            .map(|e| e.unwrap().path())
+            .collect();
+        files.sort();
+        files
+    }
+
+    #[test]
+    fn test_sampling_one_in_n() {
+        let mut config = test_config("sample", 1024, 4096);
+        config.sample_one_in = 3;
+        let mut capture = QlogCapture::new(config.clone()).unwrap();
+        let picked: Vec<bool> = (0..6).map(|_| capture.sample_connection()).collect();
+        assert_eq!(picked, vec![false, false, true, false, false, true]);
+
+        config.sample_one_in = 0;
+        let mut capture = QlogCapture::new(config.clone()).unwrap();
+        assert!(!(0..10).any(|_| capture.sample_connection()));
+        fs::remove_dir_all(&config.dir).unwrap();
+    }
+
+    #[test]
+    fn test_identity_and_service_match() {
+        let mut config = test_config("match", 1024, 4096);
+        config.identities.insert("agent-7".to_string());
+        config.services.insert("echo-service".to_string());
+        let capture = QlogCapture::new(config.clone()).unwrap();
+        assert!(capture.matches_identity("agent-7"));
+        assert!(!capture.matches_identity("agent-8"));
+        assert!(capture.matches_service("echo-service"));
+        assert!(!capture.matches_service("web-app"));
+        fs::remove_dir_all(&config.dir).unwrap();
+    }
+
+    #[test]
+    fn test_rotation_repeats_header_and_keeps_records_whole() {
+        let config = test_config("rotate", 200, 1 << 20);
+        let capture = QlogCapture::new(config.clone()).unwrap();
+        {
+            let mut writer = capture.writer("abcd");
+            writer
+                .write_all(b"\x1e{\"qlog_version\":\"0.3\"}\n")
+                .unwrap();
+            for i in 0..20 {
+                // Split every record across two writes
+                let r = record(i);
+                writer.write_all(&r[..10]).unwrap();
+                writer.write_all(&r[10..]).unwrap();
+            }
+        }
+
+        let files = sqlog_files(&config.dir);
+        assert!(files.len() > 1);
+        let mut seen = 0;
+        for path in &files {
+            let contents = fs::read_to_string(path).unwrap();
+            assert!(contents.len() <= 200);
+            assert!(contents.starts_with("\x1e{\"qlog_version\""));
+            for line in contents.lines().skip(1) {
+                assert!(line.starts_with("\x1e{\"time\":") && line.ends_with('}'));
+                seen += 1;
+            }
+        }
+        assert_eq!(seen, 20);
+        fs::remove_dir_all(&config.dir).unwrap();
+    }
+
+    #[test]
+    fn test_budget_evicts_oldest_files() {
+        let config = test_config("budget", 100, 300);
+        let capture = QlogCapture::new(config.clone()).unwrap();
+        for conn in 0..10 {
+            let mut writer = capture.writer(&format!("conn{:02}", conn));
+            writer.write_all(&record(conn)).unwrap();
+            writer.write_all(&record(conn)).unwrap();
+        }
+
+        let files = sqlog_files(&config.dir);
+        let total: u64 = files.iter().map(|f| fs::metadata(f).unwrap().len()).sum();
+        assert!(total <= 300);
+        // The newest connection survives, the oldest was evicted
+        let names: Vec<String> = files
+            .iter()
+            .map(|f| f.file_name().unwrap().to_string_lossy().into_owned())
+            .collect();
+        assert!(names.iter().any(|n| n.contains("conn09")));
+        assert!(!names.iter().any(|n| n.contains("conn00")));
+        fs::remove_dir_all(&config.dir).unwrap();
+    }
+
+    #[test]
+    fn test_live_writers_drop_when_budget_exhausted() {
+        let config = test_config("drop", 1 << 20, 100);
+        let capture = QlogCapture::new(config.clone()).unwrap();
+        let mut writer = capture.writer("live");
+        for i in 0..10 {
+            writer.write_all(&record(i)).unwrap();
+        }
+        writer.flush().unwrap();
+        let size = fs::metadata(writer.part_path()).unwrap().len();
+        assert!(size <= 100);
+        assert!(capture.budget.lock().unwrap().dropped_bytes > 0);
+        drop(writer);
+        fs::remove_dir_all(&config.dir).unwrap();
+    }
+}
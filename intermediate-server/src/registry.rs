@@ -6,8 +6,18 @@
 //!
 //! This enables bidirectional routing of DATAGRAMs between
 //! Agent-Connector pairs for the same service.
-
+//!
+//! A Connector may open striped uplinks: extra connections that register
+//! for its service with `REG_FLAG_UPLINK`. They carry tunneled traffic
+//! alongside its primary connection, which alone receives signaling. Each
+//! Agent's traffic goes out on one of them, picked by connection ID hash.
+//! The primary and its uplinks share a link group ID: an uplink is only
+//! accepted into the group of the current primary, and a primary from
+//! another group drops the uplinks it replaces.
+
+use std::collections::hash_map::DefaultHasher;
 use std::collections::{HashMap, HashSet};
+use std::hash::{Hash, Hasher};
 
 use crate::client::ClientType;
 
@@ -15,10 +25,43 @@ use crate::client::ClientType;
 // Registry Structure
 // ============================================================================
 
+/// Connector connections serving one service
+#[derive(Default)]
+struct ServiceConnectors {
+    /// Connection registered without the uplink flag (replaced by the next one)
+    primary: Option<quiche::ConnectionId<'static>>,
+    /// Link group of the latest primary, kept while it reconnects
+    group: Option<u64>,
+    /// End-to-end features of the primary (header compression, FEC) from
+    /// its registration flags; passed on to Agents of the service
+    flags: u8,
+    /// Striped uplinks of the Connector (all in `group`)
+    uplinks: Vec<quiche::ConnectionId<'static>>,
+}
+
+impl ServiceConnectors {
+    fn is_empty(&self) -> bool {
+        self.primary.is_none() && self.uplinks.is_empty()
+    }
+
+    /// Connection carrying traffic from `from`: the same one for as long as
+    /// the set of links is unchanged
+    fn pick(&self, from: &quiche::ConnectionId<'static>) -> Option<quiche::ConnectionId<'static>> {
+        if self.uplinks.is_empty() {
+            return self.primary.clone();
+        }
+        let links = self.primary.iter().count() + self.uplinks.len();
+        let mut hasher = DefaultHasher::new();
+        from.hash(&mut hasher);
+        let index = (hasher.finish() % links as u64) as usize;
+        self.primary.iter().chain(&self.uplinks).nth(index).cloned()
+    }
+}
+
 /// Registry for managing client routing
 pub struct Registry {
-    /// Map from service_id to Connector connection ID
-    connectors: HashMap<String, quiche::ConnectionId<'static>>,
+    /// Map from service_id to its Connector connections
+    connectors: HashMap<String, ServiceConnectors>,
 
     /// Map from Agent connection ID to set of target service_ids
     agent_targets: HashMap<quiche::ConnectionId<'static>, HashSet<String>>,
@@ -48,28 +91,7 @@ impl Registry {
         service_id: String,
     ) {
         match client_type {
-            ClientType::Connector => {
-                // Clean up stale connector_services entry if another Connector
-                // was previously registered for this service
-                if let Some(old_conn_id) = self.connectors.get(&service_id) {
-                    if old_conn_id != &conn_id {
-                        log::warn!(
-                            "Connector replacement: service '{}' was {:?}, now {:?}",
-                            service_id,
-                            old_conn_id,
-                            conn_id
-                        );
-                        self.connector_services.remove(old_conn_id);
-                    }
-                }
-                log::info!(
-                    "Registering Connector for service '{}' (conn={:?})",
-                    service_id,
-                    conn_id
-                );
-                self.connectors.insert(service_id.clone(), conn_id.clone());
-                self.connector_services.insert(conn_id, service_id);
-            }
+            ClientType::Connector => self.register_connector(conn_id, service_id, None, 0),
             ClientType::Agent => {
                 log::info!(
                     "Registering Agent targeting service '{}' (conn={:?})",
@@ -84,8 +106,86 @@ impl Registry {
         }
     }
 
-    /// Unregister a client when their connection closes
-    pub fn unregister(&mut self, conn_id: &quiche::ConnectionId<'static>) {
+    /// Register the primary connection of the Connector serving
+    /// `service_id`, replacing any previous one. `group` is the link group
+    /// its uplinks will join; uplinks of another group are dropped. `flags`
+    /// are the end-to-end features Agents of the service learn about.
+    pub fn register_connector(
+        &mut self,
+        conn_id: quiche::ConnectionId<'static>,
+        service_id: String,
+        group: Option<u64>,
+        flags: u8,
+    ) {
+        let entry = self.connectors.entry(service_id.clone()).or_default();
+        // Clean up stale connector_services entry if another Connector
+        // was previously registered for this service
+        if let Some(ref old_conn_id) = entry.primary {
+            if old_conn_id != &conn_id {
+                log::warn!(
+                    "Connector replacement: service '{}' was {:?}, now {:?}",
+                    service_id,
+                    old_conn_id,
+                    conn_id
+                );
+                self.connector_services.remove(old_conn_id);
+            }
+        }
+        log::info!(
+            "Registering Connector for service '{}' (conn={:?})",
+            service_id,
+            conn_id
+        );
+        entry.uplinks.retain(|id| id != &conn_id);
+        if entry.group != group || group.is_none() {
+            for stale in entry.uplinks.drain(..) {
+                log::info!(
+                    "Dropping uplink {:?} of the replaced Connector for service '{}'",
+                    stale,
+                    service_id
+                );
+                self.connector_services.remove(&stale);
+            }
+        }
+        entry.primary = Some(conn_id.clone());
+        entry.group = group;
+        entry.flags = flags;
+        self.connector_services.insert(conn_id, service_id);
+    }
+
+    /// Register a striped uplink of the Connector serving `service_id`. It
+    /// carries tunneled traffic but does not replace the primary connection.
+    /// Returns false, registering nothing, unless a primary of link group
+    /// `group` is registered for the service.
+    pub fn register_uplink(
+        &mut self,
+        conn_id: quiche::ConnectionId<'static>,
+        service_id: String,
+        group: u64,
+    ) -> bool {
+        let entry = match self.connectors.get_mut(&service_id) {
+            Some(entry) if entry.primary.is_some() && entry.group == Some(group) => entry,
+            _ => return false,
+        };
+        if entry.primary.as_ref() == Some(&conn_id) || entry.uplinks.contains(&conn_id) {
+            return true;
+        }
+        log::info!(
+            "Registering Connector uplink {} for service '{}' (conn={:?})",
+            entry.uplinks.len() + 1,
+            service_id,
+            conn_id
+        );
+        entry.uplinks.push(conn_id.clone());
+        self.connector_services.insert(conn_id, service_id);
+        true
+    }
+
+    /// Unregister a client when their connection closes. Returns the
+    /// service if this was its primary Connector.
+    pub fn unregister(&mut self, conn_id: &quiche::ConnectionId<'static>) -> Option<String> {
+        let mut lost_primary = None;
+
         // Check if it was an Agent
         if let Some(services) = self.agent_targets.remove(conn_id) {
             log::info!(
@@ -97,15 +197,18 @@ impl Registry {
 
         // Check if it was a Connector
         if let Some(service_id) = self.connector_services.remove(conn_id) {
-            // Only remove from connectors if this connection is still the active one.
+            // Only remove the primary if this connection is still the active one.
             // A newer Connector may have already taken over the service.
-            if self
-                .connectors
-                .get(&service_id)
-                .map(|c| c == conn_id)
-                .unwrap_or(false)
-            {
-                self.connectors.remove(&service_id);
+            if let Some(entry) = self.connectors.get_mut(&service_id) {
+                if entry.primary.as_ref() == Some(conn_id) {
+                    entry.primary = None;
+                    entry.flags = 0;
+                    lost_primary = Some(service_id.clone());
+                }
+                entry.uplinks.retain(|id| id != conn_id);
+                if entry.is_empty() {
+                    self.connectors.remove(&service_id);
+                }
             }
             log::info!(
                 "Unregistered Connector for service '{}' (conn={:?})",
@@ -113,14 +216,16 @@ impl Registry {
                 conn_id
             );
         }
+
+        lost_primary
     }
 
     /// Find the destination connection for a given source connection (implicit routing).
     ///
-    /// If source is an Agent → returns Connector for their first registered service
+    /// If source is an Agent → returns Connector link for their first registered service
     /// If source is a Connector → returns Agent targeting their service
     ///
-    /// For multi-service Agents, use find_connector_for_service() with explicit service_id.
+    /// For multi-service Agents, use find_connector_link() with explicit service_id.
     pub fn find_destination(
         &self,
         from_conn_id: &quiche::ConnectionId<'static>,
@@ -128,7 +233,7 @@ impl Registry {
         // Check if sender is an Agent (use first service for backward compat)
         if let Some(services) = self.agent_targets.get(from_conn_id) {
             if let Some(target_service) = services.iter().next() {
-                return self.connectors.get(target_service).cloned();
+                return self.find_connector_link(target_service, from_conn_id);
             }
         }
 
@@ -153,7 +258,25 @@ impl Registry {
         None
     }
 
-    /// Get the number of registered Connectors
+    /// Every Agent connection targeting the given service
+    pub fn agents_for_service(&self, service_id: &str) -> Vec<quiche::ConnectionId<'static>> {
+        self.agent_targets
+            .iter()
+            .filter(|(_, services)| services.contains(service_id))
+            .map(|(conn_id, _)| conn_id.clone())
+            .collect()
+    }
+
+    /// End-to-end features of the service's primary Connector, for the
+    /// ACKs of its Agents (0 without a Connector)
+    pub fn connector_flags(&self, service_id: &str) -> u8 {
+        self.connectors
+            .get(service_id)
+            .filter(|c| c.primary.is_some())
+            .map_or(0, |c| c.flags)
+    }
+
+    /// Get the number of services with a registered Connector
     #[cfg(test)]
     pub fn connector_count(&self) -> usize {
         self.connectors.len()
@@ -178,12 +301,50 @@ impl Registry {
             .unwrap_or(false)
     }
 
-    /// Find the Connector connection ID for a given service
+    /// Service a connection's implicitly routed traffic belongs to: the
+    /// Connector's service, or an Agent's first target (as in find_destination)
+    pub fn service_of(&self, conn_id: &quiche::ConnectionId<'static>) -> Option<&str> {
+        if let Some(service_id) = self.connector_services.get(conn_id) {
+            return Some(service_id);
+        }
+        self.agent_targets
+            .get(conn_id)
+            .and_then(|services| services.iter().next())
+            .map(|s| s.as_str())
+    }
+
+    /// Number of registered Agents targeting each service
+    pub fn agents_per_service(&self) -> HashMap<String, u64> {
+        let mut counts = HashMap::new();
+        for services in self.agent_targets.values() {
+            for service_id in services {
+                *counts.entry(service_id.clone()).or_insert(0) += 1;
+            }
+        }
+        counts
+    }
+
+    /// Find the Connector's primary connection ID for a given service (the
+    /// one that takes signaling)
     pub fn find_connector_for_service(
         &self,
         service_id: &str,
     ) -> Option<quiche::ConnectionId<'static>> {
-        self.connectors.get(service_id).cloned()
+        self.connectors
+            .get(service_id)
+            .and_then(|c| c.primary.clone())
+    }
+
+    /// Find the Connector connection that carries `from_conn_id`'s traffic
+    /// for a service: the primary or one of its uplinks
+    pub fn find_connector_link(
+        &self,
+        service_id: &str,
+        from_conn_id: &quiche::ConnectionId<'static>,
+    ) -> Option<quiche::ConnectionId<'static>> {
+        self.connectors
+            .get(service_id)
+            .and_then(|c| c.pick(from_conn_id))
     }
 }
 
@@ -458,4 +619,149 @@ mod tests {
             Some(new_connector.clone())
         );
     }
+
+    #[test]
+    fn test_uplinks_share_agent_traffic() {
+        let mut registry = Registry::new();
+        let primary = make_conn_id(1);
+        let uplink = make_conn_id(2);
+
+        registry.register_connector(primary.clone(), "web".to_string(), Some(7), 0);
+        assert!(registry.register_uplink(uplink.clone(), "web".to_string(), 7));
+
+        // Signaling stays on the primary
+        assert_eq!(
+            registry.find_connector_for_service("web"),
+            Some(primary.clone())
+        );
+
+        // Each Agent sticks to one link, and Agents spread over both
+        let mut used = HashSet::new();
+        for id in 10..40 {
+            let agent = make_conn_id(id);
+            registry.register(agent.clone(), ClientType::Agent, "web".to_string());
+            let link = registry.find_destination(&agent).unwrap();
+            assert_eq!(
+                registry.find_connector_link("web", &agent),
+                Some(link.clone())
+            );
+            used.insert(link);
+        }
+        assert_eq!(used.len(), 2);
+
+        // Return traffic from the uplink is routed like the primary's
+        assert!(registry.find_destination(&uplink).is_some());
+        assert_eq!(registry.service_of(&uplink), Some("web"));
+
+        // Without the primary the uplink carries everything
+        let agent = make_conn_id(10);
+        registry.unregister(&primary);
+        assert_eq!(registry.find_connector_for_service("web"), None);
+        assert_eq!(registry.find_destination(&agent), Some(uplink.clone()));
+        assert_eq!(registry.connector_count(), 1);
+
+        registry.unregister(&uplink);
+        assert_eq!(registry.find_destination(&agent), None);
+        assert_eq!(registry.connector_count(), 0);
+    }
+
+    #[test]
+    fn test_uplink_needs_primary_of_its_group() {
+        let mut registry = Registry::new();
+        let uplink = make_conn_id(2);
+
+        // No primary yet
+        assert!(!registry.register_uplink(uplink.clone(), "web".to_string(), 7));
+        assert_eq!(registry.connector_count(), 0);
+
+        // A primary of another group, or without one
+        registry.register_connector(make_conn_id(1), "web".to_string(), Some(8), 0);
+        assert!(!registry.register_uplink(uplink.clone(), "web".to_string(), 7));
+        registry.register_connector(make_conn_id(1), "web".to_string(), None, 0);
+        assert!(!registry.register_uplink(uplink.clone(), "web".to_string(), 7));
+        assert_eq!(registry.service_of(&uplink), None);
+    }
+
+    #[test]
+    fn test_replacement_drops_uplinks_of_old_connector() {
+        let mut registry = Registry::new();
+        let old_primary = make_conn_id(1);
+        let old_uplink = make_conn_id(2);
+        registry.register_connector(old_primary.clone(), "web".to_string(), Some(7), 0);
+        assert!(registry.register_uplink(old_uplink.clone(), "web".to_string(), 7));
+
+        // The primary reconnecting with its own group keeps its uplinks
+        let reconnected = make_conn_id(3);
+        registry.unregister(&old_primary);
+        registry.register_connector(reconnected.clone(), "web".to_string(), Some(7), 0);
+        assert_eq!(registry.service_of(&old_uplink), Some("web"));
+
+        // Another Connector takes over: every Agent goes to it alone
+        let new_primary = make_conn_id(4);
+        registry.register_connector(new_primary.clone(), "web".to_string(), Some(9), 0);
+        for id in 10..40 {
+            let agent = make_conn_id(id);
+            registry.register(agent.clone(), ClientType::Agent, "web".to_string());
+            assert_eq!(registry.find_destination(&agent), Some(new_primary.clone()));
+        }
+        assert_eq!(registry.service_of(&old_uplink), None);
+        assert_eq!(registry.find_destination(&old_uplink), None);
+        assert!(!registry.register_uplink(old_uplink.clone(), "web".to_string(), 7));
+
+        // Its own uplinks join
+        assert!(registry.register_uplink(make_conn_id(5), "web".to_string(), 9));
+    }
+
+    #[test]
+    fn test_connector_flags_follow_the_primary() {
+        let mut registry = Registry::new();
+        let agent = make_conn_id(10);
+
+        // The Agent registers before any Connector
+        registry.register(agent.clone(), ClientType::Agent, "web".to_string());
+        assert_eq!(registry.connector_flags("web"), 0);
+        assert_eq!(registry.agents_for_service("web"), vec![agent.clone()]);
+
+        registry.register_connector(make_conn_id(1), "web".to_string(), None, 0x06);
+        assert_eq!(registry.connector_flags("web"), 0x06);
+
+        // Replaced by a Connector without FEC; the old one closing later
+        // changes nothing
+        registry.register_connector(make_conn_id(2), "web".to_string(), None, 0x02);
+        assert_eq!(registry.connector_flags("web"), 0x02);
+        assert_eq!(registry.unregister(&make_conn_id(1)), None);
+        assert_eq!(registry.connector_flags("web"), 0x02);
+
+        // The current one closing leaves the Agents without features
+        assert_eq!(
+            registry.unregister(&make_conn_id(2)),
+            Some("web".to_string())
+        );
+        assert_eq!(registry.connector_flags("web"), 0);
+        assert!(registry.agents_for_service("other").is_empty());
+    }
+
+    #[test]
+    fn test_service_of_and_agents_per_service() {
+        let mut registry = Registry::new();
+        let connector = make_conn_id(1);
+        let agent_a = make_conn_id(2);
+        let agent_b = make_conn_id(3);
+
+        registry.register(connector.clone(), ClientType::Connector, "web".to_string());
+        registry.register(agent_a.clone(), ClientType::Agent, "web".to_string());
+        registry.register(agent_b.clone(), ClientType::Agent, "web".to_string());
+        registry.register(agent_b.clone(), ClientType::Agent, "ssh".to_string());
+
+        assert_eq!(registry.service_of(&connector), Some("web"));
+        assert_eq!(registry.service_of(&agent_a), Some("web"));
+        assert_eq!(registry.service_of(&make_conn_id(9)), None);
+
+        let counts = registry.agents_per_service();
+        assert_eq!(counts.get("web"), Some(&2));
+        assert_eq!(counts.get("ssh"), Some(&1));
+
+        registry.unregister(&agent_b);
+        assert_eq!(registry.agents_per_service().get("ssh"), None);
+    }
 }
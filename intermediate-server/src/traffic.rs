@@ -0,0 +1,342 @@
+//! Per-service and per-identity traffic accounting
+//!
+//! Relay traffic is attributed to the service it belongs to and to the mTLS
+//! identity (certificate CN) of the sending client. Either dimension can have
+//! unbounded cardinality, so each is tracked with a Space-Saving heavy-hitter
+//! table of fixed capacity (Metwally et al., 2005): a new key evicts the
+//! entry with the least traffic and inherits its weight as an error bound.
+//! Keys carrying a large share of traffic are never evicted, so the top of
+//! the table is accurate; only the long tail is approximate.
+//!
+//! Rendering emits at most [`TOP_K_REPORTED`] series per metric, keeping the
+//! Prometheus output small no matter how many services or identities exist.
+
+use std::collections::HashMap;
+
+/// Keys tracked per dimension. Larger than [`TOP_K_REPORTED`] so that keys
+/// near the reporting cutoff have settled counts.
+pub const TOP_K_TRACKED: usize = 64;
+
+/// Series emitted per metric
+pub const TOP_K_REPORTED: usize = 16;
+
+/// Metric name suffix, HELP text and value of each per-key counter
+type CounterSeries = (&'static str, &'static str, fn(&TrafficCounters) -> u64);
+
+const COUNTER_SERIES: [CounterSeries; 3] = [
+    ("relay_bytes_total", "Bytes relayed", |c| c.bytes),
+    ("datagrams_relayed_total", "DATAGRAMs relayed", |c| {
+        c.datagrams
+    }),
+    ("datagrams_dropped_total", "DATAGRAMs dropped", |c| c.drops),
+];
+
+/// Traffic attributed to one service or identity
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct TrafficCounters {
+    /// Payload bytes relayed
+    pub bytes: u64,
+    /// DATAGRAMs relayed
+    pub datagrams: u64,
+    /// DATAGRAMs dropped (no route, unauthorized, or send queue full)
+    pub drops: u64,
+}
+
+struct Entry {
+    key: String,
+    counters: TrafficCounters,
+    /// Ranking weight: bytes relayed or dropped, including the weight
+    /// inherited from the key this entry replaced (its error bound)
+    weight: u64,
+}
+
+/// Space-Saving heavy-hitter table ranked by bytes
+pub struct HeavyHitters {
+    capacity: usize,
+    entries: Vec<Entry>,
+    index: HashMap<String, usize>,
+    /// Entries replaced by a new key
+    evictions: u64,
+}
+
+impl HeavyHitters {
+    pub fn new(capacity: usize) -> Self {
+        HeavyHitters {
+            capacity: capacity.max(1),
+            entries: Vec::with_capacity(capacity),
+            index: HashMap::with_capacity(capacity),
+            evictions: 0,
+        }
+    }
+
+    /// Count a relayed datagram of `bytes` against `key`
+    pub fn record_relay(&mut self, key: &str, bytes: u64) {
+        let entry = self.entry(key);
+        entry.counters.bytes += bytes;
+        entry.counters.datagrams += 1;
+        entry.weight += bytes;
+    }
+
+    /// Count a dropped datagram of `bytes` against `key`
+    pub fn record_drop(&mut self, key: &str, bytes: u64) {
+        let entry = self.entry(key);
+        entry.counters.drops += 1;
+        entry.weight += bytes;
+    }
+
+    pub fn evictions(&self) -> u64 {
+        self.evictions
+    }
+
+    /// The `n` heaviest keys, heaviest first
+    pub fn top(&self, n: usize) -> Vec<(&str, TrafficCounters)> {
+        let mut ranked: Vec<&Entry> = self.entries.iter().collect();
+        ranked.sort_by(|a, b| b.weight.cmp(&a.weight).then_with(|| a.key.cmp(&b.key)));
+        ranked
+            .into_iter()
+            .take(n)
+            .map(|e| (e.key.as_str(), e.counters))
+            .collect()
+    }
+
+    fn entry(&mut self, key: &str) -> &mut Entry {
+        if let Some(&i) = self.index.get(key) {
+            return &mut self.entries[i];
+        }
+
+        if self.entries.len() < self.capacity {
+            self.index.insert(key.to_string(), self.entries.len());
+            self.entries.push(Entry {
+                key: key.to_string(),
+                counters: TrafficCounters::default(),
+                weight: 0,
+            });
+            return self.entries.last_mut().unwrap();
+        }
+
+        // Replace the lightest key; the newcomer keeps its weight, so a
+        // burst of one-off keys cannot push out an established heavy hitter
+        let (i, _) = self
+            .entries
+            .iter()
+            .enumerate()
+            .min_by_key(|(_, e)| e.weight)
+            .unwrap();
+        self.evictions += 1;
+        let old = std::mem::replace(&mut self.entries[i].key, key.to_string());
+        self.index.remove(&old);
+        self.index.insert(key.to_string(), i);
+
+        let entry = &mut self.entries[i];
+        entry.counters = TrafficCounters::default();
+        entry
+    }
+}
+
+/// Per-service and per-identity accounting rendered on `/metrics`
+pub struct TrafficAccounting {
+    pub services: HeavyHitters,
+    pub identities: HeavyHitters,
+    /// Agents currently registered, per service (refreshed at scrape time)
+    active_by_service: HashMap<String, u64>,
+    /// Agent connections currently open, per identity (refreshed at scrape time)
+    active_by_identity: HashMap<String, u64>,
+}
+
+impl TrafficAccounting {
+    pub fn new() -> Self {
+        TrafficAccounting {
+            services: HeavyHitters::new(TOP_K_TRACKED),
+            identities: HeavyHitters::new(TOP_K_TRACKED),
+            active_by_service: HashMap::new(),
+            active_by_identity: HashMap::new(),
+        }
+    }
+
+    /// Count one relayed (or dropped) datagram against its service and sender
+    pub fn record(
+        &mut self,
+        service: Option<&str>,
+        identity: Option<&str>,
+        bytes: u64,
+        relayed: bool,
+    ) {
+        for (table, key) in [
+            (&mut self.services, service),
+            (&mut self.identities, identity),
+        ] {
+            if let Some(key) = key {
+                if relayed {
+                    table.record_relay(key, bytes);
+                } else {
+                    table.record_drop(key, bytes);
+                }
+            }
+        }
+    }
+
+    pub fn set_active_agents(
+        &mut self,
+        by_service: HashMap<String, u64>,
+        by_identity: HashMap<String, u64>,
+    ) {
+        self.active_by_service = by_service;
+        self.active_by_identity = by_identity;
+    }
+
+    /// Render in Prometheus text exposition format
+    pub fn render(&self) -> String {
+        let mut out = String::new();
+        for (dimension, table) in [("service", &self.services), ("identity", &self.identities)] {
+            let top = table.top(TOP_K_REPORTED);
+            for (name, help, value) in COUNTER_SERIES {
+                out.push_str(&format!(
+                    "# HELP ztna_{dimension}_{name} {help} per {dimension} (top {TOP_K_REPORTED}, approximate below the top)\n\
+                     # TYPE ztna_{dimension}_{name} counter\n"
+                ));
+                for (key, counters) in &top {
+                    out.push_str(&format!(
+                        "ztna_{}_{}{{{}=\"{}\"}} {}\n",
+                        dimension,
+                        name,
+                        dimension,
+                        escape_label(key),
+                        value(counters)
+                    ));
+                }
+            }
+        }
+
+        for (dimension, active) in [
+            ("service", &self.active_by_service),
+            ("identity", &self.active_by_identity),
+        ] {
+            let mut ranked: Vec<(&String, &u64)> = active.iter().collect();
+            ranked.sort_by(|a, b| b.1.cmp(a.1).then_with(|| a.0.cmp(b.0)));
+            out.push_str(&format!(
+                "# HELP ztna_{dimension}_active_agents Connected Agents per {dimension} (top {TOP_K_REPORTED})\n\
+                 # TYPE ztna_{dimension}_active_agents gauge\n"
+            ));
+            for (key, count) in ranked.into_iter().take(TOP_K_REPORTED) {
+                out.push_str(&format!(
+                    "ztna_{}_active_agents{{{}=\"{}\"}} {}\n",
+                    dimension,
+                    dimension,
+                    escape_label(key),
+                    count
+                ));
+            }
+        }
+
+        out.push_str(
+            "# HELP ztna_traffic_sketch_evictions_total Keys evicted from the top-K traffic tables\n\
+             # TYPE ztna_traffic_sketch_evictions_total counter\n",
+        );
+        out.push_str(&format!(
+            "ztna_traffic_sketch_evictions_total{{dimension=\"service\"}} {}\n\
+             ztna_traffic_sketch_evictions_total{{dimension=\"identity\"}} {}\n",
+            self.services.evictions(),
+            self.identities.evictions()
+        ));
+        out
+    }
+}
+
+impl Default for TrafficAccounting {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Escape a Prometheus label value
+fn escape_label(value: &str) -> String {
+    let mut out = String::with_capacity(value.len());
+    for c in value.chars() {
+        match c {
+            '\\' => out.push_str("\\\\"),
+            '"' => out.push_str("\\\""),
+            '\n' => out.push_str("\\n"),
+            c => out.push(c),
+        }
+    }
+    out
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_counts_exact_under_capacity() {
+        let mut hh = HeavyHitters::new(4);
+        hh.record_relay("a", 100);
+        hh.record_relay("a", 50);
+        hh.record_relay("b", 10);
+        hh.record_drop("b", 1000);
+
+        let top = hh.top(10);
+        assert_eq!(top[0].0, "b");
+        assert_eq!(
+            top[0].1,
+            TrafficCounters {
+                bytes: 10,
+                datagrams: 1,
+                drops: 1
+            }
+        );
+        assert_eq!(
+            top[1],
+            (
+                "a",
+                TrafficCounters {
+                    bytes: 150,
+                    datagrams: 2,
+                    drops: 0
+                }
+            )
+        );
+        assert_eq!(hh.evictions(), 0);
+    }
+
+    #[test]
+    fn test_heavy_hitter_survives_long_tail() {
+        let mut hh = HeavyHitters::new(8);
+        for i in 0..10_000 {
+            hh.record_relay("noisy", 1200);
+            hh.record_relay(&format!("tail-{}", i), 60);
+        }
+
+        assert_eq!(hh.entries.len(), 8);
+        assert!(hh.evictions() > 0);
+        let top = hh.top(1);
+        assert_eq!(top[0].0, "noisy");
+        assert_eq!(top[0].1.bytes, 1200 * 10_000);
+        assert_eq!(top[0].1.datagrams, 10_000);
+    }
+
+    #[test]
+    fn test_render_bounded_and_labeled() {
+        let mut traffic = TrafficAccounting::new();
+        for i in 0..(TOP_K_TRACKED * 2) {
+            let service = format!("svc-{}", i);
+            traffic.record(Some(&service), Some("agent-1"), i as u64 + 1, true);
+        }
+        traffic.record(Some("svc-x"), None, 10, false);
+        traffic.set_active_agents(
+            HashMap::from([("svc-1".to_string(), 3)]),
+            HashMap::from([("agent \"1\"".to_string(), 1)]),
+        );
+
+        let output = traffic.render();
+        let service_series = output
+            .lines()
+            .filter(|l| l.starts_with("ztna_service_relay_bytes_total{"))
+            .count();
+        assert_eq!(service_series, TOP_K_REPORTED);
+        assert!(output.contains("# TYPE ztna_service_relay_bytes_total counter"));
+        assert!(output.contains("ztna_identity_datagrams_relayed_total{identity=\"agent-1\"} 128"));
+        assert!(output.contains("ztna_service_active_agents{service=\"svc-1\"} 3"));
+        assert!(output.contains("ztna_identity_active_agents{identity=\"agent \\\"1\\\"\"} 1"));
+        assert!(output.contains("ztna_traffic_sketch_evictions_total{dimension=\"service\"}"));
+    }
+}
@@ -33,6 +33,7 @@ typedef enum {
     AgentResultNoData = 6,
     AgentResultQuicError = 7,
     AgentResultPanicCaught = 8,
+    AgentResultQueueFull = 9,
     // Specific QUIC error codes for debugging (10+)
     AgentResultQuicDone = 10,
     AgentResultQuicBufferTooShort = 11,
@@ -141,13 +142,24 @@ AgentResult agent_recv(Agent* agent, const uint8_t* data, size_t len,
 AgentResult agent_poll(Agent* agent, uint8_t* out_data, size_t* out_len, uint16_t* out_port);
 
 /// Send an IP packet through the QUIC tunnel as a DATAGRAM.
-/// The packet will be encapsulated and sent to the server.
+/// The packet waits in its priority class queue and goes to the server as
+/// QUIC has room, so AgentResultOk means accepted, not sent.
 /// @param agent Agent pointer.
 /// @param data IP packet data to send.
 /// @param len Length of IP packet.
-/// @return AgentResultOk on success, AgentResultNotConnected if not connected.
+/// @return AgentResultOk if queued, AgentResultNotConnected if not connected,
+///         AgentResultQueueFull if its class queue is full (packet dropped),
+///         AgentResultQuicError if it is larger than a DATAGRAM can carry.
 AgentResult agent_send_datagram(Agent* agent, const uint8_t* data, size_t len);
 
+/// Get the largest IP packet the tunnel can carry right now.
+/// Follows the path MTU discovered on the Intermediate connection, so it can
+/// grow after the handshake; size the utun MTU / NEPacketTunnelNetworkSettings
+/// from it. Includes the service-routing header when one is used.
+/// @param agent Agent pointer.
+/// @return Maximum DATAGRAM payload in bytes, or 0 if not connected.
+size_t agent_max_datagram_size(const Agent* agent);
+
 /// Poll for received IP packets from the QUIC tunnel.
 /// Call this repeatedly after agent_recv() until AgentResultNoData is returned.
 /// Each call returns one IP packet received via QUIC DATAGRAM (response from Connector).
@@ -298,4 +310,194 @@ bool agent_is_in_fallback(const Agent* agent);
 AgentResult agent_get_path_stats(const Agent* agent, uint32_t* out_missed_keepalives,
                                   uint64_t* out_rtt_ms, uint8_t* out_in_fallback);
 
+// ============================================================================
+// Diagnostics
+// ============================================================================
+
+/// Event kinds in AgentTraceRecord.kind
+typedef enum {
+    AgentTraceOverflow = 0,    ///< Records lost before drain; arg1 = count
+    AgentTraceRecv = 1,        ///< agent_recv; arg0 = bytes
+    AgentTraceSend = 2,        ///< agent_poll / agent_poll_p2p; arg0 = bytes
+    AgentTraceDgramSend = 3,   ///< IP packet queued; arg0 = bytes, arg1 = send queue depth
+    AgentTraceDgramRecv = 4,   ///< IP packet for host; arg0 = bytes, arg1 = recv queue depth
+    AgentTraceDrop = 5,        ///< arg0 = AgentTraceDropReason, arg1 = bytes
+    AgentTracePathSwitch = 6,  ///< arg0 = new active path (0 direct, 1 relay, 2 none)
+    AgentTraceTimer = 7,       ///< agent_on_timeout; arg1 = us until next timeout (0 = none)
+    AgentTraceState = 8,       ///< arg0 = new AgentState
+    AgentTraceRecvError = 9,   ///< agent_recv failed; arg0 = AgentResult, arg1 = bytes
+} AgentTraceKind;
+
+/// arg0 of an AgentTraceDrop record
+typedef enum {
+    AgentTraceDropRecvQueueFull = 1,  ///< Host receive queue full, oldest packet dropped
+    AgentTraceDropOversize = 2,       ///< Packet larger than agent_recv_datagram buffer
+    AgentTraceDropSendRejected = 3,   ///< QUIC datagram send queue refused the packet
+} AgentTraceDropReason;
+
+/// One binary trace event (24 bytes).
+typedef struct {
+    uint64_t timestamp_us;  ///< Microseconds since agent_create
+    uint8_t kind;           ///< AgentTraceKind
+    uint8_t path;           ///< 0 = Intermediate connection, 1 = P2P connection
+    uint16_t reserved;
+    uint32_t arg0;
+    uint64_t arg1;
+} AgentTraceRecord;
+
+/// Drain buffered trace events, oldest first.
+/// The agent keeps the most recent 4096 events; older ones are overwritten and
+/// reported by a leading AgentTraceOverflow record. Must be called on the
+/// thread driving the agent; use agent_trace_handle() to drain from another.
+/// @param agent Agent pointer.
+/// @param out Buffer for records.
+/// @param max_records Capacity of out, in records.
+/// @return Number of records written (0 if none or on invalid pointer).
+size_t agent_drain_trace(const Agent* agent, AgentTraceRecord* out, size_t max_records);
+
+// Opaque handle on an agent's trace ring
+typedef struct AgentTrace AgentTrace;
+
+/// Get a handle on the agent's trace ring for draining from any thread.
+/// The handle keeps the ring alive, even past agent_destroy(), until
+/// agent_trace_release(). One drainer at a time, across handles and
+/// agent_drain_trace().
+/// @param agent Agent pointer.
+/// @return Handle, or NULL on invalid pointer.
+const AgentTrace* agent_trace_handle(const Agent* agent);
+
+/// Drain buffered trace events through a handle; same as agent_drain_trace().
+/// @param trace Handle from agent_trace_handle().
+/// @param out Buffer for records.
+/// @param max_records Capacity of out, in records.
+/// @return Number of records written (0 if none or on invalid pointer).
+size_t agent_trace_drain(const AgentTrace* trace, AgentTraceRecord* out, size_t max_records);
+
+/// Release a handle from agent_trace_handle(). NULL is ignored.
+void agent_trace_release(const AgentTrace* trace);
+
+/// Layout version written to AgentStats.version
+#define AGENT_STATS_VERSION 1
+
+/// P2P connections reported per AgentStats snapshot
+#define AGENT_STATS_MAX_P2P 4
+
+/// Statistics for one QUIC connection.
+/// Path fields (cwnd, RTT, delivery rate, PMTU) are for the active path;
+/// packet and byte counters are connection totals.
+typedef struct {
+    uint8_t peer_ip[4];              ///< Peer IPv4 address (zero for IPv6)
+    uint16_t peer_port;
+    uint8_t established;             ///< 1 once the handshake has completed
+    uint8_t reserved;
+    uint64_t cwnd;                   ///< Congestion window in bytes
+    uint64_t srtt_us;                ///< Smoothed RTT
+    uint64_t rttvar_us;              ///< RTT variation
+    uint64_t min_rtt_us;             ///< 0 if not yet measured
+    uint64_t delivery_rate;          ///< Bytes per second
+    uint64_t pmtu;                   ///< Path MTU in bytes
+    uint64_t sent_packets;
+    uint64_t recv_packets;
+    uint64_t lost_packets;
+    uint64_t retrans_packets;
+    uint64_t sent_bytes;
+    uint64_t recv_bytes;
+    uint64_t lost_bytes;
+    uint64_t dgram_send_queue_len;   ///< DATAGRAM frames waiting to be sent
+    uint64_t dgram_send_queue_bytes;
+} AgentConnStats;
+
+/// Agent-wide and per-connection statistics snapshot.
+/// Fields are only ever appended; check version before reading newer ones.
+typedef struct {
+    uint32_t version;                ///< Out: AGENT_STATS_VERSION of the library
+    uint32_t struct_size;            ///< In: set to sizeof(AgentStats)
+    uint32_t state;                  ///< AgentState
+    uint8_t active_path;             ///< 0 = Direct, 1 = Relay, 2 = None
+    uint8_t in_fallback;
+    uint8_t has_intermediate;        ///< 1 if the Intermediate connection exists
+    uint8_t reserved;
+    uint32_t registered_services;    ///< Services with an acknowledged registration
+    uint32_t pending_registrations;  ///< Registrations awaiting ACK
+    uint64_t recv_queue_len;         ///< IP packets queued for agent_recv_datagram
+    uint64_t recv_queue_bytes;
+    uint64_t drops_recv_queue_full;  ///< Oldest packets dropped on queue overflow
+    uint64_t drops_oversize;         ///< Packets larger than the agent_recv_datagram buffer
+    uint64_t drops_send_rejected;    ///< Packets refused by the datagram send queue
+    uint32_t p2p_count;              ///< P2P connections (may exceed AGENT_STATS_MAX_P2P)
+    uint32_t p2p_reported;           ///< Valid entries in p2p
+    AgentConnStats intermediate;     ///< Valid if has_intermediate
+    AgentConnStats p2p[AGENT_STATS_MAX_P2P];
+} AgentStats;
+
+/// Take a transport statistics snapshot.
+/// @param agent Agent pointer.
+/// @param out Stats struct; set out->struct_size = sizeof(AgentStats) first.
+/// @return AgentResultOk on success, AgentResultBufferTooSmall if struct_size is
+///         smaller than the library's AgentStats, AgentResultInvalidPointer on NULL.
+AgentResult agent_get_stats(const Agent* agent, AgentStats* out);
+
+/// Receives qlog bytes (JSON-SEQ) for one connection.
+/// @param ctx Pointer passed to agent_set_qlog.
+/// @param path 0 = Intermediate connection, 1 = P2P connection.
+/// @param data qlog bytes, valid only during the call.
+/// @param len Length of data.
+typedef void (*AgentQlogCallback)(void* ctx, uint8_t path, const uint8_t* data, size_t len);
+
+/// Stream qlog for all current and future QUIC connections to a callback.
+/// The callback runs synchronously inside other agent calls on the same
+/// thread; it must copy the data and must not call back into the agent.
+/// A replaced or removed callback is never called after this returns. Turning
+/// qlog off does not stop existing connections from serializing qlog events
+/// (they are discarded); that cost lasts until those connections reconnect.
+/// @param agent Agent pointer.
+/// @param callback qlog sink, or NULL to turn qlog off.
+/// @param ctx Opaque pointer passed back to callback.
+/// @return AgentResultOk on success, AgentResultInvalidPointer if agent is NULL.
+AgentResult agent_set_qlog(Agent* agent, AgentQlogCallback callback, void* ctx);
+
+// ============================================================================
+// Congestion Control
+// ============================================================================
+
+/// Select congestion control for future connections on one path.
+/// Takes effect from the next agent_connect (path 0) or P2P connection (path 1).
+/// @param agent Agent pointer.
+/// @param path 0 = Intermediate connection, 1 = P2P connections.
+/// @param algorithm "reno", "cubic", "bbr" or "bbr2".
+/// @param hystart Use HyStart++ to leave slow start early.
+/// @param pacing Pace packets across the RTT instead of sending bursts.
+/// @return AgentResultOk on success, AgentResultQuicCongestionControl for an
+///         unknown algorithm, AgentResultInvalidPointer on NULL or unknown path.
+AgentResult agent_set_congestion_control(Agent* agent, uint8_t path, const char* algorithm,
+                                         bool hystart, bool pacing);
+
+// ============================================================================
+// Priority Classes
+// ============================================================================
+
+/// Assigns matching tunneled packets to a priority class. Every set field
+/// must match; ports match if either the source or destination port is in
+/// [port_lo, port_hi] (TCP and UDP only).
+typedef struct {
+    uint8_t protocol;   ///< IP protocol number, 0 = any
+    uint8_t dscp;       ///< DSCP value, 0xFF = any
+    uint8_t class_id;   ///< 0 = interactive, 1 = default, 2 = bulk
+    uint8_t reserved;
+    uint16_t port_lo;   ///< Both 0 = any port
+    uint16_t port_hi;
+} AgentClassRule;
+
+/// Set the rules that classify packets sent through the Intermediate Server.
+/// The first matching rule decides; unmatched packets are default. Queued
+/// interactive packets go ahead of default and bulk ones, weighted so bulk
+/// is never starved. NULL or count 0 restores the built-in rules (DNS, SSH,
+/// ICMP, DSCP EF/CS6 interactive; DSCP CS1/LE bulk).
+/// @param agent Agent pointer.
+/// @param rules Array of count rules.
+/// @param count Number of rules.
+/// @return AgentResultOk on success, AgentResultInvalidPointer if agent is NULL
+///         or a rule names an unknown class.
+AgentResult agent_set_class_rules(Agent* agent, const AgentClassRule* rules, size_t count);
+
 #endif /* PacketProcessor_Bridging_Header_h */
@@ -67,6 +67,9 @@ final class PacketTunnelProvider: NEPacketTunnelProvider, @unchecked Sendable {
     /// Path to CA certificate PEM file for server verification (nil = system CA store)
     private var caCertPath: String?
 
+    /// Congestion control per path ("relay" / "p2p" → {algorithm, hystart, pacing})
+    private var congestionControl: [String: [String: Any]] = [:]
+
     /// Buffer for receiving UDP packets
     private var recvBuffer = [UInt8](repeating: 0, count: 1500)
 
@@ -156,6 +159,7 @@ final class PacketTunnelProvider: NEPacketTunnelProvider, @unchecked Sendable {
                 )
                 return
             }
+            self.applyCongestionControl()
 
             // Create UDP connection to server
             self.setupUdpConnection()
@@ -263,11 +267,33 @@ final class PacketTunnelProvider: NEPacketTunnelProvider, @unchecked Sendable {
         if let caPath = config["caCertPath"] as? String, !caPath.isEmpty {
             caCertPath = caPath
         }
+        if let cc = config["congestionControl"] as? [String: [String: Any]] {
+            congestionControl = cc
+        }
 
         serverIPBytes = parseIPv4(serverHost) ?? [0, 0, 0, 0]
         logger.info("Configuration loaded: \(self.serverHost):\(self.serverPort), service=\(self.targetServiceId), routes=\(self.routeTable.count), verifyPeer=\(self.verifyPeer)")
     }
 
+    /// Pass configured congestion control to the agent (before agent_connect)
+    private func applyCongestionControl() {
+        guard let agent = agentFFI.agent else { return }
+        for (name, path) in [("relay", UInt8(0)), ("p2p", UInt8(1))] {
+            guard let cc = congestionControl[name],
+                  let algorithm = cc["algorithm"] as? String else { continue }
+            let hystart = cc["hystart"] as? Bool ?? true
+            let pacing = cc["pacing"] as? Bool ?? true
+            let result = algorithm.withCString { algorithmPtr in
+                agent_set_congestion_control(agent, path, algorithmPtr, hystart, pacing)
+            }
+            if result == AgentResultOk {
+                logger.info("Congestion control (\(name)): \(algorithm), hystart=\(hystart), pacing=\(pacing)")
+            } else {
+                logger.warning("Congestion control (\(name)) '\(algorithm)' rejected: \(result.rawValue)")
+            }
+        }
+    }
+
     private func parseIPv4(_ host: String) -> [UInt8]? {
         let components = host.split(separator: ".").compactMap { UInt8($0) }
         guard components.count == 4 else {
@@ -319,9 +345,11 @@ final class PacketTunnelProvider: NEPacketTunnelProvider, @unchecked Sendable {
         let params = NWParameters.udp
         params.allowLocalEndpointReuse = true
 
-        // Force IPv4 to avoid IPv6 preference on dual-stack networks
+        // Force IPv4 to avoid IPv6 preference on dual-stack networks.
+        // DF lets the agent's PMTU probes fail cleanly instead of fragmenting.
         if let ipOptions = params.defaultProtocolStack.internetProtocol as? NWProtocolIP.Options {
             ipOptions.version = .v4
+            ipOptions.disableFragmentation = true
         }
 
         let connection = NWConnection(host: host, port: port, using: params)
@@ -776,6 +804,7 @@ final class PacketTunnelProvider: NEPacketTunnelProvider, @unchecked Sendable {
 
         let allRegistered = registeredServices.count == serviceIds.count
         logger.info("Registration state: \(registeredServices.count)/\(serviceIds.count) services registered")
+        logger.info("Tunnel max datagram size: \(agent_max_datagram_size(agent)) bytes")
 
         if anyNewSuccess {
             // Pump outbound to send registration DATAGRAMs
@@ -1074,6 +1103,7 @@ final class PacketTunnelProvider: NEPacketTunnelProvider, @unchecked Sendable {
         params.allowLocalEndpointReuse = true
         if let ipOptions = params.defaultProtocolStack.internetProtocol as? NWProtocolIP.Options {
             ipOptions.version = .v4
+            ipOptions.disableFragmentation = true
         }
 
         let connection = NWConnection(host: endpoint, port: nwPort, using: params)
@@ -1160,6 +1190,7 @@ final class PacketTunnelProvider: NEPacketTunnelProvider, @unchecked Sendable {
         params.allowLocalEndpointReuse = true
         if let ipOptions = params.defaultProtocolStack.internetProtocol as? NWProtocolIP.Options {
             ipOptions.version = .v4
+            ipOptions.disableFragmentation = true
         }
 
         let connection = NWConnection(host: endpoint, port: nwPort, using: params)
@@ -0,0 +1,40 @@
+#!/bin/bash
+# build.sh - Build the packet_processor FFI harness
+#
+# Compiles ffi_harness.cpp against the Swift bridging header and links the
+# packet_processor staticlib, producing target/release/ffi-harness (same
+# layout as the Rust fixtures so common.sh can find it).
+#
+# Usage: ./build.sh [--skip-lib]
+#   --skip-lib  Reuse an existing libpacket_processor.a instead of rebuilding
+
+set -euo pipefail
+
+HARNESS_DIR="$(cd "$(dirname "$0")" && pwd)"
+PROJECT_ROOT="$(cd "$HARNESS_DIR/../../../.." && pwd)"
+LIB_DIR="$PROJECT_ROOT/core/packet_processor/target/release"
+HEADER_DIR="$PROJECT_ROOT/ios-macos/Shared"
+OUT_DIR="$HARNESS_DIR/target/release"
+CXX="${CXX:-c++}"
+
+if [[ "${1:-}" != "--skip-lib" ]]; then
+    cargo build --release --manifest-path "$PROJECT_ROOT/core/packet_processor/Cargo.toml"
+fi
+
+mkdir -p "$OUT_DIR"
+
+# The staticlib bundles Rust std + BoringSSL; the system libs below are what
+# they need on Linux. macOS additionally needs Security/CoreFoundation.
+SYS_LIBS=(-lpthread -ldl -lm)
+if [[ "$(uname)" == "Darwin" ]]; then
+    SYS_LIBS=(-framework Security -framework CoreFoundation -lresolv)
+fi
+
+"$CXX" -std=c++17 -O2 -Wall -Wextra \
+    -I "$HEADER_DIR" \
+    "$HARNESS_DIR/ffi_harness.cpp" \
+    "$LIB_DIR/libpacket_processor.a" \
+    "${SYS_LIBS[@]}" \
+    -o "$OUT_DIR/ffi-harness"
+
+echo "Built $OUT_DIR/ffi-harness"
@@ -0,0 +1,593 @@
+// ffi_harness.cpp - Benchmark and conformance harness for the packet_processor C ABI
+//
+// Links libpacket_processor.a through PacketProcessor-Bridging-Header.h, the
+// same surface the Swift Network Extension uses, so FFI overhead and ABI
+// regressions can be measured on Linux without an Apple toolchain.
+//
+// Two phases:
+//   1. Conformance: null-pointer, buffer-capacity and pre-connect contracts
+//      documented in the bridging header. Needs no server.
+//   2. Benchmark: agent_create -> agent_connect -> handshake over a real UDP
+//      socket to a local Intermediate Server, then a timed burst of
+//      agent_send_datagram / agent_poll / agent_recv / agent_recv_datagram.
+//      Reports per-call latency (min/p50/p99/max), calls/s and bytes/s for
+//      each FFI entry point.
+//
+// Build: ./build.sh   (see that script for the link line)
+// Usage: ffi-harness [--server HOST] [--port PORT] [--service ID]
+//                    [--ca PATH] [--insecure] [--packets N] [--size BYTES]
+//                    [--conformance-only]
+//
+// Exit status: 0 on success, 1 if any conformance check fails, the
+// handshake does not complete or no datagram could be sent.
+
+extern "C" {
+#include "PacketProcessor-Bridging-Header.h"
+}
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// ABI layout checks
+// ============================================================================
+
+// Rust's #[repr(C)] enums are C `int`-sized; a mismatch here means the header
+// and lib.rs have drifted apart.
+static_assert(sizeof(AgentResult) == sizeof(int), "AgentResult must be int-sized");
+static_assert(sizeof(AgentState) == sizeof(int), "AgentState must be int-sized");
+static_assert(AgentResultPanicCaught == 8, "AgentResult base codes changed");
+static_assert(AgentResultQueueFull == 9, "AgentResult base codes changed");
+static_assert(AgentResultQuicKeyUpdate == 28, "AgentResult QUIC codes changed");
+static_assert(AgentStateError == 5, "AgentState values changed");
+static_assert(sizeof(AgentTraceRecord) == 24, "AgentTraceRecord layout changed");
+static_assert(sizeof(AgentConnStats) == 128, "AgentConnStats layout changed");
+static_assert(sizeof(AgentStats) == 72 + 5 * sizeof(AgentConnStats), "AgentStats layout changed");
+static_assert(sizeof(AgentClassRule) == 8, "AgentClassRule layout changed");
+
+namespace {
+
+// Largest UDP payload agent_poll emits: mirrors MAX_DATAGRAM_SIZE in
+// core/packet_processor/src/lib.rs. Not agent_max_datagram_size(), which is
+// the per-connection DATAGRAM frame limit and 0 until connected.
+constexpr size_t kMaxDatagramSize = 1472;
+
+using Clock = std::chrono::steady_clock;
+
+// ============================================================================
+// Per-entry-point statistics
+// ============================================================================
+
+struct CallStats {
+    const char* name;
+    std::vector<uint64_t> samples_ns;
+    uint64_t ok = 0;
+    uint64_t bytes = 0;
+
+    explicit CallStats(const char* n) : name(n) {}
+
+    void record(uint64_t ns, bool success, size_t nbytes) {
+        samples_ns.push_back(ns);
+        if (success) {
+            ok++;
+            bytes += nbytes;
+        }
+    }
+
+    void report(double wall_secs) {
+        if (samples_ns.empty()) {
+            std::printf("  %-22s (no calls)\n", name);
+            return;
+        }
+        std::sort(samples_ns.begin(), samples_ns.end());
+        auto pct = [this](double p) {
+            size_t idx = static_cast<size_t>(p * (samples_ns.size() - 1));
+            return samples_ns[idx];
+        };
+        double secs = wall_secs > 0.0 ? wall_secs : 1e-9;
+        std::printf("  %-22s calls=%-8zu ok=%-8llu min=%-6llu p50=%-6llu p99=%-7llu max=%-8llu "
+                    "(ns)  %.0f calls/s  %.0f B/s\n",
+                    name, samples_ns.size(), static_cast<unsigned long long>(ok),
+                    static_cast<unsigned long long>(samples_ns.front()),
+                    static_cast<unsigned long long>(pct(0.50)),
+                    static_cast<unsigned long long>(pct(0.99)),
+                    static_cast<unsigned long long>(samples_ns.back()),
+                    static_cast<double>(samples_ns.size()) / secs,
+                    static_cast<double>(bytes) / secs);
+    }
+};
+
+template <typename F>
+auto timed(F&& f, uint64_t* ns_out) -> decltype(f()) {
+    auto start = Clock::now();
+    auto r = f();
+    *ns_out = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    return r;
+}
+
+// ============================================================================
+// Options
+// ============================================================================
+
+struct Options {
+    std::string server = "127.0.0.1";
+    uint16_t port = 4433;
+    std::string service = "test-service";
+    std::string ca_path;
+    bool verify_peer = true;
+    size_t packets = 10000;
+    size_t size = 512;
+    bool conformance_only = false;
+};
+
+void usage(const char* argv0) {
+    std::fprintf(stderr,
+                 "Usage: %s [--server HOST] [--port PORT] [--service ID] [--ca PATH]\n"
+                 "          [--insecure] [--packets N] [--size BYTES] [--conformance-only]\n",
+                 argv0);
+}
+
+bool parse_args(int argc, char** argv, Options* opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto next = [&](const char* flag) -> const char* {
+            if (i + 1 >= argc) {
+                std::fprintf(stderr, "%s requires a value\n", flag);
+                return nullptr;
+            }
+            return argv[++i];
+        };
+        const char* v = nullptr;
+        if (arg == "--server") {
+            if (!(v = next("--server"))) return false;
+            opts->server = v;
+        } else if (arg == "--port") {
+            if (!(v = next("--port"))) return false;
+            opts->port = static_cast<uint16_t>(std::strtoul(v, nullptr, 10));
+        } else if (arg == "--service") {
+            if (!(v = next("--service"))) return false;
+            opts->service = v;
+        } else if (arg == "--ca") {
+            if (!(v = next("--ca"))) return false;
+            opts->ca_path = v;
+        } else if (arg == "--insecure") {
+            opts->verify_peer = false;
+        } else if (arg == "--packets") {
+            if (!(v = next("--packets"))) return false;
+            opts->packets = std::strtoull(v, nullptr, 10);
+        } else if (arg == "--size") {
+            if (!(v = next("--size"))) return false;
+            opts->size = std::strtoull(v, nullptr, 10);
+        } else if (arg == "--conformance-only") {
+            opts->conformance_only = true;
+        } else {
+            usage(argv[0]);
+            return false;
+        }
+    }
+    if (opts->size < 28 || opts->size > kMaxDatagramSize) {
+        std::fprintf(stderr, "--size must be in [28, %zu]\n", kMaxDatagramSize);
+        return false;
+    }
+    return true;
+}
+
+// ============================================================================
+// Conformance
+// ============================================================================
+
+int g_failures = 0;
+
+void count_qlog_bytes(void* ctx, uint8_t /*path*/, const uint8_t* /*data*/, size_t len) {
+    *static_cast<size_t*>(ctx) += len;
+}
+
+void check(bool cond, const char* what) {
+    std::printf("  [%s] %s\n", cond ? "PASS" : "FAIL", what);
+    if (!cond) g_failures++;
+}
+
+void run_conformance() {
+    std::printf("Conformance:\n");
+
+    uint8_t buf[kMaxDatagramSize];
+    size_t len = sizeof(buf);
+    uint16_t port = 0;
+    const uint8_t ip[4] = {127, 0, 0, 1};
+
+    // NULL agent handling — every entry point must fail closed, never crash
+    check(agent_get_state(nullptr) == AgentStateError, "agent_get_state(NULL) == Error");
+    check(!agent_is_connected(nullptr), "agent_is_connected(NULL) == false");
+    check(agent_timeout_ms(nullptr) == 0, "agent_timeout_ms(NULL) == 0");
+    check(agent_max_datagram_size(nullptr) == 0, "agent_max_datagram_size(NULL) == 0");
+    check(agent_connect(nullptr, "127.0.0.1", 4433) == AgentResultInvalidPointer,
+          "agent_connect(NULL) == InvalidPointer");
+    check(agent_recv(nullptr, buf, 1, ip, 4433) == AgentResultInvalidPointer,
+          "agent_recv(NULL) == InvalidPointer");
+    check(agent_poll(nullptr, buf, &len, &port) == AgentResultInvalidPointer,
+          "agent_poll(NULL) == InvalidPointer");
+    check(agent_send_datagram(nullptr, buf, 1) == AgentResultInvalidPointer,
+          "agent_send_datagram(NULL) == InvalidPointer");
+    check(agent_recv_datagram(nullptr, buf, &len) == AgentResultInvalidPointer,
+          "agent_recv_datagram(NULL) == InvalidPointer");
+    agent_on_timeout(nullptr);
+    agent_destroy(nullptr);
+    check(true, "agent_on_timeout(NULL) / agent_destroy(NULL) are no-ops");
+
+    Agent* agent = agent_create(nullptr, false);
+    check(agent != nullptr, "agent_create(NULL, false) returns an agent");
+    if (!agent) return;
+
+    check(agent_get_state(agent) == AgentStateDisconnected, "fresh agent is Disconnected");
+    check(agent_max_datagram_size(agent) == 0, "agent_max_datagram_size before connect == 0");
+    check(agent_poll(agent, nullptr, &len, &port) == AgentResultInvalidPointer,
+          "agent_poll(out_data=NULL) == InvalidPointer");
+    check(agent_recv(agent, buf, 1, nullptr, 4433) == AgentResultInvalidPointer,
+          "agent_recv(from_ip=NULL) == InvalidPointer");
+    check(agent_set_local_addr(agent, ip, 3, 5000) == AgentResultInvalidPointer,
+          "agent_set_local_addr(ip_len=3) == InvalidPointer");
+    check(agent_set_local_addr(agent, ip, 4, 5000) == AgentResultOk,
+          "agent_set_local_addr(ip_len=4) == Ok");
+
+    len = sizeof(buf);
+    check(agent_poll(agent, buf, &len, &port) == AgentResultNoData,
+          "agent_poll before connect == NoData");
+    len = sizeof(buf);
+    check(agent_recv_datagram(agent, buf, &len) == AgentResultNoData,
+          "agent_recv_datagram on empty queue == NoData");
+    check(agent_send_datagram(agent, buf, 20) == AgentResultNotConnected,
+          "agent_send_datagram before connect == NotConnected");
+    check(agent_register(agent, "svc") == AgentResultNotConnected,
+          "agent_register before connect == NotConnected");
+    check(agent_connect(agent, "not-an-ip", 4433) == AgentResultInvalidAddress,
+          "agent_connect(unparseable host) == InvalidAddress");
+
+    size_t qlog_bytes = 0;
+    check(agent_set_qlog(nullptr, count_qlog_bytes, &qlog_bytes) == AgentResultInvalidPointer,
+          "agent_set_qlog(NULL) == InvalidPointer");
+    check(agent_set_qlog(agent, count_qlog_bytes, &qlog_bytes) == AgentResultOk,
+          "agent_set_qlog(callback) == Ok");
+    check(agent_set_congestion_control(agent, 0, "bbr2", true, true) == AgentResultOk,
+          "agent_set_congestion_control(relay, bbr2) == Ok");
+    check(agent_set_congestion_control(agent, 1, "vegas", true, true) ==
+              AgentResultQuicCongestionControl,
+          "agent_set_congestion_control(unknown algorithm) == QuicCongestionControl");
+    check(agent_set_congestion_control(agent, 2, "cubic", true, true) == AgentResultInvalidPointer,
+          "agent_set_congestion_control(path=2) == InvalidPointer");
+
+    const AgentClassRule rules[] = {
+        {6, 0xFF, 0, 0, 443, 443},  // HTTPS interactive
+        {0, 0xFF, 2, 0, 0, 0},      // everything else bulk
+    };
+    check(agent_set_class_rules(agent, rules, 2) == AgentResultOk, "agent_set_class_rules == Ok");
+    AgentClassRule bad = rules[0];
+    bad.class_id = 3;
+    check(agent_set_class_rules(agent, &bad, 1) == AgentResultInvalidPointer,
+          "agent_set_class_rules(unknown class) == InvalidPointer");
+    check(agent_set_class_rules(agent, nullptr, 0) == AgentResultOk,
+          "agent_set_class_rules(NULL) restores defaults");
+
+    // After connect the Initial is queued; a 1-byte buffer must be rejected
+    // without losing the connection.
+    check(agent_connect(agent, "127.0.0.1", 4433) == AgentResultOk,
+          "agent_connect(127.0.0.1) == Ok");
+    check(agent_get_state(agent) == AgentStateConnecting, "state is Connecting after connect");
+    len = 1;
+    check(agent_poll(agent, buf, &len, &port) == AgentResultBufferTooSmall,
+          "agent_poll(capacity=1) == BufferTooSmall");
+    check(agent_timeout_ms(agent) > 0, "agent_timeout_ms > 0 while handshaking");
+    check(qlog_bytes > 0, "qlog callback receives the connection trace");
+    check(agent_set_qlog(agent, nullptr, nullptr) == AgentResultOk, "agent_set_qlog(NULL) == Ok");
+
+    AgentTraceRecord trace[64];
+    check(agent_drain_trace(nullptr, trace, 64) == 0, "agent_drain_trace(NULL) == 0");
+    check(agent_drain_trace(agent, nullptr, 64) == 0, "agent_drain_trace(out=NULL) == 0");
+    size_t n = agent_drain_trace(agent, trace, 64);
+    bool saw_connecting = false;
+    for (size_t i = 0; i < n; i++) {
+        saw_connecting |= trace[i].kind == AgentTraceState &&
+                          trace[i].arg0 == static_cast<uint32_t>(AgentStateConnecting);
+    }
+    check(saw_connecting, "agent_drain_trace reports the Connecting transition");
+    check(agent_drain_trace(agent, trace, 64) == 0, "agent_drain_trace does not repeat records");
+    const AgentTrace* trace_handle = agent_trace_handle(agent);
+    check(trace_handle != nullptr, "agent_trace_handle != NULL");
+    check(agent_trace_drain(trace_handle, trace, 64) == 0, "agent_trace_drain shares the ring");
+    agent_trace_release(trace_handle);
+
+    AgentStats stats{};
+    check(agent_get_stats(nullptr, &stats) == AgentResultInvalidPointer,
+          "agent_get_stats(NULL) == InvalidPointer");
+    stats.struct_size = 8;
+    check(agent_get_stats(agent, &stats) == AgentResultBufferTooSmall,
+          "agent_get_stats(struct_size=8) == BufferTooSmall");
+    stats.struct_size = sizeof(stats);
+    check(agent_get_stats(agent, &stats) == AgentResultOk && stats.version == AGENT_STATS_VERSION,
+          "agent_get_stats returns the current version");
+    check(stats.state == AgentStateConnecting && stats.has_intermediate == 1 &&
+              stats.intermediate.peer_port == 4433,
+          "agent_get_stats reports the Intermediate connection");
+
+    agent_destroy(agent);
+}
+
+// ============================================================================
+// Benchmark
+// ============================================================================
+
+struct Bench {
+    Agent* agent = nullptr;
+    int fd = -1;
+    sockaddr_in server{};
+    uint8_t server_ip[4]{};
+    uint8_t buf[65535];
+
+    CallStats st_poll{"agent_poll"};
+    CallStats st_recv{"agent_recv"};
+    CallStats st_send{"agent_send_datagram"};
+    CallStats st_recv_dgram{"agent_recv_datagram"};
+    CallStats st_on_timeout{"agent_on_timeout"};
+    CallStats st_timeout_ms{"agent_timeout_ms"};
+
+    // Outcome of handing agent_poll output to the socket
+    uint64_t sock_sent = 0;
+    uint64_t sock_errors = 0;
+    int sock_errno = 0;
+
+    ~Bench() {
+        if (agent) agent_destroy(agent);
+        if (fd >= 0) close(fd);
+    }
+
+    // Drain agent_poll into the socket. The socket is connect()ed to the
+    // server, so this uses send(): sendto() with an address fails with
+    // EISCONN on macOS.
+    void flush() {
+        for (;;) {
+            size_t len = kMaxDatagramSize;
+            uint16_t port = 0;
+            uint64_t ns = 0;
+            AgentResult r = timed([&] { return agent_poll(agent, buf, &len, &port); }, &ns);
+            st_poll.record(ns, r == AgentResultOk, len);
+            if (r != AgentResultOk) break;
+            if (send(fd, buf, len, 0) == static_cast<ssize_t>(len)) {
+                sock_sent++;
+            } else {
+                sock_errors++;
+                sock_errno = errno;
+            }
+        }
+    }
+
+    // Wait up to `wait_ms` for socket input, feed everything to agent_recv,
+    // then drain agent_recv_datagram. Returns number of tunnel packets read.
+    size_t pump(int wait_ms) {
+        size_t tunnel = 0;
+        pollfd pfd{fd, POLLIN, 0};
+        if (::poll(&pfd, 1, wait_ms) > 0) {
+            for (;;) {
+                sockaddr_in from{};
+                socklen_t flen = sizeof(from);
+                ssize_t n = recvfrom(fd, buf, sizeof(buf), MSG_DONTWAIT,
+                                     reinterpret_cast<sockaddr*>(&from), &flen);
+                if (n <= 0) break;
+                uint8_t from_ip[4];
+                std::memcpy(from_ip, &from.sin_addr.s_addr, 4);
+                uint64_t ns = 0;
+                AgentResult r = timed(
+                    [&] {
+                        return agent_recv(agent, buf, static_cast<size_t>(n), from_ip,
+                                          ntohs(from.sin_port));
+                    },
+                    &ns);
+                st_recv.record(ns, r == AgentResultOk, static_cast<size_t>(n));
+            }
+        }
+        for (;;) {
+            size_t len = sizeof(buf);
+            uint64_t ns = 0;
+            AgentResult r = timed([&] { return agent_recv_datagram(agent, buf, &len); }, &ns);
+            st_recv_dgram.record(ns, r == AgentResultOk, len);
+            if (r != AgentResultOk) break;
+            tunnel++;
+        }
+        return tunnel;
+    }
+
+    // Service the QUIC timer if it has fired.
+    void tick() {
+        uint64_t ns = 0;
+        uint64_t ms = timed([&] { return agent_timeout_ms(agent); }, &ns);
+        st_timeout_ms.record(ns, true, 0);
+        if (ms == 0) {
+            timed(
+                [&] {
+                    agent_on_timeout(agent);
+                    return 0;
+                },
+                &ns);
+            st_on_timeout.record(ns, true, 0);
+        }
+    }
+};
+
+// Build a minimal IPv4/UDP packet of `size` bytes addressed to the service
+// virtual IP, so the relay forwards it like real tunnel traffic.
+std::vector<uint8_t> build_probe(size_t size, uint32_t seq) {
+    std::vector<uint8_t> pkt(size, 0);
+    pkt[0] = 0x45;
+    pkt[2] = static_cast<uint8_t>(size >> 8);
+    pkt[3] = static_cast<uint8_t>(size);
+    pkt[6] = 0x40;
+    pkt[8] = 64;
+    pkt[9] = 17;
+    const uint8_t src[4] = {100, 64, 0, 1};
+    const uint8_t dst[4] = {10, 100, 0, 1};
+    std::memcpy(&pkt[12], src, 4);
+    std::memcpy(&pkt[16], dst, 4);
+    uint32_t sum = 0;
+    for (int i = 0; i < 20; i += 2) sum += (pkt[i] << 8) | pkt[i + 1];
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    uint16_t cksum = static_cast<uint16_t>(~sum);
+    pkt[10] = static_cast<uint8_t>(cksum >> 8);
+    pkt[11] = static_cast<uint8_t>(cksum);
+    uint16_t udp_len = static_cast<uint16_t>(size - 20);
+    pkt[20] = 0xC0;
+    pkt[21] = 0x00;
+    pkt[22] = static_cast<uint8_t>(9999 >> 8);
+    pkt[23] = static_cast<uint8_t>(9999 & 0xFF);
+    pkt[24] = static_cast<uint8_t>(udp_len >> 8);
+    pkt[25] = static_cast<uint8_t>(udp_len);
+    if (size >= 32) std::memcpy(&pkt[28], &seq, sizeof(seq));
+    return pkt;
+}
+
+bool run_benchmark(const Options& opts) {
+    std::printf("\nBenchmark: %s:%u service=%s packets=%zu size=%zu\n", opts.server.c_str(),
+                opts.port, opts.service.c_str(), opts.packets, opts.size);
+
+    Bench b;
+    b.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (b.fd < 0) {
+        std::perror("socket");
+        return false;
+    }
+    b.server.sin_family = AF_INET;
+    b.server.sin_port = htons(opts.port);
+    if (inet_pton(AF_INET, opts.server.c_str(), &b.server.sin_addr) != 1) {
+        std::fprintf(stderr, "--server must be an IPv4 address\n");
+        return false;
+    }
+    std::memcpy(b.server_ip, &b.server.sin_addr.s_addr, 4);
+    if (connect(b.fd, reinterpret_cast<sockaddr*>(&b.server), sizeof(b.server)) != 0) {
+        std::perror("connect");
+        return false;
+    }
+    sockaddr_in local{};
+    socklen_t llen = sizeof(local);
+    getsockname(b.fd, reinterpret_cast<sockaddr*>(&local), &llen);
+
+    uint64_t ns = 0;
+    b.agent = timed(
+        [&] {
+            return agent_create(opts.ca_path.empty() ? nullptr : opts.ca_path.c_str(),
+                                opts.verify_peer);
+        },
+        &ns);
+    std::printf("  agent_create           %llu ns\n", static_cast<unsigned long long>(ns));
+    if (!b.agent) {
+        std::fprintf(stderr, "agent_create failed (bad CA path?)\n");
+        return false;
+    }
+
+    uint8_t local_ip[4];
+    std::memcpy(local_ip, &local.sin_addr.s_addr, 4);
+    agent_set_local_addr(b.agent, local_ip, 4, ntohs(local.sin_port));
+
+    AgentResult r = timed(
+        [&] { return agent_connect(b.agent, opts.server.c_str(), opts.port); }, &ns);
+    std::printf("  agent_connect          %llu ns\n", static_cast<unsigned long long>(ns));
+    if (r != AgentResultOk) {
+        std::fprintf(stderr, "agent_connect failed: %d\n", r);
+        return false;
+    }
+
+    // Handshake
+    auto hs_start = Clock::now();
+    while (!agent_is_connected(b.agent)) {
+        b.flush();
+        b.pump(static_cast<int>(std::min<uint64_t>(agent_timeout_ms(b.agent), 100)));
+        b.tick();
+        if (agent_get_state(b.agent) == AgentStateClosed ||
+            Clock::now() - hs_start > std::chrono::seconds(5)) {
+            std::fprintf(stderr, "handshake did not complete (state=%d)\n",
+                         agent_get_state(b.agent));
+            return false;
+        }
+    }
+    std::printf("  handshake              %.2f ms\n",
+                std::chrono::duration<double, std::milli>(Clock::now() - hs_start).count());
+
+    if (agent_register(b.agent, opts.service.c_str()) != AgentResultOk) {
+        std::fprintf(stderr, "agent_register failed\n");
+        return false;
+    }
+    b.flush();
+    b.pump(100);
+
+    // Reset counters so the report only covers the steady-state burst
+    b.st_poll.samples_ns.clear();
+    b.st_recv.samples_ns.clear();
+    b.st_recv_dgram.samples_ns.clear();
+    b.st_on_timeout.samples_ns.clear();
+    b.st_timeout_ms.samples_ns.clear();
+    b.st_poll.ok = b.st_recv.ok = b.st_recv_dgram.ok = 0;
+    b.st_poll.bytes = b.st_recv.bytes = b.st_recv_dgram.bytes = 0;
+    b.sock_sent = b.sock_errors = 0;
+
+    auto burst_start = Clock::now();
+    size_t tunnel_rx = 0;
+    for (size_t i = 0; i < opts.packets; i++) {
+        std::vector<uint8_t> pkt = build_probe(opts.size, static_cast<uint32_t>(i));
+        r = timed([&] { return agent_send_datagram(b.agent, pkt.data(), pkt.size()); }, &ns);
+        b.st_send.record(ns, r == AgentResultOk, pkt.size());
+        b.flush();
+        tunnel_rx += b.pump(0);
+        b.tick();
+    }
+    // Give the relay a moment to return anything still in flight
+    auto drain_deadline = Clock::now() + std::chrono::milliseconds(500);
+    while (Clock::now() < drain_deadline) {
+        b.flush();
+        tunnel_rx += b.pump(10);
+        b.tick();
+    }
+    double wall = std::chrono::duration<double>(Clock::now() - burst_start).count();
+
+    std::printf("\nPer-call results (%.3f s wall, %zu tunnel packets returned):\n", wall,
+                tunnel_rx);
+    b.st_send.report(wall);
+    b.st_poll.report(wall);
+    b.st_recv.report(wall);
+    b.st_recv_dgram.report(wall);
+    b.st_timeout_ms.report(wall);
+    b.st_on_timeout.report(wall);
+    std::printf("  %-22s sent=%-9llu errors=%llu%s%s\n", "socket send",
+                static_cast<unsigned long long>(b.sock_sent),
+                static_cast<unsigned long long>(b.sock_errors), b.sock_errors ? "  last: " : "",
+                b.sock_errors ? std::strerror(b.sock_errno) : "");
+    if (b.sock_sent == 0 && b.sock_errors > 0) {
+        std::fprintf(stderr, "no datagram reached the socket; results are not meaningful\n");
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parse_args(argc, argv, &opts)) return 2;
+
+    run_conformance();
+    std::printf("Conformance: %d failure(s)\n", g_failures);
+
+    bool bench_ok = true;
+    if (!opts.conformance_only) bench_ok = run_benchmark(opts);
+
+    return (g_failures == 0 && bench_ok) ? 0 : 1;
+}
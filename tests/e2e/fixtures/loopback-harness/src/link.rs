@@ -0,0 +1,341 @@
+//! Simulated link layer
+//!
+//! A [`Pipe`] models one direction of a link the way `tc netem` + `tbf` would:
+//! a bottleneck that serializes packets at `rate`, a byte-bounded queue in
+//! front of it, then propagation `delay` ± `jitter`. Loss is applied before the
+//! queue; reordered packets skip the propagation delay and overtake whatever is
+//! in flight. Jitter alone never reorders, so the only reordering is the one
+//! asked for.
+//!
+//! All randomness comes from a seeded [`Rng`], so a given seed and packet
+//! sequence always produce the same drop/delay decisions.
+
+use std::time::{Duration, Instant};
+
+/// Default bottleneck queue when a rate cap is set (bytes)
+const DEFAULT_QUEUE_BYTES: usize = 64 * 1024;
+
+/// SplitMix64 — small, fast and good enough for impairment decisions.
+#[derive(Debug, Clone)]
+pub struct Rng(u64);
+
+impl Rng {
+    pub fn new(seed: u64) -> Self {
+        Rng(seed)
+    }
+
+    pub fn next_u64(&mut self) -> u64 {
+        self.0 = self.0.wrapping_add(0x9E37_79B9_7F4A_7C15);
+        let mut z = self.0;
+        z = (z ^ (z >> 30)).wrapping_mul(0xBF58_476D_1CE4_E5B9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94D0_49BB_1331_11EB);
+        z ^ (z >> 31)
+    }
+
+    /// Uniform in [0, 1)
+    pub fn next_f64(&mut self) -> f64 {
+        (self.next_u64() >> 11) as f64 / (1u64 << 53) as f64
+    }
+
+    pub fn chance(&mut self, p: f64) -> bool {
+        p > 0.0 && self.next_f64() < p
+    }
+}
+
+/// Impairment for one direction of a link.
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct LinkParams {
+    pub delay: Duration,
+    pub jitter: Duration,
+    /// Drop probability in [0, 1]
+    pub loss: f64,
+    /// Probability a packet skips the propagation delay, in [0, 1]
+    pub reorder: f64,
+    /// Bottleneck rate in bits/s (0 = unlimited)
+    pub rate_bps: u64,
+    /// Bottleneck queue size in bytes; tail-drop beyond this
+    pub queue_bytes: usize,
+}
+
+impl LinkParams {
+    /// Parse `key=value[,key=value...]`, e.g.
+    /// `delay=20ms,jitter=2ms,loss=1%,reorder=0.5%,rate=10mbit,queue=32k`.
+    /// An empty string or `none` is an unimpaired link.
+    pub fn parse(spec: &str) -> Result<Self, String> {
+        let mut params = LinkParams::default();
+        let spec = spec.trim();
+        if spec.is_empty() || spec == "none" {
+            return Ok(params);
+        }
+
+        let mut queue_set = false;
+        for item in spec.split(',') {
+            let (key, value) = item
+                .split_once('=')
+                .ok_or_else(|| format!("expected key=value, got '{}'", item))?;
+            match key.trim() {
+                "delay" => params.delay = parse_duration(value)?,
+                "jitter" => params.jitter = parse_duration(value)?,
+                "loss" => params.loss = parse_probability(value)?,
+                "reorder" => params.reorder = parse_probability(value)?,
+                "rate" => params.rate_bps = parse_rate(value)?,
+                "queue" => {
+                    params.queue_bytes = parse_bytes(value)?;
+                    queue_set = true;
+                }
+                other => return Err(format!("unknown link parameter '{}'", other)),
+            }
+        }
+        if params.rate_bps > 0 && !queue_set {
+            params.queue_bytes = DEFAULT_QUEUE_BYTES;
+        }
+        Ok(params)
+    }
+
+    /// Parse `UP[/DOWN]`; a single spec applies to both directions.
+    pub fn parse_pair(spec: &str) -> Result<(Self, Self), String> {
+        match spec.split_once('/') {
+            Some((up, down)) => Ok((Self::parse(up)?, Self::parse(down)?)),
+            None => {
+                let p = Self::parse(spec)?;
+                Ok((p.clone(), p))
+            }
+        }
+    }
+}
+
+impl std::fmt::Display for LinkParams {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(
+            f,
+            "delay={}us jitter={}us loss={:.4} reorder={:.4} rate={}bps queue={}B",
+            self.delay.as_micros(),
+            self.jitter.as_micros(),
+            self.loss,
+            self.reorder,
+            self.rate_bps,
+            self.queue_bytes
+        )
+    }
+}
+
+fn parse_duration(s: &str) -> Result<Duration, String> {
+    let s = s.trim();
+    let (num, scale_us) = if let Some(n) = s.strip_suffix("us") {
+        (n, 1.0)
+    } else if let Some(n) = s.strip_suffix("ms") {
+        (n, 1_000.0)
+    } else if let Some(n) = s.strip_suffix('s') {
+        (n, 1_000_000.0)
+    } else {
+        (s, 1_000.0) // bare numbers are milliseconds, like netem
+    };
+    let v: f64 = num
+        .parse()
+        .map_err(|_| format!("invalid duration '{}'", s))?;
+    if v < 0.0 {
+        return Err(format!("negative duration '{}'", s));
+    }
+    Ok(Duration::from_micros((v * scale_us) as u64))
+}
+
+fn parse_probability(s: &str) -> Result<f64, String> {
+    let s = s.trim();
+    let v = match s.strip_suffix('%') {
+        Some(n) => n.parse::<f64>().map(|v| v / 100.0),
+        None => s.parse::<f64>(),
+    }
+    .map_err(|_| format!("invalid probability '{}'", s))?;
+    if !(0.0..=1.0).contains(&v) {
+        return Err(format!("probability out of range '{}'", s));
+    }
+    Ok(v)
+}
+
+fn parse_rate(s: &str) -> Result<u64, String> {
+    let lower = s.trim().to_ascii_lowercase();
+    let (num, scale) = if let Some(n) = lower.strip_suffix("gbit") {
+        (n, 1e9)
+    } else if let Some(n) = lower.strip_suffix("mbit") {
+        (n, 1e6)
+    } else if let Some(n) = lower.strip_suffix("kbit") {
+        (n, 1e3)
+    } else if let Some(n) = lower.strip_suffix("bit") {
+        (n, 1.0)
+    } else {
+        (lower.as_str(), 1.0)
+    };
+    let v: f64 = num.parse().map_err(|_| format!("invalid rate '{}'", s))?;
+    Ok((v * scale) as u64)
+}
+
+fn parse_bytes(s: &str) -> Result<usize, String> {
+    let lower = s.trim().to_ascii_lowercase();
+    let lower = lower.strip_suffix('b').unwrap_or(&lower);
+    let (num, scale) = if let Some(n) = lower.strip_suffix('m') {
+        (n, 1024 * 1024)
+    } else if let Some(n) = lower.strip_suffix('k') {
+        (n, 1024)
+    } else {
+        (lower, 1)
+    };
+    let v: usize = num.parse().map_err(|_| format!("invalid size '{}'", s))?;
+    Ok(v * scale)
+}
+
+/// Per-direction counters
+#[derive(Debug, Clone, Copy, Default)]
+pub struct PipeStats {
+    pub packets: u64,
+    pub bytes: u64,
+    pub dropped_loss: u64,
+    pub dropped_queue: u64,
+    pub reordered: u64,
+}
+
+/// One direction of a simulated link.
+pub struct Pipe {
+    params: LinkParams,
+    rng: Rng,
+    /// When the bottleneck finishes serializing everything queued so far
+    busy_until: Option<Instant>,
+    /// Latest in-order arrival, to keep jitter from reordering
+    last_arrival: Option<Instant>,
+    pub stats: PipeStats,
+}
+
+impl Pipe {
+    pub fn new(params: LinkParams, seed: u64) -> Self {
+        Pipe {
+            params,
+            rng: Rng::new(seed),
+            busy_until: None,
+            last_arrival: None,
+            stats: PipeStats::default(),
+        }
+    }
+
+    /// Offer a `len`-byte packet at `now`.
+    ///
+    /// Returns when it arrives at the far end, or `None` if the link dropped it.
+    pub fn admit(&mut self, now: Instant, len: usize) -> Option<Instant> {
+        self.stats.packets += 1;
+
+        if self.rng.chance(self.params.loss) {
+            self.stats.dropped_loss += 1;
+            return None;
+        }
+
+        let departure = if self.params.rate_bps > 0 {
+            let start = self.busy_until.map_or(now, |b| b.max(now));
+            let backlog_bytes = (start - now).as_secs_f64() * self.params.rate_bps as f64 / 8.0;
+            if backlog_bytes as usize + len > self.params.queue_bytes {
+                self.stats.dropped_queue += 1;
+                return None;
+            }
+            let tx = Duration::from_secs_f64(len as f64 * 8.0 / self.params.rate_bps as f64);
+            let done = start + tx;
+            self.busy_until = Some(done);
+            done
+        } else {
+            now
+        };
+
+        self.stats.bytes += len as u64;
+
+        if self.rng.chance(self.params.reorder) {
+            self.stats.reordered += 1;
+            return Some(departure);
+        }
+
+        let mut delay = self.params.delay;
+        if !self.params.jitter.is_zero() {
+            let j = self.params.jitter.as_secs_f64();
+            let offset = (self.rng.next_f64() * 2.0 - 1.0) * j;
+            delay = Duration::from_secs_f64((delay.as_secs_f64() + offset).max(0.0));
+        }
+
+        let arrival = departure + delay;
+        let arrival = self.last_arrival.map_or(arrival, |last| arrival.max(last));
+        self.last_arrival = Some(arrival);
+        Some(arrival)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_parse_link_params() {
+        let p =
+            LinkParams::parse("delay=20ms,jitter=500us,loss=1%,reorder=0.002,rate=10mbit").unwrap();
+        assert_eq!(p.delay, Duration::from_millis(20));
+        assert_eq!(p.jitter, Duration::from_micros(500));
+        assert!((p.loss - 0.01).abs() < 1e-9);
+        assert!((p.reorder - 0.002).abs() < 1e-9);
+        assert_eq!(p.rate_bps, 10_000_000);
+        assert_eq!(p.queue_bytes, DEFAULT_QUEUE_BYTES);
+
+        assert_eq!(LinkParams::parse("none").unwrap(), LinkParams::default());
+        assert_eq!(
+            LinkParams::parse("queue=16k").unwrap().queue_bytes,
+            16 * 1024
+        );
+        assert!(LinkParams::parse("loss=150%").is_err());
+        assert!(LinkParams::parse("bogus=1").is_err());
+    }
+
+    #[test]
+    fn test_parse_pair_asymmetric() {
+        let (up, down) = LinkParams::parse_pair("delay=5ms/delay=40ms").unwrap();
+        assert_eq!(up.delay, Duration::from_millis(5));
+        assert_eq!(down.delay, Duration::from_millis(40));
+    }
+
+    #[test]
+    fn test_pipe_delay_is_fifo_under_jitter() {
+        let params = LinkParams::parse("delay=10ms,jitter=9ms").unwrap();
+        let mut pipe = Pipe::new(params, 7);
+        let now = Instant::now();
+        let mut last = now;
+        for i in 0..1000 {
+            let at = pipe
+                .admit(now + Duration::from_micros(i * 10), 100)
+                .unwrap();
+            assert!(at >= last);
+            assert!(at >= now + Duration::from_millis(1));
+            last = at;
+        }
+    }
+
+    #[test]
+    fn test_pipe_rate_and_queue() {
+        // 8 Mbit/s → 1000 bytes takes 1ms; queue fits 3 packets
+        let params = LinkParams::parse("rate=8mbit,queue=3000").unwrap();
+        let mut pipe = Pipe::new(params, 1);
+        let now = Instant::now();
+
+        let arrivals: Vec<_> = (0..4).map(|_| pipe.admit(now, 1000)).collect();
+        let us = |at: Option<Instant>| (at.unwrap() - now).as_micros();
+        assert!((999..=1001).contains(&us(arrivals[0])));
+        assert!((2999..=3001).contains(&us(arrivals[2])));
+        assert_eq!(arrivals[3], None);
+        assert_eq!(pipe.stats.dropped_queue, 1);
+    }
+
+    #[test]
+    fn test_pipe_loss_is_seeded() {
+        let params = LinkParams::parse("loss=30%").unwrap();
+        let now = Instant::now();
+        let run = |seed| {
+            let mut pipe = Pipe::new(params.clone(), seed);
+            (0..1000)
+                .map(|_| pipe.admit(now, 100).is_some())
+                .collect::<Vec<_>>()
+        };
+        assert_eq!(run(42), run(42));
+        let delivered = run(42).iter().filter(|d| **d).count();
+        assert!((600..800).contains(&delivered), "delivered {}", delivered);
+    }
+}
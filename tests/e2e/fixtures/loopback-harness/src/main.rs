@@ -0,0 +1,1185 @@
+//! Loopback E2E Harness
+//!
+//! Runs the whole relay and P2P data path on one machine with a simulated
+//! network in between, so transport and path-selection changes can be
+//! compared on a laptop under the same impairment every time:
+//!
+//! ```text
+//!                       relay link              connector link
+//!  Agent ──NAT──┬──────[up/down]──────► Intermediate ◄──[up/down]── proxy ◄── App Connector ──► udp echo
+//!  (in-process) │                                                             ▲
+//!               └──────[up/down]──── p2p link ────────────────────────────────┘ (--p2p-listen-port)
+//! ```
+//!
+//! The Agent is the `packet_processor` library driven through the same C ABI
+//! Swift uses; every packet it polls is routed here through the agent-side
+//! [`nat::Nat`] and a [`link::Pipe`] per direction. The Intermediate Server
+//! and App Connector are binaries without library targets, so they run as
+//! child processes on 127.0.0.1; the Connector reaches the Intermediate via an
+//! impairing UDP proxy. The echo backend runs in a thread.
+//!
+//! Impairment decisions come from a seeded RNG. Scheduling across processes
+//! still depends on the OS, so compare runs by their distributions, not by
+//! individual packets.
+//!
+//! Note: the Connector always sends return traffic through the Intermediate,
+//! so P2P round trips are direct uplink + relayed downlink.
+//!
+//! Usage:
+//!   loopback-harness [--path relay|p2p|both] [--duration 5] [--rate 1000]
+//!                    [--relay-link SPEC] [--p2p-link SPEC] [--connector-link SPEC]
+//!                    [--nat SPEC] [--seed N]
+//!
+//! Run `loopback-harness --help` for the SPEC syntax.
+
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
+use std::ffi::CString;
+use std::fs::File;
+use std::io;
+use std::net::{Ipv4Addr, SocketAddr, UdpSocket as StdUdpSocket};
+use std::path::{Path, PathBuf};
+use std::process::{Child, Command, Stdio};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+use std::thread;
+use std::time::{Duration, Instant};
+
+use mio::net::UdpSocket;
+use mio::{Events, Interest, Poll, Token};
+
+use packet_processor::{
+    agent_connect, agent_connect_p2p, agent_create, agent_destroy, agent_is_connected,
+    agent_is_p2p_connected, agent_on_timeout, agent_poll, agent_poll_p2p, agent_recv,
+    agent_recv_datagram, agent_register, agent_send_datagram, agent_send_datagram_p2p,
+    agent_send_intermediate_keepalive, agent_set_local_addr, agent_timeout_ms, Agent, AgentResult,
+};
+
+mod link;
+mod nat;
+
+use link::{LinkParams, Pipe, PipeStats};
+use nat::{Nat, NatConfig};
+
+// ============================================================================
+// Constants
+// ============================================================================
+
+/// Buffer size for QUIC packets and tunnelled IP packets
+const MAX_PACKET_SIZE: usize = 65535;
+
+/// Agent's address inside the NAT (never bound; only reported to quiche)
+const AGENT_INSIDE_PORT: u16 = 50_000;
+
+/// Tunnel addresses of the synthetic UDP flow
+const FLOW_SRC: (Ipv4Addr, u16) = (Ipv4Addr::new(100, 64, 0, 1), 40_000);
+const FLOW_DST: (Ipv4Addr, u16) = (Ipv4Addr::new(10, 100, 0, 1), 9_999);
+
+/// Probe payload: [magic(2), tag, 0, seq(4), sent_ns(8), padding...]
+const PROBE_MAGIC: [u8; 2] = *b"LB";
+const PROBE_HEADER_LEN: usize = 16;
+
+/// Tag for setup probes (measurement phases use their own tags)
+const SETUP_TAG: u8 = 0;
+
+const SETUP_TIMEOUT: Duration = Duration::from_secs(15);
+const KEEPALIVE_INTERVAL: Duration = Duration::from_secs(10);
+const NAT_EXPIRY_TICK: Duration = Duration::from_millis(250);
+
+const CONNECTOR_INNER: Token = Token(0);
+const CONNECTOR_OUTER: Token = Token(1);
+const FIRST_NAT_TOKEN: usize = 16;
+
+// ============================================================================
+// Configuration
+// ============================================================================
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum PathKind {
+    Relay,
+    P2p,
+}
+
+impl PathKind {
+    fn label(self) -> &'static str {
+        match self {
+            PathKind::Relay => "RELAY",
+            PathKind::P2p => "P2P",
+        }
+    }
+
+    fn tag(self) -> u8 {
+        match self {
+            PathKind::Relay => 1,
+            PathKind::P2p => 2,
+        }
+    }
+}
+
+struct HarnessConfig {
+    intermediate_bin: PathBuf,
+    connector_bin: PathBuf,
+    cert: PathBuf,
+    key: PathBuf,
+    service_id: String,
+    paths: Vec<PathKind>,
+    relay_link: (LinkParams, LinkParams),
+    p2p_link: (LinkParams, LinkParams),
+    connector_link: (LinkParams, LinkParams),
+    nat: NatConfig,
+    rate: u64,
+    duration: Duration,
+    drain: Duration,
+    payload_size: usize,
+    seed: u64,
+    log_dir: Option<PathBuf>,
+}
+
+impl HarnessConfig {
+    fn from_args(args: &[String]) -> Result<Self, String> {
+        let root = PathBuf::from(concat!(env!("CARGO_MANIFEST_DIR"), "/../../../.."));
+        let path_arg = |flag: &str, env: &str, default: PathBuf| {
+            parse_arg(args, flag)
+                .or_else(|| std::env::var(env).ok())
+                .map(PathBuf::from)
+                .unwrap_or(default)
+        };
+        let link_arg = |flag: &str| {
+            LinkParams::parse_pair(&parse_arg(args, flag).unwrap_or_default())
+                .map_err(|e| format!("{}: {}", flag, e))
+        };
+        let num_arg = |flag: &str, default: u64| -> Result<u64, String> {
+            parse_arg(args, flag)
+                .map(|v| {
+                    v.parse()
+                        .map_err(|_| format!("{}: invalid number '{}'", flag, v))
+                })
+                .unwrap_or(Ok(default))
+        };
+
+        let paths = match parse_arg(args, "--path").as_deref().unwrap_or("both") {
+            "relay" => vec![PathKind::Relay],
+            "p2p" => vec![PathKind::P2p],
+            "both" => vec![PathKind::Relay, PathKind::P2p],
+            other => return Err(format!("--path: expected relay|p2p|both, got '{}'", other)),
+        };
+
+        let payload_size = num_arg("--payload-size", 1000)? as usize;
+        if payload_size < PROBE_HEADER_LEN {
+            return Err(format!(
+                "--payload-size must be at least {}",
+                PROBE_HEADER_LEN
+            ));
+        }
+        let rate = num_arg("--rate", 1000)?;
+        if rate == 0 {
+            return Err("--rate must be positive".to_string());
+        }
+
+        Ok(HarnessConfig {
+            intermediate_bin: path_arg(
+                "--intermediate-bin",
+                "INTERMEDIATE_BIN",
+                root.join("intermediate-server/target/release/intermediate-server"),
+            ),
+            connector_bin: path_arg(
+                "--connector-bin",
+                "CONNECTOR_BIN",
+                root.join("app-connector/target/release/app-connector"),
+            ),
+            cert: path_arg("--cert", "LOOPBACK_CERT", root.join("certs/cert.pem")),
+            key: path_arg("--key", "LOOPBACK_KEY", root.join("certs/key.pem")),
+            service_id: parse_arg(args, "--service").unwrap_or_else(|| "loopback".to_string()),
+            paths,
+            relay_link: link_arg("--relay-link")?,
+            p2p_link: link_arg("--p2p-link")?,
+            connector_link: link_arg("--connector-link")?,
+            nat: NatConfig::parse(&parse_arg(args, "--nat").unwrap_or_default())
+                .map_err(|e| format!("--nat: {}", e))?,
+            rate,
+            duration: Duration::from_secs(num_arg("--duration", 5)?),
+            drain: Duration::from_millis(num_arg("--drain-ms", 1000)?),
+            payload_size,
+            seed: num_arg("--seed", 1)?,
+            log_dir: parse_arg(args, "--log-dir").map(PathBuf::from),
+        })
+    }
+}
+
+fn parse_arg(args: &[String], flag: &str) -> Option<String> {
+    args.iter()
+        .position(|a| a == flag)
+        .and_then(|i| args.get(i + 1))
+        .cloned()
+}
+
+// ============================================================================
+// Child processes
+// ============================================================================
+
+/// Intermediate Server and App Connector; killed on drop.
+struct Children(Vec<(&'static str, Child)>);
+
+impl Children {
+    fn spawn(
+        &mut self,
+        name: &'static str,
+        bin: &Path,
+        args: &[String],
+        log_dir: Option<&PathBuf>,
+    ) -> io::Result<()> {
+        let (stdout, stderr) = match log_dir {
+            Some(dir) => {
+                let file = File::create(dir.join(format!("{}.log", name)))?;
+                (Stdio::from(file.try_clone()?), Stdio::from(file))
+            }
+            None => (Stdio::null(), Stdio::null()),
+        };
+        let child = Command::new(bin)
+            .args(args)
+            .stdin(Stdio::null())
+            .stdout(stdout)
+            .stderr(stderr)
+            .spawn()
+            .map_err(|e| io::Error::new(e.kind(), format!("{}: {}", bin.display(), e)))?;
+        self.0.push((name, child));
+        Ok(())
+    }
+
+    /// Name of the first child that has already exited, if any.
+    fn exited(&mut self) -> Option<&'static str> {
+        self.0
+            .iter_mut()
+            .find_map(|(name, c)| matches!(c.try_wait(), Ok(Some(_))).then_some(*name))
+    }
+}
+
+impl Drop for Children {
+    fn drop(&mut self) {
+        for (_, child) in &mut self.0 {
+            let _ = child.kill();
+            let _ = child.wait();
+        }
+    }
+}
+
+/// Reserve-and-release a localhost UDP port for a child process to bind.
+fn free_udp_port() -> io::Result<u16> {
+    Ok(StdUdpSocket::bind("127.0.0.1:0")?.local_addr()?.port())
+}
+
+/// UDP echo backend for the Connector's `--forward`.
+fn spawn_echo(stop: Arc<AtomicBool>) -> io::Result<SocketAddr> {
+    let socket = StdUdpSocket::bind("127.0.0.1:0")?;
+    socket.set_read_timeout(Some(Duration::from_millis(100)))?;
+    let addr = socket.local_addr()?;
+    thread::spawn(move || {
+        let mut buf = vec![0u8; MAX_PACKET_SIZE];
+        while !stop.load(Ordering::Relaxed) {
+            if let Ok((len, from)) = socket.recv_from(&mut buf) {
+                let _ = socket.send_to(&buf[..len], from);
+            }
+        }
+    });
+    Ok(addr)
+}
+
+// ============================================================================
+// Measurement
+// ============================================================================
+
+#[derive(Default)]
+struct PathStats {
+    sent: u64,
+    send_errors: u64,
+    received: u64,
+    rx_bytes: u64,
+    rtts_us: Vec<u64>,
+}
+
+impl PathStats {
+    fn percentile(sorted: &[u64], q: f64) -> u64 {
+        if sorted.is_empty() {
+            return 0;
+        }
+        let idx = ((sorted.len() - 1) as f64 * q).round() as usize;
+        sorted[idx]
+    }
+
+    fn report(&mut self, path: PathKind, duration: Duration) {
+        let p = path.label();
+        self.rtts_us.sort_unstable();
+        let lost = self.sent.saturating_sub(self.received);
+        let loss_pct = if self.sent > 0 {
+            lost as f64 * 100.0 / self.sent as f64
+        } else {
+            0.0
+        };
+        let goodput_bps = self.rx_bytes as f64 * 8.0 / duration.as_secs_f64();
+
+        println!("LOOPBACK_{}_SENT:{}", p, self.sent);
+        println!("LOOPBACK_{}_SEND_ERRORS:{}", p, self.send_errors);
+        println!("LOOPBACK_{}_RECEIVED:{}", p, self.received);
+        println!("LOOPBACK_{}_LOSS_PCT:{:.3}", p, loss_pct);
+        println!("LOOPBACK_{}_GOODPUT_BPS:{:.0}", p, goodput_bps);
+        for (name, q) in [
+            ("MIN", 0.0),
+            ("P50", 0.5),
+            ("P90", 0.9),
+            ("P99", 0.99),
+            ("MAX", 1.0),
+        ] {
+            println!(
+                "LOOPBACK_{}_RTT_{}_US:{}",
+                p,
+                name,
+                Self::percentile(&self.rtts_us, q)
+            );
+        }
+    }
+}
+
+/// Traffic currently being generated
+struct Workload {
+    path: PathKind,
+    start: Instant,
+    end: Instant,
+    interval: Duration,
+    next_seq: u32,
+    stats: PathStats,
+}
+
+// ============================================================================
+// Harness
+// ============================================================================
+
+/// Where a packet goes when it leaves the link
+enum Hop {
+    /// Out of the Agent's NAT binding towards `dst`
+    AgentToRemote {
+        binding: Token,
+        dst: SocketAddr,
+    },
+    /// Into the Agent via `agent_recv`
+    RemoteToAgent {
+        from: SocketAddr,
+    },
+    ConnectorToServer,
+    ServerToConnector,
+}
+
+struct InFlight {
+    at: Instant,
+    id: u64,
+    hop: Hop,
+    data: Vec<u8>,
+}
+
+impl PartialEq for InFlight {
+    fn eq(&self, other: &Self) -> bool {
+        (self.at, self.id) == (other.at, other.id)
+    }
+}
+impl Eq for InFlight {}
+impl PartialOrd for InFlight {
+    fn partial_cmp(&self, other: &Self) -> Option<std::cmp::Ordering> {
+        Some(self.cmp(other))
+    }
+}
+impl Ord for InFlight {
+    fn cmp(&self, other: &Self) -> std::cmp::Ordering {
+        (self.at, self.id).cmp(&(other.at, other.id))
+    }
+}
+
+struct Harness {
+    cfg: HarnessConfig,
+    poll: Poll,
+    events: Events,
+    agent: *mut Agent,
+    epoch: Instant,
+
+    server_addr: SocketAddr,
+    p2p_addr: SocketAddr,
+    nat: Nat,
+    relay_up: Pipe,
+    relay_down: Pipe,
+    p2p_up: Pipe,
+    p2p_down: Pipe,
+    connector_up: Pipe,
+    connector_down: Pipe,
+
+    /// The Connector's `--server` points here
+    connector_inner: UdpSocket,
+    /// Talks to the Intermediate on the Connector's behalf
+    connector_outer: UdpSocket,
+    connector_peer: Option<SocketAddr>,
+
+    in_flight: BinaryHeap<Reverse<InFlight>>,
+    next_id: u64,
+    agent_deadline: Instant,
+    next_keepalive: Instant,
+    next_nat_expiry: Instant,
+    setup_echoes: u64,
+    workload: Option<Workload>,
+    buf: Vec<u8>,
+}
+
+impl Harness {
+    fn new(cfg: HarnessConfig, server_addr: SocketAddr, p2p_addr: SocketAddr) -> io::Result<Self> {
+        let poll = Poll::new()?;
+        let mut connector_inner = UdpSocket::bind("127.0.0.1:0".parse().unwrap())?;
+        let mut connector_outer = UdpSocket::bind("127.0.0.1:0".parse().unwrap())?;
+        poll.registry()
+            .register(&mut connector_inner, CONNECTOR_INNER, Interest::READABLE)?;
+        poll.registry()
+            .register(&mut connector_outer, CONNECTOR_OUTER, Interest::READABLE)?;
+
+        // Independent streams per pipe so adding traffic on one path does not
+        // shift the impairment pattern on another
+        let seed = cfg.seed;
+        let pipe =
+            |p: &LinkParams, n: u64| Pipe::new(p.clone(), seed.wrapping_mul(31).wrapping_add(n));
+        let now = Instant::now();
+
+        let agent = unsafe { agent_create(std::ptr::null(), false) };
+        if agent.is_null() {
+            return Err(io::Error::other("agent_create failed"));
+        }
+
+        Ok(Harness {
+            relay_up: pipe(&cfg.relay_link.0, 1),
+            relay_down: pipe(&cfg.relay_link.1, 2),
+            p2p_up: pipe(&cfg.p2p_link.0, 3),
+            p2p_down: pipe(&cfg.p2p_link.1, 4),
+            connector_up: pipe(&cfg.connector_link.0, 5),
+            connector_down: pipe(&cfg.connector_link.1, 6),
+            nat: Nat::new(cfg.nat.clone(), FIRST_NAT_TOKEN),
+            cfg,
+            poll,
+            events: Events::with_capacity(256),
+            agent,
+            epoch: now,
+            server_addr,
+            p2p_addr,
+            connector_inner,
+            connector_outer,
+            connector_peer: None,
+            in_flight: BinaryHeap::new(),
+            next_id: 0,
+            agent_deadline: now,
+            next_keepalive: now + KEEPALIVE_INTERVAL,
+            next_nat_expiry: now + NAT_EXPIRY_TICK,
+            setup_echoes: 0,
+            workload: None,
+            buf: vec![0u8; MAX_PACKET_SIZE],
+        })
+    }
+
+    fn connector_inner_addr(&self) -> io::Result<SocketAddr> {
+        self.connector_inner.local_addr()
+    }
+
+    // ------------------------------------------------------------------------
+    // Event loop
+    // ------------------------------------------------------------------------
+
+    /// Run the loop until `done` holds or `deadline` passes.
+    fn run_until(
+        &mut self,
+        deadline: Instant,
+        mut done: impl FnMut(&Self) -> bool,
+    ) -> io::Result<bool> {
+        loop {
+            if done(self) {
+                return Ok(true);
+            }
+            let now = Instant::now();
+            if now >= deadline {
+                return Ok(false);
+            }
+            self.step(deadline)?;
+        }
+    }
+
+    fn step(&mut self, deadline: Instant) -> io::Result<()> {
+        let mut wake = deadline.min(self.agent_deadline).min(self.next_nat_expiry);
+        if let Some(Reverse(next)) = self.in_flight.peek() {
+            wake = wake.min(next.at);
+        }
+        if let Some(w) = &self.workload {
+            wake = wake.min(self.next_send_time(w));
+        }
+        let timeout = wake.saturating_duration_since(Instant::now());
+
+        self.poll.poll(&mut self.events, Some(timeout))?;
+        let tokens: Vec<Token> = self.events.iter().map(|e| e.token()).collect();
+        let now = Instant::now();
+        for token in tokens {
+            self.read_socket(token, now)?;
+        }
+
+        self.deliver_due(Instant::now());
+        self.service_agent(Instant::now())?;
+        self.generate(Instant::now())?;
+        Ok(())
+    }
+
+    fn schedule(&mut self, at: Instant, hop: Hop, data: &[u8]) {
+        self.next_id += 1;
+        self.in_flight.push(Reverse(InFlight {
+            at,
+            id: self.next_id,
+            hop,
+            data: data.to_vec(),
+        }));
+    }
+
+    fn read_socket(&mut self, token: Token, now: Instant) -> io::Result<()> {
+        loop {
+            let (len, from) = {
+                let socket = match token {
+                    CONNECTOR_INNER => &self.connector_inner,
+                    CONNECTOR_OUTER => &self.connector_outer,
+                    t => match self.nat.socket(t) {
+                        Some(s) => s,
+                        None => return Ok(()),
+                    },
+                };
+                match socket.recv_from(&mut self.buf) {
+                    Ok(r) => r,
+                    Err(e) if e.kind() == io::ErrorKind::WouldBlock => return Ok(()),
+                    Err(e) => return Err(e),
+                }
+            };
+            let data = self.buf[..len].to_vec();
+
+            match token {
+                CONNECTOR_INNER => {
+                    self.connector_peer = Some(from);
+                    if let Some(at) = self.connector_up.admit(now, len) {
+                        self.schedule(at, Hop::ConnectorToServer, &data);
+                    }
+                }
+                CONNECTOR_OUTER => {
+                    if let Some(at) = self.connector_down.admit(now, len) {
+                        self.schedule(at, Hop::ServerToConnector, &data);
+                    }
+                }
+                binding => {
+                    if !self.nat.inbound_allowed(binding, from) {
+                        continue;
+                    }
+                    let pipe = if from == self.p2p_addr {
+                        &mut self.p2p_down
+                    } else {
+                        &mut self.relay_down
+                    };
+                    if let Some(at) = pipe.admit(now, len) {
+                        self.schedule(at, Hop::RemoteToAgent { from }, &data);
+                    }
+                }
+            }
+        }
+    }
+
+    fn deliver_due(&mut self, now: Instant) {
+        while self.in_flight.peek().is_some_and(|Reverse(p)| p.at <= now) {
+            let Reverse(packet) = self.in_flight.pop().unwrap();
+            match packet.hop {
+                Hop::AgentToRemote { binding, dst } => {
+                    // Binding may have expired or been rebound while in flight
+                    if let Some(socket) = self.nat.socket(binding) {
+                        let _ = socket.send_to(&packet.data, dst);
+                    }
+                }
+                Hop::RemoteToAgent { from } => {
+                    let ip = match from {
+                        SocketAddr::V4(v4) => v4.ip().octets(),
+                        SocketAddr::V6(_) => continue,
+                    };
+                    unsafe {
+                        agent_recv(
+                            self.agent,
+                            packet.data.as_ptr(),
+                            packet.data.len(),
+                            ip.as_ptr(),
+                            from.port(),
+                        );
+                    }
+                }
+                Hop::ConnectorToServer => {
+                    let _ = self.connector_outer.send_to(&packet.data, self.server_addr);
+                }
+                Hop::ServerToConnector => {
+                    if let Some(peer) = self.connector_peer {
+                        let _ = self.connector_inner.send_to(&packet.data, peer);
+                    }
+                }
+            }
+        }
+    }
+
+    /// Timers, received tunnel packets and outbound QUIC packets.
+    fn service_agent(&mut self, now: Instant) -> io::Result<()> {
+        if now >= self.agent_deadline {
+            unsafe { agent_on_timeout(self.agent) };
+            // 0 means "nothing pending" as well as "due now"; re-check shortly
+            let ms = unsafe { agent_timeout_ms(self.agent) }.clamp(1, 1000);
+            self.agent_deadline = now + Duration::from_millis(ms);
+        }
+        if now >= self.next_keepalive {
+            unsafe { agent_send_intermediate_keepalive(self.agent) };
+            self.next_keepalive = now + KEEPALIVE_INTERVAL;
+        }
+        if now >= self.next_nat_expiry {
+            self.nat.expire(self.poll.registry(), now);
+            self.next_nat_expiry = now + NAT_EXPIRY_TICK;
+        }
+
+        loop {
+            let mut len = self.buf.len();
+            let r = unsafe { agent_recv_datagram(self.agent, self.buf.as_mut_ptr(), &mut len) };
+            if r != AgentResult::Ok {
+                break;
+            }
+            self.on_tunnel_packet(len, now);
+        }
+
+        self.flush_agent(now)
+    }
+
+    /// Route everything the Agent wants to send through its NAT and links.
+    fn flush_agent(&mut self, now: Instant) -> io::Result<()> {
+        loop {
+            let mut len = self.buf.len();
+            let mut port = 0u16;
+            let r = unsafe { agent_poll(self.agent, self.buf.as_mut_ptr(), &mut len, &mut port) };
+            if r != AgentResult::Ok {
+                break;
+            }
+            let dst = SocketAddr::new(self.server_addr.ip(), port);
+            self.send_from_agent(dst, len, now)?;
+        }
+        loop {
+            let mut len = self.buf.len();
+            let mut ip = [0u8; 4];
+            let mut port = 0u16;
+            let r = unsafe {
+                agent_poll_p2p(
+                    self.agent,
+                    self.buf.as_mut_ptr(),
+                    &mut len,
+                    ip.as_mut_ptr(),
+                    &mut port,
+                )
+            };
+            if r != AgentResult::Ok {
+                break;
+            }
+            self.send_from_agent(SocketAddr::from((ip, port)), len, now)?;
+        }
+        Ok(())
+    }
+
+    /// Send `self.buf[..len]` from the Agent to `dst`.
+    fn send_from_agent(&mut self, dst: SocketAddr, len: usize, now: Instant) -> io::Result<()> {
+        let binding = self.nat.outbound(self.poll.registry(), dst, now)?;
+        let pipe = if dst == self.p2p_addr {
+            &mut self.p2p_up
+        } else {
+            &mut self.relay_up
+        };
+        if let Some(at) = pipe.admit(now, len) {
+            let data = self.buf[..len].to_vec();
+            self.schedule(at, Hop::AgentToRemote { binding, dst }, &data);
+        }
+        Ok(())
+    }
+
+    // ------------------------------------------------------------------------
+    // Traffic
+    // ------------------------------------------------------------------------
+
+    fn next_send_time(&self, w: &Workload) -> Instant {
+        let t = w.start + w.interval * w.next_seq;
+        if t >= w.end {
+            // Sending is over; only the drain window remains
+            w.end + self.cfg.drain
+        } else {
+            t
+        }
+    }
+
+    /// Open-loop sender: packets go out on schedule regardless of echoes, and
+    /// RTT is measured from the scheduled time so loop stalls are counted.
+    fn generate(&mut self, now: Instant) -> io::Result<()> {
+        loop {
+            let (path, seq, scheduled) = match &self.workload {
+                Some(w) => {
+                    let t = w.start + w.interval * w.next_seq;
+                    if t > now || t >= w.end {
+                        return Ok(());
+                    }
+                    (w.path, w.next_seq, t)
+                }
+                None => return Ok(()),
+            };
+            let ok = self.send_probe(path, path.tag(), seq, scheduled);
+            let w = self.workload.as_mut().unwrap();
+            w.next_seq += 1;
+            w.stats.sent += 1;
+            if !ok {
+                w.stats.send_errors += 1;
+            }
+            self.flush_agent(now)?;
+        }
+    }
+
+    fn send_probe(&mut self, path: PathKind, tag: u8, seq: u32, sent_at: Instant) -> bool {
+        let sent_ns = sent_at.duration_since(self.epoch).as_nanos() as u64;
+        let mut payload = vec![0u8; self.cfg.payload_size];
+        payload[..2].copy_from_slice(&PROBE_MAGIC);
+        payload[2] = tag;
+        payload[4..8].copy_from_slice(&seq.to_be_bytes());
+        payload[8..16].copy_from_slice(&sent_ns.to_be_bytes());
+        let packet = build_udp_packet(FLOW_SRC, FLOW_DST, &payload);
+
+        let r = match path {
+            PathKind::Relay => unsafe {
+                agent_send_datagram(self.agent, packet.as_ptr(), packet.len())
+            },
+            PathKind::P2p => {
+                let ip = match self.p2p_addr {
+                    SocketAddr::V4(v4) => v4.ip().octets(),
+                    SocketAddr::V6(_) => return false,
+                };
+                unsafe {
+                    agent_send_datagram_p2p(
+                        self.agent,
+                        packet.as_ptr(),
+                        packet.len(),
+                        ip.as_ptr(),
+                        self.p2p_addr.port(),
+                    )
+                }
+            }
+        };
+        r == AgentResult::Ok
+    }
+
+    /// An IP packet came out of the tunnel in `self.buf[..len]`.
+    fn on_tunnel_packet(&mut self, len: usize, now: Instant) {
+        let Some(payload) = udp_payload(&self.buf[..len]) else {
+            return;
+        };
+        if payload.len() < PROBE_HEADER_LEN || payload[..2] != PROBE_MAGIC {
+            return;
+        }
+        let tag = payload[2];
+        let sent_ns = u64::from_be_bytes(payload[8..16].try_into().unwrap());
+        let payload_len = payload.len() as u64;
+
+        if tag == SETUP_TAG {
+            self.setup_echoes += 1;
+            return;
+        }
+        if let Some(w) = self.workload.as_mut().filter(|w| w.path.tag() == tag) {
+            let now_ns = now.duration_since(self.epoch).as_nanos() as u64;
+            w.stats.received += 1;
+            w.stats.rx_bytes += payload_len;
+            w.stats.rtts_us.push(now_ns.saturating_sub(sent_ns) / 1000);
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    // Phases
+    // ------------------------------------------------------------------------
+
+    /// Connect, register and wait for the first echo through the relay.
+    fn setup(&mut self) -> io::Result<Duration> {
+        let start = Instant::now();
+        let deadline = start + SETUP_TIMEOUT;
+        let host = CString::new(self.server_addr.ip().to_string()).unwrap();
+        let local = [127u8, 0, 0, 1];
+        unsafe {
+            agent_set_local_addr(self.agent, local.as_ptr(), 4, AGENT_INSIDE_PORT);
+            let r = agent_connect(self.agent, host.as_ptr(), self.server_addr.port());
+            if r != AgentResult::Ok {
+                return Err(fail(format!("agent_connect: {:?}", r)));
+            }
+        }
+        self.flush_agent(Instant::now())?;
+
+        let agent = self.agent;
+        if !self.run_until(deadline, |_| unsafe { agent_is_connected(agent) })? {
+            return Err(fail("Agent did not connect to the Intermediate Server"));
+        }
+        let service = CString::new(self.cfg.service_id.clone()).unwrap();
+        unsafe { agent_register(self.agent, service.as_ptr()) };
+        self.flush_agent(Instant::now())?;
+
+        // The Connector registers on its own schedule; probe until the relay
+        // path carries an echo end to end
+        let mut seq = 0;
+        while Instant::now() < deadline {
+            self.send_probe(PathKind::Relay, SETUP_TAG, seq, Instant::now());
+            self.flush_agent(Instant::now())?;
+            seq += 1;
+            let next = (Instant::now() + Duration::from_millis(200)).min(deadline);
+            if self.run_until(next, |h| h.setup_echoes > 0)? {
+                return Ok(start.elapsed());
+            }
+        }
+        Err(fail(
+            "no echo through the relay path (is the Connector registered?)",
+        ))
+    }
+
+    /// Open the direct QUIC connection to the Connector's P2P listener.
+    fn connect_p2p(&mut self) -> io::Result<Duration> {
+        let start = Instant::now();
+        let host = CString::new(self.p2p_addr.ip().to_string()).unwrap();
+        let port = self.p2p_addr.port();
+        let r = unsafe { agent_connect_p2p(self.agent, host.as_ptr(), port) };
+        if r != AgentResult::Ok {
+            return Err(fail(format!("agent_connect_p2p: {:?}", r)));
+        }
+        self.flush_agent(Instant::now())?;
+
+        let agent = self.agent;
+        let connected = self.run_until(start + SETUP_TIMEOUT, |_| unsafe {
+            agent_is_p2p_connected(agent, host.as_ptr(), port)
+        })?;
+        if !connected {
+            return Err(fail("P2P handshake with the Connector did not complete"));
+        }
+        Ok(start.elapsed())
+    }
+
+    fn measure(&mut self, path: PathKind) -> io::Result<PathStats> {
+        let start = Instant::now();
+        self.workload = Some(Workload {
+            path,
+            start,
+            end: start + self.cfg.duration,
+            interval: Duration::from_secs_f64(1.0 / self.cfg.rate as f64),
+            next_seq: 0,
+            stats: PathStats::default(),
+        });
+        let done = start + self.cfg.duration + self.cfg.drain;
+        self.run_until(done, |_| false)?;
+        Ok(self.workload.take().unwrap().stats)
+    }
+
+    fn report_links(&self) {
+        let pipes: [(&str, &Pipe); 6] = [
+            ("RELAY_UP", &self.relay_up),
+            ("RELAY_DOWN", &self.relay_down),
+            ("P2P_UP", &self.p2p_up),
+            ("P2P_DOWN", &self.p2p_down),
+            ("CONNECTOR_UP", &self.connector_up),
+            ("CONNECTOR_DOWN", &self.connector_down),
+        ];
+        for (name, pipe) in pipes {
+            let PipeStats {
+                packets,
+                bytes,
+                dropped_loss,
+                dropped_queue,
+                reordered,
+            } = pipe.stats;
+            println!("LOOPBACK_LINK_{}_PACKETS:{}", name, packets);
+            println!("LOOPBACK_LINK_{}_BYTES:{}", name, bytes);
+            println!("LOOPBACK_LINK_{}_LOSS_DROPS:{}", name, dropped_loss);
+            println!("LOOPBACK_LINK_{}_QUEUE_DROPS:{}", name, dropped_queue);
+            println!("LOOPBACK_LINK_{}_REORDERED:{}", name, reordered);
+        }
+        let nat = self.nat.stats;
+        println!("LOOPBACK_NAT_BINDINGS:{}", nat.bindings_created);
+        println!("LOOPBACK_NAT_EXPIRED:{}", nat.bindings_expired);
+        println!("LOOPBACK_NAT_REBINDS:{}", nat.rebinds);
+        println!("LOOPBACK_NAT_FILTERED:{}", nat.filtered);
+    }
+}
+
+impl Drop for Harness {
+    fn drop(&mut self) {
+        unsafe { agent_destroy(self.agent) };
+    }
+}
+
+fn fail(msg: impl Into<String>) -> io::Error {
+    io::Error::other(msg.into())
+}
+
+// ============================================================================
+// Packet helpers
+// ============================================================================
+
+/// IPv4/UDP packet with a valid header checksum (UDP checksum left at 0).
+fn build_udp_packet(src: (Ipv4Addr, u16), dst: (Ipv4Addr, u16), payload: &[u8]) -> Vec<u8> {
+    let total_len = 20 + 8 + payload.len();
+    let mut packet = vec![0u8; total_len];
+    packet[0] = 0x45;
+    packet[2..4].copy_from_slice(&(total_len as u16).to_be_bytes());
+    packet[8] = 64;
+    packet[9] = 17;
+    packet[12..16].copy_from_slice(&src.0.octets());
+    packet[16..20].copy_from_slice(&dst.0.octets());
+    let checksum = ip_checksum(&packet[..20]);
+    packet[10..12].copy_from_slice(&checksum.to_be_bytes());
+
+    packet[20..22].copy_from_slice(&src.1.to_be_bytes());
+    packet[22..24].copy_from_slice(&dst.1.to_be_bytes());
+    packet[24..26].copy_from_slice(&((8 + payload.len()) as u16).to_be_bytes());
+    packet[28..].copy_from_slice(payload);
+    packet
+}
+
+fn ip_checksum(header: &[u8]) -> u16 {
+    let mut sum: u32 = header
+        .chunks(2)
+        .map(|w| ((w[0] as u32) << 8) | *w.get(1).unwrap_or(&0) as u32)
+        .sum();
+    while sum >> 16 != 0 {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    !sum as u16
+}
+
+/// Payload of an IPv4/UDP packet, bounded by the UDP length field.
+fn udp_payload(packet: &[u8]) -> Option<&[u8]> {
+    if packet.len() < 20 || packet[0] >> 4 != 4 || packet[9] != 17 {
+        return None;
+    }
+    let ihl = (packet[0] & 0x0F) as usize * 4;
+    let udp = packet.get(ihl..ihl + 8)?;
+    let udp_len = u16::from_be_bytes([udp[4], udp[5]]) as usize;
+    packet.get(ihl + 8..ihl + udp_len.max(8))
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+fn print_usage() {
+    println!(
+        "Loopback E2E harness: Agent ↔ Intermediate ↔ Connector over a simulated network
+
+Usage: loopback-harness [options]
+
+Topology:
+  --intermediate-bin PATH   (env INTERMEDIATE_BIN, default: release build in the repo)
+  --connector-bin PATH      (env CONNECTOR_BIN, default: release build in the repo)
+  --cert PATH / --key PATH  TLS material for the Intermediate and the Connector's
+                            P2P listener (default: certs/cert.pem, certs/key.pem)
+  --service ID              Service the Connector registers (default: loopback)
+  --log-dir DIR             Write child process output to DIR/<name>.log
+
+Workload:
+  --path relay|p2p|both     Paths to measure, in order (default: both)
+  --rate PPS                Open-loop send rate (default: 1000)
+  --duration SECS           Send time per path (default: 5)
+  --drain-ms MS             Wait for stragglers after sending (default: 1000)
+  --payload-size BYTES      UDP payload per packet, min {} (default: 1000)
+  --seed N                  Impairment RNG seed (default: 1)
+
+Network:
+  --relay-link SPEC         Agent ↔ Intermediate
+  --p2p-link SPEC           Agent ↔ Connector P2P listener
+  --connector-link SPEC     Connector ↔ Intermediate
+  --nat SPEC                Agent-side NAT
+
+  Link SPEC: UP[/DOWN], each key=value[,key=value...] with keys
+    delay=20ms jitter=2ms loss=1% reorder=0.5% rate=10mbit queue=64k
+  NAT SPEC: full-cone | port-restricted | symmetric, or
+    mapping=eim|apdm,filtering=eif|apdf,timeout=120s,rebind=30s
+
+Output is KEY:value lines (LOOPBACK_*). P2P round trips return via the relay.",
+        PROBE_HEADER_LEN
+    );
+}
+
+fn run(cfg: HarnessConfig) -> Result<(), Box<dyn std::error::Error>> {
+    for bin in [&cfg.intermediate_bin, &cfg.connector_bin] {
+        if !bin.exists() {
+            return Err(format!(
+                "{} not found (cargo build --release it first)",
+                bin.display()
+            )
+            .into());
+        }
+    }
+
+    let stop_echo = Arc::new(AtomicBool::new(false));
+    let echo_addr = spawn_echo(stop_echo.clone())?;
+    let server_addr = SocketAddr::from(([127, 0, 0, 1], free_udp_port()?));
+    let p2p_addr = SocketAddr::from(([127, 0, 0, 1], free_udp_port()?));
+
+    println!("LOOPBACK_SEED:{}", cfg.seed);
+    println!(
+        "LOOPBACK_RELAY_LINK:{} / {}",
+        cfg.relay_link.0, cfg.relay_link.1
+    );
+    println!("LOOPBACK_P2P_LINK:{} / {}", cfg.p2p_link.0, cfg.p2p_link.1);
+    println!(
+        "LOOPBACK_CONNECTOR_LINK:{} / {}",
+        cfg.connector_link.0, cfg.connector_link.1
+    );
+    println!("LOOPBACK_NAT:{:?}", cfg.nat);
+
+    let mut harness = Harness::new(cfg, server_addr, p2p_addr)?;
+    let cfg = &harness.cfg;
+    let log_dir = cfg.log_dir.as_ref();
+    if let Some(dir) = log_dir {
+        std::fs::create_dir_all(dir)?;
+    }
+
+    let mut children = Children(Vec::new());
+    children.spawn(
+        "intermediate-server",
+        &cfg.intermediate_bin,
+        &[
+            "--port".into(),
+            server_addr.port().to_string(),
+            "--cert".into(),
+            cfg.cert.display().to_string(),
+            "--key".into(),
+            cfg.key.display().to_string(),
+            "--bind".into(),
+            "127.0.0.1".into(),
+            "--metrics-port".into(),
+            "0".into(),
+        ],
+        log_dir,
+    )?;
+    children.spawn(
+        "app-connector",
+        &cfg.connector_bin,
+        &[
+            "--server".into(),
+            harness.connector_inner_addr()?.to_string(),
+            "--service".into(),
+            cfg.service_id.clone(),
+            "--forward".into(),
+            echo_addr.to_string(),
+            "--p2p-cert".into(),
+            cfg.cert.display().to_string(),
+            "--p2p-key".into(),
+            cfg.key.display().to_string(),
+            "--p2p-listen-port".into(),
+            p2p_addr.port().to_string(),
+            "--no-verify-peer".into(),
+            "--metrics-port".into(),
+            "0".into(),
+        ],
+        log_dir,
+    )?;
+
+    let setup = harness.setup();
+    if let Some(name) = children.exited() {
+        return Err(format!("{} exited during setup", name).into());
+    }
+    println!("LOOPBACK_SETUP_MS:{}", setup?.as_millis());
+
+    for path in harness.cfg.paths.clone() {
+        if path == PathKind::P2p {
+            let elapsed = harness.connect_p2p()?;
+            println!("LOOPBACK_P2P_CONNECT_MS:{}", elapsed.as_millis());
+            println!("LOOPBACK_P2P_RETURN_PATH:relay");
+        }
+        let mut stats = harness.measure(path)?;
+        stats.report(path, harness.cfg.duration);
+    }
+
+    harness.report_links();
+    stop_echo.store(true, Ordering::Relaxed);
+    Ok(())
+}
+
+fn main() {
+    let args: Vec<String> = std::env::args().collect();
+    if args.iter().any(|a| a == "--help" || a == "-h") {
+        print_usage();
+        return;
+    }
+
+    let cfg = match HarnessConfig::from_args(&args) {
+        Ok(cfg) => cfg,
+        Err(e) => {
+            eprintln!("Error: {}", e);
+            std::process::exit(2);
+        }
+    };
+
+    if let Err(e) = run(cfg) {
+        eprintln!("Error: {}", e);
+        std::process::exit(1);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_udp_packet_roundtrip() {
+        let payload = b"LB\x01\x00hello-loopback";
+        let packet = build_udp_packet(FLOW_SRC, FLOW_DST, payload);
+        assert_eq!(packet.len(), 28 + payload.len());
+        assert_eq!(ip_checksum(&packet[..20]), 0);
+        assert_eq!(udp_payload(&packet), Some(&payload[..]));
+
+        // Trailing bytes beyond the UDP length are not payload
+        let mut padded = packet.clone();
+        padded.extend_from_slice(&[0xEE; 4]);
+        assert_eq!(udp_payload(&padded), Some(&payload[..]));
+
+        let mut tcp = packet;
+        tcp[9] = 6;
+        assert_eq!(udp_payload(&tcp), None);
+    }
+
+    #[test]
+    fn test_percentile() {
+        let sorted: Vec<u64> = (1..=100).collect();
+        assert_eq!(PathStats::percentile(&sorted, 0.0), 1);
+        assert_eq!(PathStats::percentile(&sorted, 0.5), 51);
+        assert_eq!(PathStats::percentile(&sorted, 1.0), 100);
+        assert_eq!(PathStats::percentile(&[], 0.99), 0);
+    }
+
+    #[test]
+    fn test_config_parsing() {
+        let args: Vec<String> = [
+            "loopback-harness",
+            "--path",
+            "p2p",
+            "--relay-link",
+            "delay=10ms/delay=30ms,loss=1%",
+            "--nat",
+            "symmetric",
+            "--rate",
+            "250",
+        ]
+        .iter()
+        .map(|s| s.to_string())
+        .collect();
+        let cfg = HarnessConfig::from_args(&args).unwrap();
+        assert_eq!(cfg.paths, vec![PathKind::P2p]);
+        assert_eq!(cfg.relay_link.0.delay, Duration::from_millis(10));
+        assert_eq!(cfg.relay_link.1.delay, Duration::from_millis(30));
+        assert_eq!(cfg.nat.mapping, nat::Mapping::AddressPortDependent);
+        assert_eq!(cfg.rate, 250);
+
+        let bad = |extra: &[&str]| {
+            let mut a = vec!["loopback-harness".to_string()];
+            a.extend(extra.iter().map(|s| s.to_string()));
+            HarnessConfig::from_args(&a).is_err()
+        };
+        assert!(bad(&["--path", "direct"]));
+        assert!(bad(&["--payload-size", "8"]));
+        assert!(bad(&["--rate", "0"]));
+    }
+}
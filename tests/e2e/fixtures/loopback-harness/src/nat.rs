@@ -0,0 +1,328 @@
+//! Agent-side NAT
+//!
+//! Every packet the in-process Agent emits leaves through a *binding*: a real
+//! UDP socket on 127.0.0.1 whose port is the Agent's public (mapped) port as
+//! seen by the Intermediate Server or the Connector. Mapping and filtering
+//! follow RFC 4787 terminology:
+//!
+//! - mapping `eim`  — one binding for all destinations (so QAD from the
+//!   Intermediate predicts the port the Connector will see)
+//! - mapping `apdm` — one binding per destination ("symmetric" NAT)
+//! - filtering `eif` — any remote may send to a binding
+//! - filtering `apdf` — only remotes the binding has sent to
+//!
+//! Bindings expire after `timeout` without outbound traffic, and `rebind`
+//! forces a fresh port periodically, both of which look like NAT rebinding to
+//! the far end and exercise QUIC path migration.
+
+use std::collections::{HashMap, HashSet};
+use std::io;
+use std::net::SocketAddr;
+use std::time::{Duration, Instant};
+
+use mio::net::UdpSocket;
+use mio::{Interest, Registry, Token};
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Mapping {
+    EndpointIndependent,
+    AddressPortDependent,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Filtering {
+    EndpointIndependent,
+    AddressPortDependent,
+}
+
+#[derive(Debug, Clone, PartialEq)]
+pub struct NatConfig {
+    pub mapping: Mapping,
+    pub filtering: Filtering,
+    /// Idle timeout for a binding (outbound traffic refreshes it)
+    pub timeout: Duration,
+    /// Replace every binding with a new port this often
+    pub rebind: Option<Duration>,
+}
+
+impl Default for NatConfig {
+    fn default() -> Self {
+        // RFC 4787 REQ-5: at least two minutes
+        NatConfig {
+            mapping: Mapping::EndpointIndependent,
+            filtering: Filtering::EndpointIndependent,
+            timeout: Duration::from_secs(120),
+            rebind: None,
+        }
+    }
+}
+
+impl NatConfig {
+    /// Parse a preset (`full-cone`, `port-restricted`, `symmetric`) or
+    /// `mapping=eim|apdm,filtering=eif|apdf,timeout=30s,rebind=10s`.
+    /// Presets may be followed by further `key=value` overrides.
+    pub fn parse(spec: &str) -> Result<Self, String> {
+        let mut cfg = NatConfig::default();
+        for item in spec.split(',').map(str::trim).filter(|s| !s.is_empty()) {
+            match item {
+                "full-cone" => {
+                    cfg.mapping = Mapping::EndpointIndependent;
+                    cfg.filtering = Filtering::EndpointIndependent;
+                    continue;
+                }
+                "port-restricted" => {
+                    cfg.mapping = Mapping::EndpointIndependent;
+                    cfg.filtering = Filtering::AddressPortDependent;
+                    continue;
+                }
+                "symmetric" => {
+                    cfg.mapping = Mapping::AddressPortDependent;
+                    cfg.filtering = Filtering::AddressPortDependent;
+                    continue;
+                }
+                _ => {}
+            }
+
+            let (key, value) = item
+                .split_once('=')
+                .ok_or_else(|| format!("unknown NAT preset '{}'", item))?;
+            match (key, value) {
+                ("mapping", "eim") => cfg.mapping = Mapping::EndpointIndependent,
+                ("mapping", "apdm") => cfg.mapping = Mapping::AddressPortDependent,
+                ("filtering", "eif") => cfg.filtering = Filtering::EndpointIndependent,
+                ("filtering", "apdf") => cfg.filtering = Filtering::AddressPortDependent,
+                ("timeout", v) => cfg.timeout = parse_secs(v)?,
+                ("rebind", v) => cfg.rebind = Some(parse_secs(v)?),
+                _ => return Err(format!("invalid NAT parameter '{}'", item)),
+            }
+        }
+        Ok(cfg)
+    }
+}
+
+fn parse_secs(s: &str) -> Result<Duration, String> {
+    let n = s.strip_suffix('s').unwrap_or(s);
+    n.parse::<f64>()
+        .ok()
+        .filter(|v| *v > 0.0)
+        .map(Duration::from_secs_f64)
+        .ok_or_else(|| format!("invalid duration '{}'", s))
+}
+
+/// Counters for the report
+#[derive(Debug, Clone, Copy, Default)]
+pub struct NatStats {
+    pub bindings_created: u64,
+    pub bindings_expired: u64,
+    pub rebinds: u64,
+    pub filtered: u64,
+}
+
+struct Binding {
+    socket: UdpSocket,
+    /// Destination this binding is keyed on under APDM
+    key: Option<SocketAddr>,
+    /// Remotes we've sent to (APDF permission list)
+    permitted: HashSet<SocketAddr>,
+    created: Instant,
+    last_out: Instant,
+}
+
+pub struct Nat {
+    cfg: NatConfig,
+    bindings: HashMap<Token, Binding>,
+    by_key: HashMap<Option<SocketAddr>, Token>,
+    next_token: usize,
+    pub stats: NatStats,
+}
+
+impl Nat {
+    /// `first_token` must not collide with the caller's other mio tokens;
+    /// binding tokens are allocated upwards from it.
+    pub fn new(cfg: NatConfig, first_token: usize) -> Self {
+        Nat {
+            cfg,
+            bindings: HashMap::new(),
+            by_key: HashMap::new(),
+            next_token: first_token,
+            stats: NatStats::default(),
+        }
+    }
+
+    /// Binding for an outbound packet to `dst`, allocating one if needed.
+    pub fn outbound(
+        &mut self,
+        registry: &Registry,
+        dst: SocketAddr,
+        now: Instant,
+    ) -> io::Result<Token> {
+        let key = match self.cfg.mapping {
+            Mapping::EndpointIndependent => None,
+            Mapping::AddressPortDependent => Some(dst),
+        };
+
+        if let Some(&token) = self.by_key.get(&key) {
+            let stale = match self.bindings.get(&token) {
+                Some(b) => self
+                    .cfg
+                    .rebind
+                    .is_some_and(|every| now.duration_since(b.created) >= every),
+                None => true,
+            };
+            if !stale {
+                let binding = self.bindings.get_mut(&token).unwrap();
+                binding.last_out = now;
+                binding.permitted.insert(dst);
+                return Ok(token);
+            }
+            self.remove(registry, token);
+            self.stats.rebinds += 1;
+        }
+
+        let mut socket = UdpSocket::bind("127.0.0.1:0".parse().unwrap())?;
+        let token = Token(self.next_token);
+        self.next_token += 1;
+        registry.register(&mut socket, token, Interest::READABLE)?;
+
+        let mut permitted = HashSet::new();
+        permitted.insert(dst);
+        self.bindings.insert(
+            token,
+            Binding {
+                socket,
+                key,
+                permitted,
+                created: now,
+                last_out: now,
+            },
+        );
+        self.by_key.insert(key, token);
+        self.stats.bindings_created += 1;
+        Ok(token)
+    }
+
+    /// Whether `from` may send to the binding behind `token`.
+    pub fn inbound_allowed(&mut self, token: Token, from: SocketAddr) -> bool {
+        let allowed = match (self.bindings.get(&token), self.cfg.filtering) {
+            (None, _) => false,
+            (Some(_), Filtering::EndpointIndependent) => true,
+            (Some(b), Filtering::AddressPortDependent) => b.permitted.contains(&from),
+        };
+        if !allowed {
+            self.stats.filtered += 1;
+        }
+        allowed
+    }
+
+    pub fn socket(&self, token: Token) -> Option<&UdpSocket> {
+        self.bindings.get(&token).map(|b| &b.socket)
+    }
+
+    /// Drop bindings idle for longer than the NAT timeout.
+    pub fn expire(&mut self, registry: &Registry, now: Instant) {
+        let timeout = self.cfg.timeout;
+        let expired: Vec<Token> = self
+            .bindings
+            .iter()
+            .filter(|(_, b)| now.duration_since(b.last_out) >= timeout)
+            .map(|(t, _)| *t)
+            .collect();
+        for token in expired {
+            self.remove(registry, token);
+            self.stats.bindings_expired += 1;
+        }
+    }
+
+    fn remove(&mut self, registry: &Registry, token: Token) {
+        if let Some(mut binding) = self.bindings.remove(&token) {
+            let _ = registry.deregister(&mut binding.socket);
+            if self.by_key.get(&binding.key) == Some(&token) {
+                self.by_key.remove(&binding.key);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use mio::Poll;
+
+    #[test]
+    fn test_parse_presets() {
+        let cfg = NatConfig::parse("symmetric,timeout=30s").unwrap();
+        assert_eq!(cfg.mapping, Mapping::AddressPortDependent);
+        assert_eq!(cfg.filtering, Filtering::AddressPortDependent);
+        assert_eq!(cfg.timeout, Duration::from_secs(30));
+
+        let cfg = NatConfig::parse("mapping=eim,filtering=apdf,rebind=5").unwrap();
+        assert_eq!(cfg.mapping, Mapping::EndpointIndependent);
+        assert_eq!(cfg.filtering, Filtering::AddressPortDependent);
+        assert_eq!(cfg.rebind, Some(Duration::from_secs(5)));
+
+        assert_eq!(NatConfig::parse("").unwrap(), NatConfig::default());
+        assert!(NatConfig::parse("carrier-grade").is_err());
+        assert!(NatConfig::parse("timeout=0").is_err());
+    }
+
+    #[test]
+    fn test_mapping_behaviour() {
+        let poll = Poll::new().unwrap();
+        let now = Instant::now();
+        let a: SocketAddr = "127.0.0.1:4433".parse().unwrap();
+        let b: SocketAddr = "127.0.0.1:4434".parse().unwrap();
+
+        let mut eim = Nat::new(NatConfig::parse("port-restricted").unwrap(), 10);
+        let ta = eim.outbound(poll.registry(), a, now).unwrap();
+        let tb = eim.outbound(poll.registry(), b, now).unwrap();
+        assert_eq!(ta, tb);
+        assert_eq!(eim.stats.bindings_created, 1);
+
+        let mut apdm = Nat::new(NatConfig::parse("symmetric").unwrap(), 10);
+        let ta = apdm.outbound(poll.registry(), a, now).unwrap();
+        let tb = apdm.outbound(poll.registry(), b, now).unwrap();
+        assert_ne!(ta, tb);
+        let port = |t| apdm.socket(t).unwrap().local_addr().unwrap();
+        assert_ne!(port(ta), port(tb));
+    }
+
+    #[test]
+    fn test_filtering_and_expiry() {
+        let poll = Poll::new().unwrap();
+        let now = Instant::now();
+        let a: SocketAddr = "127.0.0.1:4433".parse().unwrap();
+        let stranger: SocketAddr = "127.0.0.1:5555".parse().unwrap();
+
+        let mut nat = Nat::new(NatConfig::parse("port-restricted,timeout=1s").unwrap(), 10);
+        let t = nat.outbound(poll.registry(), a, now).unwrap();
+        assert!(nat.inbound_allowed(t, a));
+        assert!(!nat.inbound_allowed(t, stranger));
+        assert_eq!(nat.stats.filtered, 1);
+
+        nat.expire(poll.registry(), now + Duration::from_millis(500));
+        assert!(nat.socket(t).is_some());
+        nat.expire(poll.registry(), now + Duration::from_secs(2));
+        assert!(nat.socket(t).is_none());
+        assert!(!nat.inbound_allowed(t, a));
+    }
+
+    #[test]
+    fn test_rebind_allocates_new_port() {
+        let poll = Poll::new().unwrap();
+        let now = Instant::now();
+        let a: SocketAddr = "127.0.0.1:4433".parse().unwrap();
+
+        let mut nat = Nat::new(NatConfig::parse("rebind=1s").unwrap(), 10);
+        let t1 = nat.outbound(poll.registry(), a, now).unwrap();
+        let t2 = nat
+            .outbound(poll.registry(), a, now + Duration::from_millis(100))
+            .unwrap();
+        assert_eq!(t1, t2);
+        let t3 = nat
+            .outbound(poll.registry(), a, now + Duration::from_secs(1))
+            .unwrap();
+        assert_ne!(t1, t3);
+        assert!(nat.socket(t1).is_none());
+        assert_eq!(nat.stats.rebinds, 1);
+    }
+}
@@ -0,0 +1,1115 @@
+//! Multi-connection load generator (`--load N`)
+//!
+//! Simulates N Agents from a single process. Each simulated Agent owns its
+//! own QUIC connection to the Intermediate Server, registers for a service
+//! and then pushes traffic through the relay to the App Connector:
+//!
+//! - `udp`: IP/UDP packets to `--dst` (normally the echo server). The first
+//!   8 bytes of the payload carry a sequence number so the echoed reply can
+//!   be matched to its send time.
+//! - `tcp`: a TCP SYN from a fresh source port per probe. The Connector
+//!   answers with a synthesized SYN-ACK (or RST if the backend refuses),
+//!   which exercises its TCP proxy path; the generator resets the flow.
+//!
+//! A run has three phases:
+//! 1. Connect: handshakes start at `--load-ramp` per second; each Agent
+//!    registers as soon as it is established.
+//! 2. Traffic: `--load-rate` packets/s in aggregate for `--load-duration`
+//!    seconds, spread round-robin over the registered Agents.
+//! 3. Drain: keep receiving for `--wait` ms, then close every connection.
+//!
+//! With the `open` schedule (default) packets leave on a fixed timetable
+//! regardless of replies, and latency is measured from the *intended* send
+//! time. A stalled relay therefore shows up in the tail rather than quietly
+//! slowing the generator down (coordinated omission). The `closed` schedule
+//! keeps at most `--load-window` probes outstanding per Agent instead.
+//!
+//! Many Agents share each UDP socket (`--load-sockets`); replies are routed
+//! back to their connection by destination CID.
+
+use std::cmp::Reverse;
+use std::collections::{BinaryHeap, HashMap};
+use std::io;
+use std::net::{Ipv4Addr, SocketAddr, SocketAddrV4};
+use std::time::{Duration, Instant};
+
+use hdrhistogram::Histogram;
+use mio::net::UdpSocket;
+use mio::{Events, Interest, Poll, Token};
+use ring::rand::{SecureRandom, SystemRandom};
+
+use crate::{build_ip_tcp_packet, build_ip_udp_packet, parse_arg, MAX_DATAGRAM_SIZE};
+
+/// Handshake + registration must complete within this window
+const CONNECT_TIMEOUT: Duration = Duration::from_secs(5);
+
+/// A probe with no reply after this long is counted as lost
+const PROBE_TIMEOUT: Duration = Duration::from_secs(2);
+
+/// Event loop granularity while connecting and sending
+const TICK: Duration = Duration::from_millis(1);
+
+/// Upper bound on probes scheduled per tick so socket I/O keeps up
+const MAX_SENDS_PER_TICK: u64 = 4096;
+
+/// Registration wire format (must match Intermediate Server)
+const REG_TYPE_AGENT: u8 = 0x10;
+const REG_TYPE_ACK: u8 = 0x12;
+const REG_TYPE_NACK: u8 = 0x13;
+
+/// TCP flags used by the `tcp` probe
+const TCP_SYN: u8 = 0x02;
+const TCP_RST: u8 = 0x04;
+const TCP_ACK: u8 = 0x10;
+
+/// Bytes at the start of each UDP payload holding the probe sequence number
+const PROBE_HEADER_LEN: usize = 8;
+
+/// Source port for UDP probes (each Agent has its own source IP)
+const UDP_SRC_PORT: u16 = 40000;
+
+/// First source port handed out to TCP probes
+const TCP_PORT_BASE: u16 = 1024;
+
+/// App Connector's MAX_SYN_PER_SOURCE_PER_SECOND; faster SYNs get RST
+const CONNECTOR_SYN_LIMIT: f64 = 10.0;
+
+/// First simulated Agent tunnel address (100.64.0.1)
+const AGENT_IP_BASE: u32 = 0x6440_0001;
+
+// ============================================================================
+// Configuration
+// ============================================================================
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Proto {
+    Udp,
+    Tcp,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Schedule {
+    Open,
+    Closed,
+}
+
+#[derive(Debug, Clone)]
+pub struct LoadConfig {
+    /// Number of simulated Agents (connections)
+    pub agents: usize,
+    /// Services assigned to Agents round-robin
+    pub services: Vec<String>,
+    pub proto: Proto,
+    pub schedule: Schedule,
+    /// Aggregate probes per second (0 = unlimited, closed schedule only)
+    pub rate: f64,
+    /// Outstanding probes per Agent (closed schedule)
+    pub window: usize,
+    pub duration: Duration,
+    /// Handshakes started per second (0 = all at once)
+    pub ramp: f64,
+    pub payload_size: usize,
+    pub dst: SocketAddrV4,
+    pub sockets: usize,
+    pub drain: Duration,
+}
+
+impl LoadConfig {
+    pub fn from_args(args: &[String]) -> Result<Self, Box<dyn std::error::Error>> {
+        let agents: usize = parse_num(args, "--load", 100)?;
+        if agents == 0 {
+            return Err("--load requires at least one Agent".into());
+        }
+
+        let services: Vec<String> = parse_arg(args, "--service")
+            .ok_or("--load requires --service (comma-separated for several)")?
+            .split(',')
+            .filter(|s| !s.is_empty())
+            .map(str::to_string)
+            .collect();
+        if services.is_empty() {
+            return Err("--service must name at least one service".into());
+        }
+
+        let proto = match parse_arg(args, "--load-proto").as_deref() {
+            None | Some("udp") => Proto::Udp,
+            Some("tcp") => Proto::Tcp,
+            Some(other) => {
+                return Err(
+                    format!("Unknown --load-proto '{}' (expected udp or tcp)", other).into(),
+                )
+            }
+        };
+        let schedule = match parse_arg(args, "--load-schedule").as_deref() {
+            None | Some("open") => Schedule::Open,
+            Some("closed") => Schedule::Closed,
+            Some(other) => {
+                return Err(format!(
+                    "Unknown --load-schedule '{}' (expected open or closed)",
+                    other
+                )
+                .into())
+            }
+        };
+
+        let rate: f64 = parse_num(args, "--load-rate", 1000.0)?;
+        if schedule == Schedule::Open && rate <= 0.0 {
+            return Err("Open-loop schedule requires --load-rate > 0".into());
+        }
+
+        let dst: SocketAddrV4 = parse_arg(args, "--dst")
+            .ok_or("--load requires --dst address")?
+            .parse()
+            .map_err(|_| "Invalid --dst address")?;
+
+        Ok(LoadConfig {
+            agents,
+            services,
+            proto,
+            schedule,
+            rate,
+            window: parse_num(args, "--load-window", 1usize)?.max(1),
+            duration: Duration::from_secs_f64(parse_num(args, "--load-duration", 10.0)?),
+            ramp: parse_num(args, "--load-ramp", 500.0)?,
+            payload_size: parse_num(args, "--payload-size", 64usize)?.max(PROBE_HEADER_LEN),
+            dst,
+            sockets: parse_num(args, "--load-sockets", agents.min(256))?.clamp(1, agents),
+            drain: Duration::from_millis(parse_num(args, "--wait", 2000)?),
+        })
+    }
+}
+
+fn parse_num<T: std::str::FromStr>(args: &[String], flag: &str, default: T) -> Result<T, String> {
+    match parse_arg(args, flag) {
+        Some(s) => s
+            .parse()
+            .map_err(|_| format!("Invalid {} value: {}", flag, s)),
+        None => Ok(default),
+    }
+}
+
+/// Tunnel source address of simulated Agent `index` (100.64.0.1 upward)
+fn agent_ip(index: usize) -> Ipv4Addr {
+    Ipv4Addr::from(AGENT_IP_BASE + index as u32)
+}
+
+/// Key of the probe a relayed reply answers: the sequence number echoed in
+/// a UDP payload, or the destination port of a TCP segment.
+fn response_key(proto: Proto, packet: &[u8]) -> Option<u64> {
+    if packet.len() < 20 || packet[0] >> 4 != 4 {
+        return None;
+    }
+    let ihl = (packet[0] & 0x0F) as usize * 4;
+    match (proto, packet[9]) {
+        (Proto::Udp, 17) => {
+            let payload = packet.get(ihl + 8..ihl + 8 + PROBE_HEADER_LEN)?;
+            Some(u64::from_be_bytes(payload.try_into().ok()?))
+        }
+        (Proto::Tcp, 6) => {
+            let port = packet.get(ihl + 2..ihl + 4)?;
+            Some(u16::from_be_bytes([port[0], port[1]]) as u64)
+        }
+        _ => None,
+    }
+}
+
+// ============================================================================
+// Simulated Agent
+// ============================================================================
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum AgentState {
+    Idle,
+    Handshaking,
+    Registering,
+    Registered,
+    Failed,
+}
+
+struct LoadAgent {
+    conn: Option<quiche::Connection>,
+    state: AgentState,
+    started: Instant,
+    socket: usize,
+    service: usize,
+    src: Ipv4Addr,
+    next_seq: u64,
+    next_port: u16,
+    /// Probes awaiting a reply: key → send time (µs since generator start)
+    pending: HashMap<u64, u64>,
+    /// Last timeout pushed onto the timer heap (avoids duplicate entries)
+    timer: Option<Instant>,
+}
+
+// ============================================================================
+// Statistics
+// ============================================================================
+
+struct LoadStats {
+    handshake_us: Histogram<u64>,
+    latency_us: Histogram<u64>,
+    interval_latency_us: Histogram<u64>,
+    handshakes_ok: u64,
+    handshakes_failed: u64,
+    registered: u64,
+    registrations_failed: u64,
+    agents_lost: u64,
+    sent: u64,
+    send_errors: u64,
+    received: u64,
+    unmatched: u64,
+    lost: u64,
+    bytes_sent: u64,
+    bytes_received: u64,
+    socket_drops: u64,
+}
+
+impl LoadStats {
+    fn new() -> Self {
+        // 1 µs .. 60 s at 3 significant digits
+        let hist =
+            || Histogram::<u64>::new_with_bounds(1, 60_000_000, 3).expect("histogram bounds");
+        LoadStats {
+            handshake_us: hist(),
+            latency_us: hist(),
+            interval_latency_us: hist(),
+            handshakes_ok: 0,
+            handshakes_failed: 0,
+            registered: 0,
+            registrations_failed: 0,
+            agents_lost: 0,
+            sent: 0,
+            send_errors: 0,
+            received: 0,
+            unmatched: 0,
+            lost: 0,
+            bytes_sent: 0,
+            bytes_received: 0,
+            socket_drops: 0,
+        }
+    }
+}
+
+// ============================================================================
+// Generator
+// ============================================================================
+
+pub struct LoadGenerator {
+    cfg: LoadConfig,
+    quic_config: quiche::Config,
+    server_addr: SocketAddr,
+    poll: Poll,
+    events: Events,
+    /// (socket, local address) pairs; Agent i uses socket i % len
+    sockets: Vec<(UdpSocket, SocketAddr)>,
+    agents: Vec<LoadAgent>,
+    /// Source CID → Agent index, for demultiplexing shared sockets
+    cids: HashMap<Vec<u8>, usize>,
+    timers: BinaryHeap<Reverse<(Instant, usize)>>,
+    dirty: Vec<usize>,
+    is_dirty: Vec<bool>,
+    /// Agents still handshaking or registering
+    connecting: usize,
+    /// Agents that completed registration, in registration order
+    registered: Vec<usize>,
+    rr: usize,
+    stats: LoadStats,
+    origin: Instant,
+    rng: SystemRandom,
+    recv_buf: Vec<u8>,
+    send_buf: Vec<u8>,
+    dgram_buf: Vec<u8>,
+}
+
+impl LoadGenerator {
+    pub fn new(
+        cfg: LoadConfig,
+        quic_config: quiche::Config,
+        server_addr: SocketAddr,
+    ) -> Result<Self, Box<dyn std::error::Error>> {
+        let poll = Poll::new()?;
+        let mut sockets = Vec::with_capacity(cfg.sockets);
+        for i in 0..cfg.sockets {
+            let mut socket = UdpSocket::bind("0.0.0.0:0".parse()?)?;
+            poll.registry()
+                .register(&mut socket, Token(i), Interest::READABLE)?;
+            let local = socket.local_addr()?;
+            sockets.push((socket, local));
+        }
+
+        let now = Instant::now();
+        let agents = (0..cfg.agents)
+            .map(|i| LoadAgent {
+                conn: None,
+                state: AgentState::Idle,
+                started: now,
+                socket: i % cfg.sockets,
+                service: i % cfg.services.len(),
+                src: agent_ip(i),
+                next_seq: 0,
+                next_port: TCP_PORT_BASE,
+                pending: HashMap::new(),
+                timer: None,
+            })
+            .collect();
+
+        Ok(LoadGenerator {
+            is_dirty: vec![false; cfg.agents],
+            cfg,
+            quic_config,
+            server_addr,
+            poll,
+            events: Events::with_capacity(1024),
+            sockets,
+            agents,
+            cids: HashMap::new(),
+            timers: BinaryHeap::new(),
+            dirty: Vec::new(),
+            connecting: 0,
+            registered: Vec::new(),
+            rr: 0,
+            stats: LoadStats::new(),
+            origin: now,
+            rng: SystemRandom::new(),
+            recv_buf: vec![0u8; 65535],
+            send_buf: vec![0u8; MAX_DATAGRAM_SIZE],
+            dgram_buf: vec![0u8; MAX_DATAGRAM_SIZE],
+        })
+    }
+
+    pub fn run(&mut self) -> Result<(), Box<dyn std::error::Error>> {
+        log::info!(
+            "Load test: {} Agents over {} sockets, services {:?}, {:?}/{:?}, {} pps for {:?}",
+            self.cfg.agents,
+            self.cfg.sockets,
+            self.cfg.services,
+            self.cfg.proto,
+            self.cfg.schedule,
+            self.cfg.rate,
+            self.cfg.duration
+        );
+        if self.cfg.proto == Proto::Tcp {
+            let per_agent = self.cfg.rate / self.cfg.agents as f64;
+            if per_agent > CONNECTOR_SYN_LIMIT {
+                log::warn!(
+                    "{:.1} SYN/s per Agent exceeds the Connector's limit of {} per source; \
+                     expect RSTs. Add Agents or lower --load-rate.",
+                    per_agent,
+                    CONNECTOR_SYN_LIMIT
+                );
+            }
+        }
+
+        let connect_elapsed = self.connect_phase()?;
+        if self.registered.is_empty() {
+            self.report(connect_elapsed, Duration::ZERO);
+            return Err("No Agents registered; nothing to send".into());
+        }
+        let traffic_elapsed = self.traffic_phase()?;
+        self.drain_phase()?;
+        self.close_all();
+        self.report(connect_elapsed, traffic_elapsed);
+        Ok(())
+    }
+
+    fn now_us(&self) -> u64 {
+        self.origin.elapsed().as_micros() as u64
+    }
+
+    // ------------------------------------------------------------------
+    // Phases
+    // ------------------------------------------------------------------
+
+    fn connect_phase(&mut self) -> Result<Duration, Box<dyn std::error::Error>> {
+        let start = Instant::now();
+        let mut started = 0;
+        let mut last_sweep = start;
+        let mut last_report = start;
+
+        loop {
+            let due = if self.cfg.ramp > 0.0 {
+                ((start.elapsed().as_secs_f64() * self.cfg.ramp) as usize + 1).min(self.cfg.agents)
+            } else {
+                self.cfg.agents
+            };
+            while started < due {
+                self.start_handshake(started)?;
+                started += 1;
+            }
+
+            self.io_tick(TICK)?;
+
+            let now = Instant::now();
+            if now - last_sweep >= Duration::from_millis(50) {
+                last_sweep = now;
+                for i in 0..started {
+                    let agent = &self.agents[i];
+                    if matches!(
+                        agent.state,
+                        AgentState::Handshaking | AgentState::Registering
+                    ) && now - agent.started > CONNECT_TIMEOUT
+                    {
+                        self.fail(i, "connect timeout");
+                    }
+                }
+            }
+            if now - last_report >= Duration::from_secs(1) {
+                last_report = now;
+                log::info!(
+                    "[connect {:>5.1}s] started={} established={} registered={} failed={}",
+                    start.elapsed().as_secs_f64(),
+                    started,
+                    self.stats.handshakes_ok,
+                    self.stats.registered,
+                    self.stats.handshakes_failed + self.stats.registrations_failed
+                );
+            }
+
+            if started == self.cfg.agents && self.connecting == 0 {
+                break;
+            }
+        }
+
+        let elapsed = start.elapsed();
+        log::info!(
+            "Connect phase done in {:?}: {} registered, {} failed",
+            elapsed,
+            self.stats.registered,
+            self.stats.handshakes_failed + self.stats.registrations_failed
+        );
+        Ok(elapsed)
+    }
+
+    fn traffic_phase(&mut self) -> Result<Duration, Box<dyn std::error::Error>> {
+        let start = Instant::now();
+        let start_us = self.now_us();
+        let mut scheduled: u64 = 0;
+        let mut last_report = start;
+        let mut last_sent = 0;
+        let mut last_received = 0;
+
+        while start.elapsed() < self.cfg.duration {
+            let elapsed = start.elapsed().as_secs_f64();
+            let budget = if self.cfg.rate > 0.0 {
+                ((elapsed * self.cfg.rate) as u64)
+                    .saturating_sub(scheduled)
+                    .min(MAX_SENDS_PER_TICK)
+            } else {
+                MAX_SENDS_PER_TICK
+            };
+
+            match self.cfg.schedule {
+                Schedule::Open => {
+                    for _ in 0..budget {
+                        let Some(i) = self.next_registered() else {
+                            break;
+                        };
+                        let intended = start_us + (scheduled as f64 * 1e6 / self.cfg.rate) as u64;
+                        self.send_probe(i, intended);
+                        scheduled += 1;
+                    }
+                }
+                Schedule::Closed => {
+                    let mut remaining = budget;
+                    for _ in 0..self.registered.len() {
+                        if remaining == 0 {
+                            break;
+                        }
+                        let Some(i) = self.next_registered() else {
+                            break;
+                        };
+                        while remaining > 0 && self.agents[i].pending.len() < self.cfg.window {
+                            let now_us = self.now_us();
+                            self.send_probe(i, now_us);
+                            scheduled += 1;
+                            remaining -= 1;
+                        }
+                    }
+                }
+            }
+
+            self.io_tick(TICK)?;
+
+            let now = Instant::now();
+            if now - last_report >= Duration::from_secs(1) {
+                let secs = (now - last_report).as_secs_f64();
+                last_report = now;
+                self.expire_probes();
+                let hist = &self.stats.interval_latency_us;
+                log::info!(
+                    "[traffic {:>5.1}s] tx={:.0} pps rx={:.0} pps p50={} µs p99={} µs lost={} errors={}",
+                    start.elapsed().as_secs_f64(),
+                    (self.stats.sent - last_sent) as f64 / secs,
+                    (self.stats.received - last_received) as f64 / secs,
+                    hist.value_at_quantile(0.50),
+                    hist.value_at_quantile(0.99),
+                    self.stats.lost,
+                    self.stats.send_errors
+                );
+                self.stats.interval_latency_us.reset();
+                last_sent = self.stats.sent;
+                last_received = self.stats.received;
+            }
+
+            if self.next_registered().is_none() {
+                log::error!("All registered Agents have failed; stopping traffic early");
+                break;
+            }
+        }
+
+        Ok(start.elapsed())
+    }
+
+    fn drain_phase(&mut self) -> Result<(), Box<dyn std::error::Error>> {
+        let start = Instant::now();
+        while start.elapsed() < self.cfg.drain {
+            if self.agents.iter().all(|a| a.pending.is_empty()) {
+                break;
+            }
+            self.io_tick(Duration::from_millis(10))?;
+        }
+        for agent in &mut self.agents {
+            self.stats.lost += agent.pending.len() as u64;
+            agent.pending.clear();
+        }
+        Ok(())
+    }
+
+    fn close_all(&mut self) {
+        for i in 0..self.agents.len() {
+            if let Some(conn) = self.agents[i].conn.as_mut() {
+                let _ = conn.close(true, 0x00, b"load test done");
+                self.flush_agent(i);
+            }
+        }
+    }
+
+    // ------------------------------------------------------------------
+    // Per-Agent actions
+    // ------------------------------------------------------------------
+
+    fn start_handshake(&mut self, i: usize) -> Result<(), Box<dyn std::error::Error>> {
+        let mut scid = [0u8; quiche::MAX_CONN_ID_LEN];
+        self.rng
+            .fill(&mut scid)
+            .map_err(|_| "Failed to generate connection ID")?;
+        let scid = quiche::ConnectionId::from_ref(&scid);
+
+        let local = self.sockets[self.agents[i].socket].1;
+        let conn = quiche::connect(None, &scid, local, self.server_addr, &mut self.quic_config)?;
+
+        self.cids.insert(scid.to_vec(), i);
+        let agent = &mut self.agents[i];
+        agent.conn = Some(conn);
+        agent.state = AgentState::Handshaking;
+        agent.started = Instant::now();
+        self.connecting += 1;
+        self.mark_dirty(i);
+        Ok(())
+    }
+
+    /// Round-robin over Agents that are still registered
+    fn next_registered(&mut self) -> Option<usize> {
+        for _ in 0..self.registered.len() {
+            let i = self.registered[self.rr % self.registered.len()];
+            self.rr = self.rr.wrapping_add(1);
+            if self.agents[i].state == AgentState::Registered {
+                return Some(i);
+            }
+        }
+        None
+    }
+
+    fn send_probe(&mut self, i: usize, sent_us: u64) {
+        let dst = self.cfg.dst;
+        let agent = &mut self.agents[i];
+        let Some(conn) = agent.conn.as_mut() else {
+            return;
+        };
+
+        let (key, packet) = match self.cfg.proto {
+            Proto::Udp => {
+                let seq = agent.next_seq;
+                agent.next_seq += 1;
+                let mut payload = vec![0u8; self.cfg.payload_size];
+                payload[..PROBE_HEADER_LEN].copy_from_slice(&seq.to_be_bytes());
+                let src = SocketAddrV4::new(agent.src, UDP_SRC_PORT);
+                (seq, build_ip_udp_packet(src, dst, &payload))
+            }
+            Proto::Tcp => {
+                let port = agent.next_port;
+                agent.next_port = port.checked_add(1).unwrap_or(TCP_PORT_BASE);
+                let isn = agent.next_seq as u32;
+                agent.next_seq += 1;
+                let src = SocketAddrV4::new(agent.src, port);
+                (
+                    port as u64,
+                    build_ip_tcp_packet(src, dst, isn, 0, TCP_SYN, &[]),
+                )
+            }
+        };
+
+        self.stats.sent += 1;
+        match conn.dgram_send(&packet) {
+            Ok(()) => {
+                self.stats.bytes_sent += packet.len() as u64;
+                agent.pending.insert(key, sent_us);
+            }
+            Err(e) => {
+                log::trace!("Agent {} dgram_send failed: {:?}", i, e);
+                self.stats.send_errors += 1;
+                return;
+            }
+        }
+        self.mark_dirty(i);
+    }
+
+    fn on_datagram(&mut self, i: usize, data: &[u8]) {
+        match data.first() {
+            Some(&REG_TYPE_ACK) => {
+                let agent = &mut self.agents[i];
+                if agent.state != AgentState::Registering {
+                    return;
+                }
+                if data.get(1) == Some(&0x00) {
+                    agent.state = AgentState::Registered;
+                    self.connecting -= 1;
+                    self.stats.registered += 1;
+                    self.registered.push(i);
+                } else {
+                    self.fail(i, "registration rejected");
+                }
+            }
+            Some(&REG_TYPE_NACK) => self.fail(i, "registration NACK"),
+            // QAD observed-address report
+            Some(0x01) if data.len() == 7 => {}
+            Some(b) if b >> 4 == 4 => self.on_response(i, data),
+            _ => self.stats.unmatched += 1,
+        }
+    }
+
+    fn on_response(&mut self, i: usize, packet: &[u8]) {
+        let Some(key) = response_key(self.cfg.proto, packet) else {
+            self.stats.unmatched += 1;
+            return;
+        };
+        let now_us = self.now_us();
+        let agent = &mut self.agents[i];
+        let Some(sent_us) = agent.pending.remove(&key) else {
+            // Late reply for an expired probe, or a retransmitted SYN-ACK
+            self.stats.unmatched += 1;
+            return;
+        };
+
+        let latency = now_us.saturating_sub(sent_us).max(1);
+        self.stats.latency_us.saturating_record(latency);
+        self.stats.interval_latency_us.saturating_record(latency);
+        self.stats.received += 1;
+        self.stats.bytes_received += packet.len() as u64;
+
+        // Tear down TCP flows the Connector accepted so its session table
+        // does not fill up (MAX_TCP_SESSIONS)
+        if self.cfg.proto == Proto::Tcp {
+            let ihl = (packet[0] & 0x0F) as usize * 4;
+            let Some(tcp) = packet.get(ihl..ihl + 20) else {
+                return;
+            };
+            if tcp[13] & (TCP_SYN | TCP_ACK) == (TCP_SYN | TCP_ACK) {
+                let ack = u32::from_be_bytes([tcp[8], tcp[9], tcp[10], tcp[11]]);
+                let service_ip = Ipv4Addr::new(packet[12], packet[13], packet[14], packet[15]);
+                let service_port = u16::from_be_bytes([tcp[0], tcp[1]]);
+                let rst = build_ip_tcp_packet(
+                    SocketAddrV4::new(agent.src, key as u16),
+                    SocketAddrV4::new(service_ip, service_port),
+                    ack,
+                    0,
+                    TCP_RST,
+                    &[],
+                );
+                if let Some(conn) = agent.conn.as_mut() {
+                    let _ = conn.dgram_send(&rst);
+                }
+            }
+        }
+    }
+
+    fn fail(&mut self, i: usize, reason: &str) {
+        let agent = &mut self.agents[i];
+        match agent.state {
+            AgentState::Handshaking => {
+                self.stats.handshakes_failed += 1;
+                self.connecting -= 1;
+            }
+            AgentState::Registering => {
+                self.stats.registrations_failed += 1;
+                self.connecting -= 1;
+            }
+            AgentState::Registered => self.stats.agents_lost += 1,
+            AgentState::Idle | AgentState::Failed => return,
+        }
+        log::debug!("Agent {} failed: {}", i, reason);
+        agent.state = AgentState::Failed;
+        self.stats.lost += agent.pending.len() as u64;
+        agent.pending.clear();
+        if let Some(conn) = agent.conn.as_mut() {
+            let _ = conn.close(false, 0x00, b"");
+        }
+        self.mark_dirty(i);
+    }
+
+    /// Count probes without a reply after PROBE_TIMEOUT as lost
+    fn expire_probes(&mut self) {
+        let cutoff = self
+            .now_us()
+            .saturating_sub(PROBE_TIMEOUT.as_micros() as u64);
+        for agent in &mut self.agents {
+            let before = agent.pending.len();
+            agent.pending.retain(|_, sent_us| *sent_us >= cutoff);
+            self.stats.lost += (before - agent.pending.len()) as u64;
+        }
+    }
+
+    // ------------------------------------------------------------------
+    // I/O
+    // ------------------------------------------------------------------
+
+    fn mark_dirty(&mut self, i: usize) {
+        if !self.is_dirty[i] {
+            self.is_dirty[i] = true;
+            self.dirty.push(i);
+        }
+    }
+
+    /// One event-loop iteration: read sockets, fire QUIC timers, then
+    /// process and flush every Agent that was touched.
+    fn io_tick(&mut self, timeout: Duration) -> Result<(), Box<dyn std::error::Error>> {
+        let next_timer = self
+            .timers
+            .peek()
+            .map(|Reverse((t, _))| t.saturating_duration_since(Instant::now()));
+        let timeout = if self.dirty.is_empty() {
+            next_timer.map_or(timeout, |t| t.min(timeout))
+        } else {
+            Duration::ZERO
+        };
+        self.poll.poll(&mut self.events, Some(timeout))?;
+
+        let readable: Vec<usize> = self.events.iter().map(|e| e.token().0).collect();
+        for s in readable {
+            self.read_socket(s);
+        }
+
+        let now = Instant::now();
+        while let Some(&Reverse((t, i))) = self.timers.peek() {
+            if t > now {
+                break;
+            }
+            self.timers.pop();
+            if self.agents[i].timer != Some(t) {
+                continue;
+            }
+            self.agents[i].timer = None;
+            if let Some(conn) = self.agents[i].conn.as_mut() {
+                conn.on_timeout();
+            }
+            self.mark_dirty(i);
+        }
+
+        let dirty = std::mem::take(&mut self.dirty);
+        for i in dirty {
+            self.is_dirty[i] = false;
+            self.process_agent(i);
+        }
+        Ok(())
+    }
+
+    fn read_socket(&mut self, s: usize) {
+        let local = self.sockets[s].1;
+        loop {
+            let (len, from) = match self.sockets[s].0.recv_from(&mut self.recv_buf) {
+                Ok(v) => v,
+                Err(e) if e.kind() == io::ErrorKind::WouldBlock => break,
+                Err(e) => {
+                    log::debug!("Socket {} recv error: {}", s, e);
+                    break;
+                }
+            };
+
+            let index = match quiche::Header::from_slice(
+                &mut self.recv_buf[..len],
+                quiche::MAX_CONN_ID_LEN,
+            ) {
+                Ok(hdr) => self.cids.get(&hdr.dcid[..]).copied(),
+                Err(_) => None,
+            };
+            let Some(i) = index else {
+                log::trace!("Dropping {} bytes with unknown DCID", len);
+                continue;
+            };
+
+            if let Some(conn) = self.agents[i].conn.as_mut() {
+                let info = quiche::RecvInfo { from, to: local };
+                if let Err(e) = conn.recv(&mut self.recv_buf[..len], info) {
+                    log::trace!("Agent {} QUIC recv error: {:?}", i, e);
+                }
+            }
+            self.mark_dirty(i);
+        }
+    }
+
+    fn process_agent(&mut self, i: usize) {
+        let agent = &mut self.agents[i];
+        let Some(conn) = agent.conn.as_mut() else {
+            return;
+        };
+
+        if agent.state == AgentState::Handshaking && conn.is_established() {
+            let service = &self.cfg.services[agent.service];
+            let mut msg = Vec::with_capacity(2 + service.len());
+            msg.push(REG_TYPE_AGENT);
+            msg.push(service.len() as u8);
+            msg.extend_from_slice(service.as_bytes());
+            let registered = conn.dgram_send(&msg);
+
+            self.stats.handshakes_ok += 1;
+            self.stats
+                .handshake_us
+                .saturating_record((agent.started.elapsed().as_micros() as u64).max(1));
+            agent.state = AgentState::Registering;
+            if registered.is_err() {
+                self.fail(i, "could not queue registration");
+            }
+        }
+
+        let mut buf = std::mem::take(&mut self.dgram_buf);
+        loop {
+            let Some(conn) = self.agents[i].conn.as_mut() else {
+                break;
+            };
+            let len = match conn.dgram_recv(&mut buf) {
+                Ok(len) => len,
+                Err(_) => break,
+            };
+            self.on_datagram(i, &buf[..len]);
+        }
+        self.dgram_buf = buf;
+
+        if self.agents[i].conn.as_ref().is_some_and(|c| c.is_closed()) {
+            self.fail(i, "connection closed");
+        }
+
+        self.flush_agent(i);
+    }
+
+    fn flush_agent(&mut self, i: usize) {
+        let agent = &mut self.agents[i];
+        let Some(conn) = agent.conn.as_mut() else {
+            return;
+        };
+        let socket = &self.sockets[agent.socket].0;
+
+        loop {
+            match conn.send(&mut self.send_buf) {
+                Ok((len, send_info)) => {
+                    if let Err(e) = socket.send_to(&self.send_buf[..len], send_info.to) {
+                        // Socket buffer full: QUIC loss recovery will resend
+                        log::trace!("Agent {} send_to failed: {}", i, e);
+                        self.stats.socket_drops += 1;
+                    }
+                }
+                Err(quiche::Error::Done) => break,
+                Err(e) => {
+                    log::debug!("Agent {} QUIC send error: {:?}", i, e);
+                    break;
+                }
+            }
+        }
+
+        let timeout = conn.timeout_instant();
+        if timeout != agent.timer {
+            agent.timer = timeout;
+            if let Some(t) = timeout {
+                self.timers.push(Reverse((t, i)));
+            }
+        }
+    }
+
+    // ------------------------------------------------------------------
+    // Report
+    // ------------------------------------------------------------------
+
+    fn report(&self, connect: Duration, traffic: Duration) {
+        let s = &self.stats;
+        let connect_secs = connect.as_secs_f64().max(f64::EPSILON);
+        let traffic_secs = traffic.as_secs_f64().max(f64::EPSILON);
+        let handshake_rate = s.handshakes_ok as f64 / connect_secs;
+        let rx_pps = s.received as f64 / traffic_secs;
+        let rx_bps = s.bytes_received as f64 * 8.0 / traffic_secs;
+        let hs = &s.handshake_us;
+        let lat = &s.latency_us;
+
+        log::info!("Load test results:");
+        log::info!(
+            "  Handshakes: {} ok, {} failed, {:.1}/s (p50 {} µs, p99 {} µs)",
+            s.handshakes_ok,
+            s.handshakes_failed,
+            handshake_rate,
+            hs.value_at_quantile(0.50),
+            hs.value_at_quantile(0.99)
+        );
+        log::info!(
+            "  Registered: {} ({} rejected/timed out, {} lost mid-run)",
+            s.registered,
+            s.registrations_failed,
+            s.agents_lost
+        );
+        log::info!(
+            "  Probes:     {} sent, {} received, {} lost, {} send errors, {} unmatched",
+            s.sent,
+            s.received,
+            s.lost,
+            s.send_errors,
+            s.unmatched
+        );
+        log::info!(
+            "  Throughput: {:.0} pps, {:.2} Mbit/s received over {:?}",
+            rx_pps,
+            rx_bps / 1e6,
+            traffic
+        );
+        log::info!(
+            "  Latency:    min {} / p50 {} / p90 {} / p99 {} / p99.9 {} / max {} µs",
+            lat.min(),
+            lat.value_at_quantile(0.50),
+            lat.value_at_quantile(0.90),
+            lat.value_at_quantile(0.99),
+            lat.value_at_quantile(0.999),
+            lat.max()
+        );
+
+        // Output for parsing
+        println!("LOAD_AGENTS:{}", self.cfg.agents);
+        println!("LOAD_HANDSHAKES_OK:{}", s.handshakes_ok);
+        println!("LOAD_HANDSHAKES_FAILED:{}", s.handshakes_failed);
+        println!("LOAD_HANDSHAKE_RATE:{:.1}", handshake_rate);
+        println!("LOAD_HANDSHAKE_P50_US:{}", hs.value_at_quantile(0.50));
+        println!("LOAD_HANDSHAKE_P99_US:{}", hs.value_at_quantile(0.99));
+        println!("LOAD_HANDSHAKE_MAX_US:{}", hs.max());
+        println!("LOAD_REGISTERED:{}", s.registered);
+        println!("LOAD_SENT:{}", s.sent);
+        println!("LOAD_SEND_ERRORS:{}", s.send_errors);
+        println!("LOAD_RECEIVED:{}", s.received);
+        println!("LOAD_LOST:{}", s.lost);
+        println!("LOAD_SOCKET_DROPS:{}", s.socket_drops);
+        println!("LOAD_TX_BYTES:{}", s.bytes_sent);
+        println!("LOAD_RX_BYTES:{}", s.bytes_received);
+        println!("LOAD_RX_PPS:{:.1}", rx_pps);
+        println!("LOAD_RX_BPS:{:.0}", rx_bps);
+        println!("LOAD_LATENCY_MIN_US:{}", lat.min());
+        println!("LOAD_LATENCY_P50_US:{}", lat.value_at_quantile(0.50));
+        println!("LOAD_LATENCY_P90_US:{}", lat.value_at_quantile(0.90));
+        println!("LOAD_LATENCY_P99_US:{}", lat.value_at_quantile(0.99));
+        println!("LOAD_LATENCY_P999_US:{}", lat.value_at_quantile(0.999));
+        println!("LOAD_LATENCY_MAX_US:{}", lat.max());
+    }
+}
+
+// ============================================================================
+// Tests
+// ============================================================================
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn args(s: &str) -> Vec<String> {
+        std::iter::once("quic-test-client")
+            .chain(s.split_whitespace())
+            .map(str::to_string)
+            .collect()
+    }
+
+    #[test]
+    fn test_config_defaults() {
+        let cfg =
+            LoadConfig::from_args(&args("--load 1000 --service a,b --dst 127.0.0.1:9999")).unwrap();
+        assert_eq!(cfg.agents, 1000);
+        assert_eq!(cfg.services, vec!["a", "b"]);
+        assert_eq!(cfg.proto, Proto::Udp);
+        assert_eq!(cfg.schedule, Schedule::Open);
+        assert_eq!(cfg.sockets, 256);
+        assert_eq!(cfg.payload_size, 64);
+    }
+
+    #[test]
+    fn test_config_rejects_bad_input() {
+        assert!(LoadConfig::from_args(&args("--load 10 --dst 127.0.0.1:9999")).is_err());
+        assert!(LoadConfig::from_args(&args("--load 10 --service a")).is_err());
+        assert!(LoadConfig::from_args(&args(
+            "--load 10 --service a --dst 127.0.0.1:9999 --load-proto sctp"
+        ))
+        .is_err());
+        assert!(LoadConfig::from_args(&args(
+            "--load 10 --service a --dst 127.0.0.1:9999 --load-rate 0"
+        ))
+        .is_err());
+        // Unlimited rate is fine when the window bounds the load
+        assert!(LoadConfig::from_args(&args(
+            "--load 10 --service a --dst 127.0.0.1:9999 --load-rate 0 --load-schedule closed"
+        ))
+        .is_ok());
+    }
+
+    #[test]
+    fn test_config_clamps() {
+        let cfg = LoadConfig::from_args(&args(
+            "--load 4 --service a --dst 127.0.0.1:9999 --load-sockets 64 --payload-size 2",
+        ))
+        .unwrap();
+        assert_eq!(cfg.sockets, 4);
+        assert_eq!(cfg.payload_size, PROBE_HEADER_LEN);
+    }
+
+    #[test]
+    fn test_agent_ip() {
+        assert_eq!(agent_ip(0), Ipv4Addr::new(100, 64, 0, 1));
+        assert_eq!(agent_ip(255), Ipv4Addr::new(100, 64, 1, 0));
+        assert_eq!(agent_ip(65_535), Ipv4Addr::new(100, 65, 0, 0));
+    }
+
+    #[test]
+    fn test_response_key_udp_echo() {
+        let agent: SocketAddrV4 = "100.64.0.1:40000".parse().unwrap();
+        let service: SocketAddrV4 = "127.0.0.1:9999".parse().unwrap();
+        let mut payload = vec![0u8; 64];
+        payload[..8].copy_from_slice(&42u64.to_be_bytes());
+
+        // Echo reply comes back with addresses swapped
+        let reply = build_ip_udp_packet(service, agent, &payload);
+        assert_eq!(response_key(Proto::Udp, &reply), Some(42));
+        assert_eq!(response_key(Proto::Tcp, &reply), None);
+    }
+
+    #[test]
+    fn test_response_key_tcp_synack() {
+        let agent: SocketAddrV4 = "100.64.0.1:1500".parse().unwrap();
+        let service: SocketAddrV4 = "127.0.0.1:8080".parse().unwrap();
+
+        let reply = build_ip_tcp_packet(service, agent, 7, 1, TCP_SYN | TCP_ACK, &[]);
+        assert_eq!(response_key(Proto::Tcp, &reply), Some(1500));
+        assert_eq!(response_key(Proto::Udp, &reply), None);
+    }
+
+    #[test]
+    fn test_response_key_rejects_garbage() {
+        assert_eq!(response_key(Proto::Udp, &[]), None);
+        assert_eq!(response_key(Proto::Udp, &[0x60; 40]), None);
+        // UDP reply too short to carry the sequence number
+        let short = build_ip_udp_packet(
+            "127.0.0.1:9999".parse().unwrap(),
+            "100.64.0.1:40000".parse().unwrap(),
+            &[1, 2, 3],
+        );
+        assert_eq!(response_key(Proto::Udp, &short), None);
+    }
+}
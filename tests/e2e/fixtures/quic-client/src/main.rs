@@ -15,6 +15,9 @@
 //!
 //! Phase 6 - Performance Metrics:
 //!   quic-test-client --service test --measure-rtt --rtt-count 100 --dst 127.0.0.1:9999
+//!
+//! Load generation (many simulated Agents, see load.rs):
+//!   quic-test-client --load 2000 --service test --dst 127.0.0.1:9999 --load-rate 20000
 
 use std::io::{self, BufRead, Write};
 use std::net::{SocketAddr, SocketAddrV4};
@@ -24,12 +27,14 @@ use mio::net::UdpSocket;
 use mio::{Events, Interest, Poll, Token};
 use ring::rand::{SecureRandom, SystemRandom};
 
+mod load;
+
 // ============================================================================
 // Constants (MUST match Intermediate Server and App Connector)
 // ============================================================================
 
 /// Maximum UDP payload size for QUIC packets
-const MAX_DATAGRAM_SIZE: usize = 1350;
+const MAX_DATAGRAM_SIZE: usize = 1472;
 
 /// QUIC idle timeout in milliseconds
 const IDLE_TIMEOUT_MS: u64 = 30_000;
@@ -68,6 +73,8 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
     let expect_connect_fail = args.iter().any(|a| a == "--expect-fail");
     // Phase 3.5: Query max DATAGRAM size programmatically
     let query_max_size = args.iter().any(|a| a == "--query-max-size");
+    // Enable DPLPMTUD and let probes run for N ms before querying the size
+    let pmtud_ms: Option<u64> = parse_arg(&args, "--pmtud").and_then(|s| s.parse().ok());
 
     // Phase 4: Advanced testing options
     let payload_pattern = parse_arg(&args, "--payload-pattern");
@@ -108,6 +115,18 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         .unwrap_or_else(|| ALPN_PROTOCOL.to_vec());
     let alpn_str = String::from_utf8_lossy(&alpn_bytes);
 
+    // Load generation mode: many simulated Agents, one connection each
+    if args.iter().any(|a| a == "--load") {
+        let load_config = load::LoadConfig::from_args(&args)?;
+        let quic_config = build_quic_config(
+            &alpn_bytes,
+            client_cert_path.as_deref(),
+            client_key_path.as_deref(),
+            ca_cert_path.as_deref(),
+        )?;
+        return load::LoadGenerator::new(load_config, quic_config, server_addr)?.run();
+    }
+
     log::info!("QUIC Test Client");
     log::info!("  Server: {}", server_addr);
     log::info!("  ALPN:   {:?}", alpn_str);
@@ -135,6 +154,9 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         client_key_path.as_deref(),
         ca_cert_path.as_deref(),
     )?;
+    if pmtud_ms.is_some() {
+        client.config.discover_pmtu(true);
+    }
 
     // Connect and establish QUIC session (with optional handshake timing)
     let handshake_start = Instant::now();
@@ -166,6 +188,12 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         }
     }
 
+    // Give PMTU probes time to be acknowledged so the query reflects the
+    // discovered path MTU rather than the 1200-byte starting size
+    if let Some(ms) = pmtud_ms {
+        client.wait_for_responses(Duration::from_millis(ms))?;
+    }
+
     // Query and display max DATAGRAM size (Phase 3.5: programmatic sizing)
     let max_dgram_size = client.get_max_datagram_size();
     if query_max_size || max_dgram_size.is_some() {
@@ -499,6 +527,7 @@ fn print_usage() {
     eprintln!();
     eprintln!("Phase 3.5 - Programmatic DATAGRAM Sizing:");
     eprintln!("  --query-max-size   Print MAX_DGRAM_SIZE and MAX_UDP_PAYLOAD after connection");
+    eprintln!("  --pmtud MS         Enable PMTU discovery and probe for MS ms before sizing");
     eprintln!();
     eprintln!("Phase 6A - mTLS Client Authentication:");
     eprintln!("  --client-cert PATH Client certificate PEM file for mTLS");
@@ -517,6 +546,26 @@ fn print_usage() {
     eprintln!("  --rtt-count N        Number of RTT samples to collect (default: 10)");
     eprintln!("  --measure-handshake  Measure QUIC handshake time (outputs HANDSHAKE_US)");
     eprintln!();
+    eprintln!("Load Generation:");
+    eprintln!("  --load N             Simulate N Agents, each with its own QUIC connection");
+    eprintln!(
+        "                       (--service takes a comma-separated list, assigned round-robin)"
+    );
+    eprintln!("  --load-proto P       Traffic: udp (echo probes, default) or tcp (SYN probes)");
+    eprintln!("  --load-schedule S    open (fixed timetable, default) or closed (--load-window)");
+    eprintln!("  --load-rate PPS      Aggregate probes per second (default: 1000; 0 = unlimited, closed only)");
+    eprintln!(
+        "  --load-window N      Outstanding probes per Agent in closed schedule (default: 1)"
+    );
+    eprintln!("  --load-duration S    Traffic phase length in seconds (default: 10)");
+    eprintln!(
+        "  --load-ramp CPS      Handshakes started per second (default: 500; 0 = all at once)"
+    );
+    eprintln!("  --load-sockets N     UDP sockets shared by the Agents (default: min(N, 256))");
+    eprintln!(
+        "                       --payload-size sets the UDP probe size, --wait the drain time"
+    );
+    eprintln!();
     eprintln!("  -h, --help         Show this help");
     eprintln!();
     eprintln!("Examples:");
@@ -526,8 +575,8 @@ fn print_usage() {
     eprintln!("  # Test ALPN validation (negative test - expect failure)");
     eprintln!("  quic-test-client --alpn 'wrong-protocol' --expect-fail");
     eprintln!();
-    eprintln!("  # Test MAX_DATAGRAM_SIZE boundary (1350 bytes)");
-    eprintln!("  quic-test-client --service test-service --payload-size 1322 --dst 127.0.0.1:9999");
+    eprintln!("  # Test MAX_DATAGRAM_SIZE boundary (1472 bytes)");
+    eprintln!("  quic-test-client --service test-service --payload-size 1444 --dst 127.0.0.1:9999");
     eprintln!();
     eprintln!("  # Phase 4: Echo integrity with random payload");
     eprintln!(
@@ -544,6 +593,10 @@ fn print_usage() {
     eprintln!("  # Phase 6: Measure handshake time");
     eprintln!("  quic-test-client --measure-handshake --service test-service --send-udp 'test' --dst 127.0.0.1:9999");
     eprintln!();
+    eprintln!("  # Load test: 2000 Agents, 20k pps open-loop for 30s (outputs LOAD_* statistics)");
+    eprintln!("  quic-test-client --load 2000 --service test-service --dst 127.0.0.1:9999 \\");
+    eprintln!("    --load-rate 20000 --load-duration 30");
+    eprintln!();
     eprintln!("  # Just connect (no relay, receives QAD only)");
     eprintln!("  quic-test-client --server 127.0.0.1:4433");
 }
@@ -732,6 +785,110 @@ fn ip_checksum(header: &[u8]) -> u16 {
     !sum as u16
 }
 
+/// Build an IPv4/TCP segment (20-byte header, no options) with the given payload.
+/// Used by the load generator to probe the App Connector's TCP proxy.
+fn build_ip_tcp_packet(
+    src: SocketAddrV4,
+    dst: SocketAddrV4,
+    seq: u32,
+    ack: u32,
+    flags: u8,
+    payload: &[u8],
+) -> Vec<u8> {
+    let total_len = (20 + 20 + payload.len()) as u16;
+    let mut packet = Vec::with_capacity(total_len as usize);
+
+    // === IPv4 Header (20 bytes) ===
+    packet.push(0x45);
+    packet.push(0x00);
+    packet.extend_from_slice(&total_len.to_be_bytes());
+    packet.extend_from_slice(&0u16.to_be_bytes());
+    packet.extend_from_slice(&0x4000u16.to_be_bytes());
+    packet.push(64);
+    // Protocol (TCP = 6)
+    packet.push(6);
+    packet.extend_from_slice(&0u16.to_be_bytes());
+    packet.extend_from_slice(&src.ip().octets());
+    packet.extend_from_slice(&dst.ip().octets());
+
+    let checksum = ip_checksum(&packet[..20]);
+    packet[10..12].copy_from_slice(&checksum.to_be_bytes());
+
+    // === TCP Header (20 bytes) ===
+    packet.extend_from_slice(&src.port().to_be_bytes());
+    packet.extend_from_slice(&dst.port().to_be_bytes());
+    packet.extend_from_slice(&seq.to_be_bytes());
+    packet.extend_from_slice(&ack.to_be_bytes());
+    // Data offset (5 words), no options
+    packet.push(0x50);
+    packet.push(flags);
+    // Window
+    packet.extend_from_slice(&65535u16.to_be_bytes());
+    // Checksum (placeholder) + urgent pointer
+    packet.extend_from_slice(&[0, 0, 0, 0]);
+
+    // === Payload ===
+    packet.extend_from_slice(payload);
+
+    // TCP checksum covers the pseudo-header (src, dst, proto, TCP length) + segment
+    let segment_len = (packet.len() - 20) as u16;
+    let mut pseudo = Vec::with_capacity(12 + segment_len as usize);
+    pseudo.extend_from_slice(&src.ip().octets());
+    pseudo.extend_from_slice(&dst.ip().octets());
+    pseudo.extend_from_slice(&[0, 6]);
+    pseudo.extend_from_slice(&segment_len.to_be_bytes());
+    pseudo.extend_from_slice(&packet[20..]);
+    let checksum = ip_checksum(&pseudo);
+    packet[36..38].copy_from_slice(&checksum.to_be_bytes());
+
+    packet
+}
+
+/// Client-side quiche configuration shared by single-connection and load modes
+fn build_quic_config(
+    alpn: &[u8],
+    client_cert: Option<&str>,
+    client_key: Option<&str>,
+    ca_cert: Option<&str>,
+) -> Result<quiche::Config, Box<dyn std::error::Error>> {
+    let mut config = quiche::Config::new(quiche::PROTOCOL_VERSION)?;
+
+    // Set ALPN (allows override for testing)
+    config.set_application_protos(&[alpn])?;
+
+    // Enable DATAGRAM support
+    config.enable_dgram(true, 1000, 1000);
+
+    // Set timeouts and limits
+    config.set_max_idle_timeout(IDLE_TIMEOUT_MS);
+    config.set_max_recv_udp_payload_size(MAX_DATAGRAM_SIZE);
+    config.set_max_send_udp_payload_size(MAX_DATAGRAM_SIZE);
+    config.set_initial_max_data(10_000_000);
+    config.set_initial_max_stream_data_bidi_local(1_000_000);
+    config.set_initial_max_stream_data_bidi_remote(1_000_000);
+    config.set_initial_max_streams_bidi(100);
+    config.set_initial_max_streams_uni(100);
+
+    // 6A.9: Load client certificate and key for mTLS
+    if let (Some(cert_path), Some(key_path)) = (client_cert, client_key) {
+        config.load_cert_chain_from_pem_file(cert_path)?;
+        config.load_priv_key_from_pem_file(key_path)?;
+        log::info!("Loaded client certificate for mTLS");
+    }
+
+    // Load CA certificate for server verification
+    if let Some(ca_path) = ca_cert {
+        config.load_verify_locations_from_file(ca_path)?;
+        config.verify_peer(true);
+        log::info!("Loaded CA certificate, peer verification enabled");
+    } else {
+        // Disable certificate verification (for testing with self-signed certs)
+        config.verify_peer(false);
+    }
+
+    Ok(config)
+}
+
 // ============================================================================
 // QUIC Test Client
 // ============================================================================
@@ -755,41 +912,7 @@ impl QuicTestClient {
         client_key: Option<&str>,
         ca_cert: Option<&str>,
     ) -> Result<Self, Box<dyn std::error::Error>> {
-        // Create quiche client configuration
-        let mut config = quiche::Config::new(quiche::PROTOCOL_VERSION)?;
-
-        // Set ALPN (allows override for testing)
-        config.set_application_protos(&[alpn])?;
-
-        // Enable DATAGRAM support
-        config.enable_dgram(true, 1000, 1000);
-
-        // Set timeouts and limits
-        config.set_max_idle_timeout(IDLE_TIMEOUT_MS);
-        config.set_max_recv_udp_payload_size(MAX_DATAGRAM_SIZE);
-        config.set_max_send_udp_payload_size(MAX_DATAGRAM_SIZE);
-        config.set_initial_max_data(10_000_000);
-        config.set_initial_max_stream_data_bidi_local(1_000_000);
-        config.set_initial_max_stream_data_bidi_remote(1_000_000);
-        config.set_initial_max_streams_bidi(100);
-        config.set_initial_max_streams_uni(100);
-
-        // 6A.9: Load client certificate and key for mTLS
-        if let (Some(cert_path), Some(key_path)) = (client_cert, client_key) {
-            config.load_cert_chain_from_pem_file(cert_path)?;
-            config.load_priv_key_from_pem_file(key_path)?;
-            log::info!("Loaded client certificate for mTLS");
-        }
-
-        // Load CA certificate for server verification
-        if let Some(ca_path) = ca_cert {
-            config.load_verify_locations_from_file(ca_path)?;
-            config.verify_peer(true);
-            log::info!("Loaded CA certificate, peer verification enabled");
-        } else {
-            // Disable certificate verification (for testing with self-signed certs)
-            config.verify_peer(false);
-        }
+        let config = build_quic_config(alpn, client_cert, client_key, ca_cert)?;
 
         // Create poll and socket
         let poll = Poll::new()?;
@@ -1195,7 +1318,7 @@ mod tests {
 
     #[test]
     fn test_constants() {
-        assert_eq!(MAX_DATAGRAM_SIZE, 1350);
+        assert_eq!(MAX_DATAGRAM_SIZE, 1472);
         assert_eq!(ALPN_PROTOCOL, b"ztna-v1");
     }
 
@@ -1232,6 +1355,31 @@ mod tests {
         assert_eq!(&packet[28..], b"Hello");
     }
 
+    #[test]
+    fn test_build_ip_tcp_packet() {
+        let src: SocketAddrV4 = "100.64.0.1:40000".parse().unwrap();
+        let dst: SocketAddrV4 = "127.0.0.1:8080".parse().unwrap();
+
+        let packet = build_ip_tcp_packet(src, dst, 1000, 0, 0x02, &[]);
+
+        // IP header (20) + TCP header (20), no payload
+        assert_eq!(packet.len(), 40);
+        assert_eq!(packet[9], 6);
+        assert_eq!(&packet[20..22], &40000u16.to_be_bytes());
+        assert_eq!(&packet[22..24], &8080u16.to_be_bytes());
+        assert_eq!(&packet[24..28], &1000u32.to_be_bytes());
+        assert_eq!(packet[32], 0x50);
+        assert_eq!(packet[33], 0x02);
+
+        // Both checksums verify to zero when recomputed over the filled-in fields
+        assert_eq!(ip_checksum(&packet[..20]), 0);
+        let mut pseudo = Vec::new();
+        pseudo.extend_from_slice(&packet[12..20]);
+        pseudo.extend_from_slice(&[0, 6, 0, 20]);
+        pseudo.extend_from_slice(&packet[20..]);
+        assert_eq!(ip_checksum(&pseudo), 0);
+    }
+
     #[test]
     fn test_ip_checksum() {
         // Simple test with known header
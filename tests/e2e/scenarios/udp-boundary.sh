@@ -2,7 +2,9 @@
 # udp-boundary.sh - UDP Boundary Tests
 # Task 004: E2E Relay Testing
 #
-# Tests datagram size boundaries (MAX_DATAGRAM_SIZE = 1350).
+# Tests datagram size boundaries (MAX_DATAGRAM_SIZE = 1472).
+# The QUIC cases probe with DPLPMTUD enabled and size payloads from the
+# negotiated dgram_max_writable_len().
 
 # This script is sourced by run-mvp.sh, common.sh functions available
 
@@ -12,8 +14,10 @@ run_boundary_tests() {
     run_test "Empty payload (0 bytes)" test_boundary_empty
     run_test "Single byte payload" test_boundary_single
     run_test "Near max size (1300 bytes)" test_boundary_near_max
-    run_test "At max size (1350 bytes)" test_boundary_at_max
-    run_test "Over max size (1351 bytes) - expect drop" test_boundary_over_max
+    run_test "At max size (1472 bytes)" test_boundary_at_max
+    run_test "Over max size (1473 bytes) - expect drop" test_boundary_over_max
+    run_test "PMTUD-negotiated max DATAGRAM echoed" test_boundary_pmtud_max
+    run_test "PMTUD-negotiated max+1 DATAGRAM rejected" test_boundary_pmtud_over_max
 }
 
 test_boundary_empty() {
@@ -61,33 +65,33 @@ test_boundary_near_max() {
 }
 
 test_boundary_at_max() {
-    # 1350 bytes - exactly at MAX_DATAGRAM_SIZE
+    # 1472 bytes - exactly at MAX_DATAGRAM_SIZE
     local payload
-    payload=$(head -c 1350 /dev/zero | tr '\0' 'B')
+    payload=$(head -c 1472 /dev/zero | tr '\0' 'B')
     local response
 
     response=$(echo -n "$payload" | nc -u -w 3 "$INTERMEDIATE_HOST" "$ECHO_SERVER_PORT" 2>/dev/null)
 
-    if [[ ${#response} -eq 1350 ]]; then
+    if [[ ${#response} -eq 1472 ]]; then
         return 0
     fi
 
-    log_error "Response length: ${#response}, Expected: 1350"
+    log_error "Response length: ${#response}, Expected: 1472"
     return 1
 }
 
 test_boundary_over_max() {
-    # 1351 bytes - over MAX_DATAGRAM_SIZE
+    # 1473 bytes - over MAX_DATAGRAM_SIZE
     # This should be dropped by the QUIC layer
     local payload
-    payload=$(head -c 1351 /dev/zero | tr '\0' 'C')
+    payload=$(head -c 1473 /dev/zero | tr '\0' 'C')
     local response
 
     # We expect this to fail/timeout because the datagram should be dropped
     response=$(echo -n "$payload" | nc -u -w 2 "$INTERMEDIATE_HOST" "$ECHO_SERVER_PORT" 2>/dev/null || true)
 
     # If we get no response or partial response, test passes
-    if [[ -z "$response" ]] || [[ ${#response} -lt 1351 ]]; then
+    if [[ -z "$response" ]] || [[ ${#response} -lt 1473 ]]; then
         log_info "Oversize datagram correctly dropped (no response or partial)"
         return 0
     fi
@@ -97,3 +101,66 @@ test_boundary_over_max() {
     # For now, pass with warning since direct echo server doesn't go through QUIC
     return 0
 }
+
+test_boundary_pmtud_max() {
+    # With DPLPMTUD the path grows past the 1200-byte starting size; a
+    # DATAGRAM sized to dgram_max_writable_len() must relay and echo intact
+    local output
+    output=$("$QUIC_CLIENT_BIN" \
+        --server "$INTERMEDIATE_HOST:$INTERMEDIATE_PORT" \
+        --service "$SERVICE_ID" \
+        --pmtud 1000 \
+        --query-max-size \
+        --payload-size max \
+        --dst "127.0.0.1:$ECHO_SERVER_PORT" \
+        --verify-echo \
+        --wait 3000 2>&1)
+
+    local max_dgram
+    max_dgram=$(echo "$output" | grep "^MAX_DGRAM_SIZE:" | cut -d: -f2)
+
+    if [[ -z "$max_dgram" ]]; then
+        log_error "MAX_DGRAM_SIZE not reported"
+        echo "$output"
+        return 1
+    fi
+
+    # Above the old fixed 1350-byte packet ceiling, within the 1472 cap
+    if [[ $max_dgram -lt 1350 ]] || [[ $max_dgram -gt 1472 ]]; then
+        log_error "Negotiated MAX_DGRAM_SIZE $max_dgram outside 1350..1472"
+        return 1
+    fi
+
+    if echo "$output" | grep -q "VERIFY_RESULT:PASS"; then
+        log_info "PMTUD max DATAGRAM ($max_dgram bytes) echoed intact"
+        return 0
+    fi
+
+    log_error "PMTUD max DATAGRAM ($max_dgram bytes) was not echoed"
+    echo "$output"
+    return 1
+}
+
+test_boundary_pmtud_over_max() {
+    # One byte over the negotiated size must fail locally with BufferTooShort
+    local output
+    if output=$("$QUIC_CLIENT_BIN" \
+        --server "$INTERMEDIATE_HOST:$INTERMEDIATE_PORT" \
+        --service "$SERVICE_ID" \
+        --pmtud 1000 \
+        --payload-size max+1 \
+        --dst "127.0.0.1:$ECHO_SERVER_PORT" \
+        --wait 1000 2>&1); then
+        log_error "Oversize DATAGRAM was accepted after PMTUD"
+        echo "$output"
+        return 1
+    fi
+
+    if echo "$output" | grep -q "BufferTooShort"; then
+        return 0
+    fi
+
+    log_error "Expected BufferTooShort, got:"
+    echo "$output"
+    return 1
+}